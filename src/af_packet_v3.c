@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
 #include <sys/mman.h>
 #include <poll.h>
@@ -30,6 +31,7 @@
 
 #include "safe_lib.h"
 #include "af_packet_v3.h"
+#include "affinity.h"
 #include "utils.h"
 
 /*
@@ -155,10 +157,12 @@ int sig_close_workers = 0; /* Packet proccessing var */
 
 extern void sig_close(int signal_arg);
 
-extern void joy_handler_function(void *handler_ctx, struct packet_info *pi, uint8_t *eth);
+extern void joy_handler_function(void *handler_ctx, struct pkt_desc *pi, uint8_t *eth);
+extern void joy_burst_handler_function(void *handler_ctx, struct pkt_desc **pi, uint8_t **eth, unsigned int num_frames);
+extern unsigned int joy_housekeeping_function(void *handler_ctx, unsigned int idle);
 
 /* A dummy callback function that just discards packet info */
-void dummy_callback(const struct packet_info *pi, const uint8_t *packet) {
+void dummy_callback(const struct pkt_desc *pi, const uint8_t *packet) {
   (void)pi;
   (void)packet;
   return;
@@ -169,8 +173,8 @@ void dummy_callback(const struct packet_info *pi, const uint8_t *packet) {
  * ethernet/ipv4 packet at the location passed in.
  *
  */
-void print_packet(const struct packet_info *pi, const uint8_t *packet) {
-  double when = pi->ts.tv_sec + (pi->ts.tv_nsec / 1000000000.0);
+void print_packet(const struct pkt_desc *pi, const uint8_t *packet) {
+  double when = pi->ts / 1000000000.0;
   unsigned int l3_proto = (((uint8_t *)packet)[12] << 8) | ((uint8_t *)packet)[13];
   packet += 14;
   uint32_t *ip = (uint32_t *)packet;
@@ -251,27 +255,42 @@ void process_all_packets_in_block(struct tpacket_block_desc *block_hdr,
   unsigned long byte_count = 0;
   struct tpacket3_hdr *pkt_hdr;
   //struct timespec ts;
-  struct packet_info pi;
+  struct pkt_desc pi[AF_PACKET_BURST];
+  struct pkt_desc *pip[AF_PACKET_BURST];
+  uint8_t *eth[AF_PACKET_BURST];
+  unsigned int n = 0;
 
   pkt_hdr = (struct tpacket3_hdr *) ((uint8_t *) block_hdr + block_hdr->hdr.bh1.offset_to_first_pkt);
   for (i = 0; i < num_pkts; ++i) {
     byte_count += pkt_hdr->tp_snaplen;
 
     /* Grab the times */
-    pi.ts.tv_sec = pkt_hdr->tp_sec;
-    pi.ts.tv_nsec = pkt_hdr->tp_nsec;
+    pi[n].ts = (uint64_t)pkt_hdr->tp_sec * 1000000000 + pkt_hdr->tp_nsec;
 
-    pi.caplen = pkt_hdr->tp_snaplen;
-    pi.len = pkt_hdr->tp_snaplen; // Is this right??
+    pi[n].caplen = pkt_hdr->tp_snaplen;
+    pi[n].len = pkt_hdr->tp_len;
 
-    uint8_t *eth = (uint8_t *)pkt_hdr + pkt_hdr->tp_mac;
-    //print_packet(&pi, eth);
-    //pc(&pi, eth);
+    eth[n] = (uint8_t *)pkt_hdr + pkt_hdr->tp_mac;
+    pip[n] = &pi[n];
+    //print_packet(&pi[n], eth[n]);
+    //pc(&pi[n], eth[n]);
+
+    /*
+     * the frames stay in the block until it is handed back to the
+     * kernel, so they can be gathered into bursts
+     */
+    if (handler->burst_func == NULL) {
+      handler->func(&handler->context, &pi[n], eth[n]);
+    } else if (++n == AF_PACKET_BURST) {
+      handler->burst_func(&handler->context, pip, eth, n);
+      n = 0;
+    }
 
-    handler->func(&handler->context, &pi, eth);
-    
     pkt_hdr = (struct tpacket3_hdr *) ((uint8_t *)pkt_hdr + pkt_hdr->tp_next_offset);
   }
+  if (n) {
+    handler->burst_func(&handler->context, pip, eth, n);
+  }
 
   /* Atomic operations
    * https://gcc.gnu.org/onlinedocs/gcc-4.1.0/gcc/Atomic-Builtins.html
@@ -463,6 +482,44 @@ int create_dedicated_socket(struct thread_storage *thread_stor, int fanout_arg)
 }
 
 
+/*
+ * af_packet_monotonic_ns() returns the time of CLOCK_MONOTONIC in
+ * nanoseconds
+ */
+static uint64_t af_packet_monotonic_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * af_packet_housekeeping() calls the housekeeping function of the
+ * handler if it is due.  It is cheap enough to check after every
+ * block, which bounds the time between calls on a busy socket by the
+ * time it takes to process one block.
+ */
+static void af_packet_housekeeping(struct frame_handler *handler,
+				   uint64_t interval_ns,
+				   uint64_t *next_ns,
+				   unsigned int *idle) {
+  uint64_t now;
+
+  if (handler->housekeeping_func == NULL) {
+    return;
+  }
+  now = af_packet_monotonic_ns();
+  if (now < *next_ns) {
+    return;
+  }
+  if (handler->housekeeping_func(&handler->context, *idle)) {
+    *next_ns = now; /* work left over, so do more at the next block */
+  } else {
+    *next_ns = now + interval_ns;
+  }
+  *idle = 1;
+}
+
 int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
 
   unsigned int b;
@@ -563,11 +620,22 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
   int pstreak = 0;
   int polret;
   unsigned int cb = 0;
+
+  /*
+   * Flows are expired and the output is flushed by the housekeeping
+   * function of the handler, on a clock rather than a packet count;
+   * poll() wakes up often enough to run it on an idle link too.
+   */
+  uint64_t housekeeping_ns = (uint64_t)thread_stor->housekeeping_ms * 1000000;
+  uint64_t next_housekeeping = af_packet_monotonic_ns() + housekeeping_ns;
+  unsigned int idle = 1;
+  int poll_timeout = thread_stor->housekeeping_ms < 1000 ? thread_stor->housekeeping_ms : 1000;
+
   while (sig_close_workers == 0) {
 
     if ((block_header[cb]->hdr.bh1.block_status & TP_STATUS_USER) == 0) {
 
-      polret = poll(&psockfd, 1, 1000); /* Let poll wait up to a second */
+      polret = poll(&psockfd, 1, poll_timeout);
       if (polret < 0) {
 	perror("poll returned error");
       } else if (polret > 0) {
@@ -578,6 +646,7 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
       if (pstreak > 2) {
 	cb = (cb + 1) % thread_block_count; /* Go find the block the kernel is stuck on */
       }
+      af_packet_housekeeping(handler, housekeeping_ns, &next_housekeeping, &idle);
       continue;
     }
 
@@ -585,6 +654,8 @@ int af_packet_rx_ring_fanout_capture(struct thread_storage *thread_stor) {
     pstreak = 0; /* Reset the poll streak tracking */
     process_all_packets_in_block(block_header[cb], statst, handler);
     block_header[cb]->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    idle = 0;
+    af_packet_housekeeping(handler, housekeeping_ns, &next_housekeeping, &idle);
 
     cb = (cb + 1) % thread_block_count;
   }
@@ -696,12 +767,24 @@ int af_packet_bind_and_dispatch(struct mercury_config *cfg,
       tstor[thread].t_start_c = &t_start_c;
       tstor[thread].t_start_m = &t_start_m;
       tstor[thread].handler.func = joy_handler_function;
+      tstor[thread].handler.burst_func = joy_burst_handler_function;
+      tstor[thread].handler.housekeeping_func = joy_housekeeping_function;
       tstor[thread].handler.context.joy_data.thread_id = thread;
       tstor[thread].handler.context.joy_data.packet_cnt = 0;
+      tstor[thread].handler.context.joy_data.status_cnt = 0;
+      tstor[thread].handler.context.joy_data.flushed = 0;
+      tstor[thread].housekeeping_ms = cfg->housekeeping_ms ? cfg->housekeeping_ms : AF_PACKET_HOUSEKEEPING_MS;
 
       memcpy(&(tstor[thread].ring_params), &thread_ring_req, sizeof(thread_ring_req));
 
+      /* the kernel allocates the ring on the node this thread prefers */
+      if (cfg->ring_node >= 0) {
+	  affinity_prefer_node(cfg->ring_node);
+      }
       err = create_dedicated_socket(&(tstor[thread]), fanout_arg);
+      if (cfg->ring_node >= 0) {
+	  affinity_prefer_node(-1);
+      }
 
       if (err != 0) {
 	  fprintf(stderr, "error creating dedicated socket for thread %d\n", thread);
@@ -737,6 +820,13 @@ int af_packet_start_processing(struct mercury_config *cfg) {
       fprintf(stderr, "%s: error creating af_packet capture thread %u\n", strerror(err), thread);
       exit(255);
     }
+    pthread_attr_destroy(&thread_attributes);
+
+    /* the threads wait for the clean start, so they are pinned before capturing */
+    if (cfg->thread_cpu && cfg->thread_cpu[thread] >= 0 &&
+	affinity_pin(tstor[thread].tid, cfg->thread_cpu[thread]) != 0) {
+      fprintf(stderr, "could not pin af_packet capture thread %u to cpu %d\n", thread, cfg->thread_cpu[thread]);
+    }
   }
 
   /* At this point all threads are started but they're waiting on
@@ -0,0 +1,736 @@
+/*
+ * af_xdp.c
+ *
+ * live capture through AF_XDP sockets; see af_xdp.h
+ *
+ * The XDP program and the map of sockets it redirects to are set up
+ * with the bpf() system call directly, so that no BPF toolchain or
+ * libbpf is needed to build joy.  References:
+ *
+ *  https://www.kernel.org/doc/html/latest/networking/af_xdp.html
+ *  https://www.kernel.org/doc/html/latest/bpf/instruction-set.html
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+
+/*
+ * struct bpf_insn of linux/bpf.h, an eBPF instruction, has the name
+ * of the classic BPF instruction of pcap/bpf.h, which joy_api.h pulls
+ * in, so it goes by another name here
+ */
+#define bpf_insn ebpf_insn
+#include <linux/bpf.h>
+#undef bpf_insn
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <linux/sockios.h>
+
+#include "safe_lib.h"
+#include "af_xdp.h"
+#include "affinity.h"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/*
+ * the channel counts of struct ethtool_channels and the command that
+ * gets them, from linux/ethtool.h, which does not build cleanly with
+ * -Wsystem-headers
+ */
+#define AF_XDP_ETHTOOL_GCHANNELS 0x0000003c
+
+struct af_xdp_ethtool_channels {
+  uint32_t cmd;
+  uint32_t max_rx;
+  uint32_t max_tx;
+  uint32_t max_other;
+  uint32_t max_combined;
+  uint32_t rx_count;
+  uint32_t tx_count;
+  uint32_t other_count;
+  uint32_t combined_count;
+};
+
+extern int sig_close_flag;
+extern int sig_close_workers;
+
+extern void joy_handler_function(void *handler_ctx, struct pkt_desc *pi, uint8_t *eth);
+extern void joy_burst_handler_function(void *handler_ctx, struct pkt_desc **pi, uint8_t **eth, unsigned int num_frames);
+extern unsigned int joy_housekeeping_function(void *handler_ctx, unsigned int idle);
+
+static int bpf_syscall(enum bpf_cmd cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+ * xsk_map_create() returns the file descriptor of a new XSKMAP with
+ * an entry for each of num_queues queues, or -1 on failure
+ */
+static int xsk_map_create(unsigned int num_queues) {
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type = BPF_MAP_TYPE_XSKMAP;
+  attr.key_size = sizeof(uint32_t);
+  attr.value_size = sizeof(uint32_t);
+  attr.max_entries = num_queues;
+  return bpf_syscall(BPF_MAP_CREATE, &attr);
+}
+
+/*
+ * xsk_map_set() enters the socket sockfd into the XSKMAP map_fd as
+ * the one of queue, and returns 0 on success
+ */
+static int xsk_map_set(int map_fd, uint32_t queue, int sockfd) {
+  union bpf_attr attr;
+  uint32_t fd = sockfd;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd = map_fd;
+  attr.key = (uint64_t)(uintptr_t)&queue;
+  attr.value = (uint64_t)(uintptr_t)&fd;
+  attr.flags = BPF_ANY;
+  return bpf_syscall(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+/*
+ * xdp_prog_load() returns the file descriptor of an XDP program that
+ * is equivalent to
+ *
+ *    return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS);
+ *
+ * where xsks is the XSKMAP map_fd, so packets of a queue without a
+ * socket go on to the network stack; or -1 on failure
+ */
+static int xdp_prog_load(int map_fd) {
+  struct ebpf_insn prog[] = {
+    /* r2 = ctx->rx_queue_index */
+    { .code = BPF_LDX | BPF_W | BPF_MEM, .dst_reg = BPF_REG_2, .src_reg = BPF_REG_1,
+      .off = offsetof(struct xdp_md, rx_queue_index) },
+    /* r1 = map_fd, which the kernel turns into the address of the map */
+    { .code = BPF_LD | BPF_DW | BPF_IMM, .dst_reg = BPF_REG_1, .src_reg = BPF_PSEUDO_MAP_FD,
+      .imm = map_fd },
+    { 0 },
+    /* r3 = XDP_PASS, returned if the map has no socket for the queue */
+    { .code = BPF_ALU64 | BPF_MOV | BPF_K, .dst_reg = BPF_REG_3, .imm = XDP_PASS },
+    { .code = BPF_JMP | BPF_CALL, .imm = BPF_FUNC_redirect_map },
+    { .code = BPF_JMP | BPF_EXIT },
+  };
+  static const char license[] = "BSD";
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type = BPF_PROG_TYPE_XDP;
+  attr.expected_attach_type = BPF_XDP;
+  attr.insns = (uint64_t)(uintptr_t)prog;
+  attr.insn_cnt = sizeof(prog) / sizeof(prog[0]);
+  attr.license = (uint64_t)(uintptr_t)license;
+  return bpf_syscall(BPF_PROG_LOAD, &attr);
+}
+
+/*
+ * xdp_prog_attach() attaches the program prog_fd to the interface
+ * ifindex in the mode of xdp_flags, and returns the file descriptor
+ * of the link, or -1 on failure; the program is detached when the
+ * link is closed, which includes the exit of the process
+ */
+static int xdp_prog_attach(int prog_fd, int ifindex, uint32_t xdp_flags) {
+  union bpf_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = prog_fd;
+  attr.link_create.target_ifindex = ifindex;
+  attr.link_create.attach_type = BPF_XDP;
+  attr.link_create.flags = xdp_flags;
+  return bpf_syscall(BPF_LINK_CREATE, &attr);
+}
+
+/*
+ * get_interface_queues() returns the number of receive queues of the
+ * interface if_name, or 1 if the driver does not report them
+ */
+static unsigned int get_interface_queues(const char *if_name) {
+  struct af_xdp_ethtool_channels channels;
+  struct ifreq ifr;
+  unsigned int queues = 1;
+  int fd;
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return queues;
+  }
+  memset(&ifr, 0, sizeof(ifr));
+  memset(&channels, 0, sizeof(channels));
+  strncpy_s(ifr.ifr_name, sizeof(ifr.ifr_name), if_name, sizeof(ifr.ifr_name) - 1);
+  channels.cmd = AF_XDP_ETHTOOL_GCHANNELS;
+  ifr.ifr_data = (void *)&channels;
+  if (ioctl(fd, SIOCETHTOOL, &ifr) == 0) {
+    queues = channels.rx_count + channels.combined_count;
+    if (queues == 0) {
+      queues = 1;
+    }
+  }
+  close(fd);
+  return queues;
+}
+
+/*
+ * xsk_ring_map() maps the ring of num_desc descriptors of desc_size
+ * bytes at offset pgoff of the socket sockfd, whose offsets are given
+ * by off, and returns 0 on success
+ */
+static int xsk_ring_map(int sockfd, struct xsk_ring *ring, const struct xdp_ring_offset *off,
+			uint32_t num_desc, size_t desc_size, uint64_t pgoff) {
+  uint8_t *map;
+
+  ring->map_len = off->desc + num_desc * desc_size;
+  map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, sockfd, pgoff);
+  if (map == MAP_FAILED) {
+    ring->map = NULL;
+    return -1;
+  }
+  ring->map = map;
+  ring->producer = (uint32_t *)(map + off->producer);
+  ring->consumer = (uint32_t *)(map + off->consumer);
+  ring->flags = (uint32_t *)(map + off->flags);
+  ring->desc = map + off->desc;
+  ring->mask = num_desc - 1;
+  return 0;
+}
+
+static void xsk_ring_unmap(struct xsk_ring *ring) {
+  if (ring->map != NULL) {
+    munmap(ring->map, ring->map_len);
+    ring->map = NULL;
+  }
+}
+
+/*
+ * create_xsk_socket() creates the AF_XDP socket of a thread with its
+ * UMEM and rings, and binds it to the queue of the thread, with
+ * bind_flags selecting the copy or zero-copy mode; it returns 0 on
+ * success
+ */
+static int create_xsk_socket(struct xsk_thread_storage *ts, int ifindex, uint16_t bind_flags) {
+  struct xdp_umem_reg umem_reg;
+  struct xdp_mmap_offsets off;
+  struct xdp_options options;
+  struct sockaddr_xdp sxdp;
+  socklen_t optlen;
+  uint32_t fill_size = AF_XDP_NUM_FRAMES;
+  uint32_t comp_size = AF_XDP_BURST;
+  uint32_t rx_size = AF_XDP_RING_SIZE;
+  uint64_t *fill_desc;
+  uint32_t i;
+
+  ts->sockfd = socket(AF_XDP, SOCK_RAW, 0);
+  if (ts->sockfd == -1) {
+    fprintf(stderr, "%s: could not create AF_XDP socket for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+
+  /*
+   * the UMEM is plain anonymous memory that the kernel pins when it
+   * is registered
+   */
+  ts->umem = (uint8_t *)mmap(NULL, (size_t)AF_XDP_NUM_FRAMES * AF_XDP_FRAME_SIZE,
+			     PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (ts->umem == MAP_FAILED) {
+    ts->umem = NULL;
+    fprintf(stderr, "%s: could not allocate UMEM for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+  memset(&umem_reg, 0, sizeof(umem_reg));
+  umem_reg.addr = (uint64_t)(uintptr_t)ts->umem;
+  umem_reg.len = (uint64_t)AF_XDP_NUM_FRAMES * AF_XDP_FRAME_SIZE;
+  umem_reg.chunk_size = AF_XDP_FRAME_SIZE;
+  umem_reg.headroom = 0;
+  if (setsockopt(ts->sockfd, SOL_XDP, XDP_UMEM_REG, &umem_reg, sizeof(umem_reg))) {
+    fprintf(stderr, "%s: could not register UMEM for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+
+  if (setsockopt(ts->sockfd, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) ||
+      setsockopt(ts->sockfd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp_size, sizeof(comp_size)) ||
+      setsockopt(ts->sockfd, SOL_XDP, XDP_RX_RING, &rx_size, sizeof(rx_size))) {
+    fprintf(stderr, "%s: could not set up AF_XDP rings for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+
+  optlen = sizeof(off);
+  if (getsockopt(ts->sockfd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen)) {
+    fprintf(stderr, "%s: could not get AF_XDP ring offsets for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+  if (xsk_ring_map(ts->sockfd, &ts->rx, &off.rx, rx_size, sizeof(struct xdp_desc), XDP_PGOFF_RX_RING) ||
+      xsk_ring_map(ts->sockfd, &ts->fill, &off.fr, fill_size, sizeof(uint64_t), XDP_UMEM_PGOFF_FILL_RING) ||
+      xsk_ring_map(ts->sockfd, &ts->comp, &off.cr, comp_size, sizeof(uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING)) {
+    fprintf(stderr, "%s: could not map AF_XDP rings for thread %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+
+  /* hand every frame to the kernel to receive into */
+  fill_desc = (uint64_t *)ts->fill.desc;
+  for (i = 0; i < AF_XDP_NUM_FRAMES; i++) {
+    fill_desc[i] = (uint64_t)i * AF_XDP_FRAME_SIZE;
+  }
+  __atomic_store_n(ts->fill.producer, AF_XDP_NUM_FRAMES, __ATOMIC_RELEASE);
+
+  memset(&sxdp, 0, sizeof(sxdp));
+  sxdp.sxdp_family = AF_XDP;
+  sxdp.sxdp_ifindex = ifindex;
+  sxdp.sxdp_queue_id = ts->tnum;
+  sxdp.sxdp_flags = bind_flags | XDP_USE_NEED_WAKEUP;
+  if (bind(ts->sockfd, (struct sockaddr *)&sxdp, sizeof(sxdp))) {
+    fprintf(stderr, "%s: could not bind AF_XDP socket to queue %d\n", strerror(errno), ts->tnum);
+    return -1;
+  }
+
+  optlen = sizeof(options);
+  if (getsockopt(ts->sockfd, SOL_XDP, XDP_OPTIONS, &options, &optlen) == 0) {
+    ts->zerocopy = (options.flags & XDP_OPTIONS_ZEROCOPY) != 0;
+  }
+
+  return 0;
+}
+
+/*
+ * af_xdp_rx_burst() hands up to AF_XDP_BURST packets from the RX ring
+ * of a thread to its handler, gives their frames back to the kernel,
+ * and returns the number of packets
+ */
+static unsigned int af_xdp_rx_burst(struct xsk_thread_storage *ts) {
+  struct frame_handler *handler = &ts->handler;
+  const struct xdp_desc *rx_desc = (const struct xdp_desc *)ts->rx.desc;
+  uint64_t *fill_desc = (uint64_t *)ts->fill.desc;
+  struct pkt_desc pi[AF_XDP_BURST];
+  struct pkt_desc *pip[AF_XDP_BURST];
+  uint8_t *eth[AF_XDP_BURST];
+  uint64_t addr[AF_XDP_BURST];
+  unsigned long byte_count = 0;
+  struct timespec now;
+  uint64_t ts_ns;
+  uint32_t cons, fill_prod, n, i;
+
+  cons = *ts->rx.consumer;
+  n = __atomic_load_n(ts->rx.producer, __ATOMIC_ACQUIRE) - cons;
+  if (n == 0) {
+    return 0;
+  }
+  if (n > AF_XDP_BURST) {
+    n = AF_XDP_BURST;
+  }
+
+  /*
+   * the kernel does not stamp the packets, so those of a burst share
+   * the time it was taken off the ring
+   */
+  clock_gettime(CLOCK_REALTIME, &now);
+  ts_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+  for (i = 0; i < n; i++) {
+    const struct xdp_desc *d = &rx_desc[(cons + i) & ts->rx.mask];
+
+    addr[i] = d->addr;
+    pi[i].ts = ts_ns;
+    pi[i].caplen = d->len;
+    pi[i].len = d->len;
+    eth[i] = ts->umem + d->addr;
+    pip[i] = &pi[i];
+    byte_count += d->len;
+  }
+
+  if (handler->burst_func != NULL) {
+    handler->burst_func(&handler->context, pip, eth, n);
+  } else {
+    for (i = 0; i < n; i++) {
+      handler->func(&handler->context, &pi[i], eth[i]);
+    }
+  }
+
+  /*
+   * the packets have been processed in place, so their frames can go
+   * back to the kernel; the fill ring holds every frame, so it has
+   * room for them
+   */
+  fill_prod = *ts->fill.producer;
+  for (i = 0; i < n; i++) {
+    fill_desc[(fill_prod + i) & ts->fill.mask] = addr[i] & ~((uint64_t)AF_XDP_FRAME_SIZE - 1);
+  }
+  __atomic_store_n(ts->fill.producer, fill_prod + n, __ATOMIC_RELEASE);
+  __atomic_store_n(ts->rx.consumer, cons + n, __ATOMIC_RELEASE);
+  if (__atomic_load_n(ts->fill.flags, __ATOMIC_ACQUIRE) & XDP_RING_NEED_WAKEUP) {
+    recvfrom(ts->sockfd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+  }
+
+  __sync_add_and_fetch(&(ts->statst->received_packets), n);
+  __sync_add_and_fetch(&(ts->statst->received_bytes), byte_count);
+
+  return n;
+}
+
+/*
+ * af_xdp_monotonic_ns() returns the time of CLOCK_MONOTONIC in
+ * nanoseconds
+ */
+static uint64_t af_xdp_monotonic_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * af_xdp_housekeeping() calls the housekeeping function of the handler
+ * if it is due, as af_packet_housekeeping() does
+ */
+static void af_xdp_housekeeping(struct frame_handler *handler,
+				uint64_t interval_ns,
+				uint64_t *next_ns,
+				unsigned int *idle) {
+  uint64_t now;
+
+  if (handler->housekeeping_func == NULL) {
+    return;
+  }
+  now = af_xdp_monotonic_ns();
+  if (now < *next_ns) {
+    return;
+  }
+  if (handler->housekeeping_func(&handler->context, *idle)) {
+    *next_ns = now; /* work left over, so do more after the next burst */
+  } else {
+    *next_ns = now + interval_ns;
+  }
+  *idle = 1;
+}
+
+static void xsk_wait_for_start(int *t_start_p, pthread_cond_t *t_start_c, pthread_mutex_t *t_start_m) {
+  int err;
+
+  err = pthread_mutex_lock(t_start_m);
+  if (err != 0) {
+    fprintf(stderr, "%s: error locking clean start mutex\n", strerror(err));
+    exit(255);
+  }
+  while (*t_start_p != 1) {
+    err = pthread_cond_wait(t_start_c, t_start_m);
+    if (err != 0) {
+      fprintf(stderr, "%s: error waiting on clean start condition\n", strerror(err));
+      exit(255);
+    }
+  }
+  err = pthread_mutex_unlock(t_start_m);
+  if (err != 0) {
+    fprintf(stderr, "%s: error unlocking clean start mutex\n", strerror(err));
+    exit(255);
+  }
+}
+
+static void *xsk_capture_thread_func(void *arg) {
+  struct xsk_thread_storage *ts = (struct xsk_thread_storage *)arg;
+  struct pollfd psockfd;
+  uint64_t housekeeping_ns = (uint64_t)ts->housekeeping_ms * 1000000;
+  uint64_t next_housekeeping;
+  unsigned int idle = 1;
+  int poll_timeout = ts->housekeeping_ms < 1000 ? ts->housekeeping_ms : 1000;
+  struct timespec nap = { 0, AF_XDP_NAP_US * 1000 };
+  int napped = 1;
+
+  xsk_wait_for_start(ts->t_start_p, ts->t_start_c, ts->t_start_m);
+
+  fprintf(stderr, "Thread %d with thread id %lu started on queue %d in %s mode...\n",
+	  ts->tnum, ts->tid, ts->tnum, ts->zerocopy ? "zero-copy" : "copy");
+
+  memset(&psockfd, 0, sizeof(psockfd));
+  psockfd.fd = ts->sockfd;
+  psockfd.events = POLLIN;
+
+  /*
+   * as with af_packet, housekeeping runs on a clock, and poll() wakes
+   * up often enough to run it on an idle link too
+   */
+  next_housekeeping = af_xdp_monotonic_ns() + housekeeping_ns;
+  while (sig_close_workers == 0) {
+    if (af_xdp_rx_burst(ts) != 0) {
+      idle = 0;
+      napped = 0;
+    } else if (!napped) {
+      /*
+       * the packets have been arriving, so let a burst of them
+       * gather rather than waking up for each one
+       */
+      nanosleep(&nap, NULL);
+      napped = 1;
+    } else if (poll(&psockfd, 1, poll_timeout) < 0 && errno != EINTR) {
+      perror("poll returned error");
+    }
+    af_xdp_housekeeping(&ts->handler, housekeeping_ns, &next_housekeeping, &idle);
+  }
+
+  fprintf(stderr, "Thread %d with thread id %lu exiting...\n", ts->tnum, ts->tid);
+  return NULL;
+}
+
+/*
+ * xsk_socket_stats() adds the packets the kernel dropped on a socket
+ * since it was created, and the times it found the fill ring empty,
+ * to statst
+ */
+static void xsk_socket_stats(int sockfd, struct xsk_stats_tracking *statst) {
+  struct xdp_statistics stats;
+  socklen_t optlen = sizeof(stats);
+
+  memset(&stats, 0, sizeof(stats));
+  if (getsockopt(sockfd, SOL_XDP, XDP_STATISTICS, &stats, &optlen)) {
+    perror("error: could not get AF_XDP statistics");
+    return;
+  }
+  statst->socket_drops += stats.rx_dropped + stats.rx_ring_full;
+  statst->fill_empty += stats.rx_fill_ring_empty_descs;
+}
+
+static void *xsk_stats_thread_func(void *statst_arg) {
+  struct xsk_stats_tracking *statst = (struct xsk_stats_tracking *)statst_arg;
+  uint64_t drops_before = 0;
+  uint64_t fill_empty_before = 0;
+  int thread;
+
+  xsk_wait_for_start(statst->t_start_p, statst->t_start_c, statst->t_start_m);
+
+  while (sig_close_flag == 0) {
+    uint64_t packets_before = statst->received_packets;
+    uint64_t bytes_before = statst->received_bytes;
+
+    sleep(1);
+
+    /* the socket counters are totals, so they are summed afresh */
+    statst->socket_drops = 0;
+    statst->fill_empty = 0;
+    for (thread = 0; thread < statst->num_threads; thread++) {
+      xsk_socket_stats(statst->tstor[thread].sockfd, statst);
+    }
+
+    fprintf(stderr,
+	    "Per second stats: "
+	    "received packets %8lu; received bytes %10lu; "
+	    "socket drops %8lu; fill ring empty %8lu\n",
+	    statst->received_packets - packets_before, statst->received_bytes - bytes_before,
+	    statst->socket_drops - drops_before, statst->fill_empty - fill_empty_before);
+    drops_before = statst->socket_drops;
+    fill_empty_before = statst->fill_empty;
+  }
+
+  return NULL;
+}
+
+
+static struct xsk_stats_tracking statst;
+static struct xsk_thread_storage *tstor;  // Holds the array of struct xsk_thread_storage, one for each thread
+static int t_start_p = 0;
+static pthread_cond_t t_start_c  = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t t_start_m = PTHREAD_MUTEX_INITIALIZER;
+
+static int xsk_map_fd = -1;
+static int xdp_prog_fd = -1;
+static int xdp_link_fd = -1;
+
+int af_xdp_bind_and_dispatch(struct mercury_config *cfg) {
+  struct rlimit unlimited = { RLIM_INFINITY, RLIM_INFINITY };
+  int num_threads = cfg->num_threads;
+  unsigned int num_queues;
+  uint16_t bind_flags = 0;
+  int skb_mode = 0;
+  int ifindex;
+  int thread;
+  int err;
+
+  ifindex = if_nametoindex(cfg->capture_interface);
+  if (ifindex == 0) {
+    fprintf(stderr, "Can't get interface number by interface name (%s)\n", cfg->capture_interface);
+    exit(255);
+  }
+  num_queues = get_interface_queues(cfg->capture_interface);
+  if (num_queues < (unsigned int)num_threads) {
+    fprintf(stderr, "Error: interface %s has %u receive queues, fewer than the %d threads\n",
+	    cfg->capture_interface, num_queues, num_threads);
+    exit(255);
+  }
+  /*
+   * each thread binds the queue with its own number, so the packets of
+   * any further queue would go to the host stack without being seen
+   */
+  if (num_queues > (unsigned int)num_threads) {
+    fprintf(stderr, "Error: interface %s has %u receive queues, more than the %d threads; "
+	    "the packets of queues %d to %u would not be captured\n",
+	    cfg->capture_interface, num_queues, num_threads, num_threads, num_queues - 1);
+    fprintf(stderr, "Use %u threads, or set the queues to %d with \"ethtool -L %s combined %d\"\n",
+	    num_queues, num_threads, cfg->capture_interface, num_threads);
+    exit(255);
+  }
+
+  /*
+   * kernels before 5.11 count BPF maps and the UMEM against the
+   * locked memory limit, which is small by default
+   */
+  setrlimit(RLIMIT_MEMLOCK, &unlimited);
+
+  xsk_map_fd = xsk_map_create(num_queues);
+  if (xsk_map_fd < 0) {
+    fprintf(stderr, "%s: could not create XSKMAP\n", strerror(errno));
+    exit(255);
+  }
+  xdp_prog_fd = xdp_prog_load(xsk_map_fd);
+  if (xdp_prog_fd < 0) {
+    fprintf(stderr, "%s: could not load XDP program\n", strerror(errno));
+    exit(255);
+  }
+
+  /*
+   * zero-copy needs the program to run in the driver; otherwise fall
+   * back to the generic XDP of the kernel, for drivers without XDP
+   */
+  xdp_link_fd = xdp_prog_attach(xdp_prog_fd, ifindex, XDP_FLAGS_DRV_MODE);
+  if (xdp_link_fd < 0 && cfg->xdp_mode != XDP_MODE_ZEROCOPY) {
+    xdp_link_fd = xdp_prog_attach(xdp_prog_fd, ifindex, XDP_FLAGS_SKB_MODE);
+    skb_mode = 1;
+  }
+  if (xdp_link_fd < 0) {
+    fprintf(stderr, "%s: could not attach XDP program to interface %s\n", strerror(errno), cfg->capture_interface);
+    exit(255);
+  }
+  fprintf(stderr, "Attached XDP program to interface %s in %s mode\n",
+	  cfg->capture_interface, skb_mode ? "generic" : "driver");
+
+  if (cfg->xdp_mode == XDP_MODE_ZEROCOPY) {
+    bind_flags = XDP_ZEROCOPY;
+  } else if (cfg->xdp_mode == XDP_MODE_COPY || skb_mode) {
+    bind_flags = XDP_COPY;
+  }
+
+  memset(&statst, 0, sizeof(statst));
+  statst.num_threads = num_threads;
+  statst.t_start_p = &t_start_p;
+  statst.t_start_c = &t_start_c;
+  statst.t_start_m = &t_start_m;
+
+  tstor = (struct xsk_thread_storage *)calloc(num_threads, sizeof(struct xsk_thread_storage));
+  if (!tstor) {
+    perror("could not allocate memory for struct xsk_thread_storage array\n");
+    exit(255);
+  }
+  statst.tstor = tstor;
+
+  for (thread = 0; thread < num_threads; thread++) {
+    tstor[thread].tnum = thread;
+    tstor[thread].sockfd = -1;
+    tstor[thread].statst = &statst;
+    tstor[thread].t_start_p = &t_start_p;
+    tstor[thread].t_start_c = &t_start_c;
+    tstor[thread].t_start_m = &t_start_m;
+    tstor[thread].handler.func = joy_handler_function;
+    tstor[thread].handler.burst_func = joy_burst_handler_function;
+    tstor[thread].handler.housekeeping_func = joy_housekeeping_function;
+    tstor[thread].handler.context.joy_data.thread_id = thread;
+    tstor[thread].housekeeping_ms = cfg->housekeeping_ms ? cfg->housekeeping_ms : AF_PACKET_HOUSEKEEPING_MS;
+
+    /* the UMEM is populated, and the kernel rings allocated, on the node this thread prefers */
+    if (cfg->ring_node >= 0) {
+      affinity_prefer_node(cfg->ring_node);
+    }
+    err = create_xsk_socket(&tstor[thread], ifindex, bind_flags);
+    if (cfg->ring_node >= 0) {
+      affinity_prefer_node(-1);
+    }
+    if (err != 0 || xsk_map_set(xsk_map_fd, thread, tstor[thread].sockfd) != 0) {
+      fprintf(stderr, "error creating AF_XDP socket for thread %d\n", thread);
+      exit(255);
+    }
+  }
+
+  return 0;
+}
+
+int af_xdp_start_processing(struct mercury_config *cfg) {
+  int num_threads = cfg->num_threads;
+  pthread_t stats_thread;
+  int thread;
+  int err;
+
+  err = pthread_create(&stats_thread, NULL, xsk_stats_thread_func, &statst);
+  if (err != 0) {
+    perror("error creating stats thread");
+  }
+
+  for (thread = 0; thread < num_threads; thread++) {
+    err = pthread_create(&(tstor[thread].tid), NULL, xsk_capture_thread_func, &(tstor[thread]));
+    if (err) {
+      fprintf(stderr, "%s: error creating af_xdp capture thread %u\n", strerror(err), thread);
+      exit(255);
+    }
+    if (cfg->thread_cpu && cfg->thread_cpu[thread] >= 0 &&
+	affinity_pin(tstor[thread].tid, cfg->thread_cpu[thread]) != 0) {
+      fprintf(stderr, "could not pin af_xdp capture thread %u to cpu %d\n", thread, cfg->thread_cpu[thread]);
+    }
+  }
+
+  /* start all the threads at once, as af_packet_start_processing() does */
+  pthread_mutex_lock(&t_start_m);
+  t_start_p = 1;
+  pthread_mutex_unlock(&t_start_m);
+  err = pthread_cond_broadcast(&t_start_c);
+  if (err != 0) {
+    printf("%s: error broadcasting all clear on clean start condition\n", strerror(err));
+    exit(255);
+  }
+
+  /* Wait for the stats thread to close (which only happens on a sigint/sigterm) */
+  pthread_join(stats_thread, NULL);
+
+  sig_close_workers = 1;
+  for (thread = 0; thread < num_threads; thread++) {
+    pthread_join(tstor[thread].tid, NULL);
+  }
+
+  /* closing the link detaches the program from the interface */
+  close(xdp_link_fd);
+  close(xdp_prog_fd);
+  close(xsk_map_fd);
+  for (thread = 0; thread < num_threads; thread++) {
+    xsk_ring_unmap(&tstor[thread].rx);
+    xsk_ring_unmap(&tstor[thread].fill);
+    xsk_ring_unmap(&tstor[thread].comp);
+    close(tstor[thread].sockfd);
+    munmap(tstor[thread].umem, (size_t)AF_XDP_NUM_FRAMES * AF_XDP_FRAME_SIZE);
+  }
+  free(tstor);
+
+  fprintf(stderr, "--\n"
+	  "%lu packets captured\n"
+	  "%lu bytes captured\n"
+	  "%lu packets dropped\n",
+	  statst.received_packets, statst.received_bytes, statst.socket_drops);
+
+  return 0;
+}
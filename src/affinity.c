@@ -0,0 +1,505 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file affinity.c
+ *
+ * \brief Placement of threads on CPUs and of memory on NUMA nodes,
+ *        see affinity.h
+ *
+ * A thread inherits the CPUs of the thread that creates it, so a
+ * helper thread started by a pinned worker, like the writer of an
+ * output file, would otherwise share the one CPU of that worker;
+ * affinity_spread_to_node() lets it run on the rest of the node.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include "affinity.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/* longest line read from sysfs, enough for the cpulist of a node */
+#define AFFINITY_LINE_LEN 4096
+
+/* bits of each word of a node mask */
+#define AFFINITY_MASK_BITS (8 * sizeof(unsigned long))
+
+/* reads a number below limit at *p, advancing p; -1 if there is none */
+static int cpu_list_number (const char **p, int limit) {
+    int n = 0;
+
+    if (**p < '0' || **p > '9') {
+        return -1;
+    }
+    while (**p >= '0' && **p <= '9') {
+        n = n * 10 + (**p - '0');
+        if (n >= limit) {
+            return -1;
+        }
+        (*p)++;
+    }
+    return n;
+}
+
+int cpu_list_parse (cpu_list_t *l, const char *s) {
+    const char *p = s;
+    int lo, hi;
+
+    if (l == NULL || s == NULL) {
+        return failure;
+    }
+    l->num = 0;
+    while (1) {
+        lo = hi = cpu_list_number(&p, AFFINITY_MAX_CPUS);
+        if (lo < 0) {
+            return failure;
+        }
+        if (*p == '-') {
+            p++;
+            hi = cpu_list_number(&p, AFFINITY_MAX_CPUS);
+            if (hi < lo) {
+                return failure;
+            }
+        }
+        if (l->num + (hi - lo + 1) > AFFINITY_MAX_CPUS) {
+            return failure;
+        }
+        while (lo <= hi) {
+            l->cpu[l->num++] = lo++;
+        }
+        if (*p == '\0') {
+            return ok;
+        }
+        if (*p++ != ',') {
+            return failure;
+        }
+    }
+}
+
+int cpu_list_get (const cpu_list_t *l, unsigned int i) {
+    if (l == NULL || l->num == 0) {
+        return -1;
+    }
+    return l->cpu[i % l->num];
+}
+
+#ifdef __linux__
+
+/* the CPUs of the process before any thread was pinned */
+static cpu_set_t affinity_initial;
+static int affinity_initial_saved = 0;
+static pthread_once_t affinity_initial_once = PTHREAD_ONCE_INIT;
+
+static void affinity_initial_save (void) {
+    if (sched_getaffinity(0, sizeof(affinity_initial), &affinity_initial) == 0) {
+        affinity_initial_saved = 1;
+    }
+}
+
+/* reads the first line of a file, without its newline; ok or failure */
+static int affinity_read_line (const char *path, char *line, size_t size) {
+    FILE *fp = fopen(path, "r");
+    char *nl;
+
+    if (fp == NULL) {
+        return failure;
+    }
+    if (fgets(line, size, fp) == NULL) {
+        fclose(fp);
+        return failure;
+    }
+    fclose(fp);
+    nl = strchr(line, '\n');
+    if (nl != NULL) {
+        *nl = '\0';
+    }
+    return ok;
+}
+
+int affinity_pin (pthread_t t, int cpu) {
+    cpu_set_t set;
+
+    pthread_once(&affinity_initial_once, affinity_initial_save);
+    if (cpu < 0) {
+        if (!affinity_initial_saved) {
+            return failure;
+        }
+        set = affinity_initial;
+    } else {
+        if (cpu >= AFFINITY_MAX_CPUS) {
+            return failure;
+        }
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+    }
+    return (pthread_setaffinity_np(t, sizeof(set), &set) == 0) ? ok : failure;
+}
+
+void affinity_spread_to_node (void) {
+    char path[64];
+    char line[AFFINITY_LINE_LEN];
+    cpu_list_t *l;
+    cpu_set_t set, node_set;
+    int cpu, node;
+    unsigned int i;
+
+    /* only pins made by affinity_pin() are undone */
+    if (!affinity_initial_saved) {
+        return;
+    }
+    if (sched_getaffinity(0, sizeof(set), &set) != 0 || CPU_COUNT(&set) != 1) {
+        return;
+    }
+    for (cpu = 0; cpu < AFFINITY_MAX_CPUS && !CPU_ISSET(cpu, &set); cpu++) {
+    }
+
+    set = affinity_initial;
+    node = affinity_cpu_node(cpu);
+    l = malloc(sizeof(cpu_list_t));
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (l != NULL && node >= 0 &&
+        affinity_read_line(path, line, sizeof(line)) == ok && cpu_list_parse(l, line) == ok) {
+        CPU_ZERO(&node_set);
+        for (i = 0; i < l->num; i++) {
+            CPU_SET(l->cpu[i], &node_set);
+        }
+        CPU_AND(&node_set, &node_set, &affinity_initial);
+        if (CPU_COUNT(&node_set) > 0) {
+            set = node_set;
+        }
+    }
+    free(l);
+    sched_setaffinity(0, sizeof(set), &set);
+}
+
+int affinity_cpu_node (int cpu) {
+    char path[64];
+    struct dirent *entry;
+    DIR *dir;
+    int node = -1;
+
+    if (cpu < 0) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "node", 4) == 0) {
+            const char *p = entry->d_name + 4;
+
+            node = cpu_list_number(&p, AFFINITY_MAX_NODES);
+            if (node >= 0 && *p == '\0') {
+                break;
+            }
+            node = -1;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+int affinity_interface_node (const char *ifname) {
+    char path[128];
+    char line[32];
+    const char *p = line;
+    int node;
+
+    if (ifname == NULL || strchr(ifname, '/') != NULL ||
+        strlen(ifname) > sizeof(path) - sizeof("/sys/class/net//device/numa_node")) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", ifname);
+    if (affinity_read_line(path, line, sizeof(line)) != ok) {
+        return -1;
+    }
+    /* a device that does not know its node reports -1 */
+    node = cpu_list_number(&p, AFFINITY_MAX_NODES);
+    return (*p == '\0') ? node : -1;
+}
+
+int affinity_place (void *addr, size_t len, int node) {
+    unsigned long mask[AFFINITY_MAX_NODES / AFFINITY_MASK_BITS];
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)addr + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(page - 1);
+
+    if (node < 0 || node >= AFFINITY_MAX_NODES) {
+        return failure;
+    }
+    /* pages shared with other data stay where they are */
+    if (addr == NULL || end <= start) {
+        return ok;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / AFFINITY_MASK_BITS] = 1UL << (node % AFFINITY_MASK_BITS);
+    if (syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+                AFFINITY_MAX_NODES + 1, MPOL_MF_MOVE) != 0) {
+        return failure;
+    }
+    return ok;
+}
+
+int affinity_prefer_node (int node) {
+    unsigned long mask[AFFINITY_MAX_NODES / AFFINITY_MASK_BITS];
+
+    if (node >= AFFINITY_MAX_NODES) {
+        return failure;
+    }
+    if (node < 0) {
+        return (syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0) == 0) ? ok : failure;
+    }
+    memset(mask, 0, sizeof(mask));
+    mask[node / AFFINITY_MASK_BITS] = 1UL << (node % AFFINITY_MASK_BITS);
+    return (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, AFFINITY_MAX_NODES + 1) == 0) ? ok : failure;
+}
+
+#else
+
+int affinity_pin (pthread_t t, int cpu) {
+    (void)t;
+    (void)cpu;
+    return failure;
+}
+
+void affinity_spread_to_node (void) {
+}
+
+int affinity_cpu_node (int cpu) {
+    (void)cpu;
+    return -1;
+}
+
+int affinity_interface_node (const char *ifname) {
+    (void)ifname;
+    return -1;
+}
+
+int affinity_place (void *addr, size_t len, int node) {
+    (void)addr;
+    (void)len;
+    (void)node;
+    return failure;
+}
+
+int affinity_prefer_node (int node) {
+    (void)node;
+    return failure;
+}
+
+#endif /* __linux__ */
+
+/*
+ * unit test
+ */
+
+static int affinity_test_lists (void) {
+    static const char *bad[] = {
+        "", ",", "1,", ",1", "3-1", "1-", "-1", "1-2-3", "a", "1 2", "1024", "0-1024"
+    };
+    cpu_list_t *l = malloc(sizeof(cpu_list_t));
+    unsigned int i;
+    int num_fails = 0;
+
+    if (l == NULL) {
+        return 1;
+    }
+    if (cpu_list_parse(l, "0-3,8,10-11,2") != ok || l->num != 8 ||
+        l->cpu[0] != 0 || l->cpu[3] != 3 || l->cpu[4] != 8 || l->cpu[6] != 11 || l->cpu[7] != 2) {
+        joy_log_err("cpu list 0-3,8,10-11,2 parsed into %u cpus", l->num);
+        num_fails++;
+    }
+    if (cpu_list_get(l, 9) != 1 || cpu_list_get(l, 7) != 2) {
+        joy_log_err("cpu list does not wrap around");
+        num_fails++;
+    }
+    if (cpu_list_parse(l, "1023") != ok || l->num != 1 || l->cpu[0] != 1023 ||
+        cpu_list_parse(l, "0-1023") != ok || l->num != AFFINITY_MAX_CPUS) {
+        joy_log_err("cpu list at the limit not parsed");
+        num_fails++;
+    }
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        if (cpu_list_parse(l, bad[i]) == ok) {
+            joy_log_err("cpu list \"%s\" accepted", bad[i]);
+            num_fails++;
+        }
+    }
+    l->num = 0;
+    if (cpu_list_get(l, 0) != -1) {
+        joy_log_err("empty cpu list names a cpu");
+        num_fails++;
+    }
+    free(l);
+    return num_fails;
+}
+
+#ifdef __linux__
+
+static void *affinity_test_thread (void *arg) {
+    int *fails = (int *)arg;
+    cpu_set_t set;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    unsigned long mask[AFFINITY_MAX_NODES / AFFINITY_MASK_BITS];
+    unsigned char *mem;
+    int cpu, node, mode;
+
+    /* the first cpu this thread may run on */
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        joy_log_err("could not get the cpus of the thread");
+        (*fails)++;
+        return NULL;
+    }
+    for (cpu = 0; cpu < AFFINITY_MAX_CPUS && !CPU_ISSET(cpu, &set); cpu++) {
+    }
+
+    if (affinity_pin(pthread_self(), cpu) != ok ||
+        sched_getaffinity(0, sizeof(set), &set) != 0 || CPU_COUNT(&set) != 1 || !CPU_ISSET(cpu, &set)) {
+        joy_log_err("thread not pinned to cpu %d", cpu);
+        (*fails)++;
+    } else if (sched_getcpu() != cpu) {
+        joy_log_err("thread pinned to cpu %d runs on cpu %d", cpu, sched_getcpu());
+        (*fails)++;
+    }
+
+    /* widened to the node, which holds the cpu */
+    affinity_spread_to_node();
+    if (sched_getaffinity(0, sizeof(set), &set) != 0 || !CPU_ISSET(cpu, &set)) {
+        joy_log_err("thread spread to the node of cpu %d left it", cpu);
+        (*fails)++;
+    }
+    if (affinity_pin(pthread_self(), -1) != ok ||
+        sched_getaffinity(0, sizeof(set), &set) != 0 || !CPU_EQUAL(&set, &affinity_initial)) {
+        joy_log_err("thread not unpinned");
+        (*fails)++;
+    }
+
+    node = affinity_cpu_node(cpu);
+    if (node < 0) {
+        joy_log_info("node of cpu %d is unknown, using node 0", cpu);
+        node = 0;
+    }
+
+    /* only the whole pages of the region are placed */
+    mem = mmap(NULL, 4 * page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        (*fails)++;
+        return NULL;
+    }
+    memset(mem, 0x5a, 4 * page);
+    if (affinity_place(mem + 1, page, node) != ok) {
+        joy_log_err("placing a region without a whole page failed");
+        (*fails)++;
+    }
+    if (affinity_place(mem + 1, 4 * page - 1, node) != ok) {
+        if (errno == ENOSYS || errno == EPERM) {
+            joy_log_info("memory placement is not available (%s), skipped", strerror(errno));
+            munmap(mem, 4 * page);
+            return NULL;
+        }
+        joy_log_err("could not place memory on node %d (%s)", node, strerror(errno));
+        (*fails)++;
+    } else {
+        mode = -1;
+        if (syscall(SYS_get_mempolicy, &mode, NULL, 0, mem + page, MPOL_F_NODE | MPOL_F_ADDR) != 0 ||
+            mode != node) {
+            joy_log_err("placed page is on node %d, not %d", mode, node);
+            (*fails)++;
+        }
+        if (mem[page] != 0x5a || mem[4 * page - 1] != 0x5a) {
+            joy_log_err("placed memory changed");
+            (*fails)++;
+        }
+    }
+    munmap(mem, 4 * page);
+
+    mode = -1;
+    memset(mask, 0, sizeof(mask));
+    if (affinity_prefer_node(node) != ok ||
+        syscall(SYS_get_mempolicy, &mode, mask, AFFINITY_MAX_NODES + 1, NULL, 0) != 0 ||
+        mode != MPOL_PREFERRED || !(mask[node / AFFINITY_MASK_BITS] & (1UL << (node % AFFINITY_MASK_BITS)))) {
+        joy_log_err("thread does not prefer node %d", node);
+        (*fails)++;
+    }
+    mode = -1;
+    if (affinity_prefer_node(-1) != ok ||
+        syscall(SYS_get_mempolicy, &mode, NULL, 0, NULL, 0) != 0 || mode != MPOL_DEFAULT) {
+        joy_log_err("thread memory policy not reset");
+        (*fails)++;
+    }
+    return NULL;
+}
+
+#endif /* __linux__ */
+
+int affinity_unit_test (void) {
+    int num_fails = 0;
+
+    num_fails += affinity_test_lists();
+
+#ifdef __linux__
+    {
+        pthread_t thread;
+        int thread_fails = 0;
+
+        /* in a thread of its own, so that the pins do not outlive the test */
+        if (pthread_create(&thread, NULL, affinity_test_thread, &thread_fails) != 0) {
+            num_fails++;
+        } else {
+            pthread_join(thread, NULL);
+            num_fails += thread_fails;
+        }
+    }
+#endif
+
+    return num_fails;
+}
@@ -350,6 +350,19 @@ joy_status_e anon_init (const char *pathname, FILE *logfile) {
     return s;
 }
 
+/**
+ * \fn void addr_get_anon_bytes (const struct in_addr *a, unsigned char *c)
+ * \param a address to be anonymized
+ * \param c used to store the 16 bytes of anonymized data
+ * \return none
+ */
+void addr_get_anon_bytes (const struct in_addr *a, unsigned char *c) {
+    unsigned char pt[16] = { 0, };
+
+    memcpy_s(pt, sizeof(struct in_addr), a, sizeof(struct in_addr));
+    AES_encrypt(pt, c, &key.enc_key);
+}
+
 /**
  * \fn char *addr_get_anon_hexstring (const struct in_addr *a, char *buffer, int size)
  * \param a address to be anonymized
@@ -358,7 +371,6 @@ joy_status_e anon_init (const char *pathname, FILE *logfile) {
  * \return pointer to the anonymized output
  */
 void addr_get_anon_hexstring (const struct in_addr *a, char *buffer, int size) {
-    unsigned char pt[16] = { 0, };
     unsigned char c[16];
 
     /* must be IPV4_ANON_LEN bytes in length */
@@ -366,8 +378,7 @@ void addr_get_anon_hexstring (const struct in_addr *a, char *buffer, int size) {
        return;
 
     memset_s(buffer, size, 0x00, size);
-    memcpy_s(pt, sizeof(struct in_addr), a, sizeof(struct in_addr));
-    AES_encrypt(pt, c, &key.enc_key);
+    addr_get_anon_bytes(a, c);
     snprintf(buffer, IPV4_ANON_LEN, "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
                c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], 
                c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]);
@@ -0,0 +1,531 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file binrec.c
+ *
+ * \brief streaming reader for the binary format of the flow record
+ *        output; the writer side is part of output.c
+ *
+ * A reader reads one record at a time, decodes its tokens, and can
+ * replay them through the writers of output.h, which gives back the
+ * JSON record exactly as joy would have written it.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "binrec.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+struct binrec_reader_ {
+    zreader handle;
+    unsigned char *rec;                 /*!< bytes of the record last read      */
+    size_t rec_size;
+    char *scratch;                      /*!< NUL terminated copies of the data  */
+    size_t scratch_size;
+    binrec_token_t *tokens;
+    unsigned int num_tokens;
+    unsigned int max_tokens;
+
+    /* the intern table, as the writer built it */
+    uint32_t off[BINREC_INTERN_MAX];
+    uint16_t len[BINREC_INTERN_MAX];
+    unsigned int num;
+    unsigned int used;
+    char data[BINREC_INTERN_BYTES];
+};
+
+/* read len bytes; returns the number read, or -1 on error */
+static int binrec_read (binrec_reader_t *r, void *buf, unsigned int len) {
+    return zread(r->handle, buf, len);
+}
+
+/* a reader of the decompressed bytes of a file */
+static binrec_reader_t *binrec_alloc (const char *fname) {
+    binrec_reader_t *r = calloc(1, sizeof(binrec_reader_t));
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->handle = zread_open(fname);
+    if (r->handle == NULL) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * \brief Open a binary output file for reading.
+ *
+ * Reads the file through the decompressor its first bytes call for,
+ * see zread_open(), or as it is if it is not compressed.
+ *
+ * \param fname The name of the file
+ * \return The reader, or NULL if the file could not be opened or is
+ *         not in the binary format
+ */
+binrec_reader_t *binrec_open (const char *fname) {
+    binrec_reader_t *r = binrec_alloc(fname);
+    unsigned char header[BINREC_MAGIC_LEN + 1];
+
+    if (r == NULL) {
+        return NULL;
+    }
+    if (binrec_read(r, header, sizeof(header)) != (int)sizeof(header) ||
+        memcmp(header, BINREC_MAGIC, BINREC_MAGIC_LEN) != 0 ||
+        header[BINREC_MAGIC_LEN] != BINREC_VERSION) {
+        binrec_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+/* decode a varint at *p, below end */
+static int binrec_varint (const unsigned char **p, const unsigned char *end, uint64_t *v) {
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 64) {
+        unsigned char b = *(*p)++;
+
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            return ok;
+        }
+        shift += 7;
+    }
+    return failure;
+}
+
+/* the token to be filled in next */
+static binrec_token_t *binrec_new_token (binrec_reader_t *r, enum binrec_token_type type) {
+    binrec_token_t *t;
+
+    if (r->num_tokens == r->max_tokens) {
+        unsigned int max = r->max_tokens ? r->max_tokens * 2 : 256;
+
+        t = realloc(r->tokens, max * sizeof(binrec_token_t));
+        if (t == NULL) {
+            return NULL;
+        }
+        r->tokens = t;
+        r->max_tokens = max;
+    }
+    t = &r->tokens[r->num_tokens++];
+    memset_s(t, sizeof(binrec_token_t), 0x00, sizeof(binrec_token_t));
+    t->type = type;
+    return t;
+}
+
+/* decode the tokens of the record in r->rec */
+static int binrec_decode (binrec_reader_t *r, size_t rec_len) {
+    const unsigned char *p = r->rec;
+    const unsigned char *end = r->rec + rec_len;
+    char *scratch = r->scratch;
+    binrec_token_t *t;
+    uint64_t v, len;
+
+    r->num_tokens = 0;
+    while (p < end) {
+        unsigned int tag = *p++;
+        enum binrec_token_type type;
+
+        if (tag >= BINREC_TAG_SMALL_UINT && tag < BINREC_TAG_SHORT_REF) {
+            if ((t = binrec_new_token(r, BINREC_TOKEN_UINT)) == NULL) {
+                return failure;
+            }
+            t->u = tag - BINREC_TAG_SMALL_UINT;
+            continue;
+        }
+        if (tag & BINREC_TAG_SHORT_REF) {
+            v = tag & (BINREC_SHORT_REF_MAX - 1);
+            tag = (tag & BINREC_TAG_SHORT_STRING) ? BINREC_TAG_STRING_REF : BINREC_TAG_TEXT_REF;
+        } else if (binrec_varint(&p, end, &v) != ok) {
+            return failure;
+        }
+        switch (tag) {
+        case BINREC_TAG_TEXT:
+        case BINREC_TAG_TEXT_NEW:
+        case BINREC_TAG_STRING:
+        case BINREC_TAG_STRING_NEW:
+        case BINREC_TAG_HEX:
+            len = v;
+            if (len > (uint64_t)(end - p)) {
+                return failure;
+            }
+            if (tag == BINREC_TAG_HEX) {
+                type = BINREC_TOKEN_HEX;
+            } else if (tag == BINREC_TAG_TEXT || tag == BINREC_TAG_TEXT_NEW) {
+                type = BINREC_TOKEN_TEXT;
+            } else {
+                type = BINREC_TOKEN_STRING;
+            }
+            if ((t = binrec_new_token(r, type)) == NULL) {
+                return failure;
+            }
+            if (tag == BINREC_TAG_TEXT_NEW || tag == BINREC_TAG_STRING_NEW) {
+                if (len > BINREC_INTERN_MAX_LEN || r->num >= BINREC_INTERN_MAX ||
+                    r->used + len + 1 > BINREC_INTERN_BYTES) {
+                    return failure;
+                }
+                t->data = r->data + r->used;
+                r->off[r->num] = r->used;
+                r->len[r->num] = (uint16_t)len;
+                r->num++;
+                r->used += (unsigned int)len + 1;
+            } else {
+                /* a token takes at least two bytes, so the NUL fits */
+                t->data = scratch;
+                scratch += len + 1;
+            }
+            memcpy((char *)t->data, p, len);
+            ((char *)t->data)[len] = 0;
+            t->len = (unsigned int)len;
+            p += len;
+            break;
+
+        case BINREC_TAG_TEXT_REF:
+        case BINREC_TAG_STRING_REF:
+            if (v >= r->num) {
+                return failure;
+            }
+            type = (tag == BINREC_TAG_TEXT_REF) ? BINREC_TOKEN_TEXT : BINREC_TOKEN_STRING;
+            if ((t = binrec_new_token(r, type)) == NULL) {
+                return failure;
+            }
+            t->data = r->data + r->off[v];
+            t->len = r->len[v];
+            break;
+
+        case BINREC_TAG_UINT:
+            if ((t = binrec_new_token(r, BINREC_TOKEN_UINT)) == NULL) {
+                return failure;
+            }
+            t->u = v;
+            break;
+
+        case BINREC_TAG_INT:
+            if ((t = binrec_new_token(r, BINREC_TOKEN_INT)) == NULL) {
+                return failure;
+            }
+            t->i = BINREC_UNZIGZAG(v);
+            break;
+
+        case BINREC_TAG_TIMESTAMP:
+            if ((t = binrec_new_token(r, BINREC_TOKEN_TIMESTAMP)) == NULL) {
+                return failure;
+            }
+            t->i = BINREC_UNZIGZAG(v);
+            if (binrec_varint(&p, end, &v) != ok || v >= 1000000) {
+                return failure;
+            }
+            t->usec = (long)v;
+            break;
+
+        default:
+            return failure;
+        }
+    }
+    return ok;
+}
+
+/**
+ * \brief Read the next record of a binary output file.
+ * \param r The reader
+ * \return 1 if a record was read, 0 at the end of the file, or -1 if
+ *         the file is truncated or corrupt
+ */
+int binrec_next (binrec_reader_t *r) {
+    unsigned char b;
+    uint64_t len = 0;
+    unsigned int shift = 0;
+    int n;
+
+    /* the length of the record */
+    while (1) {
+        n = binrec_read(r, &b, 1);
+        if (n == 0 && shift == 0) {
+            return 0;
+        }
+        if (n != 1 || shift >= 64) {
+            return -1;
+        }
+        len |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0) {
+            break;
+        }
+        shift += 7;
+    }
+    if (len == 0 || len > BINREC_RECORD_MAX) {
+        return -1;
+    }
+
+    if (len > r->rec_size) {
+        unsigned char *rec = realloc(r->rec, len);
+        char *scratch = realloc(r->scratch, len);
+
+        if (rec != NULL) {
+            r->rec = rec;
+        }
+        if (scratch != NULL) {
+            r->scratch = scratch;
+        }
+        if (rec == NULL || scratch == NULL) {
+            return -1;
+        }
+        r->rec_size = len;
+    }
+    if (binrec_read(r, r->rec, (unsigned int)len) != (int)len) {
+        return -1;
+    }
+    if (binrec_decode(r, (size_t)len) != ok) {
+        return -1;
+    }
+    return 1;
+}
+
+/**
+ * \brief The tokens of the record last read.
+ * \param r The reader
+ * \param num_tokens Set to the number of tokens
+ * \return The tokens, valid until the next call to binrec_next()
+ */
+const binrec_token_t *binrec_tokens (const binrec_reader_t *r, unsigned int *num_tokens) {
+    *num_tokens = r->num_tokens;
+    return r->tokens;
+}
+
+/**
+ * \brief Write the record last read as JSON, by calling the writers
+ *        that joy wrote it with.
+ * \param r The reader
+ * \param f The stream to write to
+ * \return ok, or failure
+ */
+int binrec_print_json (const binrec_reader_t *r, zfile f) {
+    unsigned int i;
+    int rc = 0;
+
+    for (i = 0; i < r->num_tokens && rc >= 0; i++) {
+        const binrec_token_t *t = &r->tokens[i];
+
+        switch (t->type) {
+        case BINREC_TOKEN_TEXT:
+            rc = zwrite(f, t->data, t->len);
+            break;
+        case BINREC_TOKEN_STRING:
+            rc = zprint_json_string(f, t->data);
+            break;
+        case BINREC_TOKEN_UINT:
+            rc = zprint_uint64(f, t->u);
+            break;
+        case BINREC_TOKEN_INT:
+            rc = zprint_int64(f, t->i);
+            break;
+        case BINREC_TOKEN_HEX:
+            rc = zprint_hex(f, (const unsigned char *)t->data, t->len);
+            break;
+        case BINREC_TOKEN_TIMESTAMP:
+            rc = zprint_timestamp(f, t->i, t->usec);
+            break;
+        default:
+            break;
+        }
+    }
+    zcommit(f);
+    return (rc >= 0) ? ok : failure;
+}
+
+/**
+ * \brief Close a reader.
+ * \param r The reader
+ * \return none
+ */
+void binrec_close (binrec_reader_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    zread_close(r->handle);
+    free(r->rec);
+    free(r->scratch);
+    free(r->tokens);
+    free(r);
+}
+
+/*
+ * unit test
+ */
+
+#define BINREC_TEST_FILE "binrec-unit-test"
+#define BINREC_TEST_RECORDS 6000
+
+/* write a record that exercises each of the writers */
+static void binrec_test_record (zfile f, unsigned int i) {
+    static const unsigned char hex[] = { 0x00, 0x01, 0x7f, 0x80, 0xab, 0xff };
+    char name[64];
+    char big[300];
+
+    snprintf(name, sizeof(name), "host-%u.example.com", i);
+    memset_s(big, sizeof(big), 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = 0;
+
+    zputc(f, '{');
+    zputs(f, "\"sa\":");
+    zprint_json_string(f, "10.0.0.1");
+    zputs(f, ",\"name\":");
+    zprint_json_string(f, name);
+    zputs(f, ",\"esc\":");
+    zprint_json_string(f, "a\"b\\c\n\x01");
+    zputs(f, ",\"none\":");
+    zprint_json_string(f, NULL);
+    zputs(f, ",\"big\":");
+    zprint_json_string(f, (i % 100 == 0) ? big : "");
+    zprintf(f, ",\"f\":%f", i / 7.0);
+    zputs(f, ",\"u\":");
+    zprint_uint(f, i * 1000u);
+    zputs(f, ",\"u64\":");
+    zprint_uint64(f, UINT64_MAX - i);
+    zputs(f, ",\"i\":");
+    zprint_int(f, -(int)i);
+    zputs(f, ",\"i64\":");
+    zprint_int64(f, INT64_MIN + i);
+    zputs(f, ",\"t\":");
+    zprint_timestamp(f, 1500000000 + i, (long)(i * 37 % 1000000));
+    zputs(f, ",\"neg\":");
+    zprint_timestamp(f, -(int64_t)i, 5);
+    zputs(f, ",\"hex\":\"");
+    zprint_hex(f, hex, (i % 2) ? sizeof(hex) : 0);
+    zputs(f, "\"}\n");
+    zcommit(f);
+}
+
+/* compare the decompressed contents of two files */
+static int binrec_test_same (const char *fname1, const char *fname2) {
+    binrec_reader_t *a = binrec_alloc(fname1);
+    binrec_reader_t *b = binrec_alloc(fname2);
+    char buf1[4096], buf2[4096];
+    int n1, n2, rc = failure;
+
+    if (a != NULL && b != NULL) {
+        do {
+            n1 = binrec_read(a, buf1, sizeof(buf1));
+            n2 = binrec_read(b, buf2, sizeof(buf2));
+        } while (n1 > 0 && n1 == n2 && memcmp(buf1, buf2, n1) == 0);
+        if (n1 == 0 && n2 == 0) {
+            rc = ok;
+        }
+    }
+    binrec_close(a);
+    binrec_close(b);
+    return rc;
+}
+
+/**
+ * \brief Unit test for the binary format: writes the same records as
+ *        JSON and in the binary format, converts the binary file back
+ *        to JSON, and checks that the two JSON files are the same.
+ * \return 0 on success, or the number of failures
+ */
+int binrec_unit_test (void) {
+    zfile json, bin, out;
+    binrec_reader_t *r;
+    const binrec_token_t *tokens;
+    unsigned int i, num_tokens, records = 0;
+    int n, num_fails = 0;
+
+    json = zopen(BINREC_TEST_FILE ".json", "w");
+    bin = zopen(BINREC_TEST_FILE ".bin", "w");
+    if (json == NULL || bin == NULL) {
+        joy_log_err("could not open test files");
+        return 1;
+    }
+    if (zbinary(bin) != ok || zbinary(bin) == ok) {
+        joy_log_err("zbinary() failed, or succeeded twice");
+        num_fails++;
+    }
+    for (i = 0; i < BINREC_TEST_RECORDS; i++) {
+        binrec_test_record(json, i);
+        binrec_test_record(bin, i);
+    }
+    zclose(json);
+    zclose(bin);
+
+    r = binrec_open(BINREC_TEST_FILE ".json");
+    if (r != NULL) {
+        joy_log_err("opened a JSON file as a binary one");
+        binrec_close(r);
+        num_fails++;
+    }
+
+    r = binrec_open(BINREC_TEST_FILE ".bin");
+    out = zopen(BINREC_TEST_FILE ".out", "w");
+    if (r == NULL || out == NULL) {
+        joy_log_err("could not open the binary test file");
+        return num_fails + 1;
+    }
+    while ((n = binrec_next(r)) == 1) {
+        tokens = binrec_tokens(r, &num_tokens);
+        if (records == 3 && (num_tokens < 2 || tokens[1].type != BINREC_TOKEN_STRING ||
+                             strcmp(tokens[1].data, "10.0.0.1") != 0)) {
+            joy_log_err("unexpected tokens in record %u", records);
+            num_fails++;
+        }
+        binrec_print_json(r, out);
+        records++;
+    }
+    if (n != 0 || records != BINREC_TEST_RECORDS) {
+        joy_log_err("read %u records, expected %u", records, BINREC_TEST_RECORDS);
+        num_fails++;
+    }
+    binrec_close(r);
+    zclose(out);
+
+    if (binrec_test_same(BINREC_TEST_FILE ".json", BINREC_TEST_FILE ".out") != ok) {
+        joy_log_err("converted binary output differs from the JSON output");
+        num_fails++;
+    }
+
+    remove(BINREC_TEST_FILE ".json");
+    remove(BINREC_TEST_FILE ".bin");
+    remove(BINREC_TEST_FILE ".out");
+    return num_fails;
+}
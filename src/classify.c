@@ -242,83 +242,83 @@ float parameters_bd[NUM_PARAMETERS_BD_LOGREG] = {
 };
 
 /**
- * \fn void merge_splt_arrays (const uint16_t *pkt_len, const struct timeval *pkt_time,
-         const uint16_t *pkt_len_twin, const struct timeval *pkt_time_twin,
+ * \fn void merge_splt_arrays (const flow_splt_t *splt, const flow_splt_t *splt_twin,
          struct timeval start_time, struct timeval start_time_twin,
          uint16_t s_idx, uint16_t r_idx,
-         uint16_t *merged_lens, uint16_t *merged_times,
-         uint32_t max_num_pkt_len, uint32_t max_merged_num_pkts)
- * \param pkt_len length of the packet
- * \param pkt_time time of the packet
- * \param pkt_len_twin length of the twin packet
- * \param pkt_time_twin time of the twin packet
+         uint16_t *merged_lens, uint16_t *merged_times)
+ * \param splt lengths and times of the packets
+ * \param splt_twin lengths and times of the twin packets
  * \param start_time start time
  * \param start_time_twin start time of twin
  * \param s_idx s index in the merge
  * \param r_idx r index in the merge
  * \param merged_lens length of the merge
  * \param merged_times time of the merge
- * \param max_merged_num_pkts number of packets merged
  * \return none
  */
-void merge_splt_arrays (const uint16_t *pkt_len, const struct timeval *pkt_time, 
-		       const uint16_t *pkt_len_twin, const struct timeval *pkt_time_twin,
+void merge_splt_arrays (const flow_splt_t *splt, const flow_splt_t *splt_twin,
 		       struct timeval start_time, struct timeval start_time_twin,
 		       uint16_t s_idx, uint16_t r_idx,
 		       uint16_t *merged_lens, uint16_t *merged_times) {
     int s,r;
     struct timeval ts_start = { 0, 0 }; /* initialize to avoid spurious warnings */
-    struct timeval tmp, tmp_r;
+    struct timeval tmp, tmp_r, ts_s, ts_r;
     struct timeval start_m;
 
     if (r_idx + s_idx == 0) {
         return ;
     } else if (r_idx == 0) {
-        ts_start = pkt_time[0];
-        tmp = pkt_time[0];
+        joy_timer_series_get(&splt->start, splt->pkt_time, 0, &ts_start);
+        tmp = ts_start;
         joy_timer_sub(&tmp, &start_time, &start_m);
     } else if (s_idx == 0) {
-        ts_start = pkt_time_twin[0];
-        tmp = pkt_time_twin[0];
+        joy_timer_series_get(&splt_twin->start, splt_twin->pkt_time, 0, &ts_start);
+        tmp = ts_start;
         joy_timer_sub(&tmp, &start_time_twin, &start_m);
     } else {
         if (joy_timer_lt(&start_time, &start_time_twin)) {
-            ts_start = pkt_time[0];
-            tmp = pkt_time[0];
+            joy_timer_series_get(&splt->start, splt->pkt_time, 0, &ts_start);
+            tmp = ts_start;
             joy_timer_sub(&tmp, &start_time, &start_m);
         } else {
             //      ts_start = pkt_time_twin[0];
-            tmp = pkt_time_twin[0];
+            joy_timer_series_get(&splt_twin->start, splt_twin->pkt_time, 0, &tmp);
             joy_timer_sub(&tmp, &start_time_twin, &start_m);
         }
     }
     s = r = 0;
     while ((s < s_idx) || (r < r_idx)) {
+        if (s < s_idx) {
+            joy_timer_series_get(&splt->start, splt->pkt_time, s, &ts_s);
+        }
+        if (r < r_idx) {
+            joy_timer_series_get(&splt_twin->start, splt_twin->pkt_time, r, &ts_r);
+        }
         if (s >= s_idx) {
-            merged_lens[s+r] = pkt_len_twin[r];
-            tmp = pkt_time_twin[r];
+            merged_lens[s+r] = splt_twin->pkt_len[r];
+            tmp = ts_r;
             joy_timer_sub(&tmp, &ts_start, &tmp_r);
             merged_times[s+r] = joy_timeval_to_milliseconds(tmp_r);
             ts_start = tmp;
             r++;
         } else if (r >= r_idx) {
-            merged_lens[s+r] = pkt_len[s];
-            tmp = pkt_time[s];
+            merged_lens[s+r] = splt->pkt_len[s];
+            tmp = ts_s;
             joy_timer_sub(&tmp, &ts_start, &tmp_r);
             merged_times[s+r] = joy_timeval_to_milliseconds(tmp_r);
             ts_start = tmp;
             s++;
         } else {
-            if (joy_timer_lt(&pkt_time[s], &pkt_time_twin[r])) {
-                merged_lens[s+r] = pkt_len[s];
-	               tmp = pkt_time[s];
+            if (joy_timer_lt(&ts_s, &ts_r)) {
+                merged_lens[s+r] = splt->pkt_len[s];
+	               tmp = ts_s;
 	               joy_timer_sub(&tmp, &ts_start, &tmp_r);
 	               merged_times[s+r] = joy_timeval_to_milliseconds(tmp_r);
 	               ts_start = tmp;
                 s++;
             } else {
-                merged_lens[s+r] = pkt_len_twin[r];
-	               tmp = pkt_time_twin[r];
+                merged_lens[s+r] = splt_twin->pkt_len[r];
+	               tmp = ts_r;
 	               joy_timer_sub(&tmp, &ts_start, &tmp_r);
 	               merged_times[s+r] = joy_timeval_to_milliseconds(tmp_r);
 	               ts_start = tmp;
@@ -405,15 +405,12 @@ void get_mc_rep_times (uint16_t *times, float *time_mc, uint16_t num_packets) {
 }
 
 /**
- * \fn float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
-        const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+ * \fn float classify (const flow_splt_t *splt, const flow_splt_t *splt_twin,
           struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
         uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
         uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t)
- * \param pkt_len length of the packet
- * \param pkt_time time of the packet
- * \param pkt_len_twin length of the packet twin
- * \param pkt_time_twin time of the packet twin
+ * \param splt lengths and times of the packets
+ * \param splt_twin lengths and times of the twin packets, or NULL
  * \param start_time start time
  * \param start_time_twin start time of the twin
  * \param max_num_pkt_len maximum len of number of packets
@@ -430,8 +427,7 @@ void get_mc_rep_times (uint16_t *times, float *time_mc, uint16_t num_packets) {
  * \param *bd_t pointer to bd type
  * \return float score
  */
-float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
-	       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+float classify (const flow_splt_t *splt, const flow_splt_t *splt_twin,
   	       struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
 	       uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
 	       uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t) {
@@ -469,7 +465,7 @@ float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
     features[7] = 0.0;// skipping 7 until we process the pkt_time arrays
 
     // find the raw features
-    merge_splt_arrays(pkt_len, pkt_time, pkt_len_twin, pkt_time_twin, start_time, start_time_twin, op_n, ip_n,
+    merge_splt_arrays(splt, splt_twin, start_time, start_time_twin, op_n, ip_n,
 		                    merged_lens, merged_times);
 
     // find new duration
@@ -494,7 +490,7 @@ float classify (const unsigned short *pkt_len, const struct timeval *pkt_time,
     // fill out byte distribution features
     if (ob+ib > 100 && use_bd) {
         for (i = 0; i < NUM_BD_VALUES; i++) {
-            if (pkt_len_twin != NULL) {
+            if (splt_twin != NULL) {
                 features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = (bd[i]+bd_t[i])/((float)(ob+ib));
             } else {
                 features[i+8+MC_BINS_LEN*MC_BINS_LEN+MC_BINS_TIME*MC_BINS_TIME] = bd[i]/((float)(ob));
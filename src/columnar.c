@@ -0,0 +1,736 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file columnar.c
+ *
+ * \brief columnar export of flow records
+ *
+ * Rows are added one flow record at a time and kept as one growing
+ * array per column; once chunk_rows rows have been added, each column
+ * is compressed on its own and the chunk is appended to the file.  The
+ * layout is described in columnar.h.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "columnar.h"
+#include "output.h"     /* for the compression of the output */
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/* the compression of each codec, indexed by codec */
+static const unsigned int columnar_codecs[COLUMNAR_NUM_CODECS] = {
+    ZFILE_COMPRESSION_NONE,     /* RAW   */
+    ZFILE_COMPRESSION_GZIP,     /* ZLIB  */
+    ZFILE_COMPRESSION_BZIP2,    /* BZIP2 */
+    ZFILE_COMPRESSION_ZSTD,     /* ZSTD  */
+    ZFILE_COMPRESSION_LZ4       /* LZ4   */
+};
+
+/* type and width of each column, indexed by enum columnar_column */
+static const struct {
+    uint8_t type;
+    uint8_t width;
+} columnar_columns[COLUMNAR_NUM_COLUMNS] = {
+    { COLUMNAR_TYPE_ADDR, 16 },  /* sa         */
+    { COLUMNAR_TYPE_ADDR, 16 },  /* da         */
+    { COLUMNAR_TYPE_UINT, 2 },   /* sp         */
+    { COLUMNAR_TYPE_UINT, 2 },   /* dp         */
+    { COLUMNAR_TYPE_UINT, 1 },   /* pr         */
+    { COLUMNAR_TYPE_UINT, 4 },   /* bytes_out  */
+    { COLUMNAR_TYPE_UINT, 4 },   /* pkts_out   */
+    { COLUMNAR_TYPE_UINT, 4 },   /* bytes_in   */
+    { COLUMNAR_TYPE_UINT, 4 },   /* pkts_in    */
+    { COLUMNAR_TYPE_INT, 8 },    /* time_start */
+    { COLUMNAR_TYPE_INT, 8 },    /* time_end   */
+    { COLUMNAR_TYPE_LIST, 2 },   /* pkt_len    */
+    { COLUMNAR_TYPE_LIST, 1 },   /* pkt_dir    */
+    { COLUMNAR_TYPE_LIST, 4 },   /* pkt_ipt    */
+    { COLUMNAR_TYPE_LIST, 4 },   /* byte_dist  */
+    { COLUMNAR_TYPE_LIST, 2 },   /* tls_cs     */
+    { COLUMNAR_TYPE_UINT, 2 },   /* tls_scs    */
+};
+
+/* a growable byte array */
+typedef struct columnar_buf_ {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} columnar_buf_t;
+
+/* the values of a column in the chunk being built */
+typedef struct columnar_col_ {
+    columnar_buf_t values;
+    columnar_buf_t offsets;             /*!< LIST columns only           */
+    uint32_t num_values;
+    uint8_t has_stats;
+    uint64_t umin, umax;
+    int64_t imin, imax;
+    uint8_t amin[16], amax[16];
+} columnar_col_t;
+
+struct columnar_ {
+    FILE *f;
+    unsigned int chunk_rows;
+    unsigned int rows;
+    columnar_col_t cols[COLUMNAR_NUM_COLUMNS];
+    columnar_buf_t chunk;               /*!< the chunk being written out */
+    columnar_buf_t raw;                 /*!< a column, as stored         */
+    columnar_buf_t packed;              /*!< a column, compressed        */
+    uint8_t codec;                      /*!< codec of compressed columns */
+    int level;                          /*!< compression level           */
+};
+
+/* make room for len more bytes at the end of b */
+static int columnar_reserve (columnar_buf_t *b, size_t len) {
+    unsigned char *data;
+    size_t size;
+
+    if (b->len + len <= b->size) {
+        return ok;
+    }
+    size = b->size ? b->size : 4096;
+    while (size < b->len + len) {
+        size *= 2;
+    }
+    data = realloc(b->data, size);
+    if (data == NULL) {
+        return failure;
+    }
+    b->data = data;
+    b->size = size;
+    return ok;
+}
+
+/* store v little endian in width bytes at p */
+static void columnar_le (unsigned char *p, uint64_t v, unsigned int width) {
+    unsigned int i;
+
+    for (i = 0; i < width; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static int columnar_append (columnar_buf_t *b, const void *data, size_t len) {
+    if (columnar_reserve(b, len) != ok) {
+        return failure;
+    }
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+    return ok;
+}
+
+static int columnar_append_le (columnar_buf_t *b, uint64_t v, unsigned int width) {
+    if (columnar_reserve(b, width) != ok) {
+        return failure;
+    }
+    columnar_le(b->data + b->len, v, width);
+    b->len += width;
+    return ok;
+}
+
+/* add an unsigned value to a UINT or LIST column */
+static int columnar_put_uint (columnar_col_t *col, unsigned int width, uint64_t v) {
+    if (!col->has_stats || v < col->umin) {
+        col->umin = v;
+    }
+    if (!col->has_stats || v > col->umax) {
+        col->umax = v;
+    }
+    col->has_stats = 1;
+    col->num_values++;
+    return columnar_append_le(&col->values, v, width);
+}
+
+static int columnar_put_int (columnar_col_t *col, int64_t v) {
+    if (!col->has_stats || v < col->imin) {
+        col->imin = v;
+    }
+    if (!col->has_stats || v > col->imax) {
+        col->imax = v;
+    }
+    col->has_stats = 1;
+    col->num_values++;
+    return columnar_append_le(&col->values, (uint64_t)v, 8);
+}
+
+static int columnar_put_addr (columnar_col_t *col, const uint8_t *a) {
+    if (!col->has_stats || memcmp(a, col->amin, 16) < 0) {
+        memcpy(col->amin, a, 16);
+    }
+    if (!col->has_stats || memcmp(a, col->amax, 16) > 0) {
+        memcpy(col->amax, a, 16);
+    }
+    col->has_stats = 1;
+    col->num_values++;
+    return columnar_append(&col->values, a, 16);
+}
+
+/* end the list of the current row of a LIST column */
+static int columnar_end_list (columnar_col_t *col) {
+    return columnar_append_le(&col->offsets, col->num_values, 4);
+}
+
+/* add the values of a LIST column, given as an array of width bytes */
+#define columnar_put_list(rc, col, width, array, n) do {            \
+    unsigned int k_;                                                \
+    for (k_ = 0; k_ < (n); k_++) {                                  \
+        (rc) |= columnar_put_uint(col, width, (array)[k_]);         \
+    }                                                               \
+    (rc) |= columnar_end_list(col);                                 \
+} while (0)
+
+/**
+ * \brief Open a columnar file.
+ *
+ * The file is opened for appending; since every chunk is complete in
+ * itself, a file that already holds chunks stays readable.
+ *
+ * \param fname The name of the file
+ * \param chunk_rows Rows per chunk, or 0 for COLUMNAR_DEFAULT_ROWS
+ * \return The writer, or NULL on failure
+ */
+columnar_t *columnar_open (const char *fname, unsigned int chunk_rows) {
+    columnar_t *c;
+    unsigned int i;
+
+    c = calloc(1, sizeof(columnar_t));
+    if (c == NULL) {
+        joy_log_err("out of memory");
+        return NULL;
+    }
+    c->f = fopen(fname, "ab");
+    if (c->f == NULL) {
+        joy_log_err("could not open columnar file %s", fname);
+        free(c);
+        return NULL;
+    }
+    if (chunk_rows == 0) {
+        chunk_rows = COLUMNAR_DEFAULT_ROWS;
+    }
+    c->chunk_rows = chunk_rows > COLUMNAR_MAX_ROWS ? COLUMNAR_MAX_ROWS : chunk_rows;
+
+    /* compress columns as the output is compressed */
+    for (i = 0; i < COLUMNAR_NUM_CODECS; i++) {
+        if (columnar_codecs[i] == zcompression_configured()) {
+            c->codec = (uint8_t)i;
+        }
+    }
+    if (glb_config != NULL) {
+        c->level = (int)glb_config->compress_level;
+    }
+
+    for (i = 0; i < COLUMNAR_NUM_COLUMNS; i++) {
+        if (columnar_columns[i].type == COLUMNAR_TYPE_LIST) {
+            columnar_append_le(&c->cols[i].offsets, 0, 4);
+        }
+    }
+    return c;
+}
+
+/**
+ * \brief Add a row to the chunk being built.
+ *
+ * The chunk is written out once it holds chunk_rows rows.
+ *
+ * \param c The writer
+ * \param row The values of the row
+ * \return ok, or failure if memory ran out or the write failed
+ */
+int columnar_add (columnar_t *c, const columnar_row_t *row) {
+    columnar_col_t *cols = c->cols;
+    unsigned int num_pkts, num_cs, num_bd;
+    int rc = ok;
+
+    num_pkts = row->num_pkts > COLUMNAR_MAX_PKTS ? COLUMNAR_MAX_PKTS : row->num_pkts;
+    num_cs = row->num_cs > COLUMNAR_MAX_CS ? COLUMNAR_MAX_CS : row->num_cs;
+    num_bd = row->num_byte_dist > 256 ? 256 : row->num_byte_dist;
+
+    rc |= columnar_put_addr(&cols[COLUMNAR_SA], row->sa);
+    rc |= columnar_put_addr(&cols[COLUMNAR_DA], row->da);
+    rc |= columnar_put_uint(&cols[COLUMNAR_SP], 2, row->sp);
+    rc |= columnar_put_uint(&cols[COLUMNAR_DP], 2, row->dp);
+    rc |= columnar_put_uint(&cols[COLUMNAR_PR], 1, row->pr);
+    rc |= columnar_put_uint(&cols[COLUMNAR_BYTES_OUT], 4, row->bytes_out);
+    rc |= columnar_put_uint(&cols[COLUMNAR_PKTS_OUT], 4, row->pkts_out);
+    rc |= columnar_put_uint(&cols[COLUMNAR_BYTES_IN], 4, row->bytes_in);
+    rc |= columnar_put_uint(&cols[COLUMNAR_PKTS_IN], 4, row->pkts_in);
+    rc |= columnar_put_int(&cols[COLUMNAR_TIME_START], row->time_start);
+    rc |= columnar_put_int(&cols[COLUMNAR_TIME_END], row->time_end);
+    columnar_put_list(rc, &cols[COLUMNAR_PKT_LEN], 2, row->pkt_len, num_pkts);
+    columnar_put_list(rc, &cols[COLUMNAR_PKT_DIR], 1, row->pkt_dir, num_pkts);
+    columnar_put_list(rc, &cols[COLUMNAR_PKT_IPT], 4, row->pkt_ipt, num_pkts);
+    columnar_put_list(rc, &cols[COLUMNAR_BYTE_DIST], 4, row->byte_dist, num_bd);
+    columnar_put_list(rc, &cols[COLUMNAR_TLS_CS], 2, row->cs, num_cs);
+    rc |= columnar_put_uint(&cols[COLUMNAR_TLS_SCS], 2, row->scs);
+    if (rc != ok) {
+        joy_log_err("out of memory");
+        return failure;
+    }
+
+    if (++c->rows >= c->chunk_rows) {
+        return columnar_flush(c);
+    }
+    return ok;
+}
+
+/* compress len bytes at data into c->packed; failure if that does not shrink them */
+static int columnar_pack (columnar_t *c, const unsigned char *data, size_t len) {
+    unsigned int compression = columnar_codecs[c->codec];
+    size_t packed_len = zcompress_bound(compression, len);
+
+    c->packed.len = 0;
+    if (c->codec == COLUMNAR_CODEC_RAW || len < 64 ||
+        columnar_reserve(&c->packed, packed_len) != ok ||
+        zcompress_block(compression, c->level, data, len, c->packed.data, &packed_len) != ok) {
+        return failure;
+    }
+    c->packed.len = packed_len;
+    return c->packed.len < len ? ok : failure;
+}
+
+/* the bytes of column i, as stored before compression, in c->raw */
+static int columnar_column_bytes (columnar_t *c, unsigned int i) {
+    const columnar_col_t *col = &c->cols[i];
+
+    c->raw.len = 0;
+    if (columnar_columns[i].type == COLUMNAR_TYPE_LIST) {
+        if (columnar_append(&c->raw, col->offsets.data, col->offsets.len) != ok) {
+            return failure;
+        }
+    }
+    return columnar_append(&c->raw, col->values.data, col->values.len);
+}
+
+/* write the descriptor of column i at d */
+static void columnar_descriptor (const columnar_t *c, unsigned int i, unsigned char *d,
+                                 uint8_t codec, size_t raw_len, size_t stored_len) {
+    const columnar_col_t *col = &c->cols[i];
+
+    memset_s(d, COLUMNAR_DESC_LEN, 0x00, COLUMNAR_DESC_LEN);
+    d[0] = (unsigned char)i;
+    d[1] = columnar_columns[i].type;
+    d[2] = columnar_columns[i].width;
+    d[3] = codec;
+    d[4] = col->has_stats ? COLUMNAR_FLAG_STATS : 0;
+    columnar_le(d + 8, raw_len, 4);
+    columnar_le(d + 12, stored_len, 4);
+    if (!col->has_stats) {
+        return;
+    }
+    switch (columnar_columns[i].type) {
+    case COLUMNAR_TYPE_ADDR:
+        memcpy(d + 16, col->amin, 16);
+        memcpy(d + 32, col->amax, 16);
+        break;
+    case COLUMNAR_TYPE_INT:
+        columnar_le(d + 16, (uint64_t)col->imin, 8);
+        columnar_le(d + 32, (uint64_t)col->imax, 8);
+        break;
+    default:
+        columnar_le(d + 16, col->umin, 8);
+        columnar_le(d + 32, col->umax, 8);
+        break;
+    }
+}
+
+/* empty the columns for the next chunk */
+static void columnar_reset (columnar_t *c) {
+    unsigned int i;
+
+    for (i = 0; i < COLUMNAR_NUM_COLUMNS; i++) {
+        columnar_col_t *col = &c->cols[i];
+
+        col->values.len = 0;
+        col->offsets.len = 0;
+        col->num_values = 0;
+        col->has_stats = 0;
+        if (columnar_columns[i].type == COLUMNAR_TYPE_LIST) {
+            columnar_append_le(&col->offsets, 0, 4);
+        }
+    }
+    c->rows = 0;
+}
+
+/* lay out the chunk of the rows added so far in c->chunk */
+static int columnar_build_chunk (columnar_t *c) {
+    size_t data_off = COLUMNAR_HEADER_LEN + COLUMNAR_NUM_COLUMNS * COLUMNAR_DESC_LEN;
+    unsigned char *d;
+    unsigned int i;
+
+    c->chunk.len = 0;
+    if (columnar_reserve(&c->chunk, data_off) != ok) {
+        return failure;
+    }
+    memset_s(c->chunk.data, data_off, 0x00, data_off);
+    c->chunk.len = data_off;
+
+    for (i = 0; i < COLUMNAR_NUM_COLUMNS; i++) {
+        const columnar_buf_t *stored = &c->raw;
+        uint8_t codec = COLUMNAR_CODEC_RAW;
+
+        if (columnar_column_bytes(c, i) != ok) {
+            return failure;
+        }
+        if (columnar_pack(c, c->raw.data, c->raw.len) == ok) {
+            stored = &c->packed;
+            codec = c->codec;
+        }
+        if (columnar_append(&c->chunk, stored->data, stored->len) != ok) {
+            return failure;
+        }
+        d = c->chunk.data + COLUMNAR_HEADER_LEN + i * COLUMNAR_DESC_LEN;
+        columnar_descriptor(c, i, d, codec, c->raw.len, stored->len);
+    }
+
+    d = c->chunk.data;
+    memcpy(d, COLUMNAR_MAGIC, COLUMNAR_MAGIC_LEN);
+    d[4] = COLUMNAR_VERSION;
+    columnar_le(d + 8, c->chunk.len, 4);
+    columnar_le(d + 12, c->rows, 4);
+    columnar_le(d + 16, COLUMNAR_NUM_COLUMNS, 2);
+    return ok;
+}
+
+/**
+ * \brief Write out the rows added so far as a chunk.
+ *
+ * \param c The writer
+ * \return ok, or failure if memory ran out or the write failed; the
+ *         rows are dropped either way
+ */
+int columnar_flush (columnar_t *c) {
+    int rc = ok;
+
+    if (c == NULL || c->rows == 0) {
+        return ok;
+    }
+    if (columnar_build_chunk(c) != ok) {
+        joy_log_err("out of memory");
+        rc = failure;
+    } else if (fwrite(c->chunk.data, 1, c->chunk.len, c->f) != c->chunk.len) {
+        joy_log_err("could not write columnar chunk");
+        rc = failure;
+    }
+    columnar_reset(c);
+    return rc;
+}
+
+/**
+ * \brief Write out the remaining rows, close the file and free the
+ *        writer.
+ *
+ * \param c The writer, or NULL
+ * \return none
+ */
+void columnar_close (columnar_t *c) {
+    unsigned int i;
+
+    if (c == NULL) {
+        return;
+    }
+    columnar_flush(c);
+    fclose(c->f);
+    for (i = 0; i < COLUMNAR_NUM_COLUMNS; i++) {
+        free(c->cols[i].values.data);
+        free(c->cols[i].offsets.data);
+    }
+    free(c->chunk.data);
+    free(c->raw.data);
+    free(c->packed.data);
+    free(c);
+}
+
+/*
+ * unit test
+ */
+
+#define COLUMNAR_TEST_FILE "columnar-unit-test"
+#define COLUMNAR_TEST_ROWS 250
+#define COLUMNAR_TEST_CHUNK_ROWS 100
+#define COLUMNAR_TEST_TIME 1500000000000000LL
+
+/* the row that the test adds as row i */
+static void columnar_test_row (columnar_row_t *row, unsigned int i) {
+    unsigned int k;
+
+    memset_s(row, sizeof(columnar_row_t), 0x00, sizeof(columnar_row_t));
+    row->sa[10] = row->sa[11] = 0xff;
+    row->sa[12] = 10;
+    row->sa[14] = (uint8_t)(i >> 8);
+    row->sa[15] = (uint8_t)i;
+    memcpy(row->da, row->sa, 16);
+    row->da[12] = 192;
+    row->sp = (uint16_t)(40000 + i);
+    row->dp = 443;
+    row->pr = 6;
+    row->bytes_out = i * 100;
+    row->pkts_out = i;
+    row->time_start = COLUMNAR_TEST_TIME + i * 1000;
+    row->time_end = row->time_start + 5000000;
+    row->num_pkts = (uint16_t)(i % 5);
+    for (k = 0; k < row->num_pkts; k++) {
+        row->pkt_len[k] = (uint16_t)(i + k);
+        row->pkt_dir[k] = k & 1;
+        row->pkt_ipt[k] = k * 10;
+    }
+    if (i % 3 == 0) {
+        row->num_byte_dist = 256;
+        for (k = 0; k < 256; k++) {
+            row->byte_dist[k] = k + i;
+        }
+    }
+    if (i % 2 == 0) {
+        row->num_cs = 3;
+        row->cs[0] = 0xc02b;
+        row->cs[1] = 0xc02f;
+        row->cs[2] = (uint16_t)i;
+        row->scs = 0xc02f;
+    }
+}
+
+static uint64_t columnar_test_le (const unsigned char *p, unsigned int width) {
+    uint64_t v = 0;
+
+    while (width--) {
+        v = (v << 8) | p[width];
+    }
+    return v;
+}
+
+/* decompress a column into out, which holds raw_len bytes */
+static int columnar_test_unpack (const unsigned char *d, const unsigned char *stored,
+                                 unsigned char *out, size_t raw_len) {
+    size_t stored_len = (size_t)columnar_test_le(d + 12, 4);
+
+    if (d[3] >= COLUMNAR_NUM_CODECS) {
+        return failure;
+    }
+    return zdecompress_block(columnar_codecs[d[3]], stored, stored_len, out, raw_len);
+}
+
+/* check a chunk holding rows first to first+rows-1; returns the number of failures */
+static int columnar_test_chunk (const unsigned char *chunk, size_t len,
+                                unsigned int first, unsigned int rows) {
+    unsigned char *cols[COLUMNAR_NUM_COLUMNS] = { NULL, };
+    const unsigned char *d, *data;
+    columnar_row_t expect;
+    unsigned int i, k, r, num_cols;
+    int num_fails = 0;
+
+    if (len < COLUMNAR_HEADER_LEN || memcmp(chunk, COLUMNAR_MAGIC, COLUMNAR_MAGIC_LEN) != 0 ||
+        chunk[4] != COLUMNAR_VERSION || columnar_test_le(chunk + 12, 4) != rows) {
+        joy_log_err("bad chunk header");
+        return 1;
+    }
+    num_cols = (unsigned int)columnar_test_le(chunk + 16, 2);
+    if (num_cols != COLUMNAR_NUM_COLUMNS) {
+        joy_log_err("chunk has %u columns", num_cols);
+        return 1;
+    }
+
+    /* unpack the columns */
+    data = chunk + COLUMNAR_HEADER_LEN + num_cols * COLUMNAR_DESC_LEN;
+    for (i = 0; i < num_cols; i++) {
+        size_t raw_len;
+
+        d = chunk + COLUMNAR_HEADER_LEN + i * COLUMNAR_DESC_LEN;
+        raw_len = (size_t)columnar_test_le(d + 8, 4);
+        if (d[0] != i || d[1] != columnar_columns[i].type || d[2] != columnar_columns[i].width) {
+            joy_log_err("bad descriptor of column %u", i);
+            num_fails++;
+            goto done;
+        }
+        cols[i] = malloc(raw_len + 1);
+        if (cols[i] == NULL || data + columnar_test_le(d + 12, 4) > chunk + len ||
+            columnar_test_unpack(d, data, cols[i], raw_len) != ok) {
+            joy_log_err("could not unpack column %u", i);
+            num_fails++;
+            goto done;
+        }
+        data += columnar_test_le(d + 12, 4);
+    }
+    if (data != chunk + len) {
+        joy_log_err("chunk length mismatch");
+        num_fails++;
+    }
+
+    /* the time range, for chunk skipping */
+    d = chunk + COLUMNAR_HEADER_LEN + COLUMNAR_TIME_START * COLUMNAR_DESC_LEN;
+    if (!(d[4] & COLUMNAR_FLAG_STATS) ||
+        (int64_t)columnar_test_le(d + 16, 8) != COLUMNAR_TEST_TIME + first * 1000 ||
+        (int64_t)columnar_test_le(d + 32, 8) != COLUMNAR_TEST_TIME + (first + rows - 1) * 1000) {
+        joy_log_err("wrong time_start statistics");
+        num_fails++;
+    }
+    d = chunk + COLUMNAR_HEADER_LEN + COLUMNAR_SA * COLUMNAR_DESC_LEN;
+    if (d[16 + 12] != 10 || d[16 + 15] != (uint8_t)first || d[32 + 15] != (uint8_t)(first + rows - 1)) {
+        joy_log_err("wrong sa statistics");
+        num_fails++;
+    }
+
+    /* the values of each row */
+    for (r = 0; r < rows; r++) {
+        const unsigned char *off;
+
+        columnar_test_row(&expect, first + r);
+        if (memcmp(cols[COLUMNAR_DA] + r * 16, expect.da, 16) != 0 ||
+            columnar_test_le(cols[COLUMNAR_SP] + r * 2, 2) != expect.sp ||
+            columnar_test_le(cols[COLUMNAR_BYTES_OUT] + r * 4, 4) != expect.bytes_out ||
+            (int64_t)columnar_test_le(cols[COLUMNAR_TIME_END] + r * 8, 8) != expect.time_end ||
+            columnar_test_le(cols[COLUMNAR_TLS_SCS] + r * 2, 2) != expect.scs) {
+            joy_log_err("wrong values in row %u", first + r);
+            num_fails++;
+            break;
+        }
+
+        off = cols[COLUMNAR_PKT_LEN] + r * 4;
+        k = (unsigned int)columnar_test_le(off, 4);
+        if (columnar_test_le(off + 4, 4) - k != expect.num_pkts ||
+            (expect.num_pkts && columnar_test_le(cols[COLUMNAR_PKT_LEN] + (rows + 1) * 4 + k * 2, 2) != expect.pkt_len[0])) {
+            joy_log_err("wrong packet lengths in row %u", first + r);
+            num_fails++;
+            break;
+        }
+        off = cols[COLUMNAR_TLS_CS] + r * 4;
+        k = (unsigned int)columnar_test_le(off, 4);
+        if (columnar_test_le(off + 4, 4) - k != expect.num_cs ||
+            (expect.num_cs && columnar_test_le(cols[COLUMNAR_TLS_CS] + (rows + 1) * 4 + (k + 2) * 2, 2) != expect.cs[2])) {
+            joy_log_err("wrong ciphersuites in row %u", first + r);
+            num_fails++;
+            break;
+        }
+        off = cols[COLUMNAR_BYTE_DIST] + r * 4;
+        if (columnar_test_le(off + 4, 4) - columnar_test_le(off, 4) != expect.num_byte_dist) {
+            joy_log_err("wrong byte distribution in row %u", first + r);
+            num_fails++;
+            break;
+        }
+    }
+
+ done:
+    for (i = 0; i < COLUMNAR_NUM_COLUMNS; i++) {
+        free(cols[i]);
+    }
+    return num_fails;
+}
+
+/**
+ * \fn int columnar_unit_test (void)
+ *
+ * \brief Writes rows in chunks, appends to the file, and checks the
+ *        chunks, their statistics and their values.
+ *
+ * \return 0 on success, or the number of failures
+ */
+int columnar_unit_test (void) {
+    static const unsigned int chunk_rows[] = { 100, 100, 50, 1 };
+    columnar_row_t row;
+    columnar_t *c;
+    unsigned char *buf = NULL;
+    long file_len;
+    size_t off = 0;
+    unsigned int i, chunk, first = 0;
+    int num_fails = 0;
+    FILE *f;
+
+    remove(COLUMNAR_TEST_FILE);
+    c = columnar_open(COLUMNAR_TEST_FILE, COLUMNAR_TEST_CHUNK_ROWS);
+    if (c == NULL) {
+        return 1;
+    }
+    for (i = 0; i < COLUMNAR_TEST_ROWS; i++) {
+        columnar_test_row(&row, i);
+        num_fails += columnar_add(c, &row) != ok;
+    }
+    columnar_close(c);
+
+    /* a second writer appends its chunk to the file */
+    c = columnar_open(COLUMNAR_TEST_FILE, 0);
+    if (c == NULL) {
+        return num_fails + 1;
+    }
+    columnar_test_row(&row, COLUMNAR_TEST_ROWS);
+    num_fails += columnar_add(c, &row) != ok;
+    num_fails += columnar_flush(c) != ok;
+    num_fails += columnar_flush(c) != ok;   /* nothing to write */
+    columnar_close(c);
+
+    f = fopen(COLUMNAR_TEST_FILE, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0 || (file_len = ftell(f)) <= 0 ||
+        fseek(f, 0, SEEK_SET) != 0 || (buf = malloc(file_len)) == NULL ||
+        fread(buf, 1, file_len, f) != (size_t)file_len) {
+        joy_log_err("could not read the columnar test file");
+        if (f != NULL) {
+            fclose(f);
+        }
+        free(buf);
+        return num_fails + 1;
+    }
+    fclose(f);
+
+    for (chunk = 0; chunk < sizeof(chunk_rows) / sizeof(chunk_rows[0]); chunk++) {
+        size_t chunk_len;
+
+        if (off + COLUMNAR_HEADER_LEN > (size_t)file_len) {
+            joy_log_err("missing chunk %u", chunk);
+            num_fails++;
+            break;
+        }
+        chunk_len = (size_t)columnar_test_le(buf + off + 8, 4);
+        if (chunk_len > (size_t)file_len - off) {
+            joy_log_err("chunk %u is truncated", chunk);
+            num_fails++;
+            break;
+        }
+        num_fails += columnar_test_chunk(buf + off, chunk_len, first, chunk_rows[chunk]);
+        first += chunk_rows[chunk];
+        off += chunk_len;
+    }
+    if (off != (size_t)file_len) {
+        joy_log_err("unexpected bytes after the last chunk");
+        num_fails++;
+    }
+
+    free(buf);
+    remove(COLUMNAR_TEST_FILE);
+    return num_fails;
+}
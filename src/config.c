@@ -52,6 +52,9 @@
 #include "radix_trie.h"
 #include "hdr_dsc.h" 
 #include "p2f.h"
+#include "columnar.h"
+#include "shm_ring.h"
+#include "affinity.h"
 
 #ifdef WIN32
 #include "unistd.h"
@@ -141,6 +144,155 @@ static int parse_string (char **s, char *arg, int num_arg) {
     return ok;
 }
 
+/* names of the flow eviction policies, indexed by enum flow_evict_policy */
+static const char *flow_evict_names[] = { "lru", "oldest", "nopayload" };
+
+/* parses a flow eviction policy name */
+static int parse_flow_evict (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < sizeof(flow_evict_names) / sizeof(flow_evict_names[0]); i++) {
+        if (strcmp(arg, flow_evict_names[i]) == 0) {
+            *x = i;
+            return ok;
+        }
+    }
+    printf("error: value must be lru, oldest or nopayload ");
+    return failure;
+}
+
+/* names of the output formats, indexed by enum output_format */
+static const char *output_format_names[] = { "json", "binary" };
+
+/* parses an output format name */
+static int parse_output_format (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < sizeof(output_format_names) / sizeof(output_format_names[0]); i++) {
+        if (strcmp(arg, output_format_names[i]) == 0) {
+            *x = i;
+            return ok;
+        }
+    }
+    printf("error: value must be json or binary ");
+    return failure;
+}
+
+/* names of the ring policies, indexed by enum shm_ring_policy */
+static const char *ring_policy_names[] = { "overwrite", "block" };
+
+/* parses a ring policy name */
+static int parse_ring_policy (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < sizeof(ring_policy_names) / sizeof(ring_policy_names[0]); i++) {
+        if (strcmp(arg, ring_policy_names[i]) == 0) {
+            *x = i;
+            return ok;
+        }
+    }
+    printf("error: value must be overwrite or block ");
+    return failure;
+}
+
+/* parses a list of CPUs, see cpu_list_parse(), keeping it as given */
+static int parse_cpu_list (char **s, char *arg, int num_arg) {
+    cpu_list_t *l;
+    int rc;
+
+    if (s == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    if (strncmp(arg, NULL_KEYWORD, strlen(NULL_KEYWORD)) != 0) {
+        l = malloc(sizeof(cpu_list_t));
+        if (l == NULL) {
+            return failure;
+        }
+        rc = cpu_list_parse(l, arg);
+        free(l);
+        if (rc != ok) {
+            printf("error: value must be a list of cpus such as 0-3,8 ");
+            return failure;
+        }
+    }
+    return parse_string(s, arg, num_arg);
+}
+
+/* names of the capture backends, indexed by enum capture_backend */
+static const char *capture_names[] = { "af_packet", "af_xdp" };
+
+/* parses a capture backend name, which the build must include */
+static int parse_capture (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < sizeof(capture_names) / sizeof(capture_names[0]); i++) {
+        if (strcmp(arg, capture_names[i]) == 0) {
+#ifndef USE_AF_PACKET
+            printf("error: %s is not included in this build ", arg);
+            return failure;
+#else
+            *x = i;
+            return ok;
+#endif
+        }
+    }
+    printf("error: value must be af_packet or af_xdp ");
+    return failure;
+}
+
+/* names of the AF_XDP modes, indexed by enum xdp_mode */
+static const char *xdp_mode_names[] = { "auto", "copy", "zerocopy" };
+
+/* parses an AF_XDP mode name */
+static int parse_xdp_mode (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < sizeof(xdp_mode_names) / sizeof(xdp_mode_names[0]); i++) {
+        if (strcmp(arg, xdp_mode_names[i]) == 0) {
+            *x = i;
+            return ok;
+        }
+    }
+    printf("error: value must be auto, copy or zerocopy ");
+    return failure;
+}
+
+/* parses a compression backend name, which the build must include */
+static int parse_compression (uint8_t *x, const char *arg, int num_arg) {
+    unsigned int i;
+
+    if (x == NULL || arg == NULL || num_arg != 2) {
+        return failure;
+    }
+    for (i = 0; i < ZFILE_COMPRESSION_MAX; i++) {
+        if (strcmp(arg, zcompression_name(i)) == 0) {
+            if (!zcompression_available(i)) {
+                printf("error: %s is not included in this build ", arg);
+                return failure;
+            }
+            *x = i;
+            return ok;
+        }
+    }
+    printf("error: value must be none, gzip, bzip2, zstd or lz4 ");
+    return failure;
+}
+
 /* parses mutliple part string values */
 static int parse_string_multiple (char **s, char *arg, int num_arg,
            unsigned int string_num, unsigned int string_num_max) {
@@ -257,6 +409,81 @@ static int config_parse_command (configuration_t *config,
     } else if (match(command, "count")) {
         parse_check(parse_int(&config->max_records, arg, num, 1, INT_MAX));
 
+    } else if (match(command, "rotate_bytes")) {
+        parse_check(parse_int(&config->rotate_bytes, arg, num, 1, INT_MAX));
+
+    } else if (match(command, "rotate_interval")) {
+        parse_check(parse_int(&config->rotate_interval, arg, num, 1, INT_MAX));
+
+    } else if (match(command, "rotate_hook")) {
+        parse_check(parse_string(&config->rotate_hook, arg, num));
+
+    } else if (match(command, "rotate_spool")) {
+        parse_check(parse_string(&config->rotate_spool, arg, num));
+
+    } else if (match(command, "flow_table_size")) {
+        parse_check(parse_int(&config->flow_table_size, arg, num, FLOW_TABLE_MIN_SIZE, FLOW_TABLE_MAX_SIZE));
+
+    } else if (match(command, "flow_pool_size")) {
+        parse_check(parse_int(&config->flow_pool_size, arg, num, 0, FLOW_RECORD_POOL_MAX_SIZE));
+
+    } else if (match(command, "max_flows")) {
+        parse_check(parse_int(&config->max_flows, arg, num, 0, INT_MAX));
+
+    } else if (match(command, "flow_evict")) {
+        parse_check(parse_flow_evict(&config->flow_evict, arg, num));
+
+    } else if (match(command, "housekeeping")) {
+        parse_check(parse_int(&config->housekeeping_ms, arg, num, 1, 1000));
+
+    } else if (match(command, "expire_max")) {
+        parse_check(parse_int(&config->expire_max, arg, num, 0, INT_MAX));
+
+    } else if (match(command, "capture_cpus")) {
+        parse_check(parse_cpu_list(&config->capture_cpus, arg, num));
+
+    } else if (match(command, "capture")) {
+        parse_check(parse_capture(&config->capture, arg, num));
+
+    } else if (match(command, "xdp_mode")) {
+        parse_check(parse_xdp_mode(&config->xdp_mode, arg, num));
+
+    } else if (match(command, "worker_cpus")) {
+        parse_check(parse_cpu_list(&config->worker_cpus, arg, num));
+
+    } else if (match(command, "format")) {
+        parse_check(parse_output_format(&config->output_format, arg, num));
+
+    } else if (match(command, "columnar")) {
+        parse_check(parse_string(&config->columnar, arg, num));
+
+    } else if (match(command, "chunk_rows")) {
+        parse_check(parse_int(&config->chunk_rows, arg, num, 1, COLUMNAR_MAX_ROWS));
+
+    } else if (match(command, "compression")) {
+        parse_check(parse_compression(&config->compression, arg, num));
+
+    } else if (match(command, "compress_level")) {
+        parse_check(parse_int(&config->compress_level, arg, num, 0, 22));
+
+    } else if (match(command, "compress_threads")) {
+        parse_check(parse_int(&config->compress_threads, arg, num, 0, 64));
+
+    } else if (match(command, "ring_file")) {
+        parse_check(parse_string(&config->ring_file, arg, num));
+
+    } else if (match(command, "ring_size")) {
+        parse_check(parse_int(&config->ring_size, arg, num, SHM_RING_MIN_SIZE, INT_MAX));
+
+    } else if (match(command, "ring_policy")) {
+        parse_check(parse_ring_policy(&config->ring_policy, arg, num));
+
+    } else if (match(command, "fields")) {
+        parse_check(parse_string(&config->fields, arg, num));
+
+    } else if (match(command, "hugepages")) {
+        parse_check(parse_bool(&config->hugepages, arg, num));
+
     } else if (match(command, "idp")) {
         parse_check(parse_int((unsigned int*)&config->idp, arg, num, 0, MAX_IDP));
 
@@ -331,6 +558,11 @@ void config_set_defaults (configuration_t *config) {
     config->num_pkts = DEFAULT_NUM_PKT_LEN;
     config->num_threads = 1;
     config->updater_on = 0;
+    config->flow_table_size = FLOW_TABLE_DEFAULT_SIZE;
+    config->housekeeping_ms = HOUSEKEEPING_DEFAULT_MS;
+    config->expire_max = EXPIRE_DEFAULT_MAX;
+    config->chunk_rows = COLUMNAR_DEFAULT_ROWS;
+    config->ring_size = SHM_RING_DEFAULT_SIZE;
 }
 
 #define MAX_FILEPATH 128
@@ -543,6 +775,10 @@ void config_print (FILE *f, const configuration_t *c) {
     fprintf(f, "outputdir = %s\n", val(c->outputdir));
     fprintf(f, "username = %s\n", val(c->username));
     fprintf(f, "count = %u\n", c->max_records); 
+    fprintf(f, "rotate_bytes = %u\n", c->rotate_bytes);
+    fprintf(f, "rotate_interval = %u\n", c->rotate_interval);
+    fprintf(f, "rotate_hook = %s\n", val(c->rotate_hook));
+    fprintf(f, "rotate_spool = %s\n", val(c->rotate_spool));
     fprintf(f, "upload = %s\n", val(c->upload_servername));
     fprintf(f, "keyfile = %s\n", val(c->upload_key));
     for (i=0; i<c->num_subnets; i++) {
@@ -568,6 +804,27 @@ void config_print (FILE *f, const configuration_t *c) {
 
     fprintf(f, "verbosity = %u\n", c->verbosity);
     fprintf(f, "threads = %u\n", c->num_threads);
+    fprintf(f, "flow_table_size = %u\n", c->flow_table_size);
+    fprintf(f, "flow_pool_size = %u\n", c->flow_pool_size);
+    fprintf(f, "max_flows = %u\n", c->max_flows);
+    fprintf(f, "flow_evict = %s\n", flow_evict_names[c->flow_evict]);
+    fprintf(f, "housekeeping = %u\n", c->housekeeping_ms);
+    fprintf(f, "expire_max = %u\n", c->expire_max);
+    fprintf(f, "capture = %s\n", capture_names[c->capture]);
+    fprintf(f, "xdp_mode = %s\n", xdp_mode_names[c->xdp_mode]);
+    fprintf(f, "capture_cpus = %s\n", val(c->capture_cpus));
+    fprintf(f, "worker_cpus = %s\n", val(c->worker_cpus));
+    fprintf(f, "format = %s\n", output_format_names[c->output_format]);
+    fprintf(f, "columnar = %s\n", val(c->columnar));
+    fprintf(f, "chunk_rows = %u\n", c->chunk_rows);
+    fprintf(f, "compression = %s\n", zcompression_name(c->compression ? c->compression : ZFILE_COMPRESSION_BUILD));
+    fprintf(f, "compress_level = %u\n", c->compress_level);
+    fprintf(f, "compress_threads = %u\n", c->compress_threads);
+    fprintf(f, "ring_file = %s\n", val(c->ring_file));
+    fprintf(f, "ring_size = %u\n", c->ring_size);
+    fprintf(f, "ring_policy = %s\n", ring_policy_names[c->ring_policy]);
+    fprintf(f, "fields = %s\n", val(c->fields));
+    fprintf(f, "hugepages = %u\n", c->hugepages);
     fprintf(f, "updater = %u\n", c->updater_on);
   
     /* note: anon_print_subnets is silent when no subnets are configured */
@@ -591,6 +848,10 @@ void config_print_json (zfile f, const configuration_t *c) {
     zprintf(f, "\"username\":\"%s\",", val(c->username));
     zprintf(f, "\"info\":\"%s\",", val(c->logfile));
     zprintf(f, "\"count\":%u,", c->max_records); 
+    zprintf(f, "\"rotate_bytes\":%u,", c->rotate_bytes);
+    zprintf(f, "\"rotate_interval\":%u,", c->rotate_interval);
+    zprintf(f, "\"rotate_hook\":\"%s\",", val(c->rotate_hook));
+    zprintf(f, "\"rotate_spool\":\"%s\",", val(c->rotate_spool));
     zprintf(f, "\"upload\":\"%s\",", val(c->upload_servername));
     zprintf(f, "\"keyfile\":\"%s\",", val(c->upload_key));
     for (i=0; i<c->num_subnets; i++) {
@@ -613,6 +874,27 @@ void config_print_json (zfile f, const configuration_t *c) {
     zprintf(f, "\"bpf\":\"%s\",", val(c->bpf_filter_exp));
     zprintf(f, "\"verbosity\":%u,", c->verbosity);
     zprintf(f, "\"threads\":%u,", c->num_threads);
+    zprintf(f, "\"flow_table_size\":%u,", c->flow_table_size);
+    zprintf(f, "\"flow_pool_size\":%u,", c->flow_pool_size);
+    zprintf(f, "\"max_flows\":%u,", c->max_flows);
+    zprintf(f, "\"flow_evict\":\"%s\",", flow_evict_names[c->flow_evict]);
+    zprintf(f, "\"housekeeping\":%u,", c->housekeeping_ms);
+    zprintf(f, "\"expire_max\":%u,", c->expire_max);
+    zprintf(f, "\"capture\":\"%s\",", capture_names[c->capture]);
+    zprintf(f, "\"xdp_mode\":\"%s\",", xdp_mode_names[c->xdp_mode]);
+    zprintf(f, "\"capture_cpus\":\"%s\",", val(c->capture_cpus));
+    zprintf(f, "\"worker_cpus\":\"%s\",", val(c->worker_cpus));
+    zprintf(f, "\"format\":\"%s\",", output_format_names[c->output_format]);
+    zprintf(f, "\"columnar\":\"%s\",", val(c->columnar));
+    zprintf(f, "\"chunk_rows\":%u,", c->chunk_rows);
+    zprintf(f, "\"compression\":\"%s\",", zcompression_name(c->compression ? c->compression : ZFILE_COMPRESSION_BUILD));
+    zprintf(f, "\"compress_level\":%u,", c->compress_level);
+    zprintf(f, "\"compress_threads\":%u,", c->compress_threads);
+    zprintf(f, "\"ring_file\":\"%s\",", val(c->ring_file));
+    zprintf(f, "\"ring_size\":%u,", c->ring_size);
+    zprintf(f, "\"ring_policy\":\"%s\",", ring_policy_names[c->ring_policy]);
+    zprintf(f, "\"fields\":\"%s\",", val(c->fields));
+    zprintf(f, "\"hugepages\":%u,", c->hugepages);
     zprintf(f, "\"updater\":%u,", c->updater_on);
 
     config_print_json_all_features_bool(feature_list);
@@ -439,7 +439,7 @@ static void dhcp_print_options(const dhcp_option_t *options,
                                zfile f) {
     int i = 0;
 
-    zprintf(f, ",\"options\":[");
+    zputs(f, ",\"options\":[");
 
     for (i = 0; i < count; i++) {
         const char *opt_str = NULL;
@@ -448,28 +448,35 @@ static void dhcp_print_options(const dhcp_option_t *options,
 
         if (opt_str) {
             if (opt->value_str != NULL) {
-                zprintf(f, "{\"%s\":\"%s\"", opt_str, opt->value_str);
+                zputc(f, '{');
+                zprint_json_string(f, opt_str);
+                zputc(f, ':');
+                zprint_json_string(f, opt->value_str);
             } else if (opt->value != NULL && opt->len != 0) {
-                zprintf(f, "{\"%s\":", opt_str);
+                zputc(f, '{');
+                zprint_json_string(f, opt_str);
+                zputc(f, ':');
                 zprintf_raw_as_hex(f, opt->value, opt->len);
             }
-            zprintf(f, "}");
+            zputc(f, '}');
         } else {
             /* The option is unknown, so print the code */
-            zprintf(f, "{\"kind\":%u", opt->code);
+            zputs(f, "{\"kind\":");
+            zprint_uint(f, opt->code);
             if (opt->value_str != NULL) {
-                zprintf(f, ",\"data\":\"%s\"", opt->value_str);
+                zputs(f, ",\"data\":");
+                zprint_json_string(f, opt->value_str);
             } else if (opt->value != NULL && opt->len != 0) {
-                zprintf(f, ",\"data\":");
+                zputs(f, ",\"data\":");
                 zprintf_raw_as_hex(f, opt->value, opt->len);
             }
-            zprintf(f, "}");
+            zputc(f, '}');
         }
 
         if (i == (count - 1)) {
-            zprintf(f, "]");
+            zputc(f, ']');
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
     }
 }
@@ -497,57 +504,81 @@ void dhcp_print_json(const dhcp_t *d1,
 
     if (d1->message_count) {
         char ipv4_addr[INET_ADDRSTRLEN];
-        zprintf(f, ",\"dhcp\":[");
+        zputs(f, ",\"dhcp\":[");
         for (i = 0; i < d1->message_count; i++) {
             const dhcp_message_t *msg = &d1->messages[i];
 
-            zprintf(f, "{");
-            zprintf(f, "\"op\":\"%u\"", msg->op);
-            zprintf(f, ",\"htype\":\"%u\"", msg->htype);
-            zprintf(f, ",\"hlen\":\"%u\"", msg->hlen);
-            zprintf(f, ",\"hops\":\"%u\"", msg->hops);
-            zprintf(f, ",\"xid\":\"%u\"", msg->xid);
-            zprintf(f, ",\"secs\":\"%u\"", msg->secs);
-            zprintf(f, ",\"flags\":\"%u\"", msg->flags);
+            zputc(f, '{');
+            zputs(f, "\"op\":\"");
+            zprint_uint(f, msg->op);
+            zputc(f, '"');
+            zputs(f, ",\"htype\":\"");
+            zprint_uint(f, msg->htype);
+            zputc(f, '"');
+            zputs(f, ",\"hlen\":\"");
+            zprint_uint(f, msg->hlen);
+            zputc(f, '"');
+            zputs(f, ",\"hops\":\"");
+            zprint_uint(f, msg->hops);
+            zputc(f, '"');
+            zputs(f, ",\"xid\":\"");
+            zprint_uint(f, msg->xid);
+            zputc(f, '"');
+            zputs(f, ",\"secs\":\"");
+            zprint_uint(f, msg->secs);
+            zputc(f, '"');
+            zputs(f, ",\"flags\":\"");
+            zprint_uint(f, msg->flags);
+            zputc(f, '"');
 
             if (ipv4_addr_needs_anonymization(&msg->ciaddr)) {
                 addr_get_anon_hexstring(&msg->ciaddr, (char*)buffer, IPV4_ANON_LEN);
-                zprintf(f, ",\"ciaddr\":\"%s\"", buffer);
+                zputs(f, ",\"ciaddr\":");
+                zprint_json_string(f, buffer);
             } else {
                 inet_ntop(AF_INET, &msg->ciaddr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(f, ",\"ciaddr\":\"%s\"", ipv4_addr);
+                zputs(f, ",\"ciaddr\":");
+                zprint_json_string(f, ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->yiaddr)) {
                 addr_get_anon_hexstring(&msg->yiaddr, (char*)buffer, IPV4_ANON_LEN);
-                zprintf(f, ",\"yiaddr\":\"%s\"", buffer);
+                zputs(f, ",\"yiaddr\":");
+                zprint_json_string(f, buffer);
             } else {
                 inet_ntop(AF_INET, &msg->yiaddr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(f, ",\"yiaddr\":\"%s\"", ipv4_addr);
+                zputs(f, ",\"yiaddr\":");
+                zprint_json_string(f, ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->siaddr)) {
                 addr_get_anon_hexstring(&msg->siaddr, (char*)buffer, IPV4_ANON_LEN);
-                zprintf(f, ",\"siaddr\":\"%s\"", buffer);
+                zputs(f, ",\"siaddr\":");
+                zprint_json_string(f, buffer);
             } else {
                 inet_ntop(AF_INET, &msg->siaddr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(f, ",\"siaddr\":\"%s\"", ipv4_addr);
+                zputs(f, ",\"siaddr\":");
+                zprint_json_string(f, ipv4_addr);
             }
             if (ipv4_addr_needs_anonymization(&msg->giaddr)) {
                 addr_get_anon_hexstring(&msg->giaddr, (char*)buffer, IPV4_ANON_LEN);
-                zprintf(f, ",\"giaddr\":\"%s\"", buffer);
+                zputs(f, ",\"giaddr\":");
+                zprint_json_string(f, buffer);
             } else {
                 inet_ntop(AF_INET, &msg->giaddr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(f, ",\"giaddr\":\"%s\"", ipv4_addr);
+                zputs(f, ",\"giaddr\":");
+                zprint_json_string(f, ipv4_addr);
             }
 
-            zprintf(f, ",\"chaddr\":");
+            zputs(f, ",\"chaddr\":");
             zprintf_raw_as_hex(f, msg->chaddr, sizeof(msg->chaddr));
             if (msg->sname != NULL) {
                 joy_utils_convert_to_json_string(msg->sname, MAX_DHCP_SNAME);
-                zprintf(f, ",\"sname\":\"%s\"", msg->sname);
+                zputs(f, ",\"sname\":");
+                zprint_json_string(f, msg->sname);
             }
             if (msg->file != NULL) {
                 joy_utils_convert_to_json_string(msg->file, MAX_DHCP_FILE);
-                zprintf(f, ",\"file\":\"%s\"", msg->file);
+                zputs(f, ",\"file\":");
+                zprint_json_string(f, msg->file);
             }
 
             if (msg->options_count) {
@@ -555,12 +586,12 @@ void dhcp_print_json(const dhcp_t *d1,
             }
 
             if (i == (d1->message_count - 1)) {
-                zprintf(f, "}");
+                zputc(f, '}');
             } else {
-                zprintf(f, "},");
+                zputs(f, "},");
             }
         }
-        zprintf(f, "]");
+        zputc(f, ']');
     }
 
     /* sanity check */
@@ -250,7 +250,7 @@ void dhcpv6_print_json(const dhcpv6_t *d1,
 
     /* print out the data we want from the messages */
     if (d1->message_count) {
-        zprintf(f, ",\"dhcpv6\":[");
+        zputs(f, ",\"dhcpv6\":[");
         for (i = 0; i < d1->message_count; i++) {
             const char *disp_buffer = NULL;
             const dhcp_v6_message_t *msg = &d1->messages[i];
@@ -258,7 +258,7 @@ void dhcpv6_print_json(const dhcpv6_t *d1,
 
             /* pesky JSON commas to seperate elements */
             if (!first_time) {
-                zprintf(f, ",");
+                zputc(f, ',');
             } else {
                 first_time = 0;
             }
@@ -266,9 +266,13 @@ void dhcpv6_print_json(const dhcpv6_t *d1,
             /* printout the message type and transaction id */
             disp_buffer = dhcpv6_msg_to_string(msg->msg_type);
             if (disp_buffer == NULL) {
-                zprintf(f, "{\"type\":\"%u\",",msg->msg_type);
+                zputs(f, "{\"type\":\"");
+                zprint_uint(f, msg->msg_type);
+                zputs(f, "\",");
             } else {
-                zprintf(f, "{\"type\":\"%s\",",disp_buffer);
+                zputs(f, "{\"type\":");
+                zprint_json_string(f, disp_buffer);
+                zputc(f, ',');
             }
             zprintf(f, "\"transid\":\"%x\",",msg->trans_id);
 
@@ -281,13 +285,19 @@ void dhcpv6_print_json(const dhcpv6_t *d1,
             /* printout the option and length */
             disp_buffer = dhcpv6_option_to_string(dhcpv6_option);
             if (disp_buffer == NULL) {
-                zprintf(f, "\"option\":\"%u\",",dhcpv6_option);
+                zputs(f, "\"option\":\"");
+                zprint_uint(f, dhcpv6_option);
+                zputs(f, "\",");
             } else {
-                zprintf(f, "\"option\":\"%s\",",dhcpv6_option_to_string(dhcpv6_option));
+                zputs(f, "\"option\":");
+                zprint_json_string(f, dhcpv6_option_to_string(dhcpv6_option));
+                zputc(f, ',');
             }
 
 #ifdef DHCPV6_DEBUG
-            zprintf(f, "\"optlen\":%u,",dhcpv6_opt_len);
+            zputs(f, "\"optlen\":");
+            zprint_uint(f, dhcpv6_opt_len);
+            zputc(f, ',');
             if ((dhcpv6_option == DHCPV6_CLIENTID) || (dhcpv6_option == DHCPV6_SERVERID)) {
 
                 zprintf(f, "\"macaddr\":\"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\",",
@@ -296,28 +306,29 @@ void dhcpv6_print_json(const dhcpv6_t *d1,
             }
 
             /* show the remaning bytes of the message */
-            int k = 0;
             int max_bytes = 0;
             max_bytes = (dhcpv6_opt_len < MAX_DHCP_V6_MSG_LEN) ? dhcpv6_opt_len : MAX_DHCP_V6_MSG_LEN;
-            zprintf(f, "\"data\":\"");
-            for (k=0; k < max_bytes; ++k) {
-                zprintf(f, "%.2x", *(ptr+k));
-            }
-            zprintf(f, "\"}");
+            zputs(f, "\"data\":\"");
+            zprint_hex(f, ptr, max_bytes);
+            zputs(f, "\"}");
         }
 #else
             /* for CLIENT ID and SERVER ID, printout the mac address */
             if ((dhcpv6_option == DHCPV6_CLIENTID) || (dhcpv6_option == DHCPV6_SERVERID)) {
-                zprintf(f, "\"optlen\":%u,",dhcpv6_opt_len);
+                zputs(f, "\"optlen\":");
+                zprint_uint(f, dhcpv6_opt_len);
+                zputc(f, ',');
                 zprintf(f, "\"macaddr\":\"%.2x:%.2x:%.2x:%.2x:%.2x:%.2x\"}",
                             *(ptr+8),*(ptr+9),*(ptr+10),
                             *(ptr+11),*(ptr+12),*(ptr+13));
             } else {
-                zprintf(f, "\"optlen\":%u}",dhcpv6_opt_len);
+                zputs(f, "\"optlen\":");
+                zprint_uint(f, dhcpv6_opt_len);
+                zputc(f, '}');
             }
         }
 #endif
-        zprintf(f, "]");
+        zputc(f, ']');
     }
 
     /* sanity check and for compiler complain */
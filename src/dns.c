@@ -553,10 +553,12 @@ dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile
             if (ipv4_addr_needs_anonymization(addr)) {
                 char buffer[IPV4_ANON_LEN];
                 addr_get_anon_hexstring(addr, (char*)buffer, IPV4_ANON_LEN);
-                zprintf(output, "\"a\":\"%s\"", buffer);
+                zputs(output, "\"a\":");
+                zprint_json_string(output, buffer);
             } else {
                 inet_ntop(AF_INET, addr, ipv4_addr, INET_ADDRSTRLEN);
-                zprintf(output, "\"a\":\"%s\"", ipv4_addr);
+                zputs(output, "\"a\":");
+                zprint_json_string(output, ipv4_addr);
             }
         } else if (type == type_AAAA) {
             const struct in6_addr *addr;;
@@ -566,7 +568,8 @@ dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile
                 return err;
             }
             inet_ntop(AF_INET6, addr, ipv6_addr, INET6_ADDRSTRLEN);
-            zprintf(output, "\"aaaa\":\"%s\"", ipv6_addr);
+            zputs(output, "\"aaaa\":");
+            zprint_json_string(output, ipv6_addr);
         } else if (type == type_SOA  || type == type_PTR || type == type_CNAME || type == type_NS || type == type_MX) {
             const char *typename;
 
@@ -592,7 +595,9 @@ dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile
             } else {
                 typename = "cname";
             }
-            zprintf(output, "\"%s\":\"%s\"", typename, name + 1);
+            zprint_json_string(output, typename);
+            zputc(output, ':');
+            zprint_json_string(output, name + 1);
 
             /* advance to end of the resource record */
             if (*len-1 > 0) {
@@ -603,7 +608,8 @@ dns_rdata_print (const dns_hdr *rh, const dns_rr *rr, char **r, int *len, zfile
             }
 
         } else if (type == type_TXT) {
-            zprintf(output, "\"txt\":\"%s\"", "NYI");
+            zputs(output, "\"txt\":");
+            zprint_json_string(output, "NYI");
 
         } else {
             err = data_advance(r, len, ntohs(rr->rdlength));
@@ -653,10 +659,11 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
      *                struct dns_rr
      *                rr_data   
      */
-    zprintf(output, "{");
+    zputc(output, '{');
 
     if (pkt_len < sizeof(dns_hdr)) {
-      zprintf(output, "\"malformed\":%d", len);
+      zputs(output, "\"malformed\":");
+      zprint_int(output, len);
       return;
     }
     
@@ -677,7 +684,8 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
     qdcount = ntohs(rh->qdcount);
     if (qdcount > 1) {
         err = dns_err_too_many;
-        zprintf(output, "\"malformed\":%d", len);
+        zputs(output, "\"malformed\":");
+        zprint_int(output, len);
         zprintf_debug(output, "qdcount=%u; err=%u\"}", qdcount, err);
       return;
     }
@@ -687,44 +695,56 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
         /* parse question name and struct */
         err = dns_header_parse_name(rh, &r, &len, name, (DNS_OUTNAME_LEN-1), 0);
         if (err != dns_ok) { 
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "question name err=%u; len=%u\"}", err, len);
             return;
         }
         err = dns_question_parse(&question, &r, &len);
         if (err != dns_ok) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "question err=%u; len=%u\"}", err, len);
             return;
         }
-        zprintf(output, "\"%cn\":\"%s\",", qr, name + 1);
+        zputc(output, '"');
+        zputc(output, qr);
+        zputs(output, "n\":");
+        zprint_json_string(output, name + 1);
+        zputc(output, ',');
     }
-    zprintf(output, "\"rc\":%u,\"rr\":[", flags_rcode);
+    zputs(output, "\"rc\":");
+    zprint_uint(output, flags_rcode);
+    zputs(output, ",\"rr\":[");
 
     ancount = ntohs(rh->ancount); 
     comma = 0;
     memset_s(name, DNS_OUTNAME_LEN, 0x00, DNS_OUTNAME_LEN);
     while (ancount-- > 0) {
         if (comma++) {
-            zprintf(output, ",");
+            zputc(output, ',');
         }
-        zprintf(output, "{");
+        zputc(output, '{');
         /* parse rr name, struct, and rdata */
         err = dns_header_parse_name(rh, &r, &len, name, (DNS_OUTNAME_LEN-1), 0);
         if (err != dns_ok) { 
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr name ancount=%u; err=%u; len=%u\"}]}", ancount, err, len);
             return;
         }
         err = dns_rr_parse(&rr, &r, &len, &rdlength);
         if (err) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr ancount=%u; err=%u; len=%u\"}]}", ancount, err, len);
             return;
         }
         err = dns_rdata_print(rh, rr, &r, &rdlength, output);
         if (err) {
-            zprintf(output, "\"malformed\":%d}]}", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
+            zputs(output, "}]}");
             return;
         }
         len -= rdlength;
@@ -732,7 +752,9 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
             r += (rdlength - 1);
             rdlength = 1;
         }
-        zprintf(output, ",\"ttl\":%u}", ntohl(rr->ttl));
+        zputs(output, ",\"ttl\":");
+        zprint_uint(output, ntohl(rr->ttl));
+        zputc(output, '}');
     }
 
     nscount = ntohs(rh->nscount);
@@ -742,25 +764,29 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
     memset_s(name, DNS_OUTNAME_LEN, 0x00, DNS_OUTNAME_LEN);
     while (nscount-- > 0) {
         if (comma++) {
-            zprintf(output, ",");
+            zputc(output, ',');
         }
-        zprintf(output, "{");
+        zputc(output, '{');
         /* parse rr name, struct, and rdata */
         err = dns_header_parse_name(rh, &r, &len, name, (DNS_OUTNAME_LEN-1), 0);
         if (err != dns_ok) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr name nscount=%u; err=%u; len=%u\"}]}", nscount, err, len);
             return;
         }
         err = dns_rr_parse(&rr, &r, &len, &rdlength);
         if (err) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr nscount=%u; err=%u; len=%u\"}]}", nscount, err, len);
             return;
         }
         err = dns_rdata_print(rh, rr, &r, &rdlength, output);
         if (err) {
-            zprintf(output, "\"malformed\":%d}]}", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
+            zputs(output, "}]}");
             return;
         }
         len -= rdlength;
@@ -768,7 +794,9 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
             r += (rdlength - 1);
             rdlength = 1;
         }
-        zprintf(output, ",\"ttl\":%u}", ntohl(rr->ttl));
+        zputs(output, ",\"ttl\":");
+        zprint_uint(output, ntohl(rr->ttl));
+        zputc(output, '}');
     }
 
     arcount = ntohs(rh->arcount);
@@ -778,25 +806,29 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
     memset_s(name, DNS_OUTNAME_LEN, 0x00, DNS_OUTNAME_LEN);
     while (arcount-- > 0) {
         if (comma++) {
-            zprintf(output, ",");
+            zputc(output, ',');
         }
-        zprintf(output, "{");
+        zputc(output, '{');
         /* parse rr name, struct, and rdata */
         err = dns_header_parse_name(rh, &r, &len, name, (DNS_OUTNAME_LEN-1), 0);
         if (err != dns_ok) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr name arcount=%u; err=%u; len=%u\"}]}", arcount, err, len);
             return;
         }
         err = dns_rr_parse(&rr, &r, &len, &rdlength);
         if (err) {
-            zprintf(output, "\"malformed\":%d", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
             zprintf_debug(output, "rr arcount=%u; err=%u; len=%u\"}]}", arcount, err, len);
             return;
         }
         err = dns_rdata_print(rh, rr, &r, &rdlength, output);
         if (err) {
-            zprintf(output, "\"malformed\":%d}]}", len);
+            zputs(output, "\"malformed\":");
+            zprint_int(output, len);
+            zputs(output, "}]}");
             return;
         }
         len -= rdlength;
@@ -804,9 +836,11 @@ static void dns_print_packet (char *dns_name, unsigned int pkt_len, zfile output
             r += (rdlength - 1);
             rdlength = 1;
         }
-        zprintf(output, ",\"ttl\":%u}", ntohl(rr->ttl));
+        zputs(output, ",\"ttl\":");
+        zprint_uint(output, ntohl(rr->ttl));
+        zputc(output, '}');
     }
-    zprintf(output, "]}");
+    zputs(output, "]}");
     return;
 }
 
@@ -815,13 +849,13 @@ static void dns_printf (char * const dns_name[], const unsigned short pkt_len[],
                 unsigned int count, zfile output) {
     unsigned int i = 0;
 
-    zprintf(output, ",\"dns\":[");
+    zputs(output, ",\"dns\":[");
   
     /* if a twin exists, print out that data */
     if (twin_dns_name) { /* bidirectional flow */
         for (i=0; i<count; i++) {
             if (i) {
-                zprintf(output, ",");
+                zputc(output, ',');
             }
             if (twin_dns_name[i]) {
                 dns_print_packet(twin_dns_name[i], twin_pkt_len[i], output);
@@ -832,7 +866,7 @@ static void dns_printf (char * const dns_name[], const unsigned short pkt_len[],
         /* print out the data from the primary record */
         for (i=0; i<count; i++) {
             if (i) {
-                zprintf(output, ",");
+                zputc(output, ',');
             }
             if (dns_name[i]) {
                 dns_print_packet(dns_name[i], pkt_len[i], output);
@@ -840,7 +874,7 @@ static void dns_printf (char * const dns_name[], const unsigned short pkt_len[],
         }
     }
 
-    zprintf(output, "]");
+    zputc(output, ']');
 }
 
 /*
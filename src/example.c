@@ -117,7 +117,8 @@ void example_print_json (const struct example *x1, const struct example *x2, zfi
         total += x2->counter;
     }
     if (total) {
-        zprintf(f, ",\"example\":%u", total);
+        zputs(f, ",\"example\":");
+        zprint_uint(f, total);
     }
 }
 
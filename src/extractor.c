@@ -221,7 +221,7 @@ void zprintf_element_as_structured_hex(zfile f,
 	/*
 	 * print out parenthesized data
 	 */
-	zprintf(f, "(");
+	zputc(f, '(');
 	if (parent_node) {
 	    /* 
 	     * print out data element as a list of elements
@@ -233,11 +233,10 @@ void zprintf_element_as_structured_hex(zfile f,
 	    /* 
 	     * print out data element as a raw octet string
 	     */
-	    while (element_len-- > 0) {
-		zprintf(f, "%02x", *x++);
-	    }
+	    zprint_hex(f, x, element_len);
+	    x += element_len;
 	}
-	zprintf(f, ")");
+	zputc(f, ')');
     }
 
 }
@@ -246,9 +245,9 @@ void zprintf_raw_as_structured_hex (zfile f,
 				    const unsigned char *data,
 				    unsigned int len) {
     
-    zprintf(f, "\"");   /* quotes needed for JSON */
+    zputc(f, '"');   /* quotes needed for JSON */
     zprintf_element_as_structured_hex(f, data, len);
-    zprintf(f, "\"");
+    zputc(f, '"');
 }
 
 enum status extractor_reserve_output(struct extractor *x,
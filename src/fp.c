@@ -117,14 +117,14 @@ void fpx_update (struct fpx *fpx,
 
 static void fpx_print_json_unidirectional(const struct fpx *x, zfile f) {
     if (x->tcp_fp_len) {
-	zprintf(f, "\"tcp\":");
+	zputs(f, "\"tcp\":");
 	zprintf_raw_as_structured_hex(f, x->tcp_fp, x->tcp_fp_len);
 	if (x->fp_len) {
-	    zprintf(f, ",");
+	    zputc(f, ',');
 	}
     }
     if (x->fp_len) {
-	zprintf(f, "\"tls\":");
+	zputs(f, "\"tls\":");
 	zprintf_raw_as_structured_hex(f, x->fp, x->fp_len);
     }
 }
@@ -142,18 +142,18 @@ void fpx_print_json (const struct fpx *x1, const struct fpx *x2, zfile f) {
      * check for fingerprints and print if needed
      */
     if (x1->tcp_fp_len || x1->fp_len) {
-	zprintf(f, ",\"fingerprints\":{");
+	zputs(f, ",\"fingerprints\":{");
 	fpx_print_json_unidirectional(x1, f);
-	zprintf(f, "}");
+	zputc(f, '}');
     }
 
     /*
      * if flow twin x2 is present, check for fingerprints and print if needed
      */
     if (x2 && (x2->tcp_fp_len || x2->fp_len)) {
-	zprintf(f, ",\"fingerprints_in\":{");
+	zputs(f, ",\"fingerprints_in\":{");
 	fpx_print_json_unidirectional(x2, f);
-	zprintf(f, "}");	
+	zputc(f, '}');	
     }
 }
 
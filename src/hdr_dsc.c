@@ -155,8 +155,6 @@ void header_description_update (header_description_t *hd,
  * \return none
  */
 void header_description_printf (const header_description_t *hd, zfile f, unsigned int len) {
-    unsigned int i;
-
     if (hd->num_headers_seen < 2) {
         return;  /* no point in printing out information-free data */
     }
@@ -173,23 +171,17 @@ void header_description_printf (const header_description_t *hd, zfile f, unsigne
      *  2 = other
      */
 
-    zprintf(f, ",\"hd\":{\"n\":%u,\"cm\":\"", hd->num_headers_seen);
-    for (i=0; i<len; i++) {
-        zprintf(f, "%02x", hd->const_mask[i]);
-    }
-    zprintf(f, "\",\"cv\":\"");
-    for (i=0; i<len; i++) {
-        zprintf(f, "%02x", hd->const_value[i]);
-    }
-    zprintf(f, "\",\"sm\":\"");
-    for (i=0; i<len; i++) {
-        zprintf(f, "%02x", hd->seq_mask[i]);
-    }
-    zprintf(f, "\",\"i\":\"");
-    for (i=0; i<len; i++) {
-        zprintf(f, "%02x", hd->initial[i]);
-    }
-    zprintf(f, "\"}");
+    zputs(f, ",\"hd\":{\"n\":");
+    zprint_uint(f, hd->num_headers_seen);
+    zputs(f, ",\"cm\":\"");
+    zprint_hex(f, hd->const_mask, len);
+    zputs(f, "\",\"cv\":\"");
+    zprint_hex(f, hd->const_value, len);
+    zputs(f, "\",\"sm\":\"");
+    zprint_hex(f, hd->seq_mask, len);
+    zputs(f, "\",\"i\":\"");
+    zprint_hex(f, hd->initial, len);
+    zputs(f, "\"}");
 
 }
 
@@ -222,17 +222,17 @@ void http_print_json(const http_t *h1,
     }
 
     /* Start http array */
-    zprintf(f, ",\"http\":[");
+    zputs(f, ",\"http\":[");
 
     for (i = 0; i < total_messages; i++) {
         int comma = 0;
 
-        zprintf(f, "{");
+        zputc(f, '{');
 
         if (h1->num_messages > i) {
             const struct http_message *msg = &h1->messages[i];
 
-            zprintf(f, "\"out\":");
+            zputs(f, "\"out\":");
 
             http_print_message(f, msg);
 
@@ -245,9 +245,9 @@ void http_print_json(const http_t *h1,
                 const struct http_message *msg = &h2->messages[i];
 
                 if (comma) {
-                    zprintf(f, ",\"in\":");
+                    zputs(f, ",\"in\":");
                 } else {
-                    zprintf(f, "\"in\":");
+                    zputs(f, "\"in\":");
                 }
 
                 http_print_message(f, msg);
@@ -255,15 +255,15 @@ void http_print_json(const http_t *h1,
         }
 
         if (i == total_messages - 1) {
-            zprintf(f, "}");
+            zputc(f, '}');
         } else {
-            zprintf(f, "},");
+            zputs(f, "},");
         }
 
     }
 
     /* End http array */
-    zprintf(f, "]");
+    zputc(f, ']');
 }
 
 void http_free_message(struct http_message *msg) {
@@ -890,42 +890,49 @@ static void http_print_message(zfile f,
     /*
      * Start req/resp array
      */
-    zprintf(f, "[");
+    zputc(f, '[');
 
     if (msg->header.line_type == HTTP_LINE_STATUS) {
         const struct http_header_status_line *line = &msg->header.line.status;
 
-        zprintf(f, "{\"version\":\"%s\"},"
-                "{\"code\":\"%s\"},"
-                "{\"reason\":\"%s\"}",
-                line->version, line->code, line->reason);
+        zputs(f, "{\"version\":");
+        zprint_json_string(f, line->version);
+        zputs(f, "},{\"code\":");
+        zprint_json_string(f, line->code);
+        zputs(f, "},{\"reason\":");
+        zprint_json_string(f, line->reason);
+        zputc(f, '}');
 
         comma = 1;
     }
     else if (msg->header.line_type == HTTP_LINE_REQUEST) {
         const struct http_header_request_line *line = &msg->header.line.request;
 
-        zprintf(f, "{\"method\":\"%s\"},", line->method);
-        zprintf(f, "{\"uri\":\"");
+        zputs(f, "{\"method\":");
+        zprint_json_string(f, line->method);
+        zputs(f, "},");
+        zputs(f, "{\"uri\":\"");
         if (usernames_ctx) {
             str_match_ctx_find_all_longest(usernames_ctx,
                                            (unsigned char*)line->uri,
                                            strnlen_s(line->uri, MAX_STRLEN), &matches);
             anon_print_uri_pseudonym(f, &matches, line->uri);
         } else {
-            zprintf(f, "%s", line->uri);
+            zputs(f, line->uri);
         }
-        zprintf(f, "\"},");
-        zprintf(f, "{\"version\":\"%s\"}", line->version);
+        zputs(f, "\"},");
+        zputs(f, "{\"version\":");
+        zprint_json_string(f, line->version);
+        zputc(f, '}');
 
 #if PRINT_USERNAMES
         /*
          * Print out (anonymized) usernames found in URI
          */
         if (usernames_ctx) {
-            zprintf(f, ",{");
+            zputs(f, ",{");
             zprintf_usernames(f, &matches, line->uri, is_special, anon_string);
-            zprintf(f, "}");
+            zputc(f, '}');
         }
 #endif
         comma = 1;
@@ -936,9 +943,17 @@ static void http_print_message(zfile f,
 
         if (elem->name && elem->value) {
             if (comma) {
-                zprintf(f, ",{\"%s\":\"%s\"}", elem->name, elem->value);
+                zputs(f, ",{");
+                zprint_json_string(f, elem->name);
+                zputc(f, ':');
+                zprint_json_string(f, elem->value);
+                zputc(f, '}');
             } else {
-                zprintf(f, "{\"%s\":\"%s\"}", elem->name, elem->value);
+                zputc(f, '{');
+                zprint_json_string(f, elem->name);
+                zputc(f, ':');
+                zprint_json_string(f, elem->value);
+                zputc(f, '}');
             }
         }
 
@@ -950,16 +965,16 @@ static void http_print_message(zfile f,
      */
     if (msg->body) {
         if (comma) {
-            zprintf(f, ",{\"body\":");
+            zputs(f, ",{\"body\":");
         } else {
-            zprintf(f, "{\"body\":");
+            zputs(f, "{\"body\":");
         }
         zprintf_raw_as_hex(f, (unsigned char*)msg->body, msg->body_length);
-        zprintf(f, "}");
+        zputc(f, '}');
     }
 
     /* End req/resp array */
-    zprintf(f, "]");
+    zputc(f, ']');
 }
 
 /**
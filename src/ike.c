@@ -2160,20 +2160,23 @@ static void ike_attribute_print_json(ike_attribute_t *s, zfile f) {
     const char *type_string = ike_attribute_type_string(s->type);
     
     /* START attribute object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
         /* Use the string repr of the type */
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"data\":", s->type);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END attribute object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -2190,13 +2193,16 @@ static void ike_attribute_v1_print_json(ike_attribute_t *s, zfile f) {
     const char *type_string = ike_attribute_type_v1_string(s->type);
 
     /* START attribute object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
         /* Use the string repr of the type */
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"data\":", s->type);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     if (s->encoding == 1 || s->data->len == 2) {
@@ -2241,7 +2247,7 @@ static void ike_attribute_v1_print_json(ike_attribute_t *s, zfile f) {
         }
 
         if (string) {
-            zprintf(f, "\"%s\"", string);
+            zprint_json_string(f, string);
         } else {
             goto print_hex;
         }
@@ -2256,7 +2262,7 @@ print_hex:
     }
 
     /* END attribute object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -2362,18 +2368,21 @@ static void ike_transform_print_json(ike_transform_t *s, zfile f) {
     unsigned int i = 0;
 
     /* START transform object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
         /* Use the string repr of the type */
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"id\":", s->type);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"id\":");
     }
 
     if (id_string) {
         /* Use the string repr of the id */
-        zprintf(f, "\"%s\"", id_string);
+        zprint_json_string(f, id_string);
     } else {
         /* Hex string of the id */
         zprintf(f, "\"%04x\"", s->id);
@@ -2382,18 +2391,18 @@ static void ike_transform_print_json(ike_transform_t *s, zfile f) {
     for (i = 0; i < s->num_attributes; i++) {
         /* Print the attributes of this Transform */
         if (i == 0) {
-            zprintf(f, ",\"attributes\":[");
+            zputs(f, ",\"attributes\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_attribute_print_json(s->attributes[i], f);
         if (i == s->num_attributes-1) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END transform object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -2411,29 +2420,31 @@ static void ike_transform_v1_print_json(ike_transform_t *s, zfile f) {
     unsigned int i = 0;
 
     /* START transform object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (id_string) {
-        zprintf(f, "\"id\":\"%s\"", id_string);
+        zputs(f, "\"id\":");
+        zprint_json_string(f, id_string);
     } else {
         zprintf(f, "\"id\":\"%02x\"", s->id_v1);
     }
-    zprintf(f, ",\"num\":%u", s->num_v1);
+    zputs(f, ",\"num\":");
+    zprint_uint(f, s->num_v1);
 
     for (i = 0; i < s->num_attributes; i++) {
         if (i == 0) {
-            zprintf(f, ",\"attributes\":[");
+            zputs(f, ",\"attributes\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_attribute_v1_print_json(s->attributes[i], f);
         if (i == s->num_attributes-1) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END transform object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -2606,34 +2617,36 @@ static void ike_proposal_print_json(ike_proposal_t *s, zfile f) {
     unsigned int i = 0;
 
     /* START proposal object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
-    zprintf(f, "\"num\":%u", s->num);
+    zputs(f, "\"num\":");
+    zprint_uint(f, s->num);
     if (prot_id_string) {
-        zprintf(f, ",\"protocol_id\":\"%s\"", prot_id_string);
+        zputs(f, ",\"protocol_id\":");
+        zprint_json_string(f, prot_id_string);
     } else {
         zprintf(f, ",\"protocol_id\":\"%02x\"", s->protocol_id);
     }
 
     if (s->spi->len > 0) {
-        zprintf(f, ",\"spi\":");
+        zputs(f, ",\"spi\":");
         zprintf_raw_as_hex(f, s->spi->bytes, s->spi->len);
     }
 
     for (i = 0; i < s->num_transforms; i++) {
         if (i == 0) {
-            zprintf(f, ",\"transforms\":[");
+            zputs(f, ",\"transforms\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_transform_print_json(s->transforms[i], f);
         if (i == (unsigned int)(s->num_transforms-1)) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END proposal object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -2651,34 +2664,36 @@ static void ike_proposal_v1_print_json(ike_proposal_t *s, zfile f) {
     unsigned int i = 0;
 
     /* START proposal object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
-    zprintf(f, "\"num\":%u", s->num);
+    zputs(f, "\"num\":");
+    zprint_uint(f, s->num);
     if (prot_id_string) {
-        zprintf(f, ",\"protocol_id\":\"%s\"", prot_id_string);
+        zputs(f, ",\"protocol_id\":");
+        zprint_json_string(f, prot_id_string);
     } else {
         zprintf(f, ",\"protocol_id\":\"%02x\"", s->protocol_id);
     }
 
     if (s->spi->len > 0) {
-        zprintf(f, ",\"spi\":");
+        zputs(f, ",\"spi\":");
         zprintf_raw_as_hex(f, s->spi->bytes, s->spi->len);
     }
 
     for (i = 0; i < s->num_transforms; i++) {
         if (i == 0) {
-            zprintf(f, ",\"transforms\":[");
+            zputs(f, ",\"transforms\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_transform_v1_print_json(s->transforms[i], f);
         if (i == (unsigned int)(s->num_transforms-1)) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END proposal object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -2888,22 +2903,22 @@ static void ike_sa_print_json(ike_sa_t *s, zfile f) {
     unsigned int i;
     
     /* START sa object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     for(i = 0; i < s->num_proposals; i++) {
         if (i == 0) {
-            zprintf(f, "\"proposals\":[");
+            zputs(f, "\"proposals\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_proposal_print_json(s->proposals[i], f);
         if (i == s->num_proposals-1) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END sa object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -2921,49 +2936,52 @@ static void ike_sa_v1_print_json(ike_sa_t *s, zfile f) {
     unsigned int i = 0;
 
     /* START sa object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (doi_string) {
         /* Use the string repr */
-        zprintf(f, "\"doi\":\"%s\"", doi_string);
+        zputs(f, "\"doi\":");
+        zprint_json_string(f, doi_string);
     } else {
         /* Hex instead */
         zprintf(f, "\"doi\":\"%x\"", s->doi_v1);
     }
 
-    zprintf(f, ",\"situation\":%u", s->situation_v1);
+    zputs(f, ",\"situation\":");
+    zprint_uint(f, s->situation_v1);
     if (s->doi_v1 == IKE_IPSEC_V1) {
         if (s->situation_v1 & (IKE_SIT_SECRECY_V1 | IKE_SIT_INTEGRITY_V1)) {
-            zprintf(f, ",\"labeled_domain_identifier\":%u", s->ldi_v1);
+            zputs(f, ",\"labeled_domain_identifier\":");
+            zprint_uint(f, s->ldi_v1);
         }
         if (s->situation_v1 & IKE_SIT_SECRECY_V1) {
-            zprintf(f, ",\"secrecy_level\":");
+            zputs(f, ",\"secrecy_level\":");
             zprintf_raw_as_hex(f, s->secrecy_level_v1->bytes, s->secrecy_level_v1->len);
-            zprintf(f, ",\"secrecy_category\":");
+            zputs(f, ",\"secrecy_category\":");
             zprintf_raw_as_hex(f, s->secrecy_category_v1->bytes, s->secrecy_category_v1->len);
         }
         if (s->situation_v1 & IKE_SIT_INTEGRITY_V1) {
-            zprintf(f, ",\"integrity_level\":");
+            zputs(f, ",\"integrity_level\":");
             zprintf_raw_as_hex(f, s->integrity_level_v1->bytes, s->integrity_level_v1->len);
-            zprintf(f, ",\"integrity_category\":");
+            zputs(f, ",\"integrity_category\":");
             zprintf_raw_as_hex(f, s->integrity_category_v1->bytes, s->integrity_category_v1->len);
         }
     }
 
     for(i = 0; i < s->num_proposals; i++) {
         if (i == 0) {
-            zprintf(f, ",\"proposals\":[");
+            zputs(f, ",\"proposals\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_proposal_v1_print_json(s->proposals[i], f);
         if (i == s->num_proposals-1) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
 
     /* END sa object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -3151,19 +3169,22 @@ static void ike_ke_print_json(ike_ke_t *s, zfile f) {
     const char *group_string = ike_diffie_hellman_group_string(s->group);
 
     /* START ke object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (group_string) {
-        zprintf(f, "\"%s\":", group_string);
+        zprint_json_string(f, group_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"data\":", s->group);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->group);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END ke object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -3287,19 +3308,22 @@ static void ike_id_print_json(ike_id_t *s, zfile f) {
     const char *type_string = ike_identification_type_string(s->type);
 
     /* START identity object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"data\":", s->type);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END identity object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -3316,19 +3340,22 @@ static void ike_id_v1_print_json(ike_id_t *s, zfile f) {
     const char *type_string = ike_identification_type_v1_string(s->type);
 
     /* START identity object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":%u,\"data\":", s->type);
+        zputs(f, "\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END identity object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -3416,19 +3443,22 @@ static void ike_cert_print_json(ike_cert_t *s, zfile f) {
     const char *encoding_string = ike_certificate_encoding_string(s->encoding);
 
     /* START certificate object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (encoding_string) {
-        zprintf(f, "\"%s\":", encoding_string);
+        zprint_json_string(f, encoding_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"encoding\":%u,\"data\":", s->encoding);
+        zputs(f, "\"encoding\":");
+        zprint_uint(f, s->encoding);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END certificate object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -3515,19 +3545,22 @@ static void ike_cr_print_json(ike_cr_t *s, zfile f) {
     const char *encoding_string = ike_certificate_encoding_string(s->encoding);
 
     /* START certificate request object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (encoding_string) {
-        zprintf(f, "\"%s\":", encoding_string);
+        zprint_json_string(f, encoding_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"encoding\":%u,\"data\":", s->encoding);
+        zputs(f, "\"encoding\":");
+        zprint_uint(f, s->encoding);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END certificate request object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -3614,19 +3647,22 @@ static void ike_auth_print_json(ike_auth_t *s, zfile f) {
     const char *method_string = ike_authentication_method_string(s->method);
 
     /* START authentication object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (method_string) {
-        zprintf(f, "\"%s\":", method_string);
+        zprint_json_string(f, method_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"method\":%u,\"data\":", s->method);
+        zputs(f, "\"method\":");
+        zprint_uint(f, s->method);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END authentication object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -3795,24 +3831,29 @@ static void ike_notify_print_json(ike_notify_t *s, zfile f) {
     const char *notify_type_string = ike_notify_type_string(s->type);
 
     /* START notify object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (prot_id_string) {
-        zprintf(f, "\"protocol_id\":\"%s\"", prot_id_string);
+        zputs(f, "\"protocol_id\":");
+        zprint_json_string(f, prot_id_string);
     } else {
         zprintf(f, "\"protocol_id\":\"%02x\"", s->protocol_id);
     }
 
     if (s->spi->len > 0) {
-        zprintf(f, ",\"spi\":");
+        zputs(f, ",\"spi\":");
         zprintf_raw_as_hex(f, s->spi->bytes, s->spi->len);
     }
 
     /* Notification message type */
     if (notify_type_string) {
-        zprintf(f, ",\"%s\":", notify_type_string);
+        zputc(f, ',');
+        zprint_json_string(f, notify_type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, ",\"kind\":%u,\"data\":", s->type);
+        zputs(f, ",\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the notification data as hex */
@@ -3828,22 +3869,22 @@ static void ike_notify_print_json(ike_notify_t *s, zfile f) {
             uint16_t id = 0;
 
             if (i == 0) {
-                zprintf(f, ",\"parsed\":[");
+                zputs(f, ",\"parsed\":[");
             }
 
             id = raw_to_uint16((char *)s->data->bytes+2*i);
             hash_alg_string = ike_hash_algorithm_string(id);
 
             if (hash_alg_string) {
-                zprintf(f, "\"%s\"", hash_alg_string);
+                zprint_json_string(f, hash_alg_string);
             } else {
                 zprintf(f, "\"%04x\"", id);
             }
 
             if (i == k - 1) {
-                zprintf(f, "]");
+                zputc(f, ']');
             } else {
-                zprintf(f, ",");
+                zputc(f, ',');
             }
         }
         break;
@@ -3853,7 +3894,7 @@ static void ike_notify_print_json(ike_notify_t *s, zfile f) {
     }
 
     /* END notify object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -3872,37 +3913,43 @@ static void ike_notify_v1_print_json(ike_notify_t *s, zfile f) {
     const char *notify_type_string = ike_notify_type_v1_string(s->type);
 
     /* START notify object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (doi_string) {
-        zprintf(f, "\"doi\":\"%s\"", doi_string);
+        zputs(f, "\"doi\":");
+        zprint_json_string(f, doi_string);
     } else {
         zprintf(f, "\"doi\":\"%x\"", s->doi_v1);
     }
 
     if (prot_id_string) {
-        zprintf(f, ",\"protocol_id\":\"%s\"", prot_id_string);
+        zputs(f, ",\"protocol_id\":");
+        zprint_json_string(f, prot_id_string);
     } else {
         zprintf(f, ",\"protocol_id\":\"%02x\"", s->protocol_id);
     }
 
     if (s->spi->len > 0) {
-        zprintf(f, ",\"spi\":");
+        zputs(f, ",\"spi\":");
         zprintf_raw_as_hex(f, s->spi->bytes, s->spi->len);
     }
 
     /* Notification message type */
     if (notify_type_string) {
-        zprintf(f, ",\"%s\":", notify_type_string);
+        zputc(f, ',');
+        zprint_json_string(f, notify_type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, ",\"kind\":%u,\"data\":", s->type);
+        zputs(f, ",\"kind\":");
+        zprint_uint(f, s->type);
+        zputs(f, ",\"data\":");
     }
 
     /* Print the notification data as hex */
     zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
 
     /* END notify object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -4143,7 +4190,7 @@ static void ike_vendor_id_print_json(ike_vendor_id_t *s, zfile f) {
     }
 
     if (id_string) {
-        zprintf(f, "\"%s\"", id_string);
+        zprint_json_string(f, id_string);
     } else {
         /* No match */
         zprintf_raw_as_hex(f, s->data->bytes, s->data->len);
@@ -4228,12 +4275,15 @@ static void ike_payload_print_json(ike_payload_t *s, zfile f) {
     const char *type_string = ike_payload_type_string(s->type);
 
     /* START payload object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
     if (type_string) {
-        zprintf(f, "\"%s\":", type_string);
+        zprint_json_string(f, type_string);
+        zputc(f, ':');
     } else {
-        zprintf(f, "\"kind\":\"%u\",\"body\":", s->type);
+        zputs(f, "\"kind\":\"");
+        zprint_uint(f, s->type);
+        zputs(f, "\",\"body\":");
     }
 
     /* Print payload body */
@@ -4287,12 +4337,12 @@ static void ike_payload_print_json(ike_payload_t *s, zfile f) {
         break;
     default:
         /* Empty object because nothing was extracted */
-        zprintf(f, "{}");
+        zputs(f, "{}");
         break;
     }
 
     /* END payload object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -4501,37 +4551,42 @@ static void ike_header_print_json(ike_header_t *s, zfile f) {
     const char *exchange_string = ike_exchange_type_string(s->exchange_type);
 
     /* START header object */
-    zprintf(f, "{");
+    zputc(f, '{');
 
-    zprintf(f, "\"init_spi\":");
+    zputs(f, "\"init_spi\":");
     zprintf_raw_as_hex(f, s->init_spi, sizeof(s->init_spi));
-    zprintf(f, ",\"resp_spi\":");
+    zputs(f, ",\"resp_spi\":");
     zprintf_raw_as_hex(f, s->resp_spi, sizeof(s->resp_spi));
-    zprintf(f, ",\"major\":%u", s->major);
-    zprintf(f, ",\"minor\":%u", s->minor);
+    zputs(f, ",\"major\":");
+    zprint_uint(f, s->major);
+    zputs(f, ",\"minor\":");
+    zprint_uint(f, s->minor);
     if (exchange_string) {
-        zprintf(f, ",\"exchange_type\":\"%s\"", exchange_string);
+        zputs(f, ",\"exchange_type\":");
+        zprint_json_string(f, exchange_string);
     } else {
         zprintf(f, ",\"exchange_type\":\"%02x\"", s->exchange_type);
     }
     zprintf(f, ",\"flags\":{\"hex\":\"%04x\"", s->flags);
-    zprintf(f, ",\"parsed\":[");
+    zputs(f, ",\"parsed\":[");
     if (s->major == 1) {
-        zprintf(f, (s->flags & IKE_ENCRYPTION_BIT_V1)? "\"encryption\"": "\"no_encryption\"");
-        zprintf(f, (s->flags & IKE_COMMIT_BIT_V1)? ",\"commit\"": ",\"no_commit\"");
-        zprintf(f, (s->flags & IKE_AUTHENTICATION_BIT_V1)? ",\"authentication\"": ",\"no_authentication\"");
+        zputs(f, (s->flags & IKE_ENCRYPTION_BIT_V1)? "\"encryption\"": "\"no_encryption\"");
+        zputs(f, (s->flags & IKE_COMMIT_BIT_V1)? ",\"commit\"": ",\"no_commit\"");
+        zputs(f, (s->flags & IKE_AUTHENTICATION_BIT_V1)? ",\"authentication\"": ",\"no_authentication\"");
     }
     else if (s->major == 2) {
-        zprintf(f, (s->flags & IKE_INITIATOR_BIT_V2) ? "\"initiator\"": "\"responder\"");
-        zprintf(f, (s->flags & IKE_VERSION_BIT_V2) ? ",\"higher_version\"": ",\"no_higher_version\"");
-        zprintf(f, (s->flags & IKE_RESPONSE_BIT_V2) ? ",\"response\"": ",\"request\"");
+        zputs(f, (s->flags & IKE_INITIATOR_BIT_V2) ? "\"initiator\"": "\"responder\"");
+        zputs(f, (s->flags & IKE_VERSION_BIT_V2) ? ",\"higher_version\"": ",\"no_higher_version\"");
+        zputs(f, (s->flags & IKE_RESPONSE_BIT_V2) ? ",\"response\"": ",\"request\"");
     }
-    zprintf(f, "]}");
-    zprintf(f, ",\"message_id\":%u", s->message_id);
-    zprintf(f, ",\"length\":%u", s->length);
+    zputs(f, "]}");
+    zputs(f, ",\"message_id\":");
+    zprint_uint(f, s->message_id);
+    zputs(f, ",\"length\":");
+    zprint_uint(f, s->length);
 
     /* END header object */
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -4625,21 +4680,21 @@ static unsigned int ike_header_unmarshal(ike_header_t *s, const char *data, unsi
 static void ike_message_print_json(const ike_message_t *s, zfile f) {
     unsigned int i;
 
-    zprintf(f, "{");
-    zprintf(f, "\"header\":");
+    zputc(f, '{');
+    zputs(f, "\"header\":");
     ike_header_print_json(s->header, f);
     for (i = 0; i < s->num_payloads; i++) {
         if (i == 0) {
-            zprintf(f, ",\"payloads\":[");
+            zputs(f, ",\"payloads\":[");
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
         ike_payload_print_json(s->payloads[i], f);
         if (i == s->num_payloads-1) {
-            zprintf(f, "]");
+            zputc(f, ']');
         }
     }
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /*
@@ -5111,41 +5166,41 @@ void ike_print_json(const ike_t *data,
 
     ike_process(init, resp);
 
-    zprintf(f, ",\"ike\":{");
+    zputs(f, ",\"ike\":{");
     if (init != NULL) {
-        zprintf(f, "\"init\":{");
+        zputs(f, "\"init\":{");
         for (i = 0; i < init->num_messages; i++) {
             if (i == 0) {
-                zprintf(f, "\"messages\":[");
+                zputs(f, "\"messages\":[");
             } else {
-                zprintf(f, ",");
+                zputc(f, ',');
             }
             ike_message_print_json(init->messages[i], f);
             if (i == init->num_messages-1) {
-                zprintf(f, "]");
+                zputc(f, ']');
             }
         }
-        zprintf(f, "}");
+        zputc(f, '}');
     }
     if (resp != NULL) {
         if (init != NULL) {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
-        zprintf(f, "\"resp\":{");
+        zputs(f, "\"resp\":{");
         for (i = 0; i < resp->num_messages; i++) {
             if (i == 0) {
-                zprintf(f, "\"messages\":[");
+                zputs(f, "\"messages\":[");
             } else {
-                zprintf(f, ",");
+                zputc(f, ',');
             }
             ike_message_print_json(resp->messages[i], f);
             if (i == resp->num_messages-1) {
-                zprintf(f, "]");
+                zputc(f, ']');
             }
         }
-        zprintf(f, "}");
+        zputc(f, '}');
     }
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
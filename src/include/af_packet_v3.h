@@ -26,6 +26,7 @@
 #include <net/if.h>
 #include <net/ethernet.h> /* the L2 protocols */
 #include "joy_api.h"
+#include "pkt_proc.h"
 
 /* ported in to compile within JOY context */
 
@@ -45,20 +46,38 @@ struct mercury_config {
     float buffer_fraction;          /* fraction of phys mem used for RX_RING buffers  */
     int num_threads;                /* number of worker threads                       */
     uint64_t rotate;                /* number of records per file rotation, or 0      */
+    uint32_t housekeeping_ms;       /* ms between housekeeping calls, 0 for default   */
+    int xdp_mode;                   /* enum xdp_mode of AF_XDP sockets, see af_xdp.h  */
+    const int *thread_cpu;          /* CPU each thread is pinned to, -1 for none, or NULL */
+    int ring_node;                  /* NUMA node of the ring memory, or -1 for any    */
     char *user;                     /* username of account used for privilege drop   */
 };
 
-/* Information about each packet on the wire */
-struct packet_info {
-  struct timespec ts;   /* timestamp */
-  uint32_t caplen;     /* length of portion present */
-  uint32_t len;        /* length this packet (off wire) */
-};
-
+/* each packet on the wire is described by a struct pkt_desc, see pkt_proc.h */
 typedef void (*frame_handler_func)(void *userdata,
-                                   struct packet_info *pi,
+                                   struct pkt_desc *pi,
                                    uint8_t *eth);
 
+typedef void (*frame_burst_handler_func)(void *userdata,
+                                         struct pkt_desc **pi,
+                                         uint8_t **eth,
+                                         unsigned int num_frames);
+
+/*
+ * called by a capture thread every housekeeping_ms, at a block
+ * boundary or when poll() times out; idle is set when no packets
+ * arrived since the last call.  A nonzero return means work was left
+ * over, and the call is repeated at the next opportunity.
+ */
+typedef unsigned int (*frame_housekeeping_func)(void *userdata,
+                                                unsigned int idle);
+
+/* most frames handed to a frame_burst_handler_func at once */
+#define AF_PACKET_BURST 32
+
+/* milliseconds between housekeeping calls if none are configured */
+#define AF_PACKET_HOUSEKEEPING_MS 100
+
 struct pcap_file {
     int fd;
     int flags;
@@ -81,6 +100,8 @@ struct json_file {
 struct joy_hndlr_ctx {
     uint64_t thread_id;
     uint64_t packet_cnt;
+    uint64_t status_cnt;       /* stats reports made so far */
+    unsigned long flushed;     /* bytes of output at the last flush */
 };
 
 /*
@@ -97,6 +118,8 @@ union frame_handler_context {
 };
 struct frame_handler {
     frame_handler_func func;
+    frame_burst_handler_func burst_func;  /* if set, used instead of func */
+    frame_housekeeping_func housekeeping_func;  /* if set, called periodically */
     union frame_handler_context context;
 };
 
@@ -116,7 +139,7 @@ struct ring_limits {
 };
 
 
-typedef void (*packet_callback_t)(const struct packet_info *,
+typedef void (*packet_callback_t)(const struct pkt_desc *,
 				  const uint8_t *);
 /*
  * Our stats tracking function will get a pointer to a struct
@@ -154,6 +177,7 @@ struct thread_storage {
     int *t_start_p;             /* The clean start predicate */
     pthread_cond_t *t_start_c;  /* The clean start condition */
     pthread_mutex_t *t_start_m; /* The clean start mutex */
+    uint32_t housekeeping_ms;   /* Time between calls of handler.housekeeping_func */
 };
 
 
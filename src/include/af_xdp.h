@@ -0,0 +1,123 @@
+/*
+ * af_xdp.h
+ *
+ * live capture through AF_XDP sockets, an alternative to the
+ * TPACKET_V3 rings of af_packet_v3.h that hands the packets to the
+ * same struct frame_handler
+ */
+
+#ifndef AF_XDP_H
+#define AF_XDP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <linux/if_xdp.h>
+#include "af_packet_v3.h"
+
+/*
+ * Each worker thread owns one AF_XDP socket (XSK), bound to the
+ * receive queue of the interface with the same number as the thread,
+ * and a UMEM of AF_XDP_NUM_FRAMES frames that the kernel writes the
+ * packets of that queue into.  An XDP program attached to the
+ * interface redirects every packet to the socket of its queue, so
+ * the interface needs exactly as many queues as there are threads (see
+ * "ethtool -l"), as packets of a queue with no thread are not captured,
+ * and the packets it captures no longer reach the network stack of
+ * the host; it is meant for a monitoring port.
+ *
+ * Attaching the program needs Linux 5.9 or later.  The interface
+ * does not need a driver with XDP support: the program falls back to
+ * the generic XDP of the kernel, which only allows copy mode.  A veth
+ * pair is enough to try it out.  The mode is an enum xdp_mode of
+ * config.h.
+ */
+
+/* frames of the UMEM of each socket; a power of two */
+#define AF_XDP_NUM_FRAMES 16384
+
+/* bytes of each frame, which bounds the captured length of a packet */
+#define AF_XDP_FRAME_SIZE 2048
+
+/*
+ * descriptors of the RX ring of each socket; a power of two.  The
+ * fill ring has room for all the frames, so that a frame can always
+ * be handed back as soon as its packet is processed.
+ */
+#define AF_XDP_RING_SIZE 8192
+
+/* most descriptors taken from the RX ring at once */
+#define AF_XDP_BURST 32
+
+/*
+ * microseconds a thread sleeps when it finds the RX ring empty after
+ * taking packets from it, before it waits in poll(); the packets that
+ * arrive meanwhile are taken in bursts, as they are from the blocks
+ * of af_packet.  At 15 million packets per second, the RX ring fills
+ * in about half a millisecond.
+ */
+#define AF_XDP_NAP_US 200
+
+/*
+ * struct xsk_ring describes one of the rings mapped from an AF_XDP
+ * socket: the kernel and the capture thread each advance one of the
+ * producer and consumer indexes, which run freely and are masked into
+ * the array of descriptors
+ */
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    uint32_t *flags;
+    void *desc;              /* struct xdp_desc for RX, uint64_t for fill */
+    uint32_t mask;
+    void *map;               /* the mmap()'d region                       */
+    size_t map_len;
+};
+
+/*
+ * struct xsk_thread_storage stores information about each thread,
+ * like struct thread_storage does for af_packet_v3
+ */
+struct xsk_thread_storage {
+    struct frame_handler handler;
+    int tnum;                 /* Thread Number, and the queue it captures */
+    pthread_t tid;            /* Thread ID */
+    int sockfd;               /* AF_XDP socket owned by this thread */
+    int zerocopy;             /* set if the socket was bound in zero-copy mode */
+    uint8_t *umem;            /* the frames the kernel writes packets into */
+    struct xsk_ring rx;       /* descriptors of received packets */
+    struct xsk_ring fill;     /* frames handed to the kernel to receive into */
+    struct xsk_ring comp;     /* required for binding, unused without TX */
+    struct xsk_stats_tracking *statst;
+    int *t_start_p;             /* The clean start predicate */
+    pthread_cond_t *t_start_c;  /* The clean start condition */
+    pthread_mutex_t *t_start_m; /* The clean start mutex */
+    uint32_t housekeeping_ms;   /* Time between calls of handler.housekeeping_func */
+};
+
+struct xsk_stats_tracking {
+    struct xsk_thread_storage *tstor;
+    int num_threads;
+    uint64_t received_packets;
+    uint64_t received_bytes;
+    uint64_t socket_drops;      /* packets the kernel had no frame or RX slot for */
+    uint64_t fill_empty;        /* times the kernel found the fill ring empty */
+    int *t_start_p;             /* The clean start predicate */
+    pthread_cond_t *t_start_c;  /* The clean start condition */
+    pthread_mutex_t *t_start_m; /* The clean start mutex */
+};
+
+/*
+ * af_xdp_bind_and_dispatch() attaches the XDP program to the
+ * interface and creates a socket for each of the cfg->num_threads
+ * threads, in the mode cfg->xdp_mode; it exits on failure, like
+ * af_packet_bind_and_dispatch()
+ */
+int af_xdp_bind_and_dispatch(struct mercury_config *cfg);
+
+/*
+ * af_xdp_start_processing() runs the capture threads until a signal
+ * sets sig_close_flag
+ */
+int af_xdp_start_processing(struct mercury_config *cfg);
+
+#endif /* AF_XDP_H */
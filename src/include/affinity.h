@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file affinity.h
+ *
+ * \brief Placement of threads on CPUs and of memory on NUMA nodes
+ *
+ * The threads that capture packets and the threads that turn them
+ * into flow records can each be pinned to a list of CPUs, given in
+ * the cpulist format of the kernel ("0-3,8,10-11").  The memory that a
+ * thread works on is then moved to the NUMA node of its CPU, and the
+ * packet rings to the node of the interface they are filled from.
+ *
+ * The nodes are found in sysfs and memory is placed with the mbind()
+ * and set_mempolicy() system calls, so libnuma is not needed.  Both
+ * are preferences: the kernel falls back to other nodes when one runs
+ * out of memory.  On platforms other than Linux there is no placement;
+ * the functions fail and the nodes are unknown.
+ *
+ */
+
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/** CPUs are numbered below this, the CPU_SETSIZE of glibc */
+#define AFFINITY_MAX_CPUS 1024
+
+/** NUMA nodes are numbered below this */
+#define AFFINITY_MAX_NODES 1024
+
+/** a list of CPUs, in the order they were given; a CPU may appear more than once */
+typedef struct cpu_list_ {
+    unsigned int num;
+    uint16_t cpu[AFFINITY_MAX_CPUS];
+} cpu_list_t;
+
+/** parse a list like "0-3,8,10-11" into l; ok or failure */
+int cpu_list_parse(cpu_list_t *l, const char *s);
+
+/** CPU number i of a list, wrapping around, or -1 if the list is empty */
+int cpu_list_get(const cpu_list_t *l, unsigned int i);
+
+/**
+ * pin thread t to one CPU, or with cpu -1 let it run anywhere the
+ * process could when the first thread was pinned; ok or failure
+ */
+int affinity_pin(pthread_t t, int cpu);
+
+/**
+ * widen the CPUs of a calling thread that inherited the pin of the
+ * thread that created it to all the CPUs of that node; a thread that
+ * is not pinned to one CPU is left alone
+ */
+void affinity_spread_to_node(void);
+
+/** NUMA node of a CPU, or -1 if it is unknown */
+int affinity_cpu_node(int cpu);
+
+/** NUMA node of the device behind a network interface, or -1 if it is unknown */
+int affinity_interface_node(const char *ifname);
+
+/**
+ * move the whole pages of a region to a node, and have the pages
+ * faulted in later come from there; ok or failure
+ */
+int affinity_place(void *addr, size_t len, int node);
+
+/**
+ * have the memory that the calling thread, or the kernel on its
+ * behalf, allocates from now on come from a node, or with node -1
+ * from the node the thread runs on; ok or failure
+ */
+int affinity_prefer_node(int node);
+
+/** unit test for cpu lists and placement */
+int affinity_unit_test(void);
+
+#endif /* AFFINITY_H */
@@ -102,6 +102,9 @@ int anon_print_subnets(FILE *f);
 /** \brief converts an address into an anonymized string */
 void addr_get_anon_hexstring(const struct in_addr *a, char *buffer, int size);
 
+/** \brief converts an address into the 16 anonymized bytes that the string holds */
+void addr_get_anon_bytes(const struct in_addr *a, unsigned char *c);
+
 /** \brief determines if address is to be anonymized */
 unsigned int ipv4_addr_needs_anonymization(const struct in_addr *a);
 
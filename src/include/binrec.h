@@ -0,0 +1,151 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file binrec.h
+ *
+ * \brief Compact binary format of the flow record output, and a
+ *        streaming reader for it
+ *
+ */
+
+#ifndef BINREC_H
+#define BINREC_H
+
+#include <stdint.h>
+#include "output.h"
+
+/**
+ * A binary output file starts with BINREC_MAGIC and a version byte,
+ * followed by records, each of them a varint length and that many
+ * bytes of tokens.  The tokens are what the writers of output.h were
+ * called with: text written with zputs() or zprintf() (the field names
+ * and punctuation), strings written with zprint_json_string(),
+ * integers as varints, hex data as the raw bytes, and timestamps as
+ * two varints.  Replaying the tokens through the same writers gives
+ * back the JSON record, byte for byte, so the file carries its own
+ * field names and needs no schema to be read.
+ *
+ * Short texts and strings are interned: the first time one is seen
+ * it is stored in a table, and later it is written as its index in
+ * that table.  The table belongs to the file, is filled in the order
+ * the records are written, and is never emptied, so a reader must
+ * start at the beginning of the file.
+ */
+#define BINREC_MAGIC "JOYB"
+#define BINREC_MAGIC_LEN 4
+#define BINREC_VERSION 1
+
+/** entries in the intern table of a file */
+#define BINREC_INTERN_MAX 4096
+
+/** bytes of text and strings held by the intern table of a file */
+#define BINREC_INTERN_BYTES (256 * 1024)
+
+/** longest text or string that is interned */
+#define BINREC_INTERN_MAX_LEN 128
+
+/** longest record a reader accepts */
+#define BINREC_RECORD_MAX (64 * 1024 * 1024)
+
+/*
+ * token tags; the high bit marks a one byte reference to one of the
+ * first 64 entries of the intern table, as text (0x80) or as a
+ * string (0xc0), and tags from 0x20 to 0x7f are unsigned integers
+ * below 96 held in the tag itself
+ */
+#define BINREC_TAG_TEXT          0x01   /*!< varint length, bytes          */
+#define BINREC_TAG_TEXT_NEW      0x02   /*!< as TEXT, and interned         */
+#define BINREC_TAG_TEXT_REF      0x03   /*!< varint index                  */
+#define BINREC_TAG_STRING        0x04   /*!< varint length, bytes          */
+#define BINREC_TAG_STRING_NEW    0x05   /*!< as STRING, and interned       */
+#define BINREC_TAG_STRING_REF    0x06   /*!< varint index                  */
+#define BINREC_TAG_UINT          0x07   /*!< varint                        */
+#define BINREC_TAG_INT           0x08   /*!< zigzag varint                 */
+#define BINREC_TAG_HEX           0x09   /*!< varint length, bytes          */
+#define BINREC_TAG_TIMESTAMP     0x0a   /*!< zigzag varint sec, varint usec */
+#define BINREC_TAG_SMALL_UINT    0x20   /*!< plus the value               */
+#define BINREC_SMALL_UINT_MAX    0x60
+#define BINREC_TAG_SHORT_REF     0x80
+#define BINREC_TAG_SHORT_STRING  0x40
+#define BINREC_SHORT_REF_MAX     64
+
+/** signed integers are stored zigzag encoded: 0, -1, 1, -2, ... */
+#define BINREC_ZIGZAG(v)   (((uint64_t)(v) << 1) ^ (uint64_t)((int64_t)(v) >> 63))
+#define BINREC_UNZIGZAG(u) ((int64_t)((u) >> 1) ^ -(int64_t)((u) & 1))
+
+/** kinds of tokens handed out by the reader */
+enum binrec_token_type {
+    BINREC_TOKEN_TEXT = 0,         /*!< text, written as is            */
+    BINREC_TOKEN_STRING = 1,       /*!< a JSON string, without quotes  */
+    BINREC_TOKEN_UINT = 2,
+    BINREC_TOKEN_INT = 3,
+    BINREC_TOKEN_HEX = 4,          /*!< bytes written as hex digits    */
+    BINREC_TOKEN_TIMESTAMP = 5     /*!< seconds and microseconds       */
+};
+
+/** a token of a record */
+typedef struct binrec_token_ {
+    enum binrec_token_type type;
+    const char *data;              /*!< text, string or bytes; strings end in a NUL */
+    unsigned int len;              /*!< bytes of data                  */
+    uint64_t u;                    /*!< UINT value                     */
+    int64_t i;                     /*!< INT value, or TIMESTAMP seconds */
+    long usec;                     /*!< TIMESTAMP microseconds         */
+} binrec_token_t;
+
+/** a reader of a binary output file */
+typedef struct binrec_reader_ binrec_reader_t;
+
+/** open a binary output file for reading */
+binrec_reader_t *binrec_open(const char *fname);
+
+/** read the next record; 1 if there was one, 0 at the end, -1 on error */
+int binrec_next(binrec_reader_t *r);
+
+/** the tokens of the record last read */
+const binrec_token_t *binrec_tokens(const binrec_reader_t *r, unsigned int *num_tokens);
+
+/** write the record last read as JSON */
+int binrec_print_json(const binrec_reader_t *r, zfile f);
+
+/** close a reader */
+void binrec_close(binrec_reader_t *r);
+
+/** unit test for the binary output format */
+int binrec_unit_test(void);
+
+#endif /* BINREC_H */
@@ -67,14 +67,14 @@ extern float parameters_bd[NUM_PARAMETERS_BD_LOGREG];
 extern float parameters_splt[NUM_PARAMETERS_SPLT_LOGREG];
 
 /* Classifier functions */
-float classify(const unsigned short *pkt_len, const struct timeval *pkt_time,
-       const unsigned short *pkt_len_twin, const struct timeval *pkt_time_twin,
+struct flow_splt_;
+
+float classify(const struct flow_splt_ *splt, const struct flow_splt_ *splt_twin,
        struct timeval start_time, struct timeval start_time_twin, uint32_t max_num_pkt_len,
        uint16_t sp, uint16_t dp, uint32_t op, uint32_t ip, uint32_t np_o, uint32_t np_i,
        uint32_t ob, uint32_t ib, uint16_t use_bd, const uint32_t *bd, const uint32_t *bd_t);
 
-void merge_splt_arrays(const uint16_t *pkt_len, const struct timeval *pkt_time, 
-       const uint16_t *pkt_len_twin, const struct timeval *pkt_time_twin,
+void merge_splt_arrays(const struct flow_splt_ *splt, const struct flow_splt_ *splt_twin,
        struct timeval start_time, struct timeval start_time_twin,
        uint16_t s_idx, uint16_t r_idx,
        uint16_t *merged_lens, uint16_t *merged_times);
@@ -0,0 +1,179 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file columnar.h
+ *
+ * \brief Columnar export of flow records, in chunks that carry
+ *        per-column statistics, for loading into column stores
+ *
+ */
+
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <stdint.h>
+
+/**
+ * A columnar file is a sequence of chunks, each of them complete in
+ * itself, so files can be appended to and concatenated.  All integers
+ * are little endian.  A chunk is
+ *
+ *   header       COLUMNAR_MAGIC, version byte, three zero bytes,
+ *                u32 chunk length (header included), u32 rows,
+ *                u16 columns, u16 zero
+ *   descriptors  one of COLUMNAR_DESC_LEN bytes per column: u8 id,
+ *                u8 type, u8 width, u8 codec, u8 flags, three zero
+ *                bytes, u32 raw length, u32 stored length, 16 bytes
+ *                of minimum, 16 bytes of maximum
+ *   data         the stored bytes of each column, in descriptor order
+ *
+ * A column of type UINT or INT holds one value of width bytes per row.
+ * An ADDR column holds 16 bytes per row: IPv6 addresses as they are,
+ * IPv4 addresses mapped as ::ffff:a.b.c.d, and anonymized IPv4
+ * addresses as the 16 byte block written in hex to the JSON output.
+ * A LIST column holds rows+1 u32 offsets into its values, followed by
+ * the values, width bytes each; the values of row i are those from
+ * offset[i] up to offset[i+1].
+ *
+ * The minimum and maximum of a column are over all of its values (for
+ * a LIST, over the values of all of the lists), as a u64 for UINT and
+ * LIST columns, an int64 for INT columns, and the 16 bytes compared
+ * in order for ADDR columns.  They are present when flags has
+ * COLUMNAR_FLAG_STATS set, so that a reader can skip chunks whose
+ * time range or addresses are outside of what it looks for.
+ *
+ * Columns are compressed as the output files are (compression=):
+ * ZLIB is the zlib format, ZSTD a zstd frame and LZ4 an lz4 frame.
+ * A column that compressing does not make smaller is stored RAW.
+ */
+#define COLUMNAR_MAGIC "JOYC"
+#define COLUMNAR_MAGIC_LEN 4
+#define COLUMNAR_VERSION 1
+#define COLUMNAR_HEADER_LEN 20
+#define COLUMNAR_DESC_LEN 48
+
+/** rows in a chunk, unless configured otherwise */
+#define COLUMNAR_DEFAULT_ROWS 16384
+#define COLUMNAR_MAX_ROWS (1024 * 1024)
+
+/** column types */
+#define COLUMNAR_TYPE_UINT 1
+#define COLUMNAR_TYPE_INT  2
+#define COLUMNAR_TYPE_ADDR 3
+#define COLUMNAR_TYPE_LIST 4
+
+/** how the bytes of a column are stored */
+#define COLUMNAR_CODEC_RAW   0
+#define COLUMNAR_CODEC_ZLIB  1
+#define COLUMNAR_CODEC_BZIP2 2
+#define COLUMNAR_CODEC_ZSTD  3
+#define COLUMNAR_CODEC_LZ4   4
+#define COLUMNAR_NUM_CODECS  5
+
+/** descriptor flags */
+#define COLUMNAR_FLAG_STATS  0x01
+
+/** the columns, by id */
+enum columnar_column {
+    COLUMNAR_SA = 0,           /*!< ADDR                               */
+    COLUMNAR_DA,               /*!< ADDR                               */
+    COLUMNAR_SP,               /*!< UINT 2, 0 unless TCP or UDP        */
+    COLUMNAR_DP,               /*!< UINT 2, 0 unless TCP or UDP        */
+    COLUMNAR_PR,               /*!< UINT 1                             */
+    COLUMNAR_BYTES_OUT,        /*!< UINT 4                             */
+    COLUMNAR_PKTS_OUT,         /*!< UINT 4                             */
+    COLUMNAR_BYTES_IN,         /*!< UINT 4, 0 for unidirectional flows */
+    COLUMNAR_PKTS_IN,          /*!< UINT 4, 0 for unidirectional flows */
+    COLUMNAR_TIME_START,       /*!< INT 8, microseconds since the epoch */
+    COLUMNAR_TIME_END,         /*!< INT 8, microseconds since the epoch */
+    COLUMNAR_PKT_LEN,          /*!< LIST of UINT 2, the "packets" array */
+    COLUMNAR_PKT_DIR,          /*!< LIST of UINT 1, 0 for "<", 1 for ">" */
+    COLUMNAR_PKT_IPT,          /*!< LIST of UINT 4, milliseconds       */
+    COLUMNAR_BYTE_DIST,        /*!< LIST of UINT 4, empty unless dist=1 */
+    COLUMNAR_TLS_CS,           /*!< LIST of UINT 2, offered ciphersuites */
+    COLUMNAR_TLS_SCS,          /*!< UINT 2, selected ciphersuite or 0  */
+    COLUMNAR_NUM_COLUMNS
+};
+
+/** packets of a row, enough for both directions of a flow */
+#define COLUMNAR_MAX_PKTS 400
+
+/** ciphersuites of a row */
+#define COLUMNAR_MAX_CS 256
+
+/** the values of one flow record */
+typedef struct columnar_row_ {
+    uint8_t sa[16];
+    uint8_t da[16];
+    uint16_t sp;
+    uint16_t dp;
+    uint8_t pr;
+    uint32_t bytes_out;
+    uint32_t pkts_out;
+    uint32_t bytes_in;
+    uint32_t pkts_in;
+    int64_t time_start;
+    int64_t time_end;
+    uint16_t num_pkts;
+    uint16_t pkt_len[COLUMNAR_MAX_PKTS];
+    uint8_t pkt_dir[COLUMNAR_MAX_PKTS];
+    uint32_t pkt_ipt[COLUMNAR_MAX_PKTS];
+    uint16_t num_byte_dist;            /*!< 0 or 256 */
+    uint32_t byte_dist[256];
+    uint16_t num_cs;
+    uint16_t cs[COLUMNAR_MAX_CS];
+    uint16_t scs;
+} columnar_row_t;
+
+/** a columnar file being written */
+typedef struct columnar_ columnar_t;
+
+/** open fname for appending chunks of chunk_rows rows */
+columnar_t *columnar_open(const char *fname, unsigned int chunk_rows);
+
+/** add a row; the chunk is written out once it is full */
+int columnar_add(columnar_t *c, const columnar_row_t *row);
+
+/** write out the rows added so far as a chunk, if there are any */
+int columnar_flush(columnar_t *c);
+
+/** flush, close and free */
+void columnar_close(columnar_t *c);
+
+int columnar_unit_test(void);
+
+#endif /* COLUMNAR_H */
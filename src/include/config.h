@@ -53,6 +53,7 @@
 #include "output.h"
 #include "radix_trie.h"
 #include "feature.h"
+#include "print_plan.h"
 
 /** maximum line length */
 #define LINEMAX 512
@@ -68,6 +69,31 @@ enum SALT_algorithm {
   rle = 3
 };
 
+/** default milliseconds between housekeeping runs of a live capture worker */
+#define HOUSEKEEPING_DEFAULT_MS 100
+
+/** default limit on the expired flows written by one housekeeping run */
+#define EXPIRE_DEFAULT_MAX 256
+
+/** formats of the flow record output */
+enum output_format {
+    OUTPUT_FORMAT_JSON = 0,
+    OUTPUT_FORMAT_BINARY = 1     /*!< tokens of binrec.h; see joy-bin2json */
+};
+
+/** backends of live capture, in a build with af_packet */
+enum capture_backend {
+    CAPTURE_AF_PACKET = 0,       /*!< TPACKET_V3 rings; see af_packet_v3.h */
+    CAPTURE_AF_XDP = 1           /*!< AF_XDP sockets; see af_xdp.h */
+};
+
+/** how AF_XDP sockets share their packet buffers with the driver */
+enum xdp_mode {
+    XDP_MODE_AUTO = 0,           /*!< zero-copy if the driver supports it, otherwise copy */
+    XDP_MODE_COPY = 1,           /*!< the kernel copies each packet into the buffers */
+    XDP_MODE_ZEROCOPY = 2        /*!< the driver receives straight into the buffers */
+};
+
 /** structure for the configuration parameters */
 typedef struct configuration {
     bool bidir;
@@ -85,6 +111,7 @@ typedef struct configuration {
     bool show_config;
     bool show_interfaces;
     bool preemptive_timeout;
+    bool hugepages;               /*!< back the flow record pool with hugepages */
     enum SALT_algorithm salt_algo;
 
     uint8_t report_hd;
@@ -122,9 +149,34 @@ typedef struct configuration {
     bool updater_on;
     uint8_t num_threads;
     uint32_t max_records;
+    uint32_t rotate_bytes;        /*!< rotate output files after N bytes, counted before compression */
+    uint32_t rotate_interval;     /*!< rotate output files after N seconds */
+    char *rotate_hook;            /*!< command run on each finished output file */
+    char *rotate_spool;           /*!< directory each finished output file is moved into */
+    uint32_t flow_table_size;     /*!< initial flow table slots per context */
+    uint32_t flow_pool_size;      /*!< flow records preallocated per context */
+    uint32_t max_flows;           /*!< flow records held per context, 0 for no limit */
+    uint8_t flow_evict;           /*!< enum flow_evict_policy used at max_flows */
+    uint32_t housekeeping_ms;     /*!< milliseconds between housekeeping runs of live capture workers */
+    uint32_t expire_max;          /*!< expired flows written per housekeeping run, 0 for no limit */
+    uint8_t capture;              /*!< enum capture_backend */
+    uint8_t xdp_mode;             /*!< enum xdp_mode */
+    uint8_t output_format;        /*!< enum output_format */
+    char *columnar;               /*!< columnar export file, if not NULL */
+    uint32_t chunk_rows;          /*!< rows per chunk of the columnar export */
+    uint8_t compression;          /*!< enum zfile_compression of the output files */
+    uint32_t compress_level;      /*!< compression level, 0 for the default of the backend */
+    uint32_t compress_threads;    /*!< threads compressing zstd output, 0 for none */
+    char *ring_file;              /*!< shared memory ring written instead of output files, if not NULL */
+    uint32_t ring_size;           /*!< bytes of the data area of the ring */
+    uint8_t ring_policy;          /*!< enum shm_ring_policy */
+    char *fields;                 /*!< members of the JSON flow records to write, if not NULL */
+    char *capture_cpus;           /*!< cpulist that capture threads are pinned to, if not NULL */
+    char *worker_cpus;            /*!< cpulist that worker threads are pinned to, if not NULL */
     uint16_t compact_bd_mapping[COMPACT_BD_MAP_MAX];
 
     radix_trie_t rt;
+    print_plan_t *plan;           /*!< compiled from fields when joy starts */
 } configuration_t;
 
 
@@ -250,9 +250,10 @@ void F##_print_json(const F##_t *F,      \
         f##_update(record->f, header, transport_start, transport_len, glb_config->report_##f); \
     }
 
-/** The macro print_feature(f) prints the feature as JSON 
+/** The macro print_feature(f) prints the feature as JSON, unless the
+ * plan of the fields option leaves it out
  */
-#define print_feature(f) if (rec->f != NULL) f##_print_json(rec->f, (rec->twin ? rec->twin->f : NULL), ctx->output);
+#define print_feature(f) if (rec->f != NULL && print_plan_has(plan, PLAN_FIELD_##f)) f##_print_json(rec->f, (rec->twin ? rec->twin->f : NULL), ctx->output);
 
 
 /** The macro init_feature(f) initializes the element f in the
@@ -98,6 +98,15 @@ typedef enum {
 #define JOY_SPLT_PROCESSED      (1 << 3)
 #define JOY_BD_PROCESSED        (1 << 4)
 
+/*
+ * Joy Library Flow Export Flag Values
+ * Given to joy_set_flow_export_callback; JOY_EXPORT_NO_OUTPUT
+ * means that the flow records are only handed to the callback,
+ * and not formatted and written to the output as well.
+ *
+ */
+#define JOY_EXPORT_NO_OUTPUT    (1 << 0)
+
 /*
  * Joy Library Bitmask Values
  * 
@@ -129,6 +138,8 @@ typedef enum {
 #define JOY_RETAIN_LOCAL_ON        (1 << 20)
 #define JOY_UPDATER_ON             (1 << 21)
 #define JOY_FPX_ON                 (1 << 22)
+#define JOY_HUGEPAGES_ON           (1 << 23)
+#define JOY_BINARY_OUTPUT_ON       (1 << 24)
 
 
 /* structure to hold feature ready counts for reporting */
@@ -154,6 +165,23 @@ typedef struct joy_init {
     const char *upload_srvname;  /* upload server name */
     const char *upload_keyfile;  /* upload key file name */
     uint32_t bitmask;            /* bitmask representing which features are on */
+    uint32_t flow_table_size;    /* initial flow table slots per context - if 0, then default used */
+    uint32_t flow_pool_size;     /* flow records preallocated per context - if 0, allocated on demand */
+    uint32_t max_flows;          /* flow records held per context - if 0, no limit */
+    uint8_t flow_evict;          /* flow evicted at max_flows (FLOW_EVICT_LRU, _OLDEST, _NOPAYLOAD) */
+    const char *columnar_file;   /* columnar export file - if NULL, no columnar export */
+    uint32_t chunk_rows;         /* rows per columnar chunk - if 0, then default used */
+    uint8_t compression;         /* output compression (ZFILE_COMPRESSION_*) - if 0, then build default used */
+    uint8_t compress_level;      /* compression level - if 0, then default of the backend used */
+    uint8_t compress_threads;    /* threads compressing zstd output - if 0, then none */
+    uint32_t rotate_bytes;       /* bytes in an output file before it rotates - if 0, no limit */
+    uint32_t rotate_interval;    /* seconds an output file is written before it rotates - if 0, no limit */
+    const char *rotate_hook;     /* command run on each finished output file - if NULL, none */
+    const char *rotate_spool;    /* directory finished output files are moved into - if NULL, none */
+    const char *ring_file;       /* shared memory ring written instead of the output file - if NULL, none */
+    uint32_t ring_size;          /* bytes of the data area of the ring - if 0, then default used */
+    uint8_t ring_policy;         /* what is done when the ring is full (SHM_RING_OVERWRITE, _BLOCK) */
+    const char *fields;          /* members of the JSON flow records written - if NULL, all of them */
 } joy_init_t;
 
 /* structure definition for the library context data */
@@ -162,6 +190,12 @@ typedef struct joy_ctx_data joy_ctx_data;
 /* definition for external processing callback */
 typedef void (joy_flow_rec_callback)(void *rec, unsigned int data_len, unsigned char *data);
 
+/* structure definition for the view of a flow handed to the flow export callback */
+typedef struct flow_view_ flow_view_t;
+
+/* definition for the flow export callback, see joy_set_flow_export_callback */
+typedef void (joy_flow_export_callback)(const flow_view_t *view, void *arg);
+
 #include "pcap.h"
 #include "p2f.h"
 
@@ -373,6 +407,8 @@ extern void joy_update_ctx_global_time (uint8_t ctx_index,
  *      data feature processing. This APi is useful for applications
  *      that use the JOY library and want to use the libraries default
  *      scheme for dividing up traffic among various worker contexts.
+ *      It does not change any state, so it is safe to call from any
+ *      number of threads at once.
  *
  * Parameters:
  *      packet - pointer to the IP packet data
@@ -385,6 +421,63 @@ extern void joy_update_ctx_global_time (uint8_t ctx_index,
  */
 extern uint8_t joy_packet_to_context (const unsigned char *packet, uint8_t num_contexts);
 
+/*
+ * Function: joy_flow_key_to_context
+ *
+ * Description: This function determines the context for a packet
+ *      whose 5-tuple key has already been parsed, in the same way as
+ *      joy_packet_to_context, and counts the packet and its length in
+ *      the load of that context. The counters are not atomic: call it
+ *      from a single thread, the one that distributes the packets.
+ *
+ * Parameters:
+ *      key - pointer to the 5-tuple key of the packet
+ *      len - length of the packet
+ *      num_contexts - number of contexts to use for distribution
+ *
+ * Returns:
+ *      context - the context number the packet belongs to for JOY processing.
+ *
+ */
+struct flow_key_;
+extern uint8_t joy_flow_key_to_context (const struct flow_key_ *key, uint32_t len, uint8_t num_contexts);
+
+/*
+ * Function: joy_get_context_load
+ *
+ * Description: This function reports how many packets and bytes have
+ *      been distributed to a context by joy_flow_key_to_context since
+ *      the library was initialized.
+ *
+ * Parameters:
+ *      ctx_index - the index number of the JOY context
+ *      packets - filled in with the number of packets
+ *      bytes - filled in with the number of bytes
+ *
+ * Returns:
+ *      none
+ *
+ */
+extern void joy_get_context_load (uint8_t ctx_index, uint64_t *packets, uint64_t *bytes);
+
+/*
+ * Function: joy_rebalance_contexts
+ *
+ * Description: This function moves idle entries of the distribution
+ *      table from busy contexts to quiet ones, so that new flows even
+ *      out the load. Flows keep their context as long as calls are
+ *      further apart than the flow inactivity timeout. Call it from
+ *      the thread that distributes packets.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      number of table entries moved
+ *
+ */
+extern unsigned int joy_rebalance_contexts (void);
+
 /*
  * Function: joy_index_to_context
  *
@@ -400,6 +493,26 @@ extern uint8_t joy_packet_to_context (const unsigned char *packet, uint8_t num_c
  */
 extern void* joy_index_to_context (uint8_t ctx_index);
 
+/*
+ * Function: joy_place_context
+ *
+ * Description: This function moves the memory of a context, its flow
+ *      table, flow record pool and output buffers, to a NUMA node.
+ *      Call it before the context processes packets, with the node
+ *      of the CPU that the thread using the context is pinned to;
+ *      memory the context allocates later comes from that thread.
+ *
+ * Parameters:
+ *      ctx_index - index of the context
+ *      node - the NUMA node, see affinity.h
+ *
+ * Returns:
+ *      0 - success
+ *      1 - some of the memory could not be moved
+ *
+ */
+extern int joy_place_context (uint8_t ctx_index, int node);
+
 /*
  * Function: joy_process_packet
  *
@@ -454,6 +567,29 @@ extern void joy_libpcap_process_packet (unsigned char *ctx_index,
                                         const struct pcap_pkthdr *header,
                                         const unsigned char *packet);
 
+/*
+ * Function: joy_process_packet_burst
+ *
+ * Description: This function processes a burst of packets for one
+ *      context, with the same result as passing each packet to
+ *      joy_libpcap_process_packet, but with the flow table lookups of
+ *      the burst overlapped.
+ *
+ * Parameters:
+ *      ctx_index - index of the thread context to use
+ *      headers - libpcap headers of the packets
+ *      packets - the packets; NULL entries are skipped
+ *      num_packets - number of packets in the burst
+ *
+ * Returns:
+ *      none
+ *
+ */
+extern void joy_process_packet_burst (unsigned char *ctx_index,
+                                      const struct pcap_pkthdr **headers,
+                                      const unsigned char **packets,
+                                      unsigned int num_packets);
+
 /*
  * Function: joy_print_flow_data
  *
@@ -478,6 +614,57 @@ extern void joy_libpcap_process_packet (unsigned char *ctx_index,
  */
 extern void joy_print_flow_data (uint8_t index, joy_flow_type_e type);
 
+/*
+ * Function: joy_print_expired_flows
+ *
+ * Description: This function prints out the expired flow records
+ *      of a context as joy_print_flow_data does with
+ *      JOY_EXPIRED_FLOWS, but stops after max_flows of them, so
+ *      that a burst of expirations is spread over several calls.
+ *      The records past max_flows are the first to be printed by
+ *      the next call.
+ *
+ * Parameters:
+ *      index - index of the context to use
+ *      max_flows - most flow records to print, or 0 for no limit
+ *
+ * Returns:
+ *      number of expired flow records still waiting to be printed
+ *
+ */
+extern unsigned int joy_print_expired_flows (uint8_t index, unsigned int max_flows);
+
+/*
+ * Function: joy_set_flow_export_callback
+ *
+ * Description: This function installs a callback that is handed
+ *      each flow as it is removed from the flow record list by
+ *      joy_print_flow_data or joy_export_flows_ipfix, just before
+ *      the flow is deleted. The callback gets a read-only view of
+ *      the whole bidirectional flow (see flow_view_t in p2f.h),
+ *      which is only valid until it returns.
+ *
+ *      The callback must be installed before any packets are
+ *      processed. It runs in the thread that calls
+ *      joy_print_flow_data for the context of the flow, so with
+ *      several contexts it may be called from several threads.
+ *
+ * Parameters:
+ *      callback_fn - function that gets the flows, or NULL to remove it
+ *      arg - passed on to the callback
+ *      flags - JOY_EXPORT_NO_OUTPUT to stop writing the flow records
+ *          to the output, in which case any output file that nothing
+ *          has been written to yet is closed and removed
+ *
+ * Returns:
+ *      0 - success
+ *      1 - failure
+ *
+ */
+extern int joy_set_flow_export_callback (joy_flow_export_callback callback_fn,
+                                         void *arg,
+                                         uint32_t flags);
+
 /*
  * Function: joy_export_flows_ipfix
  *
@@ -46,12 +46,15 @@
 
 #include "output.h"
 #include "ipfix.h"
+#include "columnar.h"
 
 #ifdef JOY_USE_VPP_OPT
 #include "vppinfra/vec.h"
 
 /* VPP optimized implementations */
 
+#define JOY_CTX_ALIGNED
+
 #define JOY_API_ALLOC_CONTEXT(a,b)   \
     vec_validate_aligned(a, (b-1), CLIB_CACHE_LINE_BYTES)
 
@@ -68,9 +71,32 @@
 
 /* default standard implementations */
 
+#ifndef WIN32
+
+/*
+ * each context takes whole pages of its own, so that
+ * joy_place_context() can move it to the NUMA node of the thread that
+ * uses it
+ */
+#define JOY_CTX_ALIGN 4096
+#define JOY_CTX_ALIGNED __attribute__((aligned(JOY_CTX_ALIGN)))
+
+#define JOY_API_ALLOC_CONTEXT(a,b)   \
+    if (posix_memalign((void **)&a, JOY_CTX_ALIGN, sizeof(struct joy_ctx_data) * b) == 0) { \
+        memset(a, 0x00, sizeof(struct joy_ctx_data) * b); \
+    } else {                         \
+        a = NULL;                    \
+    }
+
+#else
+
+#define JOY_CTX_ALIGNED
+
 #define JOY_API_ALLOC_CONTEXT(a,b)   \
     a = calloc(1, (sizeof(struct joy_ctx_data) * b));    
 
+#endif
+
 #define JOY_API_FREE_CONTEXT(a)    \
     free(a);                       \
     a = NULL;
@@ -94,6 +120,8 @@ struct joy_ctx_data  {
     uint32_t bd_recs_ready;
     zfile output;
     char *output_file_basename;
+    char output_filename[MAX_FILENAME_LEN]; /* the output file being written */
+    time_t output_opened;           /* when the output file was opened */
     unsigned int records_in_file;
     struct timeval global_time;
     flocap_stats_t stats;
@@ -102,12 +130,20 @@ struct joy_ctx_data  {
     ipfix_message_t *export_message;
     flow_record_t *flow_record_chrono_first;
     flow_record_t *flow_record_chrono_last;
-    flow_record_list flow_record_list_array[FLOW_RECORD_LIST_LEN];
+    flow_table_t flow_table;
+    flow_record_pool_t record_pool;
+    flow_timer_t flow_timer;
+    flow_queue_t flow_queue[FLOW_QUEUES];
+    columnar_t *columnar;           /* columnar export, opened with the first record */
+    uint8_t columnar_failed;        /* the columnar file could not be opened */
     unsigned long int reserved_info;
     unsigned long int reserved_ctx;
 #ifdef JOY_USE_VPP_OPT
     CLIB_CACHE_LINE_ALIGN_MARK(pad);
 #endif
-};
+} JOY_CTX_ALIGNED;
+
+/* the number of contexts the library was initialized with */
+uint8_t joy_get_num_contexts(void);
 
 #endif /* JOY_API_PRV_H */
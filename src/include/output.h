@@ -37,10 +37,13 @@
 /**
  * \file output.h
  *
- * \brief this header defines macros for a compile-time option that can
- * automatically compress file output using zlib; it is used for
- * automatic JSON compression (but could be used for other purposes as
- * well)
+ * \brief this header declares the output streams used for the JSON
+ * data; a compile-time option selects whether they are compressed
+ * with zlib or bzip2.  The streams are implemented in output.c, and
+ * can be written out by a thread of their own.  Besides zprintf(),
+ * they have writers for the integers, strings, hex and timestamps that
+ * make up most of a flow record, which do not parse a format.  A
+ * stream can also write those values in the binary format of binrec.h.
  *
  */
 #ifndef OUTPUT_H
@@ -51,28 +54,48 @@
 #endif
 
 /**
- * \brief Set the variable COMPRESSED_OUTPUT to 1 to use zlib to
- * automatically compress the JSON output, or set it to 0 to have
- * normal output.  When compressed output is used, zless can be used
- * to read the files, and gunzip can be used to convert them to normal
- * files.  
+ * \brief The compression of the output is chosen at run time, from
+ * the backends that the build includes: gzip when COMPRESSED_OUTPUT
+ * is 1 or USE_GZIP is defined, bzip2 with USE_BZIP2, zstd with
+ * USE_ZSTD and lz4 with USE_LZ4.  COMPRESSED_OUTPUT and USE_BZIP2
+ * also pick the default: bzip2 if it is built in, otherwise gzip if
+ * COMPRESSED_OUTPUT is 1, otherwise none.  zless, bzless, zstdless
+ * and lz4 -dc read the files.
  *
  */
-//#ifndef COMPRESSED_OUTPUT
-//#define COMPRESSED_OUTPUT 1
-//#endif
 #ifdef FORCED_COMPRESSED_OUTPUT_OFF
 #undef COMPRESSED_OUTPUT
 #define COMPRESSED_OUTPUT 0
 #endif
 
-#if (COMPRESSED_OUTPUT == 0)
-/** normal output */
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/** the compression backends */
+enum zfile_compression {
+    ZFILE_COMPRESSION_DEFAULT = 0,      /*!< ZFILE_COMPRESSION_BUILD            */
+    ZFILE_COMPRESSION_NONE = 1,
+    ZFILE_COMPRESSION_GZIP = 2,
+    ZFILE_COMPRESSION_BZIP2 = 3,
+    ZFILE_COMPRESSION_ZSTD = 4,
+    ZFILE_COMPRESSION_LZ4 = 5
+};
+#define ZFILE_COMPRESSION_MAX 6
+
+#ifdef FORCED_COMPRESSED_OUTPUT_OFF
+/** normal output, for tools built without output.c */
 typedef FILE *zfile;
 
 #define zopen(fname, ...)    (fopen(fname, __VA_ARGS__))
 #define zattach(fd, ...)     (fd)
 #define zprintf(output, ...) (fprintf(output, __VA_ARGS__))
+#define zwrite(output, data, len) ((int)fwrite(data, 1, len, output))
+#define zputs(output, s)     (fputs(s, output))
+#define zputc(output, c)     (fputc(c, output))
+#define zprint_uint(output, v) (fprintf(output, "%u", (unsigned int)(v)))
+#define zprint_int(output, v)  (fprintf(output, "%d", (int)(v)))
+#define zcommit(output)      ((void)(output))
 #define zflush(FILEp)        (fflush(FILEp))
 #define zclose(output)       (fclose(output))
 #define zsuffix              ""
@@ -80,43 +103,149 @@ typedef FILE *zfile;
 #else
 
 #ifdef USE_BZIP2
-    /** bzip2 compressed output */
     #include <bzlib.h>
     int BZ2_bzprintf(BZFILE *b, const char * format, ...);
+#endif
+
+/** the compression used when none is configured */
+#if defined(USE_BZIP2)
+#define ZFILE_COMPRESSION_BUILD ZFILE_COMPRESSION_BZIP2
+#elif (COMPRESSED_OUTPUT == 0) && !defined(USE_GZIP)
+#define ZFILE_COMPRESSION_BUILD ZFILE_COMPRESSION_NONE
+#else
+#define ZFILE_COMPRESSION_BUILD ZFILE_COMPRESSION_GZIP
+#endif
 
-    typedef BZFILE *zfile;
+/** the suffix of output files, for the configured compression */
+#define zsuffix (zcompression_suffix(zcompression_configured()))
 
-    #define zopen(fname, ...)    (BZ2_bzopen(fname, __VA_ARGS__))
+/** an output stream, implemented in output.c */
+typedef struct zfile_ *zfile;
 
-    #ifdef WIN32
-        #define zattach(FILEp, ...)  (BZ2_bzdopen(_fileno(FILEp), __VA_ARGS__))
-    #else
-        #define zattach(FILEp, ...)  (BZ2_bzdopen(fileno(FILEp), __VA_ARGS__))
-    #endif
-    #define zprintf              BZ2_bzprintf
-    #define zflush(FILEp)        (BZ2_bzflush(FILEp))
-    #define zclose(output)       (BZ2_bzclose(output))
-    #define zsuffix              ".bz2"
+/** counters of an asynchronous output stream */
+typedef struct zfile_stats_ {
+    unsigned long bytes;                /*!< bytes written to the stream        */
+    unsigned long bytes_written;        /*!< bytes handed on by the writer      */
+    unsigned int queued;                /*!< full buffers waiting for the writer */
+    unsigned int max_queued;            /*!< most buffers ever waiting          */
+    unsigned long waits;                /*!< times all buffers were full        */
+} zfile_stats_t;
 
+/** open a file for output, compressed as configured */
+zfile zopen(const char *fname, const char *mode);
+
+/** open a file for output with the given compression, level and threads */
+zfile zopen_compressed(const char *fname, const char *mode,
+                       unsigned int compression, int level, unsigned int threads);
+
+/** open an output stream on a ring in shared memory, see shm_ring.h */
+zfile zopen_ring(const char *fname, uint64_t size, unsigned int policy);
+
+/** open an output stream on an open stdio stream */
+zfile zattach(FILE *fp, const char *mode);
+
+/** lets the compiler check the arguments of zprintf() against its format */
+#ifdef WIN32
+#define ZPRINTF_FORMAT
 #else
-    /** gzip compressed output */
-    #include <zlib.h>
-    typedef gzFile zfile;
-
-    #define zopen(fname, ...)    (gzopen(fname, __VA_ARGS__))
-
-    #ifdef WIN32
-        #define zattach(FILEp, ...)  (gzdopen(_fileno(FILEp), __VA_ARGS__))
-    #else
-        #define zattach(FILEp, ...)  (gzdopen(fileno(FILEp), __VA_ARGS__))
-    #endif
-
-    #define zprintf(output, ...) (gzprintf(output, __VA_ARGS__))
-    #define zflush(FILEp)        (gzflush(FILEp))
-    #define zclose(output)       (gzclose(output))
-    #define zsuffix              ".gz"
+#define ZPRINTF_FORMAT __attribute__((format(printf, 2, 3)))
 #endif
 
+/** write formatted data to a stream */
+int zprintf(zfile f, const char *format, ...) ZPRINTF_FORMAT;
+
+/** write bytes to a stream */
+int zwrite(zfile f, const void *data, unsigned int len);
+
+/** write a string to a stream */
+int zputs(zfile f, const char *s);
+
+/** write a character to a stream */
+int zputc(zfile f, int c);
+
+/** write an unsigned integer in decimal, as "%u" */
+int zprint_uint(zfile f, unsigned int v);
+
+/** write a signed integer in decimal, as "%d" */
+int zprint_int(zfile f, int v);
+
+/** write a 64-bit unsigned integer in decimal, as "%llu" */
+int zprint_uint64(zfile f, uint64_t v);
+
+/** write a 64-bit signed integer in decimal, as "%lld" */
+int zprint_int64(zfile f, int64_t v);
+
+/** write a time as seconds with six decimals, as "%lld.%06ld" */
+int zprint_timestamp(zfile f, int64_t sec, long usec);
+
+/** write bytes as lowercase hex digits, two per byte */
+int zprint_hex(zfile f, const unsigned char *data, unsigned int len);
+
+/** write a string as a quoted and escaped JSON string */
+int zprint_json_string(zfile f, const char *s);
+
+/** mark the end of a record; lets buffered data trickle out */
+void zcommit(zfile f);
+
+/** write out everything written to a stream so far */
+int zflush(zfile f);
+
+/** write out everything written to a stream and close it */
+int zclose(zfile f);
+
+/** switch a stream to the binary format of binrec.h */
+int zbinary(zfile f);
+
+/** compress and write a stream on a thread of its own */
+int zasync(zfile f);
+
+/** move the buffers of a stream to a NUMA node, see affinity.h */
+int zplace(zfile f, int node);
+
+/** report the counters of an asynchronous stream */
+void zstats(zfile f, zfile_stats_t *stats);
+
+/** the bytes written to a stream so far, before compression */
+unsigned long zbytes(zfile f);
+
+/** the name of a compression backend, such as "gzip" */
+const char *zcompression_name(unsigned int compression);
+
+/** the file suffix of a compression backend, such as ".gz" */
+const char *zcompression_suffix(unsigned int compression);
+
+/** whether a compression backend is built in */
+int zcompression_available(unsigned int compression);
+
+/** the compression backend the configuration selects */
+unsigned int zcompression_configured(void);
+
+/** compress a block; *out_len holds the room at out, and is set to the bytes used */
+int zcompress_block(unsigned int compression, int level, const void *in, size_t len,
+                    void *out, size_t *out_len);
+
+/** the room zcompress_block() may need for len bytes */
+size_t zcompress_bound(unsigned int compression, size_t len);
+
+/** decompress a block of a known decompressed length */
+int zdecompress_block(unsigned int compression, const void *in, size_t len,
+                      void *out, size_t out_len);
+
+/** a reader of a file written by an output stream */
+typedef struct zreader_ *zreader;
+
+/** open a file for reading, with the backend that its first bytes show */
+zreader zread_open(const char *fname);
+
+/** read up to len bytes; returns the number read, 0 at the end, or -1 on error */
+int zread(zreader r, void *buf, unsigned int len);
+
+/** close a reader */
+void zread_close(zreader r);
+
+/** unit test for the output streams */
+int output_unit_test(void);
+
 #endif
 
 #endif  /* OUTPUT_H */
@@ -65,15 +65,22 @@
 #define ETTA_MIN_PACKETS 10
 #define ETTA_MIN_OCTETS 4000
 
-/* flow value definitions */
-#define flow_key_hash_mask 0xFFFF
-#define FLOW_RECORD_LIST_LEN (flow_key_hash_mask + 1)
+/* flow table definitions; sizes are numbers of slots and are powers of two */
+#define FLOW_TABLE_DEFAULT_SIZE 0x10000
+#define FLOW_TABLE_MIN_SIZE 0x100
+#define FLOW_TABLE_MAX_SIZE 0x10000000
 
 enum twins_match {
     EXACT_MATCH = 0,
     NEAR_MATCH = 1,
 };
 
+/* whether a flow key and its twin hash to the same value */
+enum flow_key_hash_mode {
+    FLOW_KEY_HASH_DIRECTED = 0,
+    FLOW_KEY_HASH_SYMMETRIC = 1,
+};
+
 /**
  * The maximum number of IP ID fields that will be
  * reported for a single flow.
@@ -91,9 +98,13 @@ typedef struct tcp_info_ {
     uint32_t seq;
     uint32_t retrans;
     uint32_t first_seq;
+    uint32_t order_start;       /* first sequence number of the data seen in order */
+    uint32_t order_end;         /* sequence number after the data seen in order    */
     uint16_t first_window_size;
     unsigned char flags;
     unsigned char opt_len;
+    unsigned char order_seen;   /* order_start and order_end are set */
+    unsigned char order_empty;  /* an empty segment was seen at order_end */
     unsigned char opts[TCP_OPT_LEN];
 } tcp_info_t;
 
@@ -132,6 +143,67 @@ extern FILE *info;
 #define MAX_IDP 1500
 #define MAX_TCP_RETRANS_BUFFER 10
 
+/*
+ * The per-packet arrays of a flow are kept out of flow_record_t, so
+ * that the record itself stays small for the many flows that never
+ * use them.  Each block is allocated the first time a packet of the
+ * flow needs it, and only if the corresponding option is enabled; a
+ * NULL pointer reads as an all-zero block (see flow_record_splt() and
+ * flow_record_bd()).
+ */
+
+/** sequence of packet lengths and times */
+typedef struct flow_splt_ {
+    struct timeval start;                 /*!< arrival time of the first packet */
+    int32_t pkt_time[MAX_NUM_PKT_LEN];    /*!< array of arrival times, in microseconds
+                                               after start (see joy_timer_series_get) */
+    uint16_t pkt_len[MAX_NUM_PKT_LEN];    /*!< array of packet appdata lengths */
+    uint8_t pkt_flags[MAX_NUM_PKT_LEN];   /*!< array of packet flags           */
+} flow_splt_t;
+
+/** byte distribution of the flow's application data */
+typedef struct flow_bd_ {
+    uint32_t byte_count[256];             /*!< number of occurences of each byte   */
+    uint32_t compact_byte_count[16];      /*!< number of occurences of each byte, mapping to compact form   */
+    uint32_t num_bytes;
+    double bd_mean;
+    double bd_variance;
+} flow_bd_t;
+
+/**
+ * recently seen TCP segments, for retransmission detection; only kept
+ * once a flow has sent a segment that leaves a gap after the data
+ * before it, as the data of a flow without gaps is covered by the
+ * order_start and order_end of its tcp_info_t
+ */
+typedef struct flow_retrans_ {
+    uint8_t tail;                         /*!< next entry to overwrite         */
+    tcp_retrans_t seg[MAX_TCP_RETRANS_BUFFER];
+} flow_retrans_t;
+
+/*
+ * Queues of flow records waiting for the joy_*_external_processing()
+ * calls, one per data feature, plus one of the records that have been
+ * handed to at least one of those calls (for joy_delete_flow_records),
+ * and one of all flows, least recently seen first, for eviction
+ */
+enum flow_queue_id {
+    FLOW_QUEUE_IDP = 0,
+    FLOW_QUEUE_TLS,
+    FLOW_QUEUE_SPLT,
+    FLOW_QUEUE_SALT,
+    FLOW_QUEUE_BD,
+    FLOW_QUEUE_PROCESSED,
+    FLOW_QUEUE_LRU,
+    FLOW_QUEUES
+};
+
+/** links of a flow record in one of the flow queues */
+typedef struct flow_queue_link_ {
+    struct flow_record_ *next;
+    struct flow_record_ *prev;
+} flow_queue_link_t;
+
 typedef struct flow_record_ {
     flow_key_t key;                       /*!< identifies flow by 5-tuple          */
     uint32_t key_hash;                    /*!< hash of the 5-tuple key             */
@@ -144,14 +216,8 @@ typedef struct flow_record_ {
     struct timeval start;                 /*!< start time                          */ 
     struct timeval end;                   /*!< end time                            */
     uint16_t last_pkt_len;                /*!< last observed appdata length        */
-    uint16_t pkt_len[MAX_NUM_PKT_LEN];    /*!< array of packet appdata lengths */  
-    struct timeval pkt_time[MAX_NUM_PKT_LEN]; /*!< array of arrival times          */
-    uint8_t pkt_flags[MAX_NUM_PKT_LEN];   /*!< array of packet flags           */
-    uint32_t byte_count[256];             /*!< number of occurences of each byte   */
-    uint32_t compact_byte_count[16];      /*!< number of occurences of each byte, mapping to compact form   */
-    uint32_t num_bytes;
-    double bd_mean;
-    double bd_variance;
+    flow_splt_t *splt;                    /*!< packet lengths and times, or NULL   */
+    flow_bd_t *bd;                        /*!< byte distribution, or NULL          */
     header_description_t hd;              /*!< header description (proto ident)    */
     bool idp_packet;                   /*!< determines if packet is used for IDP */
     int32_t idp_seq_num;                  /*!< marks the SYN packet for IDP determination */
@@ -160,8 +226,7 @@ typedef struct flow_record_ {
     ip_info_t ip;
     tcp_info_t tcp;
     uint8_t is_tcp_retrans;
-    uint8_t tcp_retrans_tail;
-    tcp_retrans_t tcp_retrans[MAX_TCP_RETRANS_BUFFER];
+    flow_retrans_t *retrans;              /*!< retransmission buffer, or NULL      */
     bool invalid;
     char *exe_name;                       /*!< executable associated with flow    */
     char *full_path;                      /*!< executable path associated with flow    */
@@ -183,19 +248,77 @@ typedef struct flow_record_ {
     define_all_features(feature_list)     /*!< define all features listed in feature.h */
   
     struct flow_record_ *twin;             /*!< other half of bidirectional flow    */
-    struct flow_record_ *next;             /*!< next record in flow_record_list     */
-    struct flow_record_ *prev;             /*!< previous record in flow_record_list */
     struct flow_record_ *time_prev;        /*!< previous record in chronological list */
     struct flow_record_ *time_next;        /*!< next record in chronological list     */
+    struct flow_record_ *timer_next;       /*!< next record in timer wheel slot       */
+    struct flow_record_ **timer_pprev;     /*!< link pointing at this record, or NULL */
+    uint64_t timer_expires;                /*!< second at which to check expiration   */
+    uint8_t timer_level;                   /*!< timer wheel level holding the record  */
+    uint8_t queued;                        /*!< bitmask of flow queues holding it     */
+    flow_queue_link_t queue_link[FLOW_QUEUES];
 } flow_record_t;
 
+/*
+ * A flow view is the read-only picture of an expired bidirectional
+ * flow that is handed to the flow export callback (see
+ * flow_record_set_export()), just before the flow is deleted.  Side
+ * FLOW_VIEW_OUT is the client, whose record is the one the JSON
+ * output is written from; side FLOW_VIEW_IN is its twin, and is all
+ * zeroes and NULL pointers for a unidirectional flow.  The pointers
+ * are only valid during the callback.  Members are only ever added at
+ * the end, after the data features, and version is bumped when they
+ * are, so that a callback built against an older p2f.h can tell which
+ * members it may read.
+ */
+#define FLOW_VIEW_VERSION 1
+
+#define FLOW_VIEW_OUT 0
+#define FLOW_VIEW_IN  1
+
+/** The macro flow_view_feature(f) declares the pointers to the f_t
+ *  data of both sides of a flow view
+ */
+#define flow_view_feature(f) const f##_t *f[2];
+
+/** The macro set_view_feature(f) points side of view at the f_t data
+ *  of rec
+ */
+#define set_view_feature(f) view->f[side] = rec->f;
+
+struct flow_view_ {
+    uint32_t version;                     /*!< FLOW_VIEW_VERSION                   */
+    uint32_t ctx_id;                      /*!< context that held the flow          */
+    flow_key_t key;                       /*!< 5-tuple of the client side          */
+    uint32_t ip_type;                     /*!< IPv4 or IPv6 encoding type          */
+    uint8_t exp_type;                     /*!< expiration type, or 0               */
+    struct timeval start;                 /*!< start time                          */
+    struct timeval end;                   /*!< end time                            */
+    uint32_t bytes[2];                    /*!< bytes of application data           */
+    uint32_t num_pkts[2];                 /*!< number of packets                   */
+    uint32_t num_pkt_len[2];              /*!< entries of pkt_len and pkt_time     */
+    const uint16_t *pkt_len[2];           /*!< packet appdata lengths              */
+    struct timeval pkt_time_start[2];     /*!< arrival time of the first packet    */
+    const int32_t *pkt_time[2];           /*!< arrival times, microseconds after
+                                               pkt_time_start, see
+                                               joy_timer_series_get()              */
+    const uint32_t *byte_count[2];        /*!< byte distribution, or NULL          */
+    const flow_record_t *rec[2];          /*!< the flow records themselves         */
+
+    MAP(flow_view_feature, feature_list)  /*!< data features of both sides         */
+};
+
+/** flow export callback, see flow_record_set_export() */
+typedef joy_flow_export_callback flow_export_fn;
+
 
 /** \remarks \verbatim
    flow_records can be accessed in either of two ways: 
   
      - An individual record can be looked up by its flow key, which
-       uses the flow_record_list_array[], which is indexed by the
-       flow_key_hash() function; this is a doubly linked list.
+       uses the per-context flow_table, an open addressing hash table
+       indexed by the flow_key_hash() function.  Each slot holds the
+       full hash of the key alongside the record pointer, so a probe
+       only touches a flow_record when the hashes match.
   
      - All records can be listed in chronological order, using the
        time_next pointer's linked list.  (That list will actually be
@@ -217,20 +340,124 @@ typedef struct flow_record_ {
    adds a newly created flow_record to the chronological list only if
    it has no twin.
   
+   The flow_table doubles in size once it is three quarters full.  The
+   resize is incremental: the old slot array is kept alongside the new
+   one and a few of its slots are migrated on every insertion, so no
+   single packet pays for rehashing the whole table.  Lookups consult
+   both arrays until the migration is complete.
+
+   Every record on the chronological list is also on the per-context
+   flow_timer wheel, in the slot for the second at which it could
+   first expire.  Packets don't touch the wheel; when a record comes
+   due, flow_record_is_expired() decides, and a record that is still
+   live is rescheduled for its new deadline.  Expired-flow sweeps thus
+   only visit records that are due, instead of the whole list.
+
+   Once the joy_*_external_processing() API has been used, records
+   on the chronological list are also put on a per-feature flow_queue
+   when the feature's data is ready or the flow expires, so that those
+   calls only visit the records they have work for.
+
+   The SPLT, byte distribution and TCP retransmission state of a flow
+   live in separately allocated blocks hanging off the record; they
+   are attached on demand and freed by flow_record_delete().
+
    The function flow_record_list_free() frees *all* flow records in
-   the flow_record_list_array[].  This function should only be used
-   after all processing of all of the associated flows is done.
+   the flow_table.  This function should only be used after all
+   processing of all of the associated flows is done.
    
  \endverbatim
  */
 
 
+/**
+ * A flow_record_pool is a per-context slab of preallocated flow
+ * records.  Free records are chained through their time_next pointer.
+ * Only the context's own thread allocates from and frees into its
+ * pool, so no locking is needed.
+ */
+typedef struct flow_record_pool_ {
+    flow_record_t *slab;            /*!< preallocated records                 */
+    uint32_t capacity;              /*!< number of records in slab            */
+    uint32_t num_free;              /*!< records on the free list             */
+    flow_record_t *free_list;       /*!< head of the free list                */
+    size_t slab_len;                /*!< bytes allocated for slab             */
+    bool mapped;                    /*!< slab is an mmap of hugepages         */
+} flow_record_pool_t;
+
+/* upper bound on the flow_pool_size configuration */
+#define FLOW_RECORD_POOL_MAX_SIZE 0x1000000
+
 /*
- * A flow_record_list is a handle for a linked list of flow_records;
- * an array of such lists is used as a flow cache
+ * Which flow is evicted to make room for a new one once a context
+ * holds max_flows flow records
+ */
+enum flow_evict_policy {
+    FLOW_EVICT_LRU = 0,             /*!< the flow seen least recently          */
+    FLOW_EVICT_OLDEST = 1,          /*!< the flow that started first           */
+    FLOW_EVICT_NOPAYLOAD = 2        /*!< a flow with no payload, else LRU      */
+};
+
+/* flows examined from the LRU end for FLOW_EVICT_NOPAYLOAD */
+#define FLOW_EVICT_SCAN 32
+
+/**
+ * A flow_table_slot holds one entry of the flow table; a slot is
+ * empty when its record pointer is NULL
+ */
+typedef struct flow_table_slot_ {
+    uint32_t hash;                  /*!< full hash of the record's flow key */
+    flow_record_t *record;          /*!< record stored in this slot         */
+} flow_table_slot_t;
+
+/**
+ * A flow_table is the per-context flow cache, using open addressing
+ * with linear probing
  */
+typedef struct flow_table_ {
+    flow_table_slot_t *slots;       /*!< current slot array                      */
+    uint32_t size;                  /*!< number of slots, a power of two         */
+    uint32_t count;                 /*!< records stored in slots                 */
+    flow_table_slot_t *old_slots;   /*!< slot array being drained by a resize    */
+    uint32_t old_size;              /*!< number of slots in old_slots            */
+    uint32_t old_count;             /*!< records still stored in old_slots       */
+    uint32_t rehash_pos;            /*!< next slot of old_slots to be migrated   */
+} flow_table_t;
 
-typedef flow_record_t *flow_record_list;
+/**
+ * A flow_queue is a FIFO of flow records, linked through their
+ * queue_link entry for the queue
+ */
+typedef struct flow_queue_ {
+    flow_record_t *first;
+    flow_record_t *last;
+    uint32_t count;                 /*!< records in the queue                    */
+    uint32_t min;                   /*!< data needed for a record to be ready    */
+    bool active;                    /*!< records are being queued                */
+} flow_queue_t;
+
+/* timer wheel geometry: each level has 2^FLOW_TIMER_BITS slots, and a
+ * slot of level n spans 2^(n*FLOW_TIMER_BITS) seconds */
+#define FLOW_TIMER_BITS   6
+#define FLOW_TIMER_SLOTS  (1 << FLOW_TIMER_BITS)
+#define FLOW_TIMER_LEVELS 4
+
+/**
+ * A flow_timer is a hierarchical timer wheel holding the records on
+ * the chronological list, keyed on the second of their deadline
+ */
+typedef struct flow_timer_ {
+    flow_record_t *slot[FLOW_TIMER_LEVELS][FLOW_TIMER_SLOTS];
+    uint32_t level_count[FLOW_TIMER_LEVELS]; /*!< records held in each level   */
+    uint32_t count;                 /*!< records held in the wheel               */
+    uint64_t tick;                  /*!< second currently being expired          */
+    flow_record_t *expired;         /*!< records found expired, not yet deleted  */
+    flow_record_t **expired_tail;   /*!< link at the end of the expired list     */
+    uint32_t num_expired;           /*!< records on the expired list             */
+} flow_timer_t;
+
+/* timer_level of records on the expired list of the timer wheel */
+#define FLOW_TIMER_EXPIRED FLOW_TIMER_LEVELS
 
 #define CREATE_RECORDS      1
 #define DONT_CREATE_RECORDS 0
@@ -268,6 +495,48 @@ flow_record_t *flow_key_get_record(joy_ctx_data *ctx,
                                         const struct pcap_pkthdr *header);
 
 
+/** hash a flow key and prefetch the flow table slot it maps to */
+uint32_t flow_key_prefetch(joy_ctx_data *ctx, const flow_key_t *key);
+
+/** prefetch the flow record in the slot a hash maps to */
+void flow_record_prefetch(joy_ctx_data *ctx, uint32_t hash);
+
+/** the record on the chronological list for the flow of a record */
+flow_record_t *flow_record_chrono_head(joy_ctx_data *ctx, flow_record_t *rec);
+
+/** check if a record has data ready for, and not yet handed to, an external processing call */
+unsigned int flow_record_is_ready(const flow_record_t *rec, unsigned int queue, unsigned int min);
+
+/** append a flow record to a flow queue, if it isn't already on it */
+void flow_queue_push(joy_ctx_data *ctx, flow_record_t *rec, unsigned int queue);
+
+/** take the first flow record off a flow queue */
+flow_record_t *flow_queue_pop(joy_ctx_data *ctx, unsigned int queue);
+
+/** bring a flow queue up to date before it is drained */
+void flow_queue_prepare(joy_ctx_data *ctx, unsigned int queue, unsigned int min);
+
+/** the flow record's SPLT block, or an all-zero block if it has none */
+#define flow_record_splt(f) ((f)->splt != NULL ? (const flow_splt_t *)(f)->splt : &flow_splt_empty)
+
+/** the flow record's byte distribution block, or an all-zero block if it has none */
+#define flow_record_bd(f) ((f)->bd != NULL ? (const flow_bd_t *)(f)->bd : &flow_bd_empty)
+
+extern const flow_splt_t flow_splt_empty;
+extern const flow_bd_t flow_bd_empty;
+
+/** attach an SPLT block to the flow record if it doesn't have one */
+flow_splt_t *flow_record_attach_splt(flow_record_t *f);
+
+/** attach a byte distribution block to the flow record if it doesn't have one */
+flow_bd_t *flow_record_attach_bd(flow_record_t *f);
+
+/** attach a retransmission buffer to the flow record if it doesn't have one */
+flow_retrans_t *flow_record_attach_retrans(flow_record_t *f);
+
+/** append a packet length and time to the flow record's SPLT */
+void flow_record_update_splt(flow_record_t *f, unsigned int len, const struct timeval *time);
+
 /** update the byte count of the flow record */
 void flow_record_update_byte_count(flow_record_t *f, const void *x, unsigned int len);
 
@@ -278,7 +547,10 @@ void flow_record_update_byte_dist_mean_var(flow_record_t *f, const void *x, unsi
 
 void flow_record_update_timeouts(unsigned int inact, unsigned int act);
 
-void flow_record_list_init(joy_ctx_data *ctx);
+int flow_record_list_init(joy_ctx_data *ctx);
+
+/** move the flow table and flow record pool of a context to a NUMA node */
+int flow_record_list_place(joy_ctx_data *ctx, int node);
 
 void flow_record_list_free(joy_ctx_data *ctx); 
 
@@ -286,6 +558,10 @@ void flow_record_export_as_ipfix(joy_ctx_data *ctx, unsigned int print_all);
 
 void flow_record_list_print_json(joy_ctx_data *ctx, unsigned int print_all);
 
+unsigned int flow_record_list_print_expired(joy_ctx_data *ctx, unsigned int max);
+
+void flow_record_set_export(flow_export_fn *fn, void *arg, unsigned int write_output);
+
 unsigned int flow_record_is_expired(joy_ctx_data *ctx, flow_record_t *record);
 
 void remove_record_and_update_list(joy_ctx_data *ctx, flow_record_t *rec);
@@ -305,6 +581,18 @@ int process_pcap_file(int index, char *file_name, const char *filter_exp, bpf_u_
  * num_records_output is the total number of flow records that have been 
  * written to output
  *
+ * num_table_lookups and num_table_probes count the flow table lookups
+ * and the slots examined by them, max_table_probe is the longest probe
+ * sequence seen since the last stats output, and num_table_resizes
+ * counts the number of times the flow table has grown
+ *
+ * pool_exhausted counts the flow records that had to come from the
+ * heap because the context's flow record pool was empty; malloc_fail
+ * counts allocations that failed outright
+ *
+ * flows_expired counts the flows written out because they timed out,
+ * and flows_evicted those written out early to stay within max_flows
+ *
  */
 typedef struct flocap_stats_ {
   unsigned long int num_packets;
@@ -312,6 +600,13 @@ typedef struct flocap_stats_ {
   unsigned long int num_records_in_table;
   unsigned long int num_records_output;
   unsigned long int malloc_fail;
+  unsigned long int num_table_lookups;
+  unsigned long int num_table_probes;
+  unsigned long int max_table_probe;
+  unsigned long int num_table_resizes;
+  unsigned long int pool_exhausted;
+  unsigned long int flows_expired;
+  unsigned long int flows_evicted;
 } flocap_stats_t;
 
 //#define flocap_stats_init(c) flocap_stats_t stats = {  0, 0, 0, 0 };
@@ -332,6 +627,14 @@ typedef struct flocap_stats_ {
 
 #define flocap_stats_incr_malloc_fail(c) (c->stats.malloc_fail++)
 
+#define flocap_stats_incr_table_resizes(c) (c->stats.num_table_resizes++)
+
+#define flocap_stats_incr_pool_exhausted(c) (c->stats.pool_exhausted++)
+
+#define flocap_stats_incr_flows_expired(c) (c->stats.flows_expired++)
+
+#define flocap_stats_incr_flows_evicted(c) (c->stats.flows_evicted++)
+
 #define flocap_stats_format "packets: %lu\tcurrent records: %lu\toutput records: %lu"
 
 
@@ -0,0 +1,114 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file pcap_reader.h
+ *
+ * \brief Reader of packet capture files in the pcap and pcapng
+ *        formats, plain or compressed, that hands out packets in
+ *        bursts without copying them
+ *
+ * A plain file is mapped into memory and its packets are handed out
+ * where they lie.  A compressed file, or one that cannot be mapped,
+ * is read through a zreader of output.h by a thread of its own, which
+ * decompresses into a queue of PCAP_READER_BUF_SIZE buffers while the
+ * packets of the buffers before it are processed; only a packet that
+ * spans two buffers is copied.
+ *
+ * Both pcap formats are read in either byte order.  pcap files may
+ * have microsecond or nanosecond timestamps; pcapng files may have
+ * several sections and several interfaces, each with the timestamp
+ * resolution and offset of its if_tsresol and if_tsoffset options.
+ * The timestamps are handed out as microseconds, truncated, as libpcap
+ * does.  As with libpcap, all the interfaces of a file must have the
+ * same link type.
+ *
+ */
+
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <stdint.h>
+#include <pcap.h>
+
+/** most packets handed out by one call of pcap_reader_next() */
+#define PCAP_READER_BURST 256
+
+/** bytes of each buffer of decompressed data */
+#define PCAP_READER_BUF_SIZE (1024 * 1024)
+
+/** buffers of decompressed data queued ahead of the one being read */
+#define PCAP_READER_NUM_BUFS 8
+
+/** largest packet accepted; a file claiming a bigger one is corrupt */
+#define PCAP_READER_MAX_SNAPLEN 262144
+
+/** largest pcapng block accepted */
+#define PCAP_READER_MAX_BLOCK (16 * 1024 * 1024)
+
+/** a reader, implemented in pcap_reader.c */
+typedef struct pcap_reader_ *pcap_reader_t;
+
+/**
+ * A burst of packets: headers[i] and packets[i] describe the i-th
+ * packet, and point into the reader, or into hdr.  They stay valid
+ * until the next call of pcap_reader_next() or pcap_reader_close().
+ */
+typedef struct pcap_reader_burst_ {
+    const struct pcap_pkthdr *headers[PCAP_READER_BURST];
+    const unsigned char *packets[PCAP_READER_BURST];
+    struct pcap_pkthdr hdr[PCAP_READER_BURST];
+} pcap_reader_burst_t;
+
+/** open a capture file; errbuf, of PCAP_ERRBUF_SIZE bytes, says why on failure */
+pcap_reader_t pcap_reader_open(const char *fname, char *errbuf);
+
+/** the link type of the packets of a file, as a DLT_ value */
+int pcap_reader_datalink(pcap_reader_t r);
+
+/** read up to max packets; returns the number read, 0 at the end of the file or on error */
+unsigned int pcap_reader_next(pcap_reader_t r, pcap_reader_burst_t *b, unsigned int max);
+
+/** whether reading stopped on an error rather than at the end of the file */
+int pcap_reader_error(pcap_reader_t r);
+
+/** close a reader */
+void pcap_reader_close(pcap_reader_t r);
+
+/** unit test for the capture file reader */
+int pcap_reader_unit_test(void);
+
+#endif /* PCAP_READER_H */
@@ -49,14 +49,32 @@
 
 #define MAX_TEMPLATES 100
 
+/**
+ * A packet as a capture ring delivers it: the time it arrived, in
+ * nanoseconds since the epoch, and its captured and on-the-wire
+ * lengths.  process_frame() takes it without the caller having to
+ * fake up a struct pcap_pkthdr.
+ */
+struct pkt_desc {
+    uint64_t ts;          /* arrival time, nanoseconds since the epoch */
+    uint32_t caplen;      /* length of portion present */
+    uint32_t len;         /* length of this packet (off wire) */
+};
+
 /** main packet processing entry point */
 void* process_packet(unsigned char *ctx_ptr, const struct pcap_pkthdr *header, const unsigned char *packet);
 void libpcap_process_packet(unsigned char *ctx_ptr, const struct pcap_pkthdr *header, const unsigned char *packet);
+void process_packet_burst(unsigned char *ctx_ptr, const struct pcap_pkthdr **headers, const unsigned char **packets, unsigned int num_packets);
+void* process_frame(unsigned char *ctx_ptr, const struct pkt_desc *desc, const unsigned char *packet);
+void process_frame_burst(unsigned char *ctx_ptr, const struct pkt_desc **descs, const unsigned char **packets, unsigned int num_packets);
 
 uint8_t get_packet_5tuple_key(const unsigned char *packet, flow_key_t *key);
 
 joy_status_e process_ipfix(joy_ctx_data *ctx, const char *start, int len, flow_record_t *r);
 
+/** unit test for packet parsing */
+int pkt_proc_unit_test(void);
+
 /* The tls_type_code structure describes the content of a TLS record */
 /*
 struct tls_type_code {
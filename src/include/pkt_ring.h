@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file pkt_ring.h
+ *
+ * \brief Bounded single-producer, single-consumer ring of packets,
+ *        used to hand captured packets to the thread of a context
+ *
+ */
+
+#ifndef PKT_RING_H
+#define PKT_RING_H
+
+#include <stdint.h>
+#include <pcap.h>
+
+/** default bytes of packet data held by the ring of one context */
+#define PKT_RING_DEFAULT_SIZE (8 * 1024 * 1024)
+
+/** packets a consumer handles before publishing its progress */
+#define PKT_RING_BURST 64
+
+/**
+ * A pkt_ring holds copies of packets, each stored as a pcap header
+ * followed by the captured bytes.  Exactly one thread enqueues and
+ * exactly one thread drains; they share only the head and tail
+ * positions, which each side reads with acquire and writes with
+ * release ordering, so no lock is taken on either side.
+ */
+typedef struct pkt_ring_ {
+    /* written by the producer */
+    uint64_t head;                      /*!< bytes ever enqueued               */
+    uint64_t cached_tail;               /*!< last tail seen by the producer    */
+    uint64_t enqueued;                  /*!< packets enqueued                  */
+    uint64_t dropped;                   /*!< packets dropped, ring full        */
+    char pad0[32];
+
+    /* written by the consumer */
+    uint64_t tail;                      /*!< bytes ever drained                */
+    uint64_t drained;                   /*!< packets drained                   */
+    char pad1[48];
+
+    unsigned char *buf;                 /*!< ring storage                      */
+    uint32_t size;                      /*!< bytes of storage, a power of two  */
+} pkt_ring_t;
+
+/** function that a drained packet is handed to */
+typedef void (*pkt_ring_handler_t)(unsigned char *arg,
+                                   const struct pcap_pkthdr *header,
+                                   const unsigned char *packet);
+
+/** function that a burst of drained packets is handed to */
+typedef void (*pkt_ring_burst_handler_t)(unsigned char *arg,
+                                         const struct pcap_pkthdr **headers,
+                                         const unsigned char **packets,
+                                         unsigned int num_packets);
+
+/** allocate the storage of a packet ring */
+int pkt_ring_init(pkt_ring_t *r, uint32_t size);
+
+/** free the storage of a packet ring */
+void pkt_ring_free(pkt_ring_t *r);
+
+/** copy a packet into the ring; producer side */
+int pkt_ring_enqueue(pkt_ring_t *r, const struct pcap_pkthdr *header, const unsigned char *packet);
+
+/** copy a packet into the ring, waiting for room; producer side */
+int pkt_ring_enqueue_wait(pkt_ring_t *r, const struct pcap_pkthdr *header, const unsigned char *packet);
+
+/** hand up to max queued packets to a handler; consumer side */
+unsigned int pkt_ring_drain(pkt_ring_t *r, unsigned int max, pkt_ring_handler_t handler, unsigned char *arg);
+
+/** hand up to max queued packets to a handler in one call; consumer side */
+unsigned int pkt_ring_drain_burst(pkt_ring_t *r, unsigned int max, pkt_ring_burst_handler_t handler, unsigned char *arg);
+
+/** bytes currently held by the ring */
+uint32_t pkt_ring_used(const pkt_ring_t *r);
+
+/** unit test for the packet ring */
+int pkt_ring_unit_test(void);
+
+#endif /* PKT_RING_H */
@@ -45,6 +45,7 @@
 #define PPI_H
 
 #include <stdio.h> 
+#include <stdint.h>
 #include "output.h"
 #include "feature.h"
 
@@ -59,7 +60,7 @@
 #define TCP_OPT_LEN 24
   
 struct pkt_info {
-    struct timeval time; 
+    int32_t time;                /* microseconds after ppi start */
     unsigned int ack;
     unsigned int seq;
     unsigned short len;  
@@ -71,6 +72,7 @@ struct pkt_info {
 /** ppi structure */
 typedef struct ppi {
     unsigned int np;
+    struct timeval start;        /* time of the first packet */
     struct pkt_info pkt_info[MAX_NUM_PKT];
 } ppi_t;
 
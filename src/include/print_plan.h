@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file print_plan.h
+ *
+ * \brief Plans of which members of a flow record are written to the
+ *        JSON output, compiled from the fields option
+ *
+ */
+
+#ifndef PRINT_PLAN_H
+#define PRINT_PLAN_H
+
+#include <stdint.h>
+#include "feature.h"
+
+/**
+ * The fields option is a comma separated list of the members of a
+ * flow record to write, such as
+ *
+ *   fields=sa,da,pr,sp,dp,bytes_out,bytes_in,time_start,tls.cs
+ *
+ * A name on its own selects the whole member; a name with a dot
+ * selects one part of the object of a feature, and the rest of that
+ * object is left out.  The parts of the tls object that can be chosen
+ * are listed in print_plan_tls_field; its version always leads it.
+ * Members that the plan leaves out are not formatted at all.
+ *
+ * A plan must select at least one of sa, da, pr, sp, dp, bytes_out,
+ * num_pkts_out, time_start, time_end and packets, the members that
+ * every flow record has.  The labels of a plan are written first.
+ * Without a plan, every member is written, as it always has been.
+ */
+
+#define print_plan_feature_field(F) PLAN_FIELD_##F,
+
+/** the members of a flow record, in the order they are written */
+enum print_plan_field {
+    PLAN_FIELD_SA = 0,
+    PLAN_FIELD_DA,
+    PLAN_FIELD_PR,
+    PLAN_FIELD_SP,
+    PLAN_FIELD_DP,
+    PLAN_FIELD_LABELS,           /*!< sa_labels and da_labels           */
+    PLAN_FIELD_BYTES_OUT,
+    PLAN_FIELD_NUM_PKTS_OUT,
+    PLAN_FIELD_BYTES_IN,
+    PLAN_FIELD_NUM_PKTS_IN,
+    PLAN_FIELD_TIME_START,
+    PLAN_FIELD_TIME_END,
+    PLAN_FIELD_PACKETS,
+    PLAN_FIELD_BYTE_DIST,        /*!< with byte_dist_mean and byte_dist_std */
+    PLAN_FIELD_COMPACT_BYTE_DIST,
+    PLAN_FIELD_ENTROPY,          /*!< with total_entropy                */
+    PLAN_FIELD_P_MALWARE,
+    PLAN_FIELD_IP,
+    PLAN_FIELD_TCP,
+    MAP(print_plan_feature_field, feature_list)
+    PLAN_FIELD_EXE,
+    PLAN_FIELD_HD,
+    PLAN_FIELD_PROBABLE_OS,
+    PLAN_FIELD_IDP,              /*!< idp_out, idp_in and their lengths */
+    PLAN_FIELD_DEBUG,
+    PLAN_FIELD_EXPIRE_TYPE,
+    PLAN_NUM_FIELDS
+};
+
+/** the parts of the tls object, after its version */
+enum print_plan_tls_field {
+    PLAN_TLS_KEY_EXCHANGE = 0,   /*!< c_key_length and c_key_exchange   */
+    PLAN_TLS_RANDOM,
+    PLAN_TLS_SID,
+    PLAN_TLS_SNI,
+    PLAN_TLS_SCS,
+    PLAN_TLS_CS,
+    PLAN_TLS_EXTENSIONS,         /*!< c_extensions and s_extensions     */
+    PLAN_TLS_FINGERPRINT_LABELS,
+    PLAN_TLS_CERT,               /*!< c_cert and s_cert                 */
+    PLAN_TLS_SRLT,
+    PLAN_TLS_NUM_FIELDS
+};
+
+/** a compiled plan */
+typedef struct print_plan_ {
+    uint64_t fields;                    /*!< bit per enum print_plan_field */
+    uint32_t parts[PLAN_NUM_FIELDS];    /*!< bit per part of each object   */
+} print_plan_t;
+
+/** whether a plan, or the absence of one, writes a member */
+#define print_plan_has(plan, field) \
+    ((plan) == NULL || (((plan)->fields >> (field)) & 1))
+
+/** whether a plan, or the absence of one, writes a part of an object */
+#define print_plan_has_part(plan, field, part) \
+    ((plan) == NULL || (((plan)->parts[field] >> (part)) & 1))
+
+/** compile the value of the fields option into a plan */
+print_plan_t *print_plan_compile(const char *spec);
+
+/** free a plan */
+void print_plan_free(print_plan_t *plan);
+
+/** unit test for print plans */
+int print_plan_unit_test(void);
+
+#endif /* PRINT_PLAN_H */
@@ -0,0 +1,102 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file rss.h
+ *
+ * \brief Receive side scaling style distribution of flows over
+ *        contexts: a symmetric Toeplitz hash and an indirection table
+ *
+ */
+
+#ifndef RSS_H
+#define RSS_H
+
+#include <stdint.h>
+#include "p2f.h"
+
+/** bytes of Toeplitz key; enough for an IPv6 4-tuple */
+#define RSS_KEY_LEN 40
+
+/** buckets of the indirection table, a power of two */
+#define RSS_RETA_SIZE 512
+
+/** most queues the indirection table can point at */
+#define RSS_MAX_QUEUES 256
+
+/** packets and bytes handed to a bucket or queue */
+typedef struct rss_load_ {
+    uint64_t packets;
+    uint64_t bytes;
+} rss_load_t;
+
+/**
+ * Maps the hash of a flow to a queue, as a NIC does: the low bits of
+ * the hash pick a bucket and the bucket names the queue.  The table
+ * belongs to the thread that distributes packets; lookups count the
+ * load of each bucket, and rss_table_rebalance() uses those counts to
+ * move buckets off busy queues.
+ */
+typedef struct rss_table_ {
+    uint8_t num_queues;                        /*!< queues in use              */
+    uint8_t reta[RSS_RETA_SIZE];               /*!< bucket to queue            */
+    rss_load_t bucket_load[RSS_RETA_SIZE];     /*!< since the last rebalance   */
+    rss_load_t queue_load[RSS_MAX_QUEUES];     /*!< since the table was set up */
+} rss_table_t;
+
+/** Toeplitz hash of data with an arbitrary key of at least len + 4 bytes */
+uint32_t rss_toeplitz_hash(const uint8_t *key, unsigned int key_len,
+                           const uint8_t *data, unsigned int len);
+
+/** symmetric Toeplitz hash of the addresses and ports of a flow key */
+uint32_t rss_hash_flow_key(const flow_key_t *key);
+
+/** spread the buckets of a table evenly over num_queues queues */
+void rss_table_init(rss_table_t *t, uint8_t num_queues);
+
+/** queue of a hash, without counting the packet */
+uint8_t rss_table_queue(const rss_table_t *t, uint32_t hash);
+
+/** queue of a hash, counting the packet against its bucket */
+uint8_t rss_table_lookup(rss_table_t *t, uint32_t hash, uint32_t bytes);
+
+/** move idle buckets from busy queues to quiet ones */
+unsigned int rss_table_rebalance(rss_table_t *t);
+
+/** unit test for the rss hash and table */
+int rss_unit_test(void);
+
+#endif /* RSS_H */
@@ -67,7 +67,9 @@ typedef struct salt {
     unsigned int idx;                     /* used for tracking array entries */
     unsigned int tcp_ack;                 /* acknowledgement number */
     unsigned short pkt_len[MAX_NUM_PKT];  /*!< array of packet appdata lengths */  
-    struct timeval pkt_time[MAX_NUM_PKT]; /*!< array of arrival times          */
+    struct timeval start;                 /*!< arrival time of the first message */
+    int32_t pkt_time[MAX_NUM_PKT];        /*!< array of arrival times, in microseconds
+                                               after start (see joy_timer_series_get) */
     unsigned int ack[MAX_NUM_PKT];
     unsigned int seq[MAX_NUM_PKT];
 } salt_t;
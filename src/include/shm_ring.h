@@ -0,0 +1,183 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file shm_ring.h
+ *
+ * \brief Ring of flow records in shared memory, written by joy and
+ *        read in place by other processes on the same host
+ *
+ * A ring file starts with a header of SHM_RING_HEADER_SIZE bytes,
+ * laid out as shm_ring_header_t, followed by a data area of a power
+ * of two bytes.  All fields are in the byte order of the host.
+ *
+ * Records are stored in the data area one after another, each as an
+ * shm_ring_record_t followed by len bytes of data and padded to
+ * SHM_RING_ALIGN bytes; a record never wraps around the end of the
+ * data area, which is filled with a record flagged SHM_RING_PAD
+ * instead.  Positions are counted in bytes since the ring was
+ * created and never wrap; a position p is at offset p mod size of
+ * the data area.  The records from tail up to head are complete;
+ * the writer moves head with release ordering once a record is in
+ * place, and moves tail past the records it is about to overwrite
+ * before it overwrites them.  Each record carries a sequence number,
+ * one more than that of the record before it, so a reader can count
+ * the records it missed.
+ *
+ * A reader takes one of the slots in the header, where it publishes
+ * the position up to which it has finished with the records.  With
+ * the SHM_RING_BLOCK policy the writer waits for the slowest reader
+ * rather than overwrite records it has not finished with; with the
+ * SHM_RING_OVERWRITE policy the writer never waits, and a reader
+ * that falls behind by more than the size of the ring loses records.
+ *
+ * joy writes each flow record into the ring as it would write a line
+ * of its JSON output, newline included; see the ring_file option.
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stdint.h>
+
+/** "JOYR" in the first bytes of a ring file */
+#define SHM_RING_MAGIC 0x52594f4a
+
+/** version of the layout of the ring file */
+#define SHM_RING_VERSION 1
+
+/** bytes before the data area */
+#define SHM_RING_HEADER_SIZE 4096
+
+/** readers that can hold a slot at once */
+#define SHM_RING_MAX_READERS 32
+
+/** default bytes of the data area */
+#define SHM_RING_DEFAULT_SIZE (16 * 1024 * 1024)
+
+/** smallest data area accepted by shm_ring_create() */
+#define SHM_RING_MIN_SIZE (64 * 1024)
+
+/** records start on boundaries of this many bytes */
+#define SHM_RING_ALIGN 16
+
+/** flag of a record that only fills the data area up to its end */
+#define SHM_RING_PAD 0x1
+
+/** what the writer does when the ring is full */
+enum shm_ring_policy {
+    SHM_RING_OVERWRITE = 0,      /*!< overwrite the oldest records      */
+    SHM_RING_BLOCK = 1           /*!< wait for the slowest reader       */
+};
+
+#define SHM_RING_NUM_POLICIES 2
+
+/** a reader slot, a cache line of its own */
+typedef struct shm_ring_slot_ {
+    uint64_t pos;                /*!< the reader is done with the records before pos */
+    uint32_t pid;                /*!< process holding the slot, or 0 if free */
+    uint32_t reserved;
+    char pad[48];
+} shm_ring_slot_t;
+
+/** the header at the start of a ring file */
+typedef struct shm_ring_header_ {
+    uint32_t magic;              /*!< SHM_RING_MAGIC, once the ring is ready */
+    uint16_t version;            /*!< SHM_RING_VERSION                  */
+    uint16_t policy;             /*!< enum shm_ring_policy              */
+    uint64_t size;               /*!< bytes of the data area            */
+    uint32_t max_readers;        /*!< slots in readers[]                */
+    uint32_t closed;             /*!< set once the writer is done       */
+    uint32_t writer_pid;
+    char pad0[36];
+
+    /* at offset 64, written by the writer */
+    uint64_t head;               /*!< end of the last complete record   */
+    char pad1[56];
+    uint64_t tail;               /*!< start of the oldest record        */
+    char pad2[56];
+    uint64_t records;            /*!< records written, the next sequence number */
+    uint64_t waits;              /*!< times the writer waited for a reader */
+    char pad3[48];
+
+    /* at offset 256 */
+    shm_ring_slot_t readers[SHM_RING_MAX_READERS];
+} shm_ring_header_t;
+
+/** the header of a record in the data area; the data follows it */
+typedef struct shm_ring_record_ {
+    uint32_t len;                /*!< bytes of data                     */
+    uint32_t flags;              /*!< SHM_RING_PAD, or 0                */
+    uint64_t seq;                /*!< sequence number                   */
+} shm_ring_record_t;
+
+/** the writer of a ring */
+typedef struct shm_ring_ shm_ring_t;
+
+/** a reader of a ring */
+typedef struct shm_ring_reader_ shm_ring_reader_t;
+
+/** create a ring file and map it; writer side */
+shm_ring_t *shm_ring_create(const char *path, uint64_t size, unsigned int policy);
+
+/** write a record into the ring; writer side */
+int shm_ring_write(shm_ring_t *r, const void *data, uint32_t len);
+
+/** mark the ring as done and unmap it; writer side */
+void shm_ring_close(shm_ring_t *r);
+
+/** map a ring file and take a reader slot; reader side */
+shm_ring_reader_t *shm_ring_attach(const char *path, int from_oldest);
+
+/** the next record, in place in the ring; reader side */
+int shm_ring_next(shm_ring_reader_t *rd, const void **data, uint32_t *len, uint64_t *seq);
+
+/** hand back the record from shm_ring_next(); reader side */
+int shm_ring_release(shm_ring_reader_t *rd);
+
+/** wait for a record for up to usec microseconds; reader side */
+int shm_ring_wait(shm_ring_reader_t *rd, unsigned int usec);
+
+/** records the reader has missed so far; reader side */
+uint64_t shm_ring_lost(const shm_ring_reader_t *rd);
+
+/** give up the reader slot and unmap the ring; reader side */
+void shm_ring_detach(shm_ring_reader_t *rd);
+
+/** unit test for the shared memory ring */
+int shm_ring_unit_test(void);
+
+#endif /* SHM_RING_H */
@@ -79,6 +79,7 @@
 #define MAX_SAN 12
 #define MAX_CERT_EXTENSIONS 12
 #define MAX_CKE_LEN 1024
+#define TLS_HDR_LEN 5
 /* The maimum size of string that we allow from OpenSSL */
 #define MAX_OPENSSL_STRING 32
 
@@ -191,7 +192,8 @@ typedef struct tls_ {
     joy_role_e role; /**< client, server, or unknown */
     uint16_t op;
     uint16_t lengths[MAX_NUM_RCD_LEN]; /**< TLS record lengths */
-    struct timeval times[MAX_NUM_RCD_LEN]; /**< Arrival times */
+    struct timeval start; /**< Arrival time of the first record */
+    int32_t times[MAX_NUM_RCD_LEN]; /**< Arrival times, in microseconds after start */
     tls_message_stat_t msg_stats[MAX_NUM_RCD_LEN]; /**< Message generic stats */
     uint16_t num_ciphersuites; /**< Number of ciphersuites */
     uint16_t ciphersuites[MAX_CS]; /**< Ciphersuites */
@@ -213,6 +215,8 @@ typedef struct tls_ {
     uint16_t handshake_length; /**< Length of data in handshake buffer */
     unsigned char done_handshake; /**< Flag indicating the hanshake phase has completed */
     uint16_t seg_offset;
+    unsigned char hdr_frag[TLS_HDR_LEN]; /**< Start of a record header split across segments */
+    unsigned char hdr_frag_len; /**< Bytes in hdr_frag */
     fingerprint_t *tls_fingerprint;
 } tls_t;
 
@@ -320,6 +324,9 @@ void tls_update(tls_t *r,
                 unsigned int data_len,
                 unsigned int report_tls);
 
+/** parse any handshake data still buffered at flow expiry */
+void tls_complete_handshake(tls_t *r);
+
 /** print out the TLS information to the destination file */
 void tls_print_json(const tls_t *data, const tls_t *data_twin, zfile f);
 
@@ -43,6 +43,7 @@
 #define P2FUTILS
 
 #include <stdio.h>
+#include <stdint.h>
 #include <ctype.h>      /* for isprint()           */
 #include <pcap.h>
 #include "parson.h"
@@ -83,8 +84,27 @@ void joy_timer_clear(struct timeval *a);
 
 unsigned int joy_timeval_to_milliseconds(struct timeval ts);
 
+int32_t joy_timer_delta(const struct timeval *start,
+                        const struct timeval *t);
+
+void joy_timer_add_delta(const struct timeval *start,
+                         int32_t delta,
+                         struct timeval *result);
+
+void joy_timer_series_set(struct timeval *start,
+                          int32_t *deltas,
+                          unsigned int i,
+                          const struct timeval *t);
+
+void joy_timer_series_get(const struct timeval *start,
+                          const int32_t *deltas,
+                          unsigned int i,
+                          struct timeval *result);
+
 FILE* joy_utils_open_test_file(const char *filename);
 
+int joy_utils_find_test_pcap(const char *filename, char *filepath, size_t len);
+
 pcap_t* joy_utils_open_test_pcap(const char *filename);
 
 JSON_Value* joy_utils_open_resource_parson(const char *filename);
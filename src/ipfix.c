@@ -1308,9 +1308,13 @@ static void ipfix_process_byte_distribution(flow_record_t *ix_record,
         loginfo("api-error: expecting element_length == 2");
         return;
     }
+
+    if (flow_record_attach_bd(ix_record) == NULL) {
+        return;
+    }
     
     while (data_length > 0) {
-        ix_record->byte_count[i] = (uint16_t)ntohs(*(const uint16_t *)data);
+        ix_record->bd->byte_count[i] = (uint16_t)ntohs(*(const uint16_t *)data);
         
         data += element_length;
         data_length -= element_length;
@@ -1339,6 +1343,10 @@ static void ipfix_process_spl(flow_record_t *ix_record,
         loginfo("api-error: expecting element_length == 2");
         return;
     }
+
+    if (flow_record_attach_splt(ix_record) == NULL) {
+        return;
+    }
     
     /*
      * Set the global splt packet index variable,
@@ -1356,7 +1364,7 @@ static void ipfix_process_spl(flow_record_t *ix_record,
                 ix_record->op += 1;
             }
             if (pkt_len_index < MAX_NUM_PKT_LEN) {
-                ix_record->pkt_len[pkt_len_index] = packet_length;
+                ix_record->splt->pkt_len[pkt_len_index] = packet_length;
                 ix_record->ob += packet_length;
                 pkt_len_index++;
             } else {
@@ -1372,7 +1380,7 @@ static void ipfix_process_spl(flow_record_t *ix_record,
             ix_record->op += repeated_length;
             for (i = 0; i < repeated_length; i++) {
                 if (pkt_len_index < MAX_NUM_PKT_LEN) {
-                    ix_record->pkt_len[pkt_len_index] = old_value;
+                    ix_record->splt->pkt_len[pkt_len_index] = old_value;
                     ix_record->ob += old_value;
                     pkt_len_index++;
                 } else {
@@ -1407,13 +1415,17 @@ static void ipfix_process_spt(flow_record_t *ix_record,
     int i = 0;
     
     memset_s(&previous_time, sizeof(struct timeval), 0, sizeof(struct timeval));
+
+    if (flow_record_attach_splt(ix_record) == NULL) {
+        return;
+    }
     
     pkt_time_index = splt_pkt_index;
     
     /* Initialize the most recent previous time */
     if (pkt_time_index > 0) {
-        previous_time.tv_sec = ix_record->pkt_time[pkt_time_index-1].tv_sec;
-        previous_time.tv_usec = ix_record->pkt_time[pkt_time_index-1].tv_usec;
+        joy_timer_series_get(&ix_record->splt->start, ix_record->splt->pkt_time,
+                             pkt_time_index-1, &previous_time);
     } else {
         previous_time.tv_sec = ix_record->start.tv_sec;
         previous_time.tv_usec = ix_record->start.tv_usec;
@@ -1429,7 +1441,8 @@ static void ipfix_process_spt(flow_record_t *ix_record,
             int16_t repeated_length = packet_length * -1;
             while (repeated_length > 0) {
                 if (pkt_time_index < MAX_NUM_PKT_LEN) {
-                    ix_record->pkt_time[pkt_time_index] = previous_time;
+                    joy_timer_series_set(&ix_record->splt->start, ix_record->splt->pkt_time,
+                                         pkt_time_index, &previous_time);
                     pkt_time_index++;
                 } else {
                     break;
@@ -1458,7 +1471,8 @@ static void ipfix_process_spt(flow_record_t *ix_record,
                 previous_time.tv_usec %= 1000000;
             }
             
-            ix_record->pkt_time[pkt_time_index] = previous_time;
+            joy_timer_series_set(&ix_record->splt->start, ix_record->splt->pkt_time,
+                                         pkt_time_index, &previous_time);
             pkt_time_index++;
         } else {
             break;
@@ -1524,13 +1538,16 @@ static void ipfix_process_tls_record_times(flow_record_t *ix_record,
 
     while (data_length > 0) {
         uint16_t value_time = ntohs(*((const uint16_t *)data));
-        ix_record->tls->times[i].tv_sec =
+        struct timeval record_time;
+
+        record_time.tv_sec =
             ((total_ms + value_time) + (ix_record->start.tv_sec * 1000)
              + (ix_record->start.tv_usec / 1000)) / 1000;
         
-        ix_record->tls->times[i].tv_usec =
+        record_time.tv_usec =
             (((total_ms + value_time) + (ix_record->start.tv_sec * 1000)
               + (ix_record->start.tv_usec/1000)) % 1000) * 1000;
+        joy_timer_series_set(&ix_record->tls->start, ix_record->tls->times, i, &record_time);
         
         total_ms += value_time;
         
@@ -0,0 +1,111 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-bin2json.c
+ *
+ * \brief converts flow records written with format=binary back to
+ *        the JSON that joy would have written
+ *
+ ** \verbatim
+  joy-bin2json <infile> [ <outfile> ]
+     <infile> is a file written by joy with format=binary
+     <outfile> is where the JSON is written, compressed as joy
+     compresses its output; otherwise stdout is used
+ \endverbatim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "binrec.h"
+#include "config.h"
+#include "err.h"
+
+/* external definitions from joy_api.c */
+extern FILE *info;
+
+static configuration_t active_config;
+
+static int usage (const char *s) {
+    fprintf(stderr, "usage: %s <infile> [ <outfile> ]\n", s);
+    fprintf(stderr, "converts a file written by joy with format=binary to JSON\n");
+    return EXIT_FAILURE;
+}
+
+int main (int argc, char *argv[]) {
+    binrec_reader_t *r;
+    zfile out;
+    unsigned long records = 0;
+    int rc;
+
+    if (argc < 2 || argc > 3) {
+        return usage(argv[0]);
+    }
+    info = stderr;
+    glb_config = &active_config;
+    config_set_defaults(glb_config);
+
+    r = binrec_open(argv[1]);
+    if (r == NULL) {
+        fprintf(stderr, "error: could not open %s, or it is not in the binary format\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 3) {
+        out = zopen(argv[2], "w");
+    } else {
+        out = zattach(stdout, "w");
+    }
+    if (out == NULL) {
+        fprintf(stderr, "error: could not open %s for output\n", (argc == 3) ? argv[2] : "stdout");
+        binrec_close(r);
+        return EXIT_FAILURE;
+    }
+
+    while ((rc = binrec_next(r)) == 1) {
+        if (binrec_print_json(r, out) != ok) {
+            rc = -1;
+            break;
+        }
+        records++;
+    }
+    if (rc < 0) {
+        fprintf(stderr, "error: %s is truncated or corrupt after %lu records\n", argv[1], records);
+    }
+    binrec_close(r);
+    if (zclose(out) != 0) {
+        rc = -1;
+    }
+    return (rc < 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
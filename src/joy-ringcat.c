@@ -0,0 +1,122 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-ringcat.c
+ *
+ * \brief copies the flow records that joy writes into a shared
+ *        memory ring (ring_file=F) to stdout, one JSON line each
+ *
+ ** \verbatim
+  joy-ringcat [ -o ] <ringfile>
+     <ringfile> is the file given to joy with ring_file
+     -o starts with the oldest record still in the ring, rather
+     than with the next record written
+ \endverbatim
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shm_ring.h"
+#include "err.h"
+
+static int usage (const char *s) {
+    fprintf(stderr, "usage: %s [ -o ] <ringfile>\n", s);
+    fprintf(stderr, "copies the flow records in a ring written by joy with ring_file to stdout\n");
+    fprintf(stderr, "  -o    start with the oldest record in the ring\n");
+    return EXIT_FAILURE;
+}
+
+int main (int argc, char *argv[]) {
+    shm_ring_reader_t *rd;
+    const void *data;
+    uint32_t len;
+    char *buf = NULL;
+    uint32_t buf_size = 0;
+    unsigned long records = 0;
+    int from_oldest = 0;
+    int rc;
+
+    if (argc == 3 && strcmp(argv[1], "-o") == 0) {
+        from_oldest = 1;
+    } else if (argc != 2 || argv[1][0] == '-') {
+        return usage(argv[0]);
+    }
+
+    rd = shm_ring_attach(argv[argc - 1], from_oldest);
+    if (rd == NULL) {
+        fprintf(stderr, "error: could not attach to %s, or it is not a ring\n", argv[argc - 1]);
+        return EXIT_FAILURE;
+    }
+
+    for (;;) {
+        rc = shm_ring_next(rd, &data, &len, NULL);
+        if (rc == 0) {
+            fflush(stdout);
+            rc = shm_ring_wait(rd, 1000000);
+            if (rc < 0) {
+                break;
+            }
+            continue;
+        }
+        if (rc < 0) {
+            break;
+        }
+
+        /* copy the record out, so the writer can reuse its space */
+        if (len > buf_size) {
+            char *tmp = realloc(buf, len);
+            if (tmp == NULL) {
+                fprintf(stderr, "error: out of memory\n");
+                break;
+            }
+            buf = tmp;
+            buf_size = len;
+        }
+        memcpy(buf, data, len);
+        if (shm_ring_release(rd) == ok) {
+            fwrite(buf, 1, len, stdout);
+            records++;
+        }
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "%lu records, %llu lost\n", records,
+            (unsigned long long)shm_ring_lost(rd));
+    shm_ring_detach(rd);
+    free(buf);
+    return EXIT_SUCCESS;
+}
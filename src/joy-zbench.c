@@ -0,0 +1,274 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file joy-zbench.c
+ *
+ * \brief measures the compression backends of the output streams on
+ *        a flow record file
+ *
+ ** \verbatim
+  joy-zbench [ -l <level> ] [ -t <threads> ] [ -n <runs> ] <infile>
+     <infile> is a file written by joy, in any compression the build
+     reads; it is decompressed into memory, then written out through
+     each backend the build includes, at <level> (by default at a
+     fast, a middle and a high level), with <threads> threads for
+     zstd, <runs> times (3 by default), keeping the fastest run
+ \endverbatim
+ *
+ * For each backend and level, the throughput of compression and of
+ * decompression is reported in MB/s of uncompressed data, with the
+ * ratio of the uncompressed size to the compressed size.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "output.h"
+#include "config.h"
+#include "err.h"
+
+/* external definitions from joy_api.c */
+extern FILE *info;
+
+/* where each backend writes the stream */
+#define ZBENCH_FILE "joy-zbench.tmp"
+
+/* most bytes passed to zwrite() at a time; each line is committed on its own */
+#define ZBENCH_MAX_LINE 65536
+
+static configuration_t active_config;
+
+/* a fast, a middle and a high level of each backend */
+static const int zbench_levels[ZFILE_COMPRESSION_MAX][3] = {
+    { 0, 0, 0 },        /* default */
+    { 0, 0, 0 },        /* none    */
+    { 1, 6, 9 },        /* gzip    */
+    { 1, 6, 9 },        /* bzip2   */
+    { 1, 3, 19 },       /* zstd    */
+    { 0, 3, 9 }         /* lz4     */
+};
+
+static int usage (const char *s) {
+    fprintf(stderr, "usage: %s [ -l <level> ] [ -t <threads> ] [ -n <runs> ] <infile>\n", s);
+    fprintf(stderr, "reports the speed and ratio of each compression backend on a file written by joy\n");
+    return EXIT_FAILURE;
+}
+
+static double zbench_now (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* read a whole file, decompressed, into memory */
+static char *zbench_load (const char *fname, size_t *len) {
+    size_t size = 1024 * 1024;
+    char *data = malloc(size);
+    zreader in = zread_open(fname);
+    int n;
+
+    *len = 0;
+    if (data == NULL || in == NULL) {
+        free(data);
+        zread_close(in);
+        return NULL;
+    }
+    while ((n = zread(in, data + *len, (unsigned int)(size - *len))) > 0) {
+        *len += n;
+        if (*len == size) {
+            char *tmp = realloc(data, size * 2);
+
+            if (tmp == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = tmp;
+            size *= 2;
+        }
+    }
+    zread_close(in);
+    if (n < 0) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+/*
+ * write data through a backend, one line per record as joy does;
+ * returns the seconds taken, or a negative value on failure
+ */
+static double zbench_write (unsigned int compression, int level, unsigned int threads,
+                            const char *data, size_t len) {
+    const char *p = data;
+    const char *end = data + len;
+    double start = zbench_now();
+    zfile f = zopen_compressed(ZBENCH_FILE, "w", compression, level, threads);
+
+    if (f == NULL) {
+        return -1.0;
+    }
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        size_t n = (nl == NULL) ? (size_t)(end - p) : (size_t)(nl - p) + 1;
+
+        if (n > ZBENCH_MAX_LINE) {
+            n = ZBENCH_MAX_LINE;
+        }
+        if (zwrite(f, p, (unsigned int)n) < 0) {
+            zclose(f);
+            return -1.0;
+        }
+        zcommit(f);
+        p += n;
+    }
+    if (zclose(f) != 0) {
+        return -1.0;
+    }
+    return zbench_now() - start;
+}
+
+/* read the file back; returns the seconds taken, or a negative value on failure */
+static double zbench_read (const char *data, size_t len) {
+    static char buf[ZBENCH_MAX_LINE];
+    double start = zbench_now();
+    zreader in = zread_open(ZBENCH_FILE);
+    size_t off = 0;
+    int n;
+
+    if (in == NULL) {
+        return -1.0;
+    }
+    while ((n = zread(in, buf, sizeof(buf))) > 0) {
+        if (off + n > len || memcmp(buf, data + off, n) != 0) {
+            n = -1;
+            break;
+        }
+        off += n;
+    }
+    zread_close(in);
+    if (n < 0 || off != len) {
+        return -1.0;
+    }
+    return zbench_now() - start;
+}
+
+int main (int argc, char *argv[]) {
+    int level = -1;
+    unsigned int threads = 0;
+    unsigned int runs = 3;
+    unsigned int c, k, i;
+    char *data;
+    size_t len;
+    int opt;
+    int rc = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "l:t:n:")) != -1) {
+        switch (opt) {
+        case 'l':
+            level = atoi(optarg);
+            break;
+        case 't':
+            threads = (unsigned int)atoi(optarg);
+            break;
+        case 'n':
+            runs = (unsigned int)atoi(optarg);
+            break;
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || runs == 0) {
+        return usage(argv[0]);
+    }
+    info = stderr;
+    glb_config = &active_config;
+    config_set_defaults(glb_config);
+
+    data = zbench_load(argv[optind], &len);
+    if (data == NULL || len == 0) {
+        fprintf(stderr, "error: could not read %s\n", argv[optind]);
+        free(data);
+        return EXIT_FAILURE;
+    }
+    printf("%s: %lu bytes\n", argv[optind], (unsigned long)len);
+    printf("%-8s %6s %12s %12s %12s %8s\n", "backend", "level", "bytes", "comp MB/s", "decomp MB/s", "ratio");
+
+    for (c = ZFILE_COMPRESSION_NONE; c < ZFILE_COMPRESSION_MAX; c++) {
+        if (!zcompression_available(c)) {
+            continue;
+        }
+        for (k = 0; k < 3; k++) {
+            int lvl = (level >= 0) ? level : zbench_levels[c][k];
+            double best_write = 0.0, best_read = 0.0;
+            struct stat st;
+
+            if (k > 0 && (level >= 0 || lvl == zbench_levels[c][k - 1])) {
+                continue;
+            }
+            for (i = 0; i < runs; i++) {
+                double w = zbench_write(c, lvl, threads, data, len);
+                double r = (w < 0.0) ? -1.0 : zbench_read(data, len);
+
+                if (w < 0.0 || r < 0.0) {
+                    fprintf(stderr, "error: %s level %d failed\n", zcompression_name(c), lvl);
+                    rc = EXIT_FAILURE;
+                    break;
+                }
+                if (i == 0 || w < best_write) {
+                    best_write = w;
+                }
+                if (i == 0 || r < best_read) {
+                    best_read = r;
+                }
+            }
+            if (i < runs || stat(ZBENCH_FILE, &st) != 0 || st.st_size == 0) {
+                continue;
+            }
+            printf("%-8s %6d %12lu %12.1f %12.1f %8.2f\n", zcompression_name(c), lvl,
+                   (unsigned long)st.st_size, len / best_write / 1e6, len / best_read / 1e6,
+                   (double)len / (double)st.st_size);
+        }
+    }
+    remove(ZBENCH_FILE);
+    free(data);
+    return rc;
+}
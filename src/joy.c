@@ -92,9 +92,14 @@
 #include "proto_identify.h"
 #include "pcap.h"
 #include "joy_api_private.h"
+#include "pkt_ring.h" /* packet hand-off to worker threads */
+#include "pcap_reader.h" /* capture files */
+#include "affinity.h" /* thread and memory placement    */
+#include "utils.h"    /* timer comparisons              */
 
 #ifdef USE_AF_PACKET
 #include "af_packet_v3.h"
+#include "af_xdp.h"
 
 extern int sig_close_flag; /* Watched by the stats tracking thread */
 extern int sig_close_workers; /* Packet proccessing var */
@@ -121,6 +126,13 @@ typedef enum joy_operating_mode_ {
 #else
 #define NUM_PACKETS_BETWEEN_STATS_OUTPUT 100000
 #endif
+
+/*
+ * seconds between rebalancing the contexts in live capture; must be
+ * longer than the flow inactivity timeout, so that no live flow
+ * changes context
+ */
+#define CONTEXT_REBALANCE_INTERVAL 60
 #define MAX_RECORDS 2147483647
 #define MAX_FILENAME_LEN 1024
 
@@ -138,14 +150,24 @@ static const char *filter_exp = "ip or ip6 or vlan";
 static char full_path_output[MAX_FILENAME_LEN];
 
 /* local definitions for the threading aspects */
-#ifndef USE_AF_PACKET
+#ifdef USE_AF_PACKET
+#define MAX_JOY_THREADS 24
+#else
 #define MAX_JOY_THREADS 8
-static pthread_t pkt_proc_thrd[MAX_JOY_THREADS];
-static pthread_mutex_t thrd_lock[MAX_JOY_THREADS] =
-  {PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
-   PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER,
-   PTHREAD_MUTEX_INITIALIZER};
 #endif
+static pthread_t pkt_proc_thrd[MAX_JOY_THREADS];
+
+/*
+ * the capture (or pcap file reading) loop copies each packet into the
+ * ring of the context that owns its flow, and only that context's
+ * thread drains the ring and touches the flow records, so no lock is
+ * needed between them
+ */
+static pkt_ring_t pkt_ring[MAX_JOY_THREADS];
+static int pkt_proc_num_thrds = 0;
+
+/* set to tell the worker threads to drain their rings and exit */
+static volatile int pkt_proc_stop = 0;
 
 /* config is the global configuration */
 extern configuration_t active_config;
@@ -432,6 +454,28 @@ static void print_libpcap_stats(void) {
     }
     fflush(info);
 }
+
+static void print_pkt_ring_stats(int index) {
+    pkt_ring_t *r = &pkt_ring[index];
+
+    if (r->buf == NULL) {
+        return;
+    }
+    fprintf(info,"Context id: %d, Packet Ring: %u%% full, Enqueued %lu, Dropped %lu\n",
+        index, (unsigned int)(((uint64_t)pkt_ring_used(r) * 100) / r->size),
+        (unsigned long)r->enqueued, (unsigned long)r->dropped);
+    fflush(info);
+}
+
+static void print_context_load(int index) {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+
+    joy_get_context_load(index, &packets, &bytes);
+    fprintf(info,"Context id: %d, Load: %lu packets, %lu bytes\n",
+        index, (unsigned long)packets, (unsigned long)bytes);
+    fflush(info);
+}
 #endif
 
 /*************************************************************************
@@ -441,6 +485,160 @@ static void print_libpcap_stats(void) {
  *************************************************************************
  */
 
+/*
+ * pkt_proc_stop_threads() stops the worker threads and then hands any
+ * packets still in their rings to the contexts from this thread; the
+ * join orders this after everything the workers did
+ */
+static void pkt_proc_stop_threads (pkt_ring_burst_handler_t handler) {
+    joy_ctx_data *ctx = NULL;
+    int i;
+
+    pkt_proc_stop = 1;
+    for (i=0; i < pkt_proc_num_thrds; ++i) {
+        pthread_join(pkt_proc_thrd[i], NULL);
+    }
+    for (i=0; i < pkt_proc_num_thrds; ++i) {
+        ctx = joy_index_to_context(i);
+        while (pkt_ring_drain_burst(&pkt_ring[i], PKT_RING_BURST,
+                                    handler, (unsigned char*)ctx)) {
+            continue;
+        }
+    }
+    pkt_proc_num_thrds = 0;
+    pkt_proc_stop = 0;
+}
+
+/*
+ * placement of the threads on cpus, and of the memory of their
+ * contexts on NUMA nodes, from capture_cpus and worker_cpus; see
+ * affinity.h
+ */
+
+/* which threads read packets, and which turn them into flow records */
+enum placement_roles {
+    PLACEMENT_MAIN_ONLY = 0,    /* the main thread does both, with the one context    */
+    PLACEMENT_MAIN_READS = 1,   /* the main thread reads; each context has a worker   */
+    PLACEMENT_THREADS_READ = 2  /* each context has a thread that does both: af_packet,
+                                   af_xdp, or several input files                     */
+};
+
+/* the cpu that the thread of each context is pinned to, or -1 */
+static int placement_cpu[MAX_JOY_THREADS];
+
+/* the cpu that the main thread is pinned to once it reads packets, or -1 */
+static int placement_main_cpu = -1;
+
+/*
+ * placement_init() picks the cpu of each thread, moves the memory of
+ * each context to the node of its thread, and reports the placement.
+ * The threads that read packets take their cpus from capture_cpus;
+ * a thread that also processes them falls back on worker_cpus.  The
+ * report is always written for a live capture, whose rings are placed
+ * on ring_node, the node of the interface, when that is known.
+ */
+static void placement_init (int num_contexts, enum placement_roles roles,
+                            const char *intface, int ring_node) {
+    cpu_list_t *capture_cpus = NULL;
+    cpu_list_t *worker_cpus = NULL;
+    cpu_list_t *reader_cpus = NULL;
+    int i, node;
+
+    for (i = 0; i < MAX_JOY_THREADS; i++) {
+        placement_cpu[i] = -1;
+    }
+    placement_main_cpu = -1;
+    if (glb_config->capture_cpus == NULL && glb_config->worker_cpus == NULL && intface == NULL) {
+        return;
+    }
+
+    /* the lists were checked when the configuration was read */
+    capture_cpus = calloc(1, sizeof(cpu_list_t));
+    worker_cpus = calloc(1, sizeof(cpu_list_t));
+    if (capture_cpus == NULL || worker_cpus == NULL) {
+        joy_log_err("out of memory");
+        free(capture_cpus);
+        free(worker_cpus);
+        return;
+    }
+    if (glb_config->capture_cpus) {
+        cpu_list_parse(capture_cpus, glb_config->capture_cpus);
+    }
+    if (glb_config->worker_cpus) {
+        cpu_list_parse(worker_cpus, glb_config->worker_cpus);
+    }
+    reader_cpus = capture_cpus->num ? capture_cpus : worker_cpus;
+
+    switch (roles) {
+    case PLACEMENT_MAIN_ONLY:
+        placement_main_cpu = placement_cpu[0] = cpu_list_get(reader_cpus, 0);
+        break;
+    case PLACEMENT_MAIN_READS:
+        placement_main_cpu = cpu_list_get(capture_cpus, 0);
+        for (i = 0; i < num_contexts; i++) {
+            placement_cpu[i] = cpu_list_get(worker_cpus, i);
+        }
+        break;
+    case PLACEMENT_THREADS_READ:
+    default:
+        for (i = 0; i < num_contexts; i++) {
+            placement_cpu[i] = cpu_list_get(reader_cpus, i);
+        }
+        break;
+    }
+
+    fprintf(info, "--- Joy Placement ---\n");
+    if (intface) {
+        if (ring_node >= 0) {
+            fprintf(info, "interface %s is on node %d, and so are its rings\n", intface, ring_node);
+        } else {
+            fprintf(info, "interface %s is on no known node, its rings are not placed\n", intface);
+        }
+    }
+    if (roles == PLACEMENT_MAIN_READS) {
+        if (placement_main_cpu >= 0) {
+            fprintf(info, "reading thread: cpu %d, node %d\n", placement_main_cpu,
+                    affinity_cpu_node(placement_main_cpu));
+        } else {
+            fprintf(info, "reading thread: not pinned\n");
+        }
+    }
+    for (i = 0; i < num_contexts; i++) {
+        node = affinity_cpu_node(placement_cpu[i]);
+        if (node >= 0) {
+            joy_place_context(i, node);
+        }
+        if (placement_cpu[i] < 0) {
+            fprintf(info, "context %d: thread not pinned, memory not placed\n", i);
+        } else if (node < 0) {
+            fprintf(info, "context %d: cpu %d, on no known node, memory not placed\n", i, placement_cpu[i]);
+        } else {
+            fprintf(info, "context %d: cpu %d, memory on node %d\n", i, placement_cpu[i], node);
+        }
+    }
+    fflush(info);
+
+    free(capture_cpus);
+    free(worker_cpus);
+}
+
+/* pins the thread just started for a context to its cpu */
+static void placement_pin_thread (pthread_t thread, int index) {
+    if (placement_cpu[index] >= 0 && affinity_pin(thread, placement_cpu[index]) != ok) {
+        joy_log_warn("could not pin the thread of context %d to cpu %d", index, placement_cpu[index]);
+    }
+}
+
+/*
+ * pins the main thread as it starts to read packets; the threads it
+ * started before keep their own cpus
+ */
+static void placement_pin_main (void) {
+    if (placement_main_cpu >= 0 && affinity_pin(pthread_self(), placement_main_cpu) != ok) {
+        joy_log_warn("could not pin the reading thread to cpu %d", placement_main_cpu);
+    }
+}
+
 /*
  * sig_close() causes a graceful shutdown of the program after recieving
  * an appropriate signal
@@ -457,12 +655,8 @@ __attribute__((__noreturn__)) static void sig_close (int signal_arg) {
       pcap_breakloop(handle);
     }
 
-    /* obtain the locks from the child threads */
-    if (glb_config->num_threads > 1) {
-        for (i=0; i < glb_config->num_threads; ++i) {
-            pthread_mutex_lock(&thrd_lock[i]);
-        }
-    }
+    /* let the child threads finish the packets already queued to them */
+    pkt_proc_stop_threads(process_packet_burst);
 
     /*
      * flush remaining flow records in the child threads, and
@@ -471,6 +665,9 @@ __attribute__((__noreturn__)) static void sig_close (int signal_arg) {
     for (i=0; i < glb_config->num_threads; ++i) {
         joy_print_flow_data(i, JOY_ALL_FLOWS);
         joy_print_flocap_stats_output(i);
+        print_pkt_ring_stats(i);
+        print_context_load(i);
+        pkt_ring_free(&pkt_ring[i]);
         joy_context_cleanup(i);
     }
 
@@ -507,34 +704,17 @@ static void sig_reload (int signal_arg) {
 }
 
 static void joy_close_and_reopen_logfile (void) {
-#ifndef USE_AF_PACKET
-    int i = 0;
 
-    /* obtain the locks from the child threads */
-    if (glb_config->num_threads > 1) {
-        for (i=0; i < glb_config->num_threads; ++i) {
-            pthread_mutex_lock(&thrd_lock[i]);
-        }
-    }
-#endif
-
-    fclose(info);
-    info = NULL;
+    /*
+     * reopen the stream in place; the worker threads may be writing
+     * to it, and the stream lock taken by freopen() orders them with
+     * the switch to the new file
+     */
     reopenLog = 0;
-    info = fopen(glb_config->logfile, "a");
-    if (info == NULL) {
+    if (freopen(glb_config->logfile, "a", info) == NULL) {
         fprintf(stderr, "error: could not open new log file %s\n", glb_config->logfile);
         exit(EXIT_FAILURE);
     }
-
-#ifndef USE_AF_PACKET
-    /* release the locks from the child threads */
-    if (glb_config->num_threads > 1) {
-        for (i=0; i < glb_config->num_threads; ++i) {
-            pthread_mutex_unlock(&thrd_lock[i]);
-        }
-    }
-#endif
 }
 
 /**
@@ -552,8 +732,30 @@ static int usage (char *s) {
            "  interface=I                read packets live from interface I\n"
            "  promisc=1                  put interface into promiscuous mode\n"
            "  output=F                   write output to file F (otherwise stdout is used)\n"
+           "  format=json|binary         write flow records as JSON, or in a compact binary format that\n"
+           "                             joy-bin2json converts back to JSON. Default is json.\n"
+           "  fields=LIST                write only the members of each JSON flow record in the comma\n"
+           "                             separated LIST, such as sa,da,pr,sp,dp,bytes_out,tls.cs; a\n"
+           "                             name with a dot picks parts of the tls object. See print_plan.h.\n"
+           "  columnar=F                 also write expired flow records to file F in chunks of columns,\n"
+           "                             each with min/max statistics; F.ctxN per thread when threads>1\n"
+           "  chunk_rows=N               rows per chunk of the columnar file. Default is 16384.\n"
+           "  compression=C              compress output files with C: none, gzip, bzip2, zstd or lz4,\n"
+           "                             of those included in the build; the file suffix follows C\n"
+           "  compress_level=N           compression level N; 0 (the default) uses that of the backend\n"
+           "  compress_threads=N         compress zstd output with N threads in the background\n"
+           "  ring_file=F                write flow records into a ring in shared memory mapped from file F,\n"
+           "                             such as /dev/shm/joy, instead of an output file; F.ctxN per thread\n"
+           "                             when threads>1. See shm_ring.h for its layout.\n"
+           "  ring_size=N                bytes of records the ring holds. Default is 16777216.\n"
+           "  ring_policy=P              when the ring is full, overwrite the oldest records, or block until\n"
+           "                             the slowest reader is done with them. Default is overwrite.\n"
            "  logfile=F                  write secondary output to file F (otherwise stderr is used)\n"
            "  count=C                    rotate output files so each has about C records\n"
+           "  rotate_bytes=N             rotate output files once N bytes, before compression, are written\n"
+           "  rotate_interval=S          rotate output files every S seconds\n"
+           "  rotate_hook=CMD            run CMD with the name of each output file once it is finished\n"
+           "  rotate_spool=D             move each output file into directory D once it is finished\n"
            "  upload=user@server:path    upload to user@server:path with scp after file rotation\n"
            "  keyfile=F                  use SSH identity (private key) in file F for upload\n"
            "  anon=F                     anonymize addresses matching the subnets listed in file F\n"
@@ -585,7 +787,34 @@ static int usage (char *s) {
            "                             0=off, 1=show\n"
            "  username=\"user\"          Drop privileges to username \"user\" after starting packet capture\n"
            "                             Default=\"joy\"\n"
-           "  threads=N                  Number of threads to use for live capture (1-5). Default is 1.\n"
+           "  threads=N                  Number of threads to use for live capture, or for\n"
+           "                             reading pcap files when output=F is given. Default is 1.\n"
+           "  flow_table_size=N          initial number of flow table slots per thread, rounded up to a power\n"
+           "                             of two; the table grows as needed. Default is 65536.\n"
+           "  flow_pool_size=N           preallocate N flow records per thread; when the pool is exhausted\n"
+           "                             records come from the heap. Default is 0 (no pool).\n"
+           "  hugepages=1                back the flow record pool with hugepages, if available\n"
+           "  max_flows=N                hold at most N flow records per thread, writing out a flow early\n"
+           "                             to make room for a new one. Default is 0 (no limit).\n"
+           "  flow_evict=\"policy\"        flow written out at max_flows: \"lru\" (seen least recently),\n"
+           "                             \"oldest\" (started first) or \"nopayload\" (prefer flows that have\n"
+           "                             carried no payload). Default is \"lru\".\n"
+           "  housekeeping=MS            in live capture, expire flows and flush the output every MS\n"
+           "                             milliseconds, also when no packets arrive. Default is 100.\n"
+           "  expire_max=N               write out at most N expired flows per housekeeping run, leaving\n"
+           "                             the rest for the next one. Default is 256, 0 for no limit.\n"
+           "  capture=B                  in a build with af_packet, capture through af_packet (TPACKET_V3\n"
+           "                             rings, the default) or af_xdp (an AF_XDP socket on each receive\n"
+           "                             queue; the packets no longer reach the host). See af_xdp.h.\n"
+           "  xdp_mode=M                 with capture=af_xdp, share packet buffers with the driver in\n"
+           "                             auto, copy or zerocopy mode. Default is auto.\n"
+           "  capture_cpus=LIST          pin the threads that read packets to the CPUs in LIST, such as\n"
+           "                             0-3,8, in turn: the af_packet or af_xdp threads, which also\n"
+           "                             process what they capture, or else the thread reading the\n"
+           "                             interface or the file. Their rings go on the node of the NIC.\n"
+           "  worker_cpus=LIST           pin the threads that turn packets into flow records to the CPUs\n"
+           "                             in LIST, in turn; the memory of each thread's flows and output\n"
+           "                             is moved to the NUMA node of its CPU. See affinity.h.\n"
            "  updater=0                  Turn on or off dynamic updating of certain JOY parameters.\n"
            "                             0=off, 1=on, Default is off.\n"
            "Data feature options\n"
@@ -1008,7 +1237,12 @@ static int process_directory_of_files(joy_ctx_data *ctx, char *input_directory)
             static int fc_cnt = 1;
 
             /* initialize the data structures */
+            flow_record_list_free(ctx);
             memset_s(ctx, sizeof(joy_ctx_data), 0x00, sizeof(joy_ctx_data));
+            if (flow_record_list_init(ctx) != ok) {
+                closedir(dir);
+                return -1;
+            }
             if (glb_config->filename == NULL) {
                 ctx->output = zattach(stdout, "w");
             }
@@ -1027,6 +1261,8 @@ static int process_directory_of_files(joy_ctx_data *ctx, char *input_directory)
                     sprintf(full_path_output, "%s\\%s_%d_json%s", output_dir, ent->d_name, fc_cnt, zsuffix);
                     ++fc_cnt;
                     ctx->output = zopen(full_path_output, "w");
+                    snprintf(ctx->output_filename, MAX_FILENAME_LEN, "%s", full_path_output);
+                    zasync(ctx->output);
                 }
 #else
                 if (pcap_filename[strlen(pcap_filename)-1] != '/') {
@@ -1039,6 +1275,8 @@ static int process_directory_of_files(joy_ctx_data *ctx, char *input_directory)
                     sprintf(full_path_output, "%s/%s_%d_json%s", output_dir, ent->d_name, fc_cnt, zsuffix);
                     ++fc_cnt;
                     ctx->output = zopen(full_path_output, "w");
+                    snprintf(ctx->output_filename, MAX_FILENAME_LEN, "%s", full_path_output);
+                    zasync(ctx->output);
                 }
 #endif
                 /* initialize the outputfile and processing structures */
@@ -1140,6 +1378,8 @@ static int process_multiple_input_files (joy_ctx_data *ctx, char *input_filename
 
         /* open new output file for multi-file processing */
         ctx->output = zopen(full_path_output, "w");
+        snprintf(ctx->output_filename, MAX_FILENAME_LEN, "%s", full_path_output);
+        zasync(ctx->output);
 
         /* print the json config */
         joy_print_config(ctx->ctx_id, JOY_JSON_FORMAT);
@@ -1206,6 +1446,8 @@ static int process_single_input_file (joy_ctx_data *ctx, char *input_filename) {
         strncat_s(full_outfile, (MAX_DIRNAME_LEN-strlen(full_outfile)),
                   glb_config->filename, strlen(glb_config->filename));
         ctx->output = zopen(full_outfile,"w");
+        snprintf(ctx->output_filename, MAX_FILENAME_LEN, "%s", full_outfile);
+        zasync(ctx->output);
     }
 
     /* print configuration */
@@ -1215,8 +1457,652 @@ static int process_single_input_file (joy_ctx_data *ctx, char *input_filename) {
     return tmp_ret;
 }
 
+/*
+ * Reading capture files
+ *
+ * Capture files are read with the reader of pcap_reader.h, which hands
+ * out their packets in bursts, in place.  Expired flows are looked for
+ * after every NUM_PACKETS_IN_LOOP packets that pass the filter, and at
+ * the end of the file, the points at which they were looked for when
+ * files were read with pcap_dispatch(), so the flow records do not
+ * depend on where the reader ends its bursts.
+ */
+
+/* pcap_compile() is not reentrant in older versions of libpcap */
+static pthread_mutex_t pcap_compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** function called at each point at which expired flows are looked for */
+typedef void (*pcap_file_expire_t)(unsigned char *arg);
+
+/**
+ \fn static int pcap_file_filter_compile (pcap_reader_t reader, const char *filtr_exp, bpf_u_int32 net, struct bpf_program *fp)
+ \brief compile a filter expression for the link type of a capture file
+ \param reader the capture file
+ \param filtr_exp the filter expression
+ \param net the netmask
+ \param fp where the compiled filter goes
+ \return 0 for success, or -2 if the expression could not be parsed
+ */
+static int pcap_file_filter_compile (pcap_reader_t reader, const char *filtr_exp,
+                                     bpf_u_int32 net, struct bpf_program *fp) {
+    pcap_t *dead = NULL;
+    int rc = 0;
+
+    dead = pcap_open_dead(pcap_reader_datalink(reader), PCAP_READER_MAX_SNAPLEN);
+    if (dead == NULL) {
+        fprintf(stderr, "error: could not parse filter %s\n", filtr_exp);
+        return -2;
+    }
+    pthread_mutex_lock(&pcap_compile_lock);
+    if (pcap_compile(dead, fp, filtr_exp, 0, net) == -1) {
+        fprintf(stderr, "error: could not parse filter %s: %s\n",
+                filtr_exp, pcap_geterr(dead));
+        rc = -2;
+    }
+    pthread_mutex_unlock(&pcap_compile_lock);
+    pcap_close(dead);
+    return rc;
+}
+
+/**
+ \fn static void pcap_file_read (pcap_reader_t reader, struct bpf_program *fp, pkt_ring_burst_handler_t handler, pcap_file_expire_t expire, unsigned char *arg)
+ \brief read every packet of a capture file, handing the packets that
+        pass the filter on in bursts, and calling expire after every
+        NUM_PACKETS_IN_LOOP of them and at the end of the file
+ \param reader the capture file
+ \param fp the compiled filter, or NULL for none
+ \param handler the function the packets are handed to
+ \param expire the function called to look for expired flows
+ \param arg passed to handler and expire
+ \return none
+ */
+static void pcap_file_read (pcap_reader_t reader, struct bpf_program *fp,
+                            pkt_ring_burst_handler_t handler, pcap_file_expire_t expire,
+                            unsigned char *arg) {
+    pcap_reader_burst_t burst;
+    unsigned int pending = 0; /* packets handed on since expire was last called */
+    unsigned int num, i, n;
+
+    while ((num = pcap_reader_next(reader, &burst, PCAP_READER_BURST)) > 0) {
+        if (fp != NULL) {
+            /* keep the packets that pass the filter */
+            for (i = 0, n = 0; i < num; i++) {
+                if (pcap_offline_filter(fp, burst.headers[i], burst.packets[i])) {
+                    burst.headers[n] = burst.headers[i];
+                    burst.packets[n] = burst.packets[i];
+                    n++;
+                }
+            }
+            num = n;
+        }
+
+        for (i = 0; i < num; i += n) {
+            n = NUM_PACKETS_IN_LOOP - pending;
+            if (n > num - i) {
+                n = num - i;
+            }
+            handler(arg, burst.headers + i, burst.packets + i, n);
+            pending += n;
+            if (pending == NUM_PACKETS_IN_LOOP) {
+                expire(arg);
+                pending = 0;
+            }
+        }
+    }
+    expire(arg);
+}
+
+/**
+ \fn static void pcap_file_expire (unsigned char *ctx_index)
+ \brief print out the expired flows of a context
+ \param ctx_index the index of the context
+ \return none
+ */
+static void pcap_file_expire (unsigned char *ctx_index) {
+    joy_print_flow_data((uint64_t)ctx_index, JOY_EXPIRED_FLOWS);
+}
+
+/*
+ * Parallel offline processing
+ *
+ * With more than one thread configured and an output file given,
+ * offline processing is spread over the contexts.  A single pcap file
+ * is read by the main thread, which hands each packet to the context
+ * that owns its flow through that context's packet ring.  Several
+ * files, or a directory, are instead shared out whole, each worker
+ * taking the next file when it finishes one.  Either way every flow
+ * is handled start to finish by one context, so the output files
+ * together hold the same flow records as a single threaded run.
+ *
+ * For that to hold when one file is split, flows must also expire at
+ * the same points: a single threaded run looks for expired flows
+ * after every NUM_PACKETS_IN_LOOP packets, as of the latest packet
+ * read.  The reader marks each of those points in every ring with an
+ * empty entry carrying that time.
+ */
+
+#ifdef WIN32
+#define JOY_PATH_SEP "\\"
+#else
+#define JOY_PATH_SEP "/"
+#endif
+
+/** a pcap file to process, and the file its flow records go to */
+typedef struct offline_job_ {
+    char input[MAX_FILENAME_LEN*2];
+    char output[MAX_FILENAME_LEN*2];
+} offline_job_t;
+
+static offline_job_t *offline_jobs = NULL;
+static unsigned int offline_num_jobs = 0;
+static unsigned int offline_next_job = 0;
+static int offline_job_rc = 0;
+static pthread_mutex_t offline_job_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* time of the latest flow packet read from the file being split */
+static struct timeval offline_read_time;
+
+/**
+ \fn static int offline_add_job (const char *input, const char *output)
+ \brief append a file to the list shared out to the worker threads
+ \param input the pcap file to process
+ \param output the file to write its flow records to
+ \return 0 for success or -1 on error
+ */
+static int offline_add_job (const char *input, const char *output) {
+    offline_job_t *jobs = NULL;
+
+    jobs = realloc(offline_jobs, (offline_num_jobs + 1) * sizeof(offline_job_t));
+    if (jobs == NULL) {
+        joy_log_err("could not allocate the list of input files");
+        return -1;
+    }
+    offline_jobs = jobs;
+    snprintf(jobs[offline_num_jobs].input, MAX_FILENAME_LEN*2, "%s", input);
+    snprintf(jobs[offline_num_jobs].output, MAX_FILENAME_LEN*2, "%s", output);
+    offline_num_jobs++;
+    return 0;
+}
+
+/**
+ \fn static int offline_output_name (char *output_filename, const char *output_dir,
+                                     const char *name, int fc_cnt)
+ \brief name the output file of an input file, as the single threaded
+        runs do; a name too long for the context is rejected, rather than
+        truncated into one that another file may also get
+ \param output_filename the buffer of MAX_FILENAME_LEN*2 bytes for the name
+ \param output_dir the directory the output file goes into
+ \param name the base name of the input file
+ \param fc_cnt the number of the file
+ \return 0 for success or -1 if the name is too long
+ */
+static int offline_output_name (char *output_filename, const char *output_dir,
+                                const char *name, int fc_cnt) {
+    int len;
+
+    len = snprintf(output_filename, MAX_FILENAME_LEN*2, "%s" JOY_PATH_SEP "%s_%d_json%s",
+                   output_dir, name, fc_cnt, zsuffix);
+    if (len < 0 || len >= MAX_FILENAME_LEN) {
+        joy_log_err("output file name for %s is too long", name);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ \fn static int offline_add_directory_jobs (char *input_directory, const char *output_dir)
+ \brief add every file of a directory to the list shared out to the worker
+        threads, naming the outputs as process_directory_of_files() does
+ \param input_directory the directory of pcap files
+ \param output_dir the directory the output files go into
+ \return 0 for success or a negative number on error
+ */
+static int offline_add_directory_jobs (char *input_directory, const char *output_dir) {
+    static int fc_cnt = 1;
+    struct dirent *ent = NULL;
+    DIR *dir = NULL;
+    char pcap_filename[MAX_FILENAME_LEN*2];
+    char output_filename[MAX_FILENAME_LEN*2];
+    const char *sep = JOY_PATH_SEP;
+    int cmp_ind;
+    int len;
+
+    if ((dir = opendir(input_directory)) == NULL) {
+        joy_log_err("Error opening directory: %s\n", input_directory);
+        return -11;
+    }
+    if (input_directory[strlen(input_directory)-1] == sep[0]) {
+        sep = "";
+    }
+
+    while ((ent = readdir(dir)) != NULL) {
+        if ((strcmp_s(ent->d_name, 1, ".", &cmp_ind) == EOK && cmp_ind !=0) &&
+            (strcmp_s(ent->d_name, 2, "..", &cmp_ind) == EOK && cmp_ind !=0)) {
+            len = snprintf(pcap_filename, MAX_FILENAME_LEN*2, "%s%s%s", input_directory, sep, ent->d_name);
+            if (len < 0 || len >= MAX_FILENAME_LEN*2) {
+                joy_log_err("input file name %s%s%s is too long", input_directory, sep, ent->d_name);
+                closedir(dir);
+                return -1;
+            }
+            if (offline_output_name(output_filename, output_dir, ent->d_name, fc_cnt) < 0) {
+                closedir(dir);
+                return -1;
+            }
+            ++fc_cnt;
+            if (offline_add_job(pcap_filename, output_filename) < 0) {
+                closedir(dir);
+                return -1;
+            }
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+/**
+ \fn static int offline_add_file_job (char *input_filename, const char *output_dir, int fc_cnt)
+ \brief add a file to the list shared out to the worker threads, naming
+        the output as process_multiple_input_files() does
+ \param input_filename the pcap file to process
+ \param output_dir the directory the output file goes into
+ \param fc_cnt the argument number of the file
+ \return 0 for success or -1 on error
+ */
+static int offline_add_file_job (char *input_filename, const char *output_dir, int fc_cnt) {
+    char input_path[MAX_FILENAME_LEN];
+    char input_file_base_name[MAX_FILENAME_LEN];
+    char output_filename[MAX_FILENAME_LEN*2];
+#ifdef WIN32
+    char fname[128];
+    char ext[8];
+#endif
+
+    strncpy_s(input_path, MAX_FILENAME_LEN, input_filename, (MAX_FILENAME_LEN-1));
+#ifdef WIN32
+    _splitpath_s(input_path,NULL,0,NULL,0,fname,_MAX_FNAME,ext,_MAX_EXT);
+    snprintf(input_file_base_name,128, "%s%s", fname, ext);
+#else
+    snprintf(input_file_base_name, 128, "%s", basename(input_path));
+#endif
+    if (offline_output_name(output_filename, output_dir, input_file_base_name, fc_cnt) < 0) {
+        return -1;
+    }
+    return offline_add_job(input_filename, output_filename);
+}
+
+/**
+ \fn static void* offline_file_thread_main (void* ctx_num)
+ \brief worker thread taking whole files off the shared list
+ \param ctx_num the index of the context the thread uses
+ \return NULL
+ */
+static void* offline_file_thread_main (void* ctx_num) {
+    uint8_t index = 0;
+    joy_ctx_data *ctx = NULL;
+    offline_job_t *job = NULL;
+    char *output_file_basename = NULL;
+    bpf_u_int32 net = PCAP_NETMASK_UNKNOWN;
+    struct bpf_program fp;
+    int tmp_ret = 0;
+
+    /* get the worker context from the thread number */
+    index = (uint64_t)ctx_num;
+    ctx = joy_index_to_context(index);
+    if (ctx == NULL) {
+        joy_log_crit("error:failed to find the context structure for index %d\n", index);
+        return NULL;
+    }
+
+    while (1) {
+        /* take the next file, unless another worker has failed */
+        pthread_mutex_lock(&offline_job_lock);
+        if (offline_job_rc < 0 || offline_next_job >= offline_num_jobs) {
+            pthread_mutex_unlock(&offline_job_lock);
+            break;
+        }
+        job = &offline_jobs[offline_next_job++];
+        pthread_mutex_unlock(&offline_job_lock);
+
+        /*
+         * start each file with a clean context, as a single threaded
+         * run of a directory does, so that no flow or clock state
+         * leaks from one file into the next
+         */
+        flow_record_list_free(ctx);
+        output_file_basename = ctx->output_file_basename;
+        memset_s(ctx, sizeof(joy_ctx_data), 0x00, sizeof(joy_ctx_data));
+        ctx->ctx_id = index;
+        ctx->output_file_basename = output_file_basename;
+        if (flow_record_list_init(ctx) != ok) {
+            tmp_ret = -1;
+        } else if ((ctx->output = zopen(job->output, "w")) == NULL) {
+            joy_log_err("could not open output file %s (%s)", job->output, strerror(errno));
+            tmp_ret = -1;
+        } else {
+            strncpy_s(ctx->output_filename, MAX_FILENAME_LEN, job->output, MAX_FILENAME_LEN-1);
+            zasync(ctx->output);
+            joy_print_config(index, JOY_JSON_FORMAT);
+            memset_s(&fp, sizeof(struct bpf_program), 0x00, sizeof(struct bpf_program));
+            tmp_ret = process_pcap_file(index, job->input, filter_exp, &net, &fp);
+            zclose(ctx->output);
+            ctx->output = NULL;
+        }
+
+        if (tmp_ret < 0) {
+            pthread_mutex_lock(&offline_job_lock);
+            if (offline_job_rc == 0) {
+                offline_job_rc = tmp_ret;
+            }
+            pthread_mutex_unlock(&offline_job_lock);
+        }
+    }
+    return NULL;
+}
+
+/**
+ \fn static int process_input_files_parallel (int num_contexts, int argc, char **argv, int first_arg)
+ \brief process the files and directories given on the command line,
+        one file per worker thread at a time
+ \param num_contexts the number of contexts, and of worker threads
+ \param argc command line argument count
+ \param argv command line arguments
+ \param first_arg the first argument naming an input
+ \return 0 for success or a negative number for the first processing error
+ */
+static int process_input_files_parallel (int num_contexts, int argc, char **argv, int first_arg) {
+    char output_dir[MAX_FILENAME_LEN];
+    char output_filename[MAX_FILENAME_LEN];
+    struct stat st;
+    joy_ctx_data *ctx = NULL;
+    int tmp_ret = 0;
+    int i;
+
+    /* use the output filename as the directory to storing results */
+    strncpy_s(output_dir, MAX_FILENAME_LEN, glb_config->filename, (MAX_FILENAME_LEN-1));
+    memset_s(&st, sizeof(struct stat), 0x00, sizeof(struct stat));
+    if (stat(output_dir, &st) == -1) {
+#ifdef WIN32
+        mkdir(output_dir);
+#else
+        tmp_ret = mkdir(output_dir, 0700);
+        if (tmp_ret < 0) {
+            joy_log_err("Error creating directory: %s\n", output_dir);
+            return tmp_ret;
+        }
+#endif
+    }
+
+    /* list the files to process */
+    for (i=first_arg; i<argc; i++) {
+        if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+            tmp_ret = strnlen_s(argv[i], (MAX_FILENAME_LEN*2));
+            if (tmp_ret == 0 || tmp_ret >= (MAX_FILENAME_LEN*2)) {
+                fprintf(stderr, "error:failed filename too long %s\n", argv[i]);
+                return -1;
+            }
+            tmp_ret = offline_add_directory_jobs(argv[i], output_dir);
+        } else {
+            tmp_ret = offline_add_file_job(argv[i], output_dir, i);
+        }
+        if (tmp_ret < 0) {
+            return tmp_ret;
+        }
+    }
+
+    /* the per-context output files opened at startup are not used */
+    for (i=0; i < num_contexts; ++i) {
+        ctx = joy_index_to_context(i);
+        zclose(ctx->output);
+        ctx->output = NULL;
+        snprintf(output_filename, MAX_FILENAME_LEN, "%s", ctx->output_filename);
+        if (remove(output_filename) == -1) {
+            fprintf(stderr, "error:failed to remove %s\n", output_filename);
+            return -1;
+        }
+    }
+
+    /* spin up the workers and wait for them to run out of files */
+    offline_next_job = 0;
+    offline_job_rc = 0;
+    for (i=0; i < num_contexts; ++i) {
+        uint64_t ctx_index = i;
+
+        tmp_ret = pthread_create(&pkt_proc_thrd[i], NULL, offline_file_thread_main, (void*)ctx_index);
+        if (tmp_ret) {
+            joy_log_err("error: could not start file processing thread rc: %d\n", tmp_ret);
+            offline_job_rc = -8;
+            break;
+        }
+        placement_pin_thread(pkt_proc_thrd[i], i);
+    }
+    while (i > 0) {
+        pthread_join(pkt_proc_thrd[--i], NULL);
+    }
+
+    free(offline_jobs);
+    offline_jobs = NULL;
+    offline_num_jobs = 0;
+    return offline_job_rc;
+}
+
+/**
+ \fn static void joy_offline_dispatch_packet (unsigned char *num_contexts, const struct pcap_pkthdr *header, const unsigned char *packet)
+ \brief pcap callback handing a packet read from a file to the context
+        that owns its flow
+ \param num_contexts the number of contexts packets are spread over
+ \param header the pcap header of the packet
+ \param packet the captured bytes
+ \return none
+ */
+static void joy_offline_dispatch_packet (unsigned char *num_contexts,
+                                         const struct pcap_pkthdr *header,
+                                         const unsigned char *packet) {
+    uint64_t index = 0;
+    flow_key_t key;
+
+    if (packet == NULL) {
+        return;
+    }
+    if (get_packet_5tuple_key(packet, &key)) {
+        /* packets that belong to a flow move the time on, as in process_packet() */
+        if (joy_timer_lt(&offline_read_time, &header->ts)) {
+            offline_read_time = header->ts;
+        }
+        index = joy_flow_key_to_context(&key, header->len, (uint64_t)num_contexts);
+    }
+
+    /* nothing is dropped when reading a file; wait for the worker instead */
+    pkt_ring_enqueue_wait(&pkt_ring[index], header, packet);
+}
+
+/**
+ \fn static void joy_offline_dispatch_burst (unsigned char *num_contexts, const struct pcap_pkthdr **headers, const unsigned char **packets, unsigned int num_packets)
+ \brief hand a burst of packets read from a file to the contexts that
+        own their flows
+ \param num_contexts the number of contexts packets are spread over
+ \param headers the pcap headers of the packets
+ \param packets the captured bytes of the packets
+ \param num_packets the number of packets
+ \return none
+ */
+static void joy_offline_dispatch_burst (unsigned char *num_contexts,
+                                        const struct pcap_pkthdr **headers,
+                                        const unsigned char **packets,
+                                        unsigned int num_packets) {
+    unsigned int i;
+
+    for (i = 0; i < num_packets; i++) {
+        joy_offline_dispatch_packet(num_contexts, headers[i], packets[i]);
+    }
+}
+
+/**
+ \fn static void joy_offline_mark_expiry (unsigned char *num_contexts)
+ \brief have every context print out its expired flows at this point,
+        by marking it in every ring
+ \param num_contexts the number of contexts packets are spread over
+ \return none
+ */
+static void joy_offline_mark_expiry (unsigned char *num_contexts) {
+    struct pcap_pkthdr marker;
+    uint64_t i;
+
+    memset_s(&marker, sizeof(struct pcap_pkthdr), 0x00, sizeof(struct pcap_pkthdr));
+    marker.ts = offline_read_time;
+    for (i=0; i < (uint64_t)num_contexts; ++i) {
+        pkt_ring_enqueue_wait(&pkt_ring[i], &marker, (const unsigned char*)&marker);
+    }
+}
+
+/**
+ \fn static void offline_process_burst (unsigned char *ctx_ptr, const struct pcap_pkthdr **headers, const unsigned char **packets, unsigned int num_packets)
+ \brief handle a burst of entries of a context's ring: packets, and
+        markers of points at which to look for expired flows
+ \param ctx_ptr the context
+ \param headers the pcap headers of the entries
+ \param packets the captured bytes of the entries
+ \param num_packets the number of entries
+ \return none
+ */
+static void offline_process_burst (unsigned char *ctx_ptr,
+                                   const struct pcap_pkthdr **headers,
+                                   const unsigned char **packets,
+                                   unsigned int num_packets) {
+    joy_ctx_data *ctx = (joy_ctx_data*)ctx_ptr;
+    unsigned int first = 0;
+    unsigned int i;
+
+    for (i = 0; i < num_packets; i++) {
+        if (headers[i]->caplen != 0 || headers[i]->len != 0) {
+            continue;
+        }
+
+        /* process the packets before the marker */
+        process_packet_burst(ctx_ptr, headers + first, packets + first, i - first);
+        first = i + 1;
+
+        /* Print out expired flows, as of the latest packet read */
+        if (joy_timer_lt(&ctx->global_time, &headers[i]->ts)) {
+            ctx->global_time = headers[i]->ts;
+        }
+        joy_print_flow_data(ctx->ctx_id, JOY_EXPIRED_FLOWS);
+    }
+    process_packet_burst(ctx_ptr, headers + first, packets + first, num_packets - first);
+}
+
+/**
+ \fn static void* offline_proc_thread_main (void* ctx_num)
+ \brief worker thread processing the packets of one context as the
+        main thread reads them from a file
+ \param ctx_num the index of the context the thread uses
+ \return NULL
+ */
+static void* offline_proc_thread_main (void* ctx_num) {
+    uint8_t index = 0;
+    joy_ctx_data *ctx = NULL;
+
+    /* get the worker context from the thread number */
+    index = (uint64_t)ctx_num;
+    ctx = joy_index_to_context(index);
+    if (ctx == NULL) {
+        joy_log_crit("error:failed to find the context structure for index %d\n", index);
+        return NULL;
+    }
+
+    while (1) {
+        if (pkt_ring_drain_burst(&pkt_ring[index], PKT_RING_BURST,
+                                 offline_process_burst, (unsigned char*)ctx) == 0) {
+            if (pkt_proc_stop) {
+                break;
+            }
+            usleep(100); /* 100 = 0.1 msec */
+        }
+    }
+    return NULL;
+}
+
+/**
+ \fn static int process_single_input_file_parallel (int num_contexts, char *input_filename)
+ \brief read a single pcap file, spreading its flows over the contexts;
+        context N writes to the output file opened for it at startup
+ \param num_contexts the number of contexts, and of worker threads
+ \param input_filename pcap file to process
+ \return 0 for success or a negative number for processing error code
+ */
+static int process_single_input_file_parallel (int num_contexts, char *input_filename) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    bpf_u_int32 net = PCAP_NETMASK_UNKNOWN;
+    struct bpf_program fp;
+    pcap_reader_t reader = NULL;
+    uint64_t max_contexts = num_contexts;
+    int tmp_ret = 0;
+    int i;
+
+    joy_log_info("reading pcap file %s with %d threads", input_filename, num_contexts);
+
+    reader = pcap_reader_open(input_filename, errbuf);
+    if (reader == NULL) {
+        fprintf(stderr,"Couldn't open pcap file %s: %s\n", input_filename, errbuf);
+        return -1;
+    }
+
+    memset_s(&fp, sizeof(struct bpf_program), 0x00, sizeof(struct bpf_program));
+    if (filter_exp) {
+        if (pcap_file_filter_compile(reader, filter_exp, net, &fp) < 0) {
+            pcap_reader_close(reader);
+            return -2;
+        }
+    }
+
+    /* spin up the threads */
+    for (i=0; i < num_contexts; ++i) {
+        uint64_t ctx_index = i;
+
+        joy_print_config(i, JOY_JSON_FORMAT);
+        if (pkt_ring_init(&pkt_ring[i], PKT_RING_DEFAULT_SIZE) != ok) {
+            tmp_ret = -8;
+            break;
+        }
+        if (pthread_create(&pkt_proc_thrd[i], NULL, offline_proc_thread_main, (void*)ctx_index)) {
+            joy_log_err("error: could not start packet_processing thread");
+            pkt_ring_free(&pkt_ring[i]);
+            tmp_ret = -8;
+            break;
+        }
+        placement_pin_thread(pkt_proc_thrd[i], i);
+        pkt_proc_num_thrds++;
+    }
+    placement_pin_main();
+
+    /* Loop over all packets in capture file */
+    memset_s(&offline_read_time, sizeof(struct timeval), 0x00, sizeof(struct timeval));
+    if (tmp_ret == 0) {
+        pcap_file_read(reader, filter_exp ? &fp : NULL, joy_offline_dispatch_burst,
+                       joy_offline_mark_expiry, (unsigned char*)max_contexts);
+        if (pcap_reader_error(reader)) {
+            joy_log_warn("could not read all of pcap file %s", input_filename);
+        }
+    }
+    pkt_proc_stop_threads(offline_process_burst);
+    joy_log_info("all flows processed");
+
+    for (i=0; i < num_contexts; ++i) {
+        if (pkt_ring[i].buf) {
+            joy_print_flow_data(i, JOY_ALL_FLOWS);
+            pkt_ring_free(&pkt_ring[i]);
+        }
+    }
+
+    if (filter_exp) {
+        pcap_freecode(&fp);
+    }
+    pcap_reader_close(reader);
+    return tmp_ret;
+}
+
 #ifdef USE_AF_PACKET
-void joy_handler_function(void *handler_ctx, struct packet_info *pi, uint8_t *eth) {
+void joy_handler_function(void *handler_ctx, struct pkt_desc *pi, uint8_t *eth) {
     struct joy_hndlr_ctx *joy_data = (struct joy_hndlr_ctx*)handler_ctx;
     uint8_t index = 0;
     joy_ctx_data *ctx = NULL;
@@ -1229,17 +2115,78 @@ void joy_handler_function(void *handler_ctx, struct packet_info *pi, uint8_t *et
     }
 
     /* process the data */
-    process_packet((unsigned char*)ctx, (void*)pi, eth);
+    process_frame((unsigned char*)ctx, pi, eth);
 
     /* increment the packet count for this thread */
     ++joy_data->packet_cnt;
+}
 
-    /* every 20 packets scan the flow records for exipred entries */
-    if ((joy_data->packet_cnt % 20) == 0) {
-        /* print any expired flow records */
-        joy_print_flow_data(index, JOY_EXPIRED_FLOWS);
+void joy_burst_handler_function(void *handler_ctx, struct pkt_desc **pi, uint8_t **eth, unsigned int num_frames) {
+    struct joy_hndlr_ctx *joy_data = (struct joy_hndlr_ctx*)handler_ctx;
+    uint8_t index = 0;
+    joy_ctx_data *ctx = NULL;
+
+    /* get the worker context from the thread number */
+    index = (uint64_t)joy_data->thread_id;
+    ctx = joy_index_to_context(index);
+    if (ctx == NULL) {
+        joy_log_crit("error:failed to find the context structure for index %d\n", index);
     }
 
+    /* process the data */
+    process_frame_burst((unsigned char*)ctx, (const struct pkt_desc **)pi,
+                        (const unsigned char **)eth, num_frames);
+
+    /* increment the packet count for this thread */
+    joy_data->packet_cnt += num_frames;
+}
+
+/*
+ * Called by a capture thread every housekeeping_ms.  Expired flows
+ * are written out, at most expire_max of them per call so that a
+ * burst of expirations does not hold up the packets behind it.  When
+ * the link is idle, no packets move the time of the context forward,
+ * so it is moved to the wall clock (the clock the kernel stamps the
+ * packets with) for the idle flows to expire, and the output is
+ * flushed so that what was written reaches the file.
+ */
+unsigned int joy_housekeeping_function(void *handler_ctx, unsigned int idle) {
+    struct joy_hndlr_ctx *joy_data = (struct joy_hndlr_ctx*)handler_ctx;
+    uint8_t index = 0;
+    joy_ctx_data *ctx = NULL;
+    unsigned int num_waiting = 0;
+    struct timeval now;
+
+    /* get the worker context from the thread number */
+    index = (uint64_t)joy_data->thread_id;
+    ctx = joy_index_to_context(index);
+    if (ctx == NULL) {
+        joy_log_crit("error:failed to find the context structure for index %d\n", index);
+        return 0;
+    }
+
+    if (idle) {
+        gettimeofday(&now, NULL);
+        if (joy_timer_lt(&ctx->global_time, &now)) {
+            ctx->global_time = now;
+        }
+    }
+
+    /* print any expired flow records */
+    num_waiting = joy_print_expired_flows(index, glb_config->expire_max);
+
+    /* Periodically report on progress */
+    if (joy_data->status_cnt < (ctx->stats.num_packets / NUM_PACKETS_BETWEEN_STATS_OUTPUT)) {
+        joy_print_flocap_stats_output(ctx->ctx_id);
+        joy_data->status_cnt = (ctx->stats.num_packets / NUM_PACKETS_BETWEEN_STATS_OUTPUT);
+    }
+
+    if (idle && ctx->output != NULL && zbytes(ctx->output) != joy_data->flushed) {
+        zflush(ctx->output);
+        joy_data->flushed = zbytes(ctx->output);
+    }
+
+    return num_waiting;
 }
 
 #else
@@ -1247,6 +2194,8 @@ void joy_handler_function(void *handler_ctx, struct packet_info *pi, uint8_t *et
 static void* pkt_proc_thread_main(void* ctx_num) {
     uint8_t index = 0;
     unsigned long status_cnt = 0;
+    time_t last_scan = 0;
+    time_t now;
     joy_ctx_data *ctx = NULL;
 
     /* get the worker context from the thread number */
@@ -1258,11 +2207,21 @@ static void* pkt_proc_thread_main(void* ctx_num) {
     }
 
     while (1) {
-        /* we process the flow records every 3 seconds */
-        usleep(3000000); /* 3000000 = 3 sec */
+        /* process whatever the capture loop has queued for this context */
+        if (pkt_ring_drain_burst(&pkt_ring[index], PKT_RING_BURST,
+                                 process_packet_burst, (unsigned char*)ctx) == 0) {
+            if (pkt_proc_stop) {
+                break;
+            }
+            usleep(1000); /* 1000 = 1 msec */
+        }
 
-        /* obtain the lock */
-        pthread_mutex_lock(&thrd_lock[index]);
+        /* we process the flow records about once a second */
+        now = time(NULL);
+        if (now == last_scan) {
+            continue;
+        }
+        last_scan = now;
 
         /* report executable info if configured */
         if (glb_config->report_exe) {
@@ -1277,13 +2236,13 @@ static void* pkt_proc_thread_main(void* ctx_num) {
         /* Periodically report on progress */
         if (status_cnt < (ctx->stats.num_packets / NUM_PACKETS_BETWEEN_STATS_OUTPUT)) {
             joy_print_flocap_stats_output(ctx->ctx_id);
+            print_pkt_ring_stats(index);
             print_libpcap_stats();
             status_cnt = (ctx->stats.num_packets / NUM_PACKETS_BETWEEN_STATS_OUTPUT);
         }
 
         /* Print out expired flows */
         joy_print_flow_data(ctx->ctx_id, JOY_EXPIRED_FLOWS);
-        pthread_mutex_unlock(&thrd_lock[index]);
     }
     return NULL;
 }
@@ -1294,7 +2253,7 @@ static void joy_get_packets(unsigned char *num_contexts,
 {
     uint64_t max_contexts = 0;
     uint64_t index = 0;
-    joy_ctx_data *ctx = NULL;
+    flow_key_t key;
 
     /* make sure we have a packet to process */
     if (packet == NULL) {
@@ -1303,13 +2262,12 @@ static void joy_get_packets(unsigned char *num_contexts,
 
     /* figure out the worker for this packet */
     max_contexts = (uint64_t)num_contexts;
-    index = joy_packet_to_context(packet, max_contexts);
-    ctx = joy_index_to_context(index);
+    if (get_packet_5tuple_key(packet, &key)) {
+        index = joy_flow_key_to_context(&key, header->len, max_contexts);
+    }
 
-    /* process the packet */
-    pthread_mutex_lock(&thrd_lock[index]);
-    process_packet((unsigned char*)ctx, header, packet);
-    pthread_mutex_unlock(&thrd_lock[index]);
+    /* hand the packet to the worker; it is counted there if the ring is full */
+    pkt_ring_enqueue(&pkt_ring[index], header, packet);
 }
 #endif
 
@@ -1340,6 +2298,7 @@ int main (int argc, char **argv) {
     int cmp_ind;
     joy_init_t init_data;
     int ctx_counter = 0;
+    int ring_node = -1;
 #ifdef USE_AF_PACKET
     struct mercury_config af_cfg;
     struct ring_limits af_rlp;
@@ -1427,6 +2386,7 @@ int main (int argc, char **argv) {
             fprintf(info, "error: find_interface for live capture session failed!\n");
             return -2;
         }
+        ring_node = affinity_interface_node(capture_if);
 
 #ifdef USE_AF_PACKET
         memset_s(&af_cfg, sizeof(struct mercury_config), 0x00, sizeof(struct mercury_config));
@@ -1434,13 +2394,21 @@ int main (int argc, char **argv) {
         af_cfg.buffer_fraction = 8;
         af_cfg.capture_interface = capture_if;
         af_cfg.num_threads = glb_config->num_threads;
+        af_cfg.housekeeping_ms = glb_config->housekeeping_ms;
+        af_cfg.xdp_mode = glb_config->xdp_mode;
+        af_cfg.thread_cpu = placement_cpu; /* filled in by placement_init() */
+        af_cfg.ring_node = ring_node;
         if (glb_config->username) {
             af_cfg.user = glb_config->username;
         } else {
             af_cfg.user = getenv("SUDO_USER");
         }
-        ring_limits_init(&af_rlp, af_cfg.buffer_fraction);
-        af_packet_bind_and_dispatch(&af_cfg,&af_rlp);
+        if (glb_config->capture == CAPTURE_AF_XDP) {
+            af_xdp_bind_and_dispatch(&af_cfg);
+        } else {
+            ring_limits_init(&af_rlp, af_cfg.buffer_fraction);
+            af_packet_bind_and_dispatch(&af_cfg,&af_rlp);
+        }
 #else
         if (open_interface(capture_if) < 0) {
             fprintf(info, "error: open_interface for live capture session failed!\n");
@@ -1495,11 +2463,24 @@ int main (int argc, char **argv) {
      */
     if (finish_initial_setup(num_cmds)) exit(EXIT_FAILURE);
 
+    /* the shared memory ring takes the place of the output file */
+    if (glb_config->ring_file && glb_config->filename) {
+        joy_log_warn("ring_file replaces output, no output file is written");
+        free(glb_config->filename);
+        glb_config->filename = NULL;
+    }
+
     /* setup library and context information */
     memset_s(&init_data, sizeof(joy_init_t), 0x00, sizeof(joy_init_t));
     if (joy_mode == MODE_ONLINE) {
        init_data.contexts = glb_config->num_threads;
+    } else if (joy_mode == MODE_OFFLINE && glb_config->num_threads > 1 && glb_config->filename) {
+       /* offline processing is spread over the threads, one output per context */
+       init_data.contexts = glb_config->num_threads;
     } else {
+       if (joy_mode == MODE_OFFLINE && glb_config->num_threads > 1) {
+           joy_log_warn("offline processing with several threads needs an output file, using 1 thread");
+       }
        glb_config->num_threads = 1;
        init_data.contexts = 1;
     }
@@ -1507,7 +2488,9 @@ int main (int argc, char **argv) {
     init_data.act_timeout = 20;
 
     /* config was already setup, use API with pre-set configuration */
-    joy_initialize_no_config(glb_config, info, &init_data);
+    if (joy_initialize_no_config(glb_config, info, &init_data) != ok) {
+        exit(EXIT_FAILURE);
+    }
 
     /*
      * Retrieve sequence of packet lengths/times and byte distribution
@@ -1625,32 +2608,89 @@ int main (int argc, char **argv) {
         }
 
 #ifdef USE_AF_PACKET
-        af_packet_start_processing(&af_cfg);
+        placement_init(init_data.contexts, PLACEMENT_THREADS_READ, capture_if, ring_node);
+#else
+        placement_init(init_data.contexts,
+                       (init_data.contexts > 1) ? PLACEMENT_MAIN_READS : PLACEMENT_MAIN_ONLY,
+                       capture_if, ring_node);
+#endif
+
+#ifdef USE_AF_PACKET
+        if (glb_config->capture == CAPTURE_AF_XDP) {
+            af_xdp_start_processing(&af_cfg);
+        } else {
+            af_packet_start_processing(&af_cfg);
+        }
 #else
         /* spin up the threads */
         if (init_data.contexts > 1) {
+#ifndef WIN32
+            sigset_t block_set, orig_set;
+
+            /*
+             * the signal handlers wait for the worker threads, so the
+             * signals must be delivered to this thread; the workers
+             * inherit the blocked mask
+             */
+            sigemptyset(&block_set);
+            sigaddset(&block_set, SIGINT);
+            sigaddset(&block_set, SIGTERM);
+            sigaddset(&block_set, SIGHUP);
+            pthread_sigmask(SIG_BLOCK, &block_set, &orig_set);
+#endif
+
             for (ctx_counter=0; ctx_counter < init_data.contexts; ++ctx_counter) {
                 int thrd_rc = 0;
                 uint64_t ctx_index = ctx_counter;
 
+                if (pkt_ring_init(&pkt_ring[ctx_counter], PKT_RING_DEFAULT_SIZE) != ok) {
+                    return -8;
+                }
+                if (ring_node >= 0) {
+                    affinity_place(pkt_ring[ctx_counter].buf, pkt_ring[ctx_counter].size, ring_node);
+                }
+
                 /* start the threads */
                 thrd_rc = pthread_create(&pkt_proc_thrd[ctx_counter], NULL, pkt_proc_thread_main, (void*)ctx_index);
                 if (thrd_rc) {
                     joy_log_err("error: could not start packet_processing thread rc: %d\n", thrd_rc);
                     return -8;
                 }
+                placement_pin_thread(pkt_proc_thrd[ctx_counter], ctx_counter);
+                pkt_proc_num_thrds++;
             }
+
+#ifndef WIN32
+            pthread_sigmask(SIG_SETMASK, &orig_set, NULL);
+#endif
         }
+        placement_pin_main();
 #endif
 
         while(1) {
 #ifndef USE_AF_PACKET
             uint64_t max_contexts = init_data.contexts;
             if (max_contexts > 1) {
+                static time_t last_rebalance = 0;
+                time_t now;
+                uint64_t i;
+
                 /*
                  * Loop over packets captured from interface.
                  */
                 pcap_dispatch(handle, NUM_PACKETS_IN_LOOP, joy_get_packets, (unsigned char*)max_contexts);
+
+                /* even out lasting skew between the workers */
+                now = time(NULL);
+                if (now - last_rebalance >= CONTEXT_REBALANCE_INTERVAL) {
+                    if (last_rebalance) {
+                        for (i = 0; i < max_contexts; i++) {
+                            print_context_load(i);
+                        }
+                        joy_rebalance_contexts();
+                    }
+                    last_rebalance = now;
+                }
            } else {
                 joy_ctx_data *ctx = joy_index_to_context(0);
                 pcap_dispatch(handle, NUM_PACKETS_IN_LOOP, libpcap_process_packet, (unsigned char*)ctx);
@@ -1715,7 +2755,10 @@ int main (int argc, char **argv) {
           return -7;
         }
 
-        flow_record_list_init(ctx);
+        if (flow_record_list_init(ctx) != ok) {
+            fprintf(info, "error: could not initialize the flow records\n");
+            return -1;
+        }
 
         ipfix_collect_main(ctx);
 
@@ -1750,19 +2793,43 @@ int main (int argc, char **argv) {
            multi_file_input = 1;
         }
 
+        if (init_data.contexts == 1) {
+            placement_init(1, PLACEMENT_MAIN_ONLY, NULL, -1);
+        } else {
+            placement_init(init_data.contexts,
+                           multi_file_input ? PLACEMENT_THREADS_READ : PLACEMENT_MAIN_READS, NULL, -1);
+        }
+
+        if (init_data.contexts > 1) {
+            if (multi_file_input) {
+                tmp_ret = process_input_files_parallel(init_data.contexts, argc, argv, 1+opt_count);
+            } else {
+                tmp_ret = process_single_input_file_parallel(init_data.contexts, argv[1+opt_count]);
+            }
+            for (ctx_counter=0; ctx_counter < init_data.contexts; ++ctx_counter) {
+                joy_context_cleanup(ctx_counter);
+            }
+            joy_shutdown();
+            return (tmp_ret < 0) ? tmp_ret : 0;
+        }
+
         /* close out the existing open output file and remove it */
         if (glb_config->filename) {
             zclose(ctx->output);
             memset_s(output_filename, MAX_FILENAME_LEN, 0x00, MAX_FILENAME_LEN);
-            snprintf(output_filename, MAX_FILENAME_LEN,"%s",ctx->output_file_basename);
+            snprintf(output_filename, MAX_FILENAME_LEN,"%s",ctx->output_filename);
             if (remove(output_filename) == -1) {
                 fprintf(stderr, "error:failed to remove %s\n", output_filename);
                 return -1;
             }
         }
 
-        flow_record_list_init(ctx);
+        if (flow_record_list_init(ctx) != ok) {
+            fprintf(info, "error: could not initialize the flow records\n");
+            return -1;
+        }
         flocap_stats_timer_init(ctx);
+        placement_pin_main();
 
         /* loop over remaining arguments to process files */
         for (i=1+opt_count; i<argc; i++) {
@@ -1813,50 +2880,41 @@ int main (int argc, char **argv) {
  * \fn int process_pcap_file (int index, char *file_name, char *filter_exp, bpf_u_int32 *net, struct bpf_program *fp)
  * \brief process pcap packet data from a given file
  * \param index of the context to use
- * \param file_name name of the file with pcap data in it
+ * \param file_name name of the file with pcap data in it, which may be
+ *        pcap or pcapng, and compressed
  * \param filter_exp filter to use
  * \param net
  * \param fp
  * \return -1 could not open pcap file error
  * \return -2 could not parse filter error
- * \return -3 could not install filter
  * \return 0 success
  */
 int process_pcap_file (int index, char *file_name, const char *filtr_exp, bpf_u_int32 *net, struct bpf_program *fp) {
     char errbuf[PCAP_ERRBUF_SIZE];
-    int more = 1;
     uint64_t idx = index;
+    pcap_reader_t reader = NULL; /* files may be read by several threads at once */
 
     joy_log_info("reading pcap file %s", file_name);
 
-    handle = pcap_open_offline(file_name, errbuf);
-    if (handle == NULL) {
+    reader = pcap_reader_open(file_name, errbuf);
+    if (reader == NULL) {
         fprintf(stderr,"Couldn't open pcap file %s: %s\n", file_name, errbuf);
         return -1;
     }
 
     if (filtr_exp) {
-
         /* compile the filter expression */
-        if (pcap_compile(handle, fp, filtr_exp, 0, *net) == -1) {
-            fprintf(stderr, "error: could not parse filter %s: %s\n",
-                    filtr_exp, pcap_geterr(handle));
+        if (pcap_file_filter_compile(reader, filtr_exp, *net, fp) < 0) {
+            pcap_reader_close(reader);
             return -2;
         }
-
-        /* apply the compiled filter */
-        if (pcap_setfilter(handle, fp) == -1) {
-            fprintf(stderr, "error: could not install filter %s: %s\n",
-                    filtr_exp, pcap_geterr(handle));
-            return -3;
-        }
     }
 
-    while (more) {
-        /* Loop over all packets in capture file */
-        more = pcap_dispatch(handle, NUM_PACKETS_IN_LOOP, joy_libpcap_process_packet, (unsigned char *)idx);
-        /* Print out expired flows */
-        joy_print_flow_data(index, JOY_EXPIRED_FLOWS);
+    /* Loop over all packets in capture file, printing out expired flows */
+    pcap_file_read(reader, filtr_exp ? fp : NULL, joy_process_packet_burst,
+                   pcap_file_expire, (unsigned char *)idx);
+    if (pcap_reader_error(reader)) {
+        joy_log_warn("could not read all of pcap file %s", file_name);
     }
 
     joy_log_info("all flows processed");
@@ -1866,7 +2924,7 @@ int process_pcap_file (int index, char *file_name, const char *filtr_exp, bpf_u_
         pcap_freecode(fp);
     }
 
-    pcap_close(handle);
+    pcap_reader_close(reader);
     joy_print_flow_data(index, JOY_ALL_FLOWS);
     return 0;
 }
@@ -48,6 +48,10 @@
 #endif
 
 #include <sys/types.h>
+#ifndef WIN32
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 #include <stdlib.h>  
 #include <stdio.h>
 #include <ctype.h>
@@ -67,6 +71,9 @@
 #include "output.h"
 #include "ipfix.h"
 #include "pkt_proc.h"
+#include "rss.h"
+#include "shm_ring.h"
+#include "affinity.h"
 
 #define MAX_APP_DATA_LEN 32
 #define MAX_NFV9_SPLT_SALT_PKTS 10
@@ -87,6 +94,14 @@ static bool joy_library_initialized = 0;
 static uint8_t joy_num_contexts = 0;
 static struct joy_ctx_data *ctx_data = NULL;
 
+/*
+ * Table that maps the hash of a flow to a context, in the way a NIC's
+ * RSS indirection table maps it to a receive queue. It is set up for
+ * joy_num_contexts contexts at initialization; after that only the
+ * thread that distributes packets over the contexts writes to it.
+ */
+static rss_table_t joy_rss_table;
+
 /*
  * Function: joy_splt_format_data
  *
@@ -112,8 +127,9 @@ static unsigned int joy_splt_format_data(flow_record_t *rec,
     unsigned int entries_used = 0;
     unsigned int num_of_pkts = 0;
     unsigned int data_len = 0;
-    struct timeval ts;
+    struct timeval ts, t, last;
     uint16_t *formatted_data = (uint16_t*)data;
+    const flow_splt_t *splt = flow_record_splt(rec);
 
     /* see how many packets we have to process - max is MAX_NFV9_SPLT_SALT_PKTS */
     num_of_pkts = (rec->op < MAX_NFV9_SPLT_SALT_PKTS) ? rec->op : MAX_NFV9_SPLT_SALT_PKTS;
@@ -131,7 +147,7 @@ static unsigned int joy_splt_format_data(flow_record_t *rec,
     if (export_frmt == JOY_NFV9_EXPORT) {
         /* loop through the SPLT lengths and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            *(formatted_data+i) = (uint16_t)rec->pkt_len[i];
+            *(formatted_data+i) = (uint16_t)splt->pkt_len[i];
         }
 
         if (num_of_pkts < MAX_NFV9_SPLT_SALT_PKTS) {
@@ -143,11 +159,9 @@ static unsigned int joy_splt_format_data(flow_record_t *rec,
 
         /* loop through the SPLT times and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            if (i > 0) {
-                joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-            } else {
-                joy_timer_sub(&rec->pkt_time[i], &rec->start, &ts);
-            }
+            joy_timer_series_get(&splt->start, splt->pkt_time, i, &t);
+            joy_timer_sub(&t, (i > 0) ? &last : &rec->start, &ts);
+            last = t;
             *(formatted_data+MAX_NFV9_SPLT_SALT_PKTS+i) =
                  (uint16_t)joy_timeval_to_milliseconds(ts);
         }
@@ -163,7 +177,7 @@ static unsigned int joy_splt_format_data(flow_record_t *rec,
     } else {
         /* loop through the SPLT lengths and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            *(formatted_data+i) = (uint16_t)rec->pkt_len[i];
+            *(formatted_data+i) = (uint16_t)splt->pkt_len[i];
         }
 
         /* store how many entries we used since IPFix doesn't pad */
@@ -171,11 +185,9 @@ static unsigned int joy_splt_format_data(flow_record_t *rec,
 
         /* loop through the SPLT times and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            if (i > 0) {
-                joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-            } else {
-                joy_timer_sub(&rec->pkt_time[i], &rec->start, &ts);
-            }
+            joy_timer_series_get(&splt->start, splt->pkt_time, i, &t);
+            joy_timer_sub(&t, (i > 0) ? &last : &rec->start, &ts);
+            last = t;
             *(formatted_data+entries_used+i) =
                  (uint16_t)joy_timeval_to_milliseconds(ts);
         }
@@ -210,7 +222,7 @@ static unsigned int joy_salt_format_data(flow_record_t *rec,
     unsigned int entries_used = 0;
     unsigned int num_of_pkts = 0;
     unsigned int data_len = 0;
-    struct timeval ts;
+    struct timeval ts, t, last;
     uint16_t *formatted_data = (uint16_t*)data;
 
     /* sanity check SALT structure */
@@ -248,11 +260,9 @@ static unsigned int joy_salt_format_data(flow_record_t *rec,
 
         /* loop through the SALT times and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            if (i > 0) {
-                joy_timer_sub(&rec->salt->pkt_time[i], &rec->salt->pkt_time[i-1], &ts);
-            } else {
-                joy_timer_sub(&rec->salt->pkt_time[i], &rec->start, &ts);
-            }
+            joy_timer_series_get(&rec->salt->start, rec->salt->pkt_time, i, &t);
+            joy_timer_sub(&t, (i > 0) ? &last : &rec->start, &ts);
+            last = t;
             *(formatted_data+MAX_NFV9_SPLT_SALT_PKTS+i) =
                  (uint16_t)joy_timeval_to_milliseconds(ts);
         }
@@ -277,11 +287,9 @@ static unsigned int joy_salt_format_data(flow_record_t *rec,
 
         /* loop through the SALT times and store appropriately */
         for (i=0; i < num_of_pkts; ++i) {
-            if (i > 0) {
-                joy_timer_sub(&rec->salt->pkt_time[i], &rec->salt->pkt_time[i-1], &ts);
-            } else {
-                joy_timer_sub(&rec->salt->pkt_time[i], &rec->start, &ts);
-            }
+            joy_timer_series_get(&rec->salt->start, rec->salt->pkt_time, i, &t);
+            joy_timer_sub(&t, (i > 0) ? &last : &rec->start, &ts);
+            last = t;
             *(formatted_data+entries_used+i) =
                  (uint16_t)joy_timeval_to_milliseconds(ts);
         }
@@ -312,13 +320,14 @@ static unsigned int joy_bd_format_data(flow_record_t *rec, unsigned char *data)
     int i;
     unsigned int data_len = 0;
     uint16_t *formatted_data = (uint16_t*)data;
+    const flow_bd_t *bd = flow_record_bd(rec);
 
     /* 256 values at 16 bits each = 512 bytes */
     data_len = (MAX_BYTE_COUNT_ARRAY_LENGTH * 2);
 
     /* store the byte counts into the data buffer */
     for (i=0; i < MAX_BYTE_COUNT_ARRAY_LENGTH; ++i) {
-        *(formatted_data+i) = (uint16_t)rec->byte_count[i];
+        *(formatted_data+i) = (uint16_t)bd->byte_count[i];
     }
 
     return data_len;
@@ -351,6 +360,337 @@ static void format_output_filename(char *basename, char *output_filename)
              t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, zsuffix);
 }
 
+/* an output file rotated out, waiting to be finished */
+typedef struct joy_rotated_file {
+    zfile output;
+    char filename[MAX_FILENAME_LEN];
+    struct joy_rotated_file *next;
+} joy_rotated_file_t;
+
+/* rotated output files are closed in the background, oldest first */
+static pthread_mutex_t joy_rotate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t joy_rotate_work = PTHREAD_COND_INITIALIZER;
+static joy_rotated_file_t *joy_rotate_queue = NULL;
+static joy_rotated_file_t **joy_rotate_tail = &joy_rotate_queue;
+static pthread_t joy_rotate_thread;
+static bool joy_rotate_running = 0;
+static bool joy_rotate_stop = 0;
+
+/*
+ * Function: joy_rotation_enabled
+ *
+ * Description: This function reports whether the output files
+ *      rotate, by record count, by size or by time.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      1 - output files rotate
+ *      0 - a single output file is written
+ *
+ */
+static bool joy_rotation_enabled(void)
+{
+    return (glb_config->max_records || glb_config->rotate_bytes || glb_config->rotate_interval);
+}
+
+/*
+ * Function: joy_run_rotate_hook
+ *
+ * Description: This function runs the rotate hook on a finished
+ *      output file and waits for it.  The hook is a shell command
+ *      line, but the file name reaches it as its first argument
+ *      rather than as shell text, so no name can run a command.
+ *
+ * Parameters:
+ *      hook - the hook command line
+ *      filename - the name of the finished output file
+ *
+ * Returns:
+ *      ok if the hook exited with status 0, failure otherwise
+ *
+ */
+static int joy_run_rotate_hook(const char *hook, const char *filename)
+{
+    char cmd[MAX_FILENAME_LEN * 2];
+#ifdef WIN32
+    /* cmd.exe has no argument passing, so quote the name instead */
+    snprintf(cmd, sizeof(cmd), "%s \"%s\"", hook, filename);
+    return system(cmd) == 0 ? ok : failure;
+#else
+    pid_t pid;
+    int status;
+
+    /* sh -c sets $0 and $1 from the arguments after the command */
+    snprintf(cmd, sizeof(cmd), "%s \"$1\"", hook);
+    pid = fork();
+    if (pid < 0) {
+        joy_log_err("could not start rotate hook (%s)", strerror(errno));
+        return failure;
+    }
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", cmd, "sh", filename, (char *)NULL);
+        _exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return failure;
+        }
+    }
+    return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? ok : failure;
+#endif
+}
+
+/*
+ * Function: joy_finish_output_file
+ *
+ * Description: This function closes an output file, which
+ *      completes its compressed stream, and then hands the file on:
+ *      it is moved into the spool directory, the rotate hook is run
+ *      with its name and it is queued for upload, as configured.
+ *
+ * Parameters:
+ *      output - the output file
+ *      filename - the name the output file was opened with
+ *
+ * Returns:
+ *      none
+ *
+ */
+static void joy_finish_output_file(zfile output, const char *filename)
+{
+    char finished[MAX_FILENAME_LEN];
+    const char *name = filename;
+    const char *c = NULL;
+
+    if (zclose(output) != ok) {
+        joy_log_err("could not finish output file %s", filename);
+    }
+
+    snprintf(finished, MAX_FILENAME_LEN, "%s", filename);
+    if (glb_config->rotate_spool) {
+        for (c = filename; *c; ++c) {
+#ifdef WIN32
+            if (*c == '/' || *c == '\\') {
+#else
+            if (*c == '/') {
+#endif
+                name = c + 1;
+            }
+        }
+        snprintf(finished, MAX_FILENAME_LEN, "%s/%s", glb_config->rotate_spool, name);
+        if (rename(filename, finished) != 0) {
+            joy_log_err("could not move output file %s to %s (%s)", filename, finished, strerror(errno));
+            snprintf(finished, MAX_FILENAME_LEN, "%s", filename);
+        }
+    }
+
+    if (glb_config->rotate_hook) {
+        if (joy_run_rotate_hook(glb_config->rotate_hook, finished) != ok) {
+            joy_log_warn("rotate hook [%s] failed on %s", glb_config->rotate_hook, finished);
+        }
+    }
+
+    if (glb_config->upload_servername) {
+        upload_file(finished);
+    }
+}
+
+/*
+ * Function: joy_rotate_main
+ *
+ * Description: This function is the thread that finishes the
+ *      output files rotated out by the packet processing threads,
+ *      so that the tail of a compressed stream and the rotate hook
+ *      never hold up packet processing.
+ *
+ * Parameters:
+ *      arg - unused
+ *
+ * Returns:
+ *      NULL, once stopped with its queue empty
+ *
+ */
+static void *joy_rotate_main(void *arg)
+{
+    joy_rotated_file_t *job = NULL;
+
+    (void)arg;
+    /* started by whichever worker rotates first; do not share its cpu */
+    affinity_spread_to_node();
+    pthread_mutex_lock(&joy_rotate_lock);
+    while (1) {
+        while (joy_rotate_queue == NULL && !joy_rotate_stop) {
+            pthread_cond_wait(&joy_rotate_work, &joy_rotate_lock);
+        }
+        if (joy_rotate_queue == NULL) {
+            break;
+        }
+        job = joy_rotate_queue;
+        joy_rotate_queue = job->next;
+        if (joy_rotate_queue == NULL) {
+            joy_rotate_tail = &joy_rotate_queue;
+        }
+        pthread_mutex_unlock(&joy_rotate_lock);
+
+        joy_finish_output_file(job->output, job->filename);
+        free(job);
+
+        pthread_mutex_lock(&joy_rotate_lock);
+    }
+    pthread_mutex_unlock(&joy_rotate_lock);
+    return NULL;
+}
+
+/*
+ * Function: joy_rotate_output_file
+ *
+ * Description: This function hands a rotated out output file
+ *      to the background thread that finishes it, starting that
+ *      thread on first use. The file is finished right away if the
+ *      thread can not be used.
+ *
+ * Parameters:
+ *      output - the output file
+ *      filename - the name the output file was opened with
+ *
+ * Returns:
+ *      none
+ *
+ */
+static void joy_rotate_output_file(zfile output, const char *filename)
+{
+    joy_rotated_file_t *job = NULL;
+    int rc = 0;
+
+    job = calloc(1, sizeof(joy_rotated_file_t));
+    if (job == NULL) {
+        joy_finish_output_file(output, filename);
+        return;
+    }
+    job->output = output;
+    snprintf(job->filename, MAX_FILENAME_LEN, "%s", filename);
+
+    pthread_mutex_lock(&joy_rotate_lock);
+    if (!joy_rotate_running) {
+        joy_rotate_stop = 0;
+        rc = pthread_create(&joy_rotate_thread, NULL, joy_rotate_main, NULL);
+        if (rc != 0) {
+            pthread_mutex_unlock(&joy_rotate_lock);
+            joy_log_err("could not start the output rotation thread rc: %d", rc);
+            free(job);
+            joy_finish_output_file(output, filename);
+            return;
+        }
+        joy_rotate_running = 1;
+    }
+    *joy_rotate_tail = job;
+    joy_rotate_tail = &job->next;
+    pthread_cond_signal(&joy_rotate_work);
+    pthread_mutex_unlock(&joy_rotate_lock);
+}
+
+/*
+ * Function: joy_rotate_drain
+ *
+ * Description: This function waits for the background thread
+ *      to finish every output file handed to it, and stops it.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      none
+ *
+ */
+static void joy_rotate_drain(void)
+{
+    pthread_mutex_lock(&joy_rotate_lock);
+    if (!joy_rotate_running) {
+        pthread_mutex_unlock(&joy_rotate_lock);
+        return;
+    }
+    joy_rotate_stop = 1;
+    pthread_cond_signal(&joy_rotate_work);
+    pthread_mutex_unlock(&joy_rotate_lock);
+
+    pthread_join(joy_rotate_thread, NULL);
+    joy_rotate_running = 0;
+    joy_rotate_stop = 0;
+}
+
+/*
+ * Function: joy_open_ring_output
+ *
+ * Description: This function opens the shared memory ring that
+ *      a context writes its flow records into, in place of an
+ *      output file. With more than one context, each gets a ring
+ *      of its own, named after the configured one.
+ *
+ * Parameters:
+ *      ctx_id - the context the ring is for
+ *
+ * Returns:
+ *      the output stream, or NULL on failure
+ *
+ */
+static zfile joy_open_ring_output(unsigned int ctx_id)
+{
+    char ring_filename[MAX_FILENAME_LEN];
+    zfile output = NULL;
+
+    if (joy_num_contexts == 1) {
+        snprintf(ring_filename, MAX_FILENAME_LEN, "%s", glb_config->ring_file);
+    } else {
+        snprintf(ring_filename, MAX_FILENAME_LEN, "%s.ctx%u", glb_config->ring_file, ctx_id);
+    }
+    if (glb_config->output_format != OUTPUT_FORMAT_JSON) {
+        joy_log_err("the ring carries JSON records, format=binary can not be used with it");
+        return NULL;
+    }
+    output = zopen_ring(ring_filename,
+                        glb_config->ring_size ? glb_config->ring_size : SHM_RING_DEFAULT_SIZE,
+                        glb_config->ring_policy);
+    if (output == NULL) {
+        joy_log_err("could not open ring %s", ring_filename);
+    }
+    return output;
+}
+
+/*
+ * Function: joy_compile_print_plan
+ *
+ * Description: This function compiles the fields option, if it
+ *      is set, into the plan of the members of a flow record that
+ *      the JSON output has.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      0 - success
+ *      1 - failure
+ *
+ */
+static int joy_compile_print_plan(void)
+{
+    print_plan_free(glb_config->plan);
+    glb_config->plan = NULL;
+    if (glb_config->fields == NULL) {
+        return ok;
+    }
+    glb_config->plan = print_plan_compile(glb_config->fields);
+    if (glb_config->plan == NULL) {
+        joy_log_err("could not use fields=%s", glb_config->fields);
+        return failure;
+    }
+    if (glb_config->output_format != OUTPUT_FORMAT_JSON) {
+        joy_log_warn("fields only applies to the JSON output, format=binary writes all of them");
+    }
+    return ok;
+}
+
 /*
  * Function: joy_initialize
  *
@@ -408,6 +748,7 @@ int joy_initialize(joy_init_t *init_data,
     /* allocate the context memory */
     JOY_API_ALLOC_CONTEXT(ctx_data, init_data->contexts)
     joy_num_contexts = init_data->contexts;
+    rss_table_init(&joy_rss_table, joy_num_contexts);
 
     /* set the output directory */
     memset_s(output_dirname, MAX_DIRNAME_LEN, 0x00, MAX_DIRNAME_LEN);
@@ -436,6 +777,38 @@ int joy_initialize(joy_init_t *init_data,
     /* setup the inactive and active timeouts for a flow record */
     flow_record_update_timeouts(init_data->inact_timeout, init_data->act_timeout);
 
+    /* setup the initial size of the flow table and the flow record pool */
+    glb_config->flow_table_size = init_data->flow_table_size;
+    glb_config->flow_pool_size = init_data->flow_pool_size;
+
+    /* setup the limit on flow records and the eviction policy */
+    glb_config->max_flows = init_data->max_flows;
+    if (init_data->flow_evict <= FLOW_EVICT_NOPAYLOAD) {
+        glb_config->flow_evict = init_data->flow_evict;
+    }
+
+    /* setup the columnar export */
+    if (init_data->columnar_file) {
+        glb_config->columnar = strdup(init_data->columnar_file);
+    }
+    glb_config->chunk_rows = init_data->chunk_rows;
+
+    /* setup the compression of the output files */
+    if (init_data->compression < ZFILE_COMPRESSION_MAX) {
+        glb_config->compression = init_data->compression;
+    }
+    glb_config->compress_level = init_data->compress_level;
+    glb_config->compress_threads = init_data->compress_threads;
+
+    /* setup the shared memory ring */
+    if (init_data->ring_file) {
+        glb_config->ring_file = strdup(init_data->ring_file);
+    }
+    glb_config->ring_size = init_data->ring_size;
+    if (init_data->ring_policy < SHM_RING_NUM_POLICIES) {
+        glb_config->ring_policy = init_data->ring_policy;
+    }
+
     /* setup joy with the output options */
     glb_config->outputdir = strdup(output_dirname);
     if (output_file)
@@ -450,6 +823,16 @@ int joy_initialize(joy_init_t *init_data,
         glb_config->max_records = init_data->max_records;
     }
 
+    /* setup the size and time limits of an output file, and what is done with it after */
+    glb_config->rotate_bytes = init_data->rotate_bytes;
+    glb_config->rotate_interval = init_data->rotate_interval;
+    if (init_data->rotate_hook) {
+        glb_config->rotate_hook = strdup(init_data->rotate_hook);
+    }
+    if (init_data->rotate_spool) {
+        glb_config->rotate_spool = strdup(init_data->rotate_spool);
+    }
+
     /* data features */
     glb_config->bidir = ((init_data->bitmask & JOY_BIDIR_ON) ? 1 : 0);
     glb_config->report_dns = ((init_data->bitmask & JOY_DNS_ON) ? 1 : 0);
@@ -473,6 +856,18 @@ int joy_initialize(joy_init_t *init_data,
     glb_config->updater_on = ((init_data->bitmask & JOY_UPDATER_ON) ? 1 : 0);
     glb_config->report_fpx = ((init_data->bitmask & JOY_FPX_ON) ? 1 : 0);
     glb_config->include_classifier = ((init_data->bitmask & JOY_CLASSIFY_ON) ? 1 : 0);
+    glb_config->hugepages = ((init_data->bitmask & JOY_HUGEPAGES_ON) ? 1 : 0);
+    glb_config->output_format = ((init_data->bitmask & JOY_BINARY_OUTPUT_ON) ?
+                                 OUTPUT_FORMAT_BINARY : OUTPUT_FORMAT_JSON);
+
+    /* setup the members of the JSON flow records */
+    if (init_data->fields) {
+        glb_config->fields = strdup(init_data->fields);
+    }
+    if (joy_compile_print_plan() != ok) {
+        JOY_API_FREE_CONTEXT(ctx_data);
+        return failure;
+    }
 
     /* check if IDP option is set */
     if (init_data->bitmask & JOY_IDP_ON) {
@@ -527,6 +922,23 @@ int joy_initialize(joy_init_t *init_data,
         /* id the context */
         this->ctx_id = i;
 
+        /* a shared memory ring takes the place of the output file */
+        if (glb_config->ring_file) {
+            this->output = joy_open_ring_output(this->ctx_id);
+            if (this->output == NULL) {
+                JOY_API_FREE_CONTEXT(ctx_data)
+                return failure;
+            }
+            if (flow_record_list_init(this) != ok) {
+                joy_log_err("could not initialize the flow records of context %d", this->ctx_id);
+                zclose(this->output);
+                JOY_API_FREE_CONTEXT(ctx_data)
+                return failure;
+            }
+            flocap_stats_timer_init(this);
+            continue;
+        }
+
         /* setup the output file basename for the context */
         memset_s(output_filename, MAX_FILENAME_LEN, 0x00, MAX_FILENAME_LEN);
         if (output_file != NULL) {
@@ -565,7 +977,7 @@ int joy_initialize(joy_init_t *init_data,
 
         /* open the output file */
         memset_s(output_filename, MAX_FILENAME_LEN, 0x00, MAX_FILENAME_LEN);
-        if (glb_config->max_records) {
+        if (joy_rotation_enabled()) {
             format_output_filename(this->output_file_basename, output_filename);
         } else {
             if (joy_num_contexts == 1) {
@@ -583,8 +995,17 @@ int joy_initialize(joy_init_t *init_data,
             JOY_API_FREE_CONTEXT(ctx_data)
             return failure;
         }
+        zasync(this->output);
+        snprintf(this->output_filename, MAX_FILENAME_LEN, "%s", output_filename);
+        this->output_opened = time(NULL);
 
-        flow_record_list_init(this);
+        if (flow_record_list_init(this) != ok) {
+            joy_log_err("could not initialize the flow records of context %d", this->ctx_id);
+            zclose(this->output);
+            free(this->output_file_basename);
+            JOY_API_FREE_CONTEXT(ctx_data)
+            return failure;
+        }
         flocap_stats_timer_init(this);
     }
 
@@ -642,6 +1063,7 @@ int joy_initialize_no_config(void *config, FILE *err_info, joy_init_t *data)
     /* allocate the context memory */
     JOY_API_ALLOC_CONTEXT(ctx_data, data->contexts)
     joy_num_contexts = data->contexts;
+    rss_table_init(&joy_rss_table, joy_num_contexts);
 
     glb_config->num_pkts = DEFAULT_NUM_PKT_LEN;
     if ((data->num_pkts > 0) && (data->num_pkts < MAX_NUM_PKT_LEN)) {
@@ -653,6 +1075,78 @@ int joy_initialize_no_config(void *config, FILE *err_info, joy_init_t *data)
     /* setup the inactive and active timeouts for a flow record */
     flow_record_update_timeouts(data->inact_timeout, data->act_timeout);
 
+    /* the caller's flow table size overrides the pre-setup configuration */
+    if (data->flow_table_size > 0) {
+        glb_config->flow_table_size = data->flow_table_size;
+    }
+    if (data->flow_pool_size > 0) {
+        glb_config->flow_pool_size = data->flow_pool_size;
+    }
+    if (data->max_flows > 0) {
+        glb_config->max_flows = data->max_flows;
+        if (data->flow_evict <= FLOW_EVICT_NOPAYLOAD) {
+            glb_config->flow_evict = data->flow_evict;
+        }
+    }
+    if (data->columnar_file) {
+        if (glb_config->columnar) {
+            free(glb_config->columnar);
+        }
+        glb_config->columnar = strdup(data->columnar_file);
+    }
+    if (data->chunk_rows > 0) {
+        glb_config->chunk_rows = data->chunk_rows;
+    }
+    if (data->compression > 0 && data->compression < ZFILE_COMPRESSION_MAX) {
+        glb_config->compression = data->compression;
+    }
+    if (data->compress_level > 0) {
+        glb_config->compress_level = data->compress_level;
+    }
+    if (data->compress_threads > 0) {
+        glb_config->compress_threads = data->compress_threads;
+    }
+    if (data->ring_file) {
+        if (glb_config->ring_file) {
+            free(glb_config->ring_file);
+        }
+        glb_config->ring_file = strdup(data->ring_file);
+    }
+    if (data->ring_size > 0) {
+        glb_config->ring_size = data->ring_size;
+    }
+    if (data->ring_policy > 0 && data->ring_policy < SHM_RING_NUM_POLICIES) {
+        glb_config->ring_policy = data->ring_policy;
+    }
+    if (data->rotate_bytes > 0) {
+        glb_config->rotate_bytes = data->rotate_bytes;
+    }
+    if (data->rotate_interval > 0) {
+        glb_config->rotate_interval = data->rotate_interval;
+    }
+    if (data->rotate_hook) {
+        if (glb_config->rotate_hook) {
+            free(glb_config->rotate_hook);
+        }
+        glb_config->rotate_hook = strdup(data->rotate_hook);
+    }
+    if (data->rotate_spool) {
+        if (glb_config->rotate_spool) {
+            free(glb_config->rotate_spool);
+        }
+        glb_config->rotate_spool = strdup(data->rotate_spool);
+    }
+    if (data->fields) {
+        if (glb_config->fields) {
+            free(glb_config->fields);
+        }
+        glb_config->fields = strdup(data->fields);
+    }
+    if (joy_compile_print_plan() != ok) {
+        JOY_API_FREE_CONTEXT(ctx_data);
+        return failure;
+    }
+
     /* initialize the protocol identification dictionary */
     if (proto_identify_init()) {
         joy_log_err("could not initialize the protocol identification dictionary");
@@ -676,8 +1170,15 @@ int joy_initialize_no_config(void *config, FILE *err_info, joy_init_t *data)
         /* id the context */
         this->ctx_id = i;
 
-        /* if they haven't specified an output filename, then send to stdout */
-        if (glb_config->filename == NULL) {
+        /* a shared memory ring takes the place of the output file */
+        if (glb_config->ring_file) {
+            this->output = joy_open_ring_output(this->ctx_id);
+            if (this->output == NULL) {
+                JOY_API_FREE_CONTEXT(ctx_data)
+                return failure;
+            }
+        } else if (glb_config->filename == NULL) {
+            /* if they haven't specified an output filename, then send to stdout */
             this->output = zattach(stdout, "w");
         } else {
             /* setup the output file basename for the context */
@@ -711,7 +1212,7 @@ int joy_initialize_no_config(void *config, FILE *err_info, joy_init_t *data)
 
             /* open the output file */
             memset_s(output_filename, MAX_FILENAME_LEN, 0x00, MAX_FILENAME_LEN);
-            if (glb_config->max_records) {
+            if (joy_rotation_enabled()) {
                 format_output_filename(this->output_file_basename, output_filename);
             } else {
                 if (joy_num_contexts == 1) {
@@ -729,9 +1230,20 @@ int joy_initialize_no_config(void *config, FILE *err_info, joy_init_t *data)
                 JOY_API_FREE_CONTEXT(ctx_data)
                 return failure;
             }
+            zasync(this->output);
+            snprintf(this->output_filename, MAX_FILENAME_LEN, "%s", output_filename);
+            this->output_opened = time(NULL);
         }
 
-        flow_record_list_init(this);
+        if (flow_record_list_init(this) != ok) {
+            joy_log_err("could not initialize the flow records of context %d", this->ctx_id);
+            if (glb_config->ring_file || glb_config->filename) {
+                zclose(this->output);
+            }
+            free(this->output_file_basename);
+            JOY_API_FREE_CONTEXT(ctx_data)
+            return failure;
+        }
         flocap_stats_timer_init(this);
     }
 
@@ -777,8 +1289,12 @@ void joy_print_config(uint8_t index, uint8_t format)
         /* print the configuration in the output */
         config_print(info, glb_config);
     } else {
-        /* print the configuration in the output */
+        /* print the configuration in the output, as a record of its own */
+        if (ctx->output == NULL) {
+            return;
+        }
         config_print_json(ctx->output, glb_config);
+        zcommit(ctx->output);
     }
 }
 
@@ -1125,6 +1641,9 @@ void joy_update_ctx_global_time(uint8_t ctx_index,
  *      data feature processing. This APi is useful for applications
  *      that use the JOY library and want to use the libraries default
  *      scheme for dividing up traffic among various worker contexts.
+ *      It only reads the distribution table, so any number of threads
+ *      may call it at once; the packet is not counted in the load of
+ *      its context.
  *
  * Parameters:
  *      packet - pointer to the IP packet data
@@ -1137,8 +1656,7 @@ void joy_update_ctx_global_time(uint8_t ctx_index,
  */
 uint8_t joy_packet_to_context(const unsigned char *packet, uint8_t num_contexts) {
     uint8_t rc = 0;
-    uint8_t context = 0;
-    uint32_t sum = 0;
+    uint32_t hash = 0;
     flow_key_t key;
 
     /* clear the key buffer */
@@ -1150,46 +1668,133 @@ uint8_t joy_packet_to_context(const unsigned char *packet, uint8_t num_contexts)
         joy_log_info("Failed to retrieve the 5-tuple key, using default context 0");
         return 0;
     }
+    if (num_contexts <= 1) {
+        return 0;
+    }
 
-    /* generate a nice hash to use for the 5-tuple. This calcualtion is essentially
-     * a mod 257 on the sum of the 5-tuple. This algortihm also keeps client->server and
-     * server->client flows in the same context.
-     * for IPv4 addresses, the upper 96 bits are zero, so using the IPv6 union of the structure
-     * does not affect the sum or the resulting hash.
-     */
-#ifdef DARWIN
-    sum += (uint32_t)key.sa.v6_sa.__u6_addr.__u6_addr32[0];
-    sum += (uint32_t)key.sa.v6_sa.__u6_addr.__u6_addr32[1];
-    sum += (uint32_t)key.sa.v6_sa.__u6_addr.__u6_addr32[2];
-    sum += (uint32_t)key.sa.v6_sa.__u6_addr.__u6_addr32[3];
-    sum += (uint32_t)key.da.v6_da.__u6_addr.__u6_addr32[0];
-    sum += (uint32_t)key.da.v6_da.__u6_addr.__u6_addr32[1];
-    sum += (uint32_t)key.da.v6_da.__u6_addr.__u6_addr32[2];
-    sum += (uint32_t)key.da.v6_da.__u6_addr.__u6_addr32[3];
-#else
-    sum += (uint32_t)key.sa.v6_sa.__in6_u.__u6_addr32[0];
-    sum += (uint32_t)key.sa.v6_sa.__in6_u.__u6_addr32[1];
-    sum += (uint32_t)key.sa.v6_sa.__in6_u.__u6_addr32[2];
-    sum += (uint32_t)key.sa.v6_sa.__in6_u.__u6_addr32[3];
-    sum += (uint32_t)key.da.v6_da.__in6_u.__u6_addr32[0];
-    sum += (uint32_t)key.da.v6_da.__in6_u.__u6_addr32[1];
-    sum += (uint32_t)key.da.v6_da.__in6_u.__u6_addr32[2];
-    sum += (uint32_t)key.da.v6_da.__in6_u.__u6_addr32[3];
-#endif
-    sum += (uint32_t)key.sp;
-    sum += (uint32_t)key.dp;
-    sum += (uint32_t)key.prot;
-    sum *= 0x6B;
-    sum -= (sum >> 8);
-    sum &= 0xff;
+    hash = rss_hash_flow_key(&key);
+    if (joy_rss_table.num_queues == num_contexts) {
+        return rss_table_queue(&joy_rss_table, hash);
+    }
+    /* the entry a table set up for num_contexts would hold */
+    return (uint8_t)((hash & (RSS_RETA_SIZE - 1)) % num_contexts);
+}
 
-    /* fit the mod 257 hash into the number of contexts configured */
-    context = sum % num_contexts;
+/*
+ * Function: joy_flow_key_to_context
+ *
+ * Description: This function does the work of joy_packet_to_context
+ *      for a caller that has already parsed the 5-tuple key of the
+ *      packet. The key is hashed with a symmetric Toeplitz hash, the
+ *      hash a NIC computes for RSS when set up with the same key, so
+ *      both directions of a flow go to the same context. The low bits
+ *      of the hash select an entry of an indirection table, which
+ *      names the context. When num_contexts is the number the library
+ *      was initialized with, the packet and its length are counted in
+ *      the load of the context, so only the one thread that distributes
+ *      packets may call it; other threads use joy_packet_to_context.
+ *
+ * Parameters:
+ *      key - pointer to the 5-tuple key of the packet
+ *      len - length of the packet, counted in the load of the context
+ *      num_contexts - number of contexts to use for distribution
+ *
+ * Returns:
+ *      context - the context number the packet belongs to for JOY processing.
+ *
+ */
+uint8_t joy_flow_key_to_context(const flow_key_t *key, uint32_t len, uint8_t num_contexts) {
+    uint8_t context = 0;
+    uint32_t hash = 0;
+
+    if (num_contexts <= 1) {
+        return 0;
+    }
+
+    hash = rss_hash_flow_key(key);
+    if (joy_rss_table.num_queues == num_contexts) {
+        context = rss_table_lookup(&joy_rss_table, hash, len);
+    } else {
+        /* the entry a table set up for num_contexts would hold */
+        context = (uint8_t)((hash & (RSS_RETA_SIZE - 1)) % num_contexts);
+    }
 
     joy_log_debug("Packet goes into context (%d)", context);
     return context;
 }
 
+/*
+ * Function: joy_get_context_load
+ *
+ * Description: This function reports how many packets and bytes
+ *      joy_flow_key_to_context has sent to a context since the
+ *      library was initialized.
+ *
+ * Parameters:
+ *      ctx_index - the index number of the JOY context
+ *      packets - filled in with the number of packets
+ *      bytes - filled in with the number of bytes
+ *
+ * Returns:
+ *      none
+ *
+ */
+void joy_get_context_load(uint8_t ctx_index, uint64_t *packets, uint64_t *bytes) {
+    *packets = joy_rss_table.queue_load[ctx_index].packets;
+    *bytes = joy_rss_table.queue_load[ctx_index].bytes;
+}
+
+/*
+ * Function: joy_rebalance_contexts
+ *
+ * Description: This function corrects a lasting imbalance between
+ *      the contexts by moving entries of the indirection table that
+ *      received no packets since the previous call from contexts that
+ *      received over a quarter more packets than the average to the
+ *      least loaded ones. Flows that start later hash to the moved
+ *      entries and go to the quieter contexts. No flow changes
+ *      context as long as calls are further apart than the flow
+ *      inactivity timeout. Must be called from the thread that
+ *      distributes the packets.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      number of table entries moved
+ *
+ */
+unsigned int joy_rebalance_contexts(void) {
+    unsigned int moved = 0;
+
+    if (joy_rss_table.num_queues <= 1) {
+        return 0;
+    }
+    moved = rss_table_rebalance(&joy_rss_table);
+    if (moved) {
+        joy_log_info("moved %u of %u distribution table entries", moved, RSS_RETA_SIZE);
+    }
+    return moved;
+}
+
+/*
+ * Function: joy_get_num_contexts
+ *
+ * Description: This function returns the number of contexts the
+ *      library was initialized with, for the modules that name
+ *      their files per context.
+ *
+ * Parameters:
+ *      none
+ *
+ * Returns:
+ *      number of contexts
+ *
+ */
+uint8_t joy_get_num_contexts(void) {
+    return joy_num_contexts;
+}
+
 /*
  * Function: joy_index_to_context
  *
@@ -1229,6 +1834,49 @@ void* joy_index_to_context(uint8_t ctx_index) {
     return (ctx);
 }
 
+/*
+ * Function: joy_place_context
+ *
+ * Description: This function moves the memory of a context, its flow
+ *      table, flow record pool and output buffers, to a NUMA node.
+ *      Call it before the context processes packets, with the node
+ *      of the CPU that the thread using the context is pinned to;
+ *      memory the context allocates later comes from that thread.
+ *
+ * Parameters:
+ *      ctx_index - index of the context
+ *      node - the NUMA node, see affinity.h
+ *
+ * Returns:
+ *      0 - success
+ *      1 - some of the memory could not be moved
+ *
+ */
+int joy_place_context(uint8_t ctx_index, int node) {
+    joy_ctx_data *ctx = NULL;
+    int rc = ok;
+
+    ctx = joy_index_to_context(ctx_index);
+    if (ctx == NULL) {
+        return failure;
+    }
+
+    if (affinity_place(ctx, sizeof(joy_ctx_data), node) != ok) {
+        rc = failure;
+    }
+    if (flow_record_list_place(ctx, node) != ok) {
+        rc = failure;
+    }
+    if (ctx->output != NULL && zplace(ctx->output, node) != ok) {
+        rc = failure;
+    }
+    if (rc != ok) {
+        joy_log_warn("could not move all the memory of context %d to node %d (%s)",
+                     ctx_index, node, strerror(errno));
+    }
+    return rc;
+}
+
 /*
  * Function: joy_process_packet
  *
@@ -1378,29 +2026,32 @@ void joy_libpcap_process_packet(unsigned char *ctx_index,
 
 
 /*
- * Function: joy_print_flow_data
- *
- * Description: This function is prints out the flow data from
- *      the Joy data structures to the output destination specified
- *      in the joy_initialize call. The output is formatted as
- *      Joy JSON objects.
- *
- *      Part this operation will check to see if there is any
- *      host flow data to collect, if the option is turned on.
+ * Function: joy_process_packet_burst
  *
- *      This function will remove the records that are printed from
- *      the flow record list.
+ * Description: This function processes a burst of packets for one
+ *      context, with the same result as passing each of them to
+ *      joy_libpcap_process_packet in turn. The library and context
+ *      checks are made once for the burst, and the flow table lookups
+ *      of the packets are overlapped: every packet's 5-tuple is parsed
+ *      and hashed, and its flow table slot and record prefetched,
+ *      before the packets are processed.
  *
  * Parameters:
- *      index - index of the context to use
- *      type - JOY_EXPIRED_FLOWS or JOY_PRINT_ALL_FLOWS
+ *      ctx_index - index of the thread context to use
+ *      headers - libpcap headers of the packets
+ *      packets - the packets; NULL entries are skipped
+ *      num_packets - number of packets in the burst
  *
  * Returns:
  *      none
  *
  */
-void joy_print_flow_data(uint8_t index, joy_flow_type_e type)
+void joy_process_packet_burst(unsigned char *ctx_index,
+                              const struct pcap_pkthdr **headers,
+                              const unsigned char **packets,
+                              unsigned int num_packets)
 {
+    uint64_t index = 0;
     joy_ctx_data *ctx = NULL;
 
     /* check library initialization */
@@ -1409,10 +2060,46 @@ void joy_print_flow_data(uint8_t index, joy_flow_type_e type)
         return;
     }
 
+    /* make sure we have packets to process */
+    if (headers == NULL || packets == NULL || num_packets == 0) {
+        return;
+    }
+
+    /* ctx_index has the int value of the data context
+     * This number is between 0 and max configured contexts
+     */
+    index = (uint64_t)ctx_index;
+
+    /* sanity check the index being used */
+    if (index >= joy_num_contexts ) {
+        joy_log_crit("Joy Library invalid context (%d) for packet processing!", (uint8_t)index);
+        return;
+    }
+
+    ctx = JOY_CTX_AT_INDEX(ctx_data,index);
+    process_packet_burst((unsigned char*)ctx, headers, packets, num_packets);
+}
+
+/*
+ * Prints out the flow records of a context, at most max_flows of the
+ * expired ones (0 for no limit), and rotates the output files when
+ * they are due.  Returns the number of expired records still waiting.
+ */
+static unsigned int joy_print_flows(uint8_t index, joy_flow_type_e type, unsigned int max_flows)
+{
+    joy_ctx_data *ctx = NULL;
+    unsigned int num_waiting = 0;
+
+    /* check library initialization */
+    if (!joy_library_initialized) {
+        joy_log_crit("Joy Library has not been initialized!");
+        return 0;
+    }
+
     /* sanity check the index value */
     if (index >= joy_num_contexts ) {
         joy_log_crit("Joy Library invalid context (%d) for packet processing!", index);
-        return;
+        return 0;
     }
 
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
@@ -1426,27 +2113,154 @@ void joy_print_flow_data(uint8_t index, joy_flow_type_e type)
     }
 
     /* print the flow records */
-    flow_record_list_print_json(ctx, type);
+    if (type == JOY_EXPIRED_FLOWS) {
+        num_waiting = flow_record_list_print_expired(ctx, max_flows);
+    } else {
+        flow_record_list_print_json(ctx, type);
+    }
 
     /* see if we need to rotate the output files */
-    if ((glb_config->max_records) && (glb_config->filename)) {
-        if (ctx->records_in_file >= glb_config->max_records) {
+    if (joy_rotation_enabled() && (glb_config->filename) && (ctx->output)) {
+        time_t now = time(NULL);
+
+        if (ctx->output_opened == 0) {
+            ctx->output_opened = now;
+        }
+        if ((ctx->records_in_file > 0) &&
+            ((glb_config->max_records && ctx->records_in_file >= glb_config->max_records) ||
+             (glb_config->rotate_bytes && zbytes(ctx->output) >= glb_config->rotate_bytes) ||
+             (glb_config->rotate_interval && now - ctx->output_opened >= (time_t)glb_config->rotate_interval))) {
             char output_filename[MAX_FILENAME_LEN];
+            zfile output = NULL;
 
-            zclose(ctx->output);
-            ctx->records_in_file = 0;
+            /* open the new file first, so records keep flowing if it fails */
             memset_s(output_filename, MAX_FILENAME_LEN, 0x00, MAX_FILENAME_LEN);
             format_output_filename(ctx->output_file_basename, output_filename);
-            ctx->output = zopen(output_filename, "w");
-            if (ctx->output == NULL) {
+            output = zopen(output_filename, "w");
+            if (output == NULL) {
                 joy_log_err("could not open output file %s (%s)", output_filename, strerror(errno));
                 joy_log_err("Rolling the output file failed!");
-                return;
+                return num_waiting;
             }
+            zasync(output);
+
+            /* the old file is finished in the background */
+            joy_rotate_output_file(ctx->output, ctx->output_filename);
+            ctx->output = output;
+            snprintf(ctx->output_filename, MAX_FILENAME_LEN, "%s", output_filename);
+            ctx->output_opened = now;
+            ctx->records_in_file = 0;
+
             /* print new JSON preamble */
             joy_print_config(index, JOY_JSON_FORMAT);
         }
     }
+    return num_waiting;
+}
+
+/*
+ * Function: joy_print_flow_data
+ *
+ * Description: This function is prints out the flow data from
+ *      the Joy data structures to the output destination specified
+ *      in the joy_initialize call. The output is formatted as
+ *      Joy JSON objects.
+ *
+ *      Part this operation will check to see if there is any
+ *      host flow data to collect, if the option is turned on.
+ *
+ *      This function will remove the records that are printed from
+ *      the flow record list.
+ *
+ * Parameters:
+ *      index - index of the context to use
+ *      type - JOY_EXPIRED_FLOWS or JOY_PRINT_ALL_FLOWS
+ *
+ * Returns:
+ *      none
+ *
+ */
+void joy_print_flow_data(uint8_t index, joy_flow_type_e type)
+{
+    joy_print_flows(index, type, 0);
+}
+
+/*
+ * Function: joy_print_expired_flows
+ *
+ * Description: This function prints out the expired flow records
+ *      of a context as joy_print_flow_data does with
+ *      JOY_EXPIRED_FLOWS, but stops after max_flows of them, so
+ *      that a burst of expirations is spread over several calls.
+ *      The records past max_flows are the first to be printed by
+ *      the next call.
+ *
+ * Parameters:
+ *      index - index of the context to use
+ *      max_flows - most flow records to print, or 0 for no limit
+ *
+ * Returns:
+ *      number of expired flow records still waiting to be printed
+ *
+ */
+unsigned int joy_print_expired_flows(uint8_t index, unsigned int max_flows)
+{
+    return joy_print_flows(index, JOY_EXPIRED_FLOWS, max_flows);
+}
+
+/*
+ * Function: joy_set_flow_export_callback
+ *
+ * Description: This function installs a callback that is handed
+ *      each flow just before it is deleted, with a read-only view
+ *      of the whole bidirectional flow.
+ *
+ *      With JOY_EXPORT_NO_OUTPUT, the flow records are no longer
+ *      formatted and written to the output, and the output files
+ *      that nothing has been written to yet are closed and removed.
+ *      Standard output and the shared memory ring are left open.
+ *
+ * Parameters:
+ *      callback_fn - function that gets the flows, or NULL to remove it
+ *      arg - passed on to the callback
+ *      flags - JOY_EXPORT_NO_OUTPUT or 0
+ *
+ * Returns:
+ *      0 - success
+ *      1 - failure
+ *
+ */
+int joy_set_flow_export_callback(joy_flow_export_callback callback_fn,
+                                 void *arg,
+                                 uint32_t flags)
+{
+    joy_ctx_data *ctx = NULL;
+    unsigned int i;
+
+    /* check library initialization */
+    if (!joy_library_initialized) {
+        joy_log_crit("Joy Library has not been initialized!");
+        return failure;
+    }
+
+    flow_record_set_export(callback_fn, arg, !(flags & JOY_EXPORT_NO_OUTPUT));
+    if (callback_fn == NULL || !(flags & JOY_EXPORT_NO_OUTPUT)) {
+        return ok;
+    }
+
+    /* drop the output files that are not going to be written */
+    for (i = 0; i < joy_num_contexts; i++) {
+        ctx = JOY_CTX_AT_INDEX(ctx_data,i);
+        if (ctx->output && ctx->output_filename[0] && zbytes(ctx->output) == 0) {
+            zclose(ctx->output);
+            ctx->output = NULL;
+            if (remove(ctx->output_filename) != 0) {
+                joy_log_warn("could not remove output file %s (%s)", ctx->output_filename, strerror(errno));
+            }
+            ctx->output_filename[0] = 0;
+        }
+    }
+    return ok;
 }
 
 /*
@@ -1573,9 +2387,9 @@ void joy_idp_external_processing(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records and let the callback function process */
-    rec = ctx->flow_record_chrono_first;
-    while (rec != NULL) {
+    /* go through the queued records and let the callback function process */
+    flow_queue_prepare(ctx, FLOW_QUEUE_IDP, 0);
+    while ((rec = flow_queue_pop(ctx, FLOW_QUEUE_IDP)) != NULL) {
 
         /* see if this record has IDP information or is expired */
         if ((rec->idp_ext_processed == 0) &&
@@ -1587,10 +2401,8 @@ void joy_idp_external_processing(uint8_t index,
 
             /* mark the IDP data as being processed */
             rec->idp_ext_processed = 1;
+            flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
         }
-
-        /* go to next record */
-        rec = rec->time_next;
     }
 }
 
@@ -1639,9 +2451,9 @@ void joy_tls_external_processing(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records and let the callback function process */
-    rec = ctx->flow_record_chrono_first;
-    while (rec != NULL) {
+    /* go through the queued records and let the callback function process */
+    flow_queue_prepare(ctx, FLOW_QUEUE_TLS, 0);
+    while ((rec = flow_queue_pop(ctx, FLOW_QUEUE_TLS)) != NULL) {
 
         /* see if this record has TLS information */
         if ((rec->tls_ext_processed == 0) && (rec->tls != NULL)) {
@@ -1653,6 +2465,7 @@ void joy_tls_external_processing(uint8_t index,
 
                 /* mark the TLS data as being processed */
                 rec->tls_ext_processed = 1;
+                flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
             }
         }
 
@@ -1667,10 +2480,8 @@ void joy_tls_external_processing(uint8_t index,
 
             /* mark the TLS data as being processed */
             rec->tls_ext_processed = 1;
+            flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
         }
-
-        /* go to next record */
-        rec = rec->time_next;
     }
 }
 
@@ -1742,9 +2553,9 @@ void joy_splt_external_processing(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records and let the callback function process */
-    rec = ctx->flow_record_chrono_first;
-    while (rec != NULL) {
+    /* go through the queued records and let the callback function process */
+    flow_queue_prepare(ctx, FLOW_QUEUE_SPLT, min_pkts);
+    while ((rec = flow_queue_pop(ctx, FLOW_QUEUE_SPLT)) != NULL) {
 
         /* clean up the formatted data structures */
         data_len = 0;
@@ -1759,17 +2570,17 @@ void joy_splt_external_processing(uint8_t index,
                 float score = 0.0;
 
                 if (rec->twin) {
-                    score = classify(rec->pkt_len, rec->pkt_time, rec->twin->pkt_len, rec->twin->pkt_time,
+                    score = classify(flow_record_splt(rec), flow_record_splt(rec->twin),
                                              rec->start, rec->twin->start,
                                              glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
                                              rec->ob, rec->twin->ob, glb_config->byte_distribution,
-                                             rec->byte_count, rec->twin->byte_count);
+                                             flow_record_bd(rec)->byte_count, flow_record_bd(rec->twin)->byte_count);
                     rec->twin->classify_value = score;
                 } else {
-                    score = classify(rec->pkt_len, rec->pkt_time, NULL, NULL,   rec->start, rec->start,
+                    score = classify(flow_record_splt(rec), NULL, rec->start, rec->start,
                                              glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
                                              rec->ob, 0, glb_config->byte_distribution,
-                                             rec->byte_count, NULL);
+                                             flow_record_bd(rec)->byte_count, NULL);
                     rec->classify_value = score;
                 }
             }
@@ -1787,10 +2598,8 @@ void joy_splt_external_processing(uint8_t index,
 
             /* mark the SPLT data as being processed */
             rec->splt_ext_processed = 1;
+            flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
         }
-
-        /* go to next record */
-        rec = rec->time_next;
     }
 }
 
@@ -1862,9 +2671,9 @@ void joy_salt_external_processing(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records and let the callback function process */
-    rec = ctx->flow_record_chrono_first;
-    while (rec != NULL) {
+    /* go through the queued records and let the callback function process */
+    flow_queue_prepare(ctx, FLOW_QUEUE_SALT, min_pkts);
+    while ((rec = flow_queue_pop(ctx, FLOW_QUEUE_SALT)) != NULL) {
 
         /* clean up the formatted data structures */
         data_len = 0;
@@ -1882,6 +2691,7 @@ void joy_salt_external_processing(uint8_t index,
 
                 /* mark the SALT data as being processed */
                 rec->salt_ext_processed = 1;
+                flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
             }
         }
 
@@ -1899,10 +2709,8 @@ void joy_salt_external_processing(uint8_t index,
 
             /* mark the SALT data as being processed */
             rec->salt_ext_processed = 1;
+            flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
         }
-
-        /* go to next record */
-        rec = rec->time_next;
     }
 }
 
@@ -1969,9 +2777,9 @@ void joy_bd_external_processing(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records and let the callback function process */
-    rec = ctx->flow_record_chrono_first;
-    while (rec != NULL) {
+    /* go through the queued records and let the callback function process */
+    flow_queue_prepare(ctx, FLOW_QUEUE_BD, min_octets);
+    while ((rec = flow_queue_pop(ctx, FLOW_QUEUE_BD)) != NULL) {
 
         /* clean up the formatted data structures */
         data_len = 0;
@@ -1988,10 +2796,8 @@ void joy_bd_external_processing(uint8_t index,
 
             /* mark the BD data as being processed */
             rec->bd_ext_processed = 1;
+            flow_queue_push(ctx, rec, FLOW_QUEUE_PROCESSED);
         }
-
-        /* go to next record */
-        rec = rec->time_next;
     }
 }
 
@@ -2036,8 +2842,15 @@ unsigned int joy_delete_flow_records(uint8_t index,
     /* get the correct context */
     ctx = JOY_CTX_AT_INDEX(ctx_data,index);
 
-    /* go through the records */
-    rec = ctx->flow_record_chrono_first;
+    /*
+     * go through the records; unless every record is to be deleted,
+     * only those handed to an external processing call can qualify
+     */
+    if (cond_bitmask != 0) {
+        rec = ctx->flow_queue[FLOW_QUEUE_PROCESSED].first;
+    } else {
+        rec = ctx->flow_record_chrono_first;
+    }
     while (rec != NULL) {
         /* figure out what has been procssed in this record */
         ok_to_delete = 0;
@@ -2058,7 +2871,11 @@ unsigned int joy_delete_flow_records(uint8_t index,
         }
 
         /* remove the record and advance to next record */
-        next_rec = rec->time_next;
+        if (cond_bitmask != 0) {
+            next_rec = rec->queue_link[FLOW_QUEUE_PROCESSED].next;
+        } else {
+            next_rec = rec->time_next;
+        }
         /* see if cond flags are set */
         if ((ok_to_delete & cond_bitmask) == cond_bitmask) {
             remove_record_and_update_list(ctx,rec);
@@ -2187,9 +3004,14 @@ void joy_context_cleanup(uint8_t index)
     /* free up the flow records */
     flow_record_list_free(ctx);
  
-    /* close the output file */
+    /* close the output file, handing it on as a rotated one would be */
     if (ctx->output) {
-        zclose(ctx->output);
+        if (glb_config->filename && ctx->output_filename[0]) {
+            joy_finish_output_file(ctx->output, ctx->output_filename);
+            ctx->output_filename[0] = 0;
+        } else {
+            zclose(ctx->output);
+        }
         ctx->output = NULL;
     }
     if (ctx->output_file_basename) {
@@ -2229,6 +3051,9 @@ void joy_shutdown(void)
         joy_context_cleanup(i);
     }
 
+    /* wait for the rotated output files to be finished */
+    joy_rotate_drain();
+
     /* free up the memory for the contexts */
     JOY_API_FREE_CONTEXT(ctx_data)
 
@@ -2248,6 +3073,17 @@ void joy_shutdown(void)
     if (glb_config->ipfix_export_remote_host) free((void*)glb_config->ipfix_export_remote_host);
     if (glb_config->ipfix_export_template) free((void*)glb_config->ipfix_export_template);
     if (glb_config->aux_resource_path) free((void*)glb_config->aux_resource_path);
+    if (glb_config->columnar) free((void*)glb_config->columnar);
+    if (glb_config->rotate_hook) free((void*)glb_config->rotate_hook);
+    if (glb_config->rotate_spool) free((void*)glb_config->rotate_spool);
+    if (glb_config->ring_file) free((void*)glb_config->ring_file);
+    if (glb_config->fields) free((void*)glb_config->fields);
+    if (glb_config->capture_cpus) free((void*)glb_config->capture_cpus);
+    if (glb_config->worker_cpus) free((void*)glb_config->worker_cpus);
+    print_plan_free(glb_config->plan);
+
+    /* forget the flow export callback */
+    flow_record_set_export(NULL, NULL, 1);
 
     /* free up the subnet labels if we have any */
     for (i=0; i < glb_config->num_subnets; ++i)
@@ -46,6 +46,7 @@
 #include <stdio.h>
 #include "safe_lib.h"
 #include "pcap.h"
+#include "pkt.h"
 #include "joy_api.h"
 
 char packet1[] = {0x08,0x00,0x27,0x36,0x24,0xd6,0x08,0x00,0x27,0xd8,0xca,0x49,0x08,0x00,0x45,0x00,0x00,0x3c,0x9d,0xb7,0x40,0x00,0x40,0x06,0xaa,0xe8,0xc0,0xa8,0x39,0x65,0xc0,0xa8,0x39,0x66,0xb1,0x6e,0x01,0xbb,0x20,0x0c,0xd4,0xba,0x00,0x00,0x00,0x00,0xa0,0x02,0x72,0x10,0xf2,0x4a,0x00,0x00,0x02,0x04,0x05,0xb4,0x04,0x02,0x08,0x0a,0x00,0x04,0x49,0x0d,0x00,0x00,0x00,0x00,0x01,0x03,0x03,0x07};
@@ -190,6 +191,27 @@ void my_splt_callback(void *curr_rec, unsigned int data_len, unsigned char *data
     printf("\n");
 }
 
+void my_flow_export_callback(const flow_view_t *view, void *arg) {
+    char sa[INET6_ADDRSTRLEN], da[INET6_ADDRSTRLEN];
+
+    (void)arg;
+    if (view->ip_type == ETH_TYPE_IPV6) {
+        inet_ntop(AF_INET6, &view->key.sa.v6_sa, sa, sizeof(sa));
+        inet_ntop(AF_INET6, &view->key.da.v6_da, da, sizeof(da));
+    } else {
+        inet_ntop(AF_INET, &view->key.sa.v4_sa, sa, sizeof(sa));
+        inet_ntop(AF_INET, &view->key.da.v4_da, da, sizeof(da));
+    }
+    printf("FLOW %s:%u -> %s:%u (%u): %u/%u packets, %u/%u bytes",
+           sa, view->key.sp, da, view->key.dp, view->key.prot,
+           view->num_pkts[FLOW_VIEW_OUT], view->num_pkts[FLOW_VIEW_IN],
+           view->bytes[FLOW_VIEW_OUT], view->bytes[FLOW_VIEW_IN]);
+    if (view->tls[FLOW_VIEW_OUT] != NULL && view->tls[FLOW_VIEW_OUT]->version) {
+        printf(", TLS with %u ciphersuites offered", view->tls[FLOW_VIEW_OUT]->num_ciphersuites);
+    }
+    printf("\n");
+}
+
 int main (void)
 {
     int rc = 0;
@@ -220,6 +242,9 @@ int main (void)
     /* print out the config */
     joy_print_config(0,JOY_JSON_FORMAT);
 
+    /* see each flow as it is exported */
+    joy_set_flow_export_callback(my_flow_export_callback, NULL, 0);
+
     /* process the hardcoded packets */
     process_hardcoded_packets(0); /* just using 1 context -> 0 */
     
@@ -205,7 +205,8 @@ static void nfv9_process_times (flow_record_t *nf_record,
             int repeated_length = tmp_packet_length * -1 - 1;
             while (repeated_length > 0) {
                 if (pkt_time_index < MAX_NUM_PKT_LEN) {
-                    nf_record->pkt_time[pkt_time_index] = *old_val_time;
+                    joy_timer_series_set(&nf_record->splt->start, nf_record->splt->pkt_time,
+                                         pkt_time_index, old_val_time);
                     pkt_time_index++;
                 } else {
                     break;
@@ -226,7 +227,8 @@ static void nfv9_process_times (flow_record_t *nf_record,
             }
       
             if (pkt_time_index < MAX_NUM_PKT_LEN) {
-                nf_record->pkt_time[pkt_time_index] = *old_val_time;
+                joy_timer_series_set(&nf_record->splt->start, nf_record->splt->pkt_time,
+                                         pkt_time_index, old_val_time);
                 pkt_time_index++;
             } else {
                 break;
@@ -238,7 +240,8 @@ static void nfv9_process_times (flow_record_t *nf_record,
             int k;
             for (k = 0; k < repeated_times; k++) {
                 if (pkt_time_index < MAX_NUM_PKT_LEN) {
-                    nf_record->pkt_time[pkt_time_index] = *old_val_time;
+                    joy_timer_series_set(&nf_record->splt->start, nf_record->splt->pkt_time,
+                                         pkt_time_index, old_val_time);
                     pkt_time_index++;
                 } else {
                     break;
@@ -263,7 +266,7 @@ static void nfv9_process_lengths (flow_record_t *nf_record,
             }
             old_val = tmp_packet_length;
             if (pkt_len_index < MAX_NUM_PKT_LEN) {
-                nf_record->pkt_len[pkt_len_index] = tmp_packet_length;
+                nf_record->splt->pkt_len[pkt_len_index] = tmp_packet_length;
                 pkt_len_index++;
             } else {
                 break;
@@ -280,7 +283,7 @@ static void nfv9_process_lengths (flow_record_t *nf_record,
             int k;
             for (k = 0; k < repeated_length; k++) {
                 if (pkt_len_index < MAX_NUM_PKT_LEN) {
-                    nf_record->pkt_len[pkt_len_index] = old_val;
+                    nf_record->splt->pkt_len[pkt_len_index] = old_val;
                     pkt_len_index++;
                 } else {
                     break;
@@ -465,7 +468,7 @@ void nfv9_process_flow_record (flow_record_t *nf_record,
 			       const char *flow_data, int record_num) {
 
     const struct pcap_pkthdr *header = NULL;   /* dummy */
-    struct timeval old_val_time;
+    struct timeval old_val_time, record_time;
     unsigned int total_ms = 0;
     const unsigned char *payload = NULL;
     unsigned int size_payload = 0;
@@ -543,8 +546,9 @@ void nfv9_process_flow_record (flow_record_t *nf_record,
                     }
 
                     nf_record->tls->lengths[j] = htons(*(const unsigned short *)(flow_data+j*2));
-                    nf_record->tls->times[j].tv_sec = (total_ms+htons(*(const unsigned short *)(flow_data+40+j*2))+nf_record->start.tv_sec*1000+nf_record->start.tv_usec/1000)/1000;
-                    nf_record->tls->times[j].tv_usec = ((total_ms+htons(*(const unsigned short *)(flow_data+40+j*2))+nf_record->start.tv_sec*1000+nf_record->start.tv_usec/1000)%1000)*1000;
+                    record_time.tv_sec = (total_ms+htons(*(const unsigned short *)(flow_data+40+j*2))+nf_record->start.tv_sec*1000+nf_record->start.tv_usec/1000)/1000;
+                    record_time.tv_usec = ((total_ms+htons(*(const unsigned short *)(flow_data+40+j*2))+nf_record->start.tv_sec*1000+nf_record->start.tv_usec/1000)%1000)*1000;
+                    joy_timer_series_set(&nf_record->tls->start, nf_record->tls->times, j, &record_time);
                     total_ms += htons(*(const unsigned short *)(flow_data+40+j*2));
 
                     nf_record->tls->msg_stats[j].content_type = *(const unsigned char *)(flow_data+80+j);
@@ -716,14 +720,19 @@ void nfv9_process_flow_record (flow_record_t *nf_record,
                 int pkt_len_index = nf_record->op;
                 int pkt_time_index = nf_record->op;
 
+                if (flow_record_attach_splt(nf_record) == NULL) {
+                    flow_data += htons(cur_template->fields[i].FieldLength);
+                    break;
+                }
+
                 // process the lengths array in the SPLT data
                 nfv9_process_lengths(nf_record, length_data, max_length_array, pkt_len_index);
 
                 // initialize the time <- this is where we should use the nfv9 timestamp
         
                 if (pkt_time_index > 0) {
-                    old_val_time.tv_sec = nf_record->pkt_time[pkt_time_index-1].tv_sec;
-                    old_val_time.tv_usec = nf_record->pkt_time[pkt_time_index-1].tv_usec;
+                    joy_timer_series_get(&nf_record->splt->start, nf_record->splt->pkt_time,
+                                         pkt_time_index-1, &old_val_time);
                 } else {
                     old_val_time.tv_sec = nf_record->start.tv_sec;
                     old_val_time.tv_usec = nf_record->start.tv_usec;
@@ -739,16 +748,20 @@ void nfv9_process_flow_record (flow_record_t *nf_record,
             case BYTE_DISTRIBUTION: ;
                 field_length = htons(cur_template->fields[i].FieldLength);
                 bytes_per_val = field_length/256;
+                if (flow_record_attach_bd(nf_record) == NULL) {
+                    flow_data += field_length;
+                    break;
+                }
                 for (j = 0; j < 256; j++) { 
                     // 1 byte vals
                     if (bytes_per_val == 1) {
-                        nf_record->byte_count[j] = (int)*(const char *)(flow_data+j*bytes_per_val);
+                        nf_record->bd->byte_count[j] = (int)*(const char *)(flow_data+j*bytes_per_val);
                     } else if (bytes_per_val == 2) {
                         // 2 byte vals
-                        nf_record->byte_count[j] = htons(*(const short *)(flow_data+j*bytes_per_val));  
+                        nf_record->bd->byte_count[j] = htons(*(const short *)(flow_data+j*bytes_per_val));  
                     } else {
                         // 4 byte vals
-                        nf_record->byte_count[j] = htonl(*(const int *)(flow_data+j*bytes_per_val));
+                        nf_record->bd->byte_count[j] = htonl(*(const int *)(flow_data+j*bytes_per_val));
                     }
                 }
 
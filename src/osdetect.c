@@ -57,7 +57,8 @@ void os_printf (zfile f, int ttl, int iws, int ttl_twin, int iws_twin) {
     detect_os(ttl, iws, os_name, sizeof(os_name));
 
     if (*os_name) {
-        zprintf(f, ",\"probable_os\":{\"out\":\"%s\"", os_name);
+        zputs(f, ",\"probable_os\":{\"out\":");
+        zprint_json_string(f, os_name);
         empty = 0;
     }
     if (ttl_twin) {
@@ -65,16 +66,18 @@ void os_printf (zfile f, int ttl, int iws, int ttl_twin, int iws_twin) {
         detect_os(ttl_twin, iws_twin, os_name, sizeof(os_name));
         if (*os_name) {
             if (empty) {
-                zprintf(f, ",\"probable_os\":{\"in\":\"%s\"", os_name);
+                zputs(f, ",\"probable_os\":{\"in\":");
+                zprint_json_string(f, os_name);
                 empty = 0;
             } else {
-                zprintf(f, ",\"in\":\"%s\"", os_name);
+                zputs(f, ",\"in\":");
+                zprint_json_string(f, os_name);
             }
         }
     }
 
     if (! empty) {
-        zprintf(f, "}");
+        zputc(f, '}');
     }
 }
 
@@ -0,0 +1,2398 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file output.c
+ *
+ * \brief output streams for JSON data, optionally compressed, and
+ *        optionally written out by a thread of their own
+ *
+ * A stream appends its data to a buffer in memory, either formatted
+ * by zprintf() or by the writers for integers, strings, hex and
+ * timestamps, which avoid parsing a format.  A synchronous stream
+ * passes its buffer to the compressor and the file at the end of each
+ * record, or when the buffer fills up.  Once zasync() has been called
+ * on a stream, data is collected in large buffers instead, and full
+ * buffers are queued for a writer thread that owns the compressor and
+ * the file, so the thread producing the data does not wait on
+ * compression or on the disk.
+ *
+ * A stream switched to the binary format by zbinary() encodes what
+ * the writers are called with as the tokens described in binrec.h,
+ * one length-prefixed record per zcommit(), instead of formatting it.
+ *
+ * The compressor is picked when a stream is opened, from the backends
+ * the build includes (none, gzip, bzip2, zstd and lz4), and zread_open()
+ * reads a file back with whichever of them wrote it.
+ *
+ * A stream opened by zopen_ring() writes into a ring in shared memory
+ * instead, see shm_ring.h; it stays synchronous and publishes each
+ * record whole at zcommit().
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "output.h"
+#include "binrec.h"
+#include "shm_ring.h"
+#include "affinity.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+#if defined(USE_GZIP) || ((COMPRESSED_OUTPUT != 0) && !defined(USE_BZIP2))
+#define ZFILE_HAVE_GZIP 1
+#include <zlib.h>
+#endif
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4frame.h>
+#endif
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/* data buffered by an asynchronous stream before it is queued */
+#define ZFILE_BUF_SIZE (1024 * 1024)
+
+/* most buffers an asynchronous stream may have, queued or filling */
+#define ZFILE_MAX_BUFS 16
+
+/* seconds data may sit in a partly filled buffer; see zcommit() */
+#define ZFILE_COMMIT_INTERVAL 1
+
+/* size of the buffer of a synchronous stream */
+#define ZFILE_SYNC_BUF_SIZE 4096
+
+/** a buffer of formatted data */
+typedef struct zfile_buf_ {
+    struct zfile_buf_ *next;
+    size_t len;                         /*!< bytes of data                      */
+    size_t size;                        /*!< bytes of storage                   */
+    char data[];
+} zfile_buf_t;
+
+struct zfile_ {
+    const struct zfile_backend_ *backend;
+    void *handle;                       /*!< the compressor, or the file        */
+    FILE *fp;                           /*!< the file, for zstd and lz4         */
+    unsigned char *zbuf;                /*!< compressed data, for zstd and lz4  */
+    size_t zbuf_size;
+    zfile_buf_t *cur;                   /*!< buffer being filled                */
+    int async;                          /*!< a writer thread owns the handle    */
+    int framed;                         /*!< records are written out whole      */
+    time_t last_commit;                 /*!< when cur was last handed over      */
+
+    /* shared with the writer thread, under lock */
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;                /*!< signalled when a buffer is queued  */
+    pthread_cond_t done;                /*!< signalled when a buffer is written */
+    zfile_buf_t *queue;                 /*!< full buffers, oldest first         */
+    zfile_buf_t **queue_tail;
+    zfile_buf_t *free_list;             /*!< written buffers, for reuse         */
+    unsigned int num_bufs;              /*!< buffers allocated                  */
+    int busy;                           /*!< the writer is writing a buffer     */
+    int stop;                           /*!< the writer should exit once idle   */
+    int error;                          /*!< a write failed                     */
+    zfile_stats_t stats;
+
+    /* binary format, see zbinary() */
+    int binary;
+    zfile_buf_t *rec;                   /*!< tokens of the record being written */
+    zfile_buf_t *text;                  /*!< text not yet made into a token     */
+    struct zfile_intern_ *intern;
+};
+
+/* slots of the hash table of an intern table, a power of two */
+#define ZFILE_INTERN_SLOTS (2 * BINREC_INTERN_MAX)
+
+/** the texts and strings interned in a binary stream */
+typedef struct zfile_intern_ {
+    uint16_t slot[ZFILE_INTERN_SLOTS];  /*!< entry + 1, or 0 if free            */
+    uint32_t off[BINREC_INTERN_MAX];    /*!< where each entry starts in data    */
+    uint16_t len[BINREC_INTERN_MAX];
+    unsigned int num;                   /*!< entries in use                     */
+    unsigned int used;                  /*!< bytes of data in use               */
+    char data[BINREC_INTERN_BYTES];
+} zfile_intern_t;
+
+/*
+ * the compressors
+ *
+ * Each backend writes the data of a stream to its file, compressing
+ * it on the way; zopen_compressed() picks one at run time.  zstd and
+ * lz4 are driven through their streaming APIs onto a stdio file, and
+ * gzip and bzip2 through the file APIs of their libraries.
+ */
+
+/** the operations of a compression backend */
+typedef struct zfile_backend_ {
+    int (*open) (zfile f, const char *fname, FILE *fp, const char *mode,
+                 int level, unsigned int threads);
+    int (*write) (zfile f, const char *data, size_t len);
+    int (*flush) (zfile f);
+    int (*close) (zfile f);
+} zfile_backend_t;
+
+static const char *zfile_compression_names[ZFILE_COMPRESSION_MAX] = {
+    "default", "none", "gzip", "bzip2", "zstd", "lz4"
+};
+
+static const char *zfile_compression_suffixes[ZFILE_COMPRESSION_MAX] = {
+    "", "", ".gz", ".bz2", ".zst", ".lz4"
+};
+
+/* the stdio stream a backend writes to: the named file, or fp */
+static FILE *zfile_fopen (const char *fname, FILE *fp, const char *mode) {
+    if (fname == NULL) {
+        return fp;
+    }
+    return fopen(fname, mode);
+}
+
+static int zfile_none_open (zfile f, const char *fname, FILE *fp, const char *mode,
+                            int level, unsigned int threads) {
+    (void)level;
+    (void)threads;
+    f->handle = zfile_fopen(fname, fp, mode);
+    return (f->handle != NULL) ? ok : failure;
+}
+
+static int zfile_none_write (zfile f, const char *data, size_t len) {
+    return (fwrite(data, 1, len, (FILE *)f->handle) == len) ? ok : failure;
+}
+
+static int zfile_none_flush (zfile f) {
+    return fflush((FILE *)f->handle);
+}
+
+static int zfile_none_close (zfile f) {
+    return fclose((FILE *)f->handle);
+}
+
+static const zfile_backend_t zfile_none = {
+    zfile_none_open, zfile_none_write, zfile_none_flush, zfile_none_close
+};
+
+#if defined(ZFILE_HAVE_GZIP) || defined(USE_BZIP2)
+/* mode with the compression level appended, as gzopen() and BZ2_bzopen() take it */
+static const char *zfile_level_mode (char *buf, size_t size, const char *mode, int level) {
+    if (level < 1 || level > 9) {
+        return mode;
+    }
+    snprintf(buf, size, "%s%d", mode, level);
+    return buf;
+}
+#endif
+
+#ifdef ZFILE_HAVE_GZIP
+static int zfile_gzip_open (zfile f, const char *fname, FILE *fp, const char *mode,
+                            int level, unsigned int threads) {
+    char buf[16];
+
+    (void)threads;
+    mode = zfile_level_mode(buf, sizeof(buf), mode, level);
+    if (fname != NULL) {
+        f->handle = gzopen(fname, mode);
+    } else {
+#ifdef WIN32
+        f->handle = gzdopen(_fileno(fp), mode);
+#else
+        f->handle = gzdopen(fileno(fp), mode);
+#endif
+    }
+    return (f->handle != NULL) ? ok : failure;
+}
+
+static int zfile_gzip_write (zfile f, const char *data, size_t len) {
+    return (gzwrite((gzFile)f->handle, data, (unsigned int)len) == (int)len) ? ok : failure;
+}
+
+static int zfile_gzip_flush (zfile f) {
+    return gzflush((gzFile)f->handle, Z_SYNC_FLUSH);
+}
+
+static int zfile_gzip_close (zfile f) {
+    return gzclose((gzFile)f->handle);
+}
+
+static const zfile_backend_t zfile_gzip = {
+    zfile_gzip_open, zfile_gzip_write, zfile_gzip_flush, zfile_gzip_close
+};
+#endif
+
+#ifdef USE_BZIP2
+static int zfile_bzip2_open (zfile f, const char *fname, FILE *fp, const char *mode,
+                             int level, unsigned int threads) {
+    char buf[16];
+
+    (void)threads;
+    mode = zfile_level_mode(buf, sizeof(buf), mode, level);
+    if (fname != NULL) {
+        f->handle = BZ2_bzopen(fname, mode);
+    } else {
+#ifdef WIN32
+        f->handle = BZ2_bzdopen(_fileno(fp), mode);
+#else
+        f->handle = BZ2_bzdopen(fileno(fp), mode);
+#endif
+    }
+    return (f->handle != NULL) ? ok : failure;
+}
+
+static int zfile_bzip2_write (zfile f, const char *data, size_t len) {
+    return (BZ2_bzwrite(f->handle, (void *)data, (int)len) == (int)len) ? ok : failure;
+}
+
+static int zfile_bzip2_flush (zfile f) {
+    return BZ2_bzflush(f->handle);
+}
+
+static int zfile_bzip2_close (zfile f) {
+    BZ2_bzclose(f->handle);
+    return 0;
+}
+
+static const zfile_backend_t zfile_bzip2 = {
+    zfile_bzip2_open, zfile_bzip2_write, zfile_bzip2_flush, zfile_bzip2_close
+};
+#endif
+
+#ifdef USE_ZSTD
+static int zfile_zstd_open (zfile f, const char *fname, FILE *fp, const char *mode,
+                            int level, unsigned int threads) {
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+
+    if (cctx == NULL) {
+        return failure;
+    }
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level ? level : ZSTD_CLEVEL_DEFAULT);
+    if (threads > 1 && ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, (int)threads))) {
+        joy_log_warn("zstd was built without threads, compressing in one thread");
+    }
+    f->zbuf_size = ZSTD_CStreamOutSize();
+    f->zbuf = malloc(f->zbuf_size);
+    if (f->zbuf == NULL || (f->fp = zfile_fopen(fname, fp, mode)) == NULL) {
+        ZSTD_freeCCtx(cctx);
+        return failure;
+    }
+    f->handle = cctx;
+    return ok;
+}
+
+/* run the compressor over data until it is consumed, and, unless op is
+   ZSTD_e_continue, until all of it has been written out */
+static int zfile_zstd_compress (zfile f, const char *data, size_t len, ZSTD_EndDirective op) {
+    ZSTD_inBuffer in = { data, len, 0 };
+    size_t remaining;
+
+    do {
+        ZSTD_outBuffer out = { f->zbuf, f->zbuf_size, 0 };
+
+        remaining = ZSTD_compressStream2((ZSTD_CCtx *)f->handle, &out, &in, op);
+        if (ZSTD_isError(remaining) || fwrite(f->zbuf, 1, out.pos, f->fp) != out.pos) {
+            return failure;
+        }
+    } while ((op == ZSTD_e_continue) ? (in.pos < in.size) : (remaining != 0));
+    return ok;
+}
+
+static int zfile_zstd_write (zfile f, const char *data, size_t len) {
+    return zfile_zstd_compress(f, data, len, ZSTD_e_continue);
+}
+
+static int zfile_zstd_flush (zfile f) {
+    if (zfile_zstd_compress(f, NULL, 0, ZSTD_e_flush) != ok) {
+        return -1;
+    }
+    return fflush(f->fp);
+}
+
+static int zfile_zstd_close (zfile f) {
+    int rc = zfile_zstd_compress(f, NULL, 0, ZSTD_e_end);
+
+    ZSTD_freeCCtx((ZSTD_CCtx *)f->handle);
+    if (fclose(f->fp) != 0 || rc != ok) {
+        return -1;
+    }
+    return 0;
+}
+
+static const zfile_backend_t zfile_zstd = {
+    zfile_zstd_open, zfile_zstd_write, zfile_zstd_flush, zfile_zstd_close
+};
+#endif
+
+#ifdef USE_LZ4
+/* data passed to LZ4F_compressUpdate() at a time */
+#define ZFILE_LZ4_CHUNK (64 * 1024)
+
+static int zfile_lz4_open (zfile f, const char *fname, FILE *fp, const char *mode,
+                           int level, unsigned int threads) {
+    LZ4F_cctx *cctx = NULL;
+    LZ4F_preferences_t prefs;
+    size_t n;
+
+    (void)threads;
+    memset_s(&prefs, sizeof(prefs), 0x00, sizeof(prefs));
+    prefs.compressionLevel = level;
+    if (LZ4F_isError(LZ4F_createCompressionContext(&cctx, LZ4F_VERSION))) {
+        return failure;
+    }
+    f->zbuf_size = LZ4F_compressBound(ZFILE_LZ4_CHUNK, &prefs);
+    f->zbuf = malloc(f->zbuf_size);
+    if (f->zbuf == NULL || (f->fp = zfile_fopen(fname, fp, mode)) == NULL) {
+        LZ4F_freeCompressionContext(cctx);
+        return failure;
+    }
+    n = LZ4F_compressBegin(cctx, f->zbuf, f->zbuf_size, &prefs);
+    if (LZ4F_isError(n) || fwrite(f->zbuf, 1, n, f->fp) != n) {
+        LZ4F_freeCompressionContext(cctx);
+        fclose(f->fp);
+        return failure;
+    }
+    f->handle = cctx;
+    return ok;
+}
+
+static int zfile_lz4_write (zfile f, const char *data, size_t len) {
+    while (len) {
+        size_t chunk = (len < ZFILE_LZ4_CHUNK) ? len : ZFILE_LZ4_CHUNK;
+        size_t n = LZ4F_compressUpdate((LZ4F_cctx *)f->handle, f->zbuf, f->zbuf_size,
+                                       data, chunk, NULL);
+
+        if (LZ4F_isError(n) || fwrite(f->zbuf, 1, n, f->fp) != n) {
+            return failure;
+        }
+        data += chunk;
+        len -= chunk;
+    }
+    return ok;
+}
+
+static int zfile_lz4_flush (zfile f) {
+    size_t n = LZ4F_flush((LZ4F_cctx *)f->handle, f->zbuf, f->zbuf_size, NULL);
+
+    if (LZ4F_isError(n) || fwrite(f->zbuf, 1, n, f->fp) != n) {
+        return -1;
+    }
+    return fflush(f->fp);
+}
+
+static int zfile_lz4_close (zfile f) {
+    size_t n = LZ4F_compressEnd((LZ4F_cctx *)f->handle, f->zbuf, f->zbuf_size, NULL);
+    int rc = 0;
+
+    if (LZ4F_isError(n) || fwrite(f->zbuf, 1, n, f->fp) != n) {
+        rc = -1;
+    }
+    LZ4F_freeCompressionContext((LZ4F_cctx *)f->handle);
+    if (fclose(f->fp) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
+
+static const zfile_backend_t zfile_lz4 = {
+    zfile_lz4_open, zfile_lz4_write, zfile_lz4_flush, zfile_lz4_close
+};
+#endif
+
+/*
+ * the shared memory ring, which takes a whole record per write and
+ * is opened by zopen_ring() rather than picked as a compressor
+ */
+static int zfile_ring_write (zfile f, const char *data, size_t len) {
+    return shm_ring_write((shm_ring_t *)f->handle, data, (uint32_t)len);
+}
+
+static int zfile_ring_flush (zfile f) {
+    (void)f;
+    return 0;
+}
+
+static int zfile_ring_close (zfile f) {
+    shm_ring_close((shm_ring_t *)f->handle);
+    return 0;
+}
+
+static const zfile_backend_t zfile_ring = {
+    NULL, zfile_ring_write, zfile_ring_flush, zfile_ring_close
+};
+
+/* the backend of a compression, or NULL if the build does not include it */
+static const zfile_backend_t *zfile_backend (unsigned int compression) {
+    if (compression == ZFILE_COMPRESSION_DEFAULT) {
+        compression = ZFILE_COMPRESSION_BUILD;
+    }
+    switch (compression) {
+    case ZFILE_COMPRESSION_NONE:
+        return &zfile_none;
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        return &zfile_gzip;
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        return &zfile_bzip2;
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        return &zfile_zstd;
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        return &zfile_lz4;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+static inline int zfile_handle_write (zfile f, const char *data, size_t len) {
+    return f->backend->write(f, data, len);
+}
+
+static inline int zfile_handle_flush (zfile f) {
+    return f->backend->flush(f);
+}
+
+static inline int zfile_handle_close (zfile f) {
+    return f->backend->close(f);
+}
+
+/**
+ * \brief The name of a compression backend, as compression= takes it.
+ * \param compression One of enum zfile_compression
+ * \return The name, or "unknown"
+ */
+const char *zcompression_name (unsigned int compression) {
+    if (compression >= ZFILE_COMPRESSION_MAX) {
+        return "unknown";
+    }
+    return zfile_compression_names[compression];
+}
+
+/**
+ * \brief The suffix of the files a compression backend writes.
+ * \param compression One of enum zfile_compression
+ * \return The suffix, such as ".gz", or "" for uncompressed files
+ */
+const char *zcompression_suffix (unsigned int compression) {
+    if (compression == ZFILE_COMPRESSION_DEFAULT) {
+        compression = ZFILE_COMPRESSION_BUILD;
+    }
+    if (compression >= ZFILE_COMPRESSION_MAX) {
+        return "";
+    }
+    return zfile_compression_suffixes[compression];
+}
+
+/**
+ * \brief Whether the build includes a compression backend.
+ * \param compression One of enum zfile_compression
+ * \return 1 if it does, 0 if not
+ */
+int zcompression_available (unsigned int compression) {
+    return zfile_backend(compression) != NULL;
+}
+
+/**
+ * \brief The compression backend that the configuration selects.
+ * \return One of enum zfile_compression, never ZFILE_COMPRESSION_DEFAULT
+ */
+unsigned int zcompression_configured (void) {
+    if (glb_config == NULL || glb_config->compression == ZFILE_COMPRESSION_DEFAULT) {
+        return ZFILE_COMPRESSION_BUILD;
+    }
+    return glb_config->compression;
+}
+
+/*
+ * buffers
+ */
+
+static zfile_buf_t *zfile_buf_alloc (size_t size) {
+    zfile_buf_t *b = malloc(sizeof(zfile_buf_t) + size);
+
+    if (b != NULL) {
+        b->next = NULL;
+        b->len = 0;
+        b->size = size;
+    }
+    return b;
+}
+
+static zfile zfile_alloc (void) {
+    zfile f = calloc(1, sizeof(struct zfile_));
+
+    if (f == NULL) {
+        return NULL;
+    }
+    f->cur = zfile_buf_alloc(ZFILE_SYNC_BUF_SIZE);
+    if (f->cur == NULL) {
+        free(f);
+        return NULL;
+    }
+    f->num_bufs = 1;
+    return f;
+}
+
+static void zfile_free (zfile f) {
+    zfile_buf_t *b;
+
+    free(f->zbuf);
+    free(f->cur);
+    free(f->rec);
+    free(f->text);
+    free(f->intern);
+    while ((b = f->free_list) != NULL) {
+        f->free_list = b->next;
+        free(b);
+    }
+    free(f);
+}
+
+/*
+ * the writer thread
+ */
+
+static void *zfile_writer_main (void *arg) {
+    zfile f = (zfile)arg;
+    zfile_buf_t *b;
+    int rc;
+
+    /* stay near the worker that fills the stream, off its cpu */
+    affinity_spread_to_node();
+
+    pthread_mutex_lock(&f->lock);
+    while (1) {
+        while (f->queue == NULL && !f->stop) {
+            pthread_cond_wait(&f->work, &f->lock);
+        }
+        b = f->queue;
+        if (b == NULL) {
+            break;
+        }
+        f->queue = b->next;
+        if (f->queue == NULL) {
+            f->queue_tail = &f->queue;
+        }
+        f->stats.queued--;
+        f->busy = 1;
+        pthread_mutex_unlock(&f->lock);
+
+        rc = zfile_handle_write(f, b->data, b->len);
+
+        pthread_mutex_lock(&f->lock);
+        if (rc != ok) {
+            f->error = 1;
+        }
+        f->stats.bytes_written += b->len;
+        b->len = 0;
+        b->next = f->free_list;
+        f->free_list = b;
+        f->busy = 0;
+        pthread_cond_broadcast(&f->done);
+    }
+    pthread_mutex_unlock(&f->lock);
+    return NULL;
+}
+
+/*
+ * queue the buffer being filled and take an empty one with room for at
+ * least need bytes; waits for the writer only if the stream already
+ * has ZFILE_MAX_BUFS buffers
+ */
+static int zfile_submit (zfile f, size_t need) {
+    zfile_buf_t *b = NULL;
+    size_t size = (need > ZFILE_BUF_SIZE) ? need : ZFILE_BUF_SIZE;
+
+    pthread_mutex_lock(&f->lock);
+    if (f->cur->len) {
+        *f->queue_tail = f->cur;
+        f->queue_tail = &f->cur->next;
+        f->cur->next = NULL;
+        f->cur = NULL;
+        if (++f->stats.queued > f->stats.max_queued) {
+            f->stats.max_queued = f->stats.queued;
+        }
+        pthread_cond_signal(&f->work);
+    }
+    if (f->cur == NULL) {
+        while (f->free_list == NULL && f->num_bufs >= ZFILE_MAX_BUFS) {
+            f->stats.waits++;
+            pthread_cond_wait(&f->done, &f->lock);
+        }
+        b = f->free_list;
+        if (b != NULL) {
+            f->free_list = b->next;
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    f->last_commit = time(NULL);
+    if (f->cur != NULL && f->cur->size >= need) {
+        return ok;
+    }
+    if (b != NULL && b->size < size) {
+        free(b);
+        f->num_bufs--;
+        b = NULL;
+    }
+    if (b == NULL) {
+        b = zfile_buf_alloc(size);
+        if (b == NULL) {
+            return failure;
+        }
+        f->num_bufs++;
+    }
+    if (f->cur != NULL) {
+        /* empty, but too small */
+        free(f->cur);
+        f->num_bufs--;
+    }
+    b->next = NULL;
+    b->len = 0;
+    f->cur = b;
+    return ok;
+}
+
+/* wait until the writer has written everything queued */
+static void zfile_drain (zfile f) {
+    pthread_mutex_lock(&f->lock);
+    while (f->queue != NULL || f->busy) {
+        pthread_cond_wait(&f->done, &f->lock);
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+/* pass the data held by a synchronous stream to the compressor */
+static int zfile_write_out (zfile f) {
+    int rc = ok;
+
+    if (f->cur->len) {
+        rc = zfile_handle_write(f, f->cur->data, f->cur->len);
+        f->cur->len = 0;
+    }
+    return rc;
+}
+
+static char *zbin_reserve (zfile_buf_t **bp, size_t need);
+
+/*
+ * room for at least need more bytes at the end of the buffer being
+ * filled; a synchronous stream writes out what it holds, unless it
+ * writes out whole records, and an asynchronous one queues it for
+ * the writer
+ */
+static char *zfile_reserve (zfile f, size_t need) {
+    if (f->cur->size - f->cur->len >= need) {
+        return f->cur->data + f->cur->len;
+    }
+    if (f->framed) {
+        return zbin_reserve(&f->cur, need);
+    }
+    if (f->async) {
+        if (zfile_submit(f, need) != ok) {
+            return NULL;
+        }
+    } else {
+        if (zfile_write_out(f) != ok) {
+            return NULL;
+        }
+        if (f->cur->size < need) {
+            zfile_buf_t *b = zfile_buf_alloc(need);
+
+            if (b == NULL) {
+                return NULL;
+            }
+            free(f->cur);
+            f->cur = b;
+        }
+    }
+    return f->cur->data + f->cur->len;
+}
+
+/* account for n bytes added at the end of the buffer being filled */
+static inline void zfile_advance (zfile f, size_t n) {
+    f->cur->len += n;
+    f->stats.bytes += n;
+}
+
+/* append bytes at the end of the buffer being filled */
+static int zfile_put (zfile f, const void *data, size_t len) {
+    char *p = zfile_reserve(f, len);
+
+    if (p == NULL) {
+        return failure;
+    }
+    memcpy(p, data, len);
+    zfile_advance(f, len);
+    return ok;
+}
+
+/*
+ * the binary format
+ */
+
+/* room for at least need more bytes at the end of a memory buffer */
+static char *zbin_reserve (zfile_buf_t **bp, size_t need) {
+    zfile_buf_t *b = *bp;
+
+    if (b->size - b->len < need) {
+        size_t size = b->size * 2;
+
+        while (size - b->len < need) {
+            size *= 2;
+        }
+        b = realloc(b, sizeof(zfile_buf_t) + size);
+        if (b == NULL) {
+            return NULL;
+        }
+        b->size = size;
+        *bp = b;
+    }
+    return b->data + b->len;
+}
+
+/* encode v as a varint at p; returns the bytes used, at most 10 */
+static inline unsigned int zbin_encode_varint (unsigned char *p, uint64_t v) {
+    unsigned int n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/* append a varint to the record being written */
+static int zbin_put_varint (zfile f, uint64_t v) {
+    unsigned char *p = (unsigned char *)zbin_reserve(&f->rec, 10);
+
+    if (p == NULL) {
+        return failure;
+    }
+    f->rec->len += zbin_encode_varint(p, v);
+    return ok;
+}
+
+/* append a tag and a varint to the record being written */
+static int zbin_put_tag_varint (zfile f, unsigned int tag, uint64_t v) {
+    unsigned char *p = (unsigned char *)zbin_reserve(&f->rec, 11);
+
+    if (p == NULL) {
+        return failure;
+    }
+    p[0] = (unsigned char)tag;
+    f->rec->len += 1 + zbin_encode_varint(p + 1, v);
+    return ok;
+}
+
+/* the entry of the intern table holding data, or -1 */
+static int zbin_intern_find (zfile_intern_t *t, const char *data,
+                             unsigned int len, uint32_t *hash) {
+    uint32_t h = 2166136261u;
+    unsigned int i, s;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)data[i]) * 16777619u;
+    }
+    *hash = h;
+    for (s = h & (ZFILE_INTERN_SLOTS - 1); t->slot[s]; s = (s + 1) & (ZFILE_INTERN_SLOTS - 1)) {
+        unsigned int e = t->slot[s] - 1;
+
+        if (t->len[e] == len && memcmp(t->data + t->off[e], data, len) == 0) {
+            return (int)e;
+        }
+    }
+    return -1;
+}
+
+/*
+ * add data to the intern table, if it is short enough and there is
+ * room; the reader makes the same entry when it sees the _NEW tag,
+ * and counts a NUL after each entry
+ */
+static int zbin_intern_add (zfile_intern_t *t, const char *data,
+                            unsigned int len, uint32_t hash) {
+    unsigned int s;
+
+    if (len > BINREC_INTERN_MAX_LEN || t->num >= BINREC_INTERN_MAX ||
+        t->used + len + 1 > BINREC_INTERN_BYTES) {
+        return failure;
+    }
+    memcpy(t->data + t->used, data, len);
+    t->off[t->num] = t->used;
+    t->len[t->num] = (uint16_t)len;
+    t->used += len + 1;
+    for (s = hash & (ZFILE_INTERN_SLOTS - 1); t->slot[s]; s = (s + 1) & (ZFILE_INTERN_SLOTS - 1)) {
+        ;
+    }
+    t->slot[s] = (uint16_t)(++t->num);
+    return ok;
+}
+
+/* append a text (string == 0) or string token to the record */
+static int zbin_put_item (zfile f, int string, const char *data, unsigned int len) {
+    uint32_t hash;
+    int e = zbin_intern_find(f->intern, data, len, &hash);
+    unsigned int tag;
+    char *p;
+
+    if (e >= 0) {
+        if (e < BINREC_SHORT_REF_MAX) {
+            p = zbin_reserve(&f->rec, 1);
+            if (p == NULL) {
+                return failure;
+            }
+            *p = (char)(BINREC_TAG_SHORT_REF | (string ? BINREC_TAG_SHORT_STRING : 0) | e);
+            f->rec->len++;
+            return ok;
+        }
+        return zbin_put_tag_varint(f, string ? BINREC_TAG_STRING_REF : BINREC_TAG_TEXT_REF, e);
+    }
+    if (zbin_intern_add(f->intern, data, len, hash) == ok) {
+        tag = string ? BINREC_TAG_STRING_NEW : BINREC_TAG_TEXT_NEW;
+    } else {
+        tag = string ? BINREC_TAG_STRING : BINREC_TAG_TEXT;
+    }
+    if (zbin_put_tag_varint(f, tag, len) != ok) {
+        return failure;
+    }
+    p = zbin_reserve(&f->rec, len);
+    if (p == NULL) {
+        return failure;
+    }
+    memcpy(p, data, len);
+    f->rec->len += len;
+    return ok;
+}
+
+/* make the text collected so far into a token */
+static int zbin_flush_text (zfile f) {
+    int rc = ok;
+
+    if (f->text->len) {
+        rc = zbin_put_item(f, 0, f->text->data, (unsigned int)f->text->len);
+        f->text->len = 0;
+    }
+    return rc;
+}
+
+/* add text to be made into a token */
+static int zbin_text (zfile f, const void *data, size_t len) {
+    char *p = zbin_reserve(&f->text, len);
+
+    if (p == NULL) {
+        return -1;
+    }
+    memcpy(p, data, len);
+    f->text->len += len;
+    return (int)len;
+}
+
+/* start a token other than text */
+static inline int zbin_token (zfile f, unsigned int tag, uint64_t v) {
+    if (zbin_flush_text(f) != ok || zbin_put_tag_varint(f, tag, v) != ok) {
+        return -1;
+    }
+    return 1;
+}
+
+/* write the record collected so far, preceded by its length */
+static int zbin_end_record (zfile f) {
+    unsigned char len[10];
+
+    if (zbin_flush_text(f) != ok) {
+        return failure;
+    }
+    if (f->rec->len == 0) {
+        return ok;
+    }
+    if (zfile_put(f, len, zbin_encode_varint(len, f->rec->len)) != ok ||
+        zfile_put(f, f->rec->data, f->rec->len) != ok) {
+        f->rec->len = 0;
+        return failure;
+    }
+    f->rec->len = 0;
+    return ok;
+}
+
+/*
+ * the stream interface
+ */
+
+/* open a stream on a file, or on fp if fname is NULL */
+static zfile zfile_open (const char *fname, FILE *fp, const char *mode,
+                         unsigned int compression, int level, unsigned int threads) {
+    const zfile_backend_t *backend = zfile_backend(compression);
+    zfile f;
+
+    if (backend == NULL) {
+        joy_log_err("%s compression is not included in this build",
+                    zcompression_name(compression));
+        return NULL;
+    }
+    f = zfile_alloc();
+    if (f == NULL) {
+        return NULL;
+    }
+    f->backend = backend;
+    if (backend->open(f, fname, fp, mode, level, threads) != ok) {
+        zfile_free(f);
+        return NULL;
+    }
+    if (glb_config != NULL && glb_config->output_format == OUTPUT_FORMAT_BINARY) {
+        zbinary(f);
+    }
+    return f;
+}
+
+/**
+ * \brief Open a file for output, compressed as configured.
+ *
+ * The configuration selects the backend (compression=), its level
+ * (compress_level=) and the threads of zstd (compress_threads=), and
+ * the binary format (format=binary); see zbinary().
+ *
+ * \param fname The name of the file
+ * \param mode The mode passed on to the compressor, such as "w"
+ * \return The stream, or NULL on failure
+ */
+zfile zopen (const char *fname, const char *mode) {
+    if (glb_config == NULL) {
+        return zfile_open(fname, NULL, mode, ZFILE_COMPRESSION_DEFAULT, 0, 0);
+    }
+    return zfile_open(fname, NULL, mode, glb_config->compression,
+                      glb_config->compress_level, glb_config->compress_threads);
+}
+
+/**
+ * \brief Open a file for output with a given compression.
+ *
+ * As zopen(), but with the backend, level and threads given rather
+ * than configured.
+ *
+ * \param fname The name of the file
+ * \param mode The mode passed on to the compressor, such as "w"
+ * \param compression One of enum zfile_compression
+ * \param level The compression level, or 0 for the default of the backend
+ * \param threads Threads compressing in the background (zstd only),
+ *                or 0 to compress in the thread that writes
+ * \return The stream, or NULL on failure
+ */
+zfile zopen_compressed (const char *fname, const char *mode,
+                        unsigned int compression, int level, unsigned int threads) {
+    return zfile_open(fname, NULL, mode, compression, level, threads);
+}
+
+/**
+ * \brief Open a stream on a ring in shared memory.
+ *
+ * Each record, up to a zcommit(), is written into the ring as one
+ * record of the ring, for processes on the same host to read in
+ * place; see shm_ring.h.  The stream stays synchronous, and can't be
+ * switched to the binary format, whose records depend on those
+ * before them.
+ *
+ * \param fname The name of the ring file
+ * \param size Bytes of the data area of the ring
+ * \param policy What is done when the ring is full, one of
+ *               enum shm_ring_policy
+ * \return The stream, or NULL on failure
+ */
+zfile zopen_ring (const char *fname, uint64_t size, unsigned int policy) {
+    zfile f = zfile_alloc();
+
+    if (f == NULL) {
+        return NULL;
+    }
+    f->backend = &zfile_ring;
+    f->framed = 1;
+    f->handle = shm_ring_create(fname, size, policy);
+    if (f->handle == NULL) {
+        zfile_free(f);
+        return NULL;
+    }
+    return f;
+}
+
+/**
+ * \brief Open a stream on a stdio stream that is already open.
+ *
+ * As with zopen(), the configuration selects the compression and the
+ * binary format.
+ *
+ * \param fp The stdio stream, such as stdout
+ * \param mode The mode passed on to the compressor, such as "w"
+ * \return The stream, or NULL on failure
+ */
+zfile zattach (FILE *fp, const char *mode) {
+    if (glb_config == NULL) {
+        return zfile_open(NULL, fp, mode, ZFILE_COMPRESSION_DEFAULT, 0, 0);
+    }
+    return zfile_open(NULL, fp, mode, glb_config->compression,
+                      glb_config->compress_level, glb_config->compress_threads);
+}
+
+/**
+ * \brief Switch a stream to the binary format of binrec.h.
+ *
+ * Writes the file header; from here on the writers append tokens to
+ * a record, and zcommit() writes the record out.  Must be called
+ * before anything is written to the stream.
+ *
+ * \param f The stream
+ * \return ok, or failure
+ */
+int zbinary (zfile f) {
+    unsigned char header[BINREC_MAGIC_LEN + 1];
+
+    if (f == NULL || f->binary || f->framed || f->stats.bytes) {
+        return failure;
+    }
+    f->rec = zfile_buf_alloc(ZFILE_SYNC_BUF_SIZE);
+    f->text = zfile_buf_alloc(ZFILE_SYNC_BUF_SIZE);
+    f->intern = calloc(1, sizeof(zfile_intern_t));
+    if (f->rec == NULL || f->text == NULL || f->intern == NULL) {
+        joy_log_err("out of memory");
+        return failure;
+    }
+    memcpy(header, BINREC_MAGIC, BINREC_MAGIC_LEN);
+    header[BINREC_MAGIC_LEN] = BINREC_VERSION;
+    if (zfile_put(f, header, sizeof(header)) != ok) {
+        return failure;
+    }
+    f->binary = 1;
+    return ok;
+}
+
+/**
+ * \brief Hand the writing of a stream over to a thread of its own.
+ *
+ * From here on, zprintf() and zwrite() only copy data into memory,
+ * up to ZFILE_MAX_BUFS buffers of ZFILE_BUF_SIZE bytes; they wait for
+ * the writer only when all of those are full.  zflush() and zclose()
+ * wait for the writer to finish.
+ *
+ * \param f The stream
+ * \return ok, or failure if the stream stays synchronous
+ */
+int zasync (zfile f) {
+    if (f == NULL || f->framed) {
+        return failure;
+    }
+    if (f->async) {
+        return ok;
+    }
+    if (f->cur->size < ZFILE_BUF_SIZE) {
+        zfile_buf_t *b = zfile_buf_alloc(ZFILE_BUF_SIZE);
+
+        if (b == NULL) {
+            return failure;
+        }
+        memcpy(b->data, f->cur->data, f->cur->len);
+        b->len = f->cur->len;
+        free(f->cur);
+        f->cur = b;
+    }
+    f->queue = NULL;
+    f->queue_tail = &f->queue;
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->work, NULL);
+    pthread_cond_init(&f->done, NULL);
+    if (pthread_create(&f->writer, NULL, zfile_writer_main, f) != 0) {
+        joy_log_err("could not start output writer thread");
+        pthread_cond_destroy(&f->done);
+        pthread_cond_destroy(&f->work);
+        pthread_mutex_destroy(&f->lock);
+        return failure;
+    }
+    f->last_commit = time(NULL);
+    f->async = 1;
+    return ok;
+}
+
+/**
+ * \brief Move the buffers of a stream to a NUMA node.
+ *
+ * Buffers allocated later come from the thread that fills the
+ * stream.  The writer thread keeps to the node of that thread on its
+ * own, see affinity_spread_to_node().
+ *
+ * \param f The stream
+ * \param node The node
+ * \return ok, or failure if some of the buffers could not be moved
+ */
+int zplace (zfile f, int node) {
+    zfile_buf_t *b;
+    int rc = ok;
+
+    if (f == NULL) {
+        return failure;
+    }
+    if (f->async) {
+        pthread_mutex_lock(&f->lock);
+    }
+    if (f->cur != NULL && affinity_place(f->cur, sizeof(zfile_buf_t) + f->cur->size, node) != ok) {
+        rc = failure;
+    }
+    for (b = f->free_list; b != NULL; b = b->next) {
+        if (affinity_place(b, sizeof(zfile_buf_t) + b->size, node) != ok) {
+            rc = failure;
+        }
+    }
+    if (affinity_place(f->zbuf, f->zbuf_size, node) != ok) {
+        rc = failure;
+    }
+    if (f->async) {
+        pthread_mutex_unlock(&f->lock);
+    }
+    return rc;
+}
+
+/**
+ * \brief Write bytes to a stream.
+ * \param f The stream
+ * \param data The bytes
+ * \param len Number of bytes
+ * \return Number of bytes written, or -1 on failure
+ */
+int zwrite (zfile f, const void *data, unsigned int len) {
+    if (f->binary) {
+        return zbin_text(f, data, len);
+    }
+    if (zfile_put(f, data, len) != ok) {
+        return -1;
+    }
+    return (int)len;
+}
+
+/**
+ * \brief Write formatted data to a stream, as fprintf() does.
+ * \param f The stream
+ * \param format The printf format
+ * \return Number of bytes written, or a negative value on failure
+ */
+int zprintf (zfile f, const char *format, ...) {
+    va_list args;
+    zfile_buf_t *b = f->binary ? f->text : f->cur;
+    size_t room = b->size - b->len;
+    char *p = b->data + b->len;
+    int n;
+
+    va_start(args, format);
+    n = vsnprintf(p, room, format, args);
+    va_end(args);
+    if (n < 0) {
+        return n;
+    }
+    if ((size_t)n >= room) {
+        /* make room, then format again */
+        if (f->binary) {
+            p = zbin_reserve(&f->text, (size_t)n + 1);
+        } else {
+            p = zfile_reserve(f, (size_t)n + 1);
+        }
+        if (p == NULL) {
+            return -1;
+        }
+        va_start(args, format);
+        n = vsnprintf(p, (size_t)n + 1, format, args);
+        va_end(args);
+        if (n < 0) {
+            return n;
+        }
+    }
+    if (f->binary) {
+        f->text->len += n;
+    } else {
+        zfile_advance(f, n);
+    }
+    return n;
+}
+
+/**
+ * \brief Write a string to a stream, as fputs() does.
+ * \param f The stream
+ * \param s The string; NULL writes nothing
+ * \return Number of bytes written, or -1 on failure
+ */
+int zputs (zfile f, const char *s) {
+    if (s == NULL) {
+        return 0;
+    }
+    return zwrite(f, s, (unsigned int)strlen(s));
+}
+
+/**
+ * \brief Write a character to a stream.
+ * \param f The stream
+ * \param c The character
+ * \return 1, or -1 on failure
+ */
+int zputc (zfile f, int c) {
+    char *p;
+
+    if (f->binary) {
+        char ch = (char)c;
+
+        return zbin_text(f, &ch, 1);
+    }
+    p = zfile_reserve(f, 1);
+    if (p == NULL) {
+        return -1;
+    }
+    *p = (char)c;
+    zfile_advance(f, 1);
+    return 1;
+}
+
+/* the decimal digits of 0 to 99, two by two */
+static const char zfile_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* the decimal digits of v, ending at end; returns the first digit */
+static char *zfile_format_u64 (char *end, uint64_t v) {
+    while (v >= 100) {
+        unsigned int i = (unsigned int)(v % 100) * 2;
+
+        v /= 100;
+        *--end = zfile_digit_pairs[i + 1];
+        *--end = zfile_digit_pairs[i];
+    }
+    if (v >= 10) {
+        *--end = zfile_digit_pairs[v * 2 + 1];
+        *--end = zfile_digit_pairs[v * 2];
+    } else {
+        *--end = (char)('0' + v);
+    }
+    return end;
+}
+
+/**
+ * \brief Write an unsigned integer in decimal, as "%llu" does.
+ * \param f The stream
+ * \param v The value
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_uint64 (zfile f, uint64_t v) {
+    char tmp[20];
+    char *s, *p;
+
+    if (f->binary) {
+        if (v < BINREC_SMALL_UINT_MAX) {
+            if (zbin_flush_text(f) != ok || (p = zbin_reserve(&f->rec, 1)) == NULL) {
+                return -1;
+            }
+            *p = (char)(BINREC_TAG_SMALL_UINT + v);
+            f->rec->len++;
+            return 1;
+        }
+        return zbin_token(f, BINREC_TAG_UINT, v);
+    }
+    s = zfile_format_u64(tmp + sizeof(tmp), v);
+
+    return zwrite(f, s, (unsigned int)(tmp + sizeof(tmp) - s));
+}
+
+/**
+ * \brief Write a signed integer in decimal, as "%lld" does.
+ * \param f The stream
+ * \param v The value
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_int64 (zfile f, int64_t v) {
+    char tmp[21];
+    char *s;
+
+    if (f->binary) {
+        return zbin_token(f, BINREC_TAG_INT, BINREC_ZIGZAG(v));
+    }
+    s = zfile_format_u64(tmp + sizeof(tmp), (v < 0) ? 0 - (uint64_t)v : (uint64_t)v);
+
+    if (v < 0) {
+        *--s = '-';
+    }
+    return zwrite(f, s, (unsigned int)(tmp + sizeof(tmp) - s));
+}
+
+/**
+ * \brief Write an unsigned integer in decimal, as "%u" does.
+ * \param f The stream
+ * \param v The value
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_uint (zfile f, unsigned int v) {
+    return zprint_uint64(f, v);
+}
+
+/**
+ * \brief Write a signed integer in decimal, as "%d" does.
+ * \param f The stream
+ * \param v The value
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_int (zfile f, int v) {
+    return zprint_int64(f, v);
+}
+
+/**
+ * \brief Write a time as seconds with six decimals, as joy prints
+ *        the time_start and time_end of a flow.
+ * \param f The stream
+ * \param sec Seconds
+ * \param usec Microseconds, below 1000000
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_timestamp (zfile f, int64_t sec, long usec) {
+    char tmp[28];
+    char *end = tmp + sizeof(tmp);
+    char *s;
+    unsigned int u = (unsigned int)usec;
+    int i;
+
+    if (f->binary) {
+        if (zbin_token(f, BINREC_TAG_TIMESTAMP, BINREC_ZIGZAG(sec)) < 0) {
+            return -1;
+        }
+        return (zbin_put_varint(f, (uint64_t)usec) == ok) ? 1 : -1;
+    }
+    for (i = 0; i < 6; i++) {
+        *--end = (char)('0' + u % 10);
+        u /= 10;
+    }
+    *--end = '.';
+    s = zfile_format_u64(end, (sec < 0) ? 0 - (uint64_t)sec : (uint64_t)sec);
+    if (sec < 0) {
+        *--s = '-';
+    }
+    return zwrite(f, s, (unsigned int)(tmp + sizeof(tmp) - s));
+}
+
+static const char zfile_hex_digits[] = "0123456789abcdef";
+
+/**
+ * \brief Write bytes as pairs of lowercase hex digits, as a loop
+ *        over "%02x" does.
+ * \param f The stream
+ * \param data The bytes
+ * \param len Number of bytes
+ * \return Number of characters written, or -1 on failure
+ */
+int zprint_hex (zfile f, const unsigned char *data, unsigned int len) {
+    char *p;
+    unsigned int i;
+
+    if (f->binary) {
+        if (zbin_token(f, BINREC_TAG_HEX, len) < 0 ||
+            (p = zbin_reserve(&f->rec, len)) == NULL) {
+            return -1;
+        }
+        memcpy(p, data, len);
+        f->rec->len += len;
+        return (int)len;
+    }
+    p = zfile_reserve(f, (size_t)len * 2);
+    if (p == NULL) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        p[0] = zfile_hex_digits[data[i] >> 4];
+        p[1] = zfile_hex_digits[data[i] & 0x0f];
+        p += 2;
+    }
+    zfile_advance(f, (size_t)len * 2);
+    return (int)(len * 2);
+}
+
+/*
+ * how each byte is written inside a JSON string: 0 as is, 'u' as
+ * \u00XX, and anything else as a backslash and that character
+ */
+static const char zfile_json_escape[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    0, 0, '"', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, '\\', 0, 0, 0,
+};
+
+/**
+ * \brief Write a string as a quoted JSON string, escaping quotes,
+ *        backslashes and control characters.
+ * \param f The stream
+ * \param s The string; NULL is written as an empty string
+ * \return Number of bytes written, or -1 on failure
+ */
+int zprint_json_string (zfile f, const char *s) {
+    const unsigned char *run;
+    const unsigned char *x = (const unsigned char *)s;
+    int n = 2;
+
+    if (f->binary) {
+        unsigned int len = (s == NULL) ? 0 : (unsigned int)strlen(s);
+
+        if (zbin_flush_text(f) != ok || zbin_put_item(f, 1, s, len) != ok) {
+            return -1;
+        }
+        return (int)len;
+    }
+    if (zputc(f, '"') < 0) {
+        return -1;
+    }
+    while (x != NULL && *x) {
+        char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+
+        /* copy a run of bytes that need no escape in one go */
+        run = x;
+        while (*x && zfile_json_escape[*x] == 0) {
+            x++;
+        }
+        if (x > run) {
+            if (zwrite(f, run, (unsigned int)(x - run)) < 0) {
+                return -1;
+            }
+            n += (int)(x - run);
+        }
+        if (*x == 0) {
+            break;
+        }
+        if (zfile_json_escape[*x] == 'u') {
+            esc[4] = zfile_hex_digits[*x >> 4];
+            esc[5] = zfile_hex_digits[*x & 0x0f];
+            if (zwrite(f, esc, 6) < 0) {
+                return -1;
+            }
+            n += 6;
+        } else {
+            esc[1] = zfile_json_escape[*x];
+            if (zwrite(f, esc, 2) < 0) {
+                return -1;
+            }
+            n += 2;
+        }
+        x++;
+    }
+    if (zputc(f, '"') < 0) {
+        return -1;
+    }
+    return n;
+}
+
+/**
+ * \brief Mark the end of a record written to a stream.
+ *
+ * A synchronous stream passes the record to the compressor.  An
+ * asynchronous stream normally keeps data in memory until a buffer
+ * fills up; here, a partly filled buffer is queued for the writer if
+ * it has been held for ZFILE_COMMIT_INTERVAL seconds, so that a slow
+ * trickle of records still reaches the file.  Never waits for the
+ * writer.
+ *
+ * \param f The stream
+ * \return none
+ */
+void zcommit (zfile f) {
+    time_t now;
+
+    if (f->binary) {
+        zbin_end_record(f);
+    }
+    if (f->cur->len == 0) {
+        return;
+    }
+    if (!f->async) {
+        zfile_write_out(f);
+        return;
+    }
+    now = time(NULL);
+    if (now - f->last_commit < ZFILE_COMMIT_INTERVAL) {
+        return;
+    }
+    pthread_mutex_lock(&f->lock);
+    if (f->free_list == NULL && f->num_bufs >= ZFILE_MAX_BUFS) {
+        /* no buffer to continue in; wait for this one to fill up */
+        pthread_mutex_unlock(&f->lock);
+        return;
+    }
+    pthread_mutex_unlock(&f->lock);
+    zfile_submit(f, 0);
+}
+
+/**
+ * \brief Write out everything written to a stream so far.
+ * \param f The stream
+ * \return 0 on success
+ */
+int zflush (zfile f) {
+    if (f->binary) {
+        zbin_end_record(f);
+    }
+    if (f->async) {
+        if (f->cur->len) {
+            zfile_submit(f, 0);
+        }
+        zfile_drain(f);
+    } else if (zfile_write_out(f) != ok) {
+        return -1;
+    }
+    return zfile_handle_flush(f);
+}
+
+/**
+ * \brief Write out everything written to a stream and close it.
+ * \param f The stream
+ * \return 0 on success
+ */
+int zclose (zfile f) {
+    int rc;
+
+    if (f == NULL) {
+        return -1;
+    }
+    if (f->binary && zbin_end_record(f) != ok) {
+        f->error = 1;
+    }
+    if (f->async) {
+        if (f->cur->len) {
+            zfile_submit(f, 0);
+        }
+        pthread_mutex_lock(&f->lock);
+        f->stop = 1;
+        pthread_cond_signal(&f->work);
+        pthread_mutex_unlock(&f->lock);
+        pthread_join(f->writer, NULL);
+        pthread_cond_destroy(&f->done);
+        pthread_cond_destroy(&f->work);
+        pthread_mutex_destroy(&f->lock);
+    } else if (zfile_write_out(f) != ok) {
+        f->error = 1;
+    }
+    if (f->error) {
+        joy_log_err("output could not be written in full");
+    }
+    rc = zfile_handle_close(f);
+    zfile_free(f);
+    return rc;
+}
+
+/**
+ * \brief Report the counters of an asynchronous stream.
+ * \param f The stream
+ * \param stats Filled in with the counters; all zero for a
+ *              synchronous stream
+ * \return none
+ */
+void zstats (zfile f, zfile_stats_t *stats) {
+    memset_s(stats, sizeof(zfile_stats_t), 0x00, sizeof(zfile_stats_t));
+    if (f == NULL || !f->async) {
+        return;
+    }
+    pthread_mutex_lock(&f->lock);
+    *stats = f->stats;
+    pthread_mutex_unlock(&f->lock);
+}
+
+/**
+ * \brief The bytes written to a stream so far, counted before
+ *        compression; for the thread that writes to the stream.
+ * \param f The stream
+ * \return The bytes written, or 0 for a NULL stream
+ */
+unsigned long zbytes (zfile f) {
+    if (f == NULL) {
+        return 0;
+    }
+    return f->stats.bytes;
+}
+
+/*
+ * blocks
+ */
+
+/**
+ * \brief The room zcompress_block() may need to compress a block.
+ * \param compression One of enum zfile_compression
+ * \param len Bytes in the block
+ * \return The most bytes the compressed block may take
+ */
+size_t zcompress_bound (unsigned int compression, size_t len) {
+    switch (compression) {
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        return compressBound((uLong)len);
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        return ZSTD_compressBound(len);
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        return LZ4F_compressFrameBound(len, NULL);
+#endif
+    default:
+        /* what bzip2 documents as its worst case */
+        return len + len / 100 + 600;
+    }
+}
+
+/**
+ * \brief Compress a block of data in memory.
+ *
+ * gzip compresses to the zlib format, and lz4 to a single frame; the
+ * others write what their tools read.
+ *
+ * \param compression One of enum zfile_compression
+ * \param level The compression level, or 0 for the default of the backend
+ * \param in The data
+ * \param len Bytes of data
+ * \param out Where the compressed block goes
+ * \param out_len The room at out, see zcompress_bound(); set to the
+ *                bytes used
+ * \return ok, or failure if the compressor failed, the block does not
+ *         fit, or the build does not include the backend
+ */
+int zcompress_block (unsigned int compression, int level, const void *in, size_t len,
+                     void *out, size_t *out_len) {
+    (void)level;
+    if (compression == ZFILE_COMPRESSION_DEFAULT) {
+        compression = ZFILE_COMPRESSION_BUILD;
+    }
+    switch (compression) {
+    case ZFILE_COMPRESSION_NONE:
+        if (*out_len < len) {
+            return failure;
+        }
+        memcpy(out, in, len);
+        *out_len = len;
+        return ok;
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        {
+            uLongf n = (uLongf)*out_len;
+
+            if (compress2(out, &n, in, (uLong)len, level ? level : Z_DEFAULT_COMPRESSION) != Z_OK) {
+                return failure;
+            }
+            *out_len = n;
+            return ok;
+        }
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        {
+            unsigned int n = (unsigned int)*out_len;
+
+            if (BZ2_bzBuffToBuffCompress(out, &n, (char *)in, (unsigned int)len,
+                                         (level >= 1 && level <= 9) ? level : 9, 0, 0) != BZ_OK) {
+                return failure;
+            }
+            *out_len = n;
+            return ok;
+        }
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        {
+            size_t n = ZSTD_compress(out, *out_len, in, len, level ? level : ZSTD_CLEVEL_DEFAULT);
+
+            if (ZSTD_isError(n)) {
+                return failure;
+            }
+            *out_len = n;
+            return ok;
+        }
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        {
+            LZ4F_preferences_t prefs;
+            size_t n;
+
+            memset_s(&prefs, sizeof(prefs), 0x00, sizeof(prefs));
+            prefs.compressionLevel = level;
+            n = LZ4F_compressFrame(out, *out_len, in, len, &prefs);
+            if (LZ4F_isError(n)) {
+                return failure;
+            }
+            *out_len = n;
+            return ok;
+        }
+#endif
+    default:
+        return failure;
+    }
+}
+
+/**
+ * \brief Decompress a block compressed by zcompress_block().
+ * \param compression The compression it was compressed with
+ * \param in The compressed block
+ * \param len Bytes in the compressed block
+ * \param out Where the data goes
+ * \param out_len Bytes of data the block holds
+ * \return ok, or failure if the block is damaged, does not hold
+ *         exactly out_len bytes, or the build does not include the backend
+ */
+int zdecompress_block (unsigned int compression, const void *in, size_t len,
+                       void *out, size_t out_len) {
+    if (compression == ZFILE_COMPRESSION_DEFAULT) {
+        compression = ZFILE_COMPRESSION_BUILD;
+    }
+    switch (compression) {
+    case ZFILE_COMPRESSION_NONE:
+        if (len != out_len) {
+            return failure;
+        }
+        memcpy(out, in, len);
+        return ok;
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        {
+            uLongf n = (uLongf)out_len;
+
+            if (uncompress(out, &n, in, (uLong)len) != Z_OK || n != out_len) {
+                return failure;
+            }
+            return ok;
+        }
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        {
+            unsigned int n = (unsigned int)out_len;
+
+            if (BZ2_bzBuffToBuffDecompress(out, &n, (char *)in, (unsigned int)len, 0, 0) != BZ_OK ||
+                n != out_len) {
+                return failure;
+            }
+            return ok;
+        }
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        {
+            size_t n = ZSTD_decompress(out, out_len, in, len);
+
+            return (!ZSTD_isError(n) && n == out_len) ? ok : failure;
+        }
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        {
+            LZ4F_dctx *dctx = NULL;
+            size_t n = out_len;
+            size_t used = len;
+            size_t rc;
+
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+                return failure;
+            }
+            rc = LZ4F_decompress(dctx, out, &n, in, &used, NULL);
+            LZ4F_freeDecompressionContext(dctx);
+            /* 0 once the frame is complete */
+            return (rc == 0 && n == out_len && used == len) ? ok : failure;
+        }
+#endif
+    default:
+        return failure;
+    }
+}
+
+/*
+ * the reader
+ */
+
+/* compressed data read at a time, for zstd and lz4 */
+#define ZREADER_BUF_SIZE (64 * 1024)
+
+struct zreader_ {
+    unsigned int compression;
+    void *handle;                       /*!< the decompressor, or the file      */
+    FILE *fp;                           /*!< the file, for zstd and lz4         */
+    unsigned char *zbuf;                /*!< compressed data not yet used       */
+    size_t zpos;
+    size_t zlen;
+    int eof;
+};
+
+/* the backend that wrote a file, from its first bytes */
+static unsigned int zread_detect (const unsigned char *magic, size_t n) {
+    if (n >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return ZFILE_COMPRESSION_GZIP;
+    }
+    if (n >= 3 && memcmp(magic, "BZh", 3) == 0) {
+        return ZFILE_COMPRESSION_BZIP2;
+    }
+    if (n >= 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return ZFILE_COMPRESSION_ZSTD;
+    }
+    if (n >= 4 && magic[0] == 0x04 && magic[1] == 0x22 && magic[2] == 0x4d && magic[3] == 0x18) {
+        return ZFILE_COMPRESSION_LZ4;
+    }
+    return ZFILE_COMPRESSION_NONE;
+}
+
+#if defined(USE_ZSTD) || defined(USE_LZ4)
+/* make sure there is compressed data to use, unless the file has ended */
+static int zread_fill (zreader r) {
+    if (r->zpos < r->zlen || r->eof) {
+        return ok;
+    }
+    r->zpos = 0;
+    r->zlen = fread(r->zbuf, 1, ZREADER_BUF_SIZE, r->fp);
+    if (r->zlen == 0) {
+        if (ferror(r->fp)) {
+            return failure;
+        }
+        r->eof = 1;
+    }
+    return ok;
+}
+#endif
+
+/**
+ * \brief Open a file written by an output stream for reading.
+ *
+ * The backend is told by the first bytes of the file, so a file
+ * reads back whatever compression it was written with, as long as the
+ * build includes it; anything else is read as it is.
+ *
+ * \param fname The name of the file
+ * \return The reader, or NULL on failure
+ */
+zreader zread_open (const char *fname) {
+    unsigned char magic[4];
+    size_t n;
+    zreader r = calloc(1, sizeof(struct zreader_));
+
+    if (r == NULL) {
+        return NULL;
+    }
+    r->fp = fopen(fname, "rb");
+    if (r->fp == NULL) {
+        free(r);
+        return NULL;
+    }
+    n = fread(magic, 1, sizeof(magic), r->fp);
+    rewind(r->fp);
+    r->compression = zread_detect(magic, n);
+    if (!zcompression_available(r->compression)) {
+        joy_log_err("%s is %s compressed, which this build does not include",
+                    fname, zcompression_name(r->compression));
+        fclose(r->fp);
+        free(r);
+        return NULL;
+    }
+    switch (r->compression) {
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        fclose(r->fp);
+        r->fp = NULL;
+        r->handle = gzopen(fname, "rb");
+        break;
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        fclose(r->fp);
+        r->fp = NULL;
+        r->handle = BZ2_bzopen(fname, "rb");
+        break;
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        r->handle = ZSTD_createDStream();
+        r->zbuf = malloc(ZREADER_BUF_SIZE);
+        break;
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        {
+            LZ4F_dctx *dctx = NULL;
+
+            if (!LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) {
+                r->handle = dctx;
+            }
+            r->zbuf = malloc(ZREADER_BUF_SIZE);
+        }
+        break;
+#endif
+    default:
+        r->handle = r->fp;
+        break;
+    }
+    if (r->handle == NULL || ((r->compression == ZFILE_COMPRESSION_ZSTD ||
+                               r->compression == ZFILE_COMPRESSION_LZ4) && r->zbuf == NULL)) {
+        zread_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * \brief Read decompressed data.
+ * \param r The reader
+ * \param buf Where the data goes
+ * \param len Room at buf
+ * \return Bytes read, which is less than len only at the end of the
+ *         file, or -1 on error
+ */
+int zread (zreader r, void *buf, unsigned int len) {
+    switch (r->compression) {
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        return gzread((gzFile)r->handle, buf, len);
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        return BZ2_bzread(r->handle, buf, (int)len);
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        {
+            ZSTD_outBuffer out = { buf, len, 0 };
+
+            while (out.pos < out.size) {
+                ZSTD_inBuffer in;
+                size_t before = out.pos;
+
+                if (zread_fill(r) != ok) {
+                    return -1;
+                }
+                in.src = r->zbuf;
+                in.size = r->zlen;
+                in.pos = r->zpos;
+                if (ZSTD_isError(ZSTD_decompressStream((ZSTD_DStream *)r->handle, &out, &in))) {
+                    return -1;
+                }
+                r->zpos = in.pos;
+                if (r->eof && out.pos == before) {
+                    break;
+                }
+            }
+            return (int)out.pos;
+        }
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        {
+            size_t done = 0;
+
+            while (done < len) {
+                size_t out_len = len - done;
+                size_t in_len;
+
+                if (zread_fill(r) != ok) {
+                    return -1;
+                }
+                in_len = r->zlen - r->zpos;
+                if (LZ4F_isError(LZ4F_decompress((LZ4F_dctx *)r->handle, (char *)buf + done, &out_len,
+                                                 r->zbuf + r->zpos, &in_len, NULL))) {
+                    return -1;
+                }
+                r->zpos += in_len;
+                done += out_len;
+                if (r->eof && out_len == 0) {
+                    break;
+                }
+            }
+            return (int)done;
+        }
+#endif
+    default:
+        {
+            size_t n = fread(buf, 1, len, (FILE *)r->handle);
+
+            return ferror((FILE *)r->handle) ? -1 : (int)n;
+        }
+    }
+}
+
+/**
+ * \brief Close a reader.
+ * \param r The reader; NULL is ignored
+ * \return none
+ */
+void zread_close (zreader r) {
+    if (r == NULL) {
+        return;
+    }
+    switch (r->compression) {
+#ifdef ZFILE_HAVE_GZIP
+    case ZFILE_COMPRESSION_GZIP:
+        if (r->handle != NULL) {
+            gzclose((gzFile)r->handle);
+        }
+        break;
+#endif
+#ifdef USE_BZIP2
+    case ZFILE_COMPRESSION_BZIP2:
+        if (r->handle != NULL) {
+            BZ2_bzclose(r->handle);
+        }
+        break;
+#endif
+#ifdef USE_ZSTD
+    case ZFILE_COMPRESSION_ZSTD:
+        ZSTD_freeDStream((ZSTD_DStream *)r->handle);
+        break;
+#endif
+#ifdef USE_LZ4
+    case ZFILE_COMPRESSION_LZ4:
+        if (r->handle != NULL) {
+            LZ4F_freeDecompressionContext((LZ4F_dctx *)r->handle);
+        }
+        break;
+#endif
+    default:
+        break;
+    }
+    if (r->fp != NULL) {
+        fclose(r->fp);
+    }
+    free(r->zbuf);
+    free(r);
+}
+
+/*
+ * unit test
+ */
+
+#define OUTPUT_TEST_FILE "output-unit-test"
+#define OUTPUT_TEST_RECORDS 200000
+#define OUTPUT_TEST_BIG (ZFILE_BUF_SIZE + ZFILE_BUF_SIZE / 2)
+
+/* read a whole file back through the decompressor */
+static char *output_test_read (const char *fname, size_t *len) {
+    size_t size = 1024 * 1024;
+    char *data = malloc(size);
+    int n;
+    zreader in = zread_open(fname);
+
+    *len = 0;
+    if (data == NULL || in == NULL) {
+        free(data);
+        zread_close(in);
+        return NULL;
+    }
+    while (1) {
+        if (size - *len < 65536) {
+            char *tmp = realloc(data, size * 2);
+
+            if (tmp == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = tmp;
+            size *= 2;
+        }
+        n = zread(in, data + *len, 65536);
+        if (n <= 0) {
+            break;
+        }
+        *len += n;
+    }
+    zread_close(in);
+    return data;
+}
+
+/*
+ * write the same records through each backend the build includes, at
+ * a few levels, and check that they read back, and that blocks make
+ * the round trip through zcompress_block()
+ */
+static int output_test_backends (void) {
+    static const int levels[] = { 0, 1, 9 };
+    char fname[64];
+    char line[128];
+    char *data;
+    unsigned char *block;
+    unsigned char *back;
+    size_t len, block_len, expected;
+    unsigned int c, i, k;
+    int num_fails = 0;
+
+    for (c = ZFILE_COMPRESSION_NONE; c < ZFILE_COMPRESSION_MAX; c++) {
+        if (!zcompression_available(c)) {
+            continue;
+        }
+        snprintf(fname, sizeof(fname), "%s%s", OUTPUT_TEST_FILE, zcompression_suffix(c));
+        for (k = 0; k < sizeof(levels) / sizeof(levels[0]); k++) {
+            zfile f = zopen_compressed(fname, "w", c, levels[k], (k == 2) ? 2 : 0);
+
+            if (f == NULL) {
+                joy_log_err("could not open %s with %s", fname, zcompression_name(c));
+                num_fails++;
+                continue;
+            }
+            expected = 0;
+            for (i = 0; i < 10000; i++) {
+                expected += zprintf(f, "{\"record\":%u,\"padding\":\"%0*u\"}\n", i, (int)(i % 64), i);
+                zcommit(f);
+                if (i == 5000) {
+                    zflush(f);
+                }
+            }
+            zclose(f);
+
+            data = output_test_read(fname, &len);
+            if (data == NULL || len != expected) {
+                joy_log_err("%s level %d: read back %lu bytes, expected %lu", zcompression_name(c),
+                            levels[k], (unsigned long)len, (unsigned long)expected);
+                num_fails++;
+            } else {
+                size_t off = 0;
+
+                for (i = 0; i < 10000; i++) {
+                    int n = snprintf(line, sizeof(line), "{\"record\":%u,\"padding\":\"%0*u\"}\n",
+                                     i, (int)(i % 64), i);
+
+                    if (memcmp(data + off, line, n) != 0) {
+                        joy_log_err("%s level %d: record %u differs", zcompression_name(c), levels[k], i);
+                        num_fails++;
+                        break;
+                    }
+                    off += n;
+                }
+            }
+            if (data != NULL && levels[k] == 0) {
+                block_len = zcompress_bound(c, len);
+                block = malloc(block_len);
+                back = malloc(len);
+                if (block == NULL || back == NULL ||
+                    zcompress_block(c, 0, data, len, block, &block_len) != ok ||
+                    zdecompress_block(c, block, block_len, back, len) != ok ||
+                    memcmp(back, data, len) != 0) {
+                    joy_log_err("%s blocks do not make the round trip", zcompression_name(c));
+                    num_fails++;
+                }
+                free(block);
+                free(back);
+            }
+            free(data);
+            remove(fname);
+        }
+    }
+    return num_fails;
+}
+
+/* check the writers against the printf formats they stand in for */
+static int output_test_writers (const char *fname) {
+    static const unsigned char bytes[] = { 0x00, 0x0f, 0xa5, 0xff };
+    static const unsigned int uints[] = { 0, 9, 10, 99, 100, 65535, 4294967295U };
+    static const int ints[] = { -2147483647 - 1, -100, -1, 0, 7, 2147483647 };
+    char expected[512];
+    char *data;
+    size_t len;
+    unsigned int i;
+    int n = 0;
+    int num_fails = 0;
+    zfile f = zopen(fname, "w");
+
+    if (f == NULL) {
+        joy_log_err("could not open %s", fname);
+        return 1;
+    }
+    for (i = 0; i < sizeof(uints) / sizeof(uints[0]); i++) {
+        zprint_uint(f, uints[i]);
+        zputc(f, ',');
+        n += snprintf(expected + n, sizeof(expected) - n, "%u,", uints[i]);
+    }
+    for (i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+        zprint_int(f, ints[i]);
+        zputc(f, ',');
+        n += snprintf(expected + n, sizeof(expected) - n, "%d,", ints[i]);
+    }
+    zprint_uint64(f, 18446744073709551615ULL);
+    zprint_int64(f, -9223372036854775807LL - 1);
+    zprint_timestamp(f, 1234567890, 5);
+    zprint_timestamp(f, 0, 999999);
+    zprint_hex(f, bytes, sizeof(bytes));
+    zprint_json_string(f, "plain");
+    zprint_json_string(f, "q\"b\\n\n\x01/");
+    zprint_json_string(f, NULL);
+    zputs(f, NULL);
+    zputs(f, "end");
+    n += snprintf(expected + n, sizeof(expected) - n, "%s",
+                  "18446744073709551615-9223372036854775808"
+                  "1234567890.0000050.999999"
+                  "000fa5ff"
+                  "\"plain\"\"q\\\"b\\\\n\\n\\u0001/\"\"\"end");
+    zcommit(f);
+    zclose(f);
+
+    data = output_test_read(fname, &len);
+    if (data == NULL || len != (size_t)n || memcmp(data, expected, n) != 0) {
+        joy_log_err("writers do not match their printf formats");
+        num_fails++;
+    }
+    free(data);
+    remove(fname);
+
+    return num_fails;
+}
+
+/**
+ * \brief Unit test for the output streams.
+ *
+ * Checks the writers for integers, strings, hex and timestamps, and
+ * each compression backend of the build, then writes records through
+ * an asynchronous stream, including one larger than a buffer, and
+ * checks that the file reads back the same and that the counters add
+ * up.
+ *
+ * \return 0 on success, otherwise the number of failures
+ */
+int output_unit_test (void) {
+    char fname[64];
+    char *big;
+    char *data;
+    char *p;
+    size_t len;
+    unsigned long expected = 0;
+    unsigned int i;
+    zfile_stats_t stats;
+    zfile f;
+    int num_fails = 0;
+
+    snprintf(fname, sizeof(fname), "%s%s", OUTPUT_TEST_FILE, zsuffix);
+    num_fails += output_test_writers(fname);
+    num_fails += output_test_backends();
+
+    big = malloc(OUTPUT_TEST_BIG);
+    f = zopen(fname, "w");
+    if (big == NULL || f == NULL) {
+        joy_log_err("could not open %s", fname);
+        free(big);
+        if (f != NULL) {
+            zclose(f);
+        }
+        return 1;
+    }
+    memset_s(big, OUTPUT_TEST_BIG, 'x', OUTPUT_TEST_BIG - 1);
+    big[OUTPUT_TEST_BIG - 1] = '\n';
+
+    /* the first record is written before the writer thread starts */
+    expected += zprintf(f, "{\"record\":%u}\n", 0);
+    if (zasync(f) != ok) {
+        joy_log_err("could not start the writer thread");
+        num_fails++;
+    }
+    for (i = 1; i < OUTPUT_TEST_RECORDS; i++) {
+        expected += zprintf(f, "{\"record\":%u,\"padding\":\"%0*u\"}\n", i, (int)(i % 64), i);
+        zcommit(f);
+        if (i == OUTPUT_TEST_RECORDS / 2) {
+            expected += zwrite(f, big, OUTPUT_TEST_BIG);
+        }
+    }
+    zstats(f, &stats);
+    if (stats.bytes != expected || stats.bytes_written > stats.bytes ||
+        stats.queued > ZFILE_MAX_BUFS || stats.max_queued > ZFILE_MAX_BUFS) {
+        joy_log_err("counters are inconsistent: %lu bytes in, %lu written, %u queued",
+                    stats.bytes, stats.bytes_written, stats.queued);
+        num_fails++;
+    }
+    zflush(f);
+    zstats(f, &stats);
+    if (stats.bytes_written != stats.bytes || stats.queued != 0) {
+        joy_log_err("flush left %lu of %lu bytes unwritten",
+                    stats.bytes - stats.bytes_written, stats.bytes);
+        num_fails++;
+    }
+    if (zclose(f) != 0) {
+        joy_log_err("could not close %s", fname);
+        num_fails++;
+    }
+
+    data = output_test_read(fname, &len);
+    if (data == NULL || len != expected) {
+        joy_log_err("read back %lu bytes, expected %lu", (unsigned long)len, expected);
+        num_fails++;
+    } else {
+        p = data;
+        for (i = 0; i < OUTPUT_TEST_RECORDS; i++) {
+            char line[128];
+            int n;
+
+            if (i == 0) {
+                n = snprintf(line, sizeof(line), "{\"record\":%u}\n", 0);
+            } else {
+                n = snprintf(line, sizeof(line), "{\"record\":%u,\"padding\":\"%0*u\"}\n", i, (int)(i % 64), i);
+            }
+            if (memcmp(p, line, n) != 0) {
+                joy_log_err("record %u differs", i);
+                num_fails++;
+                break;
+            }
+            p += n;
+            if (i == OUTPUT_TEST_RECORDS / 2) {
+                if (memcmp(p, big, OUTPUT_TEST_BIG) != 0) {
+                    joy_log_err("large record differs");
+                    num_fails++;
+                    break;
+                }
+                p += OUTPUT_TEST_BIG;
+            }
+        }
+    }
+    free(data);
+    free(big);
+    remove(fname);
+
+    return num_fails;
+}
@@ -46,13 +46,17 @@
 
 #ifdef WIN32
 # include "time.h"
+#else
+# include <sys/mman.h>  /* for the hugepage backed record pool */
 #endif
 
 #include <stdlib.h>
 #include <pthread.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>   /* for FLT_EPSILON */
+#include <openssl/rand.h> /* for seeding the flow key hash */
 #include "safe_lib.h"
 #include "pkt.h"
 #include "pkt_proc.h" /* packet processing               */
@@ -63,6 +67,8 @@
 #include "procwatch.h"  /* process to flow mapping       */
 #include "radix_trie.h" /* trie for subnet labels        */
 #include "config.h"     /* configuration                 */
+#include "print_plan.h" /* members of the JSON output    */
+#include "affinity.h"   /* NUMA placement                */
 #include "output.h"     /* compressed output             */
 #include "salt.h"  // Because Windows!
 #include "ipfix.h" /* ipfix protocol */
@@ -101,6 +107,16 @@ static const int include_os = 1;
 #define expiration_type_reserved 'z'
 #define expiration_type_active  'a'
 #define expiration_type_inactive 'i'
+#define expiration_type_evicted 'e'
+
+/*
+ * The callback that is handed each expired flow before it is deleted,
+ * and whether the flow records are still written to the output; see
+ * flow_record_set_export()
+ */
+static flow_export_fn *flow_export = NULL;
+static void *flow_export_arg = NULL;
+static unsigned int flow_export_output = 1;
 
 /*
  * Local prototypes
@@ -124,6 +140,9 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
     char time_str[128];
     struct timeval now, tmp;
     float bps, pps, rps, seconds;
+    float load, probes;
+    unsigned long int lookups;
+    zfile_stats_t zs;
 
 #ifdef WIN32
         time_t win_now;
@@ -140,6 +159,17 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
     pps = (float) (ctx->stats.num_packets - ctx->last_stats.num_packets) / seconds;
     rps = (float) (ctx->stats.num_records_output - ctx->last_stats.num_records_output) / seconds;
 
+    /* flow table occupancy and average probe length since the last output */
+    load = 0.0;
+    if (ctx->flow_table.size) {
+        load = (float) (ctx->flow_table.count + ctx->flow_table.old_count) / ctx->flow_table.size;
+    }
+    probes = 0.0;
+    lookups = ctx->stats.num_table_lookups - ctx->last_stats.num_table_lookups;
+    if (lookups) {
+        probes = (float) (ctx->stats.num_table_probes - ctx->last_stats.num_table_probes) / lookups;
+    }
+
 #ifdef WIN32
         strftime(time_str, sizeof(time_str) - 1, "%a %b %d %H:%M:%S %Z %Y", localtime(&win_now));
 #else
@@ -147,6 +177,21 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
 #endif
     fprintf(f, "Context id: %d, %s info: %lu packets, %lu active records, %lu records output, %lu alloc fails, %.4e bytes/sec, %.4e packets/sec, %.4e records/sec\n",
               ctx->ctx_id, time_str, ctx->stats.num_packets, ctx->stats.num_records_in_table, ctx->stats.num_records_output, ctx->stats.malloc_fail, bps, pps, rps);
+    fprintf(f, "Context id: %d, flow table: %u slots, %.2f load factor, %.2f avg probes, %lu max probes, %lu resizes%s\n",
+              ctx->ctx_id, ctx->flow_table.size, load, probes, ctx->stats.max_table_probe, ctx->stats.num_table_resizes,
+              ctx->flow_table.old_slots ? " (resize in progress)" : "");
+    if (ctx->record_pool.slab != NULL) {
+        fprintf(f, "Context id: %d, flow record pool: %u of %u records free, %lu pool exhausted%s\n",
+                  ctx->ctx_id, ctx->record_pool.num_free, ctx->record_pool.capacity,
+                  ctx->stats.pool_exhausted, ctx->record_pool.mapped ? " (hugepages)" : "");
+    }
+    fprintf(f, "Context id: %d, flows: %lu expired, %lu evicted\n",
+              ctx->ctx_id, ctx->stats.flows_expired, ctx->stats.flows_evicted);
+    zstats(ctx->output, &zs);
+    if (zs.bytes) {
+        fprintf(f, "Context id: %d, output: %u buffers queued (max %u), %lu bytes in, %lu bytes written, %lu waits for the writer\n",
+                  ctx->ctx_id, zs.queued, zs.max_queued, zs.bytes, zs.bytes_written, zs.waits);
+    }
     fflush(f);
 
     ctx->last_stats_output_time = now;
@@ -155,6 +200,15 @@ void flocap_stats_output (joy_ctx_data *ctx, FILE *f) {
     ctx->last_stats.num_records_in_table = ctx->stats.num_records_in_table;
     ctx->last_stats.num_records_output = ctx->stats.num_records_output;
     ctx->last_stats.malloc_fail = ctx->stats.malloc_fail;
+    ctx->last_stats.num_table_lookups = ctx->stats.num_table_lookups;
+    ctx->last_stats.num_table_probes = ctx->stats.num_table_probes;
+    ctx->last_stats.num_table_resizes = ctx->stats.num_table_resizes;
+    ctx->last_stats.pool_exhausted = ctx->stats.pool_exhausted;
+    ctx->last_stats.flows_expired = ctx->stats.flows_expired;
+    ctx->last_stats.flows_evicted = ctx->stats.flows_evicted;
+
+    /* the longest probe is reported per interval */
+    ctx->stats.max_table_probe = 0;
 }
 
 /**
@@ -169,73 +223,404 @@ void flocap_stats_timer_init (joy_ctx_data *ctx) {
     ctx->last_stats_output_time = now;
 }
 
+/*
+ * flow key hashing
+ *
+ * The key is read as five 64-bit words (two per address, one for the
+ * ports and protocol).  Each word goes through its own keyed
+ * multiply-rotate-multiply round, so the lanes are independent and can
+ * be evaluated in parallel; the lanes are then merged and finalized.
+ * The per-process seed makes the bucket of a key unpredictable to an
+ * outside observer, so crafted traffic can't aim at a single probe
+ * sequence.
+ */
+#define FLOW_KEY_HASH_LANES 5
+#define FLOW_KEY_HASH_PRIME1 0x9E3779B185EBCA87ULL
+#define FLOW_KEY_HASH_PRIME2 0xC2B2AE3D27D4EB4FULL
+#define FLOW_KEY_HASH_PRIME3 0x165667B19E3779F9ULL
+
+#define flow_key_hash_rotl(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t flow_key_hash_seed[FLOW_KEY_HASH_LANES];
+static int flow_key_hash_seeded = 0;
+
+/**
+ * \brief Seed the flow key hash, once per process.
+ *
+ * All contexts share the seed, so a record's key_hash is meaningful
+ * in any of them.
+ *
+ * \param none
+ * \return none
+ */
+static void flow_key_hash_seed_init (void) {
+    unsigned int i;
+
+    if (flow_key_hash_seeded) {
+        return;
+    }
+    if (!RAND_bytes((unsigned char *)flow_key_hash_seed, sizeof(flow_key_hash_seed))) {
+        struct timeval now;
+
+        joy_log_warn("flow key hash prng failure, seeding from the clock");
+        gettimeofday(&now, NULL);
+        for (i = 0; i < FLOW_KEY_HASH_LANES; i++) {
+            flow_key_hash_seed[i] = ((uint64_t)now.tv_sec << 20) ^ (uint64_t)now.tv_usec ^
+                                    ((uint64_t)(i + 1) * FLOW_KEY_HASH_PRIME3);
+        }
+    }
+    flow_key_hash_seeded = 1;
+}
+
+/**
+ * \brief Hash the words of a flow key.
+ * \param w The key words
+ * \return 32-bit hash
+ */
+static inline uint32_t flow_key_hash_words (const uint64_t w[FLOW_KEY_HASH_LANES]) {
+    uint64_t lane[FLOW_KEY_HASH_LANES];
+    uint64_t h;
+    unsigned int i;
+
+    for (i = 0; i < FLOW_KEY_HASH_LANES; i++) {
+        lane[i] = (w[i] ^ flow_key_hash_seed[i]) * FLOW_KEY_HASH_PRIME2;
+        lane[i] = flow_key_hash_rotl(lane[i], 31) * FLOW_KEY_HASH_PRIME1;
+    }
+
+    h = flow_key_hash_rotl(lane[0], 1) + flow_key_hash_rotl(lane[1], 7) +
+        flow_key_hash_rotl(lane[2], 12) + flow_key_hash_rotl(lane[3], 18) +
+        flow_key_hash_rotl(lane[4], 27);
+
+    /* finalize so that every input bit affects the low (index) bits */
+    h ^= h >> 33;
+    h *= FLOW_KEY_HASH_PRIME2;
+    h ^= h >> 29;
+    h *= FLOW_KEY_HASH_PRIME3;
+    h ^= h >> 32;
+
+    return (uint32_t)h;
+}
+
 /**
  * \brief Calculate the hash of a given flow_key.
+ *
+ * In FLOW_KEY_HASH_SYMMETRIC mode the two endpoints (address, port)
+ * are put into a canonical order before hashing, so that a key and
+ * its twin hash to the same value; in FLOW_KEY_HASH_DIRECTED mode they
+ * are hashed as they appear.  With NEAR_MATCH the addresses are left
+ * out and the hash is always symmetric.
+ *
  * \param f The flow_key to hash
+ * \param mode FLOW_KEY_HASH_DIRECTED or FLOW_KEY_HASH_SYMMETRIC
  * \return Hash of \p f
  */
-static unsigned int flow_key_hash (const flow_key_t *f) {
-    uint32_t hash = 0;
-
-    if (glb_config->flow_key_match_method == EXACT_MATCH) {
-        /*
-         * for IPv4 addresses, the upper 96 bits are zero, so using the IPv6 union of the structure
-         * does not affect the sum or the resulting hash.
-         */
-#ifdef DARWIN
-        hash += (uint32_t)f->sa.v6_sa.__u6_addr.__u6_addr32[0];
-        hash += (uint32_t)f->sa.v6_sa.__u6_addr.__u6_addr32[1];
-        hash += (uint32_t)f->sa.v6_sa.__u6_addr.__u6_addr32[2];
-        hash += (uint32_t)f->sa.v6_sa.__u6_addr.__u6_addr32[3];
-        hash += (uint32_t)f->da.v6_da.__u6_addr.__u6_addr32[0];
-        hash += (uint32_t)f->da.v6_da.__u6_addr.__u6_addr32[1];
-        hash += (uint32_t)f->da.v6_da.__u6_addr.__u6_addr32[2];
-        hash += (uint32_t)f->da.v6_da.__u6_addr.__u6_addr32[3];
-#else
-        hash += (uint32_t)f->sa.v6_sa.__in6_u.__u6_addr32[0];
-        hash += (uint32_t)f->sa.v6_sa.__in6_u.__u6_addr32[1];
-        hash += (uint32_t)f->sa.v6_sa.__in6_u.__u6_addr32[2];
-        hash += (uint32_t)f->sa.v6_sa.__in6_u.__u6_addr32[3];
-        hash += (uint32_t)f->da.v6_da.__in6_u.__u6_addr32[0];
-        hash += (uint32_t)f->da.v6_da.__in6_u.__u6_addr32[1];
-        hash += (uint32_t)f->da.v6_da.__in6_u.__u6_addr32[2];
-        hash += (uint32_t)f->da.v6_da.__in6_u.__u6_addr32[3];
-#endif
-        hash += (uint32_t)f->sp;
-        hash += (uint32_t)f->dp;
-        hash += (uint32_t)f->prot;
-
-        hash *= 0xFFD9;
-        hash -= (hash >> 16);
-        hash &= flow_key_hash_mask;
+static uint32_t flow_key_hash_mode (const flow_key_t *f, enum flow_key_hash_mode mode) {
+    uint64_t w[FLOW_KEY_HASH_LANES];
+    const struct in6_addr *a = &f->sa.v6_sa;
+    const struct in6_addr *b = &f->da.v6_da;
+    uint16_t pa = f->sp;
+    uint16_t pb = f->dp;
+    int diff = 0;
 
-    } else {  /* flow_key_match_method == NEAR_MATCH */
+    if (glb_config->flow_key_match_method == NEAR_MATCH) {
         /*
          * To make it possible to identify NAT'ed twins, the hash of the
          * flows (sa, da, sp, dp, pr) and (*, *, dp, sp, pr) are identical.
          * This is done by omitting addresses and sorting the ports into
          * order before hashing.
          */
-        hash += (uint32_t)f->sp;
-        hash += (uint32_t)f->dp;
-        hash += (uint32_t)f->prot;
+        w[0] = w[1] = w[2] = w[3] = 0;
+        if (pa > pb) {
+            pa = f->dp;
+            pb = f->sp;
+        }
+    } else {
+        if (mode == FLOW_KEY_HASH_SYMMETRIC) {
+            memcmp_s(a, sizeof(struct in6_addr), b, sizeof(struct in6_addr), &diff);
+            if (diff > 0 || (diff == 0 && pa > pb)) {
+                a = &f->da.v6_da;
+                b = &f->sa.v6_sa;
+                pa = f->dp;
+                pb = f->sp;
+            }
+        }
+        /*
+         * for IPv4 addresses, the upper 96 bits are zero, so the IPv6 view
+         * of the union covers both address families
+         */
+        memcpy_s(&w[0], 2 * sizeof(uint64_t), a, sizeof(struct in6_addr));
+        memcpy_s(&w[2], 2 * sizeof(uint64_t), b, sizeof(struct in6_addr));
+    }
+    w[4] = ((uint64_t)pa << 32) | ((uint64_t)pb << 16) | (uint64_t)f->prot;
+
+    return flow_key_hash_words(w);
+}
+
+/**
+ * \brief Calculate the flow table hash of a given flow_key.
+ *
+ * When bidirectional flows are tracked the symmetric mode is used, so
+ * that a record's twin sits in the same probe sequence and is found
+ * with the record's own key_hash.
+ *
+ * \param f The flow_key to hash
+ * \return Hash of \p f
+ */
+static uint32_t flow_key_hash (const flow_key_t *f) {
+    if (glb_config->bidir) {
+        return flow_key_hash_mode(f, FLOW_KEY_HASH_SYMMETRIC);
+    }
+    return flow_key_hash_mode(f, FLOW_KEY_HASH_DIRECTED);
+}
+
+/*
+ * flow record pool
+ *
+ * When flow_pool_size is set, each context preallocates that many
+ * flow records and recycles them through a free list, so that new
+ * flows don't go to the heap.  Records are taken from the heap once
+ * the pool is empty; those are counted in pool_exhausted and freed
+ * normally.
+ */
+
+/* hugepage size assumed when rounding the slab length */
+#define FLOW_RECORD_POOL_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+/* true if record r lies within the slab of pool p */
+#define flow_record_pool_owns(p, r) \
+    ((p)->slab != NULL && (r) >= (p)->slab && (r) < (p)->slab + (p)->capacity)
+
+/**
+ * \brief Release the slab of a flow record pool.
+ *
+ * Records allocated from the pool must not be used afterwards.
+ *
+ * \param pool The flow record pool
+ * \return none
+ */
+static void flow_record_pool_release (flow_record_pool_t *pool) {
+    if (pool->slab != NULL) {
+#ifndef WIN32
+        if (pool->mapped) {
+            munmap(pool->slab, pool->slab_len);
+        } else {
+            free(pool->slab);
+        }
+#else
+        free(pool->slab);
+#endif
+    }
+    memset_s(pool, sizeof(flow_record_pool_t), 0x00, sizeof(flow_record_pool_t));
+}
 
-        hash *= 0xFFD9;
-        hash -= (hash >> 16);
-        hash &= flow_key_hash_mask;
+/**
+ * \brief Preallocate the flow record pool of a context.
+ *
+ * Does nothing if the pool already exists.  Building the free list
+ * touches every record, so the pages are faulted in here rather than
+ * on the packet path.
+ *
+ * \param ctx The context that owns the pool
+ * \param capacity Number of records to preallocate; 0 disables the pool
+ * \param hugepages Try to back the slab with hugepages
+ * \return ok or failure
+ */
+static int flow_record_pool_init (joy_ctx_data *ctx, uint32_t capacity, bool hugepages) {
+    flow_record_pool_t *pool = &ctx->record_pool;
+    size_t len = (size_t)capacity * sizeof(flow_record_t);
+    uint32_t i;
+
+    if (pool->slab != NULL || capacity == 0) {
+        return ok;
     }
 
-    return hash;
+#if !defined(WIN32) && defined(MAP_HUGETLB)
+    if (hugepages) {
+        size_t map_len = (len + FLOW_RECORD_POOL_HUGEPAGE_SIZE - 1) & ~((size_t)FLOW_RECORD_POOL_HUGEPAGE_SIZE - 1);
+        void *slab = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+        if (slab != MAP_FAILED) {
+            pool->slab = slab;
+            pool->slab_len = map_len;
+            pool->mapped = 1;
+        } else {
+            joy_log_warn("could not map %lu bytes of hugepages for flow records (%s), using the heap",
+                         (unsigned long)map_len, strerror(errno));
+        }
+    }
+#else
+    if (hugepages) {
+        joy_log_warn("hugepages are not supported on this platform, using the heap");
+    }
+#endif
+
+    if (pool->slab == NULL) {
+        pool->slab = calloc(capacity, sizeof(flow_record_t));
+        if (pool->slab == NULL) {
+            joy_log_err("could not preallocate %u flow records", capacity);
+            return failure;
+        }
+        pool->slab_len = len;
+    }
+    pool->capacity = capacity;
+
+    /* chain the free list so that records are handed out in address order */
+    for (i = 0; i < capacity; i++) {
+        pool->slab[i].time_next = (i + 1 < capacity) ? &pool->slab[i + 1] : NULL;
+    }
+    pool->free_list = pool->slab;
+    pool->num_free = capacity;
+
+    joy_log_info("context(%d) preallocated %u flow records (%lu bytes%s)", ctx->ctx_id, capacity,
+                 (unsigned long)pool->slab_len, pool->mapped ? ", hugepages" : "");
+    return ok;
+}
+
+/**
+ * \brief Allocate a flow record, from the context's pool if possible.
+ * \param ctx The context that will own the record
+ * \return Flow record, or NULL if the heap allocation failed
+ */
+static flow_record_t *flow_record_alloc (joy_ctx_data *ctx) {
+    flow_record_pool_t *pool = &ctx->record_pool;
+    flow_record_t *record = pool->free_list;
+
+    if (record != NULL) {
+        pool->free_list = record->time_next;
+        pool->num_free--;
+        record->time_next = NULL;
+        return record;
+    }
+
+    if (pool->slab != NULL) {
+        flocap_stats_incr_pool_exhausted(ctx);
+    }
+    return calloc(1, sizeof(flow_record_t));
+}
+
+/**
+ * \brief Return a flow record to the pool it came from, or to the heap.
+ * \param ctx The context that owns the record
+ * \param record The flow record
+ * \return none
+ */
+static void flow_record_free (joy_ctx_data *ctx, flow_record_t *record) {
+    flow_record_pool_t *pool = &ctx->record_pool;
+
+    if (flow_record_pool_owns(pool, record)) {
+        record->time_next = pool->free_list;
+        pool->free_list = record;
+        pool->num_free++;
+    } else {
+        free(record);
+    }
+}
+
+/*
+ * marks a slot of old_slots whose record has been migrated or
+ * deleted; it keeps the probe sequences through that slot intact
+ */
+#define FLOW_TABLE_TOMBSTONE ((flow_record_t *)1)
+
+/* number of old_slots migrated by each insertion during a resize */
+#define FLOW_TABLE_REHASH_STEP 32
+
+/* the flow table grows once it is three quarters full */
+#define flow_table_over_loaded(t) \
+    ((uint64_t)((t)->count + (t)->old_count) * 4 > (uint64_t)(t)->size * 3)
+
+/**
+ * \brief Round a requested flow table size up to a supported power of two.
+ * \param size Requested number of slots, or 0 for the default
+ * \return Number of slots to allocate
+ */
+static uint32_t flow_table_size_round (uint32_t size) {
+    uint32_t n = FLOW_TABLE_MIN_SIZE;
+
+    if (size == 0) {
+        return FLOW_TABLE_DEFAULT_SIZE;
+    }
+    while (n < size && n < FLOW_TABLE_MAX_SIZE) {
+        n <<= 1;
+    }
+    return n;
+}
+
+/**
+ * \brief Release the slot arrays of a flow table; records are not touched.
+ * \param t The flow table
+ * \return none
+ */
+static void flow_table_release (flow_table_t *t) {
+    free(t->slots);
+    free(t->old_slots);
+    memset_s(t, sizeof(flow_table_t), 0x00, sizeof(flow_table_t));
+}
+
+/**
+ * \brief Allocate the slot array of an empty flow table.
+ * \param t The flow table
+ * \param size Requested number of slots, or 0 for the default
+ * \return ok or failure
+ */
+static int flow_table_alloc (flow_table_t *t, uint32_t size) {
+    flow_table_release(t);
+
+    size = flow_table_size_round(size);
+    t->slots = calloc(size, sizeof(flow_table_slot_t));
+    if (t->slots == NULL) {
+        joy_log_err("could not allocate flow table with %u slots", size);
+        return failure;
+    }
+    t->size = size;
+    return ok;
 }
 
 /**
  * \brief Initialize the flow_record_list.
- * \param none
- * \param return
+ * \param ctx The context
+ * \return ok, or failure if the flow table or record pool could not be allocated
  */
-void flow_record_list_init (joy_ctx_data *ctx) {
+int flow_record_list_init (joy_ctx_data *ctx) {
+    flow_key_hash_seed_init();
     ctx->flow_record_chrono_first = ctx->flow_record_chrono_last = NULL;
-    memset_s(ctx->flow_record_list_array,  sizeof(ctx->flow_record_list_array), 0x00, sizeof(ctx->flow_record_list_array));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    if (flow_table_alloc(&ctx->flow_table, glb_config->flow_table_size) != ok) {
+        return failure;
+    }
+    if (flow_record_pool_init(ctx, glb_config->flow_pool_size, glb_config->hugepages) != ok) {
+        flow_table_release(&ctx->flow_table);
+        return failure;
+    }
+    return ok;
+}
+
+/**
+ * \brief Move the flow table and flow record pool of a context to a NUMA node.
+ *
+ * Slots allocated when the table grows, and records taken from the
+ * heap, come from the thread that processes the context's packets.
+ *
+ * \param ctx The context
+ * \param node The node, see affinity.h
+ * \return ok, or failure if some of the memory could not be moved
+ */
+int flow_record_list_place (joy_ctx_data *ctx, int node) {
+    flow_table_t *t = &ctx->flow_table;
+    int rc = ok;
+
+    if (affinity_place(t->slots, (size_t)t->size * sizeof(flow_table_slot_t), node) != ok) {
+        rc = failure;
+    }
+    if (affinity_place(t->old_slots, (size_t)t->old_size * sizeof(flow_table_slot_t), node) != ok) {
+        rc = failure;
+    }
+    if (affinity_place(ctx->record_pool.slab, ctx->record_pool.slab_len, node) != ok) {
+        rc = failure;
+    }
+    return rc;
 }
 
 /**
@@ -244,22 +629,40 @@ void flow_record_list_init (joy_ctx_data *ctx) {
  * \return none
  */
 void flow_record_list_free (joy_ctx_data *ctx) {
-    flow_record_t *record = NULL;
-    flow_record_t *tmp = NULL;
+    flow_table_t *t = &ctx->flow_table;
     unsigned int i, count = 0;
 
-    for (i=0; i<FLOW_RECORD_LIST_LEN; i++) {
-        record = ctx->flow_record_list_array[i];
-        while (record != NULL) {
-            tmp = record->next;
-            flow_record_delete(ctx, record);
-            record = tmp;
+    /*
+     * records that are still waiting to be migrated are removed by
+     * tombstoning, so the old array can be walked in place
+     */
+    for (i=0; i<t->old_size; i++) {
+        if (t->old_slots[i].record != NULL && t->old_slots[i].record != FLOW_TABLE_TOMBSTONE) {
+            flow_record_delete(ctx, t->old_slots[i].record);
+            count++;
+        }
+    }
+
+    /*
+     * deleting from the current array shifts the rest of a probe
+     * sequence back into the vacated slot, so keep deleting at the
+     * same index until it is empty
+     */
+    for (i=0; i<t->size; i++) {
+        while (t->slots[i].record != NULL) {
+            flow_record_delete(ctx, t->slots[i].record);
             count++;
         }
-        ctx->flow_record_list_array[i] = NULL;
     }
+
+    flow_table_release(t);
+    flow_record_pool_release(&ctx->record_pool);
+    columnar_close(ctx->columnar);
+    ctx->columnar = NULL;
     ctx->flow_record_chrono_first = NULL;
     ctx->flow_record_chrono_last = NULL;
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
     joy_log_debug("(%d) flow records free'd from context(%d)", count, ctx->ctx_id);
 }
 
@@ -369,6 +772,8 @@ static flow_record_t *flow_key_get_twin(joy_ctx_data *ctx,
                                         const flow_key_t *key,
                                         unsigned int key_hash);
 
+static void flow_timer_unlink(flow_timer_t *w, flow_record_t *record);
+
 /**
  * \brief Initialize a flow_record.
  * \param[out] record Flow record
@@ -406,171 +811,367 @@ static inline unsigned int flow_record_is_in_chrono_list (joy_ctx_data *ctx, con
     return 0;
 }
 
+/* comparison used while probing; returns 0 on a match */
+typedef int (*flow_key_cmp_func)(const flow_key_t *a, const flow_key_t *b);
+
 /**
- * \brief Find the flow record in list, if it exists.
- * \param list The list of flow_records to search
+ * \brief Probe one slot array of the flow table for a key.
+ * \param ctx The context, for the lookup statistics
+ * \param slots The slot array to search
+ * \param size The number of slots in \p slots
+ * \param hash The hash of the flow_key
  * \param key The flow_key used to identify the flow_record
+ * \param key_cmp flow_key_is_eq or flow_key_is_twin
  * \return Valid flow_record or NULL
  */
-static flow_record_t *flow_record_list_find_record_by_key (const flow_record_list *list,
-                                                                const flow_key_t *key) {
-    flow_record_t *record = *list;
+static flow_record_t *flow_table_probe (joy_ctx_data *ctx,
+                                        const flow_table_slot_t *slots,
+                                        uint32_t size,
+                                        uint32_t hash,
+                                        const flow_key_t *key,
+                                        flow_key_cmp_func key_cmp) {
+    uint32_t mask = size - 1;
+    uint32_t i = hash & mask;
+    unsigned long int probes = 0;
+    flow_record_t *record = NULL;
 
-    /* Find a record matching the flow key, if it exists */
-    while (record != NULL) {
-        if (flow_key_is_eq(key, &record->key) == 0) {
-            joy_log_debug("LIST (head location: %p) record %p found\n", list, record);
-            return record;
+    while (probes < size) {
+        record = slots[i].record;
+        probes++;
+        if (record == NULL) {
+            break;
+        }
+        if (record != FLOW_TABLE_TOMBSTONE && slots[i].hash == hash &&
+            key_cmp(key, &record->key) == 0) {
+            break;
         }
-        record = record->next;
+        record = NULL;
+        i = (i + 1) & mask;
     }
-    joy_log_debug("LIST (head location: %p) did not find record\n", list);
 
-    return NULL;
+    ctx->stats.num_table_probes += probes;
+    if (probes > ctx->stats.max_table_probe) {
+        ctx->stats.max_table_probe = probes;
+    }
+    return record;
 }
 
 /**
- * \brief Find the twin of the flow_key in the flow_record_list.
- * \param list The list of flow_records to search
- * \param key The flow_key of the record whose twin we will search for.
- * \return The twin flow_record or NULL
+ * \brief Find a flow record in the flow table, if it exists.
+ * \param ctx The context whose flow table is searched
+ * \param hash The hash of the flow_key
+ * \param key The flow_key used to identify the flow_record
+ * \param key_cmp flow_key_is_eq to find the record itself, or
+ *                flow_key_is_twin to find the twin of \p key
+ * \return Valid flow_record or NULL
  */
-static flow_record_t *flow_record_list_find_twin_by_key (const flow_record_list *list,
-                                                              const flow_key_t *key) {
-    flow_record_t *record = *list;
+static flow_record_t *flow_table_find (joy_ctx_data *ctx,
+                                       uint32_t hash,
+                                       const flow_key_t *key,
+                                       flow_key_cmp_func key_cmp) {
+    flow_table_t *t = &ctx->flow_table;
+    flow_record_t *record = NULL;
 
-    /* find a record matching the flow key, if it exists */
-    while (record != NULL) {
-        if (flow_key_is_twin(key, &record->key) == 0) {
-            joy_log_debug("LIST (head location: %p) record %p found\n", list, record);
-            return record;
-        }
-        record = record->next;
+    ctx->stats.num_table_lookups++;
+    if (t->slots != NULL) {
+        record = flow_table_probe(ctx, t->slots, t->size, hash, key, key_cmp);
     }
-    joy_log_debug("LIST (head location: %p) did not find record\n", list);
+    if (record == NULL && t->old_slots != NULL) {
+        record = flow_table_probe(ctx, t->old_slots, t->old_size, hash, key, key_cmp);
+    }
+    joy_log_debug("TABLE hash %x record %p\n", hash, record);
 
-    return NULL;
+    return record;
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+#define flow_table_prefetch(addr) __builtin_prefetch((addr), 1, 3)
+#else
+#define flow_table_prefetch(addr) ((void)(addr))
+#endif
+
 /**
- * \brief Set the \p head a flow_record_list to the given \p record.
- * \param list The list of flow records
- * \param record The flow_record that will be prepended to the \p list
- * \return none
+ * \brief Hash a flow key and prefetch the slot where its probe starts.
+ *
+ * Used by the burst path to start the cache misses of a lookup ahead
+ * of time; the table isn't changed.
+ *
+ * \param ctx The context whose flow table will be searched
+ * \param key The flow_key of the packet
+ * \return Hash of \p key, for flow_record_prefetch()
  */
-static void flow_record_list_prepend (flow_record_list *head,
-                                      flow_record_t *record) {
-    flow_record_t *tmp;
+uint32_t flow_key_prefetch (joy_ctx_data *ctx, const flow_key_t *key) {
+    flow_table_t *t = &ctx->flow_table;
+    uint32_t hash = flow_key_hash(key);
 
-    tmp = *head;
-    if (tmp == record) {
-        printf("setting record->next to record! (%p)\n", record);
-    }
-    if (tmp != NULL) {
-        tmp->prev = record;
-        record->next = tmp;
+    if (t->slots != NULL) {
+        flow_table_prefetch(&t->slots[hash & (t->size - 1)]);
     }
-    *head = record;
-    joy_log_debug("LIST (head location %p) head set to %p (prev: %p, next: %p)\n",
-                     head, *head, record->prev, record->next);
+    return hash;
 }
 
 /**
- * \brief Remove a flow record from the list.
- * \param head The list of records
- * \param r The flow_record that will be removed from the \p list
+ * \brief Prefetch the record in the slot where a probe starts.
+ *
+ * Meant to be called once the slot prefetched by flow_key_prefetch()
+ * has had time to arrive; a slot holding another flow's record costs
+ * a wasted prefetch and nothing else.
+ *
+ * \param ctx The context whose flow table will be searched
+ * \param hash The hash returned by flow_key_prefetch()
  * \return none
  */
-static unsigned int flow_record_list_remove (flow_record_list *head,
-                                             flow_record_t *r) {
+void flow_record_prefetch (joy_ctx_data *ctx, uint32_t hash) {
+    flow_table_t *t = &ctx->flow_table;
+    const flow_table_slot_t *slot;
 
-    if (r == NULL) {
-        return 1;    /* don't process NULL pointers; probably an error to get here */
+    if (t->slots == NULL) {
+        return;
     }
-
-    joy_log_debug("LIST (head location %p) removing record at %p (prev: %p, next: %p)\n",
-                   head, r, r->prev, r->next);
-
-    if (r->prev == NULL) {
-        /*
-         * r is the first (or only) record within its flow_record_list, so
-         * the head of the list must be set
-         */
-        if (*head != r) {
-            printf("error: frla[hk] != r\n");
-            exit(1);
-        }
-        *head = r->next;
-        if (*head != NULL) {
-            /*
-             * the list is not empty, so we need to set the prev pointer in
-             * the first record to indicate that it is the head of the list
-             */
-          (*head)->prev = NULL;
-        }
-    } else {
-        /*
-         * r needs to be stitched out of its flow_record_list, by setting
-         * its previous entry to point to its next entry
-         */
-        r->prev->next = r->next;
-        joy_log_debug("LIST (head location %p) now prev->next: %p\n", head, r->prev->next);
-        if (r->next != NULL) {
-            /*
-             * the next entry's previous pointer must be made to point to
-             * the previous entry
-             */
-            r->next->prev = r->prev;
-            joy_log_debug("LIST (head location %p) now next->prev: %p\n", head, r->next->prev);
-        }
+    slot = &t->slots[hash & (t->size - 1)];
+    if (slot->record != NULL && slot->record != FLOW_TABLE_TOMBSTONE && slot->hash == hash) {
+        flow_table_prefetch(slot->record);
     }
-
-    return 0; /* indicate success */
 }
 
 /**
- * \brief Append a flow record to the chrono list.
- * \param record The flow_record that will be appended to the list
+ * \brief Store a record in the first free slot of the current slot array.
+ *
+ * The caller guarantees that the array has a free slot.
+ *
+ * \param t The flow table
+ * \param hash The hash of the record's flow_key
+ * \param record The flow_record to store
  * \return none
  */
-static void flow_record_chrono_list_append (joy_ctx_data *ctx, flow_record_t *record) {
-    if (ctx->flow_record_chrono_first == NULL) {
-        ctx->flow_record_chrono_first = record;
-        ctx->flow_record_chrono_last = record;
-    } else {
-        ctx->flow_record_chrono_last->time_next = record;
-        record->time_prev = ctx->flow_record_chrono_last;
-        ctx->flow_record_chrono_last = record;
+static void flow_table_place (flow_table_t *t,
+                              uint32_t hash,
+                              flow_record_t *record) {
+    uint32_t mask = t->size - 1;
+    uint32_t i = hash & mask;
+
+    while (t->slots[i].record != NULL) {
+        i = (i + 1) & mask;
     }
+    t->slots[i].hash = hash;
+    t->slots[i].record = record;
+    t->count++;
 }
 
 /**
- * \brief Remove a flow record from the chrono list.
- * \param record The flow_record that will be removed from the list
+ * \brief Migrate up to \p n slots of an in-progress resize.
+ * \param t The flow table
+ * \param n The number of old slots to visit
  * \return none
  */
-static void flow_record_chrono_list_remove (joy_ctx_data *ctx, flow_record_t *record) {
-
-    if (record == ctx->flow_record_chrono_first) {
-        ctx->flow_record_chrono_first = record->time_next;
-    }
-    if (record == ctx->flow_record_chrono_last) {
-        ctx->flow_record_chrono_last = record->time_prev;
-    }
-
-    if (record->time_prev != NULL) {
-        record->time_prev->time_next = record->time_next;
-    }
-    if (record->time_next != NULL) {
-        record->time_next->time_prev = record->time_prev;
+static void flow_table_rehash_step (flow_table_t *t, unsigned int n) {
+    flow_table_slot_t *slot;
+
+    while (t->old_slots != NULL && n--) {
+        slot = &t->old_slots[t->rehash_pos];
+        if (slot->record != NULL && slot->record != FLOW_TABLE_TOMBSTONE) {
+            flow_table_place(t, slot->hash, slot->record);
+            slot->record = FLOW_TABLE_TOMBSTONE;
+            t->old_count--;
+        }
+        t->rehash_pos++;
+
+        if (t->rehash_pos == t->old_size || t->old_count == 0) {
+            /* every record has been migrated */
+            free(t->old_slots);
+            t->old_slots = NULL;
+            t->old_size = 0;
+            t->old_count = 0;
+            t->rehash_pos = 0;
+        }
     }
 }
 
 /**
+ * \brief Start an incremental resize to twice the current size.
  *
- * \brief Check if an active flow_record is expired.
+ * If the new array cannot be allocated the table keeps its current
+ * size; it will keep working, only with longer probe sequences.
  *
- * This function operates in one of two modes:
+ * \param ctx The context whose flow table will grow
+ * \return none
+ */
+static void flow_table_grow (joy_ctx_data *ctx) {
+    flow_table_t *t = &ctx->flow_table;
+    flow_table_slot_t *slots = NULL;
+    uint32_t size;
+
+    if (t->size >= FLOW_TABLE_MAX_SIZE) {
+        return;
+    }
+
+    size = t->size << 1;
+    slots = calloc(size, sizeof(flow_table_slot_t));
+    if (slots == NULL) {
+        joy_log_warn("could not grow flow table to %u slots", size);
+        flocap_stats_incr_malloc_fail(ctx);
+        return;
+    }
+
+    t->old_slots = t->slots;
+    t->old_size = t->size;
+    t->old_count = t->count;
+    t->rehash_pos = 0;
+    t->slots = slots;
+    t->size = size;
+    t->count = 0;
+
+    flocap_stats_incr_table_resizes(ctx);
+    joy_log_info("context(%d) flow table resizing to %u slots", ctx->ctx_id, size);
+}
+
+/**
+ * \brief Insert a new flow record into the flow table.
+ * \param ctx The context whose flow table is used
+ * \param hash The hash of the record's flow_key
+ * \param record The flow_record to insert
+ * \return ok or failure
+ */
+static int flow_table_insert (joy_ctx_data *ctx,
+                              uint32_t hash,
+                              flow_record_t *record) {
+    flow_table_t *t = &ctx->flow_table;
+
+    if (t->slots == NULL) {
+        /* the table was released, e.g. by flow_record_list_free() */
+        if (flow_table_alloc(t, glb_config->flow_table_size) != ok) {
+            return failure;
+        }
+    }
+
+    if (t->old_slots != NULL) {
+        flow_table_rehash_step(t, FLOW_TABLE_REHASH_STEP);
+    } else if (flow_table_over_loaded(t)) {
+        flow_table_grow(ctx);
+    }
+
+    /* always leave an empty slot, so that every probe sequence terminates */
+    if (t->count + 1 >= t->size) {
+        joy_log_warn("flow table full (%u slots)", t->size);
+        return failure;
+    }
+
+    flow_table_place(t, hash, record);
+    return ok;
+}
+
+/**
+ * \brief Remove a flow record from the slot array it is stored in.
+ *
+ * Removal from the current array shifts the following entries of the
+ * probe sequence back, so that the array never holds tombstones.
+ *
+ * \param t The flow table
+ * \param r The flow_record that will be removed
+ * \return 0 on success, 1 if the record was not found
+ */
+static unsigned int flow_table_remove (flow_table_t *t,
+                                       flow_record_t *r) {
+    uint32_t mask, i, j, home;
+    uint32_t probes;
+
+    if (r == NULL) {
+        return 1;    /* don't process NULL pointers; probably an error to get here */
+    }
+
+    if (t->slots != NULL) {
+        mask = t->size - 1;
+        i = r->key_hash & mask;
+        for (probes = 0; probes < t->size && t->slots[i].record != NULL; probes++) {
+            if (t->slots[i].record == r) {
+                /* backward shift deletion */
+                j = i;
+                while (1) {
+                    j = (j + 1) & mask;
+                    if (t->slots[j].record == NULL) {
+                        break;
+                    }
+                    home = t->slots[j].hash & mask;
+                    /* move the entry at j unless its home lies cyclically in (i, j] */
+                    if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) {
+                        continue;
+                    }
+                    t->slots[i] = t->slots[j];
+                    i = j;
+                }
+                t->slots[i].hash = 0;
+                t->slots[i].record = NULL;
+                t->count--;
+                joy_log_debug("TABLE record %p removed\n", r);
+                return 0;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    if (t->old_slots != NULL) {
+        mask = t->old_size - 1;
+        i = r->key_hash & mask;
+        for (probes = 0; probes < t->old_size && t->old_slots[i].record != NULL; probes++) {
+            if (t->old_slots[i].record == r) {
+                t->old_slots[i].record = FLOW_TABLE_TOMBSTONE;
+                t->old_count--;
+                joy_log_debug("TABLE record %p removed from old slots\n", r);
+                return 0;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * \brief Append a flow record to the chrono list.
+ * \param record The flow_record that will be appended to the list
+ * \return none
+ */
+static void flow_record_chrono_list_append (joy_ctx_data *ctx, flow_record_t *record) {
+    if (ctx->flow_record_chrono_first == NULL) {
+        ctx->flow_record_chrono_first = record;
+        ctx->flow_record_chrono_last = record;
+    } else {
+        ctx->flow_record_chrono_last->time_next = record;
+        record->time_prev = ctx->flow_record_chrono_last;
+        ctx->flow_record_chrono_last = record;
+    }
+}
+
+/**
+ * \brief Remove a flow record from the chrono list.
+ * \param record The flow_record that will be removed from the list
+ * \return none
+ */
+static void flow_record_chrono_list_remove (joy_ctx_data *ctx, flow_record_t *record) {
+
+    if (record == ctx->flow_record_chrono_first) {
+        ctx->flow_record_chrono_first = record->time_next;
+    }
+    if (record == ctx->flow_record_chrono_last) {
+        ctx->flow_record_chrono_last = record->time_prev;
+    }
+
+    if (record->time_prev != NULL) {
+        record->time_prev->time_next = record->time_next;
+    }
+    if (record->time_next != NULL) {
+        record->time_next->time_prev = record->time_prev;
+    }
+
+    /* records on the chrono list are also in the timer wheel */
+    flow_timer_unlink(&ctx->flow_timer, record);
+}
+
+/**
+ *
+ * \brief Check if an active flow_record is expired.
+ *
+ * This function operates in one of two modes:
  * 1. Use the incoming packet information within \p header to determine if
  *    the current flow \p record is expired. I.e. should the incoming packet
  *    be placed in a new record.
@@ -657,1332 +1258,3354 @@ unsigned int flow_record_is_expired(joy_ctx_data *ctx, flow_record_t *record) {
     return 0;
 }
 
-/**
- * \brief Retrieve a flow record using a \p key to find it.
- * \param key The flow_key to use for lookup of flow record
- * \param create_new_records Flag for whether a new record should be created
- * \return pointer to the flow record structure
- * \return NULL if expired or could not create or retrieve record
+/*
+ * flow queues
+ *
+ * The joy_*_external_processing() calls hand each flow on the
+ * chronological list to a callback once, when its data for the
+ * feature is ready or when it expires.  Rather than checking every
+ * record on every call, records are appended to the queue of a
+ * feature when they become ready (see pkt_proc.c) or are found to be
+ * expired by the timer wheel, and the calls drain that queue.  A
+ * queue only starts collecting records after the first call for its
+ * feature, so nothing is queued for applications that don't use the
+ * external processing API.
  */
-flow_record_t *flow_key_get_record (joy_ctx_data *ctx,
-                                         const flow_key_t *key,
-                                         unsigned int create_new_records,
-                                         const struct pcap_pkthdr *header) {
-    flow_record_t *record;
-    unsigned int hash_key;
 
-    /* Find a record matching the flow key, if it exists */
-    hash_key = flow_key_hash(key);
-    record = flow_record_list_find_record_by_key(&ctx->flow_record_list_array[hash_key], key);
-
-    if (record != NULL) {
-       if (create_new_records && flow_record_is_in_chrono_list(ctx, record)
-           && flow_record_is_active_expired(record, header)) {
-           /*
-            *  Active-timeout exceeded for this flow_record; print and delete
-            *  it, then set record = NULL to cause the creation of a new
-            *  flow_record to be used in further packet processing
-            *
-            *  All applications have an output file available. If it is not being used,
-            *  then the printing of this record will just go to a file that is ignored.
-            */
-           flow_record_print_and_delete(ctx, record);
-           record = NULL;
-       } else {
-           return record;
-       }
+/**
+ * \brief Find the record of a flow that is on the chronological list.
+ * \param ctx The context that owns the record
+ * \param rec The flow_record, for either direction of the flow
+ * \return The record on the chronological list
+ */
+flow_record_t *flow_record_chrono_head (joy_ctx_data *ctx, flow_record_t *rec) {
+    if (rec->twin != NULL && !flow_record_is_in_chrono_list(ctx, rec)) {
+        return rec->twin;
     }
+    return rec;
+}
 
-    /* if we get here, then record == NULL  */
+/**
+ * \brief Check if a flow_record has already been handed to the
+ *        external processing call of a flow queue.
+ * \param rec The flow_record
+ * \param queue The flow queue, FLOW_QUEUE_IDP through FLOW_QUEUE_BD
+ * \return 1 if processed, 0 otherwise
+ */
+static unsigned int flow_record_is_processed (const flow_record_t *rec, unsigned int queue) {
+    switch (queue) {
+        case FLOW_QUEUE_IDP:
+            return rec->idp_ext_processed;
+        case FLOW_QUEUE_TLS:
+            return rec->tls_ext_processed;
+        case FLOW_QUEUE_SPLT:
+            return rec->splt_ext_processed;
+        case FLOW_QUEUE_SALT:
+            return rec->salt_ext_processed;
+        case FLOW_QUEUE_BD:
+            return rec->bd_ext_processed;
+        default:
+            return 1;
+    }
+}
 
-    if (create_new_records) {
+/**
+ * \brief Check if a flow_record has enough data for the external
+ *        processing call of a flow queue, and hasn't been handed to it.
+ * \param rec The flow_record, which is on the chronological list
+ * \param queue The flow queue, FLOW_QUEUE_IDP through FLOW_QUEUE_BD
+ * \param min Packets (SPLT, SALT) or octets (BD) needed; unused otherwise
+ * \return 1 if ready, 0 otherwise
+ */
+unsigned int flow_record_is_ready (const flow_record_t *rec, unsigned int queue, unsigned int min) {
+    if (flow_record_is_processed(rec, queue)) {
+        return 0;
+    }
+    switch (queue) {
+        case FLOW_QUEUE_IDP:
+            return rec->idp_len > 0;
+        case FLOW_QUEUE_TLS:
+            return rec->tls != NULL && rec->tls->done_handshake;
+        case FLOW_QUEUE_SPLT:
+            return rec->op >= min;
+        case FLOW_QUEUE_SALT:
+            return rec->salt != NULL && rec->salt->np >= min;
+        case FLOW_QUEUE_BD:
+            return rec->ob >= min;
+        default:
+            return 0;
+    }
+}
 
-        /* allocate and initialize a new flow record */
-        record = calloc(1, sizeof(flow_record_t));
-        joy_log_debug("LIST record %p allocated\n", record);
+/**
+ * \brief Append a flow_record to a flow queue, unless it is already on it.
+ * \param ctx The context that owns the queue
+ * \param rec The flow_record
+ * \param queue The flow queue
+ * \return none
+ */
+void flow_queue_push (joy_ctx_data *ctx, flow_record_t *rec, unsigned int queue) {
+    flow_queue_t *q = &ctx->flow_queue[queue];
 
-        if (record == NULL) {
-            joy_log_warn("could not allocate memory for flow_record");
-            flocap_stats_incr_malloc_fail(ctx);
-            return NULL;
-        }
+    if (rec->queued & (1 << queue)) {
+        return;
+    }
+    rec->queue_link[queue].next = NULL;
+    rec->queue_link[queue].prev = q->last;
+    if (q->last != NULL) {
+        q->last->queue_link[queue].next = rec;
+    } else {
+        q->first = rec;
+    }
+    q->last = rec;
+    q->count++;
+    rec->queued |= (1 << queue);
+}
 
-        flow_record_init(ctx, record, key);
-        record->key_hash = hash_key;
+/**
+ * \brief Take a flow_record off a flow queue, if it is on it.
+ * \param ctx The context that owns the queue
+ * \param rec The flow_record
+ * \param queue The flow queue
+ * \return none
+ */
+static void flow_queue_remove (joy_ctx_data *ctx, flow_record_t *rec, unsigned int queue) {
+    flow_queue_t *q = &ctx->flow_queue[queue];
+    flow_queue_link_t *link = &rec->queue_link[queue];
 
-        /* enter record into flow_record_list */
-        flow_record_list_prepend(&ctx->flow_record_list_array[hash_key], record);
+    if (!(rec->queued & (1 << queue))) {
+        return;
+    }
+    if (link->prev != NULL) {
+        link->prev->queue_link[queue].next = link->next;
+    } else {
+        q->first = link->next;
+    }
+    if (link->next != NULL) {
+        link->next->queue_link[queue].prev = link->prev;
+    } else {
+        q->last = link->prev;
+    }
+    link->next = link->prev = NULL;
+    q->count--;
+    rec->queued &= ~(1 << queue);
+}
 
-        /*
-         * if we are tracking bidirectional flows, and if record has a
-         * twin, then set both twin pointers; otherwise, enter the
-         * record into the chronological list
-         */
-        if (glb_config->bidir) {
-            record->twin = flow_key_get_twin(ctx, key, hash_key);
-            joy_log_debug("LIST record %p is twin of %p\n", record, record->twin);
-        }
-        if (record->twin != NULL) {
-            if (record->twin->twin != NULL) {
-                joy_log_info("warning: found twin that already has a twin; not setting twin pointer\n");
-                /*
-                 * experimental - consider this record an orphan, add it to chrono list, but without its twin pointer set
-                 */
-                record->twin = NULL;
-                flow_record_chrono_list_append(ctx, record);
-            } else {
-                record->twin->twin = record;
-            }
-        } else {
+/**
+ * \brief Take the first flow_record off a flow queue.
+ * \param ctx The context that owns the queue
+ * \param queue The flow queue
+ * \return The flow_record, or NULL if the queue is empty
+ */
+flow_record_t *flow_queue_pop (joy_ctx_data *ctx, unsigned int queue) {
+    flow_record_t *rec = ctx->flow_queue[queue].first;
 
-            /* this flow has no twin, so add it to chronological list */
-            flow_record_chrono_list_append(ctx, record);
-        }
+    if (rec != NULL) {
+        flow_queue_remove(ctx, rec, queue);
     }
-    return record;
+    return rec;
 }
 
 /**
- * \brief Delete a flow record.
- * \param r The flow_record to delete
+ * \brief Queue an expired flow_record for the features it hasn't been
+ *        handed out for yet.
+ * \param ctx The context that owns the record
+ * \param rec The flow_record, which is on the chronological list
  * \return none
  */
-static void flow_record_delete (joy_ctx_data *ctx, flow_record_t *r) {
+static void flow_queue_push_expired (joy_ctx_data *ctx, flow_record_t *rec) {
+    unsigned int queue;
 
-    if (flow_record_list_remove(&ctx->flow_record_list_array[r->key_hash], r) != 0) {
-        joy_log_err("problem removing flow record %p from list", r);
-        return;
+    for (queue = FLOW_QUEUE_IDP; queue <= FLOW_QUEUE_BD; queue++) {
+        if (ctx->flow_queue[queue].active && !flow_record_is_processed(rec, queue)) {
+            flow_queue_push(ctx, rec, queue);
+        }
     }
+}
 
-    flocap_stats_decr_records_in_table(ctx);
+/*
+ * flow timer wheel
+ *
+ * Records on the chronological list are filed under the second of
+ * their expiration deadline (see flow_record_deadline()).  Level 0
+ * has one slot per second; a slot of each higher level spans all of
+ * the level below it, and is cascaded down when the current second
+ * reaches it.  Deadlines only move later as packets arrive, so
+ * records are left where they are until they come due, and then
+ * either expired or filed again under their new deadline.  Expired
+ * records are moved to the expired list of the wheel, where they
+ * stay until they are printed or exported and deleted.
+ */
 
-    /* update context counts */
-    if (r->idp_len > 0) {
-        --ctx->idp_recs_ready;
-    }
+#define FLOW_TIMER_MASK (FLOW_TIMER_SLOTS - 1)
 
-    if (r->op >= ETTA_MIN_PACKETS) {
-        --ctx->splt_recs_ready;
-    }
+/* number of seconds spanned by one slot of the given level */
+#define FLOW_TIMER_SPAN(level) ((uint64_t)1 << ((level) * FLOW_TIMER_BITS))
 
-    if (r->ob >= ETTA_MIN_OCTETS) {
-        --ctx->bd_recs_ready;
-    }
+/**
+ * \brief Compute the second in which a flow_record can first expire.
+ *
+ * This is the earliest time at which flow_record_is_expired() can
+ * return 1 for \p record, given its current timestamps.
+ *
+ * \param record The flow_record, which is on the chronological list
+ * \return Deadline, in seconds
+ */
+static uint64_t flow_record_deadline (const flow_record_t *record) {
+    uint64_t start = record->start.tv_sec;
+    uint64_t end = record->end.tv_sec;
+    uint64_t active, inactive;
 
-    if (r->tls != NULL) {
-        if (r->tls->done_handshake) {
-            --ctx->tls_recs_ready;
+    if (record->twin != NULL) {
+        if (start < (uint64_t)record->twin->start.tv_sec) {
+            start = record->twin->start.tv_sec;
         }
-    }
-
-    if (r->salt != NULL) {
-        if (r->salt->np >= ETTA_MIN_PACKETS) {
-            --ctx->salt_recs_ready;
+        if (end < (uint64_t)record->twin->end.tv_sec) {
+            end = record->twin->end.tv_sec;
         }
     }
+    active = start + time_window.tv_sec + active_timeout.tv_sec;
+    inactive = end + time_window.tv_sec;
 
-    /*
-     * free the memory allocated inside of flow record
-     */
-    free(r->idp);
-    free(r->exe_name);
-    free(r->full_path);
-    free(r->file_version);
-    free(r->file_hash);
-    free(r->joy_app_data);
+    return active < inactive ? active : inactive;
+}
 
-    delete_all_features(feature_list);
+/**
+ * \brief File a flow_record in the timer wheel slot for its timer_expires.
+ * \param w The timer wheel
+ * \param record The flow_record, which must not be in the wheel
+ * \return none
+ */
+static void flow_timer_link (flow_timer_t *w, flow_record_t *record) {
+    uint64_t expires = record->timer_expires;
+    uint64_t delta;
+    unsigned int level;
+    flow_record_t **head;
+
+    if (expires < w->tick) {
+        /* already due */
+        expires = w->tick;
+    }
+    delta = expires - w->tick;
 
-    /*
-     * zeroize memory (this is defensive coding; pointers to deleted
-     * records will result in crashes rather than silent errors)
-     */
-    memset_s(r, sizeof(flow_record_t), 0, sizeof(flow_record_t));
-    free(r);
-    r = NULL;
+    for (level = 0; level < FLOW_TIMER_LEVELS - 1; level++) {
+        if (delta < FLOW_TIMER_SPAN(level + 1)) {
+            break;
+        }
+    }
+    if (delta >= FLOW_TIMER_SPAN(FLOW_TIMER_LEVELS)) {
+        /* beyond the reach of the wheel; park it in the farthest slot */
+        expires = w->tick + FLOW_TIMER_SPAN(FLOW_TIMER_LEVELS) - 1;
+    }
+
+    head = &w->slot[level][(expires >> (level * FLOW_TIMER_BITS)) & FLOW_TIMER_MASK];
+    record->timer_next = *head;
+    if (*head != NULL) {
+        (*head)->timer_pprev = &record->timer_next;
+    }
+    *head = record;
+    record->timer_pprev = head;
+    record->timer_level = level;
+    w->level_count[level]++;
+    w->count++;
 }
 
 /**
-* \fn int flow_key_set_process_info (const flow_key_t *key, const host_flow_t *data)
-* \param key flow key structure
-* \param data process flow information
-* \return failure
-* \return ok
-*/
-int flow_key_set_process_info(joy_ctx_data *ctx, const flow_key_t *key, const host_flow_t *data) {
-        flow_record_t *r;
-
-        if (data->exe_name == NULL) {
-                return failure;   /* no point in looking for flow_record */
-        }
-        r = flow_key_get_record(ctx, key, DONT_CREATE_RECORDS, NULL);
-        // flow_key_print(key);
-        if (r) {
-                if (r->exe_name == NULL) {
-                    //r->exe_name = strndup(data->exe_name, PID_MAX_LEN);
-                   r->exe_name = strdup(data->exe_name);
-                }
-                if (r->full_path == NULL) {
-                    if (data->full_path)
-                        r->full_path = strndup(data->full_path, PROC_PATH_LEN);
-                }
-                if (r->file_version == NULL) {
-                    if (data->file_version)
-                        r->file_version = strndup(data->file_version, PROC_EXE_LEN);
-                }
-                if (r->file_hash == NULL) {
-                    if (data->hash)
-                        r->file_hash = strndup(data->hash, 100);// ??
-                }
-                r->uptime_seconds = data->uptime_seconds;
-                return ok;
-        }
-        return failure;
-}
-
-/**
- * \brief Update the timeout values for flow record expiration
- * \param inact number of seconds for inactivity timeout
- * \param act number of seconds for activity timeout
+ * \brief Take a flow_record out of the timer wheel, if it is in it.
+ * \param w The timer wheel
+ * \param record The flow_record
  * \return none
  */
-void flow_record_update_timeouts (unsigned int inact, unsigned int act) {
-
-    time_window.tv_sec  = (inact > 0) ? inact : T_WINDOW;
-    time_window.tv_usec = 0;
-    active_timeout.tv_sec  = (act > 0) ? act : T_ACTIVE;
-    active_timeout.tv_usec = 0;
-    active_max = (time_window.tv_sec + active_timeout.tv_sec);
+static void flow_timer_unlink (flow_timer_t *w, flow_record_t *record) {
+    if (record->timer_pprev == NULL) {
+        return;
+    }
+    *record->timer_pprev = record->timer_next;
+    if (record->timer_next != NULL) {
+        record->timer_next->timer_pprev = record->timer_pprev;
+    } else if (record->timer_level == FLOW_TIMER_EXPIRED) {
+        w->expired_tail = record->timer_pprev;
+    }
+    if (record->timer_level == FLOW_TIMER_EXPIRED) {
+        w->num_expired--;
+    } else {
+        w->level_count[record->timer_level]--;
+        w->count--;
+    }
+    record->timer_next = NULL;
+    record->timer_pprev = NULL;
 }
 
 /**
- * \brief Update the byte count for the flow record.
- * \param f Flow record
- * \param x Data to use for update
- * \param len Length of the data (in bytes)
+ * \brief Schedule an expiration check of a flow_record.
+ * \param ctx The context whose timer wheel holds the record
+ * \param record The flow_record
+ * \param expires Second at which the record should be checked
  * \return none
  */
-void flow_record_update_byte_count (flow_record_t *f, const void *x, unsigned int len) {
-    const unsigned char *data = x;
-    unsigned int i;
-    unsigned int current_count = 0;
-
-    /*
-     * implementation note: The spec says that 4000 octets is enough of a
-     * sample size to accurately reflect the byte distribution. Also, to avoid
-     * wrapping of the byte count at the 16-bit boundry, we stop counting once
-     * the 4000th octet has been seen for a flow.
-     */
-
-    /* octet count was already incremented before processing this payload */
-    current_count = f->ob - len;
+static void flow_timer_schedule (joy_ctx_data *ctx, flow_record_t *record, uint64_t expires) {
+    flow_timer_t *w = &ctx->flow_timer;
 
-    if (glb_config->byte_distribution || glb_config->report_entropy) {
-        if (current_count < ETTA_MIN_OCTETS) {
-            for (i=0; i<len; i++) {
-                f->byte_count[data[i]]++;
-                current_count++;
-                if (current_count >= ETTA_MIN_OCTETS) {
-                   break;
-                }
-            }
-        }
+    flow_timer_unlink(w, record);
+    if (w->count == 0) {
+        /* nothing is pending, so the wheel can start from the current time */
+        w->tick = ctx->global_time.tv_sec;
     }
+    record->timer_expires = expires;
+    flow_timer_link(w, record);
 }
 
 /**
- * \brief Update the compact byte count for the flow record.
- * \param f Flow record
- * \param x Data to use for update
- * \param len Length of the data (in bytes)
+ * \brief Move the records of the current slot of a level down the wheel.
+ * \param w The timer wheel
+ * \param level The level to cascade, which must be greater than 0
  * \return none
  */
-void flow_record_update_compact_byte_count (flow_record_t *f, const void *x, unsigned int len) {
-    const unsigned char *data = x;
-    unsigned int i;
+static void flow_timer_cascade (flow_timer_t *w, unsigned int level) {
+    unsigned int idx = (w->tick >> (level * FLOW_TIMER_BITS)) & FLOW_TIMER_MASK;
+    flow_record_t *record = w->slot[level][idx];
+    flow_record_t *next;
 
-    if (glb_config->compact_byte_distribution) {
-        for (i=0; i<len; i++) {
-            f->compact_byte_count[glb_config->compact_bd_mapping[data[i]]]++;
-        }
+    w->slot[level][idx] = NULL;
+    while (record != NULL) {
+        next = record->timer_next;
+        w->level_count[level]--;
+        w->count--;
+        flow_timer_link(w, record);
+        record = next;
     }
 }
 
 /**
- * \brief Update the byte distribution mean for the flow record.
- * \param f Flow record
- * \param x Data to use for update
- * \param len Length of the data (in bytes)
+ * \brief Advance the current second of the timer wheel towards \p now.
+ *
+ * Whole slots of levels that are empty are skipped over, so a long
+ * gap between packets costs at most a few steps per level.
+ *
+ * \param w The timer wheel
+ * \param now The current second, which must be after w->tick
  * \return none
  */
-void flow_record_update_byte_dist_mean_var (flow_record_t *f, const void *x, unsigned int len) {
-    const unsigned char *data = x;
-    double delta;
-    unsigned int i;
+static void flow_timer_advance (flow_timer_t *w, uint64_t now) {
+    unsigned int level;
+    uint64_t next;
 
-    if (glb_config->byte_distribution || glb_config->report_entropy) {
-        for (i=0; i<len; i++) {
-            f->num_bytes += 1;
-            delta = ((double)data[i] - f->bd_mean);
-            f->bd_mean += delta/((double)f->num_bytes);
-            f->bd_variance += delta*((double)data[i] - f->bd_mean);
+    for (level = 0; level < FLOW_TIMER_LEVELS; level++) {
+        if (w->level_count[level] != 0) {
+            break;
         }
     }
-}
-
-static float flow_record_get_byte_count_entropy (const uint32_t byte_count[256],
-    unsigned int num_bytes) {
-    int i;
-    float tmp, sum = 0.0;
+    if (level == FLOW_TIMER_LEVELS) {
+        w->tick = now;
+        return;
+    }
 
-    for (i=0; i<256; i++) {
-        tmp = (float) byte_count[i] / (float) num_bytes;
-        if (tmp > FLT_EPSILON) {
-            sum -= tmp * logf(tmp);
-        }
-        // fprintf(output, "tmp: %f\tsum: %f\n", tmp, sum);
+    /* start of the next slot of the lowest level in use */
+    next = (w->tick | (FLOW_TIMER_SPAN(level) - 1)) + 1;
+    if (next > now) {
+        /* no slot boundary of a non-empty level is crossed */
+        w->tick = now;
+        return;
     }
-    return sum / logf(2.0);
-}
+    w->tick = next;
 
-static void print_bytes_dir_time (joy_ctx_data *ctx,
-                                  unsigned short int pkt_len,
-                                  const char *dir,
-                                  struct timeval ts,
-                                  const char *term) {
-    if (pkt_len < 32768) {
-        zprintf(ctx->output, "{\"b\":%u,\"dir\":\"%s\",\"ipt\":%u}%s",
-                    pkt_len, dir, joy_timeval_to_milliseconds(ts), term);
-    } else {
-        zprintf(ctx->output, "{\"rep\":%u,\"dir\":\"%s\",\"ipt\":%u}%s",
-                    65536-pkt_len, dir, joy_timeval_to_milliseconds(ts), term);
+    for (level = 1; level < FLOW_TIMER_LEVELS; level++) {
+        if (w->tick & (FLOW_TIMER_SPAN(level) - 1)) {
+            break;
+        }
+        flow_timer_cascade(w, level);
     }
 }
 
 /**
- * \brief Print out raw values as hex to the output file.
- * \param f Output file
- * \param data The data to print out
- * \param len Length of the data to print (in bytes)
+ * \brief Move the expired flow_records to the expired list of the wheel.
+ *
+ * Each record that is due is checked with flow_record_is_expired();
+ * those that are still live are rescheduled.  The expired records are
+ * appended to the expired list, and queued for the external processing
+ * calls that are in use.  They stay on the chronological list.
+ *
+ * \param ctx The context to expire flows of
  * \return none
  */
-void zprintf_raw_as_hex (zfile f,
-                         const unsigned char *data,
-                         unsigned int len) {
-    const unsigned char *x = data;
-    const unsigned char *end = data + len;
-
-    zprintf(f, "\"");   /* quotes needed for JSON */
-    while (x < end) {
-        zprintf(f, "%02x", *x++);
+static void flow_timer_sweep (joy_ctx_data *ctx) {
+    flow_timer_t *w = &ctx->flow_timer;
+    uint64_t now = ctx->global_time.tv_sec;
+    flow_record_t *record, *next;
+    unsigned int idx;
+
+    if (w->expired_tail == NULL) {
+        w->expired_tail = &w->expired;
     }
-    zprintf(f, "\"");
-}
 
-static void reduce_bd_bits (uint32_t *bd,
-                            unsigned int len) {
-    int mask = 0;
-    int shift = 0;
-    unsigned int i = 0;
+    while (w->count != 0) {
+        idx = w->tick & FLOW_TIMER_MASK;
+        record = w->slot[0][idx];
+        w->slot[0][idx] = NULL;
 
-    for (i = 0; i < len; i++) {
-        mask = mask | bd[i];
-    }
+        while (record != NULL) {
+            next = record->timer_next;
+            record->timer_next = NULL;
+            record->timer_pprev = NULL;
+            w->level_count[0]--;
+            w->count--;
+
+            if (flow_record_is_expired(ctx, record)) {
+                *w->expired_tail = record;
+                record->timer_pprev = w->expired_tail;
+                record->timer_level = FLOW_TIMER_EXPIRED;
+                w->expired_tail = &record->timer_next;
+                w->num_expired++;
+                flow_queue_push_expired(ctx, record);
+            } else {
+                /* still live; its deadline is now in the future */
+                record->timer_expires = flow_record_deadline(record);
+                flow_timer_link(w, record);
+            }
+            record = next;
+        }
 
-    mask = mask >> 8;
-    for (i = 0; i < 24 && mask; i++) {
-        mask = mask >> 1;
-        if (mask == 0) {
-            shift = i+1;
+        if (w->tick >= now) {
             break;
         }
-    }
-
-    for (i = 0; i < len; i++) {
-        bd[i] = bd[i] >> shift;
+        flow_timer_advance(w, now);
     }
 }
 
 /**
- * \brief Print the host executable information tied to this flow.
+ * \brief Bring a flow queue up to date before it is drained.
  *
- * \param f Output file
- * \param rec Flow record
+ * The first call for a queue, or a call with a different \p min than
+ * the last one, fills the queue from the chronological list; after
+ * that records are queued as they become ready.  Records that have
+ * expired since the last call are then added by the timer wheel.
  *
+ * \param ctx The context that owns the queue
+ * \param queue The flow queue, FLOW_QUEUE_IDP through FLOW_QUEUE_BD
+ * \param min Packets (SPLT, SALT) or octets (BD) needed for a record
+ *        to be ready; unused otherwise
  * \return none
  */
-static void print_executable_json (zfile f, const flow_record_t *rec) {
-    uint8_t comma = 0;
-
-    if (rec->exe_name || rec->full_path ||
-        rec->file_version || rec->file_hash) {
+void flow_queue_prepare (joy_ctx_data *ctx, unsigned int queue, unsigned int min) {
+    flow_queue_t *q = &ctx->flow_queue[queue];
+    flow_record_t *rec;
 
-        zprintf(f, ",\"exe\":{");
-        if (rec->exe_name) {
-            zprintf(f, "\"name\":\"%s\"", rec->exe_name);
-            comma = 1;
-        }
-        if (rec->full_path) {
-            if (comma) {
-                zprintf(f, ",\"path\":\"%s\"", rec->full_path);
-            } else {
-                zprintf(f, "\"path\":\"%s\"", rec->full_path);
-                comma = 1;
-            }
-        }
-        if (rec->file_version) {
-            if (comma) {
-                zprintf(f, ",\"version\":\"%s\"", rec->file_version);
-            } else {
-                zprintf(f, "\"version\":\"%s\"", rec->file_version);
-                comma = 1;
-            }
-        }
-        if (rec->file_hash) {
-            if (comma) {
-                zprintf(f, ",\"hash\":\"%s\"", rec->file_hash);
-            } else {
-                zprintf(f, "\"hash\":\"%s\"", rec->file_hash);
-                comma = 1;
-            }
+    if (!q->active || q->min != min) {
+        while (flow_queue_pop(ctx, queue) != NULL) {
+            continue;
         }
-        if (rec->uptime_seconds > 0) {
-            if (comma) {
-                zprintf(f, ",\"uptime\":%llu", (unsigned long long)rec->uptime_seconds);
-            } else {
-                zprintf(f, "\"uptime\":%llu", (unsigned long long)rec->uptime_seconds);
-                comma = 1;
+        q->active = 1;
+        q->min = min;
+        for (rec = ctx->flow_record_chrono_first; rec != NULL; rec = rec->time_next) {
+            if (flow_record_is_ready(rec, queue, min) ||
+                (!flow_record_is_processed(rec, queue) && flow_record_is_expired(ctx, rec))) {
+                flow_queue_push(ctx, rec, queue);
             }
         }
-        zprintf(f, "}");
     }
+    flow_timer_sweep(ctx);
 }
 
-static void print_tcp_json (zfile f, const flow_record_t *rec) {
-    int top_com = 0;
-    int com = 0;
-    int empty = 1;
-    int out_empty = 1;
-    int in_empty = 1;
-
-    /*
-     * Check what TCP data is avilable (if any).
-     */
-    if (rec->tcp.first_seq) {
-        empty = 0;
-    } else if (rec->twin && rec->twin->tcp.first_seq) {
-        empty = 0;
+/**
+ * \brief Move a flow to the most recently seen end of the LRU queue.
+ *
+ * The queue is only kept when a max_flows policy needs it.
+ *
+ * \param ctx The context that owns the record
+ * \param head The flow_record, which is on the chronological list
+ * \return none
+ */
+static void flow_record_touch (joy_ctx_data *ctx, flow_record_t *head) {
+    if (glb_config->max_flows == 0 || glb_config->flow_evict == FLOW_EVICT_OLDEST) {
+        return;
+    }
+    if (ctx->flow_queue[FLOW_QUEUE_LRU].last != head) {
+        flow_queue_remove(ctx, head, FLOW_QUEUE_LRU);
+        flow_queue_push(ctx, head, FLOW_QUEUE_LRU);
     }
+}
 
-#define not_empty(rec) (rec->tcp.flags || rec->tcp.first_window_size || rec->tcp.opt_len)
+/**
+ * \brief Write out and delete one flow to make room for a new one.
+ *
+ * The flow is chosen by the flow_evict policy, and goes through the
+ * same print and IPFIX export path as an expired flow.
+ *
+ * \param ctx The context that has reached max_flows
+ * \return none
+ */
+static void flow_record_evict (joy_ctx_data *ctx) {
+    flow_record_t *victim = NULL;
+    flow_record_t *rec;
+    unsigned int i;
 
-    if (not_empty(rec)) {
-        empty = 0; out_empty = 0;
+    if (glb_config->flow_evict == FLOW_EVICT_NOPAYLOAD) {
+        /* look for a flow that carried no data, among those idle longest */
+        rec = ctx->flow_queue[FLOW_QUEUE_LRU].first;
+        for (i = 0; rec != NULL && i < FLOW_EVICT_SCAN; i++) {
+            if (rec->ob == 0 && (rec->twin == NULL || rec->twin->ob == 0)) {
+                victim = rec;
+                break;
+            }
+            rec = rec->queue_link[FLOW_QUEUE_LRU].next;
+        }
     }
-    if (rec->twin && not_empty(rec->twin)) {
-        empty = 0; in_empty = 0;
+    if (victim == NULL && glb_config->flow_evict != FLOW_EVICT_OLDEST) {
+        victim = ctx->flow_queue[FLOW_QUEUE_LRU].first;
     }
-
-    if (empty) {
-        /* No data to print */
+    if (victim == NULL) {
+        victim = ctx->flow_record_chrono_first;
+    }
+    if (victim == NULL) {
         return;
     }
 
-    zprintf(f, ",\"tcp\":{");
-
-    if (rec->tcp.first_seq) {
-        zprintf(f, "\"first_seq\":%u", rec->tcp.first_seq);
-        top_com = 1;
-    } else if (rec->twin != NULL && rec->twin->tcp.first_seq) {
-        zprintf(f, "\"first_seq\":%u", rec->twin->tcp.first_seq);
-        top_com = 1;
-    }
+    victim->exp_type = expiration_type_evicted;
+    flocap_stats_incr_flows_evicted(ctx);
+    flow_record_print_and_delete(ctx, victim);
+}
 
-    if (!out_empty) {
-        char out_flags_string[9] = {0};
+/**
+ * \brief Retrieve a flow record using a \p key to find it.
+ * \param key The flow_key to use for lookup of flow record
+ * \param create_new_records Flag for whether a new record should be created
+ * \return pointer to the flow record structure
+ * \return NULL if expired or could not create or retrieve record
+ */
+flow_record_t *flow_key_get_record (joy_ctx_data *ctx,
+                                         const flow_key_t *key,
+                                         unsigned int create_new_records,
+                                         const struct pcap_pkthdr *header) {
+    flow_record_t *record;
+    unsigned int hash_key;
+    uint64_t first_check;
 
-        if (top_com) {
-            zprintf(f, ",\"out\":{");
-        } else {
-            zprintf(f, "\"out\":{");
-            top_com = 1;
-        }
+    /* Find a record matching the flow key, if it exists */
+    hash_key = flow_key_hash(key);
+    record = flow_table_find(ctx, hash_key, key, flow_key_is_eq);
+
+    if (record != NULL) {
+       if (create_new_records && flow_record_is_in_chrono_list(ctx, record)
+           && flow_record_is_active_expired(record, header)) {
+           /*
+            *  Active-timeout exceeded for this flow_record; print and delete
+            *  it, then set record = NULL to cause the creation of a new
+            *  flow_record to be used in further packet processing
+            *
+            *  All applications have an output file available. If it is not being used,
+            *  then the printing of this record will just go to a file that is ignored.
+            */
+           flocap_stats_incr_flows_expired(ctx);
+           flow_record_print_and_delete(ctx, record);
+           record = NULL;
+       } else {
+           flow_record_t *head = flow_record_chrono_head(ctx, record);
+
+           flow_record_touch(ctx, head);
+
+           if (header != NULL && head->timer_level == FLOW_TIMER_EXPIRED
+               && head->timer_pprev != NULL) {
+               /* queued as expired, but the flow is still going; watch it again */
+               flow_timer_schedule(ctx, head, flow_record_deadline(head));
+           }
+           return record;
+       }
+    }
+
+    /* if we get here, then record == NULL  */
+
+    if (create_new_records) {
+
+        /*
+         * make room for the record if the context holds max_flows; not
+         * for records made from collected flow data (no header), since
+         * the record of the packet carrying that data is still in use
+         */
+        while (header != NULL && glb_config->max_flows
+               && ctx->stats.num_records_in_table >= glb_config->max_flows
+               && ctx->flow_record_chrono_first != NULL) {
+            flow_record_evict(ctx);
+        }
+
+        /* allocate and initialize a new flow record */
+        record = flow_record_alloc(ctx);
+        joy_log_debug("LIST record %p allocated\n", record);
+
+        if (record == NULL) {
+            joy_log_warn("could not allocate memory for flow_record");
+            flocap_stats_incr_malloc_fail(ctx);
+            return NULL;
+        }
+
+        flow_record_init(ctx, record, key);
+        record->key_hash = hash_key;
+
+        /*
+         * the record can't expire before the inactive timeout has passed
+         * since this packet; records created without a packet (flow
+         * collection) get their times from the flow data, so check them
+         * right away
+         */
+        if (header != NULL) {
+            first_check = header->ts.tv_sec + time_window.tv_sec;
+        } else {
+            first_check = ctx->global_time.tv_sec;
+        }
+
+        /* enter record into the flow table */
+        if (flow_table_insert(ctx, hash_key, record) != ok) {
+            flocap_stats_decr_records_in_table(ctx);
+            flow_record_free(ctx, record);
+            flocap_stats_incr_malloc_fail(ctx);
+            return NULL;
+        }
+
+        /*
+         * if we are tracking bidirectional flows, and if record has a
+         * twin, then set both twin pointers; otherwise, enter the
+         * record into the chronological list
+         */
+        if (glb_config->bidir) {
+            record->twin = flow_key_get_twin(ctx, key, hash_key);
+            joy_log_debug("LIST record %p is twin of %p\n", record, record->twin);
+        }
+        if (record->twin != NULL) {
+            if (record->twin->twin != NULL) {
+                joy_log_info("warning: found twin that already has a twin; not setting twin pointer\n");
+                /*
+                 * experimental - consider this record an orphan, add it to chrono list, but without its twin pointer set
+                 */
+                record->twin = NULL;
+                flow_record_chrono_list_append(ctx, record);
+                flow_timer_schedule(ctx, record, first_check);
+                flow_record_touch(ctx, record);
+            } else {
+                record->twin->twin = record;
+                flow_record_touch(ctx, record->twin);
+            }
+        } else {
+
+            /* this flow has no twin, so add it to chronological list */
+            flow_record_chrono_list_append(ctx, record);
+            flow_timer_schedule(ctx, record, first_check);
+            flow_record_touch(ctx, record);
+        }
+    }
+    return record;
+}
+
+/**
+ * \brief Delete a flow record.
+ * \param r The flow_record to delete
+ * \return none
+ */
+static void flow_record_delete (joy_ctx_data *ctx, flow_record_t *r) {
+    unsigned int i;
+
+    if (flow_table_remove(&ctx->flow_table, r) != 0) {
+        joy_log_err("problem removing flow record %p from flow table", r);
+        return;
+    }
+
+    flocap_stats_decr_records_in_table(ctx);
+
+    /* take it off the flow queues */
+    for (i = 0; r->queued != 0; i++) {
+        flow_queue_remove(ctx, r, i);
+    }
+
+    /* update context counts */
+    if (r->idp_len > 0) {
+        --ctx->idp_recs_ready;
+    }
+
+    if (r->op >= ETTA_MIN_PACKETS) {
+        --ctx->splt_recs_ready;
+    }
+
+    if (r->ob >= ETTA_MIN_OCTETS) {
+        --ctx->bd_recs_ready;
+    }
+
+    if (r->tls != NULL) {
+        if (r->tls->done_handshake) {
+            --ctx->tls_recs_ready;
+        }
+    }
+
+    if (r->salt != NULL) {
+        if (r->salt->np >= ETTA_MIN_PACKETS) {
+            --ctx->salt_recs_ready;
+        }
+    }
+
+    /*
+     * free the memory allocated inside of flow record
+     */
+    free(r->idp);
+    free(r->exe_name);
+    free(r->full_path);
+    free(r->file_version);
+    free(r->file_hash);
+    free(r->joy_app_data);
+    free(r->splt);
+    free(r->bd);
+    free(r->retrans);
+
+    delete_all_features(feature_list);
+
+    /*
+     * zeroize memory (this is defensive coding; pointers to deleted
+     * records will result in crashes rather than silent errors)
+     */
+    memset_s(r, sizeof(flow_record_t), 0, sizeof(flow_record_t));
+    flow_record_free(ctx, r);
+    r = NULL;
+}
+
+/**
+* \fn int flow_key_set_process_info (const flow_key_t *key, const host_flow_t *data)
+* \param key flow key structure
+* \param data process flow information
+* \return failure
+* \return ok
+*/
+int flow_key_set_process_info(joy_ctx_data *ctx, const flow_key_t *key, const host_flow_t *data) {
+        flow_record_t *r;
+
+        if (data->exe_name == NULL) {
+                return failure;   /* no point in looking for flow_record */
+        }
+        r = flow_key_get_record(ctx, key, DONT_CREATE_RECORDS, NULL);
+        // flow_key_print(key);
+        if (r) {
+                if (r->exe_name == NULL) {
+                    //r->exe_name = strndup(data->exe_name, PID_MAX_LEN);
+                   r->exe_name = strdup(data->exe_name);
+                }
+                if (r->full_path == NULL) {
+                    if (data->full_path)
+                        r->full_path = strndup(data->full_path, PROC_PATH_LEN);
+                }
+                if (r->file_version == NULL) {
+                    if (data->file_version)
+                        r->file_version = strndup(data->file_version, PROC_EXE_LEN);
+                }
+                if (r->file_hash == NULL) {
+                    if (data->hash)
+                        r->file_hash = strndup(data->hash, 100);// ??
+                }
+                r->uptime_seconds = data->uptime_seconds;
+                return ok;
+        }
+        return failure;
+}
+
+/**
+ * \brief Update the timeout values for flow record expiration
+ * \param inact number of seconds for inactivity timeout
+ * \param act number of seconds for activity timeout
+ * \return none
+ */
+void flow_record_update_timeouts (unsigned int inact, unsigned int act) {
+
+    time_window.tv_sec  = (inact > 0) ? inact : T_WINDOW;
+    time_window.tv_usec = 0;
+    active_timeout.tv_sec  = (act > 0) ? act : T_ACTIVE;
+    active_timeout.tv_usec = 0;
+    active_max = (time_window.tv_sec + active_timeout.tv_sec);
+}
+
+/* read-only stand-ins for flow records that have no SPLT or BD block */
+const flow_splt_t flow_splt_empty;
+const flow_bd_t flow_bd_empty;
+
+/**
+ * \brief Attach an SPLT block to the flow record.
+ * \param f Flow record
+ * \return The record's SPLT block, or NULL if it could not be allocated
+ */
+flow_splt_t *flow_record_attach_splt (flow_record_t *f) {
+    if (f->splt == NULL) {
+        f->splt = calloc(1, sizeof(flow_splt_t));
+        if (f->splt == NULL) {
+            joy_log_err("could not allocate SPLT block");
+        }
+    }
+    return f->splt;
+}
+
+/**
+ * \brief Attach a byte distribution block to the flow record.
+ * \param f Flow record
+ * \return The record's byte distribution block, or NULL if it could not be allocated
+ */
+flow_bd_t *flow_record_attach_bd (flow_record_t *f) {
+    if (f->bd == NULL) {
+        f->bd = calloc(1, sizeof(flow_bd_t));
+        if (f->bd == NULL) {
+            joy_log_err("could not allocate byte distribution block");
+        }
+    }
+    return f->bd;
+}
+
+/**
+ * \brief Attach a TCP retransmission buffer to the flow record.
+ * \param f Flow record
+ * \return The record's retransmission buffer, or NULL if it could not be allocated
+ */
+flow_retrans_t *flow_record_attach_retrans (flow_record_t *f) {
+    if (f->retrans == NULL) {
+        f->retrans = calloc(1, sizeof(flow_retrans_t));
+        if (f->retrans == NULL) {
+            joy_log_err("could not allocate retransmission buffer");
+        }
+    }
+    return f->retrans;
+}
+
+/**
+ * \brief Append a packet to the flow record's sequence of packet lengths and times.
+ *
+ * The caller checks that there is room (f->op < MAX_NUM_PKT_LEN).  The
+ * SPLT block is only attached when lengths and times are reported
+ * (num_pkts > 0); the packet is counted in f->op either way.
+ *
+ * \param f Flow record
+ * \param len Length of the packet's application data
+ * \param time Arrival time of the packet
+ * \return none
+ */
+void flow_record_update_splt (flow_record_t *f, unsigned int len, const struct timeval *time) {
+    if (glb_config->num_pkts > 0 && flow_record_attach_splt(f) != NULL) {
+        f->splt->pkt_len[f->op] = len;
+        joy_timer_series_set(&f->splt->start, f->splt->pkt_time, f->op, time);
+    }
+    f->op++;
+}
+
+/**
+ * \brief Update the byte count for the flow record.
+ * \param f Flow record
+ * \param x Data to use for update
+ * \param len Length of the data (in bytes)
+ * \return none
+ */
+void flow_record_update_byte_count (flow_record_t *f, const void *x, unsigned int len) {
+    const unsigned char *data = x;
+    unsigned int i;
+    unsigned int current_count = 0;
+
+    /*
+     * implementation note: The spec says that 4000 octets is enough of a
+     * sample size to accurately reflect the byte distribution. Also, to avoid
+     * wrapping of the byte count at the 16-bit boundry, we stop counting once
+     * the 4000th octet has been seen for a flow.
+     */
+
+    /* octet count was already incremented before processing this payload */
+    current_count = f->ob - len;
+
+    if (glb_config->byte_distribution || glb_config->report_entropy) {
+        if (current_count < ETTA_MIN_OCTETS && len > 0) {
+            if (flow_record_attach_bd(f) == NULL) {
+                return;
+            }
+            for (i=0; i<len; i++) {
+                f->bd->byte_count[data[i]]++;
+                current_count++;
+                if (current_count >= ETTA_MIN_OCTETS) {
+                   break;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * \brief Update the compact byte count for the flow record.
+ * \param f Flow record
+ * \param x Data to use for update
+ * \param len Length of the data (in bytes)
+ * \return none
+ */
+void flow_record_update_compact_byte_count (flow_record_t *f, const void *x, unsigned int len) {
+    const unsigned char *data = x;
+    unsigned int i;
+
+    if (glb_config->compact_byte_distribution && len > 0) {
+        if (flow_record_attach_bd(f) == NULL) {
+            return;
+        }
+        for (i=0; i<len; i++) {
+            f->bd->compact_byte_count[glb_config->compact_bd_mapping[data[i]]]++;
+        }
+    }
+}
+
+/**
+ * \brief Update the byte distribution mean for the flow record.
+ * \param f Flow record
+ * \param x Data to use for update
+ * \param len Length of the data (in bytes)
+ * \return none
+ */
+void flow_record_update_byte_dist_mean_var (flow_record_t *f, const void *x, unsigned int len) {
+    const unsigned char *data = x;
+    double delta;
+    unsigned int i;
+
+    if ((glb_config->byte_distribution || glb_config->report_entropy) && len > 0) {
+        flow_bd_t *bd = flow_record_attach_bd(f);
+
+        if (bd == NULL) {
+            return;
+        }
+        for (i=0; i<len; i++) {
+            bd->num_bytes += 1;
+            delta = ((double)data[i] - bd->bd_mean);
+            bd->bd_mean += delta/((double)bd->num_bytes);
+            bd->bd_variance += delta*((double)data[i] - bd->bd_mean);
+        }
+    }
+}
+
+static float flow_record_get_byte_count_entropy (const uint32_t byte_count[256],
+    unsigned int num_bytes) {
+    int i;
+    float tmp, sum = 0.0;
+
+    for (i=0; i<256; i++) {
+        tmp = (float) byte_count[i] / (float) num_bytes;
+        if (tmp > FLT_EPSILON) {
+            sum -= tmp * logf(tmp);
+        }
+        // fprintf(output, "tmp: %f\tsum: %f\n", tmp, sum);
+    }
+    return sum / logf(2.0);
+}
+
+static void print_bytes_dir_time (joy_ctx_data *ctx,
+                                  unsigned short int pkt_len,
+                                  const char *dir,
+                                  struct timeval ts,
+                                  const char *term) {
+    if (pkt_len < 32768) {
+        zputs(ctx->output, "{\"b\":");
+        zprint_uint(ctx->output, pkt_len);
+        zputs(ctx->output, ",\"dir\":");
+        zprint_json_string(ctx->output, dir);
+        zputs(ctx->output, ",\"ipt\":");
+        zprint_uint(ctx->output, joy_timeval_to_milliseconds(ts));
+        zputc(ctx->output, '}');
+        zputs(ctx->output, term);
+    } else {
+        zputs(ctx->output, "{\"rep\":");
+        zprint_uint(ctx->output, 65536-pkt_len);
+        zputs(ctx->output, ",\"dir\":");
+        zprint_json_string(ctx->output, dir);
+        zputs(ctx->output, ",\"ipt\":");
+        zprint_uint(ctx->output, joy_timeval_to_milliseconds(ts));
+        zputc(ctx->output, '}');
+        zputs(ctx->output, term);
+    }
+}
+
+/**
+ * \brief Print out raw values as hex to the output file.
+ * \param f Output file
+ * \param data The data to print out
+ * \param len Length of the data to print (in bytes)
+ * \return none
+ */
+void zprintf_raw_as_hex (zfile f,
+                         const unsigned char *data,
+                         unsigned int len) {
+    zputc(f, '"');   /* quotes needed for JSON */
+    zprint_hex(f, data, len);
+    zputc(f, '"');
+}
+
+static void reduce_bd_bits (uint32_t *bd,
+                            unsigned int len) {
+    int mask = 0;
+    int shift = 0;
+    unsigned int i = 0;
+
+    for (i = 0; i < len; i++) {
+        mask = mask | bd[i];
+    }
+
+    mask = mask >> 8;
+    for (i = 0; i < 24 && mask; i++) {
+        mask = mask >> 1;
+        if (mask == 0) {
+            shift = i+1;
+            break;
+        }
+    }
+
+    for (i = 0; i < len; i++) {
+        bd[i] = bd[i] >> shift;
+    }
+}
+
+/**
+ * \brief Print the host executable information tied to this flow.
+ *
+ * \param f Output file
+ * \param rec Flow record
+ *
+ * \return none
+ */
+static void print_executable_json (zfile f, const flow_record_t *rec) {
+    uint8_t comma = 0;
+
+    if (rec->exe_name || rec->full_path ||
+        rec->file_version || rec->file_hash) {
+
+        zputs(f, ",\"exe\":{");
+        if (rec->exe_name) {
+            zputs(f, "\"name\":");
+            zprint_json_string(f, rec->exe_name);
+            comma = 1;
+        }
+        if (rec->full_path) {
+            if (comma) {
+                zputs(f, ",\"path\":");
+                zprint_json_string(f, rec->full_path);
+            } else {
+                zputs(f, "\"path\":");
+                zprint_json_string(f, rec->full_path);
+                comma = 1;
+            }
+        }
+        if (rec->file_version) {
+            if (comma) {
+                zputs(f, ",\"version\":");
+                zprint_json_string(f, rec->file_version);
+            } else {
+                zputs(f, "\"version\":");
+                zprint_json_string(f, rec->file_version);
+                comma = 1;
+            }
+        }
+        if (rec->file_hash) {
+            if (comma) {
+                zputs(f, ",\"hash\":");
+                zprint_json_string(f, rec->file_hash);
+            } else {
+                zputs(f, "\"hash\":");
+                zprint_json_string(f, rec->file_hash);
+                comma = 1;
+            }
+        }
+        if (rec->uptime_seconds > 0) {
+            if (comma) {
+                zputs(f, ",\"uptime\":");
+                zprint_uint64(f, (unsigned long long)rec->uptime_seconds);
+            } else {
+                zputs(f, "\"uptime\":");
+                zprint_uint64(f, (unsigned long long)rec->uptime_seconds);
+                comma = 1;
+            }
+        }
+        zputc(f, '}');
+    }
+}
+
+static void print_tcp_json (zfile f, const flow_record_t *rec) {
+    int top_com = 0;
+    int com = 0;
+    int empty = 1;
+    int out_empty = 1;
+    int in_empty = 1;
+
+    /*
+     * Check what TCP data is avilable (if any).
+     */
+    if (rec->tcp.first_seq) {
+        empty = 0;
+    } else if (rec->twin && rec->twin->tcp.first_seq) {
+        empty = 0;
+    }
+
+#define not_empty(rec) (rec->tcp.flags || rec->tcp.first_window_size || rec->tcp.opt_len)
+
+    if (not_empty(rec)) {
+        empty = 0; out_empty = 0;
+    }
+    if (rec->twin && not_empty(rec->twin)) {
+        empty = 0; in_empty = 0;
+    }
+
+    if (empty) {
+        /* No data to print */
+        return;
+    }
+
+    zputs(f, ",\"tcp\":{");
+
+    if (rec->tcp.first_seq) {
+        zputs(f, "\"first_seq\":");
+        zprint_uint(f, rec->tcp.first_seq);
+        top_com = 1;
+    } else if (rec->twin != NULL && rec->twin->tcp.first_seq) {
+        zputs(f, "\"first_seq\":");
+        zprint_uint(f, rec->twin->tcp.first_seq);
+        top_com = 1;
+    }
+
+    if (!out_empty) {
+        char out_flags_string[9] = {0};
+
+        if (top_com) {
+            zputs(f, ",\"out\":{");
+        } else {
+            zputs(f, "\"out\":{");
+            top_com = 1;
+        }
 
         if (rec->tcp.flags) {
             tcp_flags_to_string(rec->tcp.flags, out_flags_string);
-            zprintf(f, "\"flags\":\"%s\"", out_flags_string);
+            zputs(f, "\"flags\":");
+            zprint_json_string(f, out_flags_string);
+            com = 1;
+        }
+
+        if (rec->tcp.first_window_size) {
+            if (com) {
+                zputs(f, ",\"first_window_size\":");
+                zprint_uint(f, rec->tcp.first_window_size);
+            } else {
+                zputs(f, "\"first_window_size\":");
+                zprint_uint(f, rec->tcp.first_window_size);
+                com = 1;
+            }
+        }
+
+        if (rec->tcp.opt_len) {
+            if (com) {
+                zputs(f, ",\"opt_len\":");
+                zprint_uint(f, rec->tcp.opt_len);
+            } else {
+                zputs(f, "\"opt_len\":");
+                zprint_uint(f, rec->tcp.opt_len);
+            }
+            tcp_opt_print_json(f, rec->tcp.opts, rec->tcp.opt_len);
+        }
+
+        /* End out object */
+        zputc(f, '}');
+    }
+
+    if (!in_empty) {
+        char in_flags_string[9] = {0};
+        com = 0;
+
+        if (top_com) {
+            zputs(f, ",\"in\":{");
+        } else {
+            zputs(f, "\"in\":{");
+        }
+
+        if (rec->twin->tcp.flags) {
+            tcp_flags_to_string(rec->twin->tcp.flags, in_flags_string);
+            zputs(f, "\"flags\":");
+            zprint_json_string(f, in_flags_string);
             com = 1;
         }
 
-        if (rec->tcp.first_window_size) {
-            if (com) {
-                zprintf(f, ",\"first_window_size\":%u", rec->tcp.first_window_size);
+        if (rec->twin->tcp.first_window_size) {
+            if (com) {
+                zputs(f, ",\"first_window_size\":");
+                zprint_uint(f, rec->twin->tcp.first_window_size);
+            } else {
+                zputs(f, "\"first_window_size\":");
+                zprint_uint(f, rec->twin->tcp.first_window_size);
+                com = 1;
+            }
+        }
+
+        if (rec->twin->tcp.opt_len) {
+            if (com) {
+                zputs(f, ",\"opt_len\":");
+                zprint_uint(f, rec->twin->tcp.opt_len);
+            } else {
+                zputs(f, "\"opt_len\":");
+                zprint_uint(f, rec->twin->tcp.opt_len);
+            }
+            tcp_opt_print_json(f, rec->twin->tcp.opts, rec->twin->tcp.opt_len);
+        }
+
+        /* End in object */
+        zputc(f, '}');
+    }
+
+    /* End tcp object */
+    zputc(f, '}');
+}
+
+static void print_ip_json (zfile f, const flow_record_t *rec) {
+    int k = 0;
+
+    zputs(f, ",\"ip\":{");
+
+    zputs(f, "\"out\":{");
+    zputs(f, "\"ttl\":");
+    zprint_uint(f, rec->ip.ttl);
+    if (rec->ip.num_id) {
+        zputs(f, ",\"id\":[");
+        for (k = 0; k < rec->ip.num_id - 1; k++) {
+            zprint_uint(f, rec->ip.id[k]);
+            zputc(f, ',');
+        }
+        zprint_uint(f, rec->ip.id[k]);
+        zputc(f, ']');
+    }
+    /* End out object */
+    zputc(f, '}');
+
+    if (rec->twin) {
+        zputs(f, ",\"in\":{");
+        zputs(f, "\"ttl\":");
+        zprint_uint(f, rec->twin->ip.ttl);
+        if (rec->twin->ip.num_id) {
+            zputs(f, ",\"id\":[");
+            for (k = 0; k < rec->twin->ip.num_id - 1; k++) {
+                zprint_uint(f, rec->twin->ip.id[k]);
+                zputc(f, ',');
+            }
+            zprint_uint(f, rec->twin->ip.id[k]);
+            zputc(f, ']');
+        }
+        /* End in object */
+        zputc(f, '}');
+    }
+
+    /* End IP object */
+    zputc(f, '}');
+}
+
+static const flow_record_t *tcp_client_flow(const flow_record_t *a,
+                                                 const flow_record_t *b) {
+    if (!a->tcp.flags && !b->tcp.flags) {
+        /* No flags to compare */
+        return NULL;
+    }
+
+    if (a->tcp.flags == 2 && b->tcp.flags == 2) {
+        /* Cannot determine, both have SYN */
+        return NULL;
+    }
+
+    /* SYN */
+    if (a->tcp.flags == 2) {
+        return a;
+    } else if (b->tcp.flags == 2) {
+        return b;
+    }
+
+    if (a->tcp.flags == 18 && b->tcp.flags == 18) {
+        /* Cannot determine, both have SYN/ACK */
+        return NULL;
+    }
+
+    /*
+     * SYN/ACK
+     * If detected, then return the twin.
+     */
+    if (a->tcp.flags == 18) {
+        return b;
+    } else if (b->tcp.flags == 18) {
+        return a;
+    }
+
+    return NULL;
+}
+
+static const flow_record_t *get_client_flow(const flow_record_t *a,
+                                                 const flow_record_t *b) {
+    /* See if either is client */
+    if (a->dir == DIR_CLIENT) {
+        return a;
+    } else if (b->dir == DIR_CLIENT) {
+        return b;
+    }
+
+    /* See if either is server, then the twin is client */
+    if (a->dir == DIR_SERVER) {
+        return b;
+    } else if (b->dir == DIR_SERVER) {
+        return a;
+    }
+
+    /*
+     * Try identifying by tcp flags.
+     */
+    return tcp_client_flow(a, b);
+}
+
+/**
+ * \brief Find the client side of a flow record, and the time range of
+ *        the flow.
+ *
+ * \param record Flow record
+ * \param ts_start Set to the start time of the flow
+ * \param ts_end Set to the end time of the flow
+ *
+ * \return The record of the client side, whose twin is the server side
+ */
+static const flow_record_t *flow_record_orient (const flow_record_t *record,
+                                                struct timeval *ts_start,
+                                                struct timeval *ts_end) {
+    const flow_record_t *rec = NULL;
+
+    if (record->twin != NULL) {
+        /*
+         * The flow is bidirectional.
+         * Need to figure client/server order.
+         * try to determine directionality
+         */
+        rec = get_client_flow(record, record->twin);
+        if (rec != NULL) {
+            *ts_start = rec->start;
+            *ts_end = record->end;
+        } else {
+            /*
+             * Get start time.
+             * Use the smaller of the 2 time values.
+             */
+            if (joy_timer_lt(&record->start, &record->twin->start)) {
+                *ts_start = record->start;
+                rec = record;
+            } else {
+                *ts_start = record->twin->start;
+                rec = record->twin;
+            }
+
+            /*
+             * Get end time.
+             * Use the larger of the 2 time values.
+             */
+            if (joy_timer_lt(&record->end, &record->twin->end)) {
+                *ts_end = record->twin->end;
+            } else {
+                *ts_end = record->end;
+            }
+        }
+    } else {
+        /*
+         * The flow is unidirectional. Easy enough.
+         */
+        *ts_start = record->start;
+        *ts_end = record->end;
+        rec = record;
+    }
+
+    return rec;
+}
+
+#define OUT "<"
+#define IN  ">"
+
+/*
+ * Starts a member of the flow record object, after a comma unless it
+ * is the first one.
+ */
+static inline void flow_record_print_key (zfile f, unsigned int *first, const char *key) {
+    if (*first) {
+        *first = 0;
+    } else {
+        zputc(f, ',');
+    }
+    zputs(f, key);
+}
+
+/*
+ * Writes the labels of the subnets that the addresses of a flow are
+ * in, if there are any.  The labels end with a comma, so the member
+ * after them is written as if it were the first.
+ */
+static void flow_record_print_labels (joy_ctx_data *ctx, const flow_record_t *rec,
+                                      unsigned int *first) {
+    attr_flags flag;
+
+    if (glb_config->num_subnets == 0 || rec->ip_type != ETH_TYPE_IP) {
+        return;
+    }
+    flag = radix_trie_lookup_addr(glb_config->rt, rec->key.sa.v4_sa);
+    if (flag) {
+        if (!*first) {
+            zputc(ctx->output, ',');
+        }
+        attr_flags_json_print_labels(glb_config->rt, flag, "sa_labels", ctx->output);
+        *first = 1;
+    }
+    flag = radix_trie_lookup_addr(glb_config->rt, rec->key.da.v4_da);
+    if (flag) {
+        if (!*first) {
+            zputc(ctx->output, ',');
+        }
+        attr_flags_json_print_labels(glb_config->rt, flag, "da_labels", ctx->output);
+        *first = 1;
+    }
+}
+
+/*
+ * Writes an address of a flow record as a JSON string.
+ */
+static void flow_record_print_addr (zfile f, const flow_record_t *rec, const void *addr) {
+    char buffer[INET6_ADDRSTRLEN > IPV4_ANON_LEN ? INET6_ADDRSTRLEN : IPV4_ANON_LEN];
+
+    if (rec->ip_type == ETH_TYPE_IPV6) {
+        inet_ntop(AF_INET6, addr, buffer, INET6_ADDRSTRLEN);
+    } else if (ipv4_addr_needs_anonymization(addr)) {
+        addr_get_anon_hexstring(addr, (char*)&buffer, IPV4_ANON_LEN);
+    } else {
+        inet_ntop(AF_INET, addr, buffer, INET_ADDRSTRLEN);
+    }
+    zprint_json_string(f, buffer);
+}
+
+/*
+ * Writes the lengths, directions and times of the packets of a flow
+ * record, merged in time order for a bidirectional flow, and the ]
+ * that closes the array.
+ */
+static void flow_record_print_packets (joy_ctx_data *ctx, const flow_record_t *rec,
+                                       const flow_splt_t *splt, const flow_splt_t *twin_splt,
+                                       const struct timeval *ts_start) {
+    unsigned int i, j, imax, jmax;
+    struct timeval ts, ts_last, ts_tmp, ts_i, ts_j;
+    unsigned int pkt_len;
+    const char *dir;
+
+    if (rec->twin == NULL) {
+
+        imax = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
+        if (imax == 0) {
+            ; /* no packets had data, so we print out nothing */
+        } else {
+            for (i = 0; i < imax-1; i++) {
+                joy_timer_series_get(&splt->start, splt->pkt_time, i, &ts_i);
+                if (i > 0) {
+                    joy_timer_sub(&ts_i, &ts_last, &ts);
+                } else {
+                    joy_timer_clear(&ts);
+                }
+                ts_last = ts_i;
+                print_bytes_dir_time(ctx, splt->pkt_len[i], OUT, ts, ",");
+            }
+            if (i == 0) {        /* TODO this code could be simplified */
+                joy_timer_clear(&ts);
+            } else {
+                joy_timer_series_get(&splt->start, splt->pkt_time, i, &ts_i);
+                joy_timer_sub(&ts_i, &ts_last, &ts);
+            }
+            print_bytes_dir_time(ctx, splt->pkt_len[i], OUT, ts, "");
+        }
+        zputc(ctx->output, ']');
+    } else {
+        imax = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
+        jmax = rec->twin->op > glb_config->num_pkts ? glb_config->num_pkts : rec->twin->op;
+        i = j = 0;
+        ts_last = *ts_start;
+
+        while ((i < imax) || (j < jmax)) {
+            if (i < imax) {
+                joy_timer_series_get(&splt->start, splt->pkt_time, i, &ts_i);
+            }
+            if (j < jmax) {
+                joy_timer_series_get(&twin_splt->start, twin_splt->pkt_time, j, &ts_j);
+            }
+            if (i >= imax) {
+                /* record list is exhausted, so use twin */
+                    dir = OUT;
+                    ts = ts_j;
+                    pkt_len = twin_splt->pkt_len[j];
+                    j++;
+            } else if (j >= jmax) {
+                /* twin list is exhausted, so use record */
+                dir = IN;
+                ts = ts_i;
+                pkt_len = splt->pkt_len[i];
+                i++;
+            } else {
+                /* Neither list is exhausted, so use list with lowest time */
+                if (joy_timer_lt(&ts_i, &ts_j)) {
+                    ts = ts_i;
+                    pkt_len = splt->pkt_len[i];
+                    dir = IN;
+                    if (i < imax) i++;
+                } else {
+                    ts = ts_j;
+                    pkt_len = twin_splt->pkt_len[j];
+                    dir = OUT;
+                    if (j < jmax) j++;
+                }
+            }
+
+            joy_timer_sub(&ts, &ts_last, &ts_tmp);
+            print_bytes_dir_time(ctx, pkt_len, dir, ts_tmp, "");
+            ts_last = ts;
+
+            if (!((i == imax) & (j == jmax))) {
+                /* Done */
+                zputc(ctx->output, ',');
+            }
+        }
+        zputc(ctx->output, ']');
+    }
+}
+
+/**
+ * \brief Print a flow record to the JSON output.
+ *
+ * The members that the plan compiled from the fields option leaves
+ * out are skipped before they are formatted; see print_plan.h.
+ *
+ * \param record Flow record to print
+ *
+ * \return none
+ */
+static void flow_record_print_json
+ (joy_ctx_data *ctx, const flow_record_t *record) {
+    unsigned int i;
+    struct timeval ts_start, ts_end;
+    const flow_record_t *rec = NULL;
+    const flow_splt_t *splt, *twin_splt = NULL;
+    const flow_bd_t *bd, *twin_bd = NULL;
+    const print_plan_t *plan = glb_config->plan;
+    unsigned int first = 1;
+
+    flocap_stats_incr_records_output(ctx);
+    ctx->records_in_file++;
+
+    rec = flow_record_orient(record, &ts_start, &ts_end);
+
+    /*****************************************************************
+     * ---------------------------------------------------------------
+     * Flow Record object start
+     * ---------------------------------------------------------------
+     *****************************************************************
+     */
+    zputc(ctx->output, '{');
+
+    /* a plan has the labels first, as a member must follow them */
+    if (plan != NULL && print_plan_has(plan, PLAN_FIELD_LABELS)) {
+        flow_record_print_labels(ctx, rec, &first);
+    }
+
+    if (print_plan_has(plan, PLAN_FIELD_SA)) {
+        flow_record_print_key(ctx->output, &first, "\"sa\":");
+        flow_record_print_addr(ctx->output, rec, &rec->key.sa);
+    }
+    if (print_plan_has(plan, PLAN_FIELD_DA)) {
+        flow_record_print_key(ctx->output, &first, "\"da\":");
+        flow_record_print_addr(ctx->output, rec, &rec->key.da);
+    }
+    if (print_plan_has(plan, PLAN_FIELD_PR)) {
+        flow_record_print_key(ctx->output, &first, "\"pr\":");
+        zprint_uint(ctx->output, rec->key.prot);
+    }
+
+    /* Make dp/sp null for other protocols, so that they can still be compared */
+    if (print_plan_has(plan, PLAN_FIELD_SP)) {
+        flow_record_print_key(ctx->output, &first, "\"sp\":");
+        if (rec->key.prot == 6 || rec->key.prot == 17) {
+            zprint_uint(ctx->output, rec->key.sp);
+        } else {
+            zputs(ctx->output, "null");
+        }
+    }
+    if (print_plan_has(plan, PLAN_FIELD_DP)) {
+        flow_record_print_key(ctx->output, &first, "\"dp\":");
+        if (rec->key.prot == 6 || rec->key.prot == 17) {
+            zprint_uint(ctx->output, rec->key.dp);
+        } else {
+            zputs(ctx->output, "null");
+        }
+    }
+
+    /*
+     * if src or dst address matches a subnets associated with labels,
+     * then print out those labels
+     */
+    if (plan == NULL) {
+        flow_record_print_labels(ctx, rec, &first);
+    }
+
+    /*
+     * Flow stats
+     */
+    if (print_plan_has(plan, PLAN_FIELD_BYTES_OUT)) {
+        flow_record_print_key(ctx->output, &first, "\"bytes_out\":");
+        zprint_uint(ctx->output, rec->ob);
+    }
+    if (print_plan_has(plan, PLAN_FIELD_NUM_PKTS_OUT)) {
+        flow_record_print_key(ctx->output, &first, "\"num_pkts_out\":");
+        zprint_uint(ctx->output, rec->np); /* not just packets with data */
+    }
+    if (rec->twin != NULL) {
+        if (print_plan_has(plan, PLAN_FIELD_BYTES_IN)) {
+            flow_record_print_key(ctx->output, &first, "\"bytes_in\":");
+            zprint_uint(ctx->output, rec->twin->ob);
+        }
+        if (print_plan_has(plan, PLAN_FIELD_NUM_PKTS_IN)) {
+            flow_record_print_key(ctx->output, &first, "\"num_pkts_in\":");
+            zprint_uint(ctx->output, rec->twin->np);
+        }
+    }
+    if (print_plan_has(plan, PLAN_FIELD_TIME_START)) {
+        flow_record_print_key(ctx->output, &first, "\"time_start\":");
+        zprint_timestamp(ctx->output, ts_start.tv_sec, ts_start.tv_usec);
+    }
+    if (print_plan_has(plan, PLAN_FIELD_TIME_END)) {
+        flow_record_print_key(ctx->output, &first, "\"time_end\":");
+        zprint_timestamp(ctx->output, ts_end.tv_sec, ts_end.tv_usec);
+    }
+
+    splt = flow_record_splt(rec);
+    bd = flow_record_bd(rec);
+    if (rec->twin != NULL) {
+        twin_splt = flow_record_splt(rec->twin);
+        twin_bd = flow_record_bd(rec->twin);
+    }
+
+    /*****************************************************************
+     * Packet length and time array
+     *****************************************************************
+     */
+    if (print_plan_has(plan, PLAN_FIELD_PACKETS)) {
+        flow_record_print_key(ctx->output, &first, "\"packets\":[");
+        flow_record_print_packets(ctx, rec, splt, twin_splt, &ts_start);
+    }
+
+    if ((glb_config->byte_distribution && print_plan_has(plan, PLAN_FIELD_BYTE_DIST)) ||
+        (glb_config->report_entropy && print_plan_has(plan, PLAN_FIELD_ENTROPY)) ||
+        (glb_config->compact_byte_distribution && print_plan_has(plan, PLAN_FIELD_COMPACT_BYTE_DIST))) {
+        const uint32_t *array = NULL;
+        const uint32_t *compact_array = NULL;
+        uint32_t tmp[256];
+        uint32_t compact_tmp[16];
+        unsigned int num_bytes;
+        double mean = 0.0, variance = 0.0;
+
+        /*
+         * Sum up the byte_count array for outbound and inbound flows,
+         * if this flow is bidirectional
+         */
+        if (rec->twin == NULL) {
+            array = bd->byte_count;
+            //compact_array = bd->compact_byte_count; //overwritten below fixme
+            num_bytes = rec->ob;
+
+            for (i=0; i<256; i++) {
+                      tmp[i] = bd->byte_count[i];
+            }
+            for (i=0; i<16; i++) {
+                      compact_tmp[i] = bd->compact_byte_count[i];
+            }
+
+            if (bd->num_bytes != 0) {
+                mean = bd->bd_mean;
+                variance = bd->bd_variance/(bd->num_bytes - 1);
+                variance = sqrt(variance);
+
+                if (bd->num_bytes == 1) {
+                    variance = 0.0;
+                }
+            }
+        } else {
+            for (i=0; i<256; i++) {
+                      tmp[i] = bd->byte_count[i] + twin_bd->byte_count[i];
+            }
+            for (i=0; i<16; i++) {
+                      compact_tmp[i] = bd->compact_byte_count[i] + twin_bd->compact_byte_count[i];
+            }
+            array = tmp;
+            compact_array = compact_tmp;
+            num_bytes = rec->ob + rec->twin->ob;
+
+            if (bd->num_bytes + twin_bd->num_bytes != 0) {
+                mean = ((double)bd->num_bytes)/((double)(bd->num_bytes+twin_bd->num_bytes))*bd->bd_mean +
+                           ((double)twin_bd->num_bytes)/((double)(bd->num_bytes+twin_bd->num_bytes))*twin_bd->bd_mean;
+
+                    variance = ((double)bd->num_bytes)/((double)(bd->num_bytes+twin_bd->num_bytes))*bd->bd_variance +
+                               ((double)twin_bd->num_bytes)/((double)(bd->num_bytes+twin_bd->num_bytes))*twin_bd->bd_variance;
+
+                    variance = variance/((double)(bd->num_bytes + twin_bd->num_bytes - 1));
+                    variance = sqrt(variance);
+                    if (bd->num_bytes + twin_bd->num_bytes == 1) {
+                        variance = 0.0;
+                    }
+            }
+        }
+
+        if (glb_config->byte_distribution && print_plan_has(plan, PLAN_FIELD_BYTE_DIST)) {
+            reduce_bd_bits(tmp, 256);
+            array = tmp;
+
+            zputs(ctx->output, ",\"byte_dist\":[");
+            for (i = 0; i < 255; i++) {
+                zprint_uint(ctx->output, (unsigned char)array[i]);
+                zputc(ctx->output, ',');
+            }
+            zprint_uint(ctx->output, (unsigned char)array[i]);
+            zputc(ctx->output, ']');
+
+            /* Output the mean */
+            if (num_bytes != 0) {
+                zprintf(ctx->output, ",\"byte_dist_mean\":%f", mean);
+                zprintf(ctx->output, ",\"byte_dist_std\":%f", variance);
+            }
+
+        }
+
+        if (glb_config->compact_byte_distribution && print_plan_has(plan, PLAN_FIELD_COMPACT_BYTE_DIST)) {
+            reduce_bd_bits(compact_tmp, 16);
+            compact_array = compact_tmp;
+
+            zputs(ctx->output, ",\"compact_byte_dist\":[");
+            for (i = 0; i < 15; i++) {
+                zprint_uint(ctx->output, (unsigned char)compact_array[i]);
+                zputc(ctx->output, ',');
+            }
+            zprint_uint(ctx->output, (unsigned char)compact_array[i]);
+            zputc(ctx->output, ']');
+        }
+
+        if (glb_config->report_entropy && print_plan_has(plan, PLAN_FIELD_ENTROPY)) {
+            if (num_bytes != 0) {
+                double entropy = flow_record_get_byte_count_entropy(array, num_bytes);
+
+                zprintf(ctx->output, ",\"entropy\":%f", entropy);
+                zprintf(ctx->output, ",\"total_entropy\":%f", entropy * num_bytes);
+            }
+        }
+    }
+
+    /*
+     * Inline classification of flows
+     */
+    if (glb_config->include_classifier && print_plan_has(plan, PLAN_FIELD_P_MALWARE)) {
+        float score = 0.0;
+
+        if (rec->twin) {
+            score = classify(splt, twin_splt,
+                                     rec->start, rec->twin->start,
+                                     glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
+                                     rec->ob, rec->twin->ob, glb_config->byte_distribution,
+                                     bd->byte_count, twin_bd->byte_count);
+            ((flow_record_t*)rec)->twin->classify_value = score;
+        } else {
+            score = classify(splt, NULL, rec->start, rec->start,
+                                     glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
+                                     rec->ob, 0, glb_config->byte_distribution,
+                                     bd->byte_count, NULL);
+            ((flow_record_t*)rec)->classify_value = score;
+        }
+
+        zprintf(ctx->output, ",\"p_malware\":%f", score);
+    }
+
+    /* IP object */
+    if (print_plan_has(plan, PLAN_FIELD_IP)) {
+        print_ip_json(ctx->output, rec);
+    }
+
+    if (rec->key.prot == 6 && print_plan_has(plan, PLAN_FIELD_TCP)) {
+        /* TCP object */
+        print_tcp_json(ctx->output, rec);
+    }
+
+    /*
+     * All of the feature modules
+     */
+    print_all_features(feature_list);
+
+    /*
+     * Host executable
+     */
+    if (print_plan_has(plan, PLAN_FIELD_EXE)) {
+        print_executable_json(ctx->output, rec);
+    }
+
+    if (glb_config->report_hd && print_plan_has(plan, PLAN_FIELD_HD)) {
+        /*
+         * TODO: this should be bidirectional, but it is not!  This will
+         * be changed sometime soon, but for now, this will give some
+         * experience with this type of data
+         */
+        header_description_printf(&rec->hd, ctx->output, glb_config->report_hd);
+    }
+
+    /*
+     * Operating system
+     */
+    if (include_os && print_plan_has(plan, PLAN_FIELD_PROBABLE_OS)) {
+        if (rec->twin) {
+            os_printf(ctx->output, rec->ip.ttl, rec->tcp.first_window_size, rec->twin->ip.ttl, rec->twin->tcp.first_window_size);
+        } else {
+            os_printf(ctx->output, rec->ip.ttl, rec->tcp.first_window_size, 0, 0);
+        }
+    }
+
+    /*
+     * Initial data packet (IDP)
+     */
+    if (glb_config->idp && print_plan_has(plan, PLAN_FIELD_IDP)) {
+        if (rec->idp != NULL) {
+            zputs(ctx->output, ",\"idp_out\":");
+            zprintf_raw_as_hex(ctx->output, rec->idp, rec->idp_len);
+            zputs(ctx->output, ",\"idp_len_out\":");
+            zprint_uint(ctx->output, rec->idp_len);
+        }
+        if (rec->twin && (rec->twin->idp != NULL)) {
+            zputs(ctx->output, ",\"idp_in\":");
+            zprintf_raw_as_hex(ctx->output, rec->twin->idp, rec->twin->idp_len);
+            zputs(ctx->output, ",\"idp_len_in\":");
+            zprint_uint(ctx->output, rec->twin->idp_len);
+        }
+    }
+
+    if (print_plan_has(plan, PLAN_FIELD_DEBUG)) {
+        unsigned int retrans, invalid;
+
+        retrans = rec->tcp.retrans;
+        invalid = rec->invalid;
+        if (rec->twin) {
+            retrans += rec->twin->tcp.retrans;
+            invalid += rec->twin->invalid;
+        }
+
+        if (retrans || invalid) {
+            uint8_t comma = 0;
+            zputs(ctx->output, ",\"debug\":{");
+            if (retrans) {
+                zputs(ctx->output, "\"tcp_retrans\":");
+                zprint_uint(ctx->output, retrans);
+                comma = 1;
+            }
+            if (invalid) {
+                if (comma) {
+                    zputs(ctx->output, ",\"invalid\":");
+                    zprint_uint(ctx->output, invalid);
+                } else {
+                    zputs(ctx->output, "\"invalid\":");
+                    zprint_uint(ctx->output, invalid);
+                }
+            }
+            zputc(ctx->output, '}');
+        }
+
+    }
+
+    if (rec->exp_type && print_plan_has(plan, PLAN_FIELD_EXPIRE_TYPE)) {
+        zputs(ctx->output, ",\"expire_type\":\"");
+        zputc(ctx->output, rec->exp_type);
+        zputc(ctx->output, '"');
+    }
+
+    /*****************************************************************
+     * Flow Record object end
+     *****************************************************************
+     */
+    zputs(ctx->output, "}\n");
+    zcommit(ctx->output);
+}
+
+
+
+/* the 16 byte form of an address for the columnar export */
+static void columnar_addr (uint8_t *out, const flow_record_t *rec, const void *a) {
+    if (rec->ip_type == ETH_TYPE_IPV6) {
+        memcpy(out, a, 16);
+    } else if (ipv4_addr_needs_anonymization(a)) {
+        addr_get_anon_bytes(a, out);
+    } else {
+        memset_s(out, 10, 0x00, 10);
+        out[10] = out[11] = 0xff;
+        memcpy(out + 12, a, 4);
+    }
+}
+
+/* microseconds since the epoch */
+static int64_t columnar_usec (const struct timeval *ts) {
+    return (int64_t)ts->tv_sec * 1000000 + ts->tv_usec;
+}
+
+/**
+ * \brief Fill in the columnar row of a flow record.
+ *
+ * The values are the ones that flow_record_print_json() writes, with
+ * the flow oriented in the same way.
+ *
+ * \param record Flow record
+ * \param row The row to fill in
+ *
+ * \return none
+ */
+static void flow_record_columnar_row (const flow_record_t *record, columnar_row_t *row) {
+    const flow_record_t *rec;
+    const flow_splt_t *splt, *twin_splt = NULL;
+    const flow_bd_t *bd;
+    const tls_t *client = NULL, *server = NULL;
+    struct timeval ts_start, ts_end, ts, ts_last, ts_tmp, ts_i, ts_j;
+    unsigned int i, j, imax, jmax, n = 0;
+
+    memset_s(row, sizeof(columnar_row_t), 0x00, sizeof(columnar_row_t));
+    rec = flow_record_orient(record, &ts_start, &ts_end);
+
+    columnar_addr(row->sa, rec, &rec->key.sa);
+    columnar_addr(row->da, rec, &rec->key.da);
+    row->pr = rec->key.prot;
+    if (rec->key.prot == 6 || rec->key.prot == 17) {
+        row->sp = rec->key.sp;
+        row->dp = rec->key.dp;
+    }
+    row->bytes_out = rec->ob;
+    row->pkts_out = rec->np;
+    if (rec->twin != NULL) {
+        row->bytes_in = rec->twin->ob;
+        row->pkts_in = rec->twin->np;
+    }
+    row->time_start = columnar_usec(&ts_start);
+    row->time_end = columnar_usec(&ts_end);
+
+    /* packet lengths and times, merged as in the "packets" array */
+    splt = flow_record_splt(rec);
+    imax = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
+    if (rec->twin == NULL) {
+        for (i = 0; i < imax; i++) {
+            joy_timer_series_get(&splt->start, splt->pkt_time, i, &ts_i);
+            if (i > 0) {
+                joy_timer_sub(&ts_i, &ts_last, &ts);
             } else {
-                zprintf(f, "\"first_window_size\":%u", rec->tcp.first_window_size);
-                com = 1;
+                joy_timer_clear(&ts);
+            }
+            ts_last = ts_i;
+            row->pkt_len[n] = splt->pkt_len[i];
+            row->pkt_dir[n] = 0;
+            row->pkt_ipt[n] = joy_timeval_to_milliseconds(ts);
+            n++;
+        }
+    } else {
+        twin_splt = flow_record_splt(rec->twin);
+        jmax = rec->twin->op > glb_config->num_pkts ? glb_config->num_pkts : rec->twin->op;
+        i = j = 0;
+        ts_last = ts_start;
+        while ((i < imax || j < jmax) && n < COLUMNAR_MAX_PKTS) {
+            if (i < imax) {
+                joy_timer_series_get(&splt->start, splt->pkt_time, i, &ts_i);
+            }
+            if (j < jmax) {
+                joy_timer_series_get(&twin_splt->start, twin_splt->pkt_time, j, &ts_j);
             }
+            if (i < imax && (j >= jmax || joy_timer_lt(&ts_i, &ts_j))) {
+                ts = ts_i;
+                row->pkt_len[n] = splt->pkt_len[i++];
+                row->pkt_dir[n] = 1;
+            } else {
+                ts = ts_j;
+                row->pkt_len[n] = twin_splt->pkt_len[j++];
+                row->pkt_dir[n] = 0;
+            }
+            joy_timer_sub(&ts, &ts_last, &ts_tmp);
+            row->pkt_ipt[n] = joy_timeval_to_milliseconds(ts_tmp);
+            ts_last = ts;
+            n++;
+        }
+    }
+    row->num_pkts = n;
+
+    if (glb_config->byte_distribution) {
+        bd = flow_record_bd(rec);
+        for (i = 0; i < 256; i++) {
+            row->byte_dist[i] = bd->byte_count[i];
+        }
+        if (rec->twin != NULL) {
+            bd = flow_record_bd(rec->twin);
+            for (i = 0; i < 256; i++) {
+                row->byte_dist[i] += bd->byte_count[i];
+            }
+        }
+        row->num_byte_dist = 256;
+    }
+
+    /* offered and selected ciphersuites, taken as tls_print_json() does */
+    if (rec->tls != NULL && rec->tls->version) {
+        const tls_t *twin = rec->twin ? rec->twin->tls : NULL;
+
+        if (twin != NULL && !twin->version) {
+            twin = NULL;
+        }
+        if (rec->tls->role == role_client || rec->tls->role == role_flow_data) {
+            client = rec->tls;
+            server = twin;
+        } else {
+            client = twin;
+            server = rec->tls;
+        }
+    }
+    if (client != NULL) {
+        row->num_cs = client->num_ciphersuites > COLUMNAR_MAX_CS ? COLUMNAR_MAX_CS : client->num_ciphersuites;
+        for (i = 0; i < row->num_cs; i++) {
+            row->cs[i] = client->ciphersuites[i];
+        }
+    }
+    if (server != NULL && server->num_ciphersuites == 1) {
+        row->scs = server->ciphersuites[0];
+    }
+}
+
+/**
+ * \brief Add a flow record to the columnar export of the context.
+ *
+ * The columnar file is opened with the first record, as F, or as
+ * F.ctxN when there are several contexts, and it is appended to.
+ *
+ * \param ctx Context of the record
+ * \param record Flow record
+ *
+ * \return none
+ */
+static void flow_record_columnar_export (joy_ctx_data *ctx, const flow_record_t *record) {
+    columnar_row_t row;
+
+    if (ctx->columnar == NULL) {
+        char fname[MAX_FILENAME_LEN];
+
+        if (ctx->columnar_failed) {
+            return;
+        }
+        if (joy_get_num_contexts() > 1) {
+            snprintf(fname, MAX_FILENAME_LEN, "%s.ctx%u", glb_config->columnar, ctx->ctx_id);
+        } else {
+            snprintf(fname, MAX_FILENAME_LEN, "%s", glb_config->columnar);
         }
+        ctx->columnar = columnar_open(fname, glb_config->chunk_rows);
+        if (ctx->columnar == NULL) {
+            ctx->columnar_failed = 1;
+            return;
+        }
+    }
+
+    flow_record_columnar_row(record, &row);
+    columnar_add(ctx->columnar, &row);
+}
+
+/**
+ * \brief Install the callback that is handed a view of each expired
+ *        flow, just before the flow is deleted.
+ *
+ * The callback runs in the thread that processes the context of the
+ * flow, so it is installed before any packets are processed, and has
+ * to be safe to call from several threads at once when there are
+ * several contexts.
+ *
+ * \param fn The callback, or NULL to remove it
+ * \param arg Passed on to the callback
+ * \param write_output 0 to skip formatting and writing the flow records
+ *        to the output while there is a callback
+ *
+ * \return none
+ */
+void flow_record_set_export (flow_export_fn *fn, void *arg, unsigned int write_output) {
+    flow_export = fn;
+    flow_export_arg = arg;
+    flow_export_output = (fn == NULL || write_output);
+}
+
+/**
+ * \brief Parse the TLS handshake data still buffered in both sides of
+ *        a flow record, which the JSON output does as it goes.
+ *
+ * \param record Flow record
+ *
+ * \return none
+ */
+static void flow_record_complete_tls (flow_record_t *record) {
+    tls_complete_handshake(record->tls);
+    if (record->twin != NULL) {
+        tls_complete_handshake(record->twin->tls);
+    }
+}
+
+/**
+ * \brief Fill in one side of a flow view.
+ *
+ * \param view Flow view
+ * \param side FLOW_VIEW_OUT or FLOW_VIEW_IN
+ * \param rec Flow record of that side
+ *
+ * \return none
+ */
+static void flow_record_view_side (flow_view_t *view, unsigned int side, const flow_record_t *rec) {
+    const flow_splt_t *splt = flow_record_splt(rec);
+
+    view->bytes[side] = rec->ob;
+    view->num_pkts[side] = rec->np;
+    view->num_pkt_len[side] = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
+    view->pkt_len[side] = splt->pkt_len;
+    view->pkt_time_start[side] = splt->start;
+    view->pkt_time[side] = splt->pkt_time;
+    if (glb_config->byte_distribution) {
+        view->byte_count[side] = flow_record_bd(rec)->byte_count;
+    }
+    view->rec[side] = rec;
+
+    MAP(set_view_feature, feature_list)
+}
+
+/**
+ * \brief Hand a flow record to the flow export callback.
+ *
+ * \param ctx Context of the record
+ * \param record Flow record, and its twin if it has one
+ *
+ * \return none
+ */
+static void flow_record_export_view (joy_ctx_data *ctx, flow_record_t *record) {
+    flow_view_t view;
+    const flow_record_t *rec = NULL;
+
+    flow_record_complete_tls(record);
+
+    memset_s(&view, sizeof(flow_view_t), 0x00, sizeof(flow_view_t));
+    view.version = FLOW_VIEW_VERSION;
+    view.ctx_id = ctx->ctx_id;
+    rec = flow_record_orient(record, &view.start, &view.end);
+    view.key = rec->key;
+    view.ip_type = rec->ip_type;
+    view.exp_type = record->exp_type;
+    flow_record_view_side(&view, FLOW_VIEW_OUT, rec);
+    if (rec->twin != NULL) {
+        flow_record_view_side(&view, FLOW_VIEW_IN, rec->twin);
+    }
+
+    flow_export(&view, flow_export_arg);
+}
+
+/**
+ * \brief Print a flow record to output and delete.
+ *
+ * After printing the flow \p record, it will first be removed
+ * from the chrono list and then deleted. If there is a flow export
+ * callback, or IPFIX export is enabled, the record is handed to it
+ * before deletion.
+ *
+ * \param record Flow record to print and delete 
+ *
+ * \return none
+ */
+static void flow_record_print_and_delete (joy_ctx_data *ctx, flow_record_t *record) {
+    /*
+     * Print the record to JSON output, unless the export callback
+     * takes its place
+     */
+    if (flow_export_output) {
+        flow_record_print_json(ctx, record);
+    } else {
+        flocap_stats_incr_records_output(ctx);
+        flow_record_complete_tls(record);
+    }
+
+    /*
+     * Add it to the columnar export, if there is one; this comes
+     * after the JSON output, which completes the parsing of the TLS
+     * handshake
+     */
+    if (glb_config->columnar) {
+        flow_record_columnar_export(ctx, record);
+    }
+
+    /*
+     * Hand it to the export callback, if there is one
+     */
+    if (flow_export != NULL) {
+        flow_record_export_view(ctx, record);
+    }
 
-        if (rec->tcp.opt_len) {
-            if (com) {
-                zprintf(f, ",\"opt_len\":%u", rec->tcp.opt_len);
-            } else {
-                zprintf(f, "\"opt_len\":%u", rec->tcp.opt_len);
-            }
-            tcp_opt_print_json(f, rec->tcp.opts, rec->tcp.opt_len);
-        }
+    /*
+     * Export this record before deletion if running in
+     * IPFIX exporter mode.
+     */
+    if (glb_config->ipfix_export_port) {
+        ipfix_export_main(ctx, record);
+    }
+    /*
+     * Delete twin, if there is one
+     */
+    if (record->twin != NULL) {
+        joy_log_debug("LIST deleting twin\n");
+        flow_record_delete(ctx, record->twin);
+    }
 
-        /* End out object */
-        zprintf(f, "}");
+    /* Remove record from chrono list, then delete from the flow table */
+    flow_record_chrono_list_remove(ctx, record);
+    flow_record_delete(ctx, record);
+}
+
+/**
+ * \brief Export a flow_record over IPFIX, and to the flow export
+ *        callback if there is one, then delete it and its twin.
+ * \param ctx The context that owns the record
+ * \param record The flow_record, which is on the chronological list
+ * \return none
+ */
+static void flow_record_export_and_delete (joy_ctx_data *ctx, flow_record_t *record) {
+    /*
+     * Hand it to the export callback, if there is one
+     */
+    if (flow_export != NULL) {
+        flow_record_export_view(ctx, record);
     }
 
-    if (!in_empty) {
-        char in_flags_string[9] = {0};
-        com = 0;
+    /*
+     * Export this record before deletion if running in
+     * IPFIX exporter mode.
+     */
+    if (glb_config->ipfix_export_port) {
+        ipfix_export_main(ctx,record);
+    }
 
-        if (top_com) {
-            zprintf(f, ",\"in\":{");
-        } else {
-            zprintf(f, "\"in\":{");
-        }
+    /*
+     * Delete twin, if there is one
+     */
+    if (record->twin != NULL) {
+        joy_log_debug("LIST deleting twin\n");
+        flow_record_delete(ctx, record->twin);
+    }
 
-        if (rec->twin->tcp.flags) {
-            tcp_flags_to_string(rec->twin->tcp.flags, in_flags_string);
-            zprintf(f, "\"flags\":\"%s\"", in_flags_string);
-            com = 1;
-        }
+    /* Remove record from chrono list, then delete from the flow table */
+    flow_record_chrono_list_remove(ctx, record);
+    flow_record_delete(ctx, record);
+}
 
-        if (rec->twin->tcp.first_window_size) {
-            if (com) {
-                zprintf(f, ",\"first_window_size\":%u", rec->twin->tcp.first_window_size);
-            } else {
-                zprintf(f, "\"first_window_size\":%u", rec->twin->tcp.first_window_size);
-                com = 1;
-            }
-        }
+/**
+ * \brief Does IPFix sending of flow record data.
+ *
+ * \param export_all Flag whether to indiscriminately print all flow_records.
+ *                  JOY_EXPIRED_FLOWS - perform expiration check
+ *                  JOY_ALL_FLOWS - print all of them
+ *
+ * \return none
+ */
+void flow_record_export_as_ipfix (joy_ctx_data *ctx, unsigned int export_type) {
+    flow_record_t *record = NULL;
+    flow_record_t *next_record = NULL;
 
-        if (rec->twin->tcp.opt_len) {
-            if (com) {
-                zprintf(f, ",\"opt_len\":%u", rec->twin->tcp.opt_len);
+    if (export_type == JOY_EXPIRED_FLOWS) {
+        /* only the records that are due can have expired */
+        flow_timer_sweep(ctx);
+        record = ctx->flow_timer.expired;
+        while (record != NULL) {
+            next_record = record->timer_next;
+            if (flow_record_is_expired(ctx, record)) {
+                flocap_stats_incr_flows_expired(ctx);
+                flow_record_export_and_delete(ctx, record);
             } else {
-                zprintf(f, "\"opt_len\":%u", rec->twin->tcp.opt_len);
+                /* saw more packets after it was queued as expired */
+                flow_timer_schedule(ctx, record, flow_record_deadline(record));
             }
-            tcp_opt_print_json(f, rec->twin->tcp.opts, rec->twin->tcp.opt_len);
+            record = next_record;
         }
-
-        /* End in object */
-        zprintf(f, "}");
+        return;
     }
 
-    /* End tcp object */
-    zprintf(f, "}");
-}
+    /* The head of chrono record list */
+    record = ctx->flow_record_chrono_first;
 
-static void print_ip_json (zfile f, const flow_record_t *rec) {
-    int k = 0;
+    while (record != NULL) {
+        /* setup next record */
+        next_record = record->time_next;
 
-    zprintf(f, ",\"ip\":{");
+        flow_record_export_and_delete(ctx, record);
 
-    zprintf(f, "\"out\":{");
-    zprintf(f, "\"ttl\":%u", rec->ip.ttl);
-    if (rec->ip.num_id) {
-        zprintf(f, ",\"id\":[");
-        for (k = 0; k < rec->ip.num_id - 1; k++) {
-            zprintf(f, "%u,", rec->ip.id[k]);
-        }
-        zprintf(f, "%u]", rec->ip.id[k]);
+        /* Advance to next record on chrono list */
+        record = next_record;
     }
-    /* End out object */
-    zprintf(f, "}");
+}
 
-    if (rec->twin) {
-        zprintf(f, ",\"in\":{");
-        zprintf(f, "\"ttl\":%u", rec->twin->ip.ttl);
-        if (rec->twin->ip.num_id) {
-            zprintf(f, ",\"id\":[");
-            for (k = 0; k < rec->twin->ip.num_id - 1; k++) {
-                zprintf(f, "%u,", rec->twin->ip.id[k]);
-            }
-            zprintf(f, "%u]", rec->twin->ip.id[k]);
+/**
+ * \brief Prints out at most \p max of the expired flow records.
+ *
+ * The records past \p max stay on the expired list of the timer wheel,
+ * in order, and are the first to be printed by the next call.  This
+ * bounds the time one call can take when many flows expire at once.
+ *
+ * \param ctx The context to print the expired flows of
+ * \param max Most records to print, or 0 for no limit
+ *
+ * \return Number of expired records still waiting to be printed
+ */
+unsigned int flow_record_list_print_expired (joy_ctx_data *ctx, unsigned int max) {
+    flow_record_t *record = NULL;
+    flow_record_t *next_record = NULL;
+    unsigned int num_printed = 0;
+
+    /* only the records that are due can have expired */
+    flow_timer_sweep(ctx);
+    record = ctx->flow_timer.expired;
+    while (record != NULL && (max == 0 || num_printed < max)) {
+        next_record = record->timer_next;
+        if (flow_record_is_expired(ctx, record)) {
+            flocap_stats_incr_flows_expired(ctx);
+            flow_record_print_and_delete(ctx, record);
+            num_printed++;
+        } else {
+            /* saw more packets after it was queued as expired */
+            flow_timer_schedule(ctx, record, flow_record_deadline(record));
         }
-        /* End in object */
-        zprintf(f, "}");
+        record = next_record;
     }
-
-    /* End IP object */
-    zprintf(f, "}");
+    return ctx->flow_timer.num_expired;
 }
 
-static const flow_record_t *tcp_client_flow(const flow_record_t *a,
-                                                 const flow_record_t *b) {
-    if (!a->tcp.flags && !b->tcp.flags) {
-        /* No flags to compare */
-        return NULL;
-    }
+/**
+ * \brief Prints out the flow record list in JSON format.
+ *
+ * \param export_all Flag whether to indiscriminately print all flow_records.
+ *                  JOY_EXPIRED_FLOWS - perform expiration check
+ *                  JOY_ALL_FLOWS - print all of them
+ *
+ * \return none
+ */
+void flow_record_list_print_json (joy_ctx_data *ctx, unsigned int print_type) {
+    flow_record_t *record = NULL;
+    flow_record_t *next_record = NULL;
 
-    if (a->tcp.flags == 2 && b->tcp.flags == 2) {
-        /* Cannot determine, both have SYN */
-        return NULL;
+    if (print_type == JOY_EXPIRED_FLOWS) {
+        flow_record_list_print_expired(ctx, 0);
+        return;
     }
 
-    /* SYN */
-    if (a->tcp.flags == 2) {
-        return a;
-    } else if (b->tcp.flags == 2) {
-        return b;
-    }
+    /* The head of chrono record list */
+    record = ctx->flow_record_chrono_first;
 
-    if (a->tcp.flags == 18 && b->tcp.flags == 18) {
-        /* Cannot determine, both have SYN/ACK */
-        return NULL;
-    }
+    while (record != NULL) {
+        /* setup next record */
+        next_record = record->time_next;
 
-    /*
-     * SYN/ACK
-     * If detected, then return the twin.
-     */
-    if (a->tcp.flags == 18) {
-        return b;
-    } else if (b->tcp.flags == 18) {
-        return a;
+        /* print and remove the record */
+        flow_record_print_and_delete(ctx, record);
+
+        /* Advance to next record on chrono list */
+        record = next_record;
     }
 
-    return NULL;
+    // note: we might need to call flush in the future
+    // zflush(ctx->output);
 }
 
-static const flow_record_t *get_client_flow(const flow_record_t *a,
-                                                 const flow_record_t *b) {
-    /* See if either is client */
-    if (a->dir == DIR_CLIENT) {
-        return a;
-    } else if (b->dir == DIR_CLIENT) {
-        return b;
-    }
-
-    /* See if either is server, then the twin is client */
-    if (a->dir == DIR_SERVER) {
-        return b;
-    } else if (b->dir == DIR_SERVER) {
-        return a;
+/**
+ * \brief Removes the record and its twin from the list and the flow records
+ *     structure.
+ *
+ * \param ctx - the joy context to process with
+ * \param rec - the rec we are deleting
+ *
+ * \return none.
+ */
+void remove_record_and_update_list(joy_ctx_data *ctx, flow_record_t *rec)
+{
+    /* Delete twin, if there is one */
+    if (rec->twin != NULL) {
+        flow_record_delete(ctx, rec->twin);
     }
 
-    /*
-     * Try identifying by tcp flags.
-     */
-    return tcp_client_flow(a, b);
+    /* Remove from chrono list, then delete from the flow table */
+    flow_record_chrono_list_remove(ctx, rec);
+    flow_record_delete(ctx, rec);
 }
 
-#define OUT "<"
-#define IN  ">"
 
 /**
- * \brief Print a flow record to the JSON output.
+ * \brief Get the twin of a flow_key.
  *
- * \param record Flow record to print
+ * \param ctx Joy context to use for the lookup
+ * \param key flow_key that we will try to find it's twin
+ * \param key_hash hash of \p key
  *
- * \return none
+ * \return The twin flow_key, or NULL
  */
-static void flow_record_print_json
- (joy_ctx_data *ctx, const flow_record_t *record) {
-    unsigned int i, j, imax, jmax;
-    struct timeval ts, ts_last, ts_start, ts_end, ts_tmp;
-    const flow_record_t *rec = NULL;
-    unsigned int pkt_len;
-    const char *dir;
-    char ipv4_addr[INET_ADDRSTRLEN];
-    char ipv6_addr[INET6_ADDRSTRLEN];
+flow_record_t *flow_key_get_twin (joy_ctx_data *ctx,
+                                  const flow_key_t *key,
+                                  unsigned int key_hash) {
 
-    flocap_stats_incr_records_output(ctx);
-    ctx->records_in_file++;
+    if (glb_config->flow_key_match_method == EXACT_MATCH) {
+        flow_key_t twin;
 
-    if (record->twin != NULL) {
         /*
-         * The flow is bidirectional.
-         * Need to figure client/server order.
-         * try to determine directionality
+         * twins are only looked up when tracking bidirectional flows, and
+         * then flow_key_hash() is symmetric, so the twin has the same hash
+         * value as key. we use flow_key_is_eq because we are searching
+         * based on the entire key.
          */
-        rec = get_client_flow(record, record->twin);
-        if (rec != NULL) {
-            ts_start = rec->start;
-            ts_end = record->end;
-        } else {
-            /*
-             * Get start time.
-             * Use the smaller of the 2 time values.
-             */
-            if (joy_timer_lt(&record->start, &record->twin->start)) {
-                ts_start = record->start;
-                rec = record;
-            } else {
-                ts_start = record->twin->start;
-                rec = record->twin;
-            }
+        memset_s(&twin, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+        memcpy_s(&twin.sa.v6_sa, sizeof(struct in6_addr), &key->da.v6_da, sizeof(struct in6_addr));
+        memcpy_s(&twin.da.v6_da, sizeof(struct in6_addr), &key->sa.v6_sa, sizeof(struct in6_addr));
+        twin.sp = key->dp;
+        twin.dp = key->sp;
+        twin.prot = key->prot;
+        return flow_table_find(ctx, key_hash, &twin, flow_key_is_eq);
 
-            /*
-             * Get end time.
-             * Use the larger of the 2 time values.
-             */
-            if (joy_timer_lt(&record->end, &record->twin->end)) {
-                ts_end = record->twin->end;
-            } else {
-                ts_end = record->end;
-            }
-        }
     } else {
         /*
-         * The flow is unidirectional. Easy enough.
+         * we use the passed in key_hash because in NEAR_MATCH cases, the addresses are omitted
+         * from the hash calculation. Therefore, the record and twin will have the same hash.
+         * we use flow_key_is_twin because we need to at least match one address in the records
+         * to have a good chance at determining this is the NAT'd twin.
          */
-        ts_start = record->start;
-        ts_end = record->end;
-        rec = record;
+        return flow_table_find(ctx, key_hash, key, flow_key_is_twin);
     }
+}
 
-    /*****************************************************************
-     * ---------------------------------------------------------------
-     * Flow Record object start
-     * ---------------------------------------------------------------
-     *****************************************************************
-     */
-    zprintf(ctx->output, "{");
+/* number of records used by the flow table unit test */
+#define P2F_TEST_NUM_RECORDS 2048
 
-    if (rec->ip_type == ETH_TYPE_IPV6) {
-        inet_ntop(AF_INET6, &rec->key.sa.v6_sa, ipv6_addr, INET6_ADDRSTRLEN);
-        zprintf(ctx->output, "\"sa\":\"%s\",", ipv6_addr);
-        inet_ntop(AF_INET6, &rec->key.da.v6_da, ipv6_addr, INET6_ADDRSTRLEN);
-        zprintf(ctx->output, "\"da\":\"%s\",", ipv6_addr);
-    } else {
-        char buffer[IPV4_ANON_LEN];
-        if (ipv4_addr_needs_anonymization(&rec->key.sa.v4_sa)) {
-            addr_get_anon_hexstring(&rec->key.sa.v4_sa, (char*)&buffer, IPV4_ANON_LEN);
-            zprintf(ctx->output, "\"sa\":\"%s\",", buffer);
+/**
+ * \brief Unit test for the flow table functionality.
+ *
+ * Inserts enough records into a minimum size table to force several
+ * incremental resizes and then removes them again, exercising the
+ * migration of old slots and backward shift deletion.
+ *
+ * \param none
+ *
+ * \return Number of failures
+ */
+static int p2f_test_flow_table(joy_ctx_data *ctx) {
+    flow_record_t *recs = NULL;
+    flow_record_t *rp;
+    flow_key_t key;
+    unsigned int i;
+    int num_fails = 0;
+
+    recs = calloc(P2F_TEST_NUM_RECORDS, sizeof(flow_record_t));
+    if (recs == NULL) {
+        joy_log_err("out of memory");
+        return 1;
+    }
+
+    if (flow_table_alloc(&ctx->flow_table, FLOW_TABLE_MIN_SIZE) != ok) {
+        free(recs);
+        return 1;
+    }
+
+    for (i = 0; i < P2F_TEST_NUM_RECORDS; i++) {
+        memset_s(&key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+        key.sa.v4_sa.s_addr = i;
+        if (i & 1) {
+            /* constant address sum, adversarial for an additive hash */
+            key.da.v4_da.s_addr = 0x0a000000 - i;
+            key.sp = 443;
         } else {
-            inet_ntop(AF_INET, &rec->key.sa.v4_sa, ipv4_addr, INET_ADDRSTRLEN);
-            zprintf(ctx->output, "\"sa\":\"%s\",", ipv4_addr);
+            key.da.v4_da.s_addr = 0x0a000000;
+            key.sp = (uint16_t)i;
         }
-        if (ipv4_addr_needs_anonymization(&rec->key.da.v4_da)) {
-            addr_get_anon_hexstring(&rec->key.da.v4_da, (char*)&buffer, IPV4_ANON_LEN);
-            zprintf(ctx->output, "\"da\":\"%s\",", buffer);
-        } else {
-            inet_ntop(AF_INET, &rec->key.da.v4_da, ipv4_addr, INET_ADDRSTRLEN);
-            zprintf(ctx->output, "\"da\":\"%s\",", ipv4_addr);
+        key.dp = 80;
+        key.prot = 6;
+
+        flow_record_init(ctx, &recs[i], &key);
+        recs[i].key_hash = flow_key_hash(&key);
+        if (flow_table_insert(ctx, recs[i].key_hash, &recs[i]) != ok) {
+            joy_log_err("could not insert record %u", i);
+            num_fails++;
         }
     }
-    zprintf(ctx->output, "\"pr\":%u,", rec->key.prot);
 
-    if (rec->key.prot == 6 || rec->key.prot == 17) {
-        zprintf(ctx->output, "\"sp\":%u,", rec->key.sp);
-        zprintf(ctx->output, "\"dp\":%u,", rec->key.dp);
-    } else {
-        /* Make dp/sp null so that they can still be compared */
-        zprintf(ctx->output, "\"sp\":null,");
-        zprintf(ctx->output, "\"dp\":null,");
+    if (ctx->stats.num_table_resizes == 0) {
+        joy_log_err("flow table did not grow");
+        num_fails++;
     }
 
-    /*
-     * if src or dst address matches a subnets associated with labels,
-     * then print out those labels
-     */
-    if (glb_config->num_subnets) {
-        attr_flags flag;
-
-        if (rec->ip_type == ETH_TYPE_IP) {
-            flag = radix_trie_lookup_addr(glb_config->rt, rec->key.sa.v4_sa);
-            attr_flags_json_print_labels(glb_config->rt, flag, "sa_labels", ctx->output);
-            flag = radix_trie_lookup_addr(glb_config->rt, rec->key.da.v4_da);
-            attr_flags_json_print_labels(glb_config->rt, flag, "da_labels", ctx->output);
+    for (i = 0; i < P2F_TEST_NUM_RECORDS; i++) {
+        rp = flow_table_find(ctx, recs[i].key_hash, &recs[i].key, flow_key_is_eq);
+        if (rp != &recs[i]) {
+            joy_log_err("did not find record %u", i);
+            num_fails++;
         }
     }
 
-    /*
-     * Flow stats
-     */
-    zprintf(ctx->output, "\"bytes_out\":%u,", rec->ob);
-    zprintf(ctx->output, "\"num_pkts_out\":%u,", rec->np); /* not just packets with data */
-    if (rec->twin != NULL) {
-        zprintf(ctx->output, "\"bytes_in\":%u,", rec->twin->ob);
-        zprintf(ctx->output, "\"num_pkts_in\":%u,", rec->twin->np);
+    /* remove every other record, then make sure the rest are still found */
+    for (i = 0; i < P2F_TEST_NUM_RECORDS; i += 2) {
+        if (flow_table_remove(&ctx->flow_table, &recs[i]) != 0) {
+            joy_log_err("could not remove record %u", i);
+            num_fails++;
+        }
     }
-#ifdef WIN32
-        zprintf(ctx->output, "\"time_start\":%i.%06i,", ts_start.tv_sec, ts_start.tv_usec);
-        zprintf(ctx->output, "\"time_end\":%i.%06i,", ts_end.tv_sec, ts_end.tv_usec);
-#else
-    zprintf(ctx->output, "\"time_start\":%zd.%06zd,", ts_start.tv_sec, (long)ts_start.tv_usec);
-    zprintf(ctx->output, "\"time_end\":%zd.%06zd,", ts_end.tv_sec, (long)ts_end.tv_usec);
-#endif
-
-    /*****************************************************************
-     * Packet length and time array
-     *****************************************************************
-     */
-    zprintf(ctx->output, "\"packets\":[");
-
-    if (rec->twin == NULL) {
-
-        imax = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
-        if (imax == 0) {
-            ; /* no packets had data, so we print out nothing */
-        } else {
-            for (i = 0; i < imax-1; i++) {
-                if (i > 0) {
-                    joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-                } else {
-                    joy_timer_clear(&ts);
-                }
-                print_bytes_dir_time(ctx, rec->pkt_len[i], OUT, ts, ",");
-            }
-            if (i == 0) {        /* TODO this code could be simplified */
-                joy_timer_clear(&ts);
-            } else {
-                joy_timer_sub(&rec->pkt_time[i], &rec->pkt_time[i-1], &ts);
-            }
-            print_bytes_dir_time(ctx, rec->pkt_len[i], OUT, ts, "");
+    for (i = 0; i < P2F_TEST_NUM_RECORDS; i++) {
+        rp = flow_table_find(ctx, recs[i].key_hash, &recs[i].key, flow_key_is_eq);
+        if ((i & 1) && rp != &recs[i]) {
+            joy_log_err("did not find record %u", i);
+            num_fails++;
+        } else if (!(i & 1) && rp != NULL) {
+            joy_log_err("found record %u, but should not have", i);
+            num_fails++;
         }
-        zprintf(ctx->output, "]");
-    } else {
-        imax = rec->op > glb_config->num_pkts ? glb_config->num_pkts : rec->op;
-        jmax = rec->twin->op > glb_config->num_pkts ? glb_config->num_pkts : rec->twin->op;
-        i = j = 0;
-        ts_last = ts_start;
-
-        while ((i < imax) || (j < jmax)) {
-            if (i >= imax) {
-                /* record list is exhausted, so use twin */
-                    dir = OUT;
-                    ts = rec->twin->pkt_time[j];
-                    pkt_len = rec->twin->pkt_len[j];
-                    j++;
-            } else if (j >= jmax) {
-                /* twin list is exhausted, so use record */
-                dir = IN;
-                ts = rec->pkt_time[i];
-                pkt_len = rec->pkt_len[i];
-                i++;
-            } else {
-                /* Neither list is exhausted, so use list with lowest time */
-                if (joy_timer_lt(&rec->pkt_time[i], &rec->twin->pkt_time[j])) {
-                    ts = rec->pkt_time[i];
-                    pkt_len = rec->pkt_len[i];
-                    dir = IN;
-                    if (i < imax) i++;
-                } else {
-                    ts = rec->twin->pkt_time[j];
-                    pkt_len = rec->twin->pkt_len[j];
-                    dir = OUT;
-                    if (j < jmax) j++;
-                }
-            }
-
-            joy_timer_sub(&ts, &ts_last, &ts_tmp);
-            print_bytes_dir_time(ctx, pkt_len, dir, ts_tmp, "");
-            ts_last = ts;
+    }
 
-            if (!((i == imax) & (j == jmax))) {
-                /* Done */
-                zprintf(ctx->output, ",");
-            }
+    for (i = 1; i < P2F_TEST_NUM_RECORDS; i += 2) {
+        if (flow_table_remove(&ctx->flow_table, &recs[i]) != 0) {
+            joy_log_err("could not remove record %u", i);
+            num_fails++;
         }
-        zprintf(ctx->output, "]");
+    }
+    if (ctx->flow_table.count + ctx->flow_table.old_count != 0) {
+        joy_log_err("flow table not empty after removing all records");
+        num_fails++;
     }
 
-    if (glb_config->byte_distribution || glb_config->report_entropy || glb_config->compact_byte_distribution) {
-        const uint32_t *array = NULL;
-        const uint32_t *compact_array = NULL;
-        uint32_t tmp[256];
-        uint32_t compact_tmp[16];
-        unsigned int num_bytes;
-        double mean = 0.0, variance = 0.0;
-
-        /*
-         * Sum up the byte_count array for outbound and inbound flows,
-         * if this flow is bidirectional
-         */
-        if (rec->twin == NULL) {
-            array = rec->byte_count;
-            //compact_array = rec->compact_byte_count; //overwritten below fixme
-            num_bytes = rec->ob;
-
-            for (i=0; i<256; i++) {
-                      tmp[i] = rec->byte_count[i];
-            }
-            for (i=0; i<16; i++) {
-                      compact_tmp[i] = rec->compact_byte_count[i];
-            }
+    flow_table_release(&ctx->flow_table);
+    free(recs);
 
-            if (rec->num_bytes != 0) {
-                mean = rec->bd_mean;
-                variance = rec->bd_variance/(rec->num_bytes - 1);
-                variance = sqrt(variance);
+    return num_fails;
+}
 
-                if (rec->num_bytes == 1) {
-                    variance = 0.0;
-                }
-            }
-        } else {
-            for (i=0; i<256; i++) {
-                      tmp[i] = rec->byte_count[i] + rec->twin->byte_count[i];
-            }
-            for (i=0; i<16; i++) {
-                      compact_tmp[i] = rec->compact_byte_count[i] + rec->twin->compact_byte_count[i];
-            }
-            array = tmp;
-            compact_array = compact_tmp;
-            num_bytes = rec->ob + rec->twin->ob;
+/* number of records in the flow timer unit test */
+#define P2F_TEST_NUM_TIMERS 4096
 
-            if (rec->num_bytes + rec->twin->num_bytes != 0) {
-                mean = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_mean +
-                           ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_mean;
+/* seconds covered by the flow timer unit test */
+#define P2F_TEST_TIMER_SPAN 400000
 
-                    variance = ((double)rec->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->bd_variance +
-                               ((double)rec->twin->num_bytes)/((double)(rec->num_bytes+rec->twin->num_bytes))*rec->twin->bd_variance;
+/**
+ * \brief Unit test for the flow timer wheel.
+ *
+ * Records with deadlines spread over several days are scheduled, and
+ * time is advanced in uneven steps, some within one second and some
+ * across many slots of the upper levels.  After every sweep, each
+ * record must have been put on the expired list exactly once if it
+ * has expired, and not at all otherwise.
+ *
+ * \param ctx The context to use
+ *
+ * \return Number of failures
+ */
+static int p2f_test_flow_timer(joy_ctx_data *ctx) {
+    static const unsigned int step_usec[] = {
+        300000, 1000000, 1400000, 5000000, 63000000, 64000000, 65000000,
+        1000000000, 4095000000U, 4097000000U
+    };
+    flow_record_t *recs = NULL;
+    flow_record_t *rp;
+    unsigned char *seen = NULL;
+    unsigned int i, step = 0, num_expired = 0, num_removed = 0;
+    const time_t base = 1500000000;
+    int num_fails = 0;
 
-                    variance = variance/((double)(rec->num_bytes + rec->twin->num_bytes - 1));
-                    variance = sqrt(variance);
-                    if (rec->num_bytes + rec->twin->num_bytes == 1) {
-                        variance = 0.0;
-                    }
-            }
-        }
+    recs = calloc(P2F_TEST_NUM_TIMERS, sizeof(flow_record_t));
+    seen = calloc(P2F_TEST_NUM_TIMERS, 1);
+    if (recs == NULL || seen == NULL) {
+        free(recs);
+        free(seen);
+        return 1;
+    }
 
-        if (glb_config->byte_distribution) {
-            reduce_bd_bits(tmp, 256);
-            array = tmp;
+    /* a long active timeout puts deadlines in every level of the wheel */
+    flow_record_update_timeouts(10, 100000);
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    ctx->global_time.tv_sec = base;
+    ctx->global_time.tv_usec = 0;
+
+    for (i = 0; i < P2F_TEST_NUM_TIMERS; i++) {
+        recs[i].start.tv_sec = base + (i & 63);
+        recs[i].start.tv_usec = (i & 1) ? 500000 : 0;
+        recs[i].end.tv_sec = recs[i].start.tv_sec + (i * 7919) % 150000;
+        recs[i].end.tv_usec = recs[i].start.tv_usec;
+        flow_timer_schedule(ctx, &recs[i], recs[i].start.tv_sec + 10);
+    }
 
-            zprintf(ctx->output, ",\"byte_dist\":[");
-            for (i = 0; i < 255; i++) {
-                zprintf(ctx->output, "%u,", (unsigned char)array[i]);
-            }
-            zprintf(ctx->output, "%u]", (unsigned char)array[i]);
+    while (ctx->global_time.tv_sec < base + P2F_TEST_TIMER_SPAN) {
+        struct timeval delta;
 
-            /* Output the mean */
-            if (num_bytes != 0) {
-                zprintf(ctx->output, ",\"byte_dist_mean\":%f", mean);
-                zprintf(ctx->output, ",\"byte_dist_std\":%f", variance);
+        delta.tv_sec = step_usec[step % (sizeof(step_usec) / sizeof(step_usec[0]))] / 1000000;
+        delta.tv_usec = step_usec[step % (sizeof(step_usec) / sizeof(step_usec[0]))] % 1000000;
+        ctx->global_time.tv_sec += delta.tv_sec;
+        ctx->global_time.tv_usec += delta.tv_usec;
+        if (ctx->global_time.tv_usec >= 1000000) {
+            ctx->global_time.tv_sec++;
+            ctx->global_time.tv_usec -= 1000000;
+        }
+        step++;
+
+        /* records can also leave the wheel without expiring */
+        if (step == 3) {
+            for (i = 0; i < P2F_TEST_NUM_TIMERS; i += 101) {
+                if (recs[i].timer_pprev != NULL) {
+                    flow_timer_unlink(&ctx->flow_timer, &recs[i]);
+                    seen[i] = 2;
+                    num_removed++;
+                }
             }
-
         }
 
-        if (glb_config->compact_byte_distribution) {
-            reduce_bd_bits(compact_tmp, 16);
-            compact_array = compact_tmp;
-
-            zprintf(ctx->output, ",\"compact_byte_dist\":[");
-            for (i = 0; i < 15; i++) {
-                zprintf(ctx->output, "%u,", (unsigned char)compact_array[i]);
+        flow_timer_sweep(ctx);
+        while ((rp = ctx->flow_timer.expired) != NULL) {
+            flow_timer_unlink(&ctx->flow_timer, rp);
+            i = rp - recs;
+            if (seen[i]) {
+                joy_log_err("record %u returned after it left the wheel", i);
+                num_fails++;
             }
-            zprintf(ctx->output, "%u]", (unsigned char)compact_array[i]);
+            seen[i] = 1;
+            num_expired++;
         }
 
-        if (glb_config->report_entropy) {
-            if (num_bytes != 0) {
-                double entropy = flow_record_get_byte_count_entropy(array, num_bytes);
-
-                zprintf(ctx->output, ",\"entropy\":%f", entropy);
-                zprintf(ctx->output, ",\"total_entropy\":%f", entropy * num_bytes);
+        for (i = 0; i < P2F_TEST_NUM_TIMERS; i++) {
+            if (!seen[i] && flow_record_is_expired(ctx, &recs[i])) {
+                joy_log_err("record %u expired at %ld.%06ld but was not returned",
+                            i, (long)ctx->global_time.tv_sec, (long)ctx->global_time.tv_usec);
+                seen[i] = 1;
+                num_fails++;
             }
         }
     }
 
-    /*
-     * Inline classification of flows
-     */
-    if (glb_config->include_classifier) {
-        float score = 0.0;
-
-        if (rec->twin) {
-            score = classify(rec->pkt_len, rec->pkt_time, rec->twin->pkt_len, rec->twin->pkt_time,
-                                     rec->start, rec->twin->start,
-                                     glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, rec->twin->np, rec->op, rec->twin->op,
-                                     rec->ob, rec->twin->ob, glb_config->byte_distribution,
-                                     rec->byte_count, rec->twin->byte_count);
-            ((flow_record_t*)rec)->twin->classify_value = score;
-        } else {
-            score = classify(rec->pkt_len, rec->pkt_time, NULL, NULL,   rec->start, rec->start,
-                                     glb_config->num_pkts, rec->key.sp, rec->key.dp, rec->np, 0, rec->op, 0,
-                                     rec->ob, 0, glb_config->byte_distribution,
-                                     rec->byte_count, NULL);
-            ((flow_record_t*)rec)->classify_value = score;
-        }
-
-        zprintf(ctx->output, ",\"p_malware\":%f", score);
+    if (num_expired + num_removed != P2F_TEST_NUM_TIMERS || ctx->flow_timer.count != 0
+        || ctx->flow_timer.num_expired != 0) {
+        joy_log_err("%u records expired and %u removed, %u left in the wheel",
+                    num_expired, num_removed, ctx->flow_timer.count);
+        num_fails++;
     }
 
-    /* IP object */
-    print_ip_json(ctx->output, rec);
-
-    if (rec->key.prot == 6) {
-        /* TCP object */
-        print_tcp_json(ctx->output, rec);
-    }
+    flow_record_update_timeouts(0, 0);
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    free(recs);
+    free(seen);
+    return num_fails;
+}
 
-    /*
-     * All of the feature modules
-     */
-    print_all_features(feature_list);
+/* number of records in the flow queue unit test */
+#define P2F_TEST_NUM_QUEUED 8
 
-    /*
-     * Host executable
-     */
-    print_executable_json(ctx->output, rec);
+/**
+ * \brief Unit test for the flow queues.
+ *
+ * A queue is filled from the chronological list when it is first
+ * prepared, records are pushed as they become ready, and expired
+ * records are added by the timer wheel.
+ *
+ * \param ctx The context to use
+ *
+ * \return Number of failures
+ */
+static int p2f_test_flow_queue(joy_ctx_data *ctx) {
+    flow_record_t recs[P2F_TEST_NUM_QUEUED];
+    flow_record_t *rp;
+    unsigned int i;
+    int num_fails = 0;
 
-    if (glb_config->report_hd) {
-        /*
-         * TODO: this should be bidirectional, but it is not!  This will
-         * be changed sometime soon, but for now, this will give some
-         * experience with this type of data
-         */
-        header_description_printf(&rec->hd, ctx->output, glb_config->report_hd);
-    }
+    memset_s(recs, sizeof(recs), 0x00, sizeof(recs));
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    ctx->flow_record_chrono_first = ctx->flow_record_chrono_last = NULL;
+    ctx->global_time.tv_sec = 1000;
+    ctx->global_time.tv_usec = 0;
 
-    /*
-     * Operating system
-     */
-    if (include_os) {
-        if (rec->twin) {
-            os_printf(ctx->output, rec->ip.ttl, rec->tcp.first_window_size, rec->twin->ip.ttl, rec->twin->tcp.first_window_size);
-        } else {
-            os_printf(ctx->output, rec->ip.ttl, rec->tcp.first_window_size, 0, 0);
-        }
+    for (i = 0; i < P2F_TEST_NUM_QUEUED; i++) {
+        recs[i].start = recs[i].end = ctx->global_time;
+        recs[i].op = i;
+        flow_record_chrono_list_append(ctx, &recs[i]);
     }
 
-    /*
-     * Initial data packet (IDP)
-     */
-    if (glb_config->idp) {
-        if (rec->idp != NULL) {
-            zprintf(ctx->output, ",\"idp_out\":");
-            zprintf_raw_as_hex(ctx->output, rec->idp, rec->idp_len);
-            zprintf(ctx->output, ",\"idp_len_out\":%u", rec->idp_len);
-        }
-        if (rec->twin && (rec->twin->idp != NULL)) {
-            zprintf(ctx->output, ",\"idp_in\":");
-            zprintf_raw_as_hex(ctx->output, rec->twin->idp, rec->twin->idp_len);
-            zprintf(ctx->output, ",\"idp_len_in\":%u", rec->twin->idp_len);
-        }
+    /* the first call picks up the records that are already ready, in order */
+    flow_queue_prepare(ctx, FLOW_QUEUE_SPLT, 4);
+    if (ctx->flow_queue[FLOW_QUEUE_SPLT].count != 4) {
+        joy_log_err("%u records queued, expected 4", ctx->flow_queue[FLOW_QUEUE_SPLT].count);
+        num_fails++;
     }
-
-    {
-        unsigned int retrans, invalid;
-
-        retrans = rec->tcp.retrans;
-        invalid = rec->invalid;
-        if (rec->twin) {
-            retrans += rec->twin->tcp.retrans;
-            invalid += rec->twin->invalid;
-        }
-
-        if (retrans || invalid) {
-            uint8_t comma = 0;
-            zprintf(ctx->output, ",\"debug\":{");
-            if (retrans) {
-                zprintf(ctx->output, "\"tcp_retrans\":%u", retrans);
-                comma = 1;
-            }
-            if (invalid) {
-                if (comma) {
-                    zprintf(ctx->output, ",\"invalid\":%u", invalid);
-                } else {
-                    zprintf(ctx->output, "\"invalid\":%u", invalid);
-                }
-            }
-            zprintf(ctx->output, "}");
+    for (i = 4; (rp = flow_queue_pop(ctx, FLOW_QUEUE_SPLT)) != NULL; i++) {
+        if (rp != &recs[i]) {
+            joy_log_err("popped record %ld, expected %u", (long)(rp - recs), i);
+            num_fails++;
         }
+        rp->splt_ext_processed = 1;
+    }
 
+    /* records that become ready are pushed once */
+    recs[2].op = 5;
+    if (!flow_record_is_ready(&recs[2], FLOW_QUEUE_SPLT, 4)) {
+        joy_log_err("record 2 is not ready");
+        num_fails++;
+    }
+    flow_queue_push(ctx, &recs[2], FLOW_QUEUE_SPLT);
+    flow_queue_push(ctx, &recs[2], FLOW_QUEUE_SPLT);
+    flow_queue_prepare(ctx, FLOW_QUEUE_SPLT, 4);
+    if (flow_queue_pop(ctx, FLOW_QUEUE_SPLT) != &recs[2] || flow_queue_pop(ctx, FLOW_QUEUE_SPLT) != NULL) {
+        joy_log_err("record 2 was not queued exactly once");
+        num_fails++;
+    }
+    recs[2].splt_ext_processed = 1;
+
+    /* a new minimum refills the queue, skipping processed records */
+    flow_queue_prepare(ctx, FLOW_QUEUE_SPLT, 1);
+    if (ctx->flow_queue[FLOW_QUEUE_SPLT].count != 2 ||
+        ctx->flow_queue[FLOW_QUEUE_SPLT].first != &recs[1] ||
+        ctx->flow_queue[FLOW_QUEUE_SPLT].last != &recs[3]) {
+        joy_log_err("queue not refilled with records 1 and 3");
+        num_fails++;
     }
 
-    if (rec->exp_type) {
-        zprintf(ctx->output, ",\"expire_type\":\"%c\"", rec->exp_type);
+    /* deleting a record takes it off the queue */
+    flow_queue_remove(ctx, &recs[1], FLOW_QUEUE_SPLT);
+    if (ctx->flow_queue[FLOW_QUEUE_SPLT].first != &recs[3] ||
+        recs[3].queue_link[FLOW_QUEUE_SPLT].prev != NULL || recs[1].queued != 0) {
+        joy_log_err("record 1 not removed from the queue");
+        num_fails++;
+    }
+    recs[1].splt_ext_processed = 1;
+    flow_queue_pop(ctx, FLOW_QUEUE_SPLT);
+    recs[3].splt_ext_processed = 1;
+
+    /* an expired record is queued by the timer wheel */
+    flow_timer_schedule(ctx, &recs[0], flow_record_deadline(&recs[0]));
+    ctx->global_time.tv_sec += time_window.tv_sec + 1;
+    flow_queue_prepare(ctx, FLOW_QUEUE_SPLT, 1);
+    if (flow_queue_pop(ctx, FLOW_QUEUE_SPLT) != &recs[0] ||
+        ctx->flow_timer.expired != &recs[0] || ctx->flow_timer.num_expired != 1) {
+        joy_log_err("expired record 0 was not queued");
+        num_fails++;
+    }
+    flow_timer_unlink(&ctx->flow_timer, &recs[0]);
+    if (ctx->flow_timer.expired != NULL || ctx->flow_timer.expired_tail != &ctx->flow_timer.expired) {
+        joy_log_err("expired list not emptied");
+        num_fails++;
     }
 
-    /*****************************************************************
-     * Flow Record object end
-     *****************************************************************
-     */
-    zprintf(ctx->output, "}\n");
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    ctx->flow_record_chrono_first = ctx->flow_record_chrono_last = NULL;
+    return num_fails;
 }
 
+/* max_flows of the flow eviction unit test */
+#define P2F_TEST_MAX_FLOWS 4
+
+/* what the flow eviction unit test's export callback was handed */
+typedef struct p2f_test_evict_state_ {
+    unsigned int num_exported;
+    unsigned int num_evicted;
+    uint32_t evicted_sa;
+} p2f_test_evict_state_t;
 
+static void p2f_test_evict_export (const flow_view_t *view, void *arg) {
+    p2f_test_evict_state_t *state = arg;
+
+    state->num_exported++;
+    if (view->exp_type == expiration_type_evicted) {
+        state->num_evicted++;
+        state->evicted_sa = view->key.sa.v4_sa.s_addr;
+    }
+}
 
 /**
- * \brief Print a flow record to output and delete.
+ * \brief Unit test for the eviction of flows at max_flows.
  *
- * After printing the flow \p record, it will first be removed
- * from the chrono list and then deleted. If IPFIX export is enabled,
- * the record will be exported before deletion.
+ * The table is filled to max_flows, the first flow sees another
+ * packet, and one more flow arrives: the flow seen least recently,
+ * not the oldest one, must be written out as evicted and deleted, and
+ * the rest must stay in the table.
  *
- * \param record Flow record to print and delete 
+ * \param ctx The context to use
  *
- * \return none
+ * \return Number of failures
  */
-static void flow_record_print_and_delete (joy_ctx_data *ctx, flow_record_t *record) {
-    /*
-     * Print the record to JSON output
-     */
-    flow_record_print_json(ctx, record);
+static int p2f_test_flow_evict(joy_ctx_data *ctx) {
+    p2f_test_evict_state_t state;
+    struct pcap_pkthdr header;
+    flow_key_t key;
+    uint32_t saved_max_flows = glb_config->max_flows;
+    uint8_t saved_flow_evict = glb_config->flow_evict;
+    bool saved_bidir = glb_config->bidir;
+    unsigned int i;
+    int num_fails = 0;
 
-    /*
-     * Export this record before deletion if running in
-     * IPFIX exporter mode.
-     */
-    if (glb_config->ipfix_export_port) {
-        ipfix_export_main(ctx, record);
+    if (flow_table_alloc(&ctx->flow_table, FLOW_TABLE_MIN_SIZE) != ok) {
+        return 1;
     }
-    /*
-     * Delete twin, if there is one
-     */
-    if (record->twin != NULL) {
-        joy_log_debug("LIST deleting twin\n");
-        flow_record_delete(ctx, record->twin);
+    memset_s(&state, sizeof(state), 0x00, sizeof(state));
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(&ctx->stats, sizeof(ctx->stats), 0x00, sizeof(ctx->stats));
+    ctx->flow_record_chrono_first = ctx->flow_record_chrono_last = NULL;
+    glb_config->max_flows = P2F_TEST_MAX_FLOWS;
+    glb_config->flow_evict = FLOW_EVICT_LRU;
+    glb_config->bidir = 0;
+    flow_record_set_export(p2f_test_evict_export, &state, 0);
+
+    memset_s(&header, sizeof(header), 0x00, sizeof(header));
+    memset_s(&key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+    key.da.v4_da.s_addr = 0x0a000001;
+    key.dp = 443;
+    key.prot = 6;
+    header.ts.tv_sec = 1500000000;
+    ctx->global_time = header.ts;
+
+    /* flows 0 to 3 fill the table, then flow 0 is seen again */
+    for (i = 0; i <= P2F_TEST_MAX_FLOWS; i++) {
+        key.sa.v4_sa.s_addr = i % P2F_TEST_MAX_FLOWS + 1;
+        key.sp = (uint16_t)(40000 + i % P2F_TEST_MAX_FLOWS);
+        header.ts.tv_sec++;
+        if (flow_key_get_record(ctx, &key, 1, &header) == NULL) {
+            joy_log_err("no record for flow %u", i % P2F_TEST_MAX_FLOWS);
+            num_fails++;
+        }
+    }
+    if (ctx->stats.num_records_in_table != P2F_TEST_MAX_FLOWS || state.num_exported != 0) {
+        joy_log_err("%lu records in the table and %u exported before the limit",
+                    ctx->stats.num_records_in_table, state.num_exported);
+        num_fails++;
     }
 
-    /* Remove record from chrono list, then delete from flow_record_list_array */
-    flow_record_chrono_list_remove(ctx, record);
-    flow_record_delete(ctx, record);
+    /* a fifth flow makes room by evicting flow 1, idle longest */
+    key.sa.v4_sa.s_addr = P2F_TEST_MAX_FLOWS + 1;
+    key.sp = 40000 + P2F_TEST_MAX_FLOWS;
+    header.ts.tv_sec++;
+    if (flow_key_get_record(ctx, &key, 1, &header) == NULL) {
+        joy_log_err("no record for the flow over the limit");
+        num_fails++;
+    }
+    if (state.num_exported != 1 || state.num_evicted != 1 || state.evicted_sa != 2 ||
+        ctx->stats.flows_evicted != 1) {
+        joy_log_err("%u flows exported, %u evicted (address %u), expected flow 1 evicted",
+                    state.num_exported, state.num_evicted, state.evicted_sa);
+        num_fails++;
+    }
+    if (ctx->stats.num_records_in_table != P2F_TEST_MAX_FLOWS) {
+        joy_log_err("%lu records in the table after eviction, expected %u",
+                    ctx->stats.num_records_in_table, P2F_TEST_MAX_FLOWS);
+        num_fails++;
+    }
+    for (i = 0; i < P2F_TEST_MAX_FLOWS; i++) {
+        key.sa.v4_sa.s_addr = i + 1;
+        key.sp = (uint16_t)(40000 + i);
+        if ((flow_key_get_record(ctx, &key, 0, NULL) != NULL) != (i != 1)) {
+            joy_log_err("flow %u %s the table", i, i == 1 ? "is still in" : "is missing from");
+            num_fails++;
+        }
+    }
+
+    while (ctx->flow_record_chrono_first != NULL) {
+        flow_record_print_and_delete(ctx, ctx->flow_record_chrono_first);
+    }
+    flow_record_set_export(NULL, NULL, 1);
+    glb_config->max_flows = saved_max_flows;
+    glb_config->flow_evict = saved_flow_evict;
+    glb_config->bidir = saved_bidir;
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(&ctx->stats, sizeof(ctx->stats), 0x00, sizeof(ctx->stats));
+    flow_table_release(&ctx->flow_table);
+    return num_fails;
+}
+
+/* flows of the idle expiry unit test, and most expired per call */
+#define P2F_TEST_NUM_IDLE 6
+#define P2F_TEST_IDLE_MAX 2
+
+static void p2f_test_idle_export (const flow_view_t *view, void *arg) {
+    unsigned int *num_inactive = arg;
+
+    if (view->exp_type == expiration_type_inactive) {
+        (*num_inactive)++;
+    }
 }
 
 /**
- * \brief Does IPFix sending of flow record data.
+ * \brief Unit test for the expiry of flows on an idle link.
  *
- * \param export_all Flag whether to indiscriminately print all flow_records.
- *                  JOY_EXPIRED_FLOWS - perform expiration check
- *                  JOY_ALL_FLOWS - print all of them
+ * Flows see their last packets a second apart, and then no more
+ * packets arrive.  As the housekeeping of a capture thread does, the
+ * context time is moved up to the wall clock once a second and at
+ * most P2F_TEST_IDLE_MAX expired flows are written out per call: each
+ * flow must be written out as inactive in the first call after the
+ * inactive timeout has passed since its last packet, and not before.
+ * Flows that expire together are spread over several calls.
  *
- * \return none
+ * \param ctx The context to use
+ *
+ * \return Number of failures
  */
-void flow_record_export_as_ipfix (joy_ctx_data *ctx, unsigned int export_type) {
-    flow_record_t *record = NULL;
-    flow_record_t *next_record = NULL;
-
-    /* The head of chrono record list */
-    record = ctx->flow_record_chrono_first;
+static int p2f_test_flow_idle_expiry(joy_ctx_data *ctx) {
+    struct pcap_pkthdr header;
+    flow_record_t *rec;
+    flow_key_t key;
+    unsigned int num_inactive = 0, num_waiting, expect;
+    const time_t base = 1500000000;
+    const time_t inactive = 10;
+    bool saved_bidir = glb_config->bidir;
+    unsigned int i;
+    time_t now;
+    int num_fails = 0;
 
-    while (record != NULL) {
-        /* setup next record */
-        next_record = record->time_next;
+    if (flow_table_alloc(&ctx->flow_table, FLOW_TABLE_MIN_SIZE) != ok) {
+        return 1;
+    }
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(&ctx->stats, sizeof(ctx->stats), 0x00, sizeof(ctx->stats));
+    ctx->flow_record_chrono_first = ctx->flow_record_chrono_last = NULL;
+    flow_record_update_timeouts(inactive, 3600);
+    glb_config->bidir = 0;
+    flow_record_set_export(p2f_test_idle_export, &num_inactive, 0);
+
+    memset_s(&header, sizeof(header), 0x00, sizeof(header));
+    memset_s(&key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+    key.da.v4_da.s_addr = 0x0a000001;
+    key.dp = 53;
+    key.prot = 17;
+
+    /* the last packet of flow i is seen at base + i */
+    for (i = 0; i < P2F_TEST_NUM_IDLE; i++) {
+        key.sa.v4_sa.s_addr = i + 1;
+        header.ts.tv_sec = base + i;
+        header.ts.tv_usec = 500000;
+        rec = flow_key_get_record(ctx, &key, 1, &header);
+        if (rec == NULL) {
+            joy_log_err("no record for flow %u", i);
+            num_fails++;
+            continue;
+        }
+        rec->start = rec->end = header.ts;
+        ctx->global_time = header.ts;
+    }
 
-        if (export_type == JOY_EXPIRED_FLOWS) {
-            /* Avoid printing flows that might still be active */
-            if (!flow_record_is_expired(ctx,record)) {
-                record = next_record;
-                continue;
+    /* no more packets; only the wall clock moves the time on */
+    for (now = base + P2F_TEST_NUM_IDLE; now <= base + P2F_TEST_NUM_IDLE + 2 * inactive; now++) {
+        ctx->global_time.tv_sec = now;
+        ctx->global_time.tv_usec = 0;
+        flow_record_list_print_expired(ctx, P2F_TEST_IDLE_MAX);
+
+        /* flow i has expired once now - inactive is past base + i + 0.5 */
+        expect = 0;
+        for (i = 0; i < P2F_TEST_NUM_IDLE; i++) {
+            if (base + (time_t)i < now - inactive) {
+                expect++;
             }
         }
-
-        /*
-         * Export this record before deletion if running in
-         * IPFIX exporter mode.
-         */
-        if (glb_config->ipfix_export_port) {
-            ipfix_export_main(ctx,record);
+        if (num_inactive != expect) {
+            joy_log_err("%u idle flows written out at %ld s, expected %u",
+                        num_inactive, (long)(now - base), expect);
+            num_fails++;
         }
+    }
+    if (ctx->stats.num_records_in_table != 0 || ctx->stats.flows_expired != P2F_TEST_NUM_IDLE) {
+        joy_log_err("%lu records left in the table after the idle flows expired",
+                    ctx->stats.num_records_in_table);
+        num_fails++;
+    }
 
-        /*
-         * Delete twin, if there is one
-         */
-        if (record->twin != NULL) {
-            joy_log_debug("LIST deleting twin\n");
-            flow_record_delete(ctx, record->twin);
+    /* flows that expire together are written out a few per call */
+    num_inactive = 0;
+    header.ts.tv_sec = now;
+    for (i = 0; i < P2F_TEST_NUM_IDLE; i++) {
+        key.sa.v4_sa.s_addr = i + 1;
+        rec = flow_key_get_record(ctx, &key, 1, &header);
+        if (rec != NULL) {
+            rec->start = rec->end = header.ts;
         }
+    }
+    ctx->global_time.tv_sec = now + 2 * inactive;
+    for (i = 0; i * P2F_TEST_IDLE_MAX < P2F_TEST_NUM_IDLE; i++) {
+        num_waiting = flow_record_list_print_expired(ctx, P2F_TEST_IDLE_MAX);
+        expect = P2F_TEST_NUM_IDLE - (i + 1) * P2F_TEST_IDLE_MAX;
+        if (num_waiting != expect || num_inactive != (i + 1) * P2F_TEST_IDLE_MAX) {
+            joy_log_err("%u flows written out and %u waiting after call %u, expected %u waiting",
+                        num_inactive, num_waiting, i + 1, expect);
+            num_fails++;
+        }
+    }
 
-        /* Remove record from chrono list, then delete from flow_record_list_array */
-        flow_record_chrono_list_remove(ctx, record);
-        flow_record_delete(ctx, record);
-
-        /* Advance to next record on chrono list */
-        record = next_record;
+    while (ctx->flow_record_chrono_first != NULL) {
+        flow_record_print_and_delete(ctx, ctx->flow_record_chrono_first);
     }
+    flow_record_set_export(NULL, NULL, 1);
+    flow_record_update_timeouts(0, 0);
+    glb_config->bidir = saved_bidir;
+    memset_s(ctx->flow_queue, sizeof(ctx->flow_queue), 0x00, sizeof(ctx->flow_queue));
+    memset_s(&ctx->flow_timer, sizeof(flow_timer_t), 0x00, sizeof(flow_timer_t));
+    memset_s(&ctx->stats, sizeof(ctx->stats), 0x00, sizeof(ctx->stats));
+    flow_table_release(&ctx->flow_table);
+    return num_fails;
 }
 
 /**
- * \brief Prints out the flow record list in JSON format.
+ * \brief Unit test for the per-packet time series of a flow.
  *
- * \param export_all Flag whether to indiscriminately print all flow_records.
- *                  JOY_EXPIRED_FLOWS - perform expiration check
- *                  JOY_ALL_FLOWS - print all of them
+ * Times after, before and far beyond the first one are stored and
+ * read back; the ones within range must come back exactly, and the
+ * ones beyond it must saturate rather than wrap.
  *
- * \return none
+ * \param none
+ *
+ * \return Number of failures
  */
-void flow_record_list_print_json (joy_ctx_data *ctx, unsigned int print_type) {
-    flow_record_t *record = NULL;
-    flow_record_t *next_record = NULL;
+static int p2f_test_time_series(void) {
+    static const struct timeval times[] = {
+        { 1500000000, 999999 }, { 1500000001, 3 }, { 1500000000, 999998 },
+        { 1499999999, 0 }, { 1500003000, 500000 }, { 1500000000, 999999 }
+    };
+    flow_splt_t splt;
+    struct timeval t;
+    unsigned int i;
+    int num_fails = 0;
 
-    /* The head of chrono record list */
-    record = ctx->flow_record_chrono_first;
+    memset_s(&splt, sizeof(splt), 0x00, sizeof(splt));
+    for (i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        joy_timer_series_set(&splt.start, splt.pkt_time, i, &times[i]);
+    }
+    for (i = 0; i < sizeof(times) / sizeof(times[0]); i++) {
+        joy_timer_series_get(&splt.start, splt.pkt_time, i, &t);
+        if (i == 4) {
+            if (splt.pkt_time[i] != INT32_MAX) {
+                joy_log_err("time series entry %u did not saturate", i);
+                num_fails++;
+            }
+        } else if (!joy_timer_eq(&t, &times[i])) {
+            joy_log_err("time series entry %u read back as %ld.%06ld", i,
+                        (long)t.tv_sec, (long)t.tv_usec);
+            num_fails++;
+        }
+    }
+    return num_fails;
+}
 
-    while (record != NULL) {
-        /* setup next record */
-        next_record = record->time_next;
+/* number of records in the flow record pool unit test */
+#define P2F_TEST_POOL_SIZE 4
 
-        if (print_type == JOY_EXPIRED_FLOWS) {
-            /* Avoid printing flows that might still be active */
-            if (!flow_record_is_expired(ctx,record)) {
-                record = next_record;
-                continue;
-            }
+/**
+ * \brief Unit test for the flow record pool.
+ *
+ * \param none
+ *
+ * \return Number of failures
+ */
+static int p2f_test_flow_record_pool(joy_ctx_data *ctx) {
+    flow_record_t *recs[P2F_TEST_POOL_SIZE + 1];
+    unsigned int i;
+    int num_fails = 0;
+
+    if (flow_record_pool_init(ctx, P2F_TEST_POOL_SIZE, 0) != ok) {
+        return 1;
+    }
+
+    /* one more record than the pool holds */
+    for (i = 0; i < P2F_TEST_POOL_SIZE + 1; i++) {
+        recs[i] = flow_record_alloc(ctx);
+        if (recs[i] == NULL) {
+            joy_log_err("could not allocate record %u", i);
+            return num_fails + 1;
+        }
+        if ((i < P2F_TEST_POOL_SIZE) != flow_record_pool_owns(&ctx->record_pool, recs[i])) {
+            joy_log_err("record %u came from the wrong allocator", i);
+            num_fails++;
         }
+    }
+    if (ctx->stats.pool_exhausted != 1 || ctx->record_pool.num_free != 0) {
+        joy_log_err("pool exhaustion not counted");
+        num_fails++;
+    }
 
-        /* print and remove the record */
-        flow_record_print_and_delete(ctx, record);
+    for (i = 0; i < P2F_TEST_POOL_SIZE + 1; i++) {
+        flow_record_free(ctx, recs[i]);
+    }
+    if (ctx->record_pool.num_free != P2F_TEST_POOL_SIZE) {
+        joy_log_err("pool has %u free records, expected %u", ctx->record_pool.num_free, P2F_TEST_POOL_SIZE);
+        num_fails++;
+    }
 
-        /* Advance to next record on chrono list */
-        record = next_record;
+    /* the most recently freed pool record is reused first */
+    if (flow_record_alloc(ctx) != recs[P2F_TEST_POOL_SIZE - 1]) {
+        joy_log_err("pool did not reuse the last freed record");
+        num_fails++;
     }
 
-    // note: we might need to call flush in the future
-    // zflush(ctx->output);
+    flow_record_pool_release(&ctx->record_pool);
+    return num_fails;
 }
 
+/* probe length histogram buckets: 1, 2, 3-4, 5-8, 9-16, 17+ */
+#define P2F_TEST_HIST_BUCKETS 6
+
+/* number of keys in each synthetic key set: 3/4 of a default size table */
+#define P2F_TEST_NUM_KEYS ((FLOW_TABLE_DEFAULT_SIZE / 4) * 3)
+
+/* number of hash calls timed by the microbenchmark */
+#define P2F_TEST_NUM_HASHES 4000000
+
+/* largest acceptable mean probe length at 3/4 load; uniform hashing gives 2.5 */
+#define P2F_TEST_MAX_MEAN_PROBES 4.0
+
+typedef struct p2f_test_probe_stats_ {
+    unsigned int num_keys;
+    unsigned long int total_probes;
+    unsigned int max_probe;
+    unsigned int hist[P2F_TEST_HIST_BUCKETS];
+} p2f_test_probe_stats_t;
+
 /**
- * \brief Removes the record and its twin from the list and the flow records
- *     structure.
+ * \brief Insert key \p n into a linear probing simulation of the flow table.
  *
- * \param ctx - the joy context to process with
- * \param rec - the rec we are deleting
+ * The simulation holds key indexes rather than records, so that large
+ * key sets can be measured without allocating flow records.  A key
+ * equal to one that is already present is not inserted again.
  *
- * \return none.
+ * \param slots Simulated slot array, -1 marks an empty slot
+ * \param size Number of slots, a power of two
+ * \param keys Key set
+ * \param n Index of the key to insert
+ * \param stats Probe statistics to update
+ * \return 1 if the key was inserted, 0 if it was a duplicate or the table is full
  */
-void remove_record_and_update_list(joy_ctx_data *ctx, flow_record_t *rec)
-{
-    /* Delete twin, if there is one */
-    if (rec->twin != NULL) {
-        flow_record_delete(ctx, rec->twin);
+static int p2f_test_probe_insert (int *slots,
+                                  uint32_t size,
+                                  const flow_key_t *keys,
+                                  unsigned int n,
+                                  p2f_test_probe_stats_t *stats) {
+    uint32_t mask = size - 1;
+    uint32_t i = flow_key_hash(&keys[n]) & mask;
+    unsigned int probes = 1;
+    unsigned int bucket = 0;
+
+    if (stats->num_keys + 1 >= size) {
+        return 0;
+    }
+    while (slots[i] != -1) {
+        if (flow_key_is_eq(&keys[slots[i]], &keys[n]) == 0) {
+            return 0;
+        }
+        i = (i + 1) & mask;
+        probes++;
     }
+    slots[i] = n;
 
-    /* Remove from chrono list, then delete from flow_record_list_array */
-    flow_record_chrono_list_remove(ctx, rec);
-    flow_record_delete(ctx, rec);
+    stats->num_keys++;
+    stats->total_probes += probes;
+    if (probes > stats->max_probe) {
+        stats->max_probe = probes;
+    }
+    while (bucket < P2F_TEST_HIST_BUCKETS - 1 && probes > (1u << bucket)) {
+        bucket++;
+    }
+    stats->hist[bucket]++;
+    return 1;
 }
 
-
 /**
- * \brief Get the twin of a flow_key.
- *
- * \param ctx Joy context to use for the lookup
- * \param key flow_key that we will try to find it's twin
- * \param key_hash hash array to look in for the twin
- *
- * \return The twin flow_key, or NULL
+ * \brief Measure the probe lengths of a key set in a table of \p size slots.
+ * \param name Name of the key set for the report, or NULL for no report
+ * \param keys Key set
+ * \param num_keys Number of keys in \p keys
+ * \param size Number of slots, a power of two
+ * \param stats Probe statistics, filled in
+ * \return ok or failure
  */
-flow_record_t *flow_key_get_twin (joy_ctx_data *ctx,
-                                  const flow_key_t *key,
-                                  unsigned int key_hash) {
-    unsigned int twin_hash = 0;
+static int p2f_test_probe_key_set (const char *name,
+                                   const flow_key_t *keys,
+                                   unsigned int num_keys,
+                                   uint32_t size,
+                                   p2f_test_probe_stats_t *stats) {
+    int *slots = NULL;
+    unsigned int i;
+    float mean = 0.0;
 
-    if (glb_config->flow_key_match_method == EXACT_MATCH) {
-        flow_key_t twin;
+    memset_s(stats, sizeof(p2f_test_probe_stats_t), 0x00, sizeof(p2f_test_probe_stats_t));
+    slots = malloc(size * sizeof(int));
+    if (slots == NULL) {
+        joy_log_err("out of memory");
+        return failure;
+    }
+    memset_s(slots, size * sizeof(int), 0xff, size * sizeof(int));
 
-        /*
-         * we use the passed in key_hash to determine the list because
-         * the twin will has the same hash value. we use find_record_by_key
-         * because we are searching based on the entire key.
-         */
-        memcpy_s(&twin.sa.v6_sa, sizeof(struct in6_addr), &key->da.v6_da, sizeof(struct in6_addr));
-        memcpy_s(&twin.da.v6_da, sizeof(struct in6_addr), &key->sa.v6_sa, sizeof(struct in6_addr));
-        twin.sp = key->dp;
-        twin.dp = key->sp;
-        twin.prot = key->prot;
-        twin_hash = flow_key_hash(&twin);
+    for (i = 0; i < num_keys; i++) {
+        p2f_test_probe_insert(slots, size, keys, i, stats);
+    }
+    free(slots);
 
-        /* sanity check the hash calculation */
-        if (twin_hash != key_hash) {
-            joy_log_err("twin hash doesn't match: hash(%x) twin_hash(%x)", key_hash, twin_hash);
-        }
-        return flow_record_list_find_record_by_key(&ctx->flow_record_list_array[key_hash], &twin);
+    if (name == NULL) {
+        return ok;
+    }
+    if (stats->num_keys) {
+        mean = (float)stats->total_probes / stats->num_keys;
+    }
+    fprintf(info, "%-16s %6u keys %6u slots: mean probes %.2f, max %u, "
+            "histogram [1]:%u [2]:%u [3-4]:%u [5-8]:%u [9-16]:%u [17+]:%u\n",
+            name, stats->num_keys, size, mean, stats->max_probe,
+            stats->hist[0], stats->hist[1], stats->hist[2],
+            stats->hist[3], stats->hist[4], stats->hist[5]);
+    return ok;
+}
 
-    } else {
-        /*
-         * we use the passed in key_hash because in NEAR_MATCH cases, the addresses are omitted
-         * from the hash calculation. Therefore, the record and twin will have the same hash.
-         * we use find_twin_by_key because we need to at least match one address in the records
-         * to have a good chance at determining this is the NAT'd twin.
-         */
-        return flow_record_list_find_twin_by_key(&ctx->flow_record_list_array[key_hash], key);
+/**
+ * \brief Fill in key \p i of a synthetic key set.
+ *
+ * The sets model traffic that collides under an additive hash:
+ * NAT pools whose addresses and ports move in opposite directions,
+ * a scanner sweeping a /16, CGNAT port blocks and an IPv6 host sweep.
+ *
+ * \param set Key set number
+ * \param i Key number
+ * \param key Key to fill in
+ * \return none
+ */
+static void p2f_test_synthetic_key (unsigned int set, unsigned int i, flow_key_t *key) {
+    memset_s(key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+
+    switch (set) {
+    case 0:  /* NAT pool */
+        key->sa.v4_sa.s_addr = htonl(0x0a000000 + (i >> 8));
+        key->da.v4_da.s_addr = htonl(0xc0a80000 - (i >> 8));
+        key->sp = (uint16_t)(1024 + (i & 0xff));
+        key->dp = (uint16_t)(65000 - (i & 0xff));
+        key->prot = 6;
+        break;
+    case 1:  /* scanner */
+        key->sa.v4_sa.s_addr = htonl(0xcb007101);
+        key->da.v4_da.s_addr = htonl(0xac100000 + (i & 0xffff));
+        key->sp = 40000;
+        key->dp = (i >> 16) ? 443 : 80;
+        key->prot = 6;
+        break;
+    case 2:  /* CGNAT port blocks */
+        key->sa.v4_sa.s_addr = htonl(0x64400000 + (i >> 9));
+        key->da.v4_da.s_addr = htonl(0x08080808);
+        key->sp = (uint16_t)(1024 + ((i >> 9) & 0x3f) * 512 + (i & 0x1ff));
+        key->dp = 53;
+        key->prot = 17;
+        break;
+    default: /* IPv6 host sweep */
+        key->sa.v6_sa.s6_addr[0] = 0x20;
+        key->sa.v6_sa.s6_addr[1] = 0x01;
+        key->sa.v6_sa.s6_addr[2] = 0x0d;
+        key->sa.v6_sa.s6_addr[3] = 0xb8;
+        key->sa.v6_sa.s6_addr[13] = (uint8_t)(i >> 16);
+        key->sa.v6_sa.s6_addr[14] = (uint8_t)(i >> 8);
+        key->sa.v6_sa.s6_addr[15] = (uint8_t)i;
+        key->da.v6_da.s6_addr[0] = 0x20;
+        key->da.v6_da.s6_addr[1] = 0x01;
+        key->da.v6_da.s6_addr[15] = 0x01;
+        key->sp = 51000;
+        key->dp = 443;
+        key->prot = 6;
+        break;
     }
 }
 
 /**
- * \brief Unit test for the flow_record list functionality.
+ * \brief Microbenchmark of the flow key hash.
+ *
+ * Reports the probe length distribution of synthetic adversarial key
+ * sets at the load where the flow table would grow, and of the flows
+ * found in the bundled test pcaps, and times the hash function.
  *
  * \param none
  *
  * \return Number of failures
  */
-static int p2f_test_flow_record_list(joy_ctx_data *ctx) {
-    flow_record_list list = NULL;
-    flow_record_t a, b, c, d;
-    flow_record_t *rp;
-    flow_key_t k1 = { { {0xcafe} }, { {0xbabe} }, 0xfa, 0xce, 0xdd };
-    flow_key_t k2 = { { {0xdead} }, { {0xbeef} }, 0xfa, 0xce, 0xdd };
+static int p2f_test_flow_key_hash(void) {
+    static const char *set_names[] = { "nat pool", "scanner", "cgnat blocks", "ipv6 sweep" };
+    static const char *pcaps[] = { "sample.pcap", "firefox58.pcap", "kali-normal-ssh.pcap",
+                                   "kali-password-attack_hydra.pcap", "dhcp.pcap", "ikev2.pcap" };
+    p2f_test_probe_stats_t stats;
+    flow_key_t *keys = NULL;
+    flow_key_t twin;
+    unsigned int set, i, num_keys = 0;
+    uint32_t size, h = 0;
+    struct timeval start, end, elapsed;
+    unsigned int msec;
     int num_fails = 0;
 
-    flow_record_init(ctx, &a, &k1);
-    flow_record_init(ctx, &b, &k2);
-    flow_record_init(ctx, &c, &k1);
-    flow_record_init(ctx, &d, &k1);
-
-    flow_record_list_prepend(&list, &a);
-    rp = flow_record_list_find_record_by_key(&list, &k1);
-    if (!rp) {
-        joy_log_err("did not find a");
-        num_fails++;
-    }
-
-    flow_record_list_remove(&list, &a);
-    rp = flow_record_list_find_record_by_key(&list, &k1);
-    if (rp) {
-        joy_log_err("found a, but should not have");
-        num_fails++;
-    }
-
-    flow_record_list_prepend(&list, &b);
-    rp = flow_record_list_find_record_by_key(&list, &k2);
-    if (!rp) {
-        joy_log_err("did not find b");
-        num_fails++;
+    keys = calloc(P2F_TEST_NUM_KEYS, sizeof(flow_key_t));
+    if (keys == NULL) {
+        joy_log_err("out of memory");
+        return 1;
     }
 
-    flow_record_list_remove(&list, &b);
-    rp = flow_record_list_find_record_by_key(&list, &k2);
-    if (rp) {
-        joy_log_err("found b, but should not have");
-        num_fails++;
+    /* synthetic key sets */
+    for (set = 0; set < sizeof(set_names) / sizeof(set_names[0]); set++) {
+        for (i = 0; i < P2F_TEST_NUM_KEYS; i++) {
+            p2f_test_synthetic_key(set, i, &keys[i]);
+        }
+        if (p2f_test_probe_key_set(set_names[set], keys, P2F_TEST_NUM_KEYS,
+                                   FLOW_TABLE_DEFAULT_SIZE, &stats) != ok) {
+            num_fails++;
+            continue;
+        }
+        if ((float)stats.total_probes / stats.num_keys > P2F_TEST_MAX_MEAN_PROBES) {
+            joy_log_err("%s keys: mean probe length too long", set_names[set]);
+            num_fails++;
+        }
     }
 
-    flow_record_list_prepend(&list, &a);
-    flow_record_list_prepend(&list, &b);
-    rp = flow_record_list_find_record_by_key(&list, &k1);
-    if (!rp) {
-        joy_log_err("did not find a");
-        num_fails++;
+    /* symmetric mode: a key and its twin must hash alike */
+    for (i = 0; i < 1024; i++) {
+        p2f_test_synthetic_key(i & 3, i * 37, &keys[0]);
+        memset_s(&twin, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+        memcpy_s(&twin.sa.v6_sa, sizeof(struct in6_addr), &keys[0].da.v6_da, sizeof(struct in6_addr));
+        memcpy_s(&twin.da.v6_da, sizeof(struct in6_addr), &keys[0].sa.v6_sa, sizeof(struct in6_addr));
+        twin.sp = keys[0].dp;
+        twin.dp = keys[0].sp;
+        twin.prot = keys[0].prot;
+        if (flow_key_hash_mode(&keys[0], FLOW_KEY_HASH_SYMMETRIC) !=
+            flow_key_hash_mode(&twin, FLOW_KEY_HASH_SYMMETRIC)) {
+            joy_log_err("symmetric hash of key %u differs from its twin", i);
+            num_fails++;
+            break;
+        }
     }
 
-    rp = flow_record_list_find_record_by_key(&list, &k2);
-    if (!rp) {
-        joy_log_err("did not find b");
-        num_fails++;
+    /* flows in the bundled pcaps */
+    for (set = 0; set < sizeof(pcaps) / sizeof(pcaps[0]); set++) {
+        pcap_t *pcap_handle = NULL;
+        struct pcap_pkthdr header;
+        const unsigned char *pkt_ptr = NULL;
+
+        pcap_handle = joy_utils_open_test_pcap(pcaps[set]);
+        if (!pcap_handle) {
+            joy_log_err("unable to open %s", pcaps[set]);
+            num_fails++;
+            continue;
+        }
+        while (num_keys < P2F_TEST_NUM_KEYS && (pkt_ptr = pcap_next(pcap_handle, &header)) != NULL) {
+            if (get_packet_5tuple_key(pkt_ptr, &keys[num_keys])) {
+                num_keys++;
+            }
+        }
+        pcap_close(pcap_handle);
     }
-
-    flow_record_list_remove(&list, &a);
-    rp = flow_record_list_find_record_by_key(&list, &k1);
-    if (rp) {
-        joy_log_err("found a, but should not have");
-        num_fails++;
+    if (num_keys) {
+        /* count the distinct flows, then measure them at up to 3/4 load */
+        if (p2f_test_probe_key_set(NULL, keys, num_keys,
+                                   FLOW_TABLE_DEFAULT_SIZE, &stats) != ok) {
+            num_fails++;
+        } else {
+            size = FLOW_TABLE_MIN_SIZE;
+            while (stats.num_keys * 4 > size * 3) {
+                size <<= 1;
+            }
+            p2f_test_probe_key_set("test pcaps", keys, num_keys, size, &stats);
+        }
     }
 
-    flow_record_list_remove(&list, &b);
-    rp = flow_record_list_find_record_by_key(&list, &k2);
-    if (rp) {
-        joy_log_err("found a, but should not have");
-        num_fails++;
+    /* hash throughput */
+    for (i = 0; i < 256; i++) {
+        p2f_test_synthetic_key(i & 3, i * 191, &keys[i]);
     }
-
-    flow_record_list_prepend(&list, &a);
-    flow_record_list_prepend(&list, &c);
-    rp = flow_record_list_find_record_by_key(&list, &k1);
-    if (!rp) {
-        joy_log_err("did not find a");
-        num_fails++;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < P2F_TEST_NUM_HASHES; i++) {
+        h += flow_key_hash_mode(&keys[i & 0xff], (i & 0x100) ? FLOW_KEY_HASH_SYMMETRIC : FLOW_KEY_HASH_DIRECTED);
     }
+    gettimeofday(&end, NULL);
+    joy_timer_sub(&end, &start, &elapsed);
+    msec = joy_timeval_to_milliseconds(elapsed);
+    fprintf(info, "flow_key_hash: %u hashes in %u ms (%.1f ns/hash, check %08x)\n",
+            P2F_TEST_NUM_HASHES, msec, (float)msec * 1000000.0 / P2F_TEST_NUM_HASHES, h);
 
+    free(keys);
     return num_fails;
 }
 
@@ -1990,7 +4613,7 @@ void p2f_unit_test() {
     int num_fails = 0;
     joy_ctx_data *main_ctx = NULL;
     
-    main_ctx = calloc(1, sizeof(joy_ctx_data));
+    JOY_API_ALLOC_CONTEXT(main_ctx, 1)
     if (!main_ctx) {
         fprintf(info, "Out of memory\n");
         return;
@@ -1999,7 +4622,14 @@ void p2f_unit_test() {
     fprintf(info, "\n******************************\n");
     fprintf(info, "P2F Unit Test starting...\n");
 
-    num_fails += p2f_test_flow_record_list(main_ctx);
+    num_fails += p2f_test_flow_table(main_ctx);
+    num_fails += p2f_test_flow_record_pool(main_ctx);
+    num_fails += p2f_test_flow_timer(main_ctx);
+    num_fails += p2f_test_time_series();
+    num_fails += p2f_test_flow_queue(main_ctx);
+    num_fails += p2f_test_flow_evict(main_ctx);
+    num_fails += p2f_test_flow_idle_expiry(main_ctx);
+    num_fails += p2f_test_flow_key_hash();
 
     if (num_fails) {
         fprintf(info, "Finished - failures: %d\n", num_fails);
@@ -2007,8 +4637,7 @@ void p2f_unit_test() {
         fprintf(info, "Finished - success\n");
     }
     fprintf(info, "******************************\n\n");
-    free(main_ctx);
-    main_ctx = NULL;
+    JOY_API_FREE_CONTEXT(main_ctx)
 }
 
 /*********************************************************
@@ -2030,11 +4659,15 @@ pthread_mutex_t upload_in_process = PTHREAD_MUTEX_INITIALIZER;
 /** thread condition to wait for */
 pthread_cond_t upload_run_cond = PTHREAD_COND_INITIALIZER;
 
-/** thread signal for execution */
-int upload_can_run = 0;
+/** a file waiting to be uploaded */
+typedef struct upload_job_ {
+    struct upload_job_ *next;
+    char filename[MAX_FILENAME_LENGTH];
+} upload_job_t;
 
-/** filename to be uploaded */
-char upload_filename[MAX_FILENAME_LENGTH];
+/** files waiting to be uploaded, oldest first */
+static upload_job_t *upload_queue = NULL;
+static upload_job_t **upload_tail = &upload_queue;
 
 static int uploader_send_file (char *filename, const char *servername,
                                const char *key, unsigned int retain) {
@@ -2079,31 +4712,29 @@ __attribute__((__noreturn__)) void *uploader_main(void *ptr)
 #endif
 {
     configuration_t *config = ptr;
-
-    /* initialize the uploader filename container */
-    memset_s(upload_filename, MAX_FILENAME_LENGTH, 0x00, MAX_FILENAME_LENGTH);
+    upload_job_t *job = NULL;
 
     /* uploader stays alive until joy exists */
     while (1) {
 
         /* wait until we are signaled to do work */
         pthread_mutex_lock(&upload_in_process);
-        while (!upload_can_run) {
+        while (upload_queue == NULL) {
             joy_log_info("waiting on signal...");
             pthread_cond_wait(&upload_run_cond, &upload_in_process);
         }
-
-        /* upload file now */
-        if (strnlen_s(upload_filename, MAX_FILENAME_LENGTH) > 0) {
-            joy_log_info("uploading file [%s] ...", upload_filename);
-            uploader_send_file(upload_filename, config->upload_servername,
-                               config->upload_key, config->retain_local);
+        job = upload_queue;
+        upload_queue = job->next;
+        if (upload_queue == NULL) {
+            upload_tail = &upload_queue;
         }
-
-        /* we are done uploading the file, go back to sleep */
-        memset_s(upload_filename, MAX_FILENAME_LENGTH, 0x00, MAX_FILENAME_LENGTH);
-        upload_can_run = 0;
         pthread_mutex_unlock(&upload_in_process);
+
+        /* upload file now, while more files can be queued */
+        joy_log_info("uploading file [%s] ...", job->filename);
+        uploader_send_file(job->filename, config->upload_servername,
+                           config->upload_key, config->retain_local);
+        free(job);
     }
 }
 
@@ -2118,6 +4749,8 @@ __attribute__((__noreturn__)) void *uploader_main(void *ptr)
  * \return 0 success
  */
 int upload_file (char *filename) {
+    upload_job_t *job = NULL;
+    int len;
 
     /* sanity check we were passed in a file to upload */
     if (filename == NULL) {
@@ -2125,10 +4758,22 @@ int upload_file (char *filename) {
         return failure;
     }
 
-    /* wake up the uploader thread so it can do its work */
+    job = calloc(1, sizeof(upload_job_t));
+    if (job == NULL) {
+        joy_log_err("could not upload file [%s] (out of memory)", filename);
+        return failure;
+    }
+    len = snprintf(job->filename, MAX_FILENAME_LENGTH, "%s", filename);
+    if (len < 0 || len >= MAX_FILENAME_LENGTH) {
+        joy_log_err("could not upload file [%s] (name too long)", filename);
+        free(job);
+        return failure;
+    }
+
+    /* queue the file and wake up the uploader thread so it can do its work */
     pthread_mutex_lock(&upload_in_process);
-    memcpy_s(upload_filename, MAX_FILENAME_LENGTH-1, filename, (MAX_FILENAME_LENGTH-1));
-    upload_can_run = 1;
+    *upload_tail = job;
+    upload_tail = &job->next;
     pthread_cond_signal(&upload_run_cond);
     pthread_mutex_unlock(&upload_in_process);
 
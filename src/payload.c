@@ -117,19 +117,19 @@ void payload_update (struct payload *payload,
 void payload_print_json (const struct payload *x1, const struct payload *x2, zfile f) {
 
     if (x1->length || (x2 && x2->length)) {
-        zprintf(f, ",\"payload\":{");
+        zputs(f, ",\"payload\":{");
 	if (x1->length) {
-	    zprintf(f, "\"out\":");
+	    zputs(f, "\"out\":");
 	    zprintf_raw_as_hex(f, x1->data, x1->length);
 	}
 	if (x2 && x2->length) {
 	    if (x1->length) {
-		zprintf(f, ",");		
+		zputc(f, ',');		
 	    }
-	    zprintf(f, "\"in\":");
+	    zputs(f, "\"in\":");
 	    zprintf_raw_as_hex(f, x2->data, x2->length);
 	}
-        zprintf(f, "}");
+        zputc(f, '}');
     }
 }
 
@@ -0,0 +1,1237 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file pcap_reader.c
+ *
+ * \brief Reader of pcap and pcapng files, see pcap_reader.h
+ *
+ * The records of a file are parsed where they lie in the current
+ * buffer: the whole file when it is mapped, or one of the buffers
+ * that the reading thread fills.  A record that runs past the end of
+ * a buffer is gathered into the carry buffer first.  Since the packets
+ * of a burst point into the current buffer, it can only be given back
+ * to the reading thread at the start of a burst; a burst ends early
+ * at the first record that does not fit in what is left of it.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "pcap_reader.h"
+#include "output.h"
+#include "affinity.h"
+#include "config.h"
+#include "err.h"
+#include "utils.h"
+#include "safe_lib.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/*
+ * bytes past the end of the data of a buffer that can be read and
+ * written.  The packet parsers rewrite some headers in place, and may
+ * look a little past the captured bytes, as they can in the buffer of
+ * libpcap; so a file is mapped copy-on-write, and each buffer, the
+ * carry buffer and a mapped file are followed by this much zeroed room.
+ */
+#define PCAP_READER_SLACK (64 * 1024)
+
+/* magic numbers of the file formats, as read in the byte order of the file */
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAPNG_BYTE_ORDER_MAGIC 0x1a2b3c4d
+
+/* bytes of the file header and of the record header of a pcap file */
+#define PCAP_FILE_HDR_LEN 24
+#define PCAP_REC_HDR_LEN 16
+
+/* pcapng block types */
+#define PCAPNG_SHB 0x0a0d0d0a
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_PB  0x00000002
+#define PCAPNG_SPB 0x00000003
+#define PCAPNG_EPB 0x00000006
+
+/* pcapng interface options */
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_IF_TSOFFSET 14
+
+/* bytes of a pcapng block header, of the block trailer, and of the fixed
+   part of the blocks that are parsed */
+#define PCAPNG_BLOCK_HDR_LEN 8
+#define PCAPNG_BLOCK_TRAILER_LEN 4
+#define PCAPNG_SHB_LEN 16
+#define PCAPNG_IDB_LEN 8
+#define PCAPNG_PB_LEN 20
+#define PCAPNG_SPB_LEN 4
+#define PCAPNG_EPB_LEN 20
+
+enum pcap_reader_format {
+    PCAP_READER_PCAP = 0,
+    PCAP_READER_PCAPNG = 1
+};
+
+/** an interface of a pcapng section */
+typedef struct pcap_reader_if_ {
+    uint64_t units;                     /*!< timestamp units per second        */
+    int64_t offset;                     /*!< seconds added to the timestamps   */
+    uint32_t snaplen;
+} pcap_reader_if_t;
+
+/** a buffer of data read by the reading thread */
+typedef struct pcap_reader_buf_ {
+    unsigned char *data;
+    size_t len;
+} pcap_reader_buf_t;
+
+struct pcap_reader_ {
+    /* the data being parsed */
+    const unsigned char *data;          /*!< current buffer                    */
+    size_t len;                         /*!< bytes in it                       */
+    size_t pos;                         /*!< where the next record starts      */
+    int pinned;                         /*!< the current burst points into it  */
+    unsigned char *carry;               /*!< a record gathered across buffers  */
+    size_t carry_len;
+    size_t carry_size;
+    int eof;
+    int error;
+
+    /* the file */
+    int format;                         /*!< an enum pcap_reader_format        */
+    int swapped;                        /*!< the file has the other byte order */
+    int linktype;
+    uint32_t snaplen;                   /*!< pcap files                        */
+    uint64_t units;                     /*!< pcap files: timestamp units       */
+    pcap_reader_if_t *ifs;              /*!< pcapng files: the interfaces      */
+    unsigned int num_ifs;
+    unsigned int max_ifs;
+
+    /* a mapped file */
+    void *map;
+    size_t map_len;
+
+    /* a file read by the reading thread, shared under lock */
+    zreader z;
+    pthread_t thread;
+    int have_thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;              /*!< signalled when a buffer is filled */
+    pthread_cond_t emptied;             /*!< signalled when a buffer is freed  */
+    pcap_reader_buf_t bufs[PCAP_READER_NUM_BUFS];
+    uint64_t head;                      /*!< buffers ever filled               */
+    uint64_t tail;                      /*!< buffers ever given back           */
+    int holding;                        /*!< the buffer at tail is current     */
+    int stream_end;                     /*!< the thread has read everything    */
+    int stream_error;
+    int stop;
+};
+
+/*
+ * byte order
+ */
+
+static inline uint16_t pcap_reader_swap16 (uint16_t v) {
+    return (uint16_t)((v >> 8) | (v << 8));
+}
+
+static inline uint32_t pcap_reader_swap32 (uint32_t v) {
+    return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+static inline uint64_t pcap_reader_swap64 (uint64_t v) {
+    return ((uint64_t)pcap_reader_swap32((uint32_t)v) << 32) | pcap_reader_swap32((uint32_t)(v >> 32));
+}
+
+static inline uint16_t pcap_reader_get16 (const pcap_reader_t r, const unsigned char *p) {
+    uint16_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? pcap_reader_swap16(v) : v;
+}
+
+static inline uint32_t pcap_reader_get32 (const pcap_reader_t r, const unsigned char *p) {
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? pcap_reader_swap32(v) : v;
+}
+
+static inline uint64_t pcap_reader_get64 (const pcap_reader_t r, const unsigned char *p) {
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return r->swapped ? pcap_reader_swap64(v) : v;
+}
+
+/*
+ * the reading thread
+ */
+
+static void *pcap_reader_thread_main (void *arg) {
+    pcap_reader_t r = (pcap_reader_t)arg;
+    pcap_reader_buf_t *b;
+    int n = 0;
+
+    /* decompress next to the worker reading the file, not on its cpu */
+    affinity_spread_to_node();
+
+    while (1) {
+        pthread_mutex_lock(&r->lock);
+        while (r->head - r->tail == PCAP_READER_NUM_BUFS && !r->stop) {
+            pthread_cond_wait(&r->emptied, &r->lock);
+        }
+        if (r->stop) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        b = &r->bufs[r->head % PCAP_READER_NUM_BUFS];
+        pthread_mutex_unlock(&r->lock);
+
+        /* fill it up, unless the file ends first */
+        b->len = 0;
+        while (b->len < PCAP_READER_BUF_SIZE) {
+            n = zread(r->z, b->data + b->len, (unsigned int)(PCAP_READER_BUF_SIZE - b->len));
+            if (n <= 0) {
+                break;
+            }
+            b->len += n;
+        }
+
+        pthread_mutex_lock(&r->lock);
+        if (b->len) {
+            r->head++;
+        }
+        if (n <= 0) {
+            r->stream_end = 1;
+            r->stream_error = (n < 0);
+        }
+        pthread_cond_signal(&r->filled);
+        pthread_mutex_unlock(&r->lock);
+        if (n <= 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * give the current buffer back and make the next one current; fails at
+ * the end of the file, setting error if it ended on an error
+ */
+static int pcap_reader_next_buf (pcap_reader_t r) {
+    int rc = ok;
+
+    if (!r->have_thread) {
+        /* a mapped file is a single buffer */
+        r->eof = 1;
+        return failure;
+    }
+
+    pthread_mutex_lock(&r->lock);
+    if (r->holding) {
+        r->tail++;
+        r->holding = 0;
+        pthread_cond_signal(&r->emptied);
+    }
+    while (r->head == r->tail && !r->stream_end) {
+        pthread_cond_wait(&r->filled, &r->lock);
+    }
+    if (r->head == r->tail) {
+        if (r->stream_error) {
+            joy_log_err("could not read the capture file");
+            r->error = 1;
+        }
+        r->eof = 1;
+        rc = failure;
+    } else {
+        r->data = r->bufs[r->tail % PCAP_READER_NUM_BUFS].data;
+        r->len = r->bufs[r->tail % PCAP_READER_NUM_BUFS].len;
+        r->pos = 0;
+        r->holding = 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return rc;
+}
+
+/*
+ * parsing
+ */
+
+/*
+ * the next need bytes of the file, in one piece; NULL at the end of the
+ * file, or if they run past the current buffer while the burst being
+ * read points into it, in which case neither eof nor error is set
+ */
+static const unsigned char *pcap_reader_peek (pcap_reader_t r, size_t need) {
+    size_t take;
+
+    if (r->carry_len == 0) {
+        if (r->len - r->pos >= need) {
+            return r->data + r->pos;
+        }
+        if (r->pinned) {
+            return NULL;
+        }
+    }
+
+    /* gather the record into the carry buffer */
+    if (need > r->carry_size) {
+        unsigned char *carry = realloc(r->carry, need + PCAP_READER_SLACK);
+
+        if (carry == NULL) {
+            joy_log_err("could not allocate %lu bytes for a record", (unsigned long)need);
+            r->error = 1;
+            return NULL;
+        }
+        memset_s(carry + need, PCAP_READER_SLACK, 0x00, PCAP_READER_SLACK);
+        r->carry = carry;
+        r->carry_size = need;
+    }
+    while (r->carry_len < need) {
+        if (r->pos == r->len && pcap_reader_next_buf(r) != ok) {
+            if (r->carry_len != 0 && !r->error) {
+                joy_log_err("truncated capture file");
+                r->error = 1;
+            }
+            return NULL;
+        }
+        take = r->len - r->pos;
+        if (take > need - r->carry_len) {
+            take = need - r->carry_len;
+        }
+        memcpy(r->carry + r->carry_len, r->data + r->pos, take);
+        r->carry_len += take;
+        r->pos += take;
+    }
+    return r->carry;
+}
+
+/* move past a record of len bytes returned by pcap_reader_peek() */
+static inline void pcap_reader_skip (pcap_reader_t r, size_t len) {
+    if (r->carry_len) {
+        r->carry_len = 0;
+    } else {
+        r->pos += len;
+    }
+}
+
+/* libpcap takes the link types of a file, which differ from the DLT_
+   values of a few of them, as the DLT_ values */
+static int pcap_reader_linktype_to_dlt (uint32_t linktype) {
+    switch (linktype) {
+#ifdef DLT_ATM_RFC1483
+    case 100:
+        return DLT_ATM_RFC1483;
+#endif
+#ifdef DLT_RAW
+    case 101:
+        return DLT_RAW;
+#endif
+#ifdef DLT_C_HDLC
+    case 104:
+        return DLT_C_HDLC;
+#endif
+    default:
+        return (int)(linktype & 0x03ffffff);
+    }
+}
+
+/* microseconds of a fraction of a second in units per second */
+static inline long pcap_reader_usec (uint64_t frac, uint64_t units) {
+    if (units == 1000000) {
+        return (long)frac;
+    }
+    if (units % 1000000 == 0) {
+        return (long)(frac / (units / 1000000));
+    }
+    if (units < 1000000 && 1000000 % units == 0) {
+        return (long)(frac * (1000000 / units));
+    }
+    return (long)((double)frac * 1000000.0 / (double)units);
+}
+
+/* read the file header of a pcap file */
+static int pcap_reader_pcap_header (pcap_reader_t r, char *errbuf) {
+    const unsigned char *p = pcap_reader_peek(r, PCAP_FILE_HDR_LEN);
+    uint32_t magic;
+
+    if (p == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "truncated pcap file header");
+        return failure;
+    }
+    memcpy(&magic, p, sizeof(magic));
+    if (magic == pcap_reader_swap32(PCAP_MAGIC_USEC) || magic == pcap_reader_swap32(PCAP_MAGIC_NSEC)) {
+        r->swapped = 1;
+        magic = pcap_reader_swap32(magic);
+    }
+    r->units = (magic == PCAP_MAGIC_NSEC) ? 1000000000 : 1000000;
+    r->snaplen = pcap_reader_get32(r, p + 16);
+    if (r->snaplen == 0 || r->snaplen > PCAP_READER_MAX_SNAPLEN) {
+        r->snaplen = PCAP_READER_MAX_SNAPLEN;
+    }
+    r->linktype = pcap_reader_linktype_to_dlt(pcap_reader_get32(r, p + 20));
+    pcap_reader_skip(r, PCAP_FILE_HDR_LEN);
+    return ok;
+}
+
+/*
+ * read the next record of a pcap file into hdr and *packet; returns
+ * failure at the end of the file, on error, or if the burst must end
+ */
+static int pcap_reader_pcap_record (pcap_reader_t r, struct pcap_pkthdr *hdr, const unsigned char **packet) {
+    const unsigned char *p = pcap_reader_peek(r, PCAP_REC_HDR_LEN);
+    uint32_t caplen;
+    uint32_t frac;
+
+    if (p == NULL) {
+        return failure;
+    }
+    caplen = pcap_reader_get32(r, p + 8);
+    if (caplen > PCAP_READER_MAX_SNAPLEN) {
+        joy_log_err("corrupt pcap file: packet of %u bytes", caplen);
+        r->error = 1;
+        return failure;
+    }
+    p = pcap_reader_peek(r, PCAP_REC_HDR_LEN + caplen);
+    if (p == NULL) {
+        return failure;
+    }
+
+    frac = pcap_reader_get32(r, p + 4);
+    hdr->ts.tv_sec = pcap_reader_get32(r, p);
+    hdr->ts.tv_usec = (r->units == 1000000) ? (long)frac : (long)(frac / 1000);
+    hdr->caplen = (caplen > r->snaplen) ? r->snaplen : caplen;
+    hdr->len = pcap_reader_get32(r, p + 12);
+    *packet = p + PCAP_REC_HDR_LEN;
+    pcap_reader_skip(r, PCAP_REC_HDR_LEN + caplen);
+    return ok;
+}
+
+/* read the options of an interface description block */
+static int pcap_reader_pcapng_if (pcap_reader_t r, const unsigned char *p, uint32_t len) {
+    pcap_reader_if_t *i;
+    int linktype;
+    uint32_t pos = PCAPNG_BLOCK_HDR_LEN + PCAPNG_IDB_LEN;
+    uint32_t end = len - PCAPNG_BLOCK_TRAILER_LEN;
+
+    linktype = pcap_reader_linktype_to_dlt(pcap_reader_get16(r, p + PCAPNG_BLOCK_HDR_LEN));
+    if (r->ifs == NULL) {
+        r->linktype = linktype;
+    } else if (linktype != r->linktype) {
+        joy_log_err("pcapng interfaces with different link types (%d and %d)", r->linktype, linktype);
+        r->error = 1;
+        return failure;
+    }
+    if (r->num_ifs == r->max_ifs) {
+        unsigned int max = r->max_ifs ? 2 * r->max_ifs : 4;
+        pcap_reader_if_t *ifs = realloc(r->ifs, max * sizeof(pcap_reader_if_t));
+
+        if (ifs == NULL) {
+            r->error = 1;
+            return failure;
+        }
+        r->ifs = ifs;
+        r->max_ifs = max;
+    }
+    i = &r->ifs[r->num_ifs];
+    i->units = 1000000;
+    i->offset = 0;
+    i->snaplen = pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN + 4);
+
+    while (pos + 4 <= end) {
+        uint16_t code = pcap_reader_get16(r, p + pos);
+        uint16_t opt_len = pcap_reader_get16(r, p + pos + 2);
+
+        pos += 4;
+        if (code == PCAPNG_OPT_ENDOFOPT || pos + opt_len > end) {
+            break;
+        }
+        if (code == PCAPNG_OPT_IF_TSRESOL && opt_len == 1) {
+            uint8_t v = p[pos];
+            uint8_t exp = v & 0x7f;
+
+            if ((v & 0x80) ? (exp > 63) : (exp > 19)) {
+                joy_log_err("pcapng interface with unsupported if_tsresol %u", v);
+                r->error = 1;
+                return failure;
+            }
+            if (v & 0x80) {
+                i->units = (uint64_t)1 << exp;
+            } else {
+                i->units = 1;
+                while (exp--) {
+                    i->units *= 10;
+                }
+            }
+        } else if (code == PCAPNG_OPT_IF_TSOFFSET && opt_len == 8) {
+            i->offset = (int64_t)pcap_reader_get64(r, p + pos);
+        }
+        pos += (opt_len + 3) & ~3u;
+    }
+    r->num_ifs++;
+    return ok;
+}
+
+/*
+ * read the next block of a pcapng file; returns 1 if it is a packet,
+ * which goes into hdr and *packet, 0 if it is not, and -1 at the end
+ * of the file, on error, or if the burst must end
+ */
+static int pcap_reader_pcapng_block (pcap_reader_t r, struct pcap_pkthdr *hdr, const unsigned char **packet) {
+    const unsigned char *p = pcap_reader_peek(r, PCAPNG_BLOCK_HDR_LEN + 4);
+    uint32_t type;
+    uint32_t len;
+    uint32_t body;
+    const pcap_reader_if_t *i = NULL;
+    uint32_t if_id = 0;
+    uint64_t ts = 0;
+    uint32_t caplen;
+    uint32_t pkt_off;
+    int rc = 0;
+
+    if (p == NULL) {
+        return -1;
+    }
+    memcpy(&type, p, sizeof(type));
+    if (type == PCAPNG_SHB) {
+        /* a new section, maybe with the other byte order */
+        uint32_t bom;
+
+        memcpy(&bom, p + PCAPNG_BLOCK_HDR_LEN, sizeof(bom));
+        if (bom == PCAPNG_BYTE_ORDER_MAGIC) {
+            r->swapped = 0;
+        } else if (bom == pcap_reader_swap32(PCAPNG_BYTE_ORDER_MAGIC)) {
+            r->swapped = 1;
+        } else {
+            joy_log_err("corrupt pcapng file: bad byte order magic");
+            r->error = 1;
+            return -1;
+        }
+    } else {
+        type = pcap_reader_get32(r, p);
+    }
+    len = pcap_reader_get32(r, p + 4);
+    if (len < PCAPNG_BLOCK_HDR_LEN + PCAPNG_BLOCK_TRAILER_LEN || (len & 3) || len > PCAP_READER_MAX_BLOCK) {
+        joy_log_err("corrupt pcapng file: block of %u bytes", len);
+        r->error = 1;
+        return -1;
+    }
+    p = pcap_reader_peek(r, len);
+    if (p == NULL) {
+        return -1;
+    }
+    body = len - PCAPNG_BLOCK_HDR_LEN - PCAPNG_BLOCK_TRAILER_LEN;
+
+    switch (type) {
+    case PCAPNG_SHB:
+        if (body < PCAPNG_SHB_LEN) {
+            goto corrupt;
+        }
+        r->num_ifs = 0;
+        break;
+    case PCAPNG_IDB:
+        if (body < PCAPNG_IDB_LEN) {
+            goto corrupt;
+        }
+        if (pcap_reader_pcapng_if(r, p, len) != ok) {
+            return -1;
+        }
+        break;
+    case PCAPNG_EPB:
+    case PCAPNG_PB:
+        if (body < PCAPNG_EPB_LEN) {
+            goto corrupt;
+        }
+        if (type == PCAPNG_EPB) {
+            if_id = pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN);
+        } else {
+            if_id = pcap_reader_get16(r, p + PCAPNG_BLOCK_HDR_LEN);
+        }
+        ts = ((uint64_t)pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN + 4) << 32) |
+             pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN + 8);
+        caplen = pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN + 12);
+        hdr->len = pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN + 16);
+        pkt_off = PCAPNG_BLOCK_HDR_LEN + PCAPNG_EPB_LEN;
+        if (if_id >= r->num_ifs || caplen > body - PCAPNG_EPB_LEN) {
+            goto corrupt;
+        }
+        i = &r->ifs[if_id];
+        rc = 1;
+        break;
+    case PCAPNG_SPB:
+        if (body < PCAPNG_SPB_LEN || r->num_ifs == 0) {
+            goto corrupt;
+        }
+        i = &r->ifs[0];
+        hdr->len = pcap_reader_get32(r, p + PCAPNG_BLOCK_HDR_LEN);
+        caplen = body - PCAPNG_SPB_LEN;
+        if (caplen > hdr->len) {
+            caplen = hdr->len;
+        }
+        if (i->snaplen && caplen > i->snaplen) {
+            caplen = i->snaplen;
+        }
+        pkt_off = PCAPNG_BLOCK_HDR_LEN + PCAPNG_SPB_LEN;
+        rc = 1;
+        break;
+    default:
+        break;
+    }
+
+    if (rc == 1) {
+        if (caplen > PCAP_READER_MAX_SNAPLEN) {
+            goto corrupt;
+        }
+        hdr->ts.tv_sec = (time_t)(ts / i->units + i->offset);
+        hdr->ts.tv_usec = pcap_reader_usec(ts % i->units, i->units);
+        hdr->caplen = caplen;
+        *packet = p + pkt_off;
+    }
+    pcap_reader_skip(r, len);
+    return rc;
+
+ corrupt:
+    joy_log_err("corrupt pcapng file: bad block of type %u", type);
+    r->error = 1;
+    return -1;
+}
+
+/*
+ * the reader
+ */
+
+/* set up reading the file through the reading thread */
+static int pcap_reader_start_thread (pcap_reader_t r, const char *fname, char *errbuf) {
+    unsigned int i;
+
+    r->z = zread_open(fname);
+    if (r->z == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "could not open %s for reading", fname);
+        return failure;
+    }
+    for (i = 0; i < PCAP_READER_NUM_BUFS; i++) {
+        r->bufs[i].data = calloc(1, PCAP_READER_BUF_SIZE + PCAP_READER_SLACK);
+        if (r->bufs[i].data == NULL) {
+            snprintf(errbuf, PCAP_ERRBUF_SIZE, "could not allocate the read buffers");
+            return failure;
+        }
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->filled, NULL);
+    pthread_cond_init(&r->emptied, NULL);
+    if (pthread_create(&r->thread, NULL, pcap_reader_thread_main, r) != 0) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "could not start the reading thread");
+        pthread_cond_destroy(&r->emptied);
+        pthread_cond_destroy(&r->filled);
+        pthread_mutex_destroy(&r->lock);
+        return failure;
+    }
+    r->have_thread = 1;
+    return ok;
+}
+
+#ifndef WIN32
+/*
+ * map a plain capture file; fails, setting nothing, if the file is
+ * compressed, or cannot be mapped
+ */
+static int pcap_reader_map (pcap_reader_t r, const char *fname) {
+    struct stat st;
+    uint32_t magic;
+    int fd;
+
+    fd = open(fname, O_RDONLY);
+    if (fd < 0) {
+        return failure;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(magic)) {
+        close(fd);
+        return failure;
+    }
+    r->map_len = (size_t)st.st_size + PCAP_READER_SLACK;
+
+    /* reserve the room for the slack, and map the file over the start of it */
+    r->map = mmap(NULL, r->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->map == MAP_FAILED ||
+        mmap(r->map, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        if (r->map != MAP_FAILED) {
+            munmap(r->map, r->map_len);
+        }
+        close(fd);
+        r->map = NULL;
+        return failure;
+    }
+    close(fd);
+
+    memcpy(&magic, r->map, sizeof(magic));
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC && magic != PCAPNG_SHB &&
+        magic != pcap_reader_swap32(PCAP_MAGIC_USEC) && magic != pcap_reader_swap32(PCAP_MAGIC_NSEC)) {
+        munmap(r->map, r->map_len);
+        r->map = NULL;
+        return failure;
+    }
+
+    /* the file is read once, front to back */
+    madvise(r->map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    r->data = r->map;
+    r->len = (size_t)st.st_size;
+    return ok;
+}
+#endif
+
+/**
+ * \brief Open a capture file for reading.
+ *
+ * A plain file is mapped; a compressed file, or one that cannot be
+ * mapped, is read by a thread of its own.  The file header is read,
+ * and for pcapng the blocks up to the first interface description,
+ * so that the link type is known.
+ *
+ * \param fname The name of the file
+ * \param errbuf Where to write why the file could not be opened,
+ *               PCAP_ERRBUF_SIZE bytes
+ * \return The reader, or NULL on failure
+ */
+pcap_reader_t pcap_reader_open (const char *fname, char *errbuf) {
+    pcap_reader_t r = calloc(1, sizeof(struct pcap_reader_));
+    const unsigned char *p;
+    struct pcap_pkthdr hdr;
+    const unsigned char *packet;
+    uint32_t magic;
+
+    if (r == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "out of memory");
+        return NULL;
+    }
+
+#ifndef WIN32
+    if (pcap_reader_map(r, fname) != ok)
+#endif
+    {
+        if (pcap_reader_start_thread(r, fname, errbuf) != ok) {
+            pcap_reader_close(r);
+            return NULL;
+        }
+    }
+
+    p = pcap_reader_peek(r, sizeof(magic));
+    if (p == NULL) {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", r->error ? "read error" : "empty file");
+        pcap_reader_close(r);
+        return NULL;
+    }
+    memcpy(&magic, p, sizeof(magic));
+    if (magic == PCAPNG_SHB) {
+        r->format = PCAP_READER_PCAPNG;
+        while (r->num_ifs == 0) {
+            if (pcap_reader_pcapng_block(r, &hdr, &packet) != 0) {
+                snprintf(errbuf, PCAP_ERRBUF_SIZE, "no interface description at the start of the pcapng file");
+                pcap_reader_close(r);
+                return NULL;
+            }
+        }
+    } else if (magic == PCAP_MAGIC_USEC || magic == PCAP_MAGIC_NSEC ||
+               magic == pcap_reader_swap32(PCAP_MAGIC_USEC) || magic == pcap_reader_swap32(PCAP_MAGIC_NSEC)) {
+        r->format = PCAP_READER_PCAP;
+        if (pcap_reader_pcap_header(r, errbuf) != ok) {
+            pcap_reader_close(r);
+            return NULL;
+        }
+    } else {
+        snprintf(errbuf, PCAP_ERRBUF_SIZE, "unknown file format");
+        pcap_reader_close(r);
+        return NULL;
+    }
+    return r;
+}
+
+/**
+ * \brief The link type of the packets of a capture file.
+ * \param r The reader
+ * \return The DLT_ value of the link type
+ */
+int pcap_reader_datalink (pcap_reader_t r) {
+    return r->linktype;
+}
+
+/**
+ * \brief Read a burst of packets.
+ *
+ * The burst ends early at the end of the current buffer, so fewer than
+ * max packets does not mean the file has ended; only 0 does.
+ *
+ * \param r The reader
+ * \param b Where the packets go
+ * \param max The most packets to read, up to PCAP_READER_BURST
+ * \return The number of packets read, or 0 at the end of the file or
+ *         on error, see pcap_reader_error()
+ */
+unsigned int pcap_reader_next (pcap_reader_t r, pcap_reader_burst_t *b, unsigned int max) {
+    unsigned int n = 0;
+    int rc;
+
+    if (max > PCAP_READER_BURST) {
+        max = PCAP_READER_BURST;
+    }
+    r->pinned = 0;
+    while (n < max && !r->eof && !r->error) {
+        if (r->format == PCAP_READER_PCAP) {
+            rc = (pcap_reader_pcap_record(r, &b->hdr[n], &b->packets[n]) == ok) ? 1 : -1;
+        } else {
+            rc = pcap_reader_pcapng_block(r, &b->hdr[n], &b->packets[n]);
+        }
+        if (rc < 0) {
+            break;
+        }
+        if (rc == 1) {
+            b->headers[n] = &b->hdr[n];
+            n++;
+            r->pinned = 1;
+        }
+    }
+    return n;
+}
+
+/**
+ * \brief Whether reading stopped on an error.
+ * \param r The reader
+ * \return 1 if pcap_reader_next() returned 0 on an error, otherwise 0
+ */
+int pcap_reader_error (pcap_reader_t r) {
+    return r->error;
+}
+
+/**
+ * \brief Close a reader.
+ * \param r The reader; NULL is ignored
+ * \return none
+ */
+void pcap_reader_close (pcap_reader_t r) {
+    unsigned int i;
+
+    if (r == NULL) {
+        return;
+    }
+    if (r->have_thread) {
+        pthread_mutex_lock(&r->lock);
+        r->stop = 1;
+        pthread_cond_signal(&r->emptied);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->thread, NULL);
+        pthread_cond_destroy(&r->emptied);
+        pthread_cond_destroy(&r->filled);
+        pthread_mutex_destroy(&r->lock);
+    }
+    zread_close(r->z);
+    for (i = 0; i < PCAP_READER_NUM_BUFS; i++) {
+        free(r->bufs[i].data);
+    }
+#ifndef WIN32
+    if (r->map != NULL) {
+        munmap(r->map, r->map_len);
+    }
+#endif
+    free(r->carry);
+    free(r->ifs);
+    free(r);
+}
+
+/*
+ * unit test
+ */
+
+/* the capture file of test/pcaps/ the test packets are taken from */
+#define PCAP_READER_TEST_INPUT "sample.pcap"
+
+/* the files the test writes */
+#define PCAP_READER_TEST_FILE "pcap-reader-unit-test"
+
+/* copies of the test packets in the compressed file, to span many buffers */
+#define PCAP_READER_TEST_COPIES 200
+
+/** a file being put together in memory */
+typedef struct pcap_reader_test_file_ {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+    int swapped;
+} pcap_reader_test_file_t;
+
+/** the packets a file should read back as */
+typedef struct pcap_reader_test_pkts_ {
+    struct pcap_pkthdr *hdr;
+    const unsigned char **packets;
+    unsigned int num;
+} pcap_reader_test_pkts_t;
+
+static void pcap_reader_test_put (pcap_reader_test_file_t *f, const void *data, size_t len) {
+    if (f->len + len > f->size) {
+        size_t size = 2 * (f->len + len);
+        unsigned char *d = realloc(f->data, size);
+
+        if (d == NULL) {
+            return;
+        }
+        f->data = d;
+        f->size = size;
+    }
+    memcpy(f->data + f->len, data, len);
+    f->len += len;
+}
+
+static void pcap_reader_test_put16 (pcap_reader_test_file_t *f, uint16_t v) {
+    v = f->swapped ? pcap_reader_swap16(v) : v;
+    pcap_reader_test_put(f, &v, sizeof(v));
+}
+
+static void pcap_reader_test_put32 (pcap_reader_test_file_t *f, uint32_t v) {
+    v = f->swapped ? pcap_reader_swap32(v) : v;
+    pcap_reader_test_put(f, &v, sizeof(v));
+}
+
+static void pcap_reader_test_put64 (pcap_reader_test_file_t *f, uint64_t v) {
+    v = f->swapped ? pcap_reader_swap64(v) : v;
+    pcap_reader_test_put(f, &v, sizeof(v));
+}
+
+/* a pcapng block of the given type and body, padded to 4 bytes */
+static void pcap_reader_test_block (pcap_reader_test_file_t *f, uint32_t type,
+                                    const pcap_reader_test_file_t *body) {
+    static const unsigned char pad[4] = { 0, 0, 0, 0 };
+    uint32_t len = PCAPNG_BLOCK_HDR_LEN + ((body->len + 3) & ~(size_t)3) + PCAPNG_BLOCK_TRAILER_LEN;
+
+    pcap_reader_test_put32(f, type);
+    pcap_reader_test_put32(f, len);
+    pcap_reader_test_put(f, body->data, body->len);
+    pcap_reader_test_put(f, pad, (4 - (body->len & 3)) & 3);
+    pcap_reader_test_put32(f, len);
+}
+
+/* a pcapng section with two interfaces: microseconds, and nanoseconds offset by a day */
+static void pcap_reader_test_section (pcap_reader_test_file_t *f, const pcap_reader_test_pkts_t *t,
+                                      unsigned int first, unsigned int last) {
+    pcap_reader_test_file_t body;
+    unsigned int i;
+
+    memset_s(&body, sizeof(body), 0x00, sizeof(body));
+    body.swapped = f->swapped;
+
+    pcap_reader_test_put32(&body, PCAPNG_BYTE_ORDER_MAGIC);
+    pcap_reader_test_put16(&body, 1);
+    pcap_reader_test_put16(&body, 0);
+    pcap_reader_test_put64(&body, (uint64_t)-1);
+    pcap_reader_test_block(f, PCAPNG_SHB, &body);
+
+    body.len = 0;
+    pcap_reader_test_put16(&body, DLT_EN10MB);
+    pcap_reader_test_put16(&body, 0);
+    pcap_reader_test_put32(&body, 0);
+    pcap_reader_test_block(f, PCAPNG_IDB, &body);
+
+    body.len = 0;
+    pcap_reader_test_put16(&body, DLT_EN10MB);
+    pcap_reader_test_put16(&body, 0);
+    pcap_reader_test_put32(&body, 65535);
+    pcap_reader_test_put16(&body, PCAPNG_OPT_IF_TSRESOL);
+    pcap_reader_test_put16(&body, 1);
+    pcap_reader_test_put(&body, "\x09\x00\x00\x00", 4);
+    pcap_reader_test_put16(&body, PCAPNG_OPT_IF_TSOFFSET);
+    pcap_reader_test_put16(&body, 8);
+    pcap_reader_test_put64(&body, (uint64_t)-86400);
+    pcap_reader_test_put16(&body, PCAPNG_OPT_ENDOFOPT);
+    pcap_reader_test_put16(&body, 0);
+    pcap_reader_test_block(f, PCAPNG_IDB, &body);
+
+    for (i = first; i < last; i++) {
+        const struct pcap_pkthdr *h = &t->hdr[i];
+        uint64_t ts;
+
+        if (i % 2) {
+            ts = ((uint64_t)h->ts.tv_sec + 86400) * 1000000000 + (uint64_t)h->ts.tv_usec * 1000 + 999;
+        } else {
+            ts = (uint64_t)h->ts.tv_sec * 1000000 + h->ts.tv_usec;
+        }
+        body.len = 0;
+        pcap_reader_test_put32(&body, i % 2);
+        pcap_reader_test_put32(&body, (uint32_t)(ts >> 32));
+        pcap_reader_test_put32(&body, (uint32_t)ts);
+        pcap_reader_test_put32(&body, h->caplen);
+        pcap_reader_test_put32(&body, h->len);
+        pcap_reader_test_put(&body, t->packets[i], h->caplen);
+        pcap_reader_test_block(f, PCAPNG_EPB, &body);
+
+        /* and a block that is skipped, a name resolution block */
+        if (i % 7 == 0) {
+            body.len = 0;
+            pcap_reader_test_put32(&body, 0);
+            pcap_reader_test_block(f, 0x00000004, &body);
+        }
+    }
+    free(body.data);
+}
+
+/* a pcap file with nanosecond timestamps */
+static void pcap_reader_test_pcap_nsec (pcap_reader_test_file_t *f, const pcap_reader_test_pkts_t *t) {
+    unsigned int i;
+
+    pcap_reader_test_put32(f, PCAP_MAGIC_NSEC);
+    pcap_reader_test_put16(f, 2);
+    pcap_reader_test_put16(f, 4);
+    pcap_reader_test_put32(f, 0);
+    pcap_reader_test_put32(f, 0);
+    pcap_reader_test_put32(f, 65535);
+    pcap_reader_test_put32(f, DLT_EN10MB);
+    for (i = 0; i < t->num; i++) {
+        pcap_reader_test_put32(f, (uint32_t)t->hdr[i].ts.tv_sec);
+        pcap_reader_test_put32(f, (uint32_t)t->hdr[i].ts.tv_usec * 1000 + 999);
+        pcap_reader_test_put32(f, t->hdr[i].caplen);
+        pcap_reader_test_put32(f, t->hdr[i].len);
+        pcap_reader_test_put(f, t->packets[i], t->hdr[i].caplen);
+    }
+}
+
+/*
+ * read a file back, in bursts of varying sizes, and count the packets
+ * that differ from copies of the test packets
+ */
+static int pcap_reader_test_read (const char *fname, const pcap_reader_test_pkts_t *t,
+                                  unsigned int copies, unsigned int expected, int expect_error) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    pcap_reader_burst_t *b = malloc(sizeof(pcap_reader_burst_t));
+    pcap_reader_t r = pcap_reader_open(fname, errbuf);
+    unsigned int seen = 0;
+    unsigned int max = 1;
+    unsigned int i, n;
+    int num_fails = 0;
+
+    if (b == NULL || r == NULL) {
+        joy_log_err("could not open %s: %s", fname, (r == NULL) ? errbuf : "out of memory");
+        free(b);
+        pcap_reader_close(r);
+        return 1;
+    }
+    if (pcap_reader_datalink(r) != DLT_EN10MB) {
+        joy_log_err("%s has link type %d", fname, pcap_reader_datalink(r));
+        num_fails++;
+    }
+    while ((n = pcap_reader_next(r, b, max)) > 0) {
+        for (i = 0; i < n; i++, seen++) {
+            const struct pcap_pkthdr *h = &t->hdr[seen % t->num];
+
+            if (seen >= copies * t->num || b->headers[i]->ts.tv_sec != h->ts.tv_sec ||
+                b->headers[i]->ts.tv_usec != h->ts.tv_usec || b->headers[i]->caplen != h->caplen ||
+                b->headers[i]->len != h->len ||
+                memcmp(b->packets[i], t->packets[seen % t->num], h->caplen) != 0) {
+                num_fails++;
+            }
+        }
+        max = (max * 7 + 3) % PCAP_READER_BURST + 1;
+    }
+    if (seen != expected || pcap_reader_error(r) != expect_error) {
+        joy_log_err("%s: read %u of %u packets, error %d", fname, seen, expected, pcap_reader_error(r));
+        num_fails++;
+    }
+    pcap_reader_close(r);
+    free(b);
+    return num_fails;
+}
+
+/* write a file, compressed or not */
+static int pcap_reader_test_write (const char *fname, const pcap_reader_test_file_t *f,
+                                   size_t len, unsigned int compression) {
+    zfile z = zopen_compressed(fname, "w", compression, 1, 1);
+    int rc = ok;
+
+    if (z == NULL) {
+        joy_log_err("could not open %s", fname);
+        return failure;
+    }
+    if (zwrite(z, f->data, (unsigned int)len) != (int)len) {
+        rc = failure;
+    }
+    if (zclose(z) != 0) {
+        rc = failure;
+    }
+    return rc;
+}
+
+/**
+ * \brief Unit test for the capture file reader.
+ *
+ * The packets of a sample capture are read, and then written out and
+ * read back as a pcap file with nanosecond timestamps in the other
+ * byte order, as a pcapng file with two sections of two interfaces
+ * each, and truncated.  Both are also read back compressed, with many
+ * copies of the packets, so that records span the buffers of the
+ * reading thread.
+ *
+ * \return 0 on success, otherwise the number of failures
+ */
+int pcap_reader_unit_test (void) {
+    char errbuf[PCAP_ERRBUF_SIZE];
+    char fname[64];
+    char input[256];
+    pcap_reader_test_pkts_t t;
+    pcap_reader_test_file_t f;
+    pcap_reader_burst_t *b = NULL;
+    pcap_reader_t r = NULL;
+    unsigned char *data = NULL;
+    unsigned int compression = ZFILE_COMPRESSION_NONE;
+    unsigned int i, n;
+    int num_fails = 0;
+
+    memset_s(&t, sizeof(t), 0x00, sizeof(t));
+    memset_s(&f, sizeof(f), 0x00, sizeof(f));
+
+    if (joy_utils_find_test_pcap(PCAP_READER_TEST_INPUT, input, sizeof(input)) != ok) {
+        fprintf(info, "pcap_reader: test/pcaps/%s not found, test skipped\n", PCAP_READER_TEST_INPUT);
+        return 0;
+    }
+
+    /* the test packets, copied out of the reader */
+    b = malloc(sizeof(pcap_reader_burst_t));
+    r = pcap_reader_open(input, errbuf);
+    if (b == NULL || r == NULL) {
+        joy_log_err("could not open %s: %s", input, errbuf);
+        free(b);
+        pcap_reader_close(r);
+        return 1;
+    }
+    while ((n = pcap_reader_next(r, b, PCAP_READER_BURST)) > 0) {
+        struct pcap_pkthdr *hdr = realloc(t.hdr, (t.num + n) * sizeof(struct pcap_pkthdr));
+
+        if (hdr == NULL) {
+            break;
+        }
+        t.hdr = hdr;
+        for (i = 0; i < n; i++) {
+            t.hdr[t.num + i] = *b->headers[i];
+            pcap_reader_test_put(&f, b->packets[i], b->headers[i]->caplen);
+        }
+        t.num += n;
+    }
+    if (t.num == 0 || pcap_reader_error(r) || f.len == 0) {
+        joy_log_err("could not read %s", input);
+        num_fails++;
+    }
+    pcap_reader_close(r);
+    free(b);
+    data = f.data;
+    t.packets = calloc(t.num ? t.num : 1, sizeof(const unsigned char *));
+    if (num_fails || t.packets == NULL) {
+        free(t.hdr);
+        free(data);
+        return num_fails + 1;
+    }
+    for (i = 0, n = 0; i < t.num; i++) {
+        t.packets[i] = data + n;
+        n += t.hdr[i].caplen;
+    }
+
+    /* gzip is the backend the test of the reading thread uses, when the build has it */
+    if (zcompression_available(ZFILE_COMPRESSION_GZIP)) {
+        compression = ZFILE_COMPRESSION_GZIP;
+    }
+
+    /* pcap, nanoseconds, the other byte order */
+    memset_s(&f, sizeof(f), 0x00, sizeof(f));
+    f.swapped = 1;
+    pcap_reader_test_pcap_nsec(&f, &t);
+    snprintf(fname, sizeof(fname), "%s.pcap", PCAP_READER_TEST_FILE);
+    if (pcap_reader_test_write(fname, &f, f.len, ZFILE_COMPRESSION_NONE) != ok) {
+        num_fails++;
+    }
+    num_fails += pcap_reader_test_read(fname, &t, 1, t.num, 0);
+
+    /* truncated in the last packet */
+    if (pcap_reader_test_write(fname, &f, f.len - 5, ZFILE_COMPRESSION_NONE) != ok) {
+        num_fails++;
+    }
+    num_fails += pcap_reader_test_read(fname, &t, 1, t.num - 1, 1);
+    remove(fname);
+
+    /* and many times over, through the reading thread */
+    n = f.len - PCAP_FILE_HDR_LEN;
+    for (i = 1; i < PCAP_READER_TEST_COPIES; i++) {
+        pcap_reader_test_put(&f, f.data + PCAP_FILE_HDR_LEN, n);
+    }
+    snprintf(fname, sizeof(fname), "%s.pcap%s", PCAP_READER_TEST_FILE, zcompression_suffix(compression));
+    if (pcap_reader_test_write(fname, &f, f.len, compression) != ok) {
+        num_fails++;
+    }
+    num_fails += pcap_reader_test_read(fname, &t, PCAP_READER_TEST_COPIES, PCAP_READER_TEST_COPIES * t.num, 0);
+    remove(fname);
+
+    /* pcapng, a section in each byte order */
+    f.len = 0;
+    f.swapped = 0;
+    pcap_reader_test_section(&f, &t, 0, t.num / 2);
+    f.swapped = 1;
+    pcap_reader_test_section(&f, &t, t.num / 2, t.num);
+    snprintf(fname, sizeof(fname), "%s.pcapng", PCAP_READER_TEST_FILE);
+    if (pcap_reader_test_write(fname, &f, f.len, ZFILE_COMPRESSION_NONE) != ok) {
+        num_fails++;
+    }
+    num_fails += pcap_reader_test_read(fname, &t, 1, t.num, 0);
+    remove(fname);
+
+    /* and many times over, through the reading thread */
+    n = f.len;
+    for (i = 1; i < PCAP_READER_TEST_COPIES; i++) {
+        pcap_reader_test_put(&f, f.data, n);
+    }
+    snprintf(fname, sizeof(fname), "%s.pcapng%s", PCAP_READER_TEST_FILE, zcompression_suffix(compression));
+    if (pcap_reader_test_write(fname, &f, f.len, compression) != ok) {
+        num_fails++;
+    }
+    num_fails += pcap_reader_test_read(fname, &t, PCAP_READER_TEST_COPIES, PCAP_READER_TEST_COPIES * t.num, 0);
+    remove(fname);
+
+    free(f.data);
+    free(t.packets);
+    free(t.hdr);
+    free(data);
+    return num_fails;
+}
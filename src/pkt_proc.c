@@ -67,6 +67,14 @@ static u_short num_templates = 0;
 
 pthread_mutex_t nfv9_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* whether sequence number a comes before b, allowing for wrap around */
+#define tcp_seq_lt(a, b) ((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+/* sequence numbers taken up by a segment with length bytes of data */
+static uint32_t tcp_seq_space (const struct tcp_hdr *tcp, unsigned int length) {
+    return length + ((tcp->tcp_flags & TCP_SYN) ? 1 : 0) + ((tcp->tcp_flags & TCP_FIN) ? 1 : 0);
+}
+
 /*
  * re-implement this function to handle SPLT properly by itself. SALT
  * is handled by the function feature update function in the feature module.
@@ -88,32 +96,63 @@ static void flow_record_process_packet_length_and_time_ack (flow_record_t *recor
      * This is the "raw" case from the original function below
      */
     if (glb_config->include_zeroes || (length != 0)) {
-        record->pkt_len[record->op] = length;
-        record->pkt_time[record->op] = *time;
-        record->op++;
+        flow_record_update_splt(record, length, time);
     }
 
-    record->pkt_flags[record->op] = tcp->tcp_flags;
+    if (record->splt != NULL) {
+        record->splt->pkt_flags[record->op] = tcp->tcp_flags;
+    }
     record->tcp.seq = ntohl(tcp->tcp_seq);
     record->tcp.ack = ntohl(tcp->tcp_ack);
 
-    /* store the sequence number and length into the retransmission buffer */
-    record->tcp_retrans[record->tcp_retrans_tail].seq = ntohl(tcp->tcp_seq);
-    record->tcp_retrans[record->tcp_retrans_tail].len = length;
-    record->tcp_retrans_tail++;
-    if (record->tcp_retrans_tail == MAX_TCP_RETRANS_BUFFER) {
-        /* go back to the beginning of the buffer */
-        record->tcp_retrans_tail = 0;
+    /*
+     * while no segment leaves a gap after the data before it, the data
+     * seen so far is one range of sequence numbers, and nothing needs
+     * to be stored; SYN and FIN take up one sequence number each
+     */
+    if (!record->tcp.order_seen) {
+        record->tcp.order_start = record->tcp.seq;
+        record->tcp.order_end = record->tcp.seq;
+        record->tcp.order_seen = 1;
+    }
+    if (record->retrans == NULL && !tcp_seq_lt(record->tcp.seq, record->tcp.order_start)
+        && !tcp_seq_lt(record->tcp.order_end, record->tcp.seq)) {
+        uint32_t end = record->tcp.seq + tcp_seq_space(tcp, length);
+
+        if (end == record->tcp.seq) {
+            record->tcp.order_empty = (record->tcp.seq == record->tcp.order_end);
+        } else if (tcp_seq_lt(record->tcp.order_end, end)) {
+            record->tcp.order_end = end;
+            record->tcp.order_empty = 0;
+        }
+        return;
+    }
+
+    /* out of order; store the sequence number and length into the retransmission buffer */
+    if (flow_record_attach_retrans(record) != NULL) {
+        flow_retrans_t *retrans = record->retrans;
+
+        retrans->seg[retrans->tail].seq = record->tcp.seq;
+        retrans->seg[retrans->tail].len = length;
+        retrans->tail++;
+        if (retrans->tail == MAX_TCP_RETRANS_BUFFER) {
+            /* go back to the beginning of the buffer */
+            retrans->tail = 0;
+        }
     }
 }
 
 /*
  * This function checks the various data features to see if enough
  * data has been collected in the flow record to satisfy the requirments
- * for reporting on that data feature.
+ * for reporting on that data feature, and puts the flow on the queues
+ * of the external processing calls that it has become ready for.
  */
 static void flow_record_set_feature_ready_flags (joy_ctx_data *ctx, flow_record_t *rec)
 {
+    flow_record_t *head;
+    unsigned int queue;
+
     /* check IDP feature */
     if ((!(rec->feature_flags & JOY_IDP_READY)) && (rec->idp_len > 0)) {
         rec->feature_flags |= JOY_IDP_READY;
@@ -150,6 +189,15 @@ static void flow_record_set_feature_ready_flags (joy_ctx_data *ctx, flow_record_
         rec->feature_flags |= JOY_BD_READY;
         ++ctx->bd_recs_ready;
     }
+
+    /* queue the flow for the external processing calls it is now ready for */
+    head = flow_record_chrono_head(ctx, rec);
+    for (queue = FLOW_QUEUE_IDP; queue <= FLOW_QUEUE_BD; queue++) {
+        if (ctx->flow_queue[queue].active &&
+            flow_record_is_ready(head, queue, ctx->flow_queue[queue].min)) {
+            flow_queue_push(ctx, head, queue);
+        }
+    }
 }
 
 /*
@@ -420,8 +468,9 @@ static joy_status_e process_nfv9 (joy_ctx_data *ctx,
 /*
  * Function: retrans_detected
  *
- * Description: This function looks over the last 10 stored TCP sequence numbers
- *         to see if we have a retransmitted TCP packet.
+ * Description: This function looks over the last 10 stored TCP sequence numbers,
+ *         and the data the flow sent in order before it stored any, to see if
+ *         we have a retransmitted TCP packet.
  *
  * Parameters:
  *         rec - pointer to the flow record
@@ -434,18 +483,48 @@ static joy_status_e process_nfv9 (joy_ctx_data *ctx,
  *         2 - retransmission with new data detected
  */
 static int retrans_detected (flow_record_t *rec, uint32_t seq_num, uint16_t len) {
+    tcp_retrans_t *seg;
     int i;
     int rc = 0;
 
+    /*
+     * data that starts within the data sent in order has been seen, as
+     * has data at the sequence number of an empty segment, which is
+     * counted as a zero length segment would be in the stored array
+     */
+    if (rec->tcp.order_seen && !tcp_seq_lt(seq_num, rec->tcp.order_start)
+        && (tcp_seq_lt(seq_num, rec->tcp.order_end)
+            || (rec->tcp.order_empty && seq_num == rec->tcp.order_end))) {
+        if (tcp_seq_lt(rec->tcp.order_end, seq_num + len)) {
+            joy_log_debug("Retransmission with new data detected! "
+                         "SEQ(%d), LEN(%d)", seq_num, len);
+            /* the new data is seen now, like the length update below */
+            if (rec->retrans == NULL) {
+                rec->tcp.order_end = seq_num + len;
+                rec->tcp.order_empty = 0;
+            }
+            return 2;
+        }
+        joy_log_debug("Retransmission detected! "
+                     "SEQ(%d), LEN(%d)", seq_num, len);
+        return 1;
+    }
+
+    /* nothing has been stored for this flow yet */
+    if (rec->retrans == NULL) {
+        return 0;
+    }
+    seg = rec->retrans->seg;
+
     /* look for the sequence number in the stored array */
     for (i=0; i < MAX_TCP_RETRANS_BUFFER; ++i) {
-        if (rec->tcp_retrans[i].seq == seq_num) {
-            if (rec->tcp_retrans[i].len < len) {
+        if (seg[i].seq == seq_num) {
+            if (seg[i].len < len) {
                 joy_log_debug("Retransmission with new data detected! "
                              "SEQ(%d), Orig LEN(%d), New LEN (%d)",
-                             seq_num, rec->tcp_retrans[i].len, len);
+                             seq_num, seg[i].len, len);
                 /* update length with new length */
-                rec->tcp_retrans[i].len = len;
+                seg[i].len = len;
                 rc = 2;
             } else {
                 joy_log_debug("Retransmission detected! "
@@ -646,9 +725,7 @@ process_udp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *ud
     }
     if (record->op < MAX_NUM_PKT_LEN) {
         if (glb_config->include_zeroes || (size_payload != 0)) {
-            record->pkt_len[record->op] = size_payload;
-            record->pkt_time[record->op] = header->ts;
-            record->op++;
+            flow_record_update_splt(record, size_payload, &header->ts);
         }
     }
     record->ob += size_payload;
@@ -723,9 +800,7 @@ process_icmp (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const char *s
     }
     if (record->op < MAX_NUM_PKT_LEN) {
         if (glb_config->include_zeroes || (size_payload != 0)) {
-            record->pkt_len[record->op] = size_payload;
-            record->pkt_time[record->op] = header->ts;
-            record->op++;
+            flow_record_update_splt(record, size_payload, &header->ts);
         }
     }
     record->ob += size_payload;
@@ -756,9 +831,7 @@ process_ip (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const void *ip_
     }
     if (record->op < MAX_NUM_PKT_LEN) {
         if (glb_config->include_zeroes || (size_payload != 0)) {
-            record->pkt_len[record->op] = size_payload;
-            record->pkt_time[record->op] = header->ts;
-            record->op++;
+            flow_record_update_splt(record, size_payload, &header->ts);
         }
     }
     record->ob += size_payload;
@@ -771,33 +844,37 @@ process_ip (joy_ctx_data *ctx, const struct pcap_pkthdr *header, const void *ip_
     return record;
 }
 
+/*
+ * What parsing the frame and IP headers of a packet finds out.
+ * process_packet_burst() parses each packet once, to hash its flow
+ * key, and hands the result on to process_parsed_packet().
+ */
+typedef struct pkt_parse {
+    flow_key_t key;                /* addresses and protocol; the ports are left to the transport */
+    uint16_t ip_type;              /* ETH_TYPE_IP or ETH_TYPE_IPV6 */
+    uint16_t frame_hdr_len;        /* Ethernet and VLAN headers */
+    ip_hdr_t *ip;
+    ip_hdrv6_t *ipv6;
+    unsigned int ip_hdr_len;
+    unsigned int ipv6_ext_hdrs;
+    uint16_t ip_len;               /* IP length, cut to what was captured */
+    const void *transport_start;
+    unsigned int transport_len;
+} pkt_parse_t;
+
 /**
- * \fn int get_packet_5tuple_key (const unsigned char *packet,
-                               flow_key_t *key)
+ * \fn uint8_t pkt_parse_frame (const unsigned char *packet, pkt_parse_t *p)
+ * \brief Find the IP header behind the Ethernet and 802.1q/802.1ad headers.
  * \param packet pointer to the packet
- * \param key pointer to the key structure to be filled in
- * \return 0 - failed, 1 - success
+ * \param p the parse to fill in
+ * \return 0 - not an IP packet, 1 - success
  */
-uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
-    uint8_t rc = 0;
+static uint8_t pkt_parse_frame (const unsigned char *packet, pkt_parse_t *p) {
     uint16_t ether_type = 0;
-    uint16_t real_ip_type = 0;
     uint16_t vlan_ether_type = 0;
     uint16_t vlan2_ether_type = 0;
-    ip_hdr_t *ip = NULL;
-    ip_hdrv6_t *ipv6 = NULL;
-    unsigned int ip_hdr_len = 0;
-    int ipv6_ext_hdrs = 0;
-    const void *transport_start = NULL;
 
-    /* clear the key structure */
-    memset_s(key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
-
-    /* make sure we have a packet */
-    if (packet == NULL) {
-        joy_log_err(" NULL packet passed in");
-        return rc;
-    }
+    memset_s(p, sizeof(pkt_parse_t), 0x00, sizeof(pkt_parse_t));
 
     ether_type = ntohs(*(const uint16_t *)(packet + 12));//Offset to get ETH_TYPE
 
@@ -807,15 +884,17 @@ uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
     switch(ether_type) {
        case ETH_TYPE_IP:
            joy_log_info("Ethernet type - IP");
-           ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN);
-           ip_hdr_len = ip_hdr_length(ip);
-           real_ip_type = ETH_TYPE_IP;
+           p->ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN);
+           p->ip_hdr_len = ip_hdr_length(p->ip);
+           p->ip_type = ETH_TYPE_IP;
+           p->frame_hdr_len = ETHERNET_HDR_LEN;
            break;
        case ETH_TYPE_IPV6:
            joy_log_info("Ethernet type - IPv6");
-           ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN);
-           ip_hdr_len = IPV6_HDR_LENGTH;
-           real_ip_type = ETH_TYPE_IPV6;
+           p->ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN);
+           p->ip_hdr_len = IPV6_HDR_LENGTH;
+           p->ip_type = ETH_TYPE_IPV6;
+           p->frame_hdr_len = ETHERNET_HDR_LEN;
            break;
        case ETH_TYPE_DOT1Q:
        case ETH_TYPE_QNQ:
@@ -825,15 +904,17 @@ uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
            switch(vlan_ether_type) {
                case ETH_TYPE_IP:
                    joy_log_info("Ethernet type - IP with VLAN #1");
-                   ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
-                   ip_hdr_len = ip_hdr_length(ip);
-                   real_ip_type = ETH_TYPE_IP;
+                   p->ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
+                   p->ip_hdr_len = ip_hdr_length(p->ip);
+                   p->ip_type = ETH_TYPE_IP;
+                   p->frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN;
                    break;
                case ETH_TYPE_IPV6:
                    joy_log_info("Ethernet type - IPv6");
-                   ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
-                   ip_hdr_len = IPV6_HDR_LENGTH;
-                   real_ip_type = ETH_TYPE_IPV6;
+                   p->ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
+                   p->ip_hdr_len = IPV6_HDR_LENGTH;
+                   p->ip_type = ETH_TYPE_IPV6;
+                   p->frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN;
                    break;
                case ETH_TYPE_DOT1Q:
                case ETH_TYPE_QNQ:
@@ -843,98 +924,113 @@ uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
                    switch(vlan2_ether_type) {
                        case ETH_TYPE_IP:
                            joy_log_info("Ethernet type - IP with 802.1q VLAN #2");
-                           ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
-                           ip_hdr_len = ip_hdr_length(ip);
-                           real_ip_type = ETH_TYPE_IP;
+                           p->ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
+                           p->ip_hdr_len = ip_hdr_length(p->ip);
+                           p->ip_type = ETH_TYPE_IP;
+                           p->frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN;
                            break;
                        case ETH_TYPE_IPV6:
                            joy_log_info("Ethernet type - IPv6");
-                           ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
-                           ip_hdr_len = IPV6_HDR_LENGTH;
-                           real_ip_type = ETH_TYPE_IPV6;
+                           p->ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
+                           p->ip_hdr_len = IPV6_HDR_LENGTH;
+                           p->ip_type = ETH_TYPE_IPV6;
+                           p->frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN;
                            break;
                        default :
                            joy_log_info("Ethernet type - Unknown with 802.1q VLAN #2");
-                           return rc;
+                           return 0;
                    }
                    break;
                default :
                    joy_log_info("Ethernet type - Unknown with 802.1q VLAN #1");
-                   return rc;
+                   return 0;
            }
            break;
        default:
-           return rc;
+           return 0;
     }
 
-    if (real_ip_type == ETH_TYPE_IP) {
-        if (ntohs(ip->ip_len) < sizeof(ip_hdr_t)) {
-            joy_log_err("Malformed IP packet");
-            return rc;
-        }
-    }
+    return 1;
+}
 
-    /* we are able to fill out the key structure */
-    if (real_ip_type == ETH_TYPE_IPV6) {
+/**
+ * \fn uint8_t pkt_parse_key (pkt_parse_t *p, unsigned int ip_len)
+ * \brief Fill in the addresses and protocol of the flow key.
+ *
+ * IPv6 extension headers are skipped up to the upper layer protocol,
+ * reading the packet but never writing it, so it can be parsed again.
+ *
+ * \param p the parse, after pkt_parse_frame()
+ * \param ip_len bytes of the IP packet that may be read
+ * \return 0 - failed, 1 - success
+ */
+static uint8_t pkt_parse_key (pkt_parse_t *p, unsigned int ip_len) {
+
+    if (p->ip_type == ETH_TYPE_IPV6) {
         bool done = 0;
-        char *ext_hdr = NULL;
+        const char *ext_hdr = NULL;
+        uint8_t nxh = p->ipv6->ip_nxh;
 
-        ipv6_ext_hdrs = 0;
-        memcpy_s(&key->sa.v6_sa, sizeof(uint32_t)*4, &ipv6->ip_src, sizeof(uint32_t)*4);
-        memcpy_s(&key->da.v6_da, sizeof(uint32_t)*4, &ipv6->ip_dst, sizeof(uint32_t)*4);
+        memcpy_s(&p->key.sa.v6_sa, sizeof(uint32_t)*4, &p->ipv6->ip_src, sizeof(uint32_t)*4);
+        memcpy_s(&p->key.da.v6_da, sizeof(uint32_t)*4, &p->ipv6->ip_dst, sizeof(uint32_t)*4);
 
         /* loop through IPv6 headers until we find an upper layer protocol */
         while (!done) {
-            switch (ipv6->ip_nxh) {
+            switch (nxh) {
                 case IPPROTO_HOPOPTS:
                 case IPPROTO_ROUTING:
                 case IPPROTO_FRAGMENT:
                 case IPPROTO_ESP:
                 case IPPROTO_AH:
                 case IPPROTO_DSTOPTS:
-                    ext_hdr = (char*)ipv6 + IPV6_HDR_LENGTH + (ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
-                    ipv6->ip_nxh = *ext_hdr;
-                    ++ipv6_ext_hdrs;
+                    if (ip_len < IPV6_HDR_LENGTH + ((p->ipv6_ext_hdrs + 1) * IPV6_EXT_HDR_LEN)) {
+                        /*
+                         * extension headers run past the end of the packet
+                         */
+                        return 0;
+                    }
+                    ext_hdr = (const char*)p->ipv6 + IPV6_HDR_LENGTH + (p->ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
+                    nxh = *ext_hdr;
+                    ++p->ipv6_ext_hdrs;
                     break;
 
                 case IPPROTO_NONE:
                     joy_log_info("Dropping packet, no upper layer protocol found");
-                    return rc;
+                    return 0;
 
                 default:
                     done = 1;
-                    key->prot = ipv6->ip_nxh;
+                    p->key.prot = nxh;
                     break;
             }
         }
-    } else if (real_ip_type == ETH_TYPE_IP) {
-        if (ip_is_fragment(ip) == 0) {
+    } else {
+        if (ip_is_fragment(p->ip) == 0) {
             /* fill out IP-specific fields of flow key, plus proto selector */
-            key->sa.v4_sa = ip->ip_src;
-            key->da.v4_da = ip->ip_dst;
-            key->prot = ip->ip_prot;
-
+            p->key.sa.v4_sa = p->ip->ip_src;
+            p->key.da.v4_da = p->ip->ip_dst;
+            p->key.prot = p->ip->ip_prot;
         }  else {
             /*
              * select IP processing, since we don't have a TCP or UDP header
              */
-            key->sa.v4_sa = ip->ip_src;
-            key->da.v4_da = ip->ip_dst;
-            key->prot = IPPROTO_IP;
+            p->key.sa.v4_sa = p->ip->ip_src;
+            p->key.da.v4_da = p->ip->ip_dst;
+            p->key.prot = IPPROTO_IP;
         }
-    } else {
-        /* couldn't figure out the packet type */
-        return rc;
     }
 
-    /* determine transport length and start */
-    rc = 1;
-    if (real_ip_type == ETH_TYPE_IPV6) {
-        transport_start = (char *)ipv6 + ip_hdr_len + (ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
-    } else {
-        transport_start = (char *)ip + ip_hdr_len;
-    }
+    return 1;
+}
 
+/**
+ * \fn void pkt_parse_ports (flow_key_t *key, const void *transport_start)
+ * \brief Fill in the ports of a TCP or UDP flow key.
+ * \param key the flow key, with its protocol filled in
+ * \param transport_start the transport header
+ * \return none
+ */
+static void pkt_parse_ports (flow_key_t *key, const void *transport_start) {
     if (key->prot == IPPROTO_TCP) {
         const struct tcp_hdr *tcp = (const struct tcp_hdr *)transport_start;
         key->sp = ntohs(tcp->src_port);
@@ -947,177 +1043,91 @@ uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
         key->sp = 0;
         key->dp = 0;
     }
-
-    return rc;
 }
 
 /**
- * \fn void* process_packet (unsigned char *ctx_ptr,
-                            const struct pcap_pkthdr *pkt_header,
-                            const unsigned char *packet)
- * \param ctx_ptr currently used to store the context data pointer
- * \param pkt_header pointer to the packer header structure
+ * \fn int get_packet_5tuple_key (const unsigned char *packet,
+                               flow_key_t *key)
  * \param packet pointer to the packet
- * \return pointer to the flow record
+ * \param key pointer to the key structure to be filled in
+ * \return 0 - failed, 1 - success
  */
-void* process_packet (unsigned char *ctx_ptr,
-                     const struct pcap_pkthdr *pkt_header,
-                     const unsigned char *packet) {
-    flow_record_t *record = NULL;
-    bool allocated_packet_header = 0;
-    uint16_t ether_type = 0,vlan_ether_type = 0, vlan2_ether_type = 0;
-    char ipv4_addr[INET_ADDRSTRLEN];
-    char ipv6_addr[INET6_ADDRSTRLEN];
-    const struct pcap_pkthdr *header =  pkt_header;
-    struct pcap_pkthdr *dyn_header = NULL;
+uint8_t get_packet_5tuple_key (const unsigned char *packet, flow_key_t *key) {
+    pkt_parse_t p;
+    unsigned int ip_len = 0;
 
-    /* declare pointers to packet headers */
-    ip_hdr_t *ip = NULL;
-    ip_hdrv6_t *ipv6 = NULL;
-    unsigned int transport_len = 0;
-    unsigned int ip_hdr_len = 0;
-    const void *transport_start = NULL;
-    flow_key_t key;
-    uint16_t ip_len = 0;
-    uint8_t ipv6_ext_hdrs = 0;
-    uint16_t tot_frame_hdr_len = 0;
+    /* clear the key structure */
+    memset_s(key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
 
-    /* grab the context for this packet */
-    joy_ctx_data *ctx = (joy_ctx_data*)ctx_ptr;
-    if (ctx == NULL) {
-        joy_log_err("NULL Data Context Pointer");
-        return NULL;
+    /* make sure we have a packet */
+    if (packet == NULL) {
+        joy_log_err(" NULL packet passed in");
+        return 0;
     }
 
-    memset_s(&key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+    if (!pkt_parse_frame(packet, &p)) {
+        return 0;
+    }
 
-    flocap_stats_incr_num_packets(ctx);
-    joy_log_info("++++++++++ Packet %lu ++++++++++", ctx->stats.num_packets);
-    //  packet_count++;
+    /* without the pcap header, the IP header is all there is to go on */
+    if (p.ip_type == ETH_TYPE_IP) {
+        ip_len = ntohs(p.ip->ip_len);
+        if (ip_len < sizeof(ip_hdr_t)) {
+            joy_log_err("Malformed IP packet");
+            return 0;
+        }
+    } else {
+        ip_len = ntohs(p.ipv6->ip_len) + IPV6_HDR_LENGTH;
+    }
 
-    // ethernet = (struct ethernet_hdr*)(packet);
-    ether_type = ntohs(*(const uint16_t *)(packet + 12));//Offset to get ETH_TYPE
-    ctx->curr_pkt_type = 0;
-    /* Support for both normal ethernet, 802.1q and 802.1ad. Distinguish between 
-     * the three accepted types
-    */
-    switch(ether_type) {
-       case ETH_TYPE_IP:
-           joy_log_info("Ethernet type - IP");
-           ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN);
-           ip_hdr_len = ip_hdr_length(ip);
-           ctx->curr_pkt_type = ETH_TYPE_IP;
-           tot_frame_hdr_len = ETHERNET_HDR_LEN;
-           break;
-       case ETH_TYPE_IPV6:
-           joy_log_info("Ethernet type - IPv6");
-           ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN);
-           ip_hdr_len = IPV6_HDR_LENGTH;
-           ctx->curr_pkt_type = ETH_TYPE_IPV6;
-           tot_frame_hdr_len = ETHERNET_HDR_LEN;
-           break;
-       case ETH_TYPE_DOT1Q:
-       case ETH_TYPE_QNQ:
-           joy_log_info("Ethernet type - 802.1q VLAN #1");
-           //Offset to get VLAN_TYPE
-           vlan_ether_type = ntohs(*(const uint16_t *)(packet + ETHERNET_HDR_LEN + 2));
-           switch(vlan_ether_type) {
-               case ETH_TYPE_IP:
-                   joy_log_info("Ethernet type - IP with VLAN #1");
-                   ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
-                   ip_hdr_len = ip_hdr_length(ip);
-                   ctx->curr_pkt_type = ETH_TYPE_IP;
-                   tot_frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN;
-                   break;
-               case ETH_TYPE_IPV6:
-                   joy_log_info("Ethernet type - IPv6");
-                   ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN);
-                   ip_hdr_len = IPV6_HDR_LENGTH;
-                   ctx->curr_pkt_type = ETH_TYPE_IPV6;
-                   tot_frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN;
-                   break;
-               case ETH_TYPE_DOT1Q:
-               case ETH_TYPE_QNQ:
-                   joy_log_info("Ethernet type - 802.1q VLAN #2");
-                    //Offset to get VLAN_TYPE
-                   vlan2_ether_type = ntohs(*(const uint16_t *)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + 2));
-                   switch(vlan2_ether_type) {
-                       case ETH_TYPE_IP:
-                           joy_log_info("Ethernet type - IP with 802.1q VLAN #2");
-                           ip = (ip_hdr_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
-                           ip_hdr_len = ip_hdr_length(ip);
-                           ctx->curr_pkt_type = ETH_TYPE_IP;
-                           tot_frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN;
-                           break;
-                       case ETH_TYPE_IPV6:
-                           joy_log_info("Ethernet type - IPv6");
-                           ipv6 = (ip_hdrv6_t*)(packet + ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN);
-                           ip_hdr_len = IPV6_HDR_LENGTH;
-                           ctx->curr_pkt_type = ETH_TYPE_IPV6;
-                           tot_frame_hdr_len = ETHERNET_HDR_LEN + DOT1Q_HDR_LEN + DOT1Q_HDR_LEN;
-                           break;
-                       default :
-                           joy_log_info("Ethernet type - Unknown with 802.1q VLAN #2");
-                           return NULL;
-                   }
-                   break;
-               default :
-                   joy_log_info("Ethernet type - Unknown with 802.1q VLAN #1");
-                   return NULL;
-           }
-           break;
-       default:
-           return NULL;
-    }  
-    
-    /* sanity check the IPv4 header */
-    if ((ctx->curr_pkt_type == ETH_TYPE_IP) && (ip_hdr_len < 20)) {
-        joy_log_err(" Invalid IP header length: %u bytes", ip_hdr_len);
-        return NULL;
+    /* we are able to fill out the key structure */
+    if (!pkt_parse_key(&p, ip_len)) {
+        return 0;
     }
+    *key = p.key;
 
-    /* make sure we have a valid packet header */
-    if (header == NULL) {
-        struct timeval now;
+    /* determine transport start */
+    if (p.ip_type == ETH_TYPE_IPV6) {
+        pkt_parse_ports(key, (char *)p.ipv6 + p.ip_hdr_len + (p.ipv6_ext_hdrs * IPV6_EXT_HDR_LEN));
+    } else {
+        pkt_parse_ports(key, (char *)p.ip + p.ip_hdr_len);
+    }
 
-        dyn_header = (struct pcap_pkthdr*) calloc(1,sizeof(struct pcap_pkthdr));
-        if (dyn_header == NULL) {
-            joy_log_err(" Couldn't allocate memory for packet header.");
-            return NULL;
-        }
-        allocated_packet_header = 1;
-        gettimeofday(&now,NULL);
-        dyn_header->ts.tv_sec = now.tv_sec;
-        dyn_header->ts.tv_usec = now.tv_usec;
-        if (ctx->curr_pkt_type == ETH_TYPE_IPV6) {
-            dyn_header->caplen = ipv6->ip_len + IPV6_HDR_LENGTH;
-            dyn_header->len = ipv6->ip_len + IPV6_HDR_LENGTH;
-        } else {
-            dyn_header->caplen = ip->ip_len;
-            dyn_header->len = ip->ip_len;
-        }
-        header = dyn_header;
+    return 1;
+}
+
+/**
+ * \fn uint8_t pkt_parse_ip (pkt_parse_t *p, const struct pcap_pkthdr *header)
+ * \brief Check the IP header against what was captured, then find the
+ *        flow key and the transport data.
+ * \param p the parse, after pkt_parse_frame()
+ * \param header pointer to the packet header structure
+ * \return 0 - drop the packet, 1 - success
+ */
+static uint8_t pkt_parse_ip (pkt_parse_t *p, const struct pcap_pkthdr *header) {
+    uint16_t ip_len = 0;
+
+    /* sanity check the IPv4 header */
+    if ((p->ip_type == ETH_TYPE_IP) && (p->ip_hdr_len < 20)) {
+        joy_log_err(" Invalid IP header length: %u bytes", p->ip_hdr_len);
+        return 0;
     }
 
-    if (ctx->curr_pkt_type == ETH_TYPE_IPV6) {
-        ip_len = ntohs(ipv6->ip_len) + IPV6_HDR_LENGTH;
+    if (p->ip_type == ETH_TYPE_IPV6) {
+        ip_len = ntohs(p->ipv6->ip_len) + IPV6_HDR_LENGTH;
         if (header->caplen < IPV6_HDR_LENGTH) {
             /*
              * IP packet is malformed shorter than a complete IP header
              */
-            if (allocated_packet_header)
-                free(dyn_header);
-            return NULL;
+            return 0;
         }
     } else {
-        ip_len = ntohs(ip->ip_len);
+        ip_len = ntohs(p->ip->ip_len);
         if (ip_len < sizeof(ip_hdr_t)) {
             /*
              * IP packet is malformed shorter than a complete IP header
              */
-            if (allocated_packet_header)
-                free(dyn_header);
-            return NULL;
+            return 0;
         }
     }
 
@@ -1131,69 +1141,59 @@ void* process_packet (unsigned char *ctx_ptr,
          * Let's reset the ip_len to the length of the caplen minus
          * the ethernet header and then process the truncated packet.
          */
-        joy_log_debug("Truncated IP packet: orig len %u , new len %u", ip_len, (header->caplen - tot_frame_hdr_len));
-        ip_len = header->caplen - tot_frame_hdr_len;
+        joy_log_debug("Truncated IP packet: orig len %u , new len %u", ip_len, (header->caplen - p->frame_hdr_len));
+        ip_len = header->caplen - p->frame_hdr_len;
     }
 
-    /* fill in key components */
-    if (ctx->curr_pkt_type == ETH_TYPE_IPV6) {
-        bool done = 0;
-        char *ext_hdr = NULL;
-
-        ipv6_ext_hdrs = 0;
-        memcpy_s(&key.sa.v6_sa, sizeof(uint32_t)*4, &ipv6->ip_src, sizeof(uint32_t)*4);
-        memcpy_s(&key.da.v6_da, sizeof(uint32_t)*4, &ipv6->ip_dst, sizeof(uint32_t)*4);
-
-        /* loop through IPv6 header until we find an upper layer protocol */
-        while (!done) {
-            switch (ipv6->ip_nxh) {
-                case IPPROTO_HOPOPTS:
-                case IPPROTO_ROUTING:
-                case IPPROTO_FRAGMENT:
-                case IPPROTO_ESP:
-                case IPPROTO_AH:
-                case IPPROTO_DSTOPTS:
-                    ext_hdr = (char*)ipv6 + IPV6_HDR_LENGTH + (ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
-                    ipv6->ip_nxh = *ext_hdr;
-                    ++ipv6_ext_hdrs;
-                    break;
-
-                case IPPROTO_NONE:
-                    joy_log_info("Dropping packet, no upper layer protocol found");
-                    if (allocated_packet_header) {
-                        free(dyn_header);
-                    }
-                    return NULL;
-
-                default:
-                    done = 1;
-                    key.prot = ipv6->ip_nxh;
-                    break;
-            }
-        }
-    } else {
-        if (ip_is_fragment(ip) == 0) {
-            /* fill out IP-specific fields of flow key */
-            key.sa.v4_sa = ip->ip_src;
-            key.da.v4_da = ip->ip_dst;
-            key.prot = ip->ip_prot;
-        }  else {
-            /*
-             * select IP processing, since we don't have a TCP or UDP header
-             */
-            key.sa.v4_sa = ip->ip_src;
-            key.da.v4_da = ip->ip_dst;
-            key.prot = IPPROTO_IP;
-        }
+    /* fill in key components; the walk stays within ip_len */
+    if (!pkt_parse_key(p, ip_len)) {
+        return 0;
     }
 
     /* determine transport length and start */
-    if (ctx->curr_pkt_type == ETH_TYPE_IPV6) {
-        transport_len =  ip_len - IPV6_HDR_LENGTH;
-        transport_start = (char *)ipv6 + ip_hdr_len + (ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
+    if (p->ip_type == ETH_TYPE_IPV6) {
+        /* the extension headers are not part of the transport data */
+        p->transport_len =  ip_len - IPV6_HDR_LENGTH - (p->ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
+        p->transport_start = (char *)p->ipv6 + p->ip_hdr_len + (p->ipv6_ext_hdrs * IPV6_EXT_HDR_LEN);
     } else {
-        transport_len =  ip_len - ip_hdr_len;
-        transport_start = (char *)ip + ip_hdr_len;
+        p->transport_len =  ip_len - p->ip_hdr_len;
+        p->transport_start = (char *)p->ip + p->ip_hdr_len;
+    }
+    p->ip_len = ip_len;
+
+    return 1;
+}
+
+/**
+ * \fn void* process_parsed_packet (joy_ctx_data *ctx,
+                                    const struct pcap_pkthdr *header,
+                                    pkt_parse_t *p,
+                                    uint8_t parsed)
+ * \brief Count a packet and, if it parsed, fold it into its flow record.
+ * \param ctx the context data
+ * \param header pointer to the packet header structure
+ * \param p the parse of the packet; its key gets the ports filled in
+ * \param parsed 1 if pkt_parse_ip() accepted the packet, 0 otherwise
+ * \return pointer to the flow record
+ */
+static void* process_parsed_packet (joy_ctx_data *ctx,
+                                    const struct pcap_pkthdr *header,
+                                    pkt_parse_t *p,
+                                    uint8_t parsed) {
+    flow_record_t *record = NULL;
+    char ipv4_addr[INET_ADDRSTRLEN];
+    char ipv6_addr[INET6_ADDRSTRLEN];
+    ip_hdr_t *ip = p->ip;
+    ip_hdrv6_t *ipv6 = p->ipv6;
+    const void *transport_start = p->transport_start;
+    unsigned int transport_len = p->transport_len;
+    flow_key_t *key = &p->key;
+
+    flocap_stats_incr_num_packets(ctx);
+    joy_log_info("++++++++++ Packet %lu ++++++++++", ctx->stats.num_packets);
+    ctx->curr_pkt_type = p->ip_type;
+    if (!parsed) {
+        return NULL;
     }
 
     /* print source and destination IP addresses */
@@ -1203,15 +1203,15 @@ void* process_packet (unsigned char *ctx_ptr,
             joy_log_info("Source IPv6: %s", ipv6_addr);
             inet_ntop(AF_INET6, &ipv6->ip_dst, ipv6_addr, INET6_ADDRSTRLEN);
             joy_log_info("Dest IP: %s", ipv6_addr);
-            joy_log_info("Len: %u", ip_len);
-            joy_log_debug("IPv6 header len: %u", (ip_hdr_len + (ipv6_ext_hdrs * 8)));
+            joy_log_info("Len: %u", p->ip_len);
+            joy_log_debug("IPv6 header len: %u", (p->ip_hdr_len + (p->ipv6_ext_hdrs * 8)));
         } else {
             inet_ntop(AF_INET, &ip->ip_src, ipv4_addr, INET_ADDRSTRLEN);
             joy_log_info("Source IP: %s", ipv4_addr);
             inet_ntop(AF_INET, &ip->ip_dst, ipv4_addr, INET_ADDRSTRLEN);
             joy_log_info("Dest IP: %s", ipv4_addr);
-            joy_log_info("Len: %u", ip_len);
-            joy_log_debug("IP header len: %u", ip_hdr_len);
+            joy_log_info("Len: %u", p->ip_len);
+            joy_log_debug("IP header len: %u", p->ip_hdr_len);
         }
     }
 
@@ -1227,9 +1227,9 @@ void* process_packet (unsigned char *ctx_ptr,
     }
 
     /* determine transport protocol and handle appropriately */
-    switch(key.prot) {
+    switch(key->prot) {
         case IPPROTO_TCP:
-            record = process_tcp(ctx, header, transport_start, transport_len, &key);
+            record = process_tcp(ctx, header, transport_start, transport_len, key);
             if (record) {
                 record->ip_type = ctx->curr_pkt_type;
                 update_all_tcp_features(tcp_feature_list);
@@ -1242,23 +1242,17 @@ void* process_packet (unsigned char *ctx_ptr,
                  * If we do find it and the retransmission flag is not set, then its a
                  * malformed packet and let it get processed as plain IP.
                  */
-                record = flow_key_get_record(ctx, &key, DONT_CREATE_RECORDS, header);
+                record = flow_key_get_record(ctx, key, DONT_CREATE_RECORDS, header);
                 if (record != NULL) {
                     /* found record, check for retransmission flag */
                     record->ip_type = ctx->curr_pkt_type;
                     if (record->is_tcp_retrans == 1) {
                         /* same packet retransmitted, just stop processing */
-	                if (allocated_packet_header) {
-		            free(dyn_header);
-	                }
                         /* return the existing flow record */
                         return record;
                     } else if (record->is_tcp_retrans == 2) {
                         /* same packet retransmitted but with additional data */
                         /* TODO: process the additional data */
-	                if (allocated_packet_header) {
-		            free(dyn_header);
-	                }
                         /* return the existing flow record with the new data */
                         return record;
                     } else {
@@ -1275,15 +1269,15 @@ void* process_packet (unsigned char *ctx_ptr,
             }
             break;
         case IPPROTO_UDP:
-            record = process_udp(ctx, header, transport_start, transport_len, &key);
+            record = process_udp(ctx, header, transport_start, transport_len, key);
             break;
         case IPPROTO_ICMP:
         case IPPROTO_ICMPV6:
-            record = process_icmp(ctx, header, transport_start, transport_len, &key);
+            record = process_icmp(ctx, header, transport_start, transport_len, key);
             break;
         case IPPROTO_IP:
         default:
-            record = process_ip(ctx, header, transport_start, transport_len, &key);
+            record = process_ip(ctx, header, transport_start, transport_len, key);
             break;
     }
 
@@ -1293,12 +1287,9 @@ void* process_packet (unsigned char *ctx_ptr,
      * as just an IP packet
      */
     if (record == NULL) {
-        record = process_ip(ctx, header, transport_start, transport_len, &key);
+        record = process_ip(ctx, header, transport_start, transport_len, key);
         if (record == NULL) {
             joy_log_err("Unable to process ip packet (improper length or otherwise malformed)");
-	    if (allocated_packet_header) {
-		free(dyn_header);
-	    }
             return NULL;
         }
         record->invalid = 1;
@@ -1348,17 +1339,15 @@ void* process_packet (unsigned char *ctx_ptr,
         if (record->idp != NULL) {
             free(record->idp);
         }
-        record->idp_len = (ip_len < glb_config->idp ? ip_len : glb_config->idp);
+        record->idp_len = (p->ip_len < glb_config->idp ? p->ip_len : glb_config->idp);
         record->idp = calloc(1, record->idp_len);
         if (!record->idp) {
             joy_log_err("Out of memory");
-            if (allocated_packet_header)
-                free(dyn_header);
             return record;
         }
 
         /* for TCP we guard against out of order packets */
-        if (key.prot == IPPROTO_TCP) {
+        if (key->prot == IPPROTO_TCP) {
             /* SYN flag processed and got the next non-zero packet */
             if (record->idp_packet == 1) {
                 if (ctx->curr_pkt_type == ETH_TYPE_IPV6) {
@@ -1390,12 +1379,69 @@ void* process_packet (unsigned char *ctx_ptr,
     /* set the feature ready flags for this flow record */
     flow_record_set_feature_ready_flags(ctx,record);
 
+    return record;
+}
+
+/**
+ * \fn void* process_packet (unsigned char *ctx_ptr,
+                            const struct pcap_pkthdr *pkt_header,
+                            const unsigned char *packet)
+ * \param ctx_ptr currently used to store the context data pointer
+ * \param pkt_header pointer to the packer header structure
+ * \param packet pointer to the packet
+ * \return pointer to the flow record
+ */
+void* process_packet (unsigned char *ctx_ptr,
+                     const struct pcap_pkthdr *pkt_header,
+                     const unsigned char *packet) {
+    flow_record_t *record = NULL;
+    const struct pcap_pkthdr *header =  pkt_header;
+    struct pcap_pkthdr *dyn_header = NULL;
+    pkt_parse_t p;
+    uint8_t parsed = 0;
+
+    /* grab the context for this packet */
+    joy_ctx_data *ctx = (joy_ctx_data*)ctx_ptr;
+    if (ctx == NULL) {
+        joy_log_err("NULL Data Context Pointer");
+        return NULL;
+    }
+
+    if (pkt_parse_frame(packet, &p)) {
+        /* make sure we have a valid packet header */
+        if (header == NULL) {
+            struct timeval now;
+
+            dyn_header = (struct pcap_pkthdr*) calloc(1,sizeof(struct pcap_pkthdr));
+            if (dyn_header == NULL) {
+                joy_log_err(" Couldn't allocate memory for packet header.");
+            } else {
+                gettimeofday(&now,NULL);
+                dyn_header->ts.tv_sec = now.tv_sec;
+                dyn_header->ts.tv_usec = now.tv_usec;
+                if (p.ip_type == ETH_TYPE_IPV6) {
+                    dyn_header->caplen = p.ipv6->ip_len + IPV6_HDR_LENGTH;
+                    dyn_header->len = p.ipv6->ip_len + IPV6_HDR_LENGTH;
+                } else {
+                    dyn_header->caplen = p.ip->ip_len;
+                    dyn_header->len = p.ip->ip_len;
+                }
+                header = dyn_header;
+            }
+        }
+        if (header != NULL) {
+            parsed = pkt_parse_ip(&p, header);
+        }
+    }
+
+    record = process_parsed_packet(ctx, header, &p, parsed);
+
     /* if we allocated the packet header, then free it now */
-    if (allocated_packet_header)
+    if (dyn_header != NULL) {
         free(dyn_header);
+    }
     return record;
 }
-
 /**
  * \fn void libpcap_process_packet (unsigned char *ctx_ptr,
                                     const struct pcap_pkthdr *pkt_header,
@@ -1412,4 +1458,251 @@ void libpcap_process_packet (unsigned char *ctx_ptr, const struct pcap_pkthdr *p
     process_packet(ctx_ptr, pkt_header, packet);
 }
 
+/* packets whose flow lookups process_packet_burst() overlaps */
+#define PKT_PROC_BURST 32
+
+/**
+ * \fn void process_packet_burst (unsigned char *ctx_ptr,
+                                  const struct pcap_pkthdr **headers,
+                                  const unsigned char **packets,
+                                  unsigned int num_packets)
+ * \brief Process a burst of packets for one context.
+ *
+ * Every packet in the burst is parsed and its 5-tuple hashed first,
+ * prefetching the flow table slot it maps to; then the records in
+ * those slots are prefetched; and only then is each packet processed,
+ * in order and from that same parse, as process_packet() does.  The
+ * cache misses of the lookups overlap instead of stalling one packet
+ * at a time.
+ *
+ * \param ctx_ptr currently used to store the context data pointer
+ * \param headers the packet headers
+ * \param packets the packets; NULL entries are skipped
+ * \param num_packets number of packets
+ * \return none
+ */
+void process_packet_burst (unsigned char *ctx_ptr,
+                           const struct pcap_pkthdr **headers,
+                           const unsigned char **packets,
+                           unsigned int num_packets) {
+    joy_ctx_data *ctx = (joy_ctx_data*)ctx_ptr;
+    flow_key_t key;
+    pkt_parse_t parse[PKT_PROC_BURST];
+    uint32_t hash[PKT_PROC_BURST];
+    uint8_t have_key[PKT_PROC_BURST];
+    unsigned int i, j, n;
+
+    if (ctx == NULL) {
+        joy_log_err("NULL Data Context Pointer");
+        return;
+    }
+
+    for (i = 0; i < num_packets; i += n) {
+        n = num_packets - i;
+        if (n > PKT_PROC_BURST) {
+            n = PKT_PROC_BURST;
+        }
+
+        /* parse and hash the burst, starting the slot fetches */
+        for (j = 0; j < n; j++) {
+            have_key[j] = 0;
+            if (packets[i + j] == NULL || headers[i + j] == NULL) {
+                continue;
+            }
+            if (pkt_parse_frame(packets[i + j], &parse[j]) &&
+                pkt_parse_ip(&parse[j], headers[i + j])) {
+                /* the parse keeps no ports, they are the transport's to fill in */
+                key = parse[j].key;
+                if (parse[j].transport_len >= 4) {
+                    pkt_parse_ports(&key, parse[j].transport_start);
+                }
+                hash[j] = flow_key_prefetch(ctx, &key);
+                have_key[j] = 1;
+            }
+        }
+
+        /* the slots should be in by now; start the record fetches */
+        for (j = 0; j < n; j++) {
+            if (have_key[j]) {
+                flow_record_prefetch(ctx, hash[j]);
+            }
+        }
+
+        for (j = 0; j < n; j++) {
+            if (packets[i + j] == NULL) {
+                continue;
+            }
+            if (headers[i + j] == NULL) {
+                process_packet(ctx_ptr, NULL, packets[i + j]);
+            } else {
+                process_parsed_packet(ctx, headers[i + j], &parse[j], have_key[j]);
+            }
+        }
+    }
+}
+
+/**
+ * \brief Fill in the pcap header of a packet descriptor.
+ *
+ * The flow records keep microseconds, so the nanoseconds are
+ * truncated here, once, at the edge of the capture path.
+ *
+ * \param desc the packet descriptor
+ * \param header the header to fill in
+ * \return none
+ */
+static void pkt_desc_to_pkthdr (const struct pkt_desc *desc, struct pcap_pkthdr *header) {
+    header->ts.tv_sec = (time_t)(desc->ts / 1000000000);
+    header->ts.tv_usec = (long)((desc->ts % 1000000000) / 1000);
+    header->caplen = desc->caplen;
+    header->len = desc->len;
+}
+
+/**
+ * \fn void* process_frame (unsigned char *ctx_ptr,
+                            const struct pkt_desc *desc,
+                            const unsigned char *packet)
+ * \brief Process a packet described by a struct pkt_desc.
+ *
+ * \param ctx_ptr currently used to store the context data pointer
+ * \param desc the packet descriptor
+ * \param packet the packet
+ * \return as process_packet()
+ */
+void* process_frame (unsigned char *ctx_ptr,
+                     const struct pkt_desc *desc,
+                     const unsigned char *packet) {
+    struct pcap_pkthdr header;
+
+    pkt_desc_to_pkthdr(desc, &header);
+    return process_packet(ctx_ptr, &header, packet);
+}
+
+/**
+ * \fn void process_frame_burst (unsigned char *ctx_ptr,
+                                 const struct pkt_desc **descs,
+                                 const unsigned char **packets,
+                                 unsigned int num_packets)
+ * \brief Process a burst of packets described by struct pkt_desc,
+ * as process_packet_burst() does.
+ *
+ * \param ctx_ptr currently used to store the context data pointer
+ * \param descs the packet descriptors
+ * \param packets the packets; NULL entries are skipped
+ * \param num_packets number of packets
+ * \return none
+ */
+void process_frame_burst (unsigned char *ctx_ptr,
+                          const struct pkt_desc **descs,
+                          const unsigned char **packets,
+                          unsigned int num_packets) {
+    struct pcap_pkthdr header[PKT_PROC_BURST];
+    const struct pcap_pkthdr *headers[PKT_PROC_BURST];
+    unsigned int i, j, n;
+
+    for (i = 0; i < num_packets; i += n) {
+        n = num_packets - i;
+        if (n > PKT_PROC_BURST) {
+            n = PKT_PROC_BURST;
+        }
+        for (j = 0; j < n; j++) {
+            pkt_desc_to_pkthdr(descs[i + j], &header[j]);
+            headers[j] = &header[j];
+        }
+        process_packet_burst(ctx_ptr, headers, packets + i, n);
+    }
+}
+
 /* END packet processing */
+
+/* bytes of an ICMPv6 MLDv2 report behind a hop-by-hop options header */
+#define PKT_PROC_TEST_MLD_LEN 28
+
+/**
+ * \brief Unit test for the parsing of IPv6 extension headers.
+ *
+ * An MLDv2 report behind a hop-by-hop options header, as hosts send
+ * them, is parsed for its flow key and then processed: the key must
+ * name ICMPv6, the packet must not be changed, and the flow must count
+ * the ICMPv6 data without the extension header, whether or not the key
+ * was taken first.  A packet whose extension header is cut off must be
+ * dropped.
+ *
+ * \return Number of failures
+ */
+int pkt_proc_unit_test (void) {
+    static const unsigned char frame[ETHERNET_HDR_LEN + IPV6_HDR_LENGTH + IPV6_EXT_HDR_LEN + PKT_PROC_TEST_MLD_LEN] = {
+        /* ethernet */
+        0x33, 0x33, 0x00, 0x00, 0x00, 0x16, 0x02, 0x00, 0x00, 0x00, 0x00, 0x01, 0x86, 0xdd,
+        /* IPv6, payload length 36, next header hop-by-hop options */
+        0x60, 0x00, 0x00, 0x00, 0x00, 0x24, 0x00, 0x01,
+        0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x16,
+        /* hop-by-hop options, next header ICMPv6: router alert, PadN */
+        0x3a, 0x00, 0x05, 0x02, 0x00, 0x00, 0x01, 0x00,
+        /* MLDv2 report with one record */
+        0x8f, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x04, 0x00, 0x00, 0x00, 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfb
+    };
+    unsigned char packet[sizeof(frame)];
+    struct pcap_pkthdr header;
+    joy_ctx_data *ctx = NULL;
+    flow_record_t *record;
+    flow_key_t key;
+    unsigned int i;
+    int num_fails = 0;
+
+    JOY_API_ALLOC_CONTEXT(ctx, 1)
+    if (ctx == NULL) {
+        joy_log_err("out of memory");
+        return 1;
+    }
+    if (flow_record_list_init(ctx) != ok) {
+        JOY_API_FREE_CONTEXT(ctx)
+        return 1;
+    }
+
+    memset_s(&header, sizeof(header), 0x00, sizeof(header));
+    header.ts.tv_sec = 1516683620;
+    header.caplen = header.len = sizeof(frame);
+
+    for (i = 0; i < 2; i++) {
+        memcpy_s(packet, sizeof(packet), frame, sizeof(frame));
+
+        /* the second time round, the key is taken first, as when packets are spread over contexts */
+        if (i == 1) {
+            if (!get_packet_5tuple_key(packet, &key) || key.prot != IPPROTO_ICMPV6) {
+                joy_log_err("key of the MLD report has protocol %u", key.prot);
+                num_fails++;
+            }
+            if (memcmp(packet, frame, sizeof(frame)) != 0) {
+                joy_log_err("taking the key changed the packet");
+                num_fails++;
+            }
+        }
+
+        record = process_packet((unsigned char *)ctx, &header, packet);
+        if (record == NULL || record->key.prot != IPPROTO_ICMPV6 ||
+            record->ob != (i + 1) * (PKT_PROC_TEST_MLD_LEN - 8)) {
+            joy_log_err("MLD report %u counted as %lu bytes", i,
+                        record ? (unsigned long)record->ob : 0);
+            num_fails++;
+        }
+        if (memcmp(packet, frame, sizeof(frame)) != 0) {
+            joy_log_err("processing changed the packet");
+            num_fails++;
+        }
+    }
+
+    /* the packet ends half way through the extension header */
+    header.caplen = ETHERNET_HDR_LEN + IPV6_HDR_LENGTH + IPV6_EXT_HDR_LEN / 2;
+    if (process_packet((unsigned char *)ctx, &header, frame) != NULL) {
+        joy_log_err("packet with a cut off extension header was processed");
+        num_fails++;
+    }
+
+    flow_record_list_free(ctx);
+    JOY_API_FREE_CONTEXT(ctx)
+    return num_fails;
+}
@@ -0,0 +1,452 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file pkt_ring.c
+ *
+ * \brief Bounded single-producer, single-consumer ring of packets
+ *
+ * Packets are copied into a byte ring as variable length entries, so
+ * small packets don't take a snaplen-sized slot each.  An entry that
+ * doesn't fit before the end of the storage is preceded by a wrap
+ * marker and written at the start.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "pkt_ring.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/** smallest ring accepted by pkt_ring_init() */
+#define PKT_RING_MIN_SIZE (64 * 1024)
+
+/* entries start on 8-byte boundaries */
+#define PKT_RING_ALIGN(x) (((x) + 7) & ~((uint32_t)7))
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/*
+ * the head and tail positions are the only state shared by the two
+ * threads; a load of one must not be reordered after the accesses to
+ * the entries it covers, and a store before them
+ */
+static inline uint64_t pkt_ring_load_acquire (const uint64_t *p) {
+#ifdef _MSC_VER
+    uint64_t v = *(volatile const uint64_t *)p;
+    _ReadWriteBarrier();
+    return v;
+#else
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+}
+
+static inline void pkt_ring_store_release (uint64_t *p, uint64_t v) {
+#ifdef _MSC_VER
+    _ReadWriteBarrier();
+    *(volatile uint64_t *)p = v;
+#else
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+}
+
+/** an entry of the ring; the captured bytes follow it */
+typedef struct pkt_ring_entry_ {
+    uint32_t size;                      /*!< bytes taken, or 0 to wrap around  */
+    uint32_t reserved;
+    struct pcap_pkthdr header;
+} pkt_ring_entry_t;
+
+/**
+ * \brief Allocate the storage of a packet ring.
+ * \param r The packet ring
+ * \param size Bytes of storage, rounded up to a power of two
+ * \return ok or failure
+ */
+int pkt_ring_init (pkt_ring_t *r, uint32_t size) {
+    uint32_t n = PKT_RING_MIN_SIZE;
+
+    memset_s(r, sizeof(pkt_ring_t), 0x00, sizeof(pkt_ring_t));
+    while (n < size && n < 0x80000000) {
+        n <<= 1;
+    }
+    r->buf = malloc(n);
+    if (r->buf == NULL) {
+        joy_log_err("could not allocate packet ring of %u bytes", n);
+        return failure;
+    }
+    r->size = n;
+    return ok;
+}
+
+/**
+ * \brief Free the storage of a packet ring.
+ * \param r The packet ring
+ * \return none
+ */
+void pkt_ring_free (pkt_ring_t *r) {
+    free(r->buf);
+    memset_s(r, sizeof(pkt_ring_t), 0x00, sizeof(pkt_ring_t));
+}
+
+/**
+ * \brief Copy a packet into the ring.
+ *
+ * Only the producer thread may call this.  The packet is dropped and
+ * counted if the ring doesn't have room for it.
+ *
+ * \param r The packet ring
+ * \param header The pcap header of the packet
+ * \param packet The captured bytes
+ * \return ok, or failure if the packet was dropped
+ */
+int pkt_ring_enqueue (pkt_ring_t *r, const struct pcap_pkthdr *header, const unsigned char *packet) {
+    uint32_t need = PKT_RING_ALIGN(sizeof(pkt_ring_entry_t) + header->caplen);
+    uint32_t off = r->head & (r->size - 1);
+    uint32_t room = r->size - off;
+    uint32_t total = (room < need) ? room + need : need;
+    pkt_ring_entry_t *e;
+
+    if (need > r->size / 2) {
+        r->dropped++;
+        return failure;
+    }
+    if (r->head + total - r->cached_tail > r->size) {
+        /* looks full; see how far the consumer has got */
+        r->cached_tail = pkt_ring_load_acquire(&r->tail);
+        if (r->head + total - r->cached_tail > r->size) {
+            r->dropped++;
+            return failure;
+        }
+    }
+
+    if (room < need) {
+        /* entries are aligned, so there is always room for the marker */
+        ((pkt_ring_entry_t *)(r->buf + off))->size = 0;
+        off = 0;
+    }
+    e = (pkt_ring_entry_t *)(r->buf + off);
+    e->size = need;
+    e->header = *header;
+    memcpy(e + 1, packet, header->caplen);
+
+    pkt_ring_store_release(&r->head, r->head + total);
+    r->enqueued++;
+    return ok;
+}
+
+/**
+ * \brief Copy a packet into the ring, waiting for room if it is full.
+ *
+ * Only the producer thread may call this.  Used where packets must
+ * not be lost, such as when reading a capture file; the producer
+ * yields to the consumer until the packet fits.
+ *
+ * \param r The packet ring
+ * \param header The pcap header of the packet
+ * \param packet The captured bytes
+ * \return ok, or failure if the packet can never fit
+ */
+int pkt_ring_enqueue_wait (pkt_ring_t *r, const struct pcap_pkthdr *header, const unsigned char *packet) {
+
+    while (pkt_ring_enqueue(r, header, packet) != ok) {
+        /* a full ring is not a drop here */
+        r->dropped--;
+        if (pkt_ring_used(r) == 0) {
+            joy_log_err("packet of %u bytes does not fit the ring", header->caplen);
+            r->dropped++;
+            return failure;
+        }
+        sched_yield();
+    }
+    return ok;
+}
+
+/**
+ * \brief Hand queued packets to a handler, oldest first.
+ *
+ * Only the consumer thread may call this.  The packets are passed in
+ * place and their space is given back to the producer when this
+ * returns, so the handler must not keep pointers to them.
+ *
+ * \param r The packet ring
+ * \param max Most packets to hand over
+ * \param handler Function each packet is passed to
+ * \param arg First argument of the handler
+ * \return Number of packets handed over
+ */
+unsigned int pkt_ring_drain (pkt_ring_t *r, unsigned int max,
+                             pkt_ring_handler_t handler, unsigned char *arg) {
+    uint64_t tail = r->tail;
+    uint64_t head = pkt_ring_load_acquire(&r->head);
+    unsigned int n = 0;
+    uint32_t off;
+    pkt_ring_entry_t *e;
+
+    while (tail != head && n < max) {
+        off = tail & (r->size - 1);
+        e = (pkt_ring_entry_t *)(r->buf + off);
+        if (e->size == 0) {
+            tail += r->size - off;
+            continue;
+        }
+        handler(arg, &e->header, (const unsigned char *)(e + 1));
+        tail += e->size;
+        n++;
+    }
+
+    r->drained += n;
+    pkt_ring_store_release(&r->tail, tail);
+    return n;
+}
+
+/**
+ * \brief Hand queued packets to a handler in one call, oldest first.
+ *
+ * Like pkt_ring_drain(), but the handler gets arrays of up to
+ * PKT_RING_BURST packets at once, all still in place in the ring.
+ *
+ * \param r The packet ring
+ * \param max Most packets to hand over, at most PKT_RING_BURST
+ * \param handler Function the packets are passed to
+ * \param arg First argument of the handler
+ * \return Number of packets handed over
+ */
+unsigned int pkt_ring_drain_burst (pkt_ring_t *r, unsigned int max,
+                                   pkt_ring_burst_handler_t handler, unsigned char *arg) {
+    const struct pcap_pkthdr *headers[PKT_RING_BURST];
+    const unsigned char *packets[PKT_RING_BURST];
+    uint64_t tail = r->tail;
+    uint64_t head = pkt_ring_load_acquire(&r->head);
+    unsigned int n = 0;
+    uint32_t off;
+    pkt_ring_entry_t *e;
+
+    if (max > PKT_RING_BURST) {
+        max = PKT_RING_BURST;
+    }
+    while (tail != head && n < max) {
+        off = tail & (r->size - 1);
+        e = (pkt_ring_entry_t *)(r->buf + off);
+        if (e->size == 0) {
+            tail += r->size - off;
+            continue;
+        }
+        headers[n] = &e->header;
+        packets[n] = (const unsigned char *)(e + 1);
+        tail += e->size;
+        n++;
+    }
+    if (n) {
+        handler(arg, headers, packets, n);
+    }
+
+    r->drained += n;
+    pkt_ring_store_release(&r->tail, tail);
+    return n;
+}
+
+/**
+ * \brief Bytes currently held by a packet ring.
+ *
+ * Either thread may call this; the result is a snapshot.
+ *
+ * \param r The packet ring
+ * \return Bytes in use
+ */
+uint32_t pkt_ring_used (const pkt_ring_t *r) {
+    uint64_t tail = pkt_ring_load_acquire(&r->tail);
+    uint64_t head = pkt_ring_load_acquire(&r->head);
+
+    return (uint32_t)(head - tail);
+}
+
+/*
+ * unit test
+ */
+
+/* packets passed through the ring by the unit test */
+#define PKT_RING_TEST_PACKETS 200000
+
+struct pkt_ring_test_state {
+    pkt_ring_t ring;
+    uint32_t expected;                  /* sequence number of the next packet */
+    int num_fails;
+};
+
+/* packet lengths cycle through small, odd and near-MTU sizes */
+static uint32_t pkt_ring_test_len (uint32_t seq) {
+    return (seq * 37) % 1519;
+}
+
+static void pkt_ring_test_fill (unsigned char *packet, uint32_t seq, uint32_t len) {
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        packet[i] = (unsigned char)(seq + i);
+    }
+}
+
+static void pkt_ring_test_handler (unsigned char *arg,
+                                   const struct pcap_pkthdr *header,
+                                   const unsigned char *packet) {
+    struct pkt_ring_test_state *s = (struct pkt_ring_test_state *)arg;
+    uint32_t seq = header->len;
+    uint32_t i;
+
+    if (seq != s->expected || header->caplen != pkt_ring_test_len(seq)) {
+        if (s->num_fails++ < 5) {
+            joy_log_err("got packet %u of %u bytes, expected %u", seq, header->caplen, s->expected);
+        }
+    } else {
+        for (i = 0; i < header->caplen; i++) {
+            if (packet[i] != (unsigned char)(seq + i)) {
+                joy_log_err("packet %u corrupt at byte %u", seq, i);
+                s->num_fails++;
+                break;
+            }
+        }
+    }
+    s->expected = seq + 1;
+}
+
+static void pkt_ring_test_burst_handler (unsigned char *arg,
+                                         const struct pcap_pkthdr **headers,
+                                         const unsigned char **packets,
+                                         unsigned int num_packets) {
+    unsigned int i;
+
+    for (i = 0; i < num_packets; i++) {
+        pkt_ring_test_handler(arg, headers[i], packets[i]);
+    }
+}
+
+static void *pkt_ring_test_producer (void *arg) {
+    struct pkt_ring_test_state *s = (struct pkt_ring_test_state *)arg;
+    unsigned char packet[1600];
+    struct pcap_pkthdr header;
+    uint32_t seq;
+
+    memset_s(&header, sizeof(header), 0x00, sizeof(header));
+    for (seq = 0; seq < PKT_RING_TEST_PACKETS; seq++) {
+        header.len = seq;
+        header.caplen = pkt_ring_test_len(seq);
+        pkt_ring_test_fill(packet, seq, header.caplen);
+        if (pkt_ring_enqueue_wait(&s->ring, &header, packet) != ok) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * \brief Unit test for the packet ring.
+ *
+ * The ring is first filled until it drops a packet and then drained,
+ * and then a producer thread and this thread pass packets through it
+ * concurrently, checking that every packet arrives intact and in order.
+ *
+ * \return Number of failures
+ */
+int pkt_ring_unit_test (void) {
+    struct pkt_ring_test_state *s;
+    unsigned char packet[1600];
+    struct pcap_pkthdr header;
+    pthread_t producer;
+    uint32_t seq = 0;
+    int num_fails = 0;
+
+    s = calloc(1, sizeof(struct pkt_ring_test_state));
+    if (s == NULL || pkt_ring_init(&s->ring, PKT_RING_MIN_SIZE) != ok) {
+        free(s);
+        return 1;
+    }
+
+    /* fill it up */
+    memset_s(&header, sizeof(header), 0x00, sizeof(header));
+    for (;;) {
+        header.len = seq;
+        header.caplen = pkt_ring_test_len(seq);
+        pkt_ring_test_fill(packet, seq, header.caplen);
+        if (pkt_ring_enqueue(&s->ring, &header, packet) != ok) {
+            break;
+        }
+        seq++;
+    }
+    if (s->ring.dropped != 1 || s->ring.enqueued != seq || pkt_ring_used(&s->ring) > s->ring.size) {
+        joy_log_err("%u packets enqueued, %lu dropped", seq, (unsigned long)s->ring.dropped);
+        num_fails++;
+    }
+    while (pkt_ring_drain(&s->ring, PKT_RING_BURST, pkt_ring_test_handler, (unsigned char *)s) != 0) {
+        continue;
+    }
+    if (s->expected != seq || pkt_ring_used(&s->ring) != 0) {
+        joy_log_err("%u of %u packets drained", s->expected, seq);
+        num_fails++;
+    }
+
+    /* now concurrently, wrapping around many times, draining in bursts */
+    pkt_ring_free(&s->ring);
+    pkt_ring_init(&s->ring, PKT_RING_MIN_SIZE);
+    s->expected = 0;
+    if (pthread_create(&producer, NULL, pkt_ring_test_producer, s) != 0) {
+        pkt_ring_free(&s->ring);
+        free(s);
+        return num_fails + 1;
+    }
+    while (s->expected < PKT_RING_TEST_PACKETS) {
+        if (pkt_ring_drain_burst(&s->ring, PKT_RING_BURST, pkt_ring_test_burst_handler, (unsigned char *)s) == 0) {
+            sched_yield();
+        }
+    }
+    pthread_join(producer, NULL);
+    if (s->ring.drained != PKT_RING_TEST_PACKETS || s->ring.dropped != 0) {
+        joy_log_err("%lu of %u packets drained", (unsigned long)s->ring.drained, PKT_RING_TEST_PACKETS);
+        num_fails++;
+    }
+
+    num_fails += s->num_fails;
+    pkt_ring_free(&s->ring);
+    free(s);
+    return num_fails;
+}
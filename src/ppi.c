@@ -57,8 +57,10 @@ extern FILE *info;
 /* helper functions defined below */
 
 static void pkt_info_print_interleaved(zfile f,
+                                       const struct timeval *start,
                                        const struct pkt_info *pkt_info,
                                        unsigned int np,
+                                       const struct timeval *start2,
                                        const struct pkt_info *pkt_info2,
                                        unsigned int np2);
 
@@ -123,7 +125,10 @@ void ppi_update (struct ppi *ppi,
             ppi->pkt_info[ppi->np].len = size_payload;
             ppi->pkt_info[ppi->np].opt_len = opt_len;
         if (header != NULL) {
-            ppi->pkt_info[ppi->np].time = header->ts;
+            if (ppi->np == 0) {
+                ppi->start = header->ts;
+            }
+            ppi->pkt_info[ppi->np].time = joy_timer_delta(&ppi->start, &header->ts);
         }
             if (opt_len) {
                 memcpy_s(ppi->pkt_info[ppi->np].opts,
@@ -146,8 +151,10 @@ void ppi_update (struct ppi *ppi,
 void ppi_print_json (const struct ppi *x1, const struct ppi *x2, zfile f) {
 
     pkt_info_print_interleaved(f, 
+                               &x1->start,
                                x1->pkt_info, 
                                x1->np, 
+                               x2 ? &x2->start : NULL,
                                x2 ? x2->pkt_info : NULL, 
                                x2 ? x2->np : 0);
 
@@ -240,12 +247,14 @@ static void tcp_opt_malformed_print_json(zfile f,
                                          unsigned char kind,
                                          const unsigned char *data,
                                          unsigned int datalen) {
-    zprintf(f, "\"malformed\":{");
-    zprintf(f, "\"kind\":%u", kind);
-    zprintf(f, ",\"data\":");
+    zputs(f, "\"malformed\":{");
+    zputs(f, "\"kind\":");
+    zprint_uint(f, kind);
+    zputs(f, ",\"data\":");
     zprintf_raw_as_hex(f, data, datalen);
-    zprintf(f, ",\"len\":%u", datalen);
-    zprintf(f, "}");
+    zputs(f, ",\"len\":");
+    zprint_uint(f, datalen);
+    zputc(f, '}');
 }
 
 
@@ -271,7 +280,7 @@ void tcp_opt_print_json(zfile f,
 
     total_len = total_len > TCP_OPT_LEN ? TCP_OPT_LEN : total_len;
 
-    zprintf(f, ",\"opts\":[");
+    zputs(f, ",\"opts\":[");
     while (total_len > 0) {
 
     switch(*opt) {
@@ -296,16 +305,20 @@ void tcp_opt_print_json(zfile f,
     }
 
         if (!first_line) {
-          zprintf(f, ",");
+          zputc(f, ',');
         } else {
           first_line = 0;
         }
 
         if ((optlen > total_len) || (optlen == 0)) {
             /* Incomplete or malformed data */
-        zprintf(f, "{");
-        zprintf(f, "\"malformed\":{\"kind\":%u,\"len\":%u}", *opt, optlen);
-        zprintf(f, "}");
+        zputc(f, '{');
+        zputs(f, "\"malformed\":{\"kind\":");
+        zprint_uint(f, *opt);
+        zputs(f, ",\"len\":");
+        zprint_uint(f, optlen);
+        zputc(f, '}');
+        zputc(f, '}');
         goto finish;
         }
         
@@ -317,17 +330,19 @@ void tcp_opt_print_json(zfile f,
             datalen = 0;
         }
         
-        zprintf(f, "{");
+        zputc(f, '{');
         switch(*opt) {
         case NOP:
-        zprintf(f, "\"noop\":%s", "null");
+        zputs(f, "\"noop\":");
+        zputs(f, "null");
             break;
         case MSS:
             if (datalen != 2) {
             tcp_opt_malformed_print_json(f, *opt, data, datalen);
             } else {
                 const uint16_t *mss = (const uint16_t*)data;
-            zprintf(f, "\"mss\":%u", ntohs(*mss));
+            zputs(f, "\"mss\":");
+            zprint_uint(f, ntohs(*mss));
             }
         break;
         case WS:
@@ -335,11 +350,13 @@ void tcp_opt_print_json(zfile f,
             tcp_opt_malformed_print_json(f, *opt, data, datalen);
             } else {
                 const unsigned char *ws = data;
-            zprintf(f, "\"ws\":%u", *ws);
+            zputs(f, "\"ws\":");
+            zprint_uint(f, *ws);
             }
         break;
     case SACKP:
-        zprintf(f, "\"sackp\":%s", "null");
+        zputs(f, "\"sackp\":");
+        zputs(f, "null");
             break;
         case TS:
             if (datalen != 8) {
@@ -347,26 +364,31 @@ void tcp_opt_print_json(zfile f,
             } else {
                 const uint32_t *tsval = (const uint32_t*)data;
                 const uint32_t *tsecr = tsval + 1;
-            zprintf(f, "\"ts\":{\"val\":%u,\"ecr\":%u}", ntohl(*tsval), ntohl(*tsecr));
+            zputs(f, "\"ts\":{\"val\":");
+            zprint_uint(f, ntohl(*tsval));
+            zputs(f, ",\"ecr\":");
+            zprint_uint(f, ntohl(*tsecr));
+            zputc(f, '}');
             }
         break;
         default:
             if (datalen > total_len) {
             tcp_opt_malformed_print_json(f, *opt, data, total_len);
             } else {
-            zprintf(f, "\"kind\":%u", *opt);
-                zprintf(f, ",\"data\":");
+            zputs(f, "\"kind\":");
+            zprint_uint(f, *opt);
+                zputs(f, ",\"data\":");
                 zprintf_raw_as_hex(f, data, datalen);
             }
         }
-        zprintf(f, "}");
+        zputc(f, '}');
         
         total_len -= optlen;
         opt += optlen;    
     } 
 
 finish:
-    zprintf(f, "]");
+    zputc(f, ']');
 
 }
 
@@ -381,6 +403,7 @@ struct tcp_state {
 };
 
 static void pkt_info_process(zfile f, 
+                             const struct timeval *start,
                              const struct pkt_info *pkt_info, 
                              struct tcp_state *tcp_state, 
                              struct tcp_state *rev_tcp_state,
@@ -388,7 +411,7 @@ static void pkt_info_process(zfile f,
     long int rseq, rack;
     char flags_string[9];
     const char *dir = "?";
-    struct timeval tmp;
+    struct timeval t, tmp;
 
     if (pkt_info->flags & TCP_SYN) {
         tcp_state->seq = pkt_info->seq;
@@ -431,34 +454,44 @@ static void pkt_info_process(zfile f,
         dir = ">";
     }
 
-    joy_timer_sub(&pkt_info->time, &ts, &tmp); 
+    joy_timer_add_delta(start, pkt_info->time, &t);
+    joy_timer_sub(&t, &ts, &tmp); 
     tcp_flags_to_string(pkt_info->flags, flags_string);
-    zprintf(f, 
-            "{\"seq\":%u,\"ack\":%u,\"rseq\":%ld,\"rack\":%ld,\"b\":%u,\"olen\":%u,\"dir\":\"%s\",\"t\":%u,\"flags\":\"%s\"", 
-            pkt_info->seq, 
-            pkt_info->ack,
-            rseq,
-            rack,
-            pkt_info->len, 
-            pkt_info->opt_len, 
-            dir, 
-            joy_timeval_to_milliseconds(tmp), // note: not pkt_info->time 
-            flags_string);
+    zputs(f, "{\"seq\":");
+    zprint_uint(f, pkt_info->seq);
+    zputs(f, ",\"ack\":");
+    zprint_uint(f, pkt_info->ack);
+    zputs(f, ",\"rseq\":");
+    zprint_int64(f, rseq);
+    zputs(f, ",\"rack\":");
+    zprint_int64(f, rack);
+    zputs(f, ",\"b\":");
+    zprint_uint(f, pkt_info->len);
+    zputs(f, ",\"olen\":");
+    zprint_uint(f, pkt_info->opt_len);
+    zputs(f, ",\"dir\":");
+    zprint_json_string(f, dir);
+    zputs(f, ",\"t\":");
+    zprint_uint(f, joy_timeval_to_milliseconds(tmp)); // note: not pkt_info->time
+    zputs(f, ",\"flags\":");
+    zprint_json_string(f, flags_string);
     tcp_opt_print_json(f, pkt_info->opts, pkt_info->opt_len);
-    zprintf(f, "}");
+    zputc(f, '}');
 
 }
 
 
 
 static void pkt_info_print_interleaved(zfile f,
+                                       const struct timeval *start,
                                        const struct pkt_info *pkt_info,
                                        unsigned int np,
+                                       const struct timeval *start2,
                                        const struct pkt_info *pkt_info2,
                                        unsigned int np2) {
     
     unsigned int i, j, imax, jmax;
-    struct timeval ts_last;
+    struct timeval ts_last, ts_i, ts_j;
     struct tcp_state tcp_state = {0, 0};
     struct tcp_state rev_tcp_state = {0,0};
 
@@ -470,57 +503,61 @@ static void pkt_info_print_interleaved(zfile f,
             return; /* nothing to report */
         }
 
-        zprintf(f, ",\"ppi\":[");
-        ts_last = pkt_info[0].time;
+        zputs(f, ",\"ppi\":[");
+        ts_last = *start;
         for (i=0; i < imax; i++) { 
             if (i) { 
-                zprintf(f, ",");
+                zputc(f, ',');
             }
-            pkt_info_process(f, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
+            pkt_info_process(f, start, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
         }
-        zprintf(f, "]");        
+        zputc(f, ']');        
 
     } else { /*  bidirectional tcp flow in (pkt_info, pkt_info2), interleaving needed */
 
-        if (joy_timer_lt(&pkt_info[0].time, &pkt_info2[0].time)) {
-            ts_last = pkt_info[0].time;
+        joy_timer_add_delta(start, pkt_info[0].time, &ts_i);
+        joy_timer_add_delta(start2, pkt_info2[0].time, &ts_j);
+        if (joy_timer_lt(&ts_i, &ts_j)) {
+            ts_last = ts_i;
         } else {
-            ts_last = pkt_info2[0].time;
+            ts_last = ts_j;
         }
 
         jmax = np2 > glb_config->num_pkts ? glb_config->num_pkts : np2;
         if (!imax || !jmax) {
           return;   /* nothing to output */
         }
-        zprintf(f, ",\"ppi\":[");
+        zputs(f, ",\"ppi\":[");
         i = j = 0;
         while ((i < imax) || (j < jmax)) {      
           
             if (i >= imax) {  /* record list is exhausted, so use twin */
-                pkt_info_process(f, &pkt_info2[j], &rev_tcp_state, &tcp_state, ts_last);
+                pkt_info_process(f, start2, &pkt_info2[j], &rev_tcp_state, &tcp_state, ts_last);
                 j++;
             } else if (j >= jmax) {  /* twin list is exhausted, so use record */
-                pkt_info_process(f, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
+                pkt_info_process(f, start, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
                 i++;
             } else { /* neither list is exhausted, so use list with lowest time */     
 
-                    if (joy_timer_lt(&pkt_info[i].time, &pkt_info2[j].time)) {
-                        pkt_info_process(f, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
+                    joy_timer_add_delta(start, pkt_info[i].time, &ts_i);
+                    joy_timer_add_delta(start2, pkt_info2[j].time, &ts_j);
+                    if (joy_timer_lt(&ts_i, &ts_j)) {
+                        pkt_info_process(f, start, &pkt_info[i], &tcp_state, &rev_tcp_state, ts_last);
                         if (i < imax) {
                             i++;
                         }
                     } else {
-                        pkt_info_process(f, &pkt_info2[j], &rev_tcp_state, &tcp_state, ts_last);
+                        pkt_info_process(f, start2, &pkt_info2[j], &rev_tcp_state, &tcp_state, ts_last);
                         if (j < jmax) {
                             j++;
                         }
                     }
             }
             if (!((i == imax) & (j == jmax))) { /* we are done */
-                zprintf(f, ",");
+                zputc(f, ',');
             }
         }
-        zprintf(f, "]");        
+        zputc(f, ']');        
     }
 }
 
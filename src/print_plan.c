@@ -0,0 +1,244 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file print_plan.c
+ *
+ * \brief compiles the fields option into a plan of the members of a
+ *        flow record that are written to the JSON output
+ *
+ * The plan is compiled once, when joy starts, into bit masks that
+ * flow_record_print_json() and the print functions of the features
+ * test before they format a member; see print_plan.h.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "print_plan.h"
+#include "config.h"
+#include "err.h"
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+#define print_plan_feature_name(F) #F,
+
+/* names of the members, indexed by enum print_plan_field */
+static const char *print_plan_names[PLAN_NUM_FIELDS] = {
+    "sa", "da", "pr", "sp", "dp", "labels",
+    "bytes_out", "num_pkts_out", "bytes_in", "num_pkts_in",
+    "time_start", "time_end", "packets",
+    "byte_dist", "compact_byte_dist", "entropy", "p_malware",
+    "ip", "tcp",
+    MAP(print_plan_feature_name, feature_list)
+    "exe", "hd", "probable_os", "idp", "debug", "expire_type"
+};
+
+/* names of the parts of the tls object, indexed by enum print_plan_tls_field */
+static const char *print_plan_tls_names[PLAN_TLS_NUM_FIELDS] = {
+    "key_exchange", "random", "sid", "sni", "scs", "cs",
+    "extensions", "fingerprint_labels", "cert", "srlt"
+};
+
+/* the members every flow record has, one of which leads the record */
+#define PLAN_LEADING_FIELDS ((1ull << PLAN_FIELD_SA) | (1ull << PLAN_FIELD_DA) | \
+                             (1ull << PLAN_FIELD_PR) | (1ull << PLAN_FIELD_SP) | \
+                             (1ull << PLAN_FIELD_DP) | (1ull << PLAN_FIELD_BYTES_OUT) | \
+                             (1ull << PLAN_FIELD_NUM_PKTS_OUT) | \
+                             (1ull << PLAN_FIELD_TIME_START) | \
+                             (1ull << PLAN_FIELD_TIME_END) | (1ull << PLAN_FIELD_PACKETS))
+
+static int print_plan_lookup (const char **names, unsigned int num, const char *name) {
+    unsigned int i;
+
+    for (i = 0; i < num; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+/* adds one name of the fields option to a plan */
+static int print_plan_add (print_plan_t *plan, char *name) {
+    char *part;
+    int field, i;
+
+    part = strchr(name, '.');
+    if (part != NULL) {
+        *part++ = '\0';
+    }
+    field = print_plan_lookup(print_plan_names, PLAN_NUM_FIELDS, name);
+    if (field < 0) {
+        joy_log_err("fields: unknown member %s", name);
+        return failure;
+    }
+    plan->fields |= 1ull << field;
+
+    if (part == NULL) {
+        plan->parts[field] = UINT32_MAX;
+        return ok;
+    }
+    if (field != PLAN_FIELD_tls) {
+        joy_log_err("fields: the parts of %s can't be chosen", name);
+        return failure;
+    }
+    i = print_plan_lookup(print_plan_tls_names, PLAN_TLS_NUM_FIELDS, part);
+    if (i < 0) {
+        joy_log_err("fields: unknown part %s of %s", part, name);
+        return failure;
+    }
+    plan->parts[field] |= 1u << i;
+    return ok;
+}
+
+/**
+ * \brief Compile the value of the fields option into a plan.
+ * \param spec Comma separated names of members, or parts of members
+ * \return The plan, or NULL if spec is not valid
+ */
+print_plan_t *print_plan_compile (const char *spec) {
+    print_plan_t *plan;
+    char *names, *name, *save = NULL;
+    size_t len;
+
+    if (spec == NULL) {
+        return NULL;
+    }
+    plan = calloc(1, sizeof(print_plan_t));
+    names = strdup(spec);
+    if (plan == NULL || names == NULL) {
+        joy_log_err("out of memory");
+        free(plan);
+        free(names);
+        return NULL;
+    }
+
+    for (name = strtok_r(names, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save)) {
+        while (*name == ' ' || *name == '\t') {
+            name++;
+        }
+        len = strlen(name);
+        while (len > 0 && (name[len - 1] == ' ' || name[len - 1] == '\t')) {
+            name[--len] = '\0';
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (print_plan_add(plan, name) != ok) {
+            free(names);
+            free(plan);
+            return NULL;
+        }
+    }
+    free(names);
+
+    if ((plan->fields & PLAN_LEADING_FIELDS) == 0) {
+        joy_log_err("fields: must include one of sa, da, pr, sp, dp, bytes_out, "
+                    "num_pkts_out, time_start, time_end or packets");
+        free(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+/**
+ * \brief Free a plan.
+ * \param plan The plan, or NULL
+ * \return none
+ */
+void print_plan_free (print_plan_t *plan) {
+    free(plan);
+}
+
+/**
+ * \brief Unit test for print plans.
+ * \return Number of failures
+ */
+int print_plan_unit_test (void) {
+    static const char *bad[] = {
+        "", "tls", "sa,nosuch", "sa,dns.qn", "sa,tls.nosuch", "sa,.cs", "labels,ip"
+    };
+    print_plan_t *plan;
+    unsigned int i;
+    int num_fails = 0;
+
+    if (PLAN_NUM_FIELDS > 64 || PLAN_TLS_NUM_FIELDS > 32) {
+        return 1;
+    }
+    if (print_plan_has((print_plan_t *)NULL, PLAN_FIELD_EXPIRE_TYPE) == 0 ||
+        print_plan_has_part((print_plan_t *)NULL, PLAN_FIELD_tls, PLAN_TLS_CERT) == 0) {
+        num_fails++;
+    }
+
+    plan = print_plan_compile(" sa, da ,pr,sp,dp,bytes_out,tls.cs,tls.sni,,dns");
+    if (plan == NULL) {
+        return num_fails + 1;
+    }
+    num_fails += !print_plan_has(plan, PLAN_FIELD_SA);
+    num_fails += !print_plan_has(plan, PLAN_FIELD_DA);
+    num_fails += !print_plan_has(plan, PLAN_FIELD_BYTES_OUT);
+    num_fails += print_plan_has(plan, PLAN_FIELD_BYTES_IN);
+    num_fails += print_plan_has(plan, PLAN_FIELD_PACKETS);
+    num_fails += print_plan_has(plan, PLAN_FIELD_EXPIRE_TYPE);
+    num_fails += !print_plan_has(plan, PLAN_FIELD_tls);
+    num_fails += !print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_CS);
+    num_fails += !print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SNI);
+    num_fails += print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_CERT);
+    num_fails += !print_plan_has(plan, PLAN_FIELD_dns);
+    num_fails += print_plan_has(plan, PLAN_FIELD_http);
+    print_plan_free(plan);
+
+    /* a whole member takes in all of its parts */
+    plan = print_plan_compile("time_start,tls.cs,tls");
+    if (plan == NULL) {
+        return num_fails + 1;
+    }
+    for (i = 0; i < PLAN_TLS_NUM_FIELDS; i++) {
+        num_fails += !print_plan_has_part(plan, PLAN_FIELD_tls, i);
+    }
+    print_plan_free(plan);
+
+    for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        plan = print_plan_compile(bad[i]);
+        if (plan != NULL) {
+            joy_log_err("fields=%s was accepted", bad[i]);
+            print_plan_free(plan);
+            num_fails++;
+        }
+    }
+    return num_fails;
+}
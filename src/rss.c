@@ -0,0 +1,477 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file rss.c
+ *
+ * \brief Receive side scaling style distribution of flows over
+ *        contexts
+ *
+ * The hash is the Toeplitz hash that NICs use for RSS, over the
+ * addresses and ports of a flow in the order a NIC feeds them in:
+ * source address, destination address, source port, destination
+ * port.  With a key made of a repeated 16-bit pattern, swapping the
+ * source and destination leaves the hash unchanged, so both
+ * directions of a flow land in the same context, just as they do on a
+ * NIC configured with the same symmetric key.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rss.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/** the symmetric key; any key made of one repeated 16-bit value works */
+static const uint8_t rss_sym_key[RSS_KEY_LEN] = {
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a,
+    0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a, 0x6d, 0x5a
+};
+
+/*
+ * the hash is linear, so it is the xor of what each input byte adds to
+ * it; with the symmetric key that depends only on the byte's value and
+ * whether it sits at an even or odd offset
+ */
+static uint32_t rss_sym_table[2][256];
+static pthread_once_t rss_sym_table_once = PTHREAD_ONCE_INIT;
+
+static void rss_sym_table_build (void) {
+    uint8_t data[2];
+    unsigned int v;
+
+    for (v = 0; v < 256; v++) {
+        data[0] = (uint8_t)v;
+        data[1] = 0;
+        rss_sym_table[0][v] = rss_toeplitz_hash(rss_sym_key, RSS_KEY_LEN, data, 2);
+        data[0] = 0;
+        data[1] = (uint8_t)v;
+        rss_sym_table[1][v] = rss_toeplitz_hash(rss_sym_key, RSS_KEY_LEN, data, 2);
+    }
+}
+
+/**
+ * \brief Compute the Toeplitz hash of some bytes.
+ *
+ * For each set bit of the input, the 32 bits of the key starting at
+ * that bit position are xored into the result.
+ *
+ * \param key The key
+ * \param key_len Bytes of key, at least len + 4
+ * \param data The bytes to hash
+ * \param len Number of bytes to hash
+ * \return The hash
+ */
+uint32_t rss_toeplitz_hash (const uint8_t *key, unsigned int key_len,
+                            const uint8_t *data, unsigned int len) {
+    uint32_t hash = 0;
+    uint32_t window;
+    unsigned int i;
+    int bit;
+
+    if (key_len < 4) {
+        return 0;
+    }
+    window = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16) |
+             ((uint32_t)key[2] << 8) | (uint32_t)key[3];
+    for (i = 0; i < len; i++) {
+        for (bit = 7; bit >= 0; bit--) {
+            if (data[i] & (1 << bit)) {
+                hash ^= window;
+            }
+            window <<= 1;
+            if (i + 4 < key_len && (key[i + 4] & (1 << bit))) {
+                window |= 1;
+            }
+        }
+    }
+    return hash;
+}
+
+/**
+ * \brief Compute the symmetric Toeplitz hash of a flow key.
+ *
+ * An IPv4 key leaves all but the first 4 bytes of each address zero
+ * and is hashed over 12 bytes of input, otherwise over 36, matching
+ * what a NIC computes for the packet.  The protocol is not part of
+ * the hash; ports are zero for protocols without them, which gives
+ * the same result as a NIC's address-only hash.
+ *
+ * \param key The flow key
+ * \return The hash
+ */
+uint32_t rss_hash_flow_key (const flow_key_t *key) {
+    const uint8_t *sa = (const uint8_t *)&key->sa;
+    const uint8_t *da = (const uint8_t *)&key->da;
+    uint8_t data[36];
+    unsigned int addr_len = 4;
+    unsigned int i, n = 0;
+    uint32_t hash = 0;
+
+    pthread_once(&rss_sym_table_once, rss_sym_table_build);
+
+    for (i = 4; i < 16; i++) {
+        if (sa[i] | da[i]) {
+            addr_len = 16;
+            break;
+        }
+    }
+    for (i = 0; i < addr_len; i++) {
+        data[n++] = sa[i];
+    }
+    for (i = 0; i < addr_len; i++) {
+        data[n++] = da[i];
+    }
+    data[n++] = (uint8_t)(key->sp >> 8);
+    data[n++] = (uint8_t)key->sp;
+    data[n++] = (uint8_t)(key->dp >> 8);
+    data[n++] = (uint8_t)key->dp;
+
+    for (i = 0; i < n; i++) {
+        hash ^= rss_sym_table[i & 1][data[i]];
+    }
+    return hash;
+}
+
+/**
+ * \brief Spread the buckets of a table evenly over a number of queues
+ *        and clear its load counters.
+ * \param t The table
+ * \param num_queues Number of queues, at least 1
+ * \return none
+ */
+void rss_table_init (rss_table_t *t, uint8_t num_queues) {
+    unsigned int b;
+
+    memset_s(t, sizeof(rss_table_t), 0x00, sizeof(rss_table_t));
+    if (num_queues == 0) {
+        num_queues = 1;
+    }
+    t->num_queues = num_queues;
+    for (b = 0; b < RSS_RETA_SIZE; b++) {
+        t->reta[b] = (uint8_t)(b % num_queues);
+    }
+}
+
+/**
+ * \brief Find the queue of a hash without counting anything, so that
+ *        threads other than the table's owner may call it.
+ * \param t The table
+ * \param hash The hash of the packet's flow
+ * \return The queue
+ */
+uint8_t rss_table_queue (const rss_table_t *t, uint32_t hash) {
+    return t->reta[hash & (RSS_RETA_SIZE - 1)];
+}
+
+/**
+ * \brief Find the queue of a hash and count a packet against it.
+ * \param t The table
+ * \param hash The hash of the packet's flow
+ * \param bytes Length of the packet
+ * \return The queue
+ */
+uint8_t rss_table_lookup (rss_table_t *t, uint32_t hash, uint32_t bytes) {
+    unsigned int b = hash & (RSS_RETA_SIZE - 1);
+    uint8_t q = rss_table_queue(t, hash);
+
+    t->bucket_load[b].packets++;
+    t->bucket_load[b].bytes += bytes;
+    t->queue_load[q].packets++;
+    t->queue_load[q].bytes += bytes;
+    return q;
+}
+
+/**
+ * \brief Move idle buckets from busy queues to quiet ones.
+ *
+ * A queue is busy when it took over a quarter more packets than the
+ * mean since the last call.  Only buckets that saw no packet at all
+ * in that time are moved, so as long as calls are further apart than
+ * the flow inactivity timeout no live flow changes queue; the moved
+ * buckets send the flows that start later to the quiet queues.  At
+ * most half of a busy queue's idle buckets are moved per call, so the
+ * table settles over several calls rather than swinging back and
+ * forth.  The per-bucket counters are cleared for the next interval.
+ *
+ * \param t The table
+ * \return Number of buckets moved
+ */
+unsigned int rss_table_rebalance (rss_table_t *t) {
+    uint64_t load[RSS_MAX_QUEUES];
+    uint64_t total = 0;
+    uint64_t mean, share;
+    unsigned int moved = 0;
+    unsigned int b, i, q, dst, idle;
+
+    memset_s(load, sizeof(load), 0x00, sizeof(load));
+    for (b = 0; b < RSS_RETA_SIZE; b++) {
+        load[t->reta[b]] += t->bucket_load[b].packets;
+        total += t->bucket_load[b].packets;
+    }
+    mean = total / t->num_queues;
+
+    /* what a bucket can be expected to bring in */
+    share = total / RSS_RETA_SIZE;
+    if (share == 0) {
+        share = 1;
+    }
+
+    for (q = 0; q < t->num_queues && t->num_queues > 1 && mean > 0; q++) {
+        if (load[q] * 4 <= mean * 5) {
+            continue;
+        }
+        idle = 0;
+        for (b = 0; b < RSS_RETA_SIZE; b++) {
+            if (t->reta[b] == q && t->bucket_load[b].packets == 0) {
+                idle++;
+            }
+        }
+        idle /= 2;
+        for (b = 0; b < RSS_RETA_SIZE && idle > 0 && load[q] > mean; b++) {
+            if (t->reta[b] != q || t->bucket_load[b].packets != 0) {
+                continue;
+            }
+            /* give it to the quietest queue, if that is below the mean */
+            dst = 0;
+            for (i = 1; i < t->num_queues; i++) {
+                if (load[i] < load[dst]) {
+                    dst = i;
+                }
+            }
+            if (load[dst] >= mean) {
+                break;
+            }
+            t->reta[b] = (uint8_t)dst;
+            load[dst] += share;
+            load[q] = (load[q] > share) ? load[q] - share : 0;
+            moved++;
+            idle--;
+        }
+    }
+
+    memset_s(t->bucket_load, sizeof(t->bucket_load), 0x00, sizeof(t->bucket_load));
+    return moved;
+}
+
+/*
+ * unit test
+ */
+
+/* deterministic pseudo-random numbers for the tests */
+static uint32_t rss_test_rand (uint32_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void rss_test_flow_key (flow_key_t *key, uint32_t *state, int v6) {
+    uint8_t *sa = (uint8_t *)&key->sa;
+    uint8_t *da = (uint8_t *)&key->da;
+    unsigned int i, n = v6 ? 16 : 4;
+
+    memset_s(key, sizeof(flow_key_t), 0x00, sizeof(flow_key_t));
+    for (i = 0; i < n; i++) {
+        sa[i] = (uint8_t)rss_test_rand(state);
+        da[i] = (uint8_t)rss_test_rand(state);
+    }
+    key->sp = (uint16_t)rss_test_rand(state);
+    key->dp = (uint16_t)rss_test_rand(state);
+    key->prot = 6;
+}
+
+/* the same key laid out as NIC input, for the reference hash */
+static unsigned int rss_test_input (const flow_key_t *key, uint8_t *data, int v6) {
+    unsigned int n = v6 ? 16 : 4;
+
+    memcpy(data, &key->sa, n);
+    memcpy(data + n, &key->da, n);
+    data[2 * n] = (uint8_t)(key->sp >> 8);
+    data[2 * n + 1] = (uint8_t)key->sp;
+    data[2 * n + 2] = (uint8_t)(key->dp >> 8);
+    data[2 * n + 3] = (uint8_t)key->dp;
+    return 2 * n + 4;
+}
+
+/**
+ * \brief Unit test for the rss hash and table.
+ *
+ * Checks the hash against the verification suite published for RSS,
+ * that the table-driven symmetric hash agrees with the reference one
+ * and doesn't depend on direction, that flows spread evenly, and that
+ * rebalancing only moves idle buckets.
+ *
+ * \return Number of failures
+ */
+int rss_unit_test (void) {
+    static const uint8_t ms_key[RSS_KEY_LEN] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+        0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+        0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+        0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+        0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+    };
+    /* 66.9.149.187:2794 -> 161.142.100.80:1766 */
+    static const uint8_t ms_v4[12] = {
+        0x42, 0x09, 0x95, 0xbb, 0xa1, 0x8e, 0x64, 0x50,
+        0x0a, 0xea, 0x06, 0xe6
+    };
+    /* [3ffe:2501:200:1fff::7]:2794 -> [3ffe:2501:200:3::1]:1766 */
+    static const uint8_t ms_v6[36] = {
+        0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07,
+        0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+        0x0a, 0xea, 0x06, 0xe6
+    };
+    rss_table_t *t;
+    rss_table_t *before;
+    flow_key_t key, rev;
+    uint8_t data[36];
+    uint32_t state = 0x2545f491;
+    uint32_t hash;
+    uint64_t mean;
+    unsigned int i, n, b, moved;
+    int num_fails = 0;
+
+    if (rss_toeplitz_hash(ms_key, RSS_KEY_LEN, ms_v4, 12) != 0x51ccc178 ||
+        rss_toeplitz_hash(ms_key, RSS_KEY_LEN, ms_v4, 8) != 0x323e8fc2) {
+        joy_log_err("IPv4 hash does not match the verification suite");
+        num_fails++;
+    }
+    if (rss_toeplitz_hash(ms_key, RSS_KEY_LEN, ms_v6, 36) != 0x40207d3d ||
+        rss_toeplitz_hash(ms_key, RSS_KEY_LEN, ms_v6, 32) != 0x2cc18cd5) {
+        joy_log_err("IPv6 hash does not match the verification suite");
+        num_fails++;
+    }
+
+    for (i = 0; i < 2000; i++) {
+        rss_test_flow_key(&key, &state, i & 1);
+        n = rss_test_input(&key, data, i & 1);
+        hash = rss_hash_flow_key(&key);
+        if (hash != rss_toeplitz_hash(rss_sym_key, RSS_KEY_LEN, data, n)) {
+            joy_log_err("symmetric hash differs from the reference hash");
+            num_fails++;
+            break;
+        }
+        rev = key;
+        memcpy(&rev.sa, &key.da, sizeof(rev.sa));
+        memcpy(&rev.da, &key.sa, sizeof(rev.da));
+        rev.sp = key.dp;
+        rev.dp = key.sp;
+        if (rss_hash_flow_key(&rev) != hash) {
+            joy_log_err("hash depends on the direction of the flow");
+            num_fails++;
+            break;
+        }
+    }
+
+    t = calloc(1, sizeof(rss_table_t));
+    before = calloc(1, sizeof(rss_table_t));
+    if (t == NULL || before == NULL) {
+        free(t);
+        free(before);
+        return num_fails + 1;
+    }
+
+    /* flows spread within 10% of the mean over an odd number of queues */
+    rss_table_init(t, 6);
+    for (i = 0; i < 60000; i++) {
+        rss_test_flow_key(&key, &state, 0);
+        rss_table_lookup(t, rss_hash_flow_key(&key), 100);
+    }
+    for (i = 0; i < 6; i++) {
+        if (t->queue_load[i].packets < 9000 || t->queue_load[i].packets > 11000 ||
+            t->queue_load[i].bytes != t->queue_load[i].packets * 100) {
+            joy_log_err("queue %u took %lu of 60000 flows", i, (unsigned long)t->queue_load[i].packets);
+            num_fails++;
+        }
+    }
+
+    /* queue 0 is busy; only its idle buckets may move, to the others */
+    rss_table_init(t, 4);
+    for (b = 0; b < RSS_RETA_SIZE; b++) {
+        if (t->reta[b] == 0) {
+            if ((b / 4) % 2 == 0) {
+                rss_table_lookup(t, b, 100);
+                t->bucket_load[b].packets += 1000;
+            }
+        } else if (b % 2 == 0) {
+            t->bucket_load[b].packets += 100;
+        }
+    }
+    *before = *t;
+    moved = rss_table_rebalance(t);
+    if (moved == 0 || moved > RSS_RETA_SIZE / 16) {
+        joy_log_err("%u buckets moved", moved);
+        num_fails++;
+    }
+    for (b = 0; b < RSS_RETA_SIZE; b++) {
+        if (t->reta[b] != before->reta[b] &&
+            (before->reta[b] != 0 || before->bucket_load[b].packets != 0 || t->reta[b] == 0)) {
+            joy_log_err("bucket %u moved from queue %u to %u", b, before->reta[b], t->reta[b]);
+            num_fails++;
+        }
+        if (t->bucket_load[b].packets != 0) {
+            joy_log_err("bucket %u load not cleared", b);
+            num_fails++;
+        }
+    }
+
+    /* an even load leaves the table alone */
+    mean = 0;
+    for (b = 0; b < RSS_RETA_SIZE; b++) {
+        t->bucket_load[b].packets = 10;
+        mean += 10;
+    }
+    *before = *t;
+    if (rss_table_rebalance(t) != 0 || memcmp(t->reta, before->reta, sizeof(t->reta)) != 0) {
+        joy_log_err("table changed under an even load of %lu packets", (unsigned long)mean);
+        num_fails++;
+    }
+
+    free(t);
+    free(before);
+    return num_fails;
+}
@@ -49,6 +49,7 @@
 #include "pkt.h"      /* for tcp macros */
 #include "config.h"
 #include "err.h"
+#include "utils.h"
 
 /* external definitions from joy.c */
 extern FILE *info;
@@ -128,7 +129,7 @@ void salt_update (struct salt *salt,
                 salt->op++;
             }
             salt->pkt_len[salt->idx] += payload_len;
-            salt->pkt_time[salt->idx] = *time;
+            joy_timer_series_set(&salt->start, salt->pkt_time, salt->idx, time);
         }
     }
 
@@ -147,42 +148,46 @@ void salt_print_json (const struct salt *x1, const struct salt *x2, zfile f) {
     unsigned int i;
 
     if (x1->np) {
-        zprintf(f, ",\"oseq\":[");
+        zputs(f, ",\"oseq\":[");
         for (i=0; i < x1->np; i++) {
             if (i) {
-                zprintf(f, ",%u", x1->seq[i] - x1->seq[i-1]);
+                zputc(f, ',');
+                zprint_uint(f, x1->seq[i] - x1->seq[i-1]);
             } else {
-                zprintf(f, "%u", x1->seq[i]);
+                zprint_uint(f, x1->seq[i]);
             }
         }
-        zprintf(f, "],\"oack\":[");
+        zputs(f, "],\"oack\":[");
         for (i=0; i < x1->np; i++) {
             if (i) {
-                zprintf(f, ",%u", x1->ack[i] - x1->ack[i-1]);
+                zputc(f, ',');
+                zprint_uint(f, x1->ack[i] - x1->ack[i-1]);
             } else {
-                zprintf(f, "%u", x1->ack[i]);
+                zprint_uint(f, x1->ack[i]);
             }
         }
-        zprintf(f, "]");
+        zputc(f, ']');
     }
     if (x2 && x2->np) {
-        zprintf(f, ",\"iseq\":[");
+        zputs(f, ",\"iseq\":[");
         for (i=0; i < x2->np; i++) {
             if (i) {
-                zprintf(f, ",%u", x2->seq[i] - x2->seq[i-1]);
+                zputc(f, ',');
+                zprint_uint(f, x2->seq[i] - x2->seq[i-1]);
             } else {
-                zprintf(f, "%u", x2->seq[i]);
+                zprint_uint(f, x2->seq[i]);
             }
         }
-        zprintf(f, "],\"iack\":[");
+        zputs(f, "],\"iack\":[");
         for (i=0; i < x2->np; i++) {
             if (i) {
-                zprintf(f, ",%u", x2->ack[i] - x2->ack[i-1]);
+                zputc(f, ',');
+                zprint_uint(f, x2->ack[i] - x2->ack[i-1]);
             } else {
-                zprintf(f, "%u", x2->ack[i]);
+                zprint_uint(f, x2->ack[i]);
             }
         }
-        zprintf(f, "]");
+        zputc(f, ']');
     }
 
 }
@@ -0,0 +1,849 @@
+/*
+ *
+ * Copyright (c) 2016-2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/**
+ * \file shm_ring.c
+ *
+ * \brief Ring of flow records in shared memory
+ *
+ * The writer is joy, one ring per context; the readers are other
+ * processes that map the same file, see shm_ring.h for its layout.
+ * The reader side doesn't depend on the joy configuration, so that
+ * a consumer can link this file on its own.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include "shm_ring.h"
+#include "output.h"
+#include "config.h"
+#include "err.h"
+#include "safe_lib.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* external definitions from joy.c */
+extern FILE *info;
+
+/* bytes a record of len bytes of data takes */
+#define SHM_RING_RECORD_SIZE(len) \
+    ((sizeof(shm_ring_record_t) + (uint64_t)(len) + SHM_RING_ALIGN - 1) & ~((uint64_t)SHM_RING_ALIGN - 1))
+
+/** the writer of a ring */
+struct shm_ring_ {
+    shm_ring_header_t *hdr;
+    unsigned char *data;                /*!< the data area                     */
+    uint64_t size;                      /*!< bytes of the data area            */
+    uint64_t head;                      /*!< copies of the shared positions    */
+    uint64_t tail;
+    uint64_t seq;
+    size_t map_size;
+};
+
+/** a reader of a ring */
+struct shm_ring_reader_ {
+    shm_ring_header_t *hdr;
+    unsigned char *data;
+    uint64_t size;
+    uint64_t pos;                       /*!< where the next record is looked for */
+    uint64_t cur;                       /*!< start of the record handed out    */
+    uint64_t next_seq;                  /*!< sequence number expected next     */
+    uint64_t lost;                      /*!< records missed                    */
+    int started;                        /*!< a record has been handed out      */
+    int slot;                           /*!< reader slot, or -1 if none        */
+    size_t map_size;
+};
+
+#ifndef WIN32
+
+/*
+ * head and tail are published with release ordering once the records
+ * they cover are written, and loaded with acquire ordering before
+ * those records are read; a reader checks tail again after reading a
+ * record, as the writer may have overwritten it meanwhile
+ */
+static inline uint64_t shm_ring_load_acquire (const uint64_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void shm_ring_store_release (uint64_t *p, uint64_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/*
+ * writer side
+ */
+
+/**
+ * \brief Create a ring file and map it.
+ *
+ * An existing file of that name is unlinked first, so that readers
+ * still mapping it see it closed rather than reused.
+ *
+ * \param path The name of the ring file, best placed in /dev/shm
+ * \param size Bytes of the data area, rounded up to a power of two
+ * \param policy What the writer does when the ring is full, one of
+ *               enum shm_ring_policy
+ * \return The ring, or NULL on failure
+ */
+shm_ring_t *shm_ring_create (const char *path, uint64_t size, unsigned int policy) {
+    shm_ring_t *r;
+    uint64_t n = SHM_RING_MIN_SIZE;
+    int fd;
+
+    if (path == NULL || policy >= SHM_RING_NUM_POLICIES) {
+        return NULL;
+    }
+    while (n < size && n < ((uint64_t)1 << 40)) {
+        n <<= 1;
+    }
+    r = calloc(1, sizeof(shm_ring_t));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->size = n;
+    r->map_size = SHM_RING_HEADER_SIZE + n;
+
+    unlink(path);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        joy_log_err("could not create ring %s (%s)", path, strerror(errno));
+        free(r);
+        return NULL;
+    }
+    if (ftruncate(fd, (off_t)r->map_size) != 0) {
+        joy_log_err("could not size ring %s to %lu bytes (%s)", path,
+                    (unsigned long)r->map_size, strerror(errno));
+        close(fd);
+        unlink(path);
+        free(r);
+        return NULL;
+    }
+    r->hdr = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (r->hdr == MAP_FAILED) {
+        joy_log_err("could not map ring %s (%s)", path, strerror(errno));
+        unlink(path);
+        free(r);
+        return NULL;
+    }
+    r->data = (unsigned char *)r->hdr + SHM_RING_HEADER_SIZE;
+
+    /* the file is all zeros; readers wait for the magic number */
+    r->hdr->version = SHM_RING_VERSION;
+    r->hdr->policy = (uint16_t)policy;
+    r->hdr->size = n;
+    r->hdr->max_readers = SHM_RING_MAX_READERS;
+    r->hdr->writer_pid = (uint32_t)getpid();
+    __atomic_store_n(&r->hdr->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+    return r;
+}
+
+/* the position of the slowest reader holding a slot, or head if none */
+static uint64_t shm_ring_slowest_reader (shm_ring_t *r) {
+    shm_ring_slot_t *s;
+    uint64_t min = r->head;
+    uint64_t pos;
+    uint32_t pid;
+    unsigned int i;
+
+    for (i = 0; i < SHM_RING_MAX_READERS; i++) {
+        s = &r->hdr->readers[i];
+        pid = __atomic_load_n(&s->pid, __ATOMIC_ACQUIRE);
+        if (pid == 0) {
+            continue;
+        }
+        if (kill((pid_t)pid, 0) != 0 && errno == ESRCH) {
+            /* the reader went away without giving up its slot */
+            __atomic_compare_exchange_n(&s->pid, &pid, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+            continue;
+        }
+        pos = shm_ring_load_acquire(&s->pos);
+        if (pos < min) {
+            min = pos;
+        }
+    }
+    return min;
+}
+
+/**
+ * \brief Write a record into the ring.
+ *
+ * Only the one writer of the ring may call this.  When the ring is
+ * full, the oldest records are overwritten, after waiting for the
+ * readers to be done with them if the policy is SHM_RING_BLOCK.
+ *
+ * \param r The ring
+ * \param data The data of the record
+ * \param len Bytes of data, at most a quarter of the data area
+ * \return ok, or failure if the record is too large
+ */
+int shm_ring_write (shm_ring_t *r, const void *data, uint32_t len) {
+    uint64_t need = SHM_RING_RECORD_SIZE(len);
+    uint64_t off = r->head & (r->size - 1);
+    uint64_t room = r->size - off;
+    uint64_t total = (room < need) ? room + need : need;
+    uint64_t end = r->head + total;
+    shm_ring_record_t *rec;
+    int waited = 0;
+
+    if (need > r->size / 4) {
+        return failure;
+    }
+
+    if (r->hdr->policy == SHM_RING_BLOCK) {
+        while (end - shm_ring_slowest_reader(r) > r->size) {
+            if (!waited) {
+                r->hdr->waits++;
+                waited = 1;
+            }
+            sched_yield();
+        }
+    }
+
+    /* move tail past the records about to be overwritten */
+    if (end - r->tail > r->size) {
+        while (end - r->tail > r->size) {
+            rec = (shm_ring_record_t *)(r->data + (r->tail & (r->size - 1)));
+            r->tail += SHM_RING_RECORD_SIZE(rec->len);
+        }
+        shm_ring_store_release(&r->hdr->tail, r->tail);
+        /* readers must see the new tail before any of the new data */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+
+    if (room < need) {
+        /* records are aligned, so there is always room for the pad */
+        rec = (shm_ring_record_t *)(r->data + off);
+        rec->len = (uint32_t)(room - sizeof(shm_ring_record_t));
+        rec->flags = SHM_RING_PAD;
+        rec->seq = r->seq;
+        off = 0;
+    }
+    rec = (shm_ring_record_t *)(r->data + off);
+    rec->len = len;
+    rec->flags = 0;
+    rec->seq = r->seq++;
+    memcpy(rec + 1, data, len);
+
+    r->head = end;
+    shm_ring_store_release(&r->hdr->head, r->head);
+    __atomic_store_n(&r->hdr->records, r->seq, __ATOMIC_RELEASE);
+    return ok;
+}
+
+/**
+ * \brief Mark the ring as done and unmap it.
+ *
+ * Readers get the records still in the ring, and then learn that no
+ * more will come.  The ring file is left in place for them.
+ *
+ * \param r The ring
+ * \return none
+ */
+void shm_ring_close (shm_ring_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    __atomic_store_n(&r->hdr->closed, 1, __ATOMIC_RELEASE);
+    munmap(r->hdr, r->map_size);
+    free(r);
+}
+
+/*
+ * reader side
+ */
+
+/**
+ * \brief Map a ring file and take a reader slot.
+ *
+ * The slot holds back a writer with the SHM_RING_BLOCK policy; if
+ * all slots are taken, the reader still works, but the writer
+ * doesn't wait for it.
+ *
+ * \param path The name of the ring file
+ * \param from_oldest Nonzero to start with the oldest record in the
+ *                    ring, zero to start with the next one written
+ * \return The reader, or NULL with errno set on failure
+ */
+shm_ring_reader_t *shm_ring_attach (const char *path, int from_oldest) {
+    shm_ring_reader_t *rd;
+    shm_ring_header_t *hdr;
+    struct stat sb;
+    uint32_t pid = (uint32_t)getpid();
+    uint32_t free_pid;
+    unsigned int i;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < SHM_RING_HEADER_SIZE + SHM_RING_MIN_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    hdr = mmap(NULL, (size_t)sb.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        return NULL;
+    }
+    if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != SHM_RING_MAGIC ||
+        hdr->version != SHM_RING_VERSION ||
+        SHM_RING_HEADER_SIZE + hdr->size != (uint64_t)sb.st_size) {
+        munmap(hdr, (size_t)sb.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    rd = calloc(1, sizeof(shm_ring_reader_t));
+    if (rd == NULL) {
+        munmap(hdr, (size_t)sb.st_size);
+        return NULL;
+    }
+    rd->hdr = hdr;
+    rd->data = (unsigned char *)hdr + SHM_RING_HEADER_SIZE;
+    rd->size = hdr->size;
+    rd->map_size = (size_t)sb.st_size;
+    rd->slot = -1;
+
+    /*
+     * until the start position is published, the slot holds that of
+     * its last reader, which is behind it; a writer may wait for that
+     * a moment, but won't overwrite what this reader is about to read
+     */
+    for (i = 0; i < SHM_RING_MAX_READERS; i++) {
+        free_pid = 0;
+        if (__atomic_compare_exchange_n(&hdr->readers[i].pid, &free_pid, pid, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            rd->slot = (int)i;
+            break;
+        }
+    }
+    if (from_oldest) {
+        rd->pos = shm_ring_load_acquire(&hdr->tail);
+    } else {
+        /* records is stored after head, so this is never too low */
+        rd->pos = shm_ring_load_acquire(&hdr->head);
+        rd->next_seq = __atomic_load_n(&hdr->records, __ATOMIC_ACQUIRE);
+        rd->started = 1;
+    }
+    if (rd->slot >= 0) {
+        shm_ring_store_release(&hdr->readers[rd->slot].pos, rd->pos);
+    }
+    return rd;
+}
+
+/**
+ * \brief Get the next record, in place in the ring.
+ *
+ * The data stays valid until shm_ring_release() is called, which must
+ * be done before the next call; with the SHM_RING_OVERWRITE policy,
+ * the writer may overwrite it all the same, which shm_ring_release()
+ * then reports.
+ *
+ * \param rd The reader
+ * \param data Set to the data of the record
+ * \param len Set to the bytes of data
+ * \param seq Set to the sequence number of the record, if not NULL
+ * \return 1 if there is a record, 0 if there is none yet, or -1 if
+ *         there is none and the writer has closed the ring
+ */
+int shm_ring_next (shm_ring_reader_t *rd, const void **data, uint32_t *len, uint64_t *seq) {
+    const shm_ring_record_t *rec;
+    uint64_t head, tail, pos;
+    uint32_t rec_len, rec_flags;
+    uint64_t rec_seq;
+    uint32_t closed;
+
+    pos = rd->pos;
+    for (;;) {
+        /* closed first, so that a closed ring's head is final */
+        closed = __atomic_load_n(&rd->hdr->closed, __ATOMIC_ACQUIRE);
+        head = shm_ring_load_acquire(&rd->hdr->head);
+        if (pos >= head) {
+            rd->pos = pos;
+            return closed ? -1 : 0;
+        }
+        tail = shm_ring_load_acquire(&rd->hdr->tail);
+        if (pos < tail) {
+            /* overwritten; the sequence numbers tell how much was lost */
+            pos = tail;
+            continue;
+        }
+        rec = (const shm_ring_record_t *)(rd->data + (pos & (rd->size - 1)));
+        rec_len = rec->len;
+        rec_flags = rec->flags;
+        rec_seq = rec->seq;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&rd->hdr->tail, __ATOMIC_RELAXED) > pos) {
+            /* overwritten while it was read */
+            continue;
+        }
+        if (rec_flags & SHM_RING_PAD) {
+            pos += SHM_RING_RECORD_SIZE(rec_len);
+            continue;
+        }
+        break;
+    }
+
+    if (rd->started && rec_seq > rd->next_seq) {
+        rd->lost += rec_seq - rd->next_seq;
+    }
+    rd->started = 1;
+    rd->next_seq = rec_seq + 1;
+    rd->cur = pos;
+    rd->pos = pos + SHM_RING_RECORD_SIZE(rec_len);
+
+    *data = rec + 1;
+    *len = rec_len;
+    if (seq != NULL) {
+        *seq = rec_seq;
+    }
+    return 1;
+}
+
+/**
+ * \brief Hand back the record from shm_ring_next().
+ *
+ * Lets a writer with the SHM_RING_BLOCK policy reuse its space.
+ *
+ * \param rd The reader
+ * \return ok, or failure if the writer overwrote the record while it
+ *         was in use, in which case it counts as lost
+ */
+int shm_ring_release (shm_ring_reader_t *rd) {
+    int rc = ok;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&rd->hdr->tail, __ATOMIC_RELAXED) > rd->cur) {
+        rd->lost++;
+        rc = failure;
+    }
+    if (rd->slot >= 0) {
+        shm_ring_store_release(&rd->hdr->readers[rd->slot].pos, rd->pos);
+    }
+    return rc;
+}
+
+/* whether the process that created the ring is still running */
+static int shm_ring_writer_alive (const shm_ring_header_t *hdr) {
+    pid_t pid = (pid_t)hdr->writer_pid;
+
+    return !(kill(pid, 0) != 0 && errno == ESRCH);
+}
+
+/**
+ * \brief Wait until there is a record to read.
+ *
+ * Polls the ring, yielding the processor at first and then sleeping
+ * for a few microseconds at a time, so that a record is seen well
+ * within a millisecond of being written.
+ *
+ * \param rd The reader
+ * \param usec Most microseconds to wait
+ * \return 1 if there is a record, 0 if there is none yet, or -1 if
+ *         there is none and the writer has closed the ring or exited
+ */
+int shm_ring_wait (shm_ring_reader_t *rd, unsigned int usec) {
+    struct timespec pause = { 0, 20000 };
+    unsigned int spins = 0;
+    unsigned int waited = 0;
+
+    for (;;) {
+        if (shm_ring_load_acquire(&rd->hdr->head) > rd->pos) {
+            return 1;
+        }
+        if (__atomic_load_n(&rd->hdr->closed, __ATOMIC_ACQUIRE)) {
+            return (shm_ring_load_acquire(&rd->hdr->head) > rd->pos) ? 1 : -1;
+        }
+        if (waited >= usec) {
+            return 0;
+        }
+        if (spins < 64) {
+            spins++;
+            sched_yield();
+        } else {
+            nanosleep(&pause, NULL);
+            waited += 20;
+            if ((waited % 1000) == 0 && !shm_ring_writer_alive(rd->hdr)) {
+                /* the writer went away without closing the ring */
+                return (shm_ring_load_acquire(&rd->hdr->head) > rd->pos) ? 1 : -1;
+            }
+        }
+    }
+}
+
+/**
+ * \brief Give up the reader slot and unmap the ring.
+ * \param rd The reader
+ * \return none
+ */
+void shm_ring_detach (shm_ring_reader_t *rd) {
+    if (rd == NULL) {
+        return;
+    }
+    if (rd->slot >= 0) {
+        __atomic_store_n(&rd->hdr->readers[rd->slot].pid, 0, __ATOMIC_RELEASE);
+    }
+    munmap(rd->hdr, rd->map_size);
+    free(rd);
+}
+
+
+/*
+ * unit test
+ */
+
+#define SHM_RING_TEST_FILE "shm-ring-unit-test"
+
+/* records passed through the ring by the concurrent tests */
+#define SHM_RING_TEST_RECORDS 200000
+
+/* record lengths cycle through small and odd sizes */
+static uint32_t shm_ring_test_len (uint64_t seq) {
+    return (uint32_t)((seq * 37) % 701) + 8;
+}
+
+static void shm_ring_test_fill (unsigned char *data, uint64_t seq, uint32_t len) {
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = (unsigned char)(seq + i);
+    }
+}
+
+/* whether a record holds what shm_ring_test_fill() put into it */
+static int shm_ring_test_check (const unsigned char *data, uint64_t seq, uint32_t len) {
+    uint32_t i;
+
+    if (len != shm_ring_test_len(seq)) {
+        return failure;
+    }
+    for (i = 0; i < len; i++) {
+        if (data[i] != (unsigned char)(seq + i)) {
+            return failure;
+        }
+    }
+    return ok;
+}
+
+struct shm_ring_test_reader {
+    shm_ring_reader_t *rd;
+    uint64_t records;                   /* records read intact */
+    int num_fails;
+};
+
+/* reads until the ring is closed; a record counts if it was intact */
+static void *shm_ring_test_reader_main (void *arg) {
+    struct shm_ring_test_reader *t = (struct shm_ring_test_reader *)arg;
+    const void *data;
+    uint32_t len;
+    uint64_t seq;
+    int rc, intact;
+
+    for (;;) {
+        rc = shm_ring_next(t->rd, &data, &len, &seq);
+        if (rc < 0) {
+            break;
+        }
+        if (rc == 0) {
+            shm_ring_wait(t->rd, 1000);
+            continue;
+        }
+        intact = shm_ring_test_check(data, seq, len);
+        if (shm_ring_release(t->rd) != ok) {
+            continue;
+        }
+        if (intact != ok) {
+            if (t->num_fails++ < 5) {
+                joy_log_err("record %lu of %u bytes is corrupt", (unsigned long)seq, len);
+            }
+        } else {
+            t->records++;
+        }
+    }
+    return NULL;
+}
+
+/* writes the test records into a ring, then closes it */
+static void *shm_ring_test_writer_main (void *arg) {
+    shm_ring_t *r = (shm_ring_t *)arg;
+    unsigned char data[720];
+    uint64_t seq;
+
+    for (seq = 0; seq < SHM_RING_TEST_RECORDS; seq++) {
+        shm_ring_test_fill(data, seq, shm_ring_test_len(seq));
+        shm_ring_write(r, data, shm_ring_test_len(seq));
+    }
+    shm_ring_close(r);
+    return NULL;
+}
+
+/* passes the test records to readers in threads of their own */
+static int shm_ring_test_concurrent (unsigned int policy, unsigned int num_readers) {
+    struct shm_ring_test_reader t[2];
+    pthread_t threads[2];
+    pthread_t writer;
+    shm_ring_t *r;
+    unsigned int i;
+    int num_fails = 0;
+
+    memset_s(t, sizeof(t), 0x00, sizeof(t));
+    r = shm_ring_create(SHM_RING_TEST_FILE, SHM_RING_MIN_SIZE, policy);
+    if (r == NULL) {
+        return 1;
+    }
+    for (i = 0; i < num_readers; i++) {
+        t[i].rd = shm_ring_attach(SHM_RING_TEST_FILE, 0);
+        if (t[i].rd == NULL || pthread_create(&threads[i], NULL, shm_ring_test_reader_main, &t[i]) != 0) {
+            joy_log_err("could not start reader %u", i);
+            return num_fails + 1;
+        }
+    }
+    if (pthread_create(&writer, NULL, shm_ring_test_writer_main, r) != 0) {
+        return num_fails + 1;
+    }
+    pthread_join(writer, NULL);
+    for (i = 0; i < num_readers; i++) {
+        pthread_join(threads[i], NULL);
+        if (t[i].records + shm_ring_lost(t[i].rd) != SHM_RING_TEST_RECORDS ||
+            (policy == SHM_RING_BLOCK && shm_ring_lost(t[i].rd) != 0)) {
+            joy_log_err("%s ring: reader %u read %lu records and lost %lu of %u",
+                        policy == SHM_RING_BLOCK ? "block" : "overwrite", i, (unsigned long)t[i].records,
+                        (unsigned long)shm_ring_lost(t[i].rd), SHM_RING_TEST_RECORDS);
+            num_fails++;
+        }
+        num_fails += t[i].num_fails;
+        shm_ring_detach(t[i].rd);
+    }
+    return num_fails;
+}
+
+/**
+ * \brief Unit test for the shared memory ring.
+ *
+ * Checks the layout of the header, fills a ring well past its size
+ * and checks that a reader gets the newest records and counts the
+ * others as lost, passes records to two readers that hold back the
+ * writer and to one that doesn't, concurrently, and writes JSON
+ * records through an output stream opened on a ring.
+ *
+ * \return Number of failures
+ */
+int shm_ring_unit_test (void) {
+    unsigned char data[720];
+    shm_ring_reader_t *rd;
+    shm_ring_t *r;
+    const void *rec;
+    uint32_t len;
+    uint64_t seq, expected, records = 0;
+    unsigned int i;
+    int num_fails = 0;
+    zfile f;
+
+    if (offsetof(shm_ring_header_t, head) != 64 || offsetof(shm_ring_header_t, tail) != 128 ||
+        offsetof(shm_ring_header_t, readers) != 256 || sizeof(shm_ring_slot_t) != 64 ||
+        sizeof(shm_ring_header_t) > SHM_RING_HEADER_SIZE || sizeof(shm_ring_record_t) != 16) {
+        joy_log_err("ring header is not laid out as documented");
+        num_fails++;
+    }
+
+    /* overwrite the oldest records while nobody reads */
+    r = shm_ring_create(SHM_RING_TEST_FILE, SHM_RING_MIN_SIZE, SHM_RING_OVERWRITE);
+    rd = shm_ring_attach(SHM_RING_TEST_FILE, 0);
+    if (r == NULL || rd == NULL) {
+        shm_ring_close(r);
+        shm_ring_detach(rd);
+        remove(SHM_RING_TEST_FILE);
+        return num_fails + 1;
+    }
+    for (seq = 0; seq < 10000; seq++) {
+        shm_ring_test_fill(data, seq, shm_ring_test_len(seq));
+        if (shm_ring_write(r, data, shm_ring_test_len(seq)) != ok) {
+            num_fails++;
+        }
+    }
+    if (shm_ring_write(r, data, SHM_RING_MIN_SIZE / 2) == ok) {
+        joy_log_err("record larger than a quarter of the ring was written");
+        num_fails++;
+    }
+    shm_ring_close(r);
+    expected = 0;
+    while (shm_ring_next(rd, &rec, &len, &seq) > 0) {
+        if (seq < expected || shm_ring_test_check(rec, seq, len) != ok) {
+            joy_log_err("got record %lu, expected %lu or later", (unsigned long)seq, (unsigned long)expected);
+            num_fails++;
+        }
+        if (shm_ring_release(rd) != ok) {
+            num_fails++;
+        }
+        expected = seq + 1;
+        records++;
+    }
+    if (expected != 10000 || shm_ring_lost(rd) == 0 || records + shm_ring_lost(rd) != 10000) {
+        joy_log_err("read %lu records up to %lu and lost %lu of 10000", (unsigned long)records,
+                    (unsigned long)expected, (unsigned long)shm_ring_lost(rd));
+        num_fails++;
+    }
+    shm_ring_detach(rd);
+
+    /* concurrently, wrapping around many times */
+    num_fails += shm_ring_test_concurrent(SHM_RING_BLOCK, 2);
+    num_fails += shm_ring_test_concurrent(SHM_RING_OVERWRITE, 1);
+
+    /* each record of an output stream is one record of the ring */
+    f = zopen_ring(SHM_RING_TEST_FILE, SHM_RING_MIN_SIZE, SHM_RING_BLOCK);
+    rd = shm_ring_attach(SHM_RING_TEST_FILE, 0);
+    if (f == NULL || rd == NULL) {
+        if (f != NULL) {
+            zclose(f);
+        }
+        shm_ring_detach(rd);
+        remove(SHM_RING_TEST_FILE);
+        return num_fails + 1;
+    }
+    for (i = 0; i < 3; i++) {
+        zprintf(f, "{\"record\":%u,\"text\":\"", i);
+        memset_s(data, sizeof(data), 'a' + i, sizeof(data));
+        zwrite(f, data, (i == 1) ? sizeof(data) : 4);
+        zputs(f, "\"}\n");
+        if (i == 1) {
+            /* grows past the buffer of a stream, but stays one record */
+            zwrite(f, data, sizeof(data));
+            zwrite(f, data, sizeof(data));
+            zwrite(f, data, sizeof(data));
+            zwrite(f, data, sizeof(data));
+            zwrite(f, data, sizeof(data));
+            zwrite(f, data, sizeof(data));
+        }
+        zcommit(f);
+    }
+    zclose(f);
+    for (i = 0; shm_ring_next(rd, &rec, &len, &seq) > 0; i++) {
+        uint32_t want = (i == 1) ? 7 * sizeof(data) + 23 : 27;
+
+        if (seq != i || len != want || memcmp(rec, "{\"record\":", 10) != 0) {
+            joy_log_err("stream record %u has %u bytes, expected %u", (unsigned int)seq, len, want);
+            num_fails++;
+        }
+        shm_ring_release(rd);
+    }
+    if (i != 3) {
+        joy_log_err("%u of 3 stream records read", i);
+        num_fails++;
+    }
+    shm_ring_detach(rd);
+    remove(SHM_RING_TEST_FILE);
+
+    return num_fails;
+}
+
+#else /* WIN32 */
+
+shm_ring_t *shm_ring_create (const char *path, uint64_t size, unsigned int policy) {
+    (void)path;
+    (void)size;
+    (void)policy;
+    joy_log_err("shared memory rings are not supported on this platform");
+    return NULL;
+}
+
+int shm_ring_write (shm_ring_t *r, const void *data, uint32_t len) {
+    (void)r;
+    (void)data;
+    (void)len;
+    return failure;
+}
+
+void shm_ring_close (shm_ring_t *r) {
+    (void)r;
+}
+
+shm_ring_reader_t *shm_ring_attach (const char *path, int from_oldest) {
+    (void)path;
+    (void)from_oldest;
+    return NULL;
+}
+
+int shm_ring_next (shm_ring_reader_t *rd, const void **data, uint32_t *len, uint64_t *seq) {
+    (void)rd;
+    (void)data;
+    (void)len;
+    (void)seq;
+    return -1;
+}
+
+int shm_ring_release (shm_ring_reader_t *rd) {
+    (void)rd;
+    return failure;
+}
+
+int shm_ring_wait (shm_ring_reader_t *rd, unsigned int usec) {
+    (void)rd;
+    (void)usec;
+    return -1;
+}
+
+void shm_ring_detach (shm_ring_reader_t *rd) {
+    (void)rd;
+}
+
+int shm_ring_unit_test (void) {
+    return 0;
+}
+
+#endif /* WIN32 */
+
+/**
+ * \brief Records a reader has missed, overwritten before it got to
+ *        them or while it was reading them.
+ * \param rd The reader
+ * \return Number of records
+ */
+uint64_t shm_ring_lost (const shm_ring_reader_t *rd) {
+    return rd->lost;
+}
@@ -895,12 +895,24 @@ void ssh_update(struct ssh *ssh,
 
 }
 
+/* print a vector as the JSON string member name */
+static void ssh_print_vector_json(zfile f,
+                                  const char *name,
+                                  struct vector *vector) {
+    char *ptr = vector_string(vector);
+
+    zputs(f, ",\"");
+    zputs(f, name);
+    zputs(f, "\":");
+    zprint_json_string(f, ptr);
+    free(ptr);
+}
+
 void ssh_print_json(const struct ssh *x1,
                     const struct ssh *x2,
                     zfile f) {
 
     struct ssh *cli = NULL, *srv = NULL;
-    char *ptr;
 
     if (x1->role == role_unknown) {
         return;
@@ -912,83 +924,91 @@ void ssh_print_json(const struct ssh *x1,
         srv = (struct ssh*)x1;
     }
     ssh_process(cli, srv);
-    zprintf(f, ",\"ssh\":{");
+    zputs(f, ",\"ssh\":{");
     if (cli != NULL) {
-        zprintf(f, "\"cli\":{");
-        zprintf(f, "\"protocol\":\"%s\"", cli->protocol);
+        zputs(f, "\"cli\":{");
+        zputs(f, "\"protocol\":");
+        zprint_json_string(f, cli->protocol);
         if (cli->cookie[0] != 0) {
-            zprintf(f, ",\"cookie\":");
+            zputs(f, ",\"cookie\":");
             zprintf_raw_as_hex(f, cli->cookie, sizeof(cli->cookie));
         }
-        ptr = vector_string(cli->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(cli->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
+        ssh_print_vector_json(f, "kex_algos", cli->kex_algos);
+        ssh_print_vector_json(f, "s_host_key_algos", cli->s_host_key_algos);
+        ssh_print_vector_json(f, "c_encryption_algos", cli->c_encryption_algos);
+        ssh_print_vector_json(f, "s_encryption_algos", cli->s_encryption_algos);
+        ssh_print_vector_json(f, "c_mac_algos", cli->c_mac_algos);
+        ssh_print_vector_json(f, "s_mac_algos", cli->s_mac_algos);
+        ssh_print_vector_json(f, "c_comp_algos", cli->c_comp_algos);
+        ssh_print_vector_json(f, "s_comp_algos", cli->s_comp_algos);
+        ssh_print_vector_json(f, "c_languages", cli->c_languages);
+        ssh_print_vector_json(f, "s_languages", cli->s_languages);
         if (cli->kex_algo != NULL) {
-        zprintf(f, ",\"kex_algo\":\"%s\"", cli->kex_algo);
+        zputs(f, ",\"kex_algo\":");
+        zprint_json_string(f, cli->kex_algo);
         }
         if (cli->c_kex->len > 0) {
-        zprintf(f, ",\"c_kex\":");
+        zputs(f, ",\"c_kex\":");
         zprintf_raw_as_hex(f, (unsigned char*)cli->c_kex->bytes, cli->c_kex->len);
         }
-        zprintf(f, ",\"newkeys\":\"%s\"", cli->newkeys? "true": "false");
-        zprintf(f, ",\"unencrypted\":%d", cli->unencrypted);
-        zprintf(f, "}");
+        zputs(f, ",\"newkeys\":");
+        zprint_json_string(f, cli->newkeys? "true": "false");
+        zputs(f, ",\"unencrypted\":");
+        zprint_int(f, cli->unencrypted);
+        zputc(f, '}');
     }
     if (srv != NULL) {
         if (cli != NULL) {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
-        zprintf(f, "\"srv\":{");
-        zprintf(f, "\"protocol\":\"%s\"", srv->protocol);
+        zputs(f, "\"srv\":{");
+        zputs(f, "\"protocol\":");
+        zprint_json_string(f, srv->protocol);
         if (srv->cookie[0] != 0) {
-            zprintf(f, ",\"cookie\":");
+            zputs(f, ",\"cookie\":");
             zprintf_raw_as_hex(f, srv->cookie, sizeof(srv->cookie));
         }
-        ptr = vector_string(srv->kex_algos); zprintf(f, ",\"kex_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_host_key_algos); zprintf(f, ",\"s_host_key_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_encryption_algos); zprintf(f, ",\"c_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_encryption_algos); zprintf(f, ",\"s_encryption_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_mac_algos); zprintf(f, ",\"c_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_mac_algos); zprintf(f, ",\"s_mac_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_comp_algos); zprintf(f, ",\"c_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_comp_algos); zprintf(f, ",\"s_comp_algos\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->c_languages); zprintf(f, ",\"c_languages\":\"%s\"", ptr); free(ptr);
-        ptr = vector_string(srv->s_languages); zprintf(f, ",\"s_languages\":\"%s\"", ptr); free(ptr);
+        ssh_print_vector_json(f, "kex_algos", srv->kex_algos);
+        ssh_print_vector_json(f, "s_host_key_algos", srv->s_host_key_algos);
+        ssh_print_vector_json(f, "c_encryption_algos", srv->c_encryption_algos);
+        ssh_print_vector_json(f, "s_encryption_algos", srv->s_encryption_algos);
+        ssh_print_vector_json(f, "c_mac_algos", srv->c_mac_algos);
+        ssh_print_vector_json(f, "s_mac_algos", srv->s_mac_algos);
+        ssh_print_vector_json(f, "c_comp_algos", srv->c_comp_algos);
+        ssh_print_vector_json(f, "s_comp_algos", srv->s_comp_algos);
+        ssh_print_vector_json(f, "c_languages", srv->c_languages);
+        ssh_print_vector_json(f, "s_languages", srv->s_languages);
         if (srv->s_hostkey->len > 0) {
-        ptr = vector_string(srv->s_hostkey_type); zprintf(f, ",\"s_hostkey_type\":\"%s\"", ptr); free(ptr);
-        zprintf(f, ",\"s_hostkey\":");
+        ssh_print_vector_json(f, "s_hostkey_type", srv->s_hostkey_type);
+        zputs(f, ",\"s_hostkey\":");
         zprintf_raw_as_hex(f, (unsigned char*)srv->s_hostkey->bytes, srv->s_hostkey->len);
         }
         if (srv->s_signature->len > 0) {
-        ptr = vector_string(srv->s_signature_type); zprintf(f, ",\"s_signature_type\":\"%s\"", ptr); free(ptr);
-        zprintf(f, ",\"s_signature\":");
+        ssh_print_vector_json(f, "s_signature_type", srv->s_signature_type);
+        zputs(f, ",\"s_signature\":");
         zprintf_raw_as_hex(f, (unsigned char*)srv->s_signature->bytes, srv->s_signature->len);
         }
         if (srv->kex_algo != NULL) {
-        zprintf(f, ",\"kex_algo\":\"%s\"", srv->kex_algo);
+        zputs(f, ",\"kex_algo\":");
+        zprint_json_string(f, srv->kex_algo);
         }
         if (srv->s_kex->len > 0) {
-        zprintf(f, ",\"s_kex\":");
+        zputs(f, ",\"s_kex\":");
         zprintf_raw_as_hex(f, (unsigned char*)srv->s_kex->bytes, srv->s_kex->len);
         }
         if (srv->s_gex_p->len > 0 && srv->s_gex_g->len > 0) {
-        zprintf(f, ",\"s_gex_p\":");
+        zputs(f, ",\"s_gex_p\":");
         zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_p->bytes, srv->s_gex_p->len);
-        zprintf(f, ",\"s_gex_g\":");
+        zputs(f, ",\"s_gex_g\":");
         zprintf_raw_as_hex(f, (unsigned char*)srv->s_gex_g->bytes, srv->s_gex_g->len);
         }
-        zprintf(f, ",\"newkeys\":\"%s\"", srv->newkeys? "true": "false");
-        zprintf(f, ",\"unencrypted\":%d", srv->unencrypted);
-        zprintf(f, "}");
+        zputs(f, ",\"newkeys\":");
+        zprint_json_string(f, srv->newkeys? "true": "false");
+        zputs(f, ",\"unencrypted\":");
+        zprint_int(f, srv->unencrypted);
+        zputc(f, '}');
     }
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -64,6 +64,7 @@
 #include "pkt.h"
 #include "utils.h"
 #include "config.h"
+#include "print_plan.h"
 #include "err.h"
 #include "pthread.h"
 
@@ -76,7 +77,6 @@
 
 #define MAX_HANDSHAKE_LENGTH 11000
 
-#define TLS_HDR_LEN 5
 #define TLS_HANDSHAKE_HDR_LEN 4
 
 /* TLS mutex lock */
@@ -1595,9 +1595,9 @@ static void tls_write_message_stats(tls_t *r,
         if (pkt_hdr == NULL) {
             /* The pcap_pkthdr is not available, cannot get timestamp */
             const struct timeval ts = {0,0};
-            r->times[r->op] = ts;
+            joy_timer_series_set(&r->start, r->times, r->op, &ts);
         } else {
-            r->times[r->op] = pkt_hdr->ts;
+            joy_timer_series_set(&r->start, r->times, r->op, &pkt_hdr->ts);
         }
     }
 
@@ -1605,9 +1605,60 @@ static void tls_write_message_stats(tls_t *r,
     r->op++;
 }
 
+/**
+ * \brief Account for one TLS record header.
+ *
+ * The first record after the handshake phase triggers the parsing of
+ * the handshake data collected so far.
+ *
+ * \param r TLS structure pointer
+ * \param hdr The record header, all TLS_HDR_LEN bytes of it.
+ * \param header The pcap header of the packet the record started in.
+ *
+ * \return 0 for success, 1 if the TLS version sanity check failed
+ */
+static int tls_record_header_update (tls_t *r,
+                                     const tls_header_t *hdr,
+                                     const struct pcap_pkthdr *header) {
+
+    if (r->done_handshake == 0 && r->handshake_buffer &&
+        (hdr->content_type == TLS_CONTENT_CHANGE_CIPHER_SPEC ||
+         hdr->content_type == TLS_CONTENT_ALERT ||
+         hdr->content_type == TLS_CONTENT_APPLICATION_DATA)) {
+        /*
+         * After the handshake phase.
+         * We need to parse the contents of the handshake data
+         * that we previously collected.
+         */
+        tls_handshake_buffer_parse(r);
+        free(r->handshake_buffer);
+        r->handshake_buffer = NULL;
+        r->handshake_length = 0;
+
+        /* Set flag indicating the handshake data has been parsed */
+        r->done_handshake = 1;
+
+        if (!r->version) {
+            /* Write the TLS version to record if empty */
+            if (tls_header_version_capture(r, hdr)) {
+                /* TLS version sanity check failed */
+                return 1;
+            }
+        }
+    }
+
+    /* Write the stats for this message */
+    tls_write_message_stats(r, hdr, header);
+
+    return 0;
+}
+
 /**
  * \brief Parse, process, and record TLS payload data.
  *
+ * Only the \p len bytes at \p payload are read; a record header that
+ * runs past them is kept and completed from the next segment.
+ *
  * \param r TLS structure pointer
  * \param payload Beginning of the payload data.
  * \param len Length in bytes of the data that \p payload is pointing to.
@@ -1637,7 +1688,6 @@ void tls_update (tls_t *r,
 
     /* Cast beginning of payload to a tls_header */
     hdr = (const tls_header_t*)data;
-    msg_len = tls_header_get_length(hdr);
 
     if (r->done_handshake == 0 &&
         !(hdr->content_type == TLS_CONTENT_CHANGE_CIPHER_SPEC ||
@@ -1684,10 +1734,34 @@ void tls_update (tls_t *r,
         r->handshake_length += len;
     }
 
+    if (r->hdr_frag_len) {
+        unsigned int need = TLS_HDR_LEN - r->hdr_frag_len;
+
+        if (need > len) {
+            /* Still not the whole record header */
+            memcpy_s(r->hdr_frag + r->hdr_frag_len, need, data, len);
+            r->hdr_frag_len += len;
+            return;
+        }
+        /*
+         * Complete the record header the previous segment split,
+         * then skip its body like any other segmented message.
+         */
+        memcpy_s(r->hdr_frag + r->hdr_frag_len, need, data, need);
+        r->hdr_frag_len = 0;
+        data += need;
+        rem_len -= need;
+        hdr = (const tls_header_t*)r->hdr_frag;
+        if (tls_record_header_update(r, hdr, header)) {
+            return;
+        }
+        r->seg_offset = tls_header_get_length(hdr);
+    }
+
     if (r->seg_offset) {
-        if (r->seg_offset > len) {
+        if (r->seg_offset > rem_len) {
             /* The original message spans at least one more packet */
-            r->seg_offset -= len;
+            r->seg_offset -= rem_len;
             return;
         }
         /*
@@ -1701,6 +1775,15 @@ void tls_update (tls_t *r,
     }
 
     while (rem_len > 0) {
+        if (rem_len < TLS_HDR_LEN) {
+            /* The record header continues in the next segment */
+            if (!glb_config->ipfix_collect_port) {
+                memcpy_s(r->hdr_frag, TLS_HDR_LEN, data, rem_len);
+                r->hdr_frag_len = rem_len;
+            }
+            break;
+        }
+
         hdr = (const tls_header_t*)data;
         msg_len = tls_header_get_length(hdr);
 
@@ -1709,35 +1792,10 @@ void tls_update (tls_t *r,
             r->seg_offset = msg_len - (rem_len - TLS_HDR_LEN);
         }
 
-        if (r->done_handshake == 0 && r->handshake_buffer &&
-            (hdr->content_type == TLS_CONTENT_CHANGE_CIPHER_SPEC ||
-             hdr->content_type == TLS_CONTENT_ALERT ||
-             hdr->content_type == TLS_CONTENT_APPLICATION_DATA)) {
-            /*
-             * After the handshake phase.
-             * We need to parse the contents of the handshake data
-             * that we previously collected.
-             */
-            tls_handshake_buffer_parse(r);
-            free(r->handshake_buffer);
-            r->handshake_buffer = NULL;
-            r->handshake_length = 0;
-
-            /* Set flag indicating the handshake data has been parsed */
-            r->done_handshake = 1;
-
-            if (!r->version) {
-                /* Write the TLS version to record if empty */
-                if (tls_header_version_capture(r, hdr)) {
-                    /* TLS version sanity check failed */
-                    return;
-                }
-            }
+        if (tls_record_header_update(r, hdr, header)) {
+            return;
         }
 
-        /* Write the stats for this message */
-        tls_write_message_stats(r, hdr, header);
-
         /* Skip to the next message */
         rem_len -= msg_len + TLS_HDR_LEN;
         data += msg_len + TLS_HDR_LEN;
@@ -1772,26 +1830,21 @@ static int tls_header_version_capture (tls_t *tls_info,
 }
 
 static void zprintf_raw_as_hex_tls (zfile f, const unsigned char *data, unsigned int len) {
-    const unsigned char *x = data;
-    const unsigned char *end = data + len;
-
     if (len > 1024) {
-        zprintf(f, "\"");   /* quotes needed for JSON */
-        zprintf(f, "\"");
+        zputc(f, '"');   /* quotes needed for JSON */
+        zputc(f, '"');
         return;
     }
 
     if (data == NULL) { /* special case for nfv9 TLS export */
-        zprintf(f, "\"");   /* quotes needed for JSON */
-        zprintf(f, "\"");
+        zputc(f, '"');   /* quotes needed for JSON */
+        zputc(f, '"');
         return ;
     }
   
-    zprintf(f, "\"");   /* quotes needed for JSON */
-    while (x < end) {
-        zprintf(f, "%02x", *x++);
-    }
-    zprintf(f, "\"");
+    zputc(f, '"');   /* quotes needed for JSON */
+    zprint_hex(f, data, len);
+    zputc(f, '"');
 }
 
 static void print_bytes_dir_time_tls(unsigned short int pkt_len, const char *dir,
@@ -1799,77 +1852,93 @@ static void print_bytes_dir_time_tls(unsigned short int pkt_len, const char *dir
                                      const char *term, zfile f) {
     int i = 0;
 
-    zprintf(f, "{\"b\":%u,\"dir\":\"%s\",\"ipt\":%u,\"tp\":%u",
-            pkt_len, dir, joy_timeval_to_milliseconds(ts), m.content_type);
+    zputs(f, "{\"b\":");
+    zprint_uint(f, pkt_len);
+    zputs(f, ",\"dir\":");
+    zprint_json_string(f, dir);
+    zputs(f, ",\"ipt\":");
+    zprint_uint(f, joy_timeval_to_milliseconds(ts));
+    zputs(f, ",\"tp\":");
+    zprint_uint(f, m.content_type);
 
     if (m.num_handshakes) {
         /*
          * Print handshake information
          */
-        zprintf(f, ",\"hs_types\":[");
+        zputs(f, ",\"hs_types\":[");
         for (i = 0; i < m.num_handshakes; i++) {
             if (i == (m.num_handshakes - 1)) {
-                zprintf(f, "%u]", m.handshake_types[i]);
+                zprint_uint(f, m.handshake_types[i]);
+                zputc(f, ']');
             } else {
-                zprintf(f, "%u,", m.handshake_types[i]);
+                zprint_uint(f, m.handshake_types[i]);
+                zputc(f, ',');
             }
         }
-        zprintf(f, ",\"hs_lens\":[");
+        zputs(f, ",\"hs_lens\":[");
         for (i = 0; i < m.num_handshakes; i++) {
             if (i == (m.num_handshakes - 1)) {
-                zprintf(f, "%u]", m.handshake_lens[i]);
+                zprint_uint(f, m.handshake_lens[i]);
+                zputc(f, ']');
             } else {
-                zprintf(f, "%u,", m.handshake_lens[i]);
+                zprint_uint(f, m.handshake_lens[i]);
+                zputc(f, ',');
             }
         }
     }
 
     /* Close the object */
-    zprintf(f, "}%s", term);
+    zputc(f, '}');
+    zputs(f, term);
 }
 
 static void len_time_print_interleaved_tls (unsigned int op, const unsigned short *len, 
-    const struct timeval *time, const tls_message_stat_t *msg_stat,
+    const struct timeval *start, const int32_t *time, const tls_message_stat_t *msg_stat,
     unsigned int op2, const unsigned short *len2, 
-    const struct timeval *time2, const tls_message_stat_t *msg_stat2, zfile f) {
+    const struct timeval *start2, const int32_t *time2, const tls_message_stat_t *msg_stat2, zfile f) {
     unsigned int i, j, imax, jmax;
-    struct timeval ts, ts_last, ts_start, tmp;
+    struct timeval ts, ts_last, ts_start, tmp, ts_i, ts_j;
     unsigned int pkt_len;
     const char *dir;
     tls_message_stat_t stat;
 
-    zprintf(f, ",\"srlt\":[");
+    zputs(f, ",\"srlt\":[");
 
     if (len2 == NULL) {
       
-        ts_start = *time;
+        joy_timer_series_get(start, time, 0, &ts_start);
 
         imax = op > NUM_PKT_LEN_TLS ? NUM_PKT_LEN_TLS : op;
         if (imax == 0) { 
             ; /* no packets had data, so we print out nothing */
         } else {
             for (i = 0; i < imax-1; i++) {
+                    joy_timer_series_get(start, time, i, &ts_i);
                     if (i > 0) {
-                        joy_timer_sub(&time[i], &time[i-1], &ts);
+                        joy_timer_sub(&ts_i, &ts_last, &ts);
                     } else {
                         joy_timer_clear(&ts);
                     }
+                    ts_last = ts_i;
                     print_bytes_dir_time_tls(len[i], OUT, ts, msg_stat[i], ",", f);
             }
             if (i == 0) {        /* this code could be simplified */    
                     joy_timer_clear(&ts);  
             } else {
-                    joy_timer_sub(&time[i], &time[i-1], &ts);
+                    joy_timer_series_get(start, time, i, &ts_i);
+                    joy_timer_sub(&ts_i, &ts_last, &ts);
             }
             print_bytes_dir_time_tls(len[i], OUT, ts, msg_stat[i], "", f);
         }
-        zprintf(f, "]"); 
+        zputc(f, ']'); 
     } else {
 
-        if (joy_timer_lt(time, time2)) {
-            ts_start = *time;
+        joy_timer_series_get(start, time, 0, &ts_i);
+        joy_timer_series_get(start2, time2, 0, &ts_j);
+        if (joy_timer_lt(&ts_i, &ts_j)) {
+            ts_start = ts_i;
         } else {
-            ts_start = *time2;
+            ts_start = ts_j;
         }
 
         imax = op > NUM_PKT_LEN_TLS ? NUM_PKT_LEN_TLS : op;
@@ -1877,23 +1946,29 @@ static void len_time_print_interleaved_tls (unsigned int op, const unsigned shor
         i = j = 0;
         ts_last = ts_start;
         while ((i < imax) || (j < jmax)) {      
+            if (i < imax) {
+                    joy_timer_series_get(start, time, i, &ts_i);
+            }
+            if (j < jmax) {
+                    joy_timer_series_get(start2, time2, j, &ts_j);
+            }
 
             if (i >= imax) {  /* record list is exhausted, so use twin */
                     dir = OUT;
-                    ts = time2[j];
+                    ts = ts_j;
                     pkt_len = len2[j];
                     stat = msg_stat2[j];
                     j++;
             } else if (j >= jmax) {  /* twin list is exhausted, so use record */
                     dir = IN;
-                    ts = time[i];
+                    ts = ts_i;
                     pkt_len = len[i];
                     stat = msg_stat[i];
                     i++;
             } else { /* neither list is exhausted, so use list with lowest time */     
 
-                    if (joy_timer_lt(&time[i], &time2[j])) {
-                        ts = time[i];
+                    if (joy_timer_lt(&ts_i, &ts_j)) {
+                        ts = ts_i;
                         pkt_len = len[i];
                         stat = msg_stat[i];
                         dir = IN;
@@ -1901,7 +1976,7 @@ static void len_time_print_interleaved_tls (unsigned int op, const unsigned shor
                             i++;
                         }
                     } else {
-                        ts = time2[j];
+                        ts = ts_j;
                         pkt_len = len2[j];
                         stat = msg_stat2[j];
                         dir = OUT;
@@ -1914,10 +1989,10 @@ static void len_time_print_interleaved_tls (unsigned int op, const unsigned shor
             print_bytes_dir_time_tls(pkt_len, dir, tmp, stat, "", f);
             ts_last = ts;
             if (!((i == imax) & (j == jmax))) { /* we are done */
-                    zprintf(f, ",");
+                    zputc(f, ',');
             }
         }
-        zprintf(f, "]");
+        zputc(f, ']');
     }
 }
 
@@ -1965,11 +2040,11 @@ static void tls_print_extensions(const tls_extension_t *extensions,
     int i = 0;
 
     if (role == role_client) {
-        zprintf(f, ",\"c_extensions\":[");
+        zputs(f, ",\"c_extensions\":[");
     } else if (role == role_server) {
-        zprintf(f, ",\"s_extensions\":[");
+        zputs(f, ",\"s_extensions\":[");
     } else if (role == role_flow_data) {
-        zprintf(f, ",\"extensions\":[");
+        zputs(f, ",\"extensions\":[");
     } else {
         joy_log_err("unknown role is not permitted");
         return;
@@ -1980,25 +2055,52 @@ static void tls_print_extensions(const tls_extension_t *extensions,
 
         type_str = tls_extension_lookup(extensions[i].type);
         if (type_str) {
-            zprintf(f, "{\"%s\":", type_str);
+            zputc(f, '{');
+            zprint_json_string(f, type_str);
+            zputc(f, ':');
             zprintf_raw_as_hex_tls(f, extensions[i].data, extensions[i].length);
-            zprintf(f, "}");
+            zputc(f, '}');
         } else {
             /* The type is unknown */
-            zprintf(f, "{\"kind\":%u", extensions[i].type);
-                zprintf(f, ",\"data\":");
+            zputs(f, "{\"kind\":");
+            zprint_uint(f, extensions[i].type);
+                zputs(f, ",\"data\":");
             zprintf_raw_as_hex_tls(f, extensions[i].data, extensions[i].length);
-            zprintf(f, "}");
+            zputc(f, '}');
         }
 
         if (i == (count - 1)) {
-            zprintf(f, "]");
+            zputc(f, ']');
         } else {
-            zprintf(f, ",");
+            zputc(f, ',');
         }
     }
 }
 
+/**
+ * \brief Parse the handshake data that is still buffered in \p r.
+ *
+ * The handshake messages are normally parsed once the handshake phase
+ * ends; a flow that expires before that still has them in its buffer,
+ * and no version yet.  Anything that reads the TLS info of an expired
+ * flow calls this first.
+ *
+ * \param r pointer to TLS information structure
+ *
+ * \return none
+ */
+void tls_complete_handshake (tls_t *r) {
+    if (r == NULL || r->version || r->handshake_buffer == NULL) {
+        return;
+    }
+
+    tls_handshake_buffer_parse(r);
+    free(r->handshake_buffer);
+    r->handshake_buffer = NULL;
+    r->handshake_length = 0;
+    r->done_handshake = 1;
+}
+
 /**
  * \brief Print the TLS struct to JSON output file \p f.
  *
@@ -2014,6 +2116,7 @@ void tls_print_json (const tls_t *d1,
     int i = 0;
     tls_t *data = (tls_t*)d1;
     tls_t *data_twin = (tls_t*)d2;
+    const print_plan_t *plan = glb_config->plan;
 
     if (data == NULL) {
         return;
@@ -2021,13 +2124,7 @@ void tls_print_json (const tls_t *d1,
 
     /* Make sure the tls info passed in is reliable */
     if (!data->version) {
-        if (data->handshake_buffer) {
-            tls_handshake_buffer_parse(data);
-            free(data->handshake_buffer);
-            data->handshake_buffer = NULL;
-            data->handshake_length = 0;
-            data->done_handshake = 1;
-        }
+        tls_complete_handshake(data);
         if (!data->version) {
             return;
         }
@@ -2035,13 +2132,7 @@ void tls_print_json (const tls_t *d1,
 
     /* If a twin is present make sure its info is reliable */
     if (data_twin != NULL && !data_twin->version) {
-        if (data_twin->handshake_buffer) {
-            tls_handshake_buffer_parse(data_twin);
-            free(data_twin->handshake_buffer);
-            data_twin->handshake_buffer = NULL;
-            data_twin->handshake_length = 0;
-            data_twin->done_handshake = 1;
-        }
+        tls_complete_handshake(data_twin);
         if (!data_twin->version) {
             /*
              * still couldn't get the other side parsed
@@ -2052,7 +2143,7 @@ void tls_print_json (const tls_t *d1,
         }
     }
 
-    zprintf(f, ",\"tls\":{");
+    zputs(f, ",\"tls\":{");
 
     /*
      * Assign the versions according to role.
@@ -2060,43 +2151,52 @@ void tls_print_json (const tls_t *d1,
      * i.e. both client or both server
      */
     if (data->role == role_client) {
-        zprintf(f, "\"c_version\":%u", data->version);
+        zputs(f, "\"c_version\":");
+        zprint_uint(f, data->version);
         if (data_twin && data_twin->version) {
             if (data_twin->role == role_client) {
-                zprintf(f, ",\"error\":\"twin clients\"}");
+                zputs(f, ",\"error\":\"twin clients\"}");
                 return;
             }
-            zprintf(f, ",\"s_version\":%u", data->version);
+            zputs(f, ",\"s_version\":");
+            zprint_uint(f, data->version);
         }
     } else if (data->role == role_server) {
-        zprintf(f, "\"s_version\":%u", data->version);
+        zputs(f, "\"s_version\":");
+        zprint_uint(f, data->version);
         if (data_twin && data_twin->version) {
             if (data_twin->role == role_server) {
-                zprintf(f, ",\"error\":\"twin servers\"}");
+                zputs(f, ",\"error\":\"twin servers\"}");
                 return;
             }
-            zprintf(f, ",\"c_version\":%u", data->version);
+            zputs(f, ",\"c_version\":");
+            zprint_uint(f, data->version);
         }
     } else if (data->role == role_flow_data) {
-        zprintf(f, "\"version\":%u", data->version);
+        zputs(f, "\"version\":");
+        zprint_uint(f, data->version);
     } else {
-        zprintf(f, "\"error\":\"no role\"}");
+        zputs(f, "\"error\":\"no role\"}");
         return;
     }
 
     /*
      * Client key length
      */
-    if (data->client_key_length) {
-        zprintf(f, ",\"c_key_length\":%u", data->client_key_length);
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_KEY_EXCHANGE)) {
+        ; /* left out by the plan */
+    } else if (data->client_key_length) {
+        zputs(f, ",\"c_key_length\":");
+        zprint_uint(f, data->client_key_length);
         if (data->role != role_flow_data) {
-            zprintf(f, ",\"c_key_exchange\":");
+            zputs(f, ",\"c_key_exchange\":");
             zprintf_raw_as_hex_tls(f, data->clientKeyExchange, data->client_key_length/8);
         }
     } else if (data_twin && data_twin->client_key_length) {
-        zprintf(f, ",\"c_key_length\":%u", data_twin->client_key_length);
+        zputs(f, ",\"c_key_length\":");
+        zprint_uint(f, data_twin->client_key_length);
         if (data_twin->role != role_flow_data) {
-            zprintf(f, ",\"c_key_exchange\":");
+            zputs(f, ",\"c_key_exchange\":");
             zprintf_raw_as_hex_tls(f, data_twin->clientKeyExchange, data_twin->client_key_length/8);
         }
     }
@@ -2104,46 +2204,48 @@ void tls_print_json (const tls_t *d1,
     /*
      * TLS Random
      */
-    if (data->role == role_client) {
-        zprintf(f, ",\"c_random\":");
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_RANDOM)) {
+        ; /* left out by the plan */
+    } else if (data->role == role_client) {
+        zputs(f, ",\"c_random\":");
         zprintf_raw_as_hex_tls(f, data->random, 32);
         if (data_twin) {
-            zprintf(f, ",\"s_random\":");
+            zputs(f, ",\"s_random\":");
             zprintf_raw_as_hex_tls(f, data_twin->random, 32);
         }
     }
     else if (data->role == role_server) {
-        zprintf(f, ",\"s_random\":");
+        zputs(f, ",\"s_random\":");
         zprintf_raw_as_hex_tls(f, data->random, 32);
         if (data_twin) {
-            zprintf(f, ",\"c_random\":");
+            zputs(f, ",\"c_random\":");
             zprintf_raw_as_hex_tls(f, data_twin->random, 32);
         }
     } else {
-        zprintf(f, ",\"random\":");
+        zputs(f, ",\"random\":");
         zprintf_raw_as_hex_tls(f, data->random, 32);
     }
 
     /*
      * Session ID
      */
-    if (data->sid_len) {
+    if (data->sid_len && print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SID)) {
         if (data->role == role_client) {
-            zprintf(f, ",\"c_sid\":");
+            zputs(f, ",\"c_sid\":");
             zprintf_raw_as_hex_tls(f, data->sid, data->sid_len);
             if (data_twin && data_twin->sid_len) {
-                zprintf(f, ",\"s_sid\":");
+                zputs(f, ",\"s_sid\":");
                 zprintf_raw_as_hex_tls(f, data_twin->sid, data_twin->sid_len);
             }
         } else if (data->role == role_server) {
-            zprintf(f, ",\"s_sid\":");
+            zputs(f, ",\"s_sid\":");
             zprintf_raw_as_hex_tls(f, data->sid, data->sid_len);
             if (data_twin && data_twin->sid_len) {
-                zprintf(f, ",\"c_sid\":");
+                zputs(f, ",\"c_sid\":");
                 zprintf_raw_as_hex_tls(f, data_twin->sid, data_twin->sid_len);
             }
         } else {
-            zprintf(f, ",\"sid\":");
+            zputs(f, ",\"sid\":");
             zprintf_raw_as_hex_tls(f, data->sid, data->sid_len);
         }
     }
@@ -2151,35 +2253,43 @@ void tls_print_json (const tls_t *d1,
     /*
      * Server Name Indicator
      */
-    if (data->sni_length) {
-        zprintf(f, ",\"sni\":[\"%s\"]", (char *)data->sni);
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SNI)) {
+        ; /* left out by the plan */
+    } else if (data->sni_length) {
+        zputs(f, ",\"sni\":[");
+        zprint_json_string(f, (char *)data->sni);
+        zputc(f, ']');
     }
     else if (data_twin && data_twin->sni_length) {
-        zprintf(f, ",\"sni\":[\"%s\"]", (char *)data_twin->sni);
+        zputs(f, ",\"sni\":[");
+        zprint_json_string(f, (char *)data_twin->sni);
+        zputc(f, ']');
     }
 
     /*
      * Offered and selected ciphersuites
      */
     if ((data->role == role_client) || (data->role == role_flow_data)) {
-        if (data_twin && data_twin->num_ciphersuites == 1) {
+        if (data_twin && data_twin->num_ciphersuites == 1 &&
+            print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SCS)) {
             zprintf(f, ",\"scs\":\"%04x\"", data_twin->ciphersuites[0]);
         }
 
-        if (data->num_ciphersuites) {
-            zprintf(f, ",\"cs\":[");
+        if (data->num_ciphersuites && print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_CS)) {
+            zputs(f, ",\"cs\":[");
             for (i = 0; i < data->num_ciphersuites-1; i++) {
                 zprintf(f, "\"%04x\",", data->ciphersuites[i]);
             }
             zprintf(f, "\"%04x\"]", data->ciphersuites[i]);
         }
     } else {
-        if (data->num_ciphersuites == 1) {
+        if (data->num_ciphersuites == 1 && print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SCS)) {
             zprintf(f, ",\"scs\":\"%04x\"", data->ciphersuites[0]);
         }
 
-        if (data_twin && data_twin->num_ciphersuites) {
-            zprintf(f, ",\"cs\":[");
+        if (data_twin && data_twin->num_ciphersuites &&
+            print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_CS)) {
+            zputs(f, ",\"cs\":[");
             for (i = 0; i < data_twin->num_ciphersuites-1; i++) {
                 zprintf(f, "\"%04x\",", data_twin->ciphersuites[i]);
             }
@@ -2190,7 +2300,9 @@ void tls_print_json (const tls_t *d1,
     /*
      * Extensions
      */
-    if (data->num_extensions && data->role == role_client) {
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_EXTENSIONS)) {
+        ; /* left out by the plan */
+    } else if (data->num_extensions && data->role == role_client) {
         tls_print_extensions(data->extensions,
                              data->num_extensions,
                              role_client, f);
@@ -2201,7 +2313,9 @@ void tls_print_json (const tls_t *d1,
                              role_client, f);
     }
   
-    if (data->num_server_extensions && data->role == role_server) {
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_EXTENSIONS)) {
+        ; /* left out by the plan */
+    } else if (data->num_server_extensions && data->role == role_server) {
         tls_print_extensions(data->server_extensions,
                              data->num_server_extensions,
                              role_server, f);
@@ -2213,79 +2327,82 @@ void tls_print_json (const tls_t *d1,
 
     }
 
-    if (data->num_extensions && data->role == role_flow_data) {
+    if (data->num_extensions && data->role == role_flow_data &&
+        print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_EXTENSIONS)) {
         tls_print_extensions(data->extensions,
                              data->num_extensions,
                              role_flow_data, f);
     }
 
-    if (data->tls_fingerprint) {
-        zprintf(f, ",\"fingerprint_labels\":[");
+    if (data->tls_fingerprint && print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_FINGERPRINT_LABELS)) {
+        zputs(f, ",\"fingerprint_labels\":[");
         for (i = 0; i < data->tls_fingerprint->label_count; i++) {
-                zprintf(f, "\"%s\"", data->tls_fingerprint->labels[i]);
+                zprint_json_string(f, data->tls_fingerprint->labels[i]);
             if (i == (data->tls_fingerprint->label_count - 1)) {
-                zprintf(f, "]");
+                zputc(f, ']');
             } else {
-                zprintf(f, ", ");
+                zputs(f, ", ");
             }
         }
     }
 
-    if (data->role == role_client) {
+    if (!print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_CERT)) {
+        ; /* left out by the plan */
+    } else if (data->role == role_client) {
         if (data->num_certificates) {
-            zprintf(f, ",\"c_cert\":[");
+            zputs(f, ",\"c_cert\":[");
             for (i = 0; i < data->num_certificates-1; i++) {
                 tls_certificate_print_json(&data->certificates[i], f);
-                zprintf(f, "},");
+                zputs(f, "},");
             }
             tls_certificate_print_json(&data->certificates[i], f);
-            zprintf(f, "}]");
+            zputs(f, "}]");
         }
         if (data_twin && data_twin->num_certificates) {
-            zprintf(f, ",\"s_cert\":[");
+            zputs(f, ",\"s_cert\":[");
             for (i = 0; i < data_twin->num_certificates-1; i++) {
                 tls_certificate_print_json(&data_twin->certificates[i], f);
-                zprintf(f, "},");
+                zputs(f, "},");
             }
             tls_certificate_print_json(&data_twin->certificates[i], f);
-            zprintf(f, "}]");
+            zputs(f, "}]");
         }
     } else {
         if (data->num_certificates) {
-            zprintf(f, ",\"s_cert\":[");
+            zputs(f, ",\"s_cert\":[");
             for (i = 0; i < data->num_certificates-1; i++) {
                 tls_certificate_print_json(&data->certificates[i], f);
-                zprintf(f, "},");
+                zputs(f, "},");
             }
             tls_certificate_print_json(&data->certificates[i], f);
-            zprintf(f, "}]");
+            zputs(f, "}]");
         }
         if (data_twin && data_twin->num_certificates) {
-            zprintf(f, ",\"c_cert\":[");
+            zputs(f, ",\"c_cert\":[");
             for (i = 0; i < data_twin->num_certificates-1; i++) {
                 tls_certificate_print_json(&data_twin->certificates[i], f);
-                zprintf(f, "},");
+                zputs(f, "},");
             }
             tls_certificate_print_json(&data_twin->certificates[i], f);
-            zprintf(f, "}]");
+            zputs(f, "}]");
         }
     }
 
     /* Print out TLS application data lengths and times, if any */
-    if (data->op) {
+    if (data->op && print_plan_has_part(plan, PLAN_FIELD_tls, PLAN_TLS_SRLT)) {
         if (data_twin) {
-                len_time_print_interleaved_tls(data->op, data->lengths, data->times, data->msg_stats,
-                                       data_twin->op, data_twin->lengths, data_twin->times, data_twin->msg_stats, f);
+                len_time_print_interleaved_tls(data->op, data->lengths, &data->start, data->times, data->msg_stats,
+                                       data_twin->op, data_twin->lengths, &data_twin->start, data_twin->times, data_twin->msg_stats, f);
         } else {
             /*
              * unidirectional TLS does not typically happen, but if it
              * does, we need to pass in zero/NULLs, since there is no twin
              */
-                len_time_print_interleaved_tls(data->op, data->lengths, data->times, data->msg_stats, 0, NULL, NULL, NULL, f);
+                len_time_print_interleaved_tls(data->op, data->lengths, &data->start, data->times, data->msg_stats, 0, NULL, NULL, NULL, NULL, f);
         }
     }
 
-    zprintf(f, "}");
+    zputc(f, '}');
 }
 
 /**
@@ -2300,80 +2417,99 @@ void tls_print_json (const tls_t *d1,
 static void tls_certificate_print_json(const tls_certificate_t *data, zfile f) {
     int j = 0;
 
-    zprintf(f, "{\"length\":%i", data->length);
+    zputs(f, "{\"length\":");
+    zprint_int(f, data->length);
     if (data->serial_number) {
-        zprintf(f, ",\"serial_number\":");
+        zputs(f, ",\"serial_number\":");
         zprintf_raw_as_hex_tls(f, data->serial_number, data->serial_number_length);
     }
     
     if (data->signature) {
-        zprintf(f, ",\"signature\":");
+        zputs(f, ",\"signature\":");
         zprintf_raw_as_hex_tls(f, data->signature, data->signature_length);
     }
 
     if (*data->signature_algorithm) {
-        zprintf(f, ",\"signature_algo\":\"%s\"", data->signature_algorithm);
+        zputs(f, ",\"signature_algo\":");
+        zprint_json_string(f, data->signature_algorithm);
     }
 
     if (data->signature_key_size) {
-        zprintf(f, ",\"signature_key_size\":%i", data->signature_key_size);
+        zputs(f, ",\"signature_key_size\":");
+        zprint_int(f, data->signature_key_size);
     }
     
     if (data->num_issuer_items) {
-        zprintf(f, ",\"issuer\":[");
+        zputs(f, ",\"issuer\":[");
         for (j = 0; j < data->num_issuer_items; j++) {
-                zprintf(f, "{\"%s\":\"%s\"}", data->issuer[j].id, (char *)data->issuer[j].data);
+                zputc(f, '{');
+                zprint_json_string(f, data->issuer[j].id);
+                zputc(f, ':');
+                zprint_json_string(f, (char *)data->issuer[j].data);
+                zputc(f, '}');
             if (j == (data->num_issuer_items - 1)) {
-                zprintf(f, "]");
+                zputc(f, ']');
             } else {
-                zprintf(f, ",");
+                zputc(f, ',');
             }
         }
     }
 
     if (data->num_subject_items) {
-        zprintf(f, ",\"subject\":[");
+        zputs(f, ",\"subject\":[");
         for (j = 0; j < data->num_subject_items; j++) {
-                zprintf(f, "{\"%s\":\"%s\"}", data->subject[j].id, (char *)data->subject[j].data);
+                zputc(f, '{');
+                zprint_json_string(f, data->subject[j].id);
+                zputc(f, ':');
+                zprint_json_string(f, (char *)data->subject[j].data);
+                zputc(f, '}');
             if (j == (data->num_subject_items - 1)) {
-                zprintf(f, "]");
+                zputc(f, ']');
             } else {
-                zprintf(f, ",");
+                zputc(f, ',');
             }
         }
     }
 
     if (data->num_extension_items) {
-        zprintf(f, ",\"extensions\":[");
+        zputs(f, ",\"extensions\":[");
         for (j = 0; j < data->num_extension_items; j++) {
             if ((data->extensions[j].id[0] != 0) &&
                 (data->extensions[j].data != NULL)) {
-               zprintf(f, "{\"%s\":\"%s\"}", data->extensions[j].id, (char *)data->extensions[j].data);
+               zputc(f, '{');
+               zprint_json_string(f, data->extensions[j].id);
+               zputc(f, ':');
+               zprint_json_string(f, (char *)data->extensions[j].data);
+               zputc(f, '}');
             }
             if (j == (data->num_extension_items - 1)) {
-                zprintf(f, "]");
+                zputc(f, ']');
             } else {
                 if ((data->extensions[j].id[0] != 0) &&
                     (data->extensions[j].data != NULL)) {
-                   zprintf(f, ",");
+                   zputc(f, ',');
                 }
             }
         }
     }
     
     if (data->validity_not_before) {
-        zprintf(f, ",\"validity_not_before\":\"%s\"", data->validity_not_before);
+        zputs(f, ",\"validity_not_before\":");
+        zprint_json_string(f, data->validity_not_before);
     }
     if (data->validity_not_after) {
-        zprintf(f, ",\"validity_not_after\":\"%s\"", data->validity_not_after);
+        zputs(f, ",\"validity_not_after\":");
+        zprint_json_string(f, data->validity_not_after);
     }
     
     if (*data->subject_public_key_algorithm) {
-        zprintf(f, ",\"subject_public_key_algo\":\"%s\"", data->subject_public_key_algorithm);
+        zputs(f, ",\"subject_public_key_algo\":");
+        zprint_json_string(f, data->subject_public_key_algorithm);
     }
     
     if (data->subject_public_key_size) {
-        zprintf(f, ",\"subject_public_key_size\":%i", data->subject_public_key_size);
+        zputs(f, ",\"subject_public_key_size\":");
+        zprint_int(f, data->subject_public_key_size);
     }
 }
 
@@ -3334,6 +3470,56 @@ static int tls_test_calculate_handshake_length(void) {
     return num_fails;
 }
 
+/*
+ * \brief Unit test for a record header split across segments.
+ *
+ * Each segment is handed to tls_update() with its exact length, the
+ * second record's header arriving over three segments.
+ *
+ * \return 0 for success, otherwise number of failures
+ */
+static int tls_test_split_record_header(void) {
+    tls_t *record = NULL;
+    const unsigned char seg1[] = { 0x17, 0x03, 0x03, 0x00, 0x04, 0xaa, 0xbb, 0xcc, 0xdd,
+                                   0x17, 0x03 };
+    const unsigned char seg2[] = { 0x03 };
+    const unsigned char seg3[] = { 0x00, 0x06, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+                                   0x17, 0x03, 0x03, 0x00, 0x01, 0xee };
+    const uint16_t expected[] = { 4, 6, 1 };
+    unsigned int i;
+    int num_fails = 0;
+
+    tls_init(&record);
+    record->done_handshake = 1;
+
+    tls_update(record, NULL, seg1, sizeof(seg1), 1);
+    tls_update(record, NULL, seg2, sizeof(seg2), 1);
+    tls_update(record, NULL, seg3, sizeof(seg3), 1);
+
+    if (record->op != 3) {
+        joy_log_err("fail, expected (%d) records, got (%d)", 3, record->op);
+        num_fails++;
+        goto end;
+    }
+    for (i = 0; i < 3; i++) {
+        if (record->lengths[i] != expected[i] ||
+            record->msg_stats[i].content_type != TLS_CONTENT_APPLICATION_DATA) {
+            joy_log_err("fail, record %u: expected length (%d), got (%d) type (%d)",
+                        i, expected[i], record->lengths[i], record->msg_stats[i].content_type);
+            num_fails++;
+        }
+    }
+    if (record->seg_offset != 0 || record->hdr_frag_len != 0) {
+        joy_log_err("fail, segment state left over");
+        num_fails++;
+    }
+
+end:
+    tls_delete(&record);
+
+    return num_fails;
+}
+
 void tls_unit_test() {
     int num_fails = 0;
 
@@ -3344,6 +3530,8 @@ void tls_unit_test() {
 
     num_fails += tls_test_calculate_handshake_length();
 
+    num_fails += tls_test_split_record_header();
+
     num_fails += tls_test_initial_handshake();
 
     num_fails += tls_test_certificate_parsing();
@@ -48,6 +48,16 @@
 #include "err.h"
 #include "safe_lib.h"
 #include "joy_api.h"
+#include "pkt_ring.h"
+#include "rss.h"
+#include "output.h"
+#include "binrec.h"
+#include "columnar.h"
+#include "shm_ring.h"
+#include "print_plan.h"
+#include "pcap_reader.h"
+#include "affinity.h"
+#include "pkt_proc.h"
 
 /**
  * \fn int main ()
@@ -77,6 +87,66 @@ int main (void) {
         printf("radix_trie tests passed\n");
     }
 
+    if (pkt_ring_unit_test() != 0) {
+        printf("error: pkt_ring test failed\n");
+    } else {
+        printf("pkt_ring tests passed\n");
+    }
+
+    if (rss_unit_test() != 0) {
+        printf("error: rss test failed\n");
+    } else {
+        printf("rss tests passed\n");
+    }
+
+    if (output_unit_test() != 0) {
+        printf("error: output test failed\n");
+    } else {
+        printf("output tests passed\n");
+    }
+
+    if (binrec_unit_test() != 0) {
+        printf("error: binrec test failed\n");
+    } else {
+        printf("binrec tests passed\n");
+    }
+
+    if (columnar_unit_test() != 0) {
+        printf("error: columnar test failed\n");
+    } else {
+        printf("columnar tests passed\n");
+    }
+
+    if (shm_ring_unit_test() != 0) {
+        printf("error: shm_ring test failed\n");
+    } else {
+        printf("shm_ring tests passed\n");
+    }
+
+    if (print_plan_unit_test() != 0) {
+        printf("error: print_plan test failed\n");
+    } else {
+        printf("print_plan tests passed\n");
+    }
+
+    if (pcap_reader_unit_test() != 0) {
+        printf("error: pcap_reader test failed\n");
+    } else {
+        printf("pcap_reader tests passed\n");
+    }
+
+    if (affinity_unit_test() != 0) {
+        printf("error: affinity test failed\n");
+    } else {
+        printf("affinity tests passed\n");
+    }
+
+    if (pkt_proc_unit_test() != 0) {
+        printf("error: pkt_proc test failed\n");
+    } else {
+        printf("pkt_proc tests passed\n");
+    }
+
     /* Test p2f.c */
     p2f_unit_test();
 
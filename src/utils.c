@@ -196,6 +196,40 @@ FILE* joy_utils_open_test_file(const char *filename) {
     return fp;
 }
 
+/*
+ *
+ * \brief Find a pcap of the source test/pcaps/ directory.
+ *
+ * The directory is looked for from the root of the Joy source package
+ * and from one of its subdirectories; the working directory itself is
+ * tried last, for runs from within test/pcaps/.
+ *
+ * \param filename Name of the pcap to be found.
+ * \param filepath Buffer the path of the pcap is written into.
+ * \param len Size of the buffer.
+ *
+ * \return ok if the pcap was found, otherwise failure
+ */
+int joy_utils_find_test_pcap(const char *filename, char *filepath, size_t len) {
+    static const char *dirs[] = { "./test/pcaps/", "../test/pcaps/", "./" };
+    FILE *fp = NULL;
+    unsigned int i;
+    int n;
+
+    for (i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        n = snprintf(filepath, len, "%s%s", dirs[i], filename);
+        if (n < 0 || (size_t)n >= len) {
+            continue;
+        }
+        fp = fopen(filepath, "rb");
+        if (fp) {
+            fclose(fp);
+            return ok;
+        }
+    }
+    return failure;
+}
+
 /*
  *
  * \brief Open a pcap from the source test/pcaps/ directory.
@@ -207,23 +241,9 @@ FILE* joy_utils_open_test_file(const char *filename) {
 pcap_t* joy_utils_open_test_pcap(const char *filename) {
     char errbuf[PCAP_ERRBUF_SIZE];
     pcap_t *handle = NULL;
-    char *filepath = NULL;
-
-    /* Allocate memory to store constructed file path */
-    filepath = calloc(JOY_UTILS_MAX_FILEPATH, sizeof(char));
-    if (!filepath) {
-	return NULL;
-    }
+    char filepath[JOY_UTILS_MAX_FILEPATH];
 
-    /* Assume user CWD in root of Joy source package */
-    strncpy_s(filepath, JOY_UTILS_MAX_FILEPATH, "./test/pcaps/", JOY_UTILS_MAX_FILEPATH-1);
-    strncat_s(filepath, JOY_UTILS_MAX_FILEPATH, filename, JOY_UTILS_MAX_FILEPATH - 1);
-    handle = pcap_open_offline(filepath, errbuf);
-    if (!handle) {
-        /* Assume user CWD one-level subdir of Joy source package */
-        memset_s(filepath, JOY_UTILS_MAX_FILEPATH, 0, JOY_UTILS_MAX_FILEPATH);
-        strncpy_s(filepath, JOY_UTILS_MAX_FILEPATH, "../test/pcaps/", JOY_UTILS_MAX_FILEPATH-1);
-        strncat_s(filepath, JOY_UTILS_MAX_FILEPATH, filename, JOY_UTILS_MAX_FILEPATH - 1);
+    if (joy_utils_find_test_pcap(filename, filepath, sizeof(filepath)) == ok) {
         handle = pcap_open_offline(filepath, errbuf);
     }
 
@@ -231,10 +251,6 @@ pcap_t* joy_utils_open_test_pcap(const char *filename) {
         joy_log_err("could not open %s", filename);
     }
 
-    /* Cleanup */
-    free(filepath);
-
-
     return handle;
 }
 
@@ -354,6 +370,88 @@ unsigned int joy_timeval_to_milliseconds(struct timeval ts) {
     return result;
 }
 
+/*
+ * The per-packet times of a flow (its SPLT, SALT, PPI and TLS record
+ * times) are kept as a series: the time of the first entry, and every
+ * entry as a 32-bit signed count of microseconds after it.  That is a
+ * quarter of the size of an array of struct timeval, and covers about
+ * 35 minutes either side of the first entry, beyond which the entries
+ * saturate; flows are expired long before that.
+ */
+
+/**
+ * \brief Microseconds from \p start to \p t, saturated to 32 bits.
+ * \param start Start of the series
+ * \param t Time
+ * \return Signed count of microseconds
+ */
+int32_t joy_timer_delta(const struct timeval *start,
+                        const struct timeval *t) {
+    int64_t d = ((int64_t)t->tv_sec - start->tv_sec) * 1000000 + (t->tv_usec - start->tv_usec);
+
+    if (d > INT32_MAX) {
+        d = INT32_MAX;
+    } else if (d < INT32_MIN) {
+        d = INT32_MIN;
+    }
+    return (int32_t)d;
+}
+
+/**
+ * \brief The time \p delta microseconds after \p start.
+ * \param start Start of the series
+ * \param delta Signed count of microseconds
+ * \param result The time
+ * \return none
+ */
+void joy_timer_add_delta(const struct timeval *start,
+                         int32_t delta,
+                         struct timeval *result) {
+    int64_t usec = (int64_t)start->tv_usec + delta;
+    int64_t sec = usec / 1000000;
+
+    usec -= sec * 1000000;
+    if (usec < 0) {
+        usec += 1000000;
+        --sec;
+    }
+    result->tv_sec = start->tv_sec + sec;
+    result->tv_usec = usec;
+}
+
+/**
+ * \brief Store entry \p i of a time series; entry 0 sets its start.
+ * \param start Start of the series
+ * \param deltas Entries of the series
+ * \param i Index of the entry
+ * \param t Time to store
+ * \return none
+ */
+void joy_timer_series_set(struct timeval *start,
+                          int32_t *deltas,
+                          unsigned int i,
+                          const struct timeval *t) {
+    if (i == 0) {
+        *start = *t;
+    }
+    deltas[i] = joy_timer_delta(start, t);
+}
+
+/**
+ * \brief Get entry \p i of a time series.
+ * \param start Start of the series
+ * \param deltas Entries of the series
+ * \param i Index of the entry
+ * \param result The time of the entry
+ * \return none
+ */
+void joy_timer_series_get(const struct timeval *start,
+                          const int32_t *deltas,
+                          unsigned int i,
+                          struct timeval *result) {
+    joy_timer_add_delta(start, deltas[i], result);
+}
+
 void joy_log_timestamp(char *log_ts) {
     struct timeval tv;
     time_t nowtime;
@@ -0,0 +1,224 @@
+#!/usr/bin/env python
+"""
+ *
+ * Copyright (c) 2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Benchmark of live capture: sends UDP packets over a veth pair, from a
+network namespace to joy on the other end, and runs joy once with each
+of the capture backends of a build with af_packet (capture=af_packet,
+and capture=af_xdp in copy and auto mode).  For each it reports the
+packets joy received, and the CPU time it spent on them.  Needs root, iproute2, and a joy built with
+--enable-af_packet.
+
+    sudo ./bench_capture.py --joy ../bin/joy --seconds 10 --threads 2
+"""
+
+import argparse
+import os
+import re
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+NETNS = 'joybench'
+CAPTURE_IF = 'jbcap'
+SEND_IF = 'jbgen'
+
+# the runs: name and joy options
+BACKENDS = [
+    ('af_packet', ['capture=af_packet']),
+    ('af_xdp copy', ['capture=af_xdp', 'xdp_mode=copy']),
+    ('af_xdp auto', ['capture=af_xdp', 'xdp_mode=auto']),
+]
+
+
+def checksum(data):
+    if len(data) % 2:
+        data += b'\0'
+    total = sum(struct.unpack('!%dH' % (len(data) // 2), data))
+    total = (total >> 16) + (total & 0xffff)
+    total += total >> 16
+    return ~total & 0xffff
+
+
+def make_frames(flows, size):
+    """
+    Build one Ethernet frame of UDP over IPv4 for each flow; the flows
+    differ in their source port, which spreads them over the receive
+    queues.
+    :param flows: Number of frames
+    :param size: Length of each frame
+    :return: List of frames
+    """
+    frames = []
+    payload = b'x' * max(size - 42, 0)
+    for i in range(flows):
+        udp = struct.pack('!HHHH', 1024 + i, 53, 8 + len(payload), 0) + payload
+        ip = struct.pack('!BBHHHBBH4s4s', 0x45, 0, 20 + len(udp), i & 0xffff, 0, 64, 17, 0,
+                         socket.inet_aton('10.201.0.2'), socket.inet_aton('10.201.0.1'))
+        ip = ip[:10] + struct.pack('!H', checksum(ip)) + ip[12:]
+        eth = b'\x02\x00\x00\x00\x00\x01' + b'\x02\x00\x00\x00\x00\x02' + b'\x08\x00'
+        frames.append(eth + ip + udp)
+    return frames
+
+
+def send(interface, seconds, flows, size):
+    """
+    Send frames on interface as fast as this process can for a number
+    of seconds, and print how many were sent.
+    """
+    sock = socket.socket(socket.AF_PACKET, socket.SOCK_RAW)
+    sock.bind((interface, 0))
+    frames = make_frames(flows, size)
+    sent = 0
+    end = time.time() + seconds
+    while time.time() < end:
+        for frame in frames:
+            try:
+                sock.send(frame)
+                sent += 1
+            except socket.error:
+                pass
+    print(sent)
+
+
+def ip(*args):
+    subprocess.check_call(['ip'] + list(args))
+
+
+def setup(queues):
+    teardown()
+    ip('netns', 'add', NETNS)
+    ip('link', 'add', CAPTURE_IF, 'numrxqueues', str(queues), 'numtxqueues', str(queues), 'type', 'veth',
+       'peer', 'name', SEND_IF, 'numrxqueues', str(queues), 'numtxqueues', str(queues))
+    ip('link', 'set', SEND_IF, 'netns', NETNS)
+    # joy only captures on an interface with an address
+    ip('addr', 'add', '10.201.0.1/24', 'dev', CAPTURE_IF)
+    ip('link', 'set', CAPTURE_IF, 'up')
+    ip('netns', 'exec', NETNS, 'ip', 'addr', 'add', '10.201.0.2/24', 'dev', SEND_IF)
+    ip('netns', 'exec', NETNS, 'ip', 'link', 'set', SEND_IF, 'up')
+
+
+def teardown():
+    with open(os.devnull, 'w') as devnull:
+        subprocess.call(['ip', 'link', 'del', CAPTURE_IF], stderr=devnull)
+        subprocess.call(['ip', 'netns', 'del', NETNS], stderr=devnull)
+
+
+def cpu_seconds(pid):
+    """
+    :return: User and system time of the process pid, in seconds
+    """
+    with open('/proc/%d/stat' % pid) as f:
+        fields = f.read().rsplit(')', 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / float(os.sysconf('SC_CLK_TCK'))
+
+
+def count_packets(log):
+    """
+    Add up the packets that the stats thread of the capture backend
+    reports joy received each second.
+    :param log: Output of joy on stderr
+    :return: Number of packets
+    """
+    return sum(int(n) for n in re.findall(r'rec(?:ie|ei)ved packets +(\d+)', log))
+
+
+def run(joy, options, args, workdir):
+    """
+    Run joy on the capture interface while the frames are sent to it.
+    :return: (sent, captured, cpu seconds)
+    """
+    output = os.path.join(workdir, 'bench.json')
+    if os.path.exists(output):
+        os.remove(output)
+    with open(os.path.join(workdir, 'joy.log'), 'w+') as log:
+        proc = subprocess.Popen([joy, 'interface=' + CAPTURE_IF, 'output=bench.json', 'username=' + args.user,
+                                 'threads=%d' % args.threads] + options,
+                                cwd=workdir, stdout=log, stderr=log)
+        time.sleep(2)
+        if proc.poll() is not None:
+            log.seek(0)
+            raise RuntimeError('joy exited:\n' + log.read())
+        cpu_before = cpu_seconds(proc.pid)
+        senders = [subprocess.Popen(['ip', 'netns', 'exec', NETNS, sys.executable, os.path.abspath(__file__),
+                                     '--send', '--seconds', str(args.seconds), '--flows', str(args.flows),
+                                     '--size', str(args.size)], stdout=subprocess.PIPE)
+                   for _ in range(args.senders)]
+        sent = sum(int(s.communicate()[0]) for s in senders)
+        time.sleep(1)
+        cpu = cpu_seconds(proc.pid) - cpu_before
+        proc.send_signal(signal.SIGINT)
+        proc.wait()
+        log.seek(0)
+        captured = count_packets(log.read())
+    return sent, captured, cpu
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the live capture backends of joy')
+    parser.add_argument('--joy', default='../bin/joy', help='joy binary, built with --enable-af_packet')
+    parser.add_argument('--seconds', type=int, default=10, help='seconds of traffic per run')
+    parser.add_argument('--threads', type=int, default=1, help='joy threads, and queues of the veth pair')
+    parser.add_argument('--senders', type=int, default=2, help='processes sending the traffic')
+    parser.add_argument('--flows', type=int, default=1000, help='UDP flows of the traffic')
+    parser.add_argument('--size', type=int, default=64, help='bytes of each frame')
+    parser.add_argument('--user', default='nobody', help='user joy runs as after it starts capturing')
+    parser.add_argument('--send', action='store_true', help=argparse.SUPPRESS)
+    args = parser.parse_args()
+
+    if args.send:
+        send(SEND_IF, args.seconds, args.flows, args.size)
+        return
+
+    joy = os.path.abspath(args.joy)
+    workdir = tempfile.mkdtemp()
+    os.chmod(workdir, 0o777)
+    setup(args.threads)
+    try:
+        for name, options in BACKENDS:
+            sent, captured, cpu = run(joy, options, args, workdir)
+            print('%-12s sent %9d, captured %9d (%5.1f%%), %6.2f cpu s, %8.0f packets/cpu s' %
+                  (name, sent, captured, 100.0 * captured / max(sent, 1), cpu, captured / max(cpu, 0.01)))
+    finally:
+        teardown()
+        shutil.rmtree(workdir)
+
+
+if __name__ == '__main__':
+    main()
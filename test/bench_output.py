@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+"""
+ *
+ * Copyright (c) 2019 Cisco Systems, Inc.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *   Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ *
+ *   Redistributions in binary form must reproduce the above
+ *   copyright notice, this list of conditions and the following
+ *   disclaimer in the documentation and/or other materials provided
+ *   with the distribution.
+ *
+ *   Neither the name of the Cisco Systems, Inc. nor the names of its
+ *   contributors may be used to endorse or promote products derived
+ *   from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT,
+ * STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED
+ * OF THE POSSIBILITY OF SUCH DAMAGE.
+
+Benchmark of the JSON output path: runs joy over the pcaps in
+test/pcaps, each repeated so that a run is not dominated by starting
+joy, and reports the flow records written per second.  Given a second joy binary with --baseline, for example one
+built before a change to the output code, both are run alternately
+and the speedup is reported.
+
+    ./bench_output.py --joy ../bin/joy --baseline /tmp/old/joy
+"""
+
+import argparse
+import gzip
+import os
+import shutil
+import struct
+import subprocess
+import tempfile
+import time
+
+# options that make joy print most of its record types
+DEFAULT_OPTIONS = 'bidir=1 dist=1 entropy=1 tls=1 dns=1 http=1 ssh=1 idp=1400 salt=1 ppi=1 ' \
+                  'wht=1 dhcp=1 ike=1 payload=4 hd=1'
+
+
+def repeat_pcap(src, dst, repeat):
+    """
+    Write a pcap that holds the packets of another one several times
+    over, each copy shifted in time past the flow timeouts, so that joy
+    sees repeat times as many flows in a single run.
+    :param src: Input pcap file
+    :param dst: Output pcap file
+    :param repeat: Number of copies
+    :return: None
+    """
+    with open(src, 'rb') as f:
+        data = f.read()
+    endian = '<' if data[:4] in (b'\xd4\xc3\xb2\xa1', b'\x4d\x3c\xb2\xa1') else '>'
+    records = []
+    offset = 24
+    while offset + 16 <= len(data):
+        sec, frac, caplen, wirelen = struct.unpack(endian + 'IIII', data[offset:offset + 16])
+        records.append((sec, data[offset + 4:offset + 16 + caplen]))
+        offset += 16 + caplen
+    if not records:
+        shutil.copyfile(src, dst)
+        return
+    span = max(r[0] for r in records) - min(r[0] for r in records) + 600
+    with open(dst, 'wb') as f:
+        f.write(data[:24])
+        for k in range(repeat):
+            for sec, rest in records:
+                f.write(struct.pack(endian + 'I', sec + k * span))
+                f.write(rest)
+
+
+def count_records(path):
+    """
+    Count the flow records in a joy output file.
+    :param path: Output file, compressed or not
+    :return: Number of records
+    """
+    opener = open
+    with open(path, 'rb') as f:
+        if f.read(2) == b'\x1f\x8b':
+            opener = gzip.open
+    records = 0
+    with opener(path, 'rb') as f:
+        for line in f:
+            if line.startswith(b'{"sa"'):
+                records += 1
+    return records
+
+
+def run_joy(joy, options, pcaps, workdir):
+    """
+    Run joy once over each of the pcaps.
+    :param joy: Path of the joy binary
+    :param options: List of joy options
+    :param pcaps: List of pcap files
+    :param workdir: Directory for the output files
+    :return: (seconds, records)
+    """
+    output = os.path.join(workdir, 'bench.json')
+    seconds = 0.0
+    records = 0
+    with open(os.devnull, 'w') as devnull:
+        for pcap in pcaps:
+            if os.path.exists(output):
+                os.remove(output)
+            start = time.time()
+            subprocess.call([joy, 'output=bench.json'] + options + [pcap], cwd=workdir,
+                            stdout=devnull, stderr=devnull)
+            seconds += time.time() - start
+            records += count_records(output)
+    return seconds, records
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Benchmark the joy JSON output path')
+    parser.add_argument('--joy', default='../bin/joy', help='joy binary to measure')
+    parser.add_argument('--baseline', help='joy binary to compare against')
+    parser.add_argument('--runs', type=int, default=5, help='runs per binary')
+    parser.add_argument('--repeat', type=int, default=50, help='copies of each pcap per run')
+    parser.add_argument('--options', default=DEFAULT_OPTIONS, help='joy options')
+    parser.add_argument('--pcaps', default=os.path.join(os.path.dirname(os.path.abspath(__file__)), 'pcaps'),
+                        help='directory of pcap files')
+    args = parser.parse_args()
+
+    options = args.options.split()
+    binaries = [('joy', os.path.abspath(args.joy))]
+    if args.baseline:
+        binaries.append(('baseline', os.path.abspath(args.baseline)))
+
+    workdir = tempfile.mkdtemp()
+    try:
+        pcaps = []
+        for p in sorted(os.listdir(args.pcaps)):
+            if p.endswith('.pcap'):
+                pcaps.append(os.path.join(workdir, p))
+                repeat_pcap(os.path.join(args.pcaps, p), pcaps[-1], args.repeat)
+
+        totals = dict((name, [0.0, 0]) for name, _ in binaries)
+        for _ in range(args.runs):
+            # alternate the binaries so that both see the same conditions
+            for name, joy in binaries:
+                seconds, records = run_joy(joy, options, pcaps, workdir)
+                totals[name][0] += seconds
+                totals[name][1] += records
+    finally:
+        shutil.rmtree(workdir)
+
+    rates = {}
+    for name, joy in binaries:
+        seconds, records = totals[name]
+        rates[name] = records / seconds
+        print('%-8s %s: %d records in %.3f s, %.0f records/sec' % (name, joy, records, seconds, rates[name]))
+    if args.baseline:
+        print('speedup: %.2fx' % (rates['joy'] / rates['baseline']))
+
+
+if __name__ == '__main__':
+    main()